@@ -108,6 +108,7 @@ win* {
   RC_FILE = openscad_win32.rc
   QMAKE_CXXFLAGS += -DNOGDI
   QMAKE_LFLAGS += -Wl,--stack,$$STACKSIZE
+  LIBS += -lpsapi
 }
 
 mingw* {
@@ -191,6 +192,7 @@ CONFIG += lib3mf
 CONFIG += gettext
 CONFIG += libxml2
 CONFIG += libzip
+CONFIG += zlib
 CONFIG += hidapi
 CONFIG += spnav
 CONFIG += double-conversion
@@ -200,6 +202,11 @@ experimental {
   DEFINES += ENABLE_EXPERIMENTAL
 }
 
+# add CONFIG+=tracing to compile in the trace zones of the hot paths, see src/Trace.h
+tracing {
+  DEFINES += ENABLE_TRACING
+}
+
 nogui {
   DEFINES += OPENSCAD_NOGUI
 }
@@ -251,7 +258,10 @@ HEADERS += src/AST.h \
            src/Package.h \
            src/Assignment.h \
            src/expression.h \
+           src/NumericProgram.h \
            src/function.h \
+           src/FunctionCache.h \
+           src/ModuleCallCache.h \
            src/module.h \           
            src/UserModule.h \
 
@@ -259,7 +269,10 @@ SOURCES += src/AST.cc \
            src/ModuleInstantiation.cc \
            src/Assignment.cc \
            src/expr.cc \
+           src/NumericProgram.cc \
            src/function.cc \
+           src/FunctionCache.cc \
+           src/ModuleCallCache.cc \
            src/module.cc \
            src/UserModule.cc \
            src/annotation.cc
@@ -271,7 +284,9 @@ BISONSOURCES += src/comment_parser.y
 HEADERS += src/version_check.h \
            src/version_helper.h \
            src/ProgressWidget.h \
+           src/previewworker.h \
            src/parsersettings.h \
+           src/parsecontext.h \
            src/renderer.h \
            src/settings.h \
            src/rendersettings.h \
@@ -297,6 +312,7 @@ HEADERS += src/version_check.h \
            src/builtin.h \
            src/calc.h \
            src/context.h \
+           src/VariableName.h \
            src/builtincontext.h \
            src/modcontext.h \
            src/evalcontext.h \
@@ -306,13 +322,20 @@ HEADERS += src/version_check.h \
            src/dxfdata.h \
            src/dxfdim.h \
            src/export.h \
+           src/OutputBuffer.h \
+           src/NumberFormat.h \
+           src/ZipWriter.h \
+           src/osmesh.h \
            src/stackcheck.h \
+           src/JobLimits.h \
+           src/Metrics.h \
            src/exceptions.h \
            src/grid.h \
            src/hash.h \
            src/highlighter.h \
            src/localscope.h \
            src/feature.h \
+           src/Arena.h \
            src/node.h \
            src/csgnode.h \
            src/offsetnode.h \
@@ -333,24 +356,42 @@ HEADERS += src/version_check.h \
            src/Polygon2d.h \
            src/clipper-utils.h \
            src/GeometryUtils.h \
+           src/Quickhull.h \
            src/polyset-utils.h \
            src/polyset.h \
+           src/TriangleBVH.h \
+           src/VoxelGrid.h \
+           src/VBOCache.h \
+           src/LODCache.h \
+           src/InstancedPolySet.h \
            src/printutils.h \
            src/fileutils.h \
            src/value.h \
            src/progress.h \
+           src/ThreadPool.h \
            src/editor.h \
            src/NodeVisitor.h \
            src/state.h \
            src/nodecache.h \
            src/nodedumper.h \
            src/ModuleCache.h \
+           src/NodeReuseCache.h \
            src/GeometryCache.h \
+           src/ImportCache.h \
+           src/ShardedCache.h \
+           src/DiskCache.h \
+           src/EvaluationSnapshot.h \
+           src/RenderProfile.h \
+           src/Trace.h \
+           src/InterpreterProfile.h \
+           src/ASTCache.h \
            src/GeometryEvaluator.h \
+           src/VoxelEvaluator.h \
            src/Tree.h \
            src/DrawingCallback.h \
            src/FreetypeRenderer.h \
            src/FontCache.h \
+           src/GlyphCache.h \
            src/memory.h \
            src/linalg.h \
            src/Camera.h \
@@ -420,6 +461,7 @@ SOURCES += \
 
 SOURCES += \
            src/ProgressWidget.cc \
+           src/previewworker.cc \
            src/linalg.cc \
            src/Camera.cc \
            src/handle_dep.cc \
@@ -428,6 +470,7 @@ SOURCES += \
            src/func.cc \
            src/localscope.cc \
            src/feature.cc \
+           src/Arena.cc \
            src/node.cc \
            src/context.cc \
            src/builtincontext.cc \
@@ -441,8 +484,14 @@ SOURCES += \
            src/clipper-utils.cc \
            src/polyset-utils.cc \
            src/GeometryUtils.cc \
+           src/Quickhull.cc \
+           src/TriangleBVH.cc \
+           src/VoxelGrid.cc \
            src/polyset.cc \
+           src/InstancedPolySet.cc \
            src/polyset-gl.cc \
+           src/VBOCache.cc \
+           src/LODCache.cc \
            src/csgops.cc \
            src/transform.cc \
            src/color.cc \
@@ -461,6 +510,10 @@ SOURCES += \
            src/printutils.cc \
            src/fileutils.cc \
            src/progress.cc \
+           src/JobLimits.cc \
+           src/Metrics.cc \
+           src/NumberFormat.cc \
+           src/ThreadPool.cc \
            src/parsersettings.cc \
            src/boost-utils.cc \
            src/PlatformUtils.cc \
@@ -468,13 +521,22 @@ SOURCES += \
            \
            src/nodedumper.cc \
            src/NodeVisitor.cc \
+           src/RenderProfile.cc \
+           src/InterpreterProfile.cc \
            src/GeometryEvaluator.cc \
+           src/VoxelEvaluator.cc \
            src/ModuleCache.cc \
+           src/NodeReuseCache.cc \
            src/GeometryCache.cc \
+           src/ImportCache.cc \
+           src/DiskCache.cc \
+           src/EvaluationSnapshot.cc \
+           src/ASTCache.cc \
            src/Tree.cc \
 	       src/DrawingCallback.cc \
 	       src/FreetypeRenderer.cc \
 	       src/FontCache.cc \
+	       src/GlyphCache.cc \
            \
            src/settings.cc \
            src/rendersettings.cc \
@@ -497,6 +559,9 @@ SOURCES += \
            src/export_stl.cc \
            src/export_amf.cc \
            src/export_3mf.cc \
+           src/export_osmesh.cc \
+           src/ZipWriter.cc \
+           src/osmesh.cc \
            src/export_off.cc \
            src/export_dxf.cc \
            src/export_svg.cc \
@@ -505,6 +570,7 @@ SOURCES += \
            src/import.cc \
            src/import_stl.cc \
            src/import_off.cc \
+           src/import_osmesh.cc \
            src/import_svg.cc \
            src/import_amf.cc \
            src/import_3mf.cc \
@@ -623,7 +689,13 @@ linux: {
 
 unix:!macx {
   SOURCES += src/imageutils-lodepng.cc
-  SOURCES += src/OffscreenContextGLX.cc
+  # CONFIG+=egl creates offscreen contexts without an X server
+  egl {
+    SOURCES += src/OffscreenContextEGL.cc
+    LIBS += -lEGL
+  } else {
+    SOURCES += src/OffscreenContextGLX.cc
+  }
 }
 macx {
   SOURCES += src/imageutils-macosx.cc
@@ -635,19 +707,23 @@ win* {
 }
 
 opencsg {
-  HEADERS += src/OpenCSGRenderer.h
-  SOURCES += src/OpenCSGRenderer.cc
+  HEADERS += src/OpenCSGRenderer.h \
+             src/RayMarchRenderer.h
+  SOURCES += src/OpenCSGRenderer.cc \
+             src/RayMarchRenderer.cc
 }
 
 cgal {
 HEADERS += src/cgal.h \
            src/cgalfwd.h \
            src/cgalutils.h \
+           src/CSGBackend.h \
            src/Reindexer.h \
            src/CGALCache.h \
            src/CGALRenderer.h \
            src/CGAL_Nef_polyhedron.h \
            src/cgalworker.h \
+           src/RenderFarm.h \
            src/Polygon2d-CGAL.h
 
 SOURCES += src/cgalutils.cc \
@@ -655,7 +731,12 @@ SOURCES += src/cgalutils.cc \
            src/cgalutils-project.cc \
            src/cgalutils-tess.cc \
            src/cgalutils-polyhedron.cc \
+           src/cgalutils-corefine.cc \
+           src/cgalutils-serialize.cc \
+           src/CSGBackend.cc \
+           src/CSGBackend-voxel.cc \
            src/CGALCache.cc \
+           src/RenderFarm.cc \
            src/CGALRenderer.cc \
            src/CGAL_Nef_polyhedron.cc \
            src/cgalworker.cc \
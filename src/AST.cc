@@ -1,8 +1,53 @@
 #include "AST.h"
+#include "Arena.h"
+#include <deque>
+#include <mutex>
 #include <sstream>
+#include <unordered_map>
 #include "boost-utils.h"
 
-const Location Location::NONE(0, 0, 0, 0, std::make_shared<fs::path>(fs::path{}));
+namespace {
+	struct FileTable {
+		std::mutex mutex;
+		std::deque<fs::path> paths{fs::path()}; // Id 0 is no file, elements never move
+		std::unordered_map<std::string, uint32_t> ids{{std::string(), 0}};
+	};
+
+	// Never destroyed, locations are used until exit
+	FileTable &files()
+	{
+		static FileTable *table = new FileTable;
+		return *table;
+	}
+}
+
+void *ASTNode::operator new(size_t size)
+{
+	return Arena::parse().allocate(size);
+}
+
+void ASTNode::operator delete(void *ptr, size_t size)
+{
+	Arena::parse().deallocate(ptr, size);
+}
+
+const Location Location::NONE(0, 0, 0, 0, 0);
+
+uint32_t Location::internFile(const fs::path &path)
+{
+	auto &table = files();
+	std::lock_guard<std::mutex> lock(table.mutex);
+	const auto it = table.ids.emplace(path.string(), uint32_t(table.paths.size()));
+	if (it.second) table.paths.push_back(path);
+	return it.first->second;
+}
+
+const fs::path &Location::internedFile(uint32_t file)
+{
+	auto &table = files();
+	std::lock_guard<std::mutex> lock(table.mutex);
+	return table.paths[file];
+}
 
 bool operator==(Location const& lhs, Location const& rhs){
 	return
@@ -10,7 +55,7 @@ bool operator==(Location const& lhs, Location const& rhs){
 		lhs.firstColumn() == rhs.firstColumn() &&
 		lhs.lastLine()    == rhs.lastLine() &&
 		lhs.lastColumn()  == rhs.lastColumn() &&
-		lhs.filePath()    == rhs.filePath();
+		lhs.fileId()      == rhs.fileId();
 }
 
 bool operator != (Location const& lhs, Location const& rhs)
@@ -24,7 +69,7 @@ bool Location::isNone() const{
 
 std::string Location::toRelativeString(const std::string &docPath) const{
 	if(this->isNone()) return "location unknown";
-	return "in file "+boostfs_uncomplete((*path), docPath).generic_string()+ ", "+"line " + std::to_string(this->firstLine());
+	return "in file "+boostfs_uncomplete(filePath(), docPath).generic_string()+ ", "+"line " + std::to_string(this->firstLine());
 }
 
 std::ostream &operator<<(std::ostream &stream, const ASTNode &ast)
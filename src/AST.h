@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <memory.h>
 #include <boost/filesystem.hpp>
@@ -7,17 +8,26 @@ namespace fs = boost::filesystem;
 
 #include <string>
 
+/*!
+	A span of a source file, in 16 bytes. Files are interned once per run,
+	a location only keeps the file's id, which is looked up for messages
+	and profiles. Columns past 65535 are stored as 65535.
+*/
 class Location {
 
 public:
-	Location(int firstLine, int firstCol, int lastLine, int lastCol,
-			std::shared_ptr<fs::path> path)
-		: first_line(firstLine), first_col(firstCol), last_line(lastLine),
-		last_col(lastCol), path(std::move(path)) {
+	Location(int firstLine, int firstCol, int lastLine, int lastCol, uint32_t file)
+		: file(file), first_line(firstLine), last_line(lastLine),
+		first_col(clampColumn(firstCol)), last_col(clampColumn(lastCol)) {
 	}
 
-	std::string fileName() const { return path ? path->generic_string() : ""; }
-	const fs::path& filePath() const { return *path; }
+	// The id of path, the same for equal paths. Ids stay valid for the whole run.
+	static uint32_t internFile(const fs::path &path);
+	static const fs::path &internedFile(uint32_t file);
+
+	std::string fileName() const { return filePath().generic_string(); }
+	const fs::path& filePath() const { return internedFile(file); }
+	uint32_t fileId() const { return file; }
 	int firstLine() const { return first_line; }
 	int firstColumn() const { return first_col; }
 	int lastLine() const { return last_line; }
@@ -28,11 +38,13 @@ public:
 
 	static const Location NONE;
 private:
-	int first_line;
-	int first_col;
-	int last_line;
-	int last_col;
-	std::shared_ptr<fs::path> path;
+	static uint16_t clampColumn(int col) { return col < 0 ? 0 : col > 0xffff ? 0xffff : col; }
+
+	uint32_t file;
+	int32_t first_line;
+	int32_t last_line;
+	uint16_t first_col;
+	uint16_t last_col;
 };
 
 bool operator == (Location const& lhs, Location const& rhs);
@@ -44,6 +56,10 @@ public:
 	ASTNode(const Location &loc) : loc(loc) {}
 	virtual ~ASTNode() {}
 
+	// Nodes are allocated from Arena::parse()
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+
 	virtual void print(std::ostream &stream, const std::string &indent) const = 0;
 
 	std::string dump(const std::string &indent) const;
@@ -0,0 +1,689 @@
+#include "ASTCache.h"
+#include "DiskCache.h"
+#include "FileModule.h"
+#include "UserModule.h"
+#include "ModuleInstantiation.h"
+#include "expression.h"
+#include "function.h"
+#include "printutils.h"
+#include "version.h"
+#include "hash.h"
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+
+namespace {
+	const std::string ast_prefix = "ast ";
+	// Bump when the serialized format changes
+	const uint32_t ast_format_version = 1;
+
+	enum class ExprType : uint8_t {
+		NONE, UNARY, BINARY, TERNARY, ARRAY_LOOKUP, LITERAL, RANGE, VECTOR, LOOKUP,
+		MEMBER_LOOKUP, FUNCTION_CALL, ASSERT, ECHO, LET, LC_IF, LC_FOR, LC_FORC, LC_EACH, LC_LET
+	};
+
+	enum class InstType : uint8_t { MODULE, IFELSE };
+
+	template <typename T> void write_value(std::ostream &out, const T &v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	template <typename T> bool read_value(std::istream &in, T &v)
+	{
+		return bool(in.read(reinterpret_cast<char *>(&v), sizeof(T)));
+	}
+
+	void write_string(std::ostream &out, const std::string &str)
+	{
+		write_value<uint64_t>(out, str.size());
+		out.write(str.data(), str.size());
+	}
+
+	bool read_string(std::istream &in, std::string &str, size_t limit)
+	{
+		uint64_t size;
+		if (!read_value(in, size) || size > limit) return false;
+		str.resize(size);
+		return size == 0 || bool(in.read(&str[0], size));
+	}
+
+	std::string cache_id(const std::string &text, const std::string &filename, const std::string &mainFile)
+	{
+		std::ostringstream key;
+		key << openscad_versionnumber << "\n" << ast_format_version << "\n" << filename << "\n" << mainFile << "\n" << text;
+		return ast_prefix + hash128(key.str()).toString();
+	}
+
+	// The contents hash of an included file, or false if it can't be read
+	bool hash_file(const std::string &filename, Hash128 &hash)
+	{
+		std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		std::ostringstream data;
+		data << in.rdbuf();
+		hash = hash128(data.str());
+		return true;
+	}
+}
+
+class ASTCache::Writer
+{
+public:
+	Writer() : out(std::ios::out | std::ios::binary) {}
+
+	// Returns false if something in the module can't be stored
+	bool write(const FileModule &module) {
+		write_string(out, module.modulePath());
+		write_string(out, module.getFilename());
+		write_value<uint64_t>(out, module.usedlibs.size());
+		for (const auto &lib : module.usedlibs) write_string(out, lib);
+		return write(module.scope);
+	}
+
+	/*!
+		The payload of the entry: the messages, the included files with their
+		contents hashes and the path table, followed by the module written.
+	*/
+	std::string payload(const FileModule &module, const std::string &messages) const {
+		std::ostringstream result(std::ios::out | std::ios::binary);
+		write_string(result, messages);
+		write_value<uint64_t>(result, module.includes.size());
+		for (const auto &inc : module.includes) {
+			write_string(result, inc.first);
+			write_string(result, inc.second.filename);
+			Hash128 hash;
+			uint8_t exists = hash_file(inc.second.filename, hash);
+			write_value(result, exists);
+			write_value(result, hash.h1);
+			write_value(result, hash.h2);
+		}
+		write_value<uint64_t>(result, this->paths.size());
+		for (const auto &path : this->paths) write_string(result, path);
+		result << out.str();
+		return result.str();
+	}
+
+private:
+	void write(const Location &loc) {
+		write_value<int32_t>(out, loc.firstLine());
+		write_value<int32_t>(out, loc.firstColumn());
+		write_value<int32_t>(out, loc.lastLine());
+		write_value<int32_t>(out, loc.lastColumn());
+		const std::string path = loc.fileName();
+		auto it = this->pathIndex.find(path);
+		if (it == this->pathIndex.end()) {
+			it = this->pathIndex.emplace(path, this->paths.size()).first;
+			this->paths.push_back(path);
+		}
+		write_value<uint32_t>(out, it->second);
+	}
+
+	bool write(const LocalScope &scope) {
+		write_value<uint64_t>(out, scope.astFunctions.size());
+		for (const auto &f : scope.astFunctions) {
+			const UserFunction &func = *f.second;
+			write_string(out, func.name);
+			write(func.location());
+			if (!write(func.definition_arguments) || !write(func.expr.get())) return false;
+		}
+		write_value<uint64_t>(out, scope.astModules.size());
+		for (const auto &m : scope.astModules) {
+			const UserModule &mod = *m.second;
+			if (mod.is_experimental()) return false;
+			write_string(out, m.first);
+			write_string(out, mod.name);
+			write(mod.location());
+			if (!write(mod.definition_arguments) || !write(mod.scope)) return false;
+		}
+		if (!write(scope.assignments)) return false;
+		write_value<uint64_t>(out, scope.children.size());
+		for (const auto &inst : scope.children) {
+			if (!write(*inst)) return false;
+		}
+		return true;
+	}
+
+	bool write(const ModuleInstantiation &inst) {
+		auto ifelse = dynamic_cast<const IfElseModuleInstantiation *>(&inst);
+		write_value(out, ifelse ? InstType::IFELSE : InstType::MODULE);
+		if (!ifelse) write_string(out, inst.name());
+		write_string(out, inst.path());
+		write(inst.location());
+		uint8_t tags = (inst.tag_root ? 1 : 0) | (inst.tag_highlight ? 2 : 0) | (inst.tag_background ? 4 : 0);
+		write_value(out, tags);
+		if (ifelse) {
+			if (inst.arguments.size() != 1 || !write(inst.arguments[0].expr.get())) return false;
+		}
+		else if (!write(inst.arguments)) return false;
+		if (!write(inst.scope)) return false;
+		return !ifelse || write(ifelse->else_scope);
+	}
+
+	bool write(const AssignmentList &args) {
+		write_value<uint64_t>(out, args.size());
+		for (const auto &arg : args) {
+			if (arg.hasAnnotations()) return false;
+			write_string(out, arg.name);
+			write(arg.location());
+			if (!write(arg.expr.get())) return false;
+		}
+		return true;
+	}
+
+	bool write(const ValuePtr &value) {
+		const auto type = value->type();
+		write_value<uint8_t>(out, static_cast<uint8_t>(type));
+		switch (type) {
+		case Value::ValueType::UNDEFINED: return true;
+		case Value::ValueType::BOOL: write_value<uint8_t>(out, value->toBool()); return true;
+		case Value::ValueType::NUMBER: write_value(out, value->toDouble()); return true;
+		case Value::ValueType::STRING: write_string(out, value->toString()); return true;
+		case Value::ValueType::VECTOR:
+			write_value<uint64_t>(out, value->toVector().size());
+			for (const auto &v : value->toVector()) {
+				if (!write(v)) return false;
+			}
+			return true;
+		default: return false;
+		}
+	}
+
+	// Writes expr, which may be null
+	bool write(const Expression *expr) {
+		if (!expr) {
+			write_value(out, ExprType::NONE);
+			return true;
+		}
+		if (auto e = dynamic_cast<const UnaryOp *>(expr)) {
+			write_value(out, ExprType::UNARY);
+			write(e->location());
+			write_value<uint8_t>(out, static_cast<uint8_t>(e->op));
+			return write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const BinaryOp *>(expr)) {
+			write_value(out, ExprType::BINARY);
+			write(e->location());
+			write_value<uint8_t>(out, static_cast<uint8_t>(e->op));
+			return write(e->left.get()) && write(e->right.get());
+		}
+		if (auto e = dynamic_cast<const TernaryOp *>(expr)) {
+			write_value(out, ExprType::TERNARY);
+			write(e->location());
+			return write(e->cond.get()) && write(e->ifexpr.get()) && write(e->elseexpr.get());
+		}
+		if (auto e = dynamic_cast<const ArrayLookup *>(expr)) {
+			write_value(out, ExprType::ARRAY_LOOKUP);
+			write(e->location());
+			return write(e->array.get()) && write(e->index.get());
+		}
+		if (auto e = dynamic_cast<const Literal *>(expr)) {
+			write_value(out, ExprType::LITERAL);
+			write(e->location());
+			return write(e->value);
+		}
+		if (auto e = dynamic_cast<const Range *>(expr)) {
+			write_value(out, ExprType::RANGE);
+			write(e->location());
+			return write(e->begin.get()) && write(e->step.get()) && write(e->end.get());
+		}
+		if (auto e = dynamic_cast<const Vector *>(expr)) {
+			write_value(out, ExprType::VECTOR);
+			write(e->location());
+			write_value<uint64_t>(out, e->children.size());
+			for (const auto &child : e->children) {
+				if (!write(child.get())) return false;
+			}
+			return true;
+		}
+		if (auto e = dynamic_cast<const Lookup *>(expr)) {
+			write_value(out, ExprType::LOOKUP);
+			write(e->location());
+			write_string(out, e->name.str());
+			return true;
+		}
+		if (auto e = dynamic_cast<const MemberLookup *>(expr)) {
+			write_value(out, ExprType::MEMBER_LOOKUP);
+			write(e->location());
+			write_string(out, e->member);
+			return write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const FunctionCall *>(expr)) {
+			write_value(out, ExprType::FUNCTION_CALL);
+			write(e->location());
+			write_string(out, e->name);
+			return write(e->arguments);
+		}
+		if (auto e = dynamic_cast<const Assert *>(expr)) {
+			write_value(out, ExprType::ASSERT);
+			write(e->location());
+			return write(e->arguments) && write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const Echo *>(expr)) {
+			write_value(out, ExprType::ECHO);
+			write(e->location());
+			return write(e->arguments) && write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const Let *>(expr)) {
+			write_value(out, ExprType::LET);
+			write(e->location());
+			return write(e->arguments) && write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const LcIf *>(expr)) {
+			write_value(out, ExprType::LC_IF);
+			write(e->location());
+			return write(e->cond.get()) && write(e->ifexpr.get()) && write(e->elseexpr.get());
+		}
+		if (auto e = dynamic_cast<const LcFor *>(expr)) {
+			write_value(out, ExprType::LC_FOR);
+			write(e->location());
+			return write(e->arguments) && write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const LcForC *>(expr)) {
+			write_value(out, ExprType::LC_FORC);
+			write(e->location());
+			return write(e->arguments) && write(e->incr_arguments) && write(e->cond.get()) && write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const LcEach *>(expr)) {
+			write_value(out, ExprType::LC_EACH);
+			write(e->location());
+			return write(e->expr.get());
+		}
+		if (auto e = dynamic_cast<const LcLet *>(expr)) {
+			write_value(out, ExprType::LC_LET);
+			write(e->location());
+			return write(e->arguments) && write(e->expr.get());
+		}
+		return false;
+	}
+
+	std::ostringstream out;
+	std::unordered_map<std::string, uint32_t> pathIndex;
+	std::vector<std::string> paths;
+};
+
+/*!
+	Reads what Writer wrote. Any inconsistency, e.g. from a truncated file,
+	makes reading fail rather than crash: counts and sizes are checked
+	against the size of the data.
+*/
+class ASTCache::Reader
+{
+public:
+	Reader(const std::string &data) : in(data, std::ios::in | std::ios::binary), limit(data.size()) {}
+
+	// Reads the messages and the included files, which the caller must check
+	bool readHeader(std::string &messages, std::vector<std::pair<std::string, std::string>> &includes,
+									std::vector<std::pair<bool, Hash128>> &hashes) {
+		if (!read_string(in, messages, limit)) return false;
+		uint64_t n;
+		if (!read_value(in, n) || n > limit) return false;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::string localpath, fullpath;
+			uint8_t exists;
+			Hash128 hash;
+			if (!read_string(in, localpath, limit) || !read_string(in, fullpath, limit) ||
+					!read_value(in, exists) || !read_value(in, hash.h1) || !read_value(in, hash.h2)) {
+				return false;
+			}
+			includes.emplace_back(localpath, fullpath);
+			hashes.emplace_back(exists != 0, hash);
+		}
+		if (!read_value(in, n) || n > limit) return false;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::string path;
+			if (!read_string(in, path, limit)) return false;
+			this->paths.push_back(Location::internFile(path));
+		}
+		return true;
+	}
+
+	FileModule *readModule(const std::vector<std::pair<std::string, std::string>> &includes) {
+		std::string path, filename;
+		if (!read_string(in, path, limit) || !read_string(in, filename, limit)) return nullptr;
+		std::unique_ptr<FileModule> module(new FileModule(path, filename));
+		uint64_t n;
+		if (!read_value(in, n) || n > limit) return nullptr;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::string lib;
+			if (!read_string(in, lib, limit)) return nullptr;
+			module->usedlibs.insert(lib);
+		}
+		for (const auto &inc : includes) module->registerInclude(inc.first, inc.second);
+		if (!read(module->scope)) return nullptr;
+		return module.release();
+	}
+
+private:
+	bool read(Location &loc) {
+		int32_t firstLine, firstCol, lastLine, lastCol;
+		uint32_t path;
+		if (!read_value(in, firstLine) || !read_value(in, firstCol) || !read_value(in, lastLine) ||
+				!read_value(in, lastCol) || !read_value(in, path) || path >= this->paths.size()) {
+			return false;
+		}
+		loc = Location(firstLine, firstCol, lastLine, lastCol, this->paths[path]);
+		return true;
+	}
+
+	bool read(LocalScope &scope) {
+		uint64_t n;
+		if (!read_value(in, n) || n > limit) return false;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::string name;
+			Location loc = Location::NONE;
+			AssignmentList args;
+			std::unique_ptr<Expression> expr;
+			if (!read_string(in, name, limit) || !read(loc) || !read(args) || !read(expr)) return false;
+			scope.addFunction(UserFunction::create(name.c_str(), args, shared_ptr<Expression>(expr.release()), loc));
+		}
+		if (!read_value(in, n) || n > limit) return false;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::string key, name;
+			Location loc = Location::NONE;
+			if (!read_string(in, key, limit) || !read_string(in, name, limit) || !read(loc)) return false;
+			UserModule *mod = new UserModule(name.c_str(), loc);
+			scope.addModule(key, mod);
+			if (!read(mod->definition_arguments) || !read(mod->scope)) return false;
+		}
+		AssignmentList assignments;
+		if (!read(assignments)) return false;
+		for (const auto &ass : assignments) scope.addAssignment(ass);
+		if (!read_value(in, n) || n > limit) return false;
+		for (uint64_t i = 0; i < n; ++i) {
+			ModuleInstantiation *inst = read();
+			if (!inst) return false;
+			scope.addChild(inst);
+		}
+		return true;
+	}
+
+	ModuleInstantiation *read() {
+		InstType type;
+		std::string name, path;
+		Location loc = Location::NONE;
+		uint8_t tags;
+		if (!read_value(in, type)) return nullptr;
+		if (type != InstType::IFELSE && (type != InstType::MODULE || !read_string(in, name, limit))) return nullptr;
+		if (!read_string(in, path, limit) || !read(loc) || !read_value(in, tags)) return nullptr;
+
+		std::unique_ptr<ModuleInstantiation> inst;
+		IfElseModuleInstantiation *ifelse = nullptr;
+		if (type == InstType::IFELSE) {
+			std::unique_ptr<Expression> cond;
+			if (!read(cond) || !cond) return nullptr;
+			ifelse = new IfElseModuleInstantiation(shared_ptr<Expression>(cond.release()), path, loc);
+			inst.reset(ifelse);
+		}
+		else {
+			AssignmentList args;
+			if (!read(args)) return nullptr;
+			inst.reset(new ModuleInstantiation(name, args, path, loc));
+		}
+		inst->tag_root = tags & 1;
+		inst->tag_highlight = tags & 2;
+		inst->tag_background = tags & 4;
+		if (!read(inst->scope)) return nullptr;
+		if (ifelse && !read(ifelse->else_scope)) return nullptr;
+		return inst.release();
+	}
+
+	bool read(AssignmentList &args) {
+		uint64_t n;
+		if (!read_value(in, n) || n > limit) return false;
+		for (uint64_t i = 0; i < n; ++i) {
+			std::string name;
+			Location loc = Location::NONE;
+			std::unique_ptr<Expression> expr;
+			if (!read_string(in, name, limit) || !read(loc) || !read(expr)) return false;
+			args.emplace_back(name, shared_ptr<Expression>(expr.release()), loc);
+		}
+		return true;
+	}
+
+	bool read(ValuePtr &value) {
+		uint8_t type;
+		if (!read_value(in, type)) return false;
+		switch (static_cast<Value::ValueType>(type)) {
+		case Value::ValueType::UNDEFINED:
+			value = ValuePtr::undefined;
+			return true;
+		case Value::ValueType::BOOL: {
+			uint8_t b;
+			if (!read_value(in, b)) return false;
+			value = ValuePtr(b != 0);
+			return true;
+		}
+		case Value::ValueType::NUMBER: {
+			double d;
+			if (!read_value(in, d)) return false;
+			value = ValuePtr(d);
+			return true;
+		}
+		case Value::ValueType::STRING: {
+			std::string str;
+			if (!read_string(in, str, limit)) return false;
+			value = ValuePtr(str);
+			return true;
+		}
+		case Value::ValueType::VECTOR: {
+			uint64_t n;
+			if (!read_value(in, n) || n > limit) return false;
+			Value::VectorType vec;
+			vec.reserve(n);
+			for (uint64_t i = 0; i < n; ++i) {
+				ValuePtr v;
+				if (!read(v)) return false;
+				vec.push_back(v);
+			}
+			value = ValuePtr(std::move(vec));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	// Reads an expression, which may be null
+	bool read(std::unique_ptr<Expression> &expr) {
+		expr.reset();
+		ExprType type;
+		if (!read_value(in, type)) return false;
+		if (type == ExprType::NONE) return true;
+		Location loc = Location::NONE;
+		if (!read(loc)) return false;
+
+		switch (type) {
+		case ExprType::UNARY: {
+			uint8_t op;
+			std::unique_ptr<Expression> e;
+			if (!read_value(in, op) || op > static_cast<uint8_t>(UnaryOp::Op::Negate) || !read(e) || !e) return false;
+			expr.reset(new UnaryOp(static_cast<UnaryOp::Op>(op), e.release(), loc));
+			return true;
+		}
+		case ExprType::BINARY: {
+			uint8_t op;
+			std::unique_ptr<Expression> left, right;
+			if (!read_value(in, op) || op > static_cast<uint8_t>(BinaryOp::Op::NotEqual) ||
+					!read(left) || !left || !read(right) || !right) {
+				return false;
+			}
+			expr.reset(new BinaryOp(left.release(), static_cast<BinaryOp::Op>(op), right.release(), loc));
+			return true;
+		}
+		case ExprType::TERNARY: {
+			std::unique_ptr<Expression> cond, ifexpr, elseexpr;
+			if (!read(cond) || !cond || !read(ifexpr) || !ifexpr || !read(elseexpr) || !elseexpr) return false;
+			expr.reset(new TernaryOp(cond.release(), ifexpr.release(), elseexpr.release(), loc));
+			return true;
+		}
+		case ExprType::ARRAY_LOOKUP: {
+			std::unique_ptr<Expression> array, index;
+			if (!read(array) || !array || !read(index) || !index) return false;
+			expr.reset(new ArrayLookup(array.release(), index.release(), loc));
+			return true;
+		}
+		case ExprType::LITERAL: {
+			ValuePtr value;
+			if (!read(value)) return false;
+			expr.reset(new Literal(value, loc));
+			return true;
+		}
+		case ExprType::RANGE: {
+			std::unique_ptr<Expression> begin, step, end;
+			if (!read(begin) || !begin || !read(step) || !read(end) || !end) return false;
+			if (step) expr.reset(new Range(begin.release(), step.release(), end.release(), loc));
+			else expr.reset(new Range(begin.release(), end.release(), loc));
+			return true;
+		}
+		case ExprType::VECTOR: {
+			uint64_t n;
+			if (!read_value(in, n) || n > limit) return false;
+			auto vec = new Vector(loc);
+			expr.reset(vec);
+			for (uint64_t i = 0; i < n; ++i) {
+				std::unique_ptr<Expression> child;
+				if (!read(child) || !child) return false;
+				vec->push_back(child.release());
+			}
+			vec->finish();
+			return true;
+		}
+		case ExprType::LOOKUP: {
+			std::string name;
+			if (!read_string(in, name, limit) || name.empty()) return false;
+			expr.reset(new Lookup(name, loc));
+			return true;
+		}
+		case ExprType::MEMBER_LOOKUP: {
+			std::string member;
+			std::unique_ptr<Expression> e;
+			if (!read_string(in, member, limit) || !read(e) || !e) return false;
+			expr.reset(new MemberLookup(e.release(), member, loc));
+			return true;
+		}
+		case ExprType::FUNCTION_CALL: {
+			std::string name;
+			AssignmentList args;
+			if (!read_string(in, name, limit) || !read(args)) return false;
+			expr.reset(new FunctionCall(name, args, loc));
+			return true;
+		}
+		case ExprType::ASSERT:
+		case ExprType::ECHO:
+		case ExprType::LET: {
+			AssignmentList args;
+			std::unique_ptr<Expression> e;
+			if (!read(args) || !read(e)) return false;
+			if (type == ExprType::ASSERT) expr.reset(new Assert(args, e.release(), loc));
+			else if (type == ExprType::ECHO) expr.reset(new Echo(args, e.release(), loc));
+			else if (e) expr.reset(new Let(args, e.release(), loc));
+			return bool(expr);
+		}
+		case ExprType::LC_IF: {
+			std::unique_ptr<Expression> cond, ifexpr, elseexpr;
+			if (!read(cond) || !cond || !read(ifexpr) || !ifexpr || !read(elseexpr)) return false;
+			expr.reset(new LcIf(cond.release(), ifexpr.release(), elseexpr.release(), loc));
+			return true;
+		}
+		case ExprType::LC_FOR: {
+			AssignmentList args;
+			std::unique_ptr<Expression> e;
+			if (!read(args) || args.size() != 1 || !read(e) || !e) return false;
+			expr.reset(new LcFor(args, e.release(), loc));
+			return true;
+		}
+		case ExprType::LC_FORC: {
+			AssignmentList args, incrargs;
+			std::unique_ptr<Expression> cond, e;
+			if (!read(args) || !read(incrargs) || !read(cond) || !cond || !read(e) || !e) return false;
+			expr.reset(new LcForC(args, incrargs, cond.release(), e.release(), loc));
+			return true;
+		}
+		case ExprType::LC_EACH: {
+			std::unique_ptr<Expression> e;
+			if (!read(e) || !e) return false;
+			expr.reset(new LcEach(e.release(), loc));
+			return true;
+		}
+		case ExprType::LC_LET: {
+			AssignmentList args;
+			std::unique_ptr<Expression> e;
+			if (!read(args) || !read(e) || !e) return false;
+			expr.reset(new LcLet(args, e.release(), loc));
+			return true;
+		}
+		default:
+			return false;
+		}
+	}
+
+	std::istringstream in;
+	size_t limit;
+	std::vector<uint32_t> paths; // Interned, see Location::internFile()
+};
+
+/*!
+	Returns the module parsed from text earlier, as stored by store(), or
+	nullptr if there is none or any included file changed since.
+*/
+FileModule *ASTCache::load(const std::string &text, const std::string &filename, const std::string &mainFile)
+{
+	auto disk = DiskCache::instance();
+	if (!disk->isEnabled()) return nullptr;
+	const std::string id = cache_id(text, filename, mainFile);
+	std::string data;
+	if (!disk->getData(id, data)) return nullptr;
+
+	Reader reader(data);
+	std::string messages;
+	std::vector<std::pair<std::string, std::string>> includes;
+	std::vector<std::pair<bool, Hash128>> hashes;
+	if (!reader.readHeader(messages, includes, hashes)) {
+		disk->remove(id);
+		return nullptr;
+	}
+	// Parsing again would stop on the first warning
+	if (OpenSCAD::hardwarnings && !messages.empty()) return nullptr;
+	for (size_t i = 0; i < includes.size(); ++i) {
+		Hash128 hash;
+		const bool exists = hash_file(includes[i].second, hash);
+		if (exists != hashes[i].first || (exists && hash != hashes[i].second)) {
+			// Make room for the entry of the new parse
+			disk->remove(id);
+			return nullptr;
+		}
+	}
+	FileModule *module = reader.readModule(includes);
+	if (!module) {
+		disk->remove(id);
+		return nullptr;
+	}
+	PRINTDB("AST cache hit: %s", filename);
+
+	std::vector<std::string> lines;
+	if (!messages.empty()) boost::split(lines, messages, boost::is_any_of("\n"));
+	for (const auto &msg : lines) PRINT(msg);
+	return module;
+}
+
+/*!
+	Stores module, which was parsed from text and printed the given messages
+	while parsing. Modules with parts which can't be stored are skipped.
+*/
+void ASTCache::store(const std::string &text, const std::string &filename, const std::string &mainFile,
+										 const FileModule &module, const std::string &messages)
+{
+	auto disk = DiskCache::instance();
+	if (!disk->isEnabled()) return;
+	Writer writer;
+	if (!writer.write(module)) {
+		PRINTDB("Not caching the AST of %s", filename);
+		return;
+	}
+	disk->insertData(cache_id(text, filename, mainFile), writer.payload(module, messages));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <string>
+
+class FileModule;
+
+/*!
+	Parsed library files, kept in the DiskCache so that processes using the
+	same libraries don't have to parse them again.
+
+	Entries are keyed by a hash of the OpenSCAD version, the file name, the
+	main file and the text to parse (which includes the command line
+	assignments). Included files are part of the AST as well, so an entry
+	also records the contents hash of each file included, and is only used
+	while all of them are unchanged. The messages printed while parsing are
+	stored along and repeated when loading.
+
+	Like the DiskCache, this is disabled until a cache directory is set.
+*/
+class ASTCache
+{
+public:
+	static FileModule *load(const std::string &text, const std::string &filename, const std::string &mainFile);
+	static void store(const std::string &text, const std::string &filename, const std::string &mainFile,
+										const FileModule &module, const std::string &messages);
+
+private:
+	class Writer;
+	class Reader;
+};
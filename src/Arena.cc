@@ -0,0 +1,171 @@
+#include "Arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if defined(__GLIBC__) || defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// At the start of each slab, so the slab of a block is found by its address
+struct Arena::Slab {
+	size_t sizeclass;
+	size_t live; // Blocks in use
+	bool released;
+};
+
+const size_t Arena::headersize = (sizeof(Arena::Slab) + Arena::granularity - 1) / Arena::granularity * Arena::granularity;
+
+namespace {
+	const size_t keptslabs = 16; // Per arena, by releaseAll()
+
+	size_t sizeClass(size_t size) { return (std::max(size, size_t(1)) + Arena::granularity - 1) / Arena::granularity; }
+
+	// Slabs are aligned to their size
+	void *allocateSlab()
+	{
+#ifdef _WIN32
+		void *slab = _aligned_malloc(Arena::slabsize, Arena::slabsize);
+		if (!slab) throw std::bad_alloc();
+#else
+		void *slab;
+		if (posix_memalign(&slab, Arena::slabsize, Arena::slabsize) != 0) throw std::bad_alloc();
+#endif
+		return slab;
+	}
+
+	void freeSlab(void *slab)
+	{
+#ifdef _WIN32
+		_aligned_free(slab);
+#else
+		free(slab);
+#endif
+	}
+}
+
+Arena::Arena(const char *name) : freelists(maxsize / granularity + 1, nullptr), counts{name, 0, 0, 0, 0, 0}
+{
+}
+
+void *Arena::allocate(size_t size)
+{
+	void *block;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (size > maxsize) {
+		block = ::operator new(size);
+	}
+	else {
+		const size_t sizeclass = sizeClass(size);
+		if (!this->freelists[sizeclass]) refill(sizeclass);
+		block = this->freelists[sizeclass];
+		this->freelists[sizeclass] = *static_cast<void **>(block);
+		reinterpret_cast<Slab *>(uintptr_t(block) & ~uintptr_t(slabsize - 1))->live++;
+	}
+	this->counts.allocations++;
+	this->counts.bytes += size;
+	this->counts.live += size;
+	this->counts.peak = std::max(this->counts.peak, this->counts.live);
+	return block;
+}
+
+void Arena::deallocate(void *block, size_t size)
+{
+	if (!block) return;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->counts.live -= size;
+	if (size > maxsize) return ::operator delete(block);
+	const size_t sizeclass = sizeClass(size);
+	*static_cast<void **>(block) = this->freelists[sizeclass];
+	this->freelists[sizeclass] = block;
+	reinterpret_cast<Slab *>(uintptr_t(block) & ~uintptr_t(slabsize - 1))->live--;
+}
+
+Arena::Slab *Arena::refill(size_t sizeclass)
+{
+	auto slab = static_cast<Slab *>(allocateSlab());
+	*slab = {sizeclass, 0, false};
+	this->slabs.push_back(slab);
+	this->counts.reserved += slabsize;
+
+	const size_t blocksize = sizeclass * granularity;
+	char *blocks = reinterpret_cast<char *>(slab);
+	for (size_t offset = headersize + (slabsize - headersize) / blocksize * blocksize; offset > headersize;) {
+		offset -= blocksize;
+		*reinterpret_cast<void **>(blocks + offset) = this->freelists[sizeclass];
+		this->freelists[sizeclass] = blocks + offset;
+	}
+	return slab;
+}
+
+size_t Arena::trim(size_t keep)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	size_t released = 0;
+	for (auto slab : this->slabs) {
+		if (slab->live > 0) continue;
+		if (keep > 0) keep--;
+		else {
+			slab->released = true;
+			released++;
+		}
+	}
+	if (!released) return 0;
+
+	// The free blocks of released slabs are unlinked, the others keep their order
+	for (auto &freelist : this->freelists) {
+		void **next = &freelist;
+		while (*next) {
+			if (reinterpret_cast<Slab *>(uintptr_t(*next) & ~uintptr_t(slabsize - 1))->released) {
+				*next = *static_cast<void **>(*next);
+			}
+			else next = static_cast<void **>(*next);
+		}
+	}
+	this->slabs.erase(std::remove_if(this->slabs.begin(), this->slabs.end(), [](Slab *slab) {
+		if (!slab->released) return false;
+		freeSlab(slab);
+		return true;
+	}), this->slabs.end());
+	this->counts.reserved -= released * slabsize;
+	return released * slabsize;
+}
+
+Arena::Stats Arena::stats() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->counts;
+}
+
+// Never destroyed, since cached objects may be released at exit
+Arena &Arena::parse()
+{
+	static Arena *arena = new Arena("parse");
+	return *arena;
+}
+
+Arena &Arena::instantiate()
+{
+	static Arena *arena = new Arena("instantiate");
+	return *arena;
+}
+
+Arena &Arena::evaluate()
+{
+	static Arena *arena = new Arena("evaluate");
+	return *arena;
+}
+
+std::vector<Arena::Stats> Arena::allStats()
+{
+	return {parse().stats(), instantiate().stats(), evaluate().stats()};
+}
+
+void Arena::releaseAll()
+{
+	for (auto arena : {&parse(), &instantiate(), &evaluate()}) arena->trim(keptslabs);
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+}
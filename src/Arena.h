@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/*!
+	Allocates small objects from 64 kB slabs, with a free list per size
+	class. The objects of each phase come from their own arena: AST nodes
+	from parse(), abstract nodes from instantiate() and the values of the
+	interpreter from evaluate(). They don't carry a heap header each, and
+	objects made together are stored together, instead of being scattered
+	over a heap fragmented by the geometry of earlier runs.
+
+	Each slab holds blocks of one size. trim() frees the slabs of which no
+	block is in use, so an arena shrinks once a tree and the temporaries
+	of its evaluation are gone; Tree::setRoot() trims all of them when the
+	new tree replaced the previous one (see releaseAll()).
+*/
+class Arena
+{
+public:
+	struct Stats {
+		const char *name;
+		size_t allocations; // Since the start
+		size_t bytes; // Allocated since the start
+		size_t live; // Bytes in use
+		size_t peak; // Of live
+		size_t reserved; // Bytes of the slabs
+	};
+
+	Arena(const char *name);
+	void *allocate(size_t size);
+	void deallocate(void *block, size_t size);
+	// Frees the unused slabs except for keep of them, returns the bytes freed
+	size_t trim(size_t keep = 0);
+	Stats stats() const;
+
+	static Arena &parse();
+	static Arena &instantiate();
+	static Arena &evaluate();
+	static std::vector<Stats> allStats();
+	// Trims all arenas, then returns the free memory of the heap to the system where the C library can
+	static void releaseAll();
+
+	static const size_t granularity = 16; // Which new[] aligns to
+	static const size_t maxsize = 512; // Larger objects come from the heap
+	static const size_t slabsize = 64 * 1024;
+
+private:
+	struct Slab;
+	static const size_t headersize; // Of each slab, keeps the blocks aligned
+	Slab *refill(size_t sizeclass);
+
+	mutable std::mutex mutex;
+	std::vector<void *> freelists;
+	std::vector<Slab *> slabs;
+	Stats counts;
+};
+
+/*!
+	Allocates from an arena, for allocate_shared() and containers.
+*/
+template <typename T>
+class ArenaAllocator
+{
+public:
+	typedef T value_type;
+
+	ArenaAllocator(Arena &arena) : arena(&arena) {}
+	template <typename U> ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+	T *allocate(size_t n) { return static_cast<T *>(this->arena->allocate(n * sizeof(T))); }
+	void deallocate(T *p, size_t n) { this->arena->deallocate(p, n * sizeof(T)); }
+
+	template <typename U> bool operator==(const ArenaAllocator<U> &other) const { return this->arena == other.arena; }
+	template <typename U> bool operator!=(const ArenaAllocator<U> &other) const { return this->arena != other.arena; }
+
+private:
+	template <typename U> friend class ArenaAllocator;
+	Arena *arena;
+};
@@ -5,38 +5,22 @@
 // FIXME: Default constructor Response()
 enum class Response {ContinueTraversal, AbortTraversal, PruneTraversal};
 
-class BaseVisitor
-{
-public:
-	virtual ~BaseVisitor() {}
-};
-
-template <class T>
-class Visitor
-{
-public:
-	virtual Response visit(class State &state, const T&) = 0;
-};
-
+/*!
+	A node which visitors can visit. Each visitable class declares accept()
+	with VISITABLE(), and its definition calls the visit() overload of the
+	NodeVisitor for the class, which is resolved at compile time. So a visit
+	is one virtual call, without a dynamic_cast to find the visitor.
+*/
 class BaseVisitable
 {
 public:
 	virtual ~BaseVisitable() {}
-	virtual Response accept(class State&, BaseVisitor&) const = 0;
-protected:
-	template <class T>
-	static Response acceptImpl(class State &state, const T &node, BaseVisitor &visitor) {
-		if (Visitor<T> *p = dynamic_cast<Visitor<T>*>(&visitor)) {
-			return p->visit(state, node);
-		}
-		// FIXME: If we want to allow for missing nodes in visitors, we need
-		// to handle it here, e.g. by calling some handler.
-		// See e.g. page 225 of Alexandrescu's "Modern C++ Design" 
-		return Response::AbortTraversal;
-	}
+	virtual Response accept(class State&, class NodeVisitor&) const = 0;
 };
 
 #define VISITABLE() \
-	Response accept(class State &state, BaseVisitor &visitor) const override { \
-		return acceptImpl(state, *this, visitor); \
-  }
+	Response accept(class State &state, class NodeVisitor &visitor) const override
+
+// Defines accept() of a class, where NodeVisitor is complete
+#define DEFINE_VISITABLE(T) \
+	Response T::accept(State &state, NodeVisitor &visitor) const { return visitor.visit(state, *this); }
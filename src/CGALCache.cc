@@ -1,25 +1,90 @@
 #include "CGALCache.h"
 #include "printutils.h"
 #include "CGAL_Nef_polyhedron.h"
+#include "DiskCache.h"
+#include "GeometryCache.h"
+
+#include <cstdint>
+#include <sstream>
 
 CGALCache *CGALCache::inst = nullptr;
 
-CGALCache::CGALCache(size_t limit) : cache(limit)
+namespace {
+	const std::string decomposition_prefix = "convex-decomposition ";
+
+	size_t parts_memsize(const CGALCache::ConvexParts &parts)
+	{
+		size_t memsize = sizeof(CGALCache::ConvexParts);
+		for (const auto &part : parts) memsize += sizeof(part) + part.size() * sizeof(Vector3d);
+		return memsize;
+	}
+
+	template <typename T> void write_value(std::ostream &out, const T &v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	template <typename T> bool read_value(std::istream &in, T &v)
+	{
+		return bool(in.read(reinterpret_cast<char *>(&v), sizeof(T)));
+	}
+
+	std::string write_parts(const CGALCache::ConvexParts &parts)
+	{
+		std::ostringstream out(std::ios::out | std::ios::binary);
+		write_value<uint64_t>(out, parts.size());
+		for (const auto &part : parts) {
+			write_value<uint64_t>(out, part.size());
+			for (const auto &v : part) {
+				write_value(out, v[0]); write_value(out, v[1]); write_value(out, v[2]);
+			}
+		}
+		return out.str();
+	}
+
+	bool read_parts(const std::string &data, CGALCache::ConvexParts &parts)
+	{
+		std::istringstream in(data, std::ios::in | std::ios::binary);
+		uint64_t numparts;
+		if (!read_value(in, numparts) || numparts > data.size()) return false;
+		parts.resize(numparts);
+		for (auto &part : parts) {
+			uint64_t numvertices;
+			if (!read_value(in, numvertices) || numvertices > data.size()) return false;
+			part.resize(numvertices);
+			for (auto &v : part) {
+				read_value(in, v[0]); read_value(in, v[1]); read_value(in, v[2]);
+			}
+		}
+		return bool(in);
+	}
+}
+
+CGALCache::CGALCache(size_t limit) : decompositions(limit)
+{
+	GeometryPool::instance()->setLimit(GeometryPool::Member::CGAL, limit);
+}
+
+bool CGALCache::contains(const std::string &id) const
 {
+	return GeometryPool::instance()->contains(GeometryPool::Member::CGAL, id);
 }
 
 shared_ptr<const CGAL_Nef_polyhedron> CGALCache::get(const std::string &id) const
 {
-	const auto &N = this->cache[id]->N;
+	// Only Nef polyhedra are inserted under this member
+	auto N = static_pointer_cast<const CGAL_Nef_polyhedron>(GeometryPool::instance()->get(GeometryPool::Member::CGAL, id));
 #ifdef DEBUG
-	PRINTB("CGAL Cache hit: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
+	if (N) PRINTB("CGAL Cache hit: %s (%d bytes)", id.substr(0, 40) % N->memsize());
 #endif
 	return N;
 }
 
-bool CGALCache::insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N)
+bool CGALCache::insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N, double seconds)
 {
-	auto inserted = this->cache.insert(id, new cache_entry(N), N ? N->memsize() : 0);
+	// Computed now, while only this thread uses N
+	if (N) N->getBoundingBox();
+	auto inserted = GeometryPool::instance()->insert(GeometryPool::Member::CGAL, id, N, seconds);
 #ifdef DEBUG
 	if (inserted) PRINTB("CGAL Cache insert: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
 	else PRINTB("CGAL Cache insert failed: %s (%d bytes)", id.substr(0, 40) % (N ? N->memsize() : 0));
@@ -27,29 +92,60 @@ bool CGALCache::insert(const std::string &id, const shared_ptr<const CGAL_Nef_po
 	return inserted;
 }
 
+shared_ptr<const CGALCache::ConvexParts> CGALCache::getDecomposition(const std::string &id) const
+{
+	shared_ptr<const ConvexParts> parts;
+	if (this->decompositions.get(id, parts)) return parts;
+
+	std::string data;
+	auto disk = DiskCache::instance();
+	if (!disk->getData(decomposition_prefix + id, data)) return nullptr;
+	auto diskparts = make_shared<ConvexParts>();
+	if (!read_parts(data, *diskparts)) {
+		disk->remove(decomposition_prefix + id);
+		return nullptr;
+	}
+	this->decompositions.insert(id, diskparts, parts_memsize(*diskparts));
+	return diskparts;
+}
+
+bool CGALCache::insertDecomposition(const std::string &id, const shared_ptr<const ConvexParts> &parts)
+{
+	DiskCache::instance()->insertData(decomposition_prefix + id, write_parts(*parts));
+	return this->decompositions.insert(id, parts, parts_memsize(*parts));
+}
+
 size_t CGALCache::maxSizeMB() const
 {
-	return this->cache.maxCost()/(1024*1024);
+	return GeometryPool::instance()->limit(GeometryPool::Member::CGAL)/(1024*1024);
 }
 
 void CGALCache::setMaxSizeMB(size_t limit)
 {
-	this->cache.setMaxCost(limit*1024*1024);
+	GeometryPool::instance()->setLimit(GeometryPool::Member::CGAL, limit*1024*1024);
+	this->decompositions.setMaxCost(limit*1024*1024);
 }
 
 void CGALCache::clear()
 {
-	cache.clear();
+	GeometryPool::instance()->clear(GeometryPool::Member::CGAL);
+	decompositions.clear();
 }
 
-void CGALCache::print()
+size_t CGALCache::hits() const
 {
-	PRINTB("CGAL Polyhedrons in cache: %d", this->cache.size());
-	PRINTB("CGAL cache size in bytes: %d", this->cache.totalCost());
+	return GeometryPool::instance()->hits(GeometryPool::Member::CGAL);
 }
 
-CGALCache::cache_entry::cache_entry(const shared_ptr<const CGAL_Nef_polyhedron> &N)
-	: N(N)
+size_t CGALCache::misses() const
+{
+	return GeometryPool::instance()->misses(GeometryPool::Member::CGAL);
+}
+
+void CGALCache::print()
 {
-	if (print_messages_stack.size() > 0) this->msg = print_messages_stack.back();
+	const auto usage = GeometryPool::instance()->usage(GeometryPool::Member::CGAL);
+	PRINTB("CGAL Polyhedrons in cache: %d", usage.first);
+	PRINTB("CGAL cache size in bytes: %d", usage.second);
+	PRINTB("Convex decompositions in cache: %d", this->decompositions.size());
 }
@@ -1,9 +1,18 @@
 #pragma once
 
-#include "cache.h"
+#include <vector>
+#include "ShardedCache.h"
+#include "linalg.h"
 #include "memory.h"
 
 /*!
+	Besides Nef polyhedra, this caches convex decompositions as used by
+	Minkowski sums: the vertices of each convex part of an operand, keyed by
+	the operand's id. Decompositions are stored in the DiskCache as well, if
+	enabled, so they survive across runs.
+
+	The Nef polyhedra share their memory with the GeometryCache, see
+	GeometryPool; the decompositions are kept apart.
 */
 class CGALCache
 {
@@ -12,23 +21,23 @@ public:
 
 	static CGALCache *instance() { if (!inst) inst = new CGALCache; return inst; }
 
-	bool contains(const std::string &id) const { return this->cache.contains(id); }
+	bool contains(const std::string &id) const;
 	shared_ptr<const class CGAL_Nef_polyhedron> get(const std::string &id) const;
-	bool insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N);
+	// seconds is the time N took to compute, which weighs against evicting it
+	bool insert(const std::string &id, const shared_ptr<const CGAL_Nef_polyhedron> &N, double seconds = 0);
+	typedef std::vector<std::vector<Vector3d>> ConvexParts;
+	shared_ptr<const ConvexParts> getDecomposition(const std::string &id) const;
+	bool insertDecomposition(const std::string &id, const shared_ptr<const ConvexParts> &parts);
+
 	size_t maxSizeMB() const;
 	void setMaxSizeMB(size_t limit);
 	void clear();
 	void print();
+	size_t hits() const;
+	size_t misses() const;
 
 private:
 	static CGALCache *inst;
 
-	struct cache_entry {
-		shared_ptr<const CGAL_Nef_polyhedron> N;
-		std::string msg;
-		cache_entry(const shared_ptr<const CGAL_Nef_polyhedron> &N);
-		~cache_entry() { }
-	};
-
-	Cache<std::string, cache_entry> cache;
+	mutable ShardedCache<std::string, shared_ptr<const ConvexParts>> decompositions;
 };
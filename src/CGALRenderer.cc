@@ -39,6 +39,10 @@
 #include "CGAL_OGL_Polyhedron.h"
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
+#include "cgalutils.h"
+#include "VBOCache.h"
+#include "LODCache.h"
+#include "Trace.h"
 
 //#include "Preferences.h"
 
@@ -52,14 +56,20 @@ CGALRenderer::CGALRenderer(shared_ptr<const class Geometry> geom)
 		ps_tri->setConvexity(ps->getConvexity());
 		PolysetUtils::tessellate_faces(*ps, *ps_tri);
 		this->polyset.reset(ps_tri);
+		this->faces = this->polyset;
 	}
 	else if (auto poly = dynamic_pointer_cast<const Polygon2d>(geom)) {
 		this->polyset.reset(poly->tessellate());
+		// 2D PolySets are drawn as slabs, so draw the triangles as 3D ones at z=0
+		auto flat = new PolySet(3);
+		flat->mutablePolygons() = this->polyset->polygons();
+		this->faces.reset(flat);
 	}
 	else if (auto new_N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
 		assert(new_N->getDimension() == 3);
 		if (!new_N->isEmpty()) {
 			this->N = new_N;
+			buildNefMeshes();
 		}
 	}
 }
@@ -85,6 +95,47 @@ void CGALRenderer::buildPolyhedron() const
 	PRINTD("buildPolyhedron() end");
 }
 
+/*!
+	Converts N to the triangles and facet outlines drawn from vertex buffers.
+	Leaves them unset if N isn't a valid mesh; it's then drawn through the
+	polyhedron, so the errors of the conversion aren't reported.
+*/
+void CGALRenderer::buildNefMeshes()
+{
+	PRINTD("buildNefMeshes");
+	const CGAL_Nef_polyhedron3 &N = *this->N->p3;
+	auto ps = new PolySet(3);
+	bool err;
+	{
+		PrintCapture messages;
+		PrintCapture::Scope scope(messages);
+		err = CGALUtils::createPolySetFromNefPolyhedron3(N, *ps);
+	}
+	if (err) {
+		delete ps;
+		return;
+	}
+	this->faces.reset(ps);
+
+	auto outlines = new PolySet(3);
+	CGAL_Nef_polyhedron3::Halffacet_const_iterator hfaceti;
+	CGAL_forall_halffacets(hfaceti, N) {
+		// Each facet has one halffacet facing the 0-mark-volume, the empty space
+		if (hfaceti->incident_volume()->mark()) continue;
+		CGAL_Nef_polyhedron3::Halffacet_cycle_const_iterator cyclei;
+		CGAL_forall_facet_cycles_of(cyclei, hfaceti) {
+			CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c1(cyclei);
+			CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c2(c1);
+			outlines->append_poly();
+			CGAL_For_all(c1, c2) {
+				outlines->append_vertex(vector_convert<Vector3d>(c1->source()->center_vertex()->point()));
+			}
+		}
+	}
+	this->edges.reset(outlines);
+	PRINTD("buildNefMeshes() end");
+}
+
 // Overridden from Renderer
 void CGALRenderer::setColorScheme(const ColorScheme &cs)
 {
@@ -96,6 +147,7 @@ void CGALRenderer::setColorScheme(const ColorScheme &cs)
 
 void CGALRenderer::draw(bool showfaces, bool showedges) const
 {
+	TRACE_ZONE("CGALRenderer::draw");
 	PRINTD("draw()");
 	if (this->polyset) {
 		PRINTD("draw() polyset");
@@ -105,13 +157,15 @@ void CGALRenderer::draw(bool showfaces, bool showedges) const
 // FIXME:		const QColor &col = Preferences::inst()->color(Preferences::CGAL_FACE_2D_COLOR);
 			glColor3f(0.0f, 0.75f, 0.60f);
 
-			for (size_t i=0; i < this->polyset->polygons.size(); i++) {
-				glBegin(GL_POLYGON);
-				for (size_t j=0; j < this->polyset->polygons[i].size(); j++) {
-					const auto &p = this->polyset->polygons[i][j];
-					glVertex3d(p[0], p[1], 0);
+			if (!VBOCache::instance()->renderSurface(this->faces, CSGMODE_NORMAL, Transform3d::Identity(), nullptr)) {
+				for (size_t i=0; i < this->polyset->polygons().size(); i++) {
+					glBegin(GL_POLYGON);
+					for (size_t j=0; j < this->polyset->polygons()[i].size(); j++) {
+						const auto &p = this->polyset->polygons()[i][j];
+						glVertex3d(p[0], p[1], 0);
+					}
+					glEnd();
 				}
-				glEnd();
 			}
 		
 			// Draw 2D edges
@@ -120,14 +174,31 @@ void CGALRenderer::draw(bool showfaces, bool showedges) const
 			glLineWidth(2);
 // FIXME:		const QColor &col2 = Preferences::inst()->color(Preferences::CGAL_EDGE_2D_COLOR);
 			glColor3f(1.0f, 0.0f, 0.0f);
-			this->polyset->render_edges(CSGMODE_NONE);
+			render_edges(this->polyset, CSGMODE_NONE);
 			glEnable(GL_DEPTH_TEST);
 		}
 		else {
 			// Draw 3D polygons
 			const Color4f c(-1,-1,-1,-1);	
 			setColor(ColorMode::MATERIAL, c.data(), nullptr);
-			this->polyset->render_surface(CSGMODE_NORMAL, Transform3d::Identity(), nullptr);
+			render_surface(this->polyset, CSGMODE_NORMAL, Transform3d::Identity(), nullptr);
+		}
+	}
+	else if (this->faces && VBOCache::isSupported()) {
+		PRINTD("draw() nef meshes");
+		// Same styles as CGAL_OGL_Polyhedron::draw()
+		if (showfaces) {
+			// Keep the edges drawn on top of their faces
+			glEnable(GL_POLYGON_OFFSET_FILL);
+			glPolygonOffset(1.0f, 1.0f);
+			setColor(ColorMap::getColor(*this->colorscheme, RenderColor::CGAL_FACE_FRONT_COLOR).data());
+			VBOCache::instance()->renderSurface(LODCache::instance()->lookup(this->faces), CSGMODE_NORMAL, Transform3d::Identity(), nullptr);
+			glDisable(GL_POLYGON_OFFSET_FILL);
+		}
+		if (!showfaces || showedges) {
+			glLineWidth(5);
+			setColor(ColorMap::getColor(*this->colorscheme, RenderColor::CGAL_EDGE_FRONT_COLOR).data());
+			VBOCache::instance()->renderEdges(this->edges, CSGMODE_NORMAL);
 		}
 	}
 	else {
@@ -149,6 +220,9 @@ BoundingBox CGALRenderer::getBoundingBox() const
 	if (this->polyset) {
 		bbox = this->polyset->getBoundingBox();
 	}
+	else if (this->faces) {
+		bbox = this->faces->getBoundingBox();
+	}
 	else {
 		auto polyhedron = getPolyhedron();
 		if (polyhedron) {
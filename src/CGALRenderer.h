@@ -3,6 +3,13 @@
 #include "renderer.h"
 #include "CGAL_Nef_polyhedron.h"
 
+/*!
+	Draws the result of a full render. All the mesh data is prepared in the
+	constructor, which doesn't use OpenGL and so may run on a worker thread.
+	The meshes are then drawn from vertex buffers through the VBOCache; the
+	display lists of CGAL_OGL_Polyhedron are only built for Nef polyhedra
+	where vertex buffers aren't supported or the Nef can't be converted.
+*/
 class CGALRenderer : public Renderer
 {
 public:
@@ -15,8 +22,14 @@ public:
 private:
 	shared_ptr<class CGAL_OGL_Polyhedron> getPolyhedron() const;
 	void buildPolyhedron() const;
+	void buildNefMeshes();
 
 	mutable shared_ptr<class CGAL_OGL_Polyhedron> polyhedron;
 	shared_ptr<const CGAL_Nef_polyhedron> N;
 	shared_ptr<const class PolySet> polyset;
+	// Triangles drawn from vertex buffers: polyset itself, a flat 3D copy
+	// of 2D polysets, or the triangulated N
+	shared_ptr<const PolySet> faces;
+	// The facet outlines of N
+	shared_ptr<const PolySet> edges;
 };
@@ -5,47 +5,105 @@
 #include "polyset.h"
 #include "svg.h"
 
-CGAL_Nef_polyhedron::CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3 *p)
+CGAL_Nef_polyhedron::CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3 *p) : Geometry(KIND)
 {
 	if (p) p3.reset(p);
 }
 
 // Copy constructor
-CGAL_Nef_polyhedron::CGAL_Nef_polyhedron(const CGAL_Nef_polyhedron &src)
+CGAL_Nef_polyhedron::CGAL_Nef_polyhedron(const CGAL_Nef_polyhedron &src) : Geometry(KIND)
 {
 	if (src.p3) this->p3.reset(new CGAL_Nef_polyhedron3(*src.p3));
+	this->boundingbox = std::atomic_load(&src.boundingbox);
+}
+
+/*!
+	Converting the exact coordinates of all vertices is slow, so the box is
+	computed on first use, or when the polyhedron is inserted into the
+	CGALCache, and kept until the polyhedron changes.
+*/
+BoundingBox CGAL_Nef_polyhedron::getBoundingBox() const
+{
+	auto bbox = std::atomic_load(&this->boundingbox);
+	if (!bbox) {
+		auto result = make_shared<BoundingBox>();
+		if (!this->isEmpty()) {
+			const auto bb = CGALUtils::boundingBox(*this->p3);
+			Vector3d min, max;
+			for (int i = 0; i < 3; ++i) {
+				min[i] = CGAL::to_interval(bb.min_coord(i)).first;
+				max[i] = CGAL::to_interval(bb.max_coord(i)).second;
+			}
+			result->extend(min);
+			result->extend(max);
+		}
+		bbox = result;
+		std::atomic_store(&this->boundingbox, bbox);
+	}
+	return *bbox;
 }
 
 CGAL_Nef_polyhedron& CGAL_Nef_polyhedron::operator+=(const CGAL_Nef_polyhedron &other)
 {
 	(*this->p3) += (*other.p3);
+	changed();
 	return *this;
 }
 
 CGAL_Nef_polyhedron& CGAL_Nef_polyhedron::operator*=(const CGAL_Nef_polyhedron &other)
 {
 	(*this->p3) *= (*other.p3);
+	changed();
 	return *this;
 }
 
 CGAL_Nef_polyhedron& CGAL_Nef_polyhedron::operator-=(const CGAL_Nef_polyhedron &other)
 {
 	(*this->p3) -= (*other.p3);
+	changed();
 	return *this;
 }
 
 CGAL_Nef_polyhedron &CGAL_Nef_polyhedron::minkowski(const CGAL_Nef_polyhedron &other)
 {
 	(*this->p3) = CGAL::minkowski_sum_3(*this->p3, *other.p3);
+	changed();
 	return *this;
 }
 
+/*!
+	p3->bytes() only counts the structure itself. Its exact numbers are
+	handles to separately allocated rationals, which grow with each boolean
+	and often take most of the memory. Their size is estimated from a
+	sample of the vertices: every point of a vertex or halfedge, plane of a
+	halffacet and circle of a shalfedge (about two per halfedge) holds
+	numbers of about that size.
+*/
 size_t CGAL_Nef_polyhedron::memsize() const
 {
 	if (this->isEmpty()) return 0;
 
 	auto memsize = sizeof(CGAL_Nef_polyhedron);
 	memsize += this->p3->bytes();
+
+	const size_t samples = 64;
+	size_t sampled = 0, limbbytes = 0;
+	CGAL_Nef_polyhedron3::Vertex_const_iterator vi;
+	CGAL_forall_vertices(vi, *this->p3) {
+		const auto &p = vi->point();
+		for (int i = 0; i < 3; ++i) {
+			const auto &q = CGALUtils::to_gmpq(p[i]);
+			limbbytes += (q.numerator().bit_size() + 63) / 64 * 8 + (q.denominator().bit_size() + 63) / 64 * 8;
+		}
+		if (++sampled == samples) break;
+	}
+	if (sampled > 0) {
+		// The rep of a Gmpq (mpq_t and reference count) and its three allocations
+		const size_t overhead = sizeof(NT3) + 48 + 3 * 16;
+		const size_t numbers = 3 * (this->p3->number_of_vertices() + this->p3->number_of_halfedges()) +
+			4 * (this->p3->number_of_halffacets() + 2 * this->p3->number_of_halfedges());
+		memsize += numbers * (overhead + limbbytes / (3 * sampled));
+	}
 	return memsize;
 }
 
@@ -156,6 +214,7 @@ void CGAL_Nef_polyhedron::transform( const Transform3d &matrix )
 				matrix(1,0), matrix(1,1), matrix(1,2), matrix(1,3),
 				matrix(2,0), matrix(2,1), matrix(2,2), matrix(2,3), matrix(3,3));
 			this->p3->transform(t);
+			changed();
 		}
 	}
 }
@@ -9,20 +9,22 @@
 class CGAL_Nef_polyhedron : public Geometry
 {
 public:
+	static const Kind KIND = Kind::NEF_POLYHEDRON;
+
 	CGAL_Nef_polyhedron(CGAL_Nef_polyhedron3 *p = nullptr);
 	CGAL_Nef_polyhedron(const CGAL_Nef_polyhedron &src);
 	~CGAL_Nef_polyhedron() {}
 
 	size_t memsize() const override;
-	// FIXME: Implement, but we probably want a high-resolution BBox..
-	BoundingBox getBoundingBox() const override { assert(false && "not implemented"); return BoundingBox(); }
+	// Rounded outwards and cached; use CGALUtils::boundingBox() for the exact box
+	BoundingBox getBoundingBox() const override;
 	std::string dump() const override;
 	unsigned int getDimension() const override { return 3; }
   // Empty means it is a geometric node which has zero area/volume
 	bool isEmpty() const override;
 	Geometry *copy() const override { return new CGAL_Nef_polyhedron(*this); }
 
-	void reset() { p3.reset(); }
+	void reset() { p3.reset(); changed(); }
 	CGAL_Nef_polyhedron &operator+=(const CGAL_Nef_polyhedron &other);
 	CGAL_Nef_polyhedron &operator*=(const CGAL_Nef_polyhedron &other);
 	CGAL_Nef_polyhedron &operator-=(const CGAL_Nef_polyhedron &other);
@@ -33,4 +35,10 @@ public:
 	void resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize);
 
 	shared_ptr<CGAL_Nef_polyhedron3> p3;
+
+private:
+	void changed() { this->boundingbox.reset(); }
+
+	// Shared with copies; the results of concurrent first uses are the same
+	mutable shared_ptr<const BoundingBox> boundingbox;
 };
@@ -0,0 +1,96 @@
+// Approximate voxel backend for 3D booleans, see CSGBackend
+
+#ifdef ENABLE_CGAL
+
+#include "CSGBackend.h"
+#include "cgalutils.h"
+#include "polyset.h"
+#include "printutils.h"
+#include "progress.h"
+#include "VoxelGrid.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+	double voxelsize = 0.5;
+
+	class VoxelBackend : public CSGBackend
+	{
+	public:
+		const char *name() const override { return "voxel"; }
+		std::string cacheTag() const override {
+			std::ostringstream tag;
+			tag << "~voxel" << voxelsize;
+			return tag.str();
+		}
+		shared_ptr<const Geometry> applyOperator(const Geometry::Geometries &children, OpenSCADOperator op) const override;
+	};
+
+	shared_ptr<const Geometry> VoxelBackend::applyOperator(const Geometry::Geometries &children, OpenSCADOperator op) const
+	{
+		if (op != OpenSCADOperator::UNION && op != OpenSCADOperator::INTERSECTION && op != OpenSCADOperator::DIFFERENCE) {
+			return nullptr;
+		}
+
+		std::vector<shared_ptr<const PolySet>> meshes;
+		unsigned int convexity = 1;
+		for (const auto &item : children) {
+			shared_ptr<const PolySet> ps = geometry_cast<const PolySet>(item.second);
+			if (!ps) {
+				auto N = geometry_cast<const CGAL_Nef_polyhedron>(item.second);
+				if (!N) return nullptr;
+				auto converted = make_shared<PolySet>(3);
+				if (!N->isEmpty() && CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *converted)) return nullptr;
+				ps = converted;
+			}
+			convexity = std::max(convexity, item.second->getConvexity());
+			meshes.push_back(ps);
+		}
+
+		// Where the result can be
+		BoundingBox box;
+		for (size_t i = 0; i < meshes.size(); ++i) {
+			const auto childbox = meshes[i]->getBoundingBox();
+			if (i == 0 || op == OpenSCADOperator::UNION) box.extend(childbox);
+			else if (op == OpenSCADOperator::INTERSECTION) box = box.intersection(childbox);
+			if (op == OpenSCADOperator::DIFFERENCE) break;
+		}
+		auto result = make_shared<PolySet>(3);
+		result->setConvexity(convexity);
+		if (box.isEmpty()) return result;
+
+		const double cellsize = VoxelGrid::cellSizeFor(box, voxelsize);
+		if (cellsize != voxelsize) PRINTDB("Voxel size increased to %g", cellsize);
+
+		VoxelGrid occupied(cellsize);
+		for (size_t i = 0; i < meshes.size(); ++i) {
+			progress_tick(double(i) / meshes.size());
+			VoxelGrid grid(cellsize);
+			if (!grid.insert(*meshes[i])) return nullptr;
+			if (i == 0) std::swap(occupied, grid);
+			else occupied.apply(grid, op);
+		}
+
+		occupied.triangulate(*result);
+		return result;
+	}
+}
+
+const CSGBackend *CSGBackend::voxel()
+{
+	static VoxelBackend backend;
+	return &backend;
+}
+
+void CSGBackend::setVoxelSize(double size)
+{
+	voxelsize = size;
+}
+
+double CSGBackend::voxelSize()
+{
+	return voxelsize;
+}
+
+#endif // ENABLE_CGAL
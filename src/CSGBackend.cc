@@ -0,0 +1,113 @@
+#include "CSGBackend.h"
+#include "cgalutils.h"
+#include "printutils.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace {
+	class NefBackend : public CSGBackend
+	{
+	public:
+		const char *name() const override { return "nef"; }
+		shared_ptr<const Geometry> applyOperator(const Geometry::Geometries &children, OpenSCADOperator op) const override {
+			if (op == OpenSCADOperator::UNION) return CGALUtils::applyUnion3D(children);
+			return shared_ptr<const Geometry>(CGALUtils::applyOperator(children, op));
+		}
+	};
+
+	std::vector<const CSGBackend *> backends()
+	{
+		std::vector<const CSGBackend *> result{CSGBackend::nef()};
+		if (auto backend = CSGBackend::corefine()) result.push_back(backend);
+		result.push_back(CSGBackend::voxel());
+		return result;
+	}
+}
+
+const CSGBackend *CSGBackend::selected = CSGBackend::nef();
+
+const CSGBackend *CSGBackend::nef()
+{
+	static NefBackend backend;
+	return &backend;
+}
+
+bool CSGBackend::select(const std::string &name)
+{
+	for (const auto backend : backends()) {
+		if (name == backend->name()) {
+			selected = backend;
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<std::string> CSGBackend::names()
+{
+	std::vector<std::string> result;
+	for (const auto backend : backends()) result.push_back(backend->name());
+	return result;
+}
+
+shared_ptr<const Geometry> CSGBackend::apply(const Geometry::Geometries &children, OpenSCADOperator op)
+{
+	if (op == OpenSCADOperator::INTERSECTION && children.size() > 2) return reduce(children, op);
+	return applySelected(children, op);
+}
+
+shared_ptr<const Geometry> CSGBackend::applySelected(const Geometry::Geometries &children, OpenSCADOperator op)
+{
+	if (selected != nef()) {
+		if (auto geom = selected->applyOperator(children, op)) return geom;
+		PRINTDB("%s backend can't handle operation, falling back to Nef polyhedra", selected->name());
+	}
+	return nef()->applyOperator(children, op);
+}
+
+/*!
+	Reduces the children pairwise in a balanced tree instead of folding them
+	left to right, so intermediate results don't get re-processed by every
+	following operation. In each round the operands are sorted by size
+	(Geometry::memsize()) and the two smallest, the next two smallest, and
+	so on are combined. The pairs of a round are independent and evaluated
+	in parallel.
+
+	Only valid for associative and commutative operators. Returns nullptr if
+	any of the operations fails.
+*/
+shared_ptr<const Geometry> CSGBackend::reduce(const Geometry::Geometries &children, OpenSCADOperator op)
+{
+	std::vector<std::pair<size_t, Geometry::GeometryItem>> operands;
+	for (const auto &item : children) operands.emplace_back(item.second->memsize(), item);
+
+	while (operands.size() > 1) {
+		std::stable_sort(operands.begin(), operands.end(),
+			[](const std::pair<size_t, Geometry::GeometryItem> &a, const std::pair<size_t, Geometry::GeometryItem> &b) {
+				return a.first < b.first;
+			});
+
+		const size_t pairs = operands.size() / 2;
+		std::vector<shared_ptr<const Geometry>> results(pairs);
+		TaskGroup group;
+		for (size_t i = 0; i < pairs; ++i) {
+			group.run([&operands, &results, op, i]() {
+				Geometry::Geometries pair{operands[2*i].second, operands[2*i + 1].second};
+				results[i] = applySelected(pair, op);
+			});
+		}
+		group.wait();
+
+		std::vector<std::pair<size_t, Geometry::GeometryItem>> next;
+		for (size_t i = 0; i < pairs; ++i) {
+			if (!results[i]) return nullptr;
+			// Intersecting with nothing results in nothing
+			if (op == OpenSCADOperator::INTERSECTION && results[i]->isEmpty()) return results[i];
+			next.emplace_back(results[i]->memsize(), Geometry::GeometryItem(operands[2*i + 1].second.first, results[i]));
+		}
+		if (operands.size() % 2) next.push_back(operands.back());
+		operands.swap(next);
+	}
+	return operands.front().second.second;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "Geometry.h"
+#include "enums.h"
+#include "memory.h"
+
+/*!
+	Engine for 3D booleans (union, intersection, difference) of the
+	children of a node, as done by GeometryEvaluator.
+
+	The Nef backend uses exact Nef polyhedra (CGAL_Kernel3) and handles any
+	input. Other backends may refuse operations or inputs they can't handle,
+	e.g. non-manifold or self-intersecting meshes, by returning nullptr.
+	apply() then falls back to the Nef backend.
+
+	Intersections of more than two children are reduced pairwise in a
+	balanced tree, see reduce(). Callers with many overlapping operands of
+	a union (e.g. the convex parts of a Minkowski sum) can use it as well.
+
+	The backend is selected once per run, see select().
+*/
+class CSGBackend
+{
+public:
+	virtual ~CSGBackend() {}
+	virtual const char *name() const = 0;
+	virtual shared_ptr<const Geometry> applyOperator(const Geometry::Geometries &children, OpenSCADOperator op) const = 0;
+	// Appended to the cache keys of results, for backends whose results differ from the
+	// Nef backend's in shape or representation. The keys of the persistent DiskCache
+	// are the same, so entries written with one backend aren't read with another.
+	virtual std::string cacheTag() const { return std::string(); }
+
+	static shared_ptr<const Geometry> apply(const Geometry::Geometries &children, OpenSCADOperator op);
+	static shared_ptr<const Geometry> reduce(const Geometry::Geometries &children, OpenSCADOperator op);
+
+	static const CSGBackend *current() { return selected; }
+	static bool select(const std::string &name);
+	static std::vector<std::string> names();
+
+	static const CSGBackend *nef();
+	// Mesh corefinement (CGAL Polygon Mesh Processing), nullptr if not available
+	static const CSGBackend *corefine();
+	/*!
+		Approximate booleans by sampling the operands on a grid and
+		triangulating the occupied cells, for fast previews of expensive
+		models. Closed but faceted results, with details below the voxel size
+		lost. Renders with this backend evaluate the whole tree on voxels,
+		see VoxelEvaluator.
+	*/
+	static const CSGBackend *voxel();
+	// The edge length of the voxels in mm, see voxel()
+	static void setVoxelSize(double size);
+	static double voxelSize();
+
+private:
+	static shared_ptr<const Geometry> applySelected(const Geometry::Geometries &children, OpenSCADOperator op);
+
+	static const CSGBackend *selected;
+};
@@ -11,11 +11,15 @@
 #include "printutils.h"
 #include "GeometryEvaluator.h"
 #include "polyset.h"
+#include "InstancedPolySet.h"
 #include "polyset-utils.h"
+#include "GeometryCache.h"
+#include "ThreadPool.h"
 
 #include <string>
 #include <map>
 #include <list>
+#include <unordered_map>
 #include <assert.h>
 #include <cstddef>
 
@@ -28,7 +32,9 @@
 
 shared_ptr<CSGNode> CSGTreeEvaluator::buildCSGTree(const AbstractNode &node)
 {
+	if (this->geomevaluator && ThreadPool::instance()->isParallel()) evaluateGeometriesInParallel(node);
 	this->traverse(node);
+	this->precomputed.clear();
 	
 	shared_ptr<CSGNode> t(this->stored_term[node.index()]);
 	if (t) {
@@ -42,6 +48,57 @@ shared_ptr<CSGNode> CSGTreeEvaluator::buildCSGTree(const AbstractNode &node)
 	return this->rootNode = t;
 }
 
+/*!
+	Evaluates the geometries of the leaves of the CSG tree below node
+	concurrently, each in its own GeometryEvaluator sharing our Tree,
+	before the serial traversal, which then only picks them up. Leaves are
+	the outermost nodes which need their geometry from the GeometryEvaluator
+	(see evaluateGeometry()), e.g. render() blocks; identical subtrees are
+	evaluated once.
+*/
+void CSGTreeEvaluator::evaluateGeometriesInParallel(const AbstractNode &node)
+{
+	std::unordered_map<std::string, std::vector<const AbstractNode *>> leaves;
+	std::vector<std::string> keys;
+	std::vector<const AbstractNode *> stack{&node};
+	while (!stack.empty()) {
+		const AbstractNode *current = stack.back();
+		stack.pop_back();
+		if (dynamic_cast<const AbstractPolyNode *>(current) || dynamic_cast<const RenderNode *>(current) ||
+				dynamic_cast<const CgaladvNode *>(current)) {
+			const auto key = GeometryEvaluator::cacheKey(this->tree, *current);
+			if (GeometryCache::instance()->contains(key)) continue;
+			auto &nodes = leaves[key];
+			if (nodes.empty()) keys.push_back(key);
+			nodes.push_back(current);
+			continue;
+		}
+		for (const auto child : current->getChildren()) stack.push_back(child);
+	}
+	if (keys.size() < 2) return;
+
+	std::vector<shared_ptr<const Geometry>> results(keys.size());
+	TaskGroup group;
+	for (size_t i = 0; i < keys.size(); ++i) {
+		group.run([this, &leaves, &keys, &results, i]() {
+			GeometryEvaluator evaluator(this->tree);
+			results[i] = evaluator.evaluateGeometry(*leaves[keys[i]].front(), false, true);
+		});
+	}
+	group.wait();
+
+	for (size_t i = 0; i < keys.size(); ++i) {
+		for (const auto leaf : leaves[keys[i]]) this->precomputed.emplace(leaf, results[i]);
+	}
+}
+
+shared_ptr<const Geometry> CSGTreeEvaluator::evaluateGeometry(const AbstractNode &node)
+{
+	auto it = this->precomputed.find(&node);
+	if (it != this->precomputed.end()) return it->second;
+	return this->geomevaluator->evaluateGeometry(node, false, true);
+}
+
 void CSGTreeEvaluator::applyBackgroundAndHighlight(State & /*state*/, const AbstractNode &node)
 {
 	for(const auto &chnode : this->visitedchildren[node.index()]) {
@@ -137,6 +194,14 @@ void CSGTreeEvaluator::applyToChildren(State & /*state*/, const AbstractNode &no
 	this->stored_term[node.index()] = t1;
 }
 
+// Leaves carry their geometry, other terms only refer to their children's
+void CSGTreeEvaluator::profileNode(const AbstractNode &node, RenderProfile::Event &event)
+{
+	auto it = this->stored_term.find(node.index());
+	if (it == this->stored_term.end()) return;
+	if (const auto leaf = dynamic_pointer_cast<CSGLeaf>(it->second)) event.setGeometry(leaf->geom.get());
+}
+
 Response CSGTreeEvaluator::visit(State &state, const AbstractNode &node)
 {
 	if (state.isPostfix()) {
@@ -155,6 +220,23 @@ Response CSGTreeEvaluator::visit(State &state, const AbstractIntersectionNode &n
 	return Response::ContinueTraversal;
 }
 
+/*!
+	A union of one leaf per instance in [begin, end), all sharing the
+	instanced PolySet. Balanced, as there may be many instances.
+*/
+static shared_ptr<CSGNode> instance_leaves(const InstancedPolySet &instances, size_t begin, size_t end,
+																					 const State &state, const std::string &label)
+{
+	if (end - begin == 1) {
+		return shared_ptr<CSGNode>(new CSGLeaf(instances.polySet(), state.matrix() * instances.transforms()[begin],
+																					 state.color(), label));
+	}
+	const size_t mid = begin + (end - begin) / 2;
+	return CSGOperation::createCSGNode(OpenSCADOperator::UNION,
+																		 instance_leaves(instances, begin, mid, state, label),
+																		 instance_leaves(instances, mid, end, state, label));
+}
+
 shared_ptr<CSGNode> CSGTreeEvaluator::evaluateCSGNodeFromGeometry(
 	State &state, const shared_ptr<const Geometry> &geom,
 	const ModuleInstantiation *modinst, const AbstractNode &node)
@@ -162,14 +244,22 @@ shared_ptr<CSGNode> CSGTreeEvaluator::evaluateCSGNodeFromGeometry(
 	// We cannot render Polygon2d directly, so we preprocess (tessellate) it here
 	auto g = geom;
 	if (!g->isEmpty()) {
-		auto p2d = dynamic_pointer_cast<const Polygon2d>(geom);
+		auto p2d = geometry_cast<const Polygon2d>(geom);
 		if (p2d) {
 			g.reset(p2d->tessellate());
 		}
 		// 3D Polysets are tessellated before inserting into Geometry cache, inside GeometryEvaluator::evaluateGeometry
 	}
 
-	shared_ptr<CSGNode> t(new CSGLeaf(g, state.matrix(), state.color(), STR(node.name() << node.index())));
+	const std::string label = STR(node.name() << node.index());
+	shared_ptr<CSGNode> t;
+	auto instances = geometry_cast<const InstancedPolySet>(g);
+	if (instances && !instances->isEmpty()) {
+		t = instance_leaves(*instances, 0, instances->numInstances(), state, label);
+	}
+	else {
+		t.reset(new CSGLeaf(instances ? instances->polySet() : g, state.matrix(), state.color(), label));
+	}
 	if (modinst->isHighlight()) t->setHighlight(true);
 	else if (modinst->isBackground()) t->setBackground(true);
 	return t;
@@ -180,7 +270,7 @@ Response CSGTreeEvaluator::visit(State &state, const AbstractPolyNode &node)
 	if (state.isPostfix()) {
 		shared_ptr<CSGNode> t1;
 		if (this->geomevaluator) {
-			auto geom = this->geomevaluator->evaluateGeometry(node, false);
+			auto geom = evaluateGeometry(node);
 			if (geom) {
 				t1 = evaluateCSGNodeFromGeometry(state, geom, node.modinst, node);
 			}
@@ -236,7 +326,7 @@ Response CSGTreeEvaluator::visit(State &state, const RenderNode &node)
 		shared_ptr<CSGNode> t1;
 		shared_ptr<const Geometry> geom;
 		if (this->geomevaluator) {
-			geom = this->geomevaluator->evaluateGeometry(node, false);
+			geom = evaluateGeometry(node);
 			if (geom) {
 				t1 = evaluateCSGNodeFromGeometry(state, geom, node.modinst, node);
 			}
@@ -255,7 +345,7 @@ Response CSGTreeEvaluator::visit(State &state, const CgaladvNode &node)
     // FIXME: Calling evaluator directly since we're not a PolyNode. Generalize this.
 		shared_ptr<const Geometry> geom;
 		if (this->geomevaluator) {
-			geom = this->geomevaluator->evaluateGeometry(node, false);
+			geom = evaluateGeometry(node);
 			if (geom) {
 				t1 = evaluateCSGNodeFromGeometry(state, geom, node.modinst, node);
 			}
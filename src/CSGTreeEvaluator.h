@@ -2,6 +2,7 @@
 
 #include <map>
 #include <list>
+#include <unordered_map>
 #include <vector>
 #include <cstddef>
 #include "NodeVisitor.h"
@@ -37,6 +38,10 @@ public:
 		return this->backgroundNodes;
 	}
 
+protected:
+	const char *profileCategory() const override { return "CSGTreeEvaluator"; }
+	void profileNode(const AbstractNode &node, RenderProfile::Event &event) override;
+
 private:
   void addToParent(const State &state, const AbstractNode &node);
 	void applyToChildren(State &state, const AbstractNode &node, OpenSCADOperator op);
@@ -45,9 +50,12 @@ private:
 																									const class ModuleInstantiation *modinst, 
 																									const AbstractNode &node);
 	void applyBackgroundAndHighlight(State &state, const AbstractNode &node);
+	void evaluateGeometriesInParallel(const AbstractNode &node);
+	// The geometry of node, from evaluateGeometriesInParallel() or the GeometryEvaluator
+	shared_ptr<const class Geometry> evaluateGeometry(const AbstractNode &node);
 
 	typedef std::list<const AbstractNode *> ChildList;
-	std::map<int, ChildList> visitedchildren;
+	VisitedChildren<ChildList> visitedchildren;
 
 protected:
 	const Tree &tree;
@@ -56,4 +64,5 @@ protected:
 	std::vector<shared_ptr<CSGNode>> highlightNodes;
 	std::vector<shared_ptr<CSGNode>> backgroundNodes;
 	std::map<int, shared_ptr<CSGNode>> stored_term; // The term evaluated from each node index
+	std::unordered_map<const AbstractNode *, shared_ptr<const class Geometry>> precomputed;
 };
@@ -3,6 +3,57 @@
 #include "CSGTreeNormalizer.h"
 #include "csgnode.h"
 #include "printutils.h"
+#include "JobLimits.h"
+#include "Metrics.h"
+
+CSGTermCache *CSGTermCache::inst = nullptr;
+
+void CSGTermCache::prune()
+{
+	for (auto it = this->entries.begin(); it != this->entries.end();) {
+		if (!it->second.used) {
+			it = this->entries.erase(it);
+		}
+		else {
+			it->second.used = false;
+			++it;
+		}
+	}
+}
+
+namespace {
+	template <typename T> void append(std::string &key, const T &value)
+	{
+		key.append(reinterpret_cast<const char *>(&value), sizeof(value));
+	}
+
+	// Everything of term the normalization depends on, in preorder
+	std::string termKey(const shared_ptr<CSGNode> &term, std::vector<shared_ptr<const Geometry>> &geometries)
+	{
+		std::string key;
+		std::stack<const CSGNode *> todo;
+		todo.push(term.get());
+		while (!todo.empty()) {
+			auto node = todo.top();
+			todo.pop();
+			append(key, node->getFlags());
+			if (auto leaf = dynamic_cast<const CSGLeaf *>(node)) {
+				key.push_back('L');
+				append(key, leaf->geom.get());
+				if (leaf->geom) geometries.push_back(leaf->geom);
+				key.append(reinterpret_cast<const char *>(leaf->matrix.data()), 16 * sizeof(double));
+				key.append(reinterpret_cast<const char *>(leaf->color.data()), 4 * sizeof(float));
+			}
+			else {
+				auto op = const_cast<CSGOperation *>(static_cast<const CSGOperation *>(node));
+				append(key, op->getType());
+				todo.push(op->right().get());
+				todo.push(op->left().get());
+			}
+		}
+		return key;
+	}
+}
 
 // Helper function to debug normalization bugs
 #if 0
@@ -21,14 +72,71 @@ static bool validate_tree(const shared_ptr<CSGNode> &node)
 */
 shared_ptr<CSGNode> CSGTreeNormalizer::normalize(const shared_ptr<CSGNode> &root)
 {
+	Metrics::PhaseTimer timer("normalize");
 	this->aborted = false;
 	this->nodecount = 0;
+	if (this->cache) return normalizeCached(root);
 	shared_ptr<CSGNode> temp = root;
 	temp = normalizePass(temp);
 	this->rootnode.reset();
 	return temp;
 }
 
+/*!
+	Normalizes each branch below the unions at the top of root on its own,
+	which gives the same products as normalizing root at once, and reuses
+	the branches found in the cache. Unions with flags aren't split, since
+	their flags apply to all of their products.
+
+	Branches are stored in the cache as they are normalized in place, so
+	the caller mustn't normalize terms sharing nodes with root afterwards.
+*/
+shared_ptr<CSGNode> CSGTreeNormalizer::normalizeCached(const shared_ptr<CSGNode> &root)
+{
+	std::vector<shared_ptr<CSGNode>> branches;
+	std::stack<shared_ptr<CSGNode>> todo;
+	todo.push(root);
+	while (!todo.empty()) {
+		auto term = todo.top();
+		todo.pop();
+		auto op = dynamic_pointer_cast<CSGOperation>(term);
+		if (op && op->getType() == OpenSCADOperator::UNION && op->getFlags() == CSGNode::FLAG_NONE) {
+			this->nodecount++;
+			todo.push(op->right());
+			todo.push(op->left());
+		}
+		else {
+			branches.push_back(term);
+		}
+	}
+
+	shared_ptr<CSGNode> result;
+	for (auto &branch : branches) {
+		std::vector<shared_ptr<const Geometry>> geometries;
+		auto key = termKey(branch, geometries);
+		auto it = this->cache->entries.find(key);
+		if (it != this->cache->entries.end()) {
+			this->nodecount += it->second.nodecount;
+			it->second.used = true;
+		}
+		else {
+			const size_t start = this->nodecount;
+			auto term = normalizePass(branch);
+			if (this->aborted) break;
+			it = this->cache->entries.emplace(std::move(key), CSGTermCache::Entry{term, this->nodecount - start, true, std::move(geometries)}).first;
+		}
+		JobLimits::checkCSGSize(this->nodecount);
+		if (this->nodecount > this->limit) {
+			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
+			this->aborted = true;
+			break;
+		}
+		result = CSGOperation::createCSGNode(OpenSCADOperator::UNION, result, it->second.term);
+	}
+	this->rootnode.reset();
+	return this->aborted ? shared_ptr<CSGNode>() : result;
+}
+
 /*!
 	After aborting, a subtree might have become invalidated (nullptr child node)
 	since terms can be instantiated multiple times.
@@ -86,6 +194,7 @@ entrypoint:
 	do {
 		while (node && match_and_replace(node)) {	}
 		this->nodecount++;
+		JobLimits::checkCSGSize(this->nodecount);
 		if (nodecount > this->limit) {
 			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
 			this->aborted = true;
@@ -103,6 +212,7 @@ cont_right: ;
 
 	// FIXME: Do we need to take into account any transformation of item here?
 	node = collapse_null_terms(node);
+	node = prune_term(node);
 
 	if (this->aborted) {
 		if (node) node = cleanup_term(node);
@@ -157,6 +267,30 @@ shared_ptr<CSGNode> CSGTreeNormalizer::collapse_null_terms(const shared_ptr<CSGN
 	return node;
 }
 
+/*!
+	Children are normalized in place, so their parent's bounding box is
+	out of date by then. Recomputes it, and repeats the pruning which
+	CSGOperation::createCSGNode() does when creating a node: intersections
+	of disjoint boxes are empty, and differences with a disjoint negative
+	part become the positive part. Since the box of a product shrinks with
+	each intersection, this removes products proven empty by any two of
+	their intersections.
+*/
+shared_ptr<CSGNode> CSGTreeNormalizer::prune_term(const shared_ptr<CSGNode> &node)
+{
+	auto op = dynamic_pointer_cast<CSGOperation>(node);
+	if (!op || !op->left() || !op->right()) return node;
+	op->initBoundingBox();
+	if (op->getType() == OpenSCADOperator::UNION) return node;
+	const auto &leftbox = op->left()->getBoundingBox();
+	const auto &rightbox = op->right()->getBoundingBox();
+	if (leftbox.intersection(rightbox).isEmpty()) {
+		this->nodecount--;
+		return op->getType() == OpenSCADOperator::DIFFERENCE ? op->left() : shared_ptr<CSGNode>();
+	}
+	return node;
+}
+
 bool CSGTreeNormalizer::match_and_replace(shared_ptr<CSGNode> &node)
 {
 	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
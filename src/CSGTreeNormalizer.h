@@ -2,23 +2,64 @@
 
 #include "memory.h"
 
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*!
+	Normalized terms of earlier normalizations, keyed by the structure of
+	the term before normalizing: its operators and flags, and the geometry,
+	matrix and color of its leaves (but not their labels). As the unions at
+	the top of a tree are normalized branch by branch, an edit which only
+	touches one branch re-normalizes only that one.
+
+	Call prune() after each compile to drop the terms which weren't used by it.
+*/
+class CSGTermCache
+{
+public:
+	static CSGTermCache *instance() { if (!inst) inst = new CSGTermCache; return inst; }
+
+	void prune();
+	void clear() { this->entries.clear(); }
+
+private:
+	CSGTermCache() {}
+	friend class CSGTreeNormalizer;
+
+	struct Entry {
+		shared_ptr<class CSGNode> term; // nullptr if normalized to nothing
+		size_t nodecount;
+		bool used;
+		// Keeps the geometries in the key alive, so their addresses aren't reused
+		std::vector<shared_ptr<const class Geometry>> geometries;
+	};
+
+	static CSGTermCache *inst;
+
+	std::unordered_map<std::string, Entry> entries;
+};
+
 class CSGTreeNormalizer
 {
 public:
-	CSGTreeNormalizer(size_t limit) : aborted(false), limit(limit), nodecount(0) {}
+	CSGTreeNormalizer(size_t limit, CSGTermCache *cache = nullptr) : aborted(false), limit(limit), nodecount(0), cache(cache) {}
 	~CSGTreeNormalizer() {}
 
 	shared_ptr<class CSGNode> normalize(const shared_ptr<CSGNode> &term);
 
 private:
+	shared_ptr<CSGNode> normalizeCached(const shared_ptr<CSGNode> &root);
 	shared_ptr<CSGNode> normalizePass(shared_ptr<CSGNode> term) ;
 	bool match_and_replace(shared_ptr<class CSGNode> &term);
 	shared_ptr<CSGNode> collapse_null_terms(const shared_ptr<CSGNode> &term);
+	shared_ptr<CSGNode> prune_term(const shared_ptr<CSGNode> &term);
 	shared_ptr<CSGNode> cleanup_term(shared_ptr<CSGNode> &t);
 	unsigned int count(const shared_ptr<CSGNode> &term) const;
 
 	bool aborted;
 	size_t limit;
 	size_t nodecount;
+	CSGTermCache *cache;
 	shared_ptr<class CSGNode> rootnode;
 };
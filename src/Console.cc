@@ -27,15 +27,30 @@
 #include <QMenu>
 #include <QFileDialog>
 #include <QTextStream>
+#include <QThread>
 
 #include "Console.h"
 #include "printutils.h"
 
-Console::Console(QWidget *parent) : QPlainTextEdit(parent)
+#if (QT_VERSION < QT_VERSION_CHECK(5, 0, 0))
+#include <QTextDocument>
+#define QT_HTML_ESCAPE(qstring) Qt::escape(qstring)
+#else
+#define QT_HTML_ESCAPE(qstring) (qstring).toHtmlEscaped()
+#endif
+
+namespace {
+	// How often output is shown while the GUI thread itself is busy printing
+	const qint64 flush_interval = 100; // ms
+}
+
+Console::Console(QWidget *parent) : QPlainTextEdit(parent), dropped(0), flushScheduled(false)
 {
 	setupUi(this);
 	connect(this->actionClear, SIGNAL(triggered()), this, SLOT(actionClearConsole_triggered()));
 	connect(this->actionSaveAs, SIGNAL(triggered()), this, SLOT(actionSaveAs_triggered()));
+	connect(this->actionLogToFile, SIGNAL(triggered(bool)), this, SLOT(actionLogToFile_triggered(bool)));
+	this->sinceFlush.start();
 }
 
 Console::~Console()
@@ -60,6 +75,122 @@ void Console::actionSaveAs_triggered()
 	}
 }
 
+void Console::actionLogToFile_triggered(bool checked)
+{
+	QMutexLocker lock(&this->mutex);
+	this->logFile.close();
+	if (!checked) return;
+	lock.unlock();
+
+	const auto fileName = QFileDialog::getSaveFileName(this, _("Log console messages to file"));
+	if (fileName.isEmpty()) {
+		this->actionLogToFile->setChecked(false);
+		return;
+	}
+	lock.relock();
+	this->logFile.setFileName(fileName);
+	if (!this->logFile.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+		lock.unlock();
+		this->actionLogToFile->setChecked(false);
+		PRINTB("UI-ERROR: Cannot open '%s' for the console log.", fileName.toStdString());
+		return;
+	}
+	lock.unlock();
+	PRINTB("Logging console messages to '%s'.", fileName.toStdString());
+}
+
+/*!
+	Queues a message from any thread. The queue is shown by flush(), which
+	runs once the GUI thread processes events. If the GUI thread is the one
+	printing, it flushes now and then and returns true, so the caller can let
+	the output be drawn.
+*/
+bool Console::post(const QString &msg)
+{
+	bool schedule = false;
+	{
+		QMutexLocker lock(&this->mutex);
+		if (this->logFile.isOpen()) {
+			this->logFile.write(msg.toUtf8());
+			this->logFile.write("\n");
+		}
+		this->pending.push_back(msg);
+		if (this->pending.size() > size_t(maxLines)) {
+			this->pending.pop_front();
+			this->dropped++;
+		}
+		if (!this->flushScheduled) {
+			this->flushScheduled = true;
+			schedule = true;
+		}
+	}
+	if (QThread::currentThread() == this->thread() && this->sinceFlush.hasExpired(flush_interval)) {
+		flush();
+		return true;
+	}
+	if (schedule) QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+	return false;
+}
+
+/*!
+	Shows the queued messages, in a single edit of the document.
+*/
+void Console::flush()
+{
+	std::deque<QString> msgs;
+	size_t skipped;
+	{
+		QMutexLocker lock(&this->mutex);
+		msgs.swap(this->pending);
+		skipped = this->dropped;
+		this->dropped = 0;
+		this->flushScheduled = false;
+		if (this->logFile.isOpen()) this->logFile.flush();
+	}
+	this->sinceFlush.start();
+	if (msgs.empty() && skipped == 0) return;
+
+	QTextCursor cursor(this->document());
+	cursor.beginEditBlock();
+	cursor.movePosition(QTextCursor::End);
+	if (skipped > 0) {
+		appendMessage(cursor, QString(_("(%1 earlier messages not shown)")).arg(skipped));
+	}
+	for (const auto &msg : msgs) appendMessage(cursor, msg);
+	cursor.endEditBlock();
+
+	// Keep the latest message in view
+	auto c = textCursor();
+	c.movePosition(QTextCursor::End);
+	setTextCursor(c);
+	ensureCursorVisible();
+}
+
+void Console::appendMessage(QTextCursor &cursor, const QString &msg)
+{
+	// Clear leaves characterCount() at 1, not 0
+	if (this->document()->characterCount() > 1) cursor.insertBlock();
+	cursor.setCharFormat(QTextCharFormat());
+
+	if (msg.startsWith("WARNING:") || msg.startsWith("DEPRECATED:") ||
+			msg.startsWith("UI-WARNING:") || msg.startsWith("FONT-WARNING:") || msg.startsWith("EXPORT-WARNING:")) {
+		cursor.insertHtml("<span style=\"color: black; background-color: #ffffb0;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
+	} else if (msg.startsWith("ERROR:") ||
+						 msg.startsWith("EXPORT-ERROR:") || msg.startsWith("UI-ERROR:") || msg.startsWith("PARSER-ERROR:")) {
+		cursor.insertHtml("<span style=\"color: black; background-color: #ffb0b0;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
+	} else if (msg.startsWith("TRACE:")) {
+		cursor.insertHtml("<span style=\"color: black; background-color: #d0d0ff;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
+	} else {
+		QString qmsg = msg;
+		if(qmsg.contains('\t') && !qmsg.contains("<pre>", Qt::CaseInsensitive))
+			cursor.insertText(qmsg);
+		else {
+			qmsg.replace("\n","<br>");
+			cursor.insertHtml(qmsg);
+		}
+	}
+}
+
 void Console::contextMenuEvent(QContextMenuEvent *event)
 {
 	// Clear leaves characterCount() at 1, not 0
@@ -70,6 +201,7 @@ void Console::contextMenuEvent(QContextMenuEvent *event)
 	menu->insertAction(menu->actions().at(0), this->actionClear);
 	menu->addSeparator();
 	menu->addAction(this->actionSaveAs);
+	menu->addAction(this->actionLogToFile);
     menu->exec(event->globalPos());
 	delete menu;
 }
@@ -27,10 +27,21 @@
 #pragma once
 
 #include <QPlainTextEdit>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QStringList>
+#include <deque>
 
 #include "qtgettext.h"
 #include "ui_Console.h"
 
+/*!
+	Messages are posted from any thread and shown in batches, so printing
+	many of them costs about the same per message as a few. At most
+	maximumBlockCount() messages are kept waiting; older ones are only
+	counted, and written to the log file if one is set.
+*/
 class Console : public QPlainTextEdit, public Ui::Console
 {
 	Q_OBJECT
@@ -39,9 +50,24 @@ public:
 	Console(QWidget *parent = nullptr);
 	virtual ~Console();
 
+	static constexpr int maxLines = 5000;
+
 	void contextMenuEvent(QContextMenuEvent *event) override;
+	bool post(const QString &msg);
 
 public slots:
 	void actionClearConsole_triggered();
 	void actionSaveAs_triggered();
+	void actionLogToFile_triggered(bool checked);
+	void flush();
+
+private:
+	void appendMessage(QTextCursor &cursor, const QString &msg);
+
+	QMutex mutex; // guards pending, dropped, flushScheduled and logFile
+	std::deque<QString> pending;
+	size_t dropped;
+	bool flushScheduled;
+	QElapsedTimer sinceFlush;
+	QFile logFile;
 };
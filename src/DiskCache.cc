@@ -0,0 +1,522 @@
+#include "DiskCache.h"
+#include "printutils.h"
+#include "Geometry.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "GeometryUtils.h"
+#include "Polygon2d.h"
+#include "osmesh.h"
+#include "version.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#include "cgalutils.h"
+#endif
+
+DiskCache *DiskCache::inst = nullptr;
+DiskCache *DiskCache::sharedinst = nullptr;
+
+namespace {
+	const char magic[4] = {'O', 'S', 'G', 'C'};
+	const uint32_t format_version = 5;
+	const char *entry_extension = ".geom";
+	const char *package_dir = "openscad-geometry";
+
+	enum class EntryType : uint8_t { POLYSET = 1, POLYGON2D = 2, NEF = 3, NEF_EMPTY = 4 };
+
+	// FNV-1a; stable across runs and platforms, unlike std::hash
+	uint64_t hash_id(const std::string &id)
+	{
+		uint64_t h = 14695981039346656037ULL;
+		for (unsigned char c : id) {
+			h ^= c;
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+	std::string entry_name(uint64_t hash)
+	{
+		std::ostringstream name;
+		name << std::hex;
+		name.width(16);
+		name.fill('0');
+		name << hash << entry_extension;
+		return name.str();
+	}
+
+	template <typename T> void write_value(std::ostream &out, const T &v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	template <typename T> bool read_value(std::istream &in, T &v)
+	{
+		return bool(in.read(reinterpret_cast<char *>(&v), sizeof(T)));
+	}
+
+	/*!
+		PolySets are stored as indexed meshes, in the encoding of OSMesh,
+		followed by the face colors: the color table and the index of each
+		face, see PolySet::FaceColors.
+	*/
+	void write_polyset(std::ostream &out, const PolySet &ps)
+	{
+		int8_t convex = ps.convexValue() ? 1 : !ps.convexValue() ? 0 : -1;
+		write_value(out, convex);
+		IndexedMesh mesh;
+		PolysetUtils::createIndexedMesh(ps, mesh);
+		OSMesh::writeMesh(out, mesh);
+		const auto &colors = ps.faceColors();
+		write_value<uint32_t>(out, colors ? colors->table.size() : 0);
+		if (!colors) return;
+		for (const auto &color : colors->table) {
+			for (int i = 0; i < 4; ++i) write_value(out, color[i]);
+		}
+		write_value<uint64_t>(out, colors->indices.size());
+		out.write(reinterpret_cast<const char *>(colors->indices.data()), colors->indices.size() * sizeof(uint16_t));
+	}
+
+	template <typename T> bool read_value(const char *&data, const char *end, T &v)
+	{
+		if (size_t(end - data) < sizeof(T)) return false;
+		memcpy(&v, data, sizeof(T));
+		data += sizeof(T);
+		return true;
+	}
+
+	PolySet *read_polyset(const char *data, const char *end)
+	{
+		int8_t convex;
+		if (data == end) return nullptr;
+		memcpy(&convex, data++, 1);
+		IndexedMesh mesh;
+		if (!OSMesh::readMesh(data, end, mesh)) return nullptr;
+
+		// Counts are checked against the remaining size before allocating anything
+		uint32_t numcolors;
+		if (!read_value(data, end, numcolors) ||
+				numcolors > uint64_t(end - data) / sizeof(Color4f)) return nullptr;
+		shared_ptr<PolySet::FaceColors> colors;
+		if (numcolors > 0) {
+			colors = make_shared<PolySet::FaceColors>();
+			colors->table.resize(numcolors);
+			for (auto &color : colors->table) {
+				for (int i = 0; i < 4; ++i) {
+					if (!read_value(data, end, color[i])) return nullptr;
+				}
+			}
+			uint64_t numindices;
+			if (!read_value(data, end, numindices) || numindices > mesh.numFaces() ||
+					numindices > uint64_t(end - data) / sizeof(uint16_t)) return nullptr;
+			colors->indices.resize(numindices);
+			memcpy(colors->indices.data(), data, numindices * sizeof(uint16_t));
+			for (const auto idx : colors->indices) {
+				if (idx != PolySet::FaceColors::nocolor && idx >= numcolors) return nullptr;
+			}
+		}
+
+		auto ps = new PolySet(3, convex < 0 ? boost::tribool(unknown) : boost::tribool(convex == 1));
+		PolysetUtils::appendIndexedMesh(mesh, *ps);
+		if (colors) ps->setFaceColors(colors);
+		return ps;
+	}
+
+	void write_polygon2d(std::ostream &out, const Polygon2d &poly)
+	{
+		write_value<uint8_t>(out, poly.isSanitized());
+		write_value<uint64_t>(out, poly.outlines().size());
+		for (const auto &o : poly.outlines()) {
+			write_value<uint8_t>(out, o.positive);
+			write_value<uint64_t>(out, o.vertices.size());
+			for (const auto &v : o.vertices) {
+				write_value(out, v[0]); write_value(out, v[1]);
+			}
+		}
+	}
+
+	Polygon2d *read_polygon2d(const char *data, const char *end)
+	{
+		uint8_t sanitized;
+		uint64_t numoutlines;
+		if (!read_value(data, end, sanitized) || !read_value(data, end, numoutlines) ||
+				numoutlines > uint64_t(end - data) / (sizeof(uint8_t) + sizeof(uint64_t))) return nullptr;
+		auto poly = new Polygon2d;
+		for (uint64_t i = 0; i < numoutlines; ++i) {
+			Outline2d o;
+			uint8_t positive;
+			uint64_t numvertices;
+			if (!read_value(data, end, positive) || !read_value(data, end, numvertices) ||
+					numvertices > uint64_t(end - data) / (2 * sizeof(double))) {
+				delete poly;
+				return nullptr;
+			}
+			o.positive = positive;
+			o.vertices.resize(numvertices);
+			for (auto &v : o.vertices) {
+				read_value(data, end, v[0]); read_value(data, end, v[1]);
+			}
+			poly->addOutline(o);
+		}
+		poly->setSanitized(sanitized);
+		return poly;
+	}
+
+	/*!
+		Writes the payload for the given geometry, returns false if the
+		geometry type isn't supported.
+	*/
+	bool write_geometry(std::ostream &out, const shared_ptr<const Geometry> &geom)
+	{
+		if (const auto ps = dynamic_pointer_cast<const PolySet>(geom)) {
+			if (ps->getDimension() != 3) return false;
+			write_value(out, EntryType::POLYSET);
+			write_value<int32_t>(out, ps->getConvexity());
+			write_polyset(out, *ps);
+		}
+		else if (const auto poly = dynamic_pointer_cast<const Polygon2d>(geom)) {
+			write_value(out, EntryType::POLYGON2D);
+			write_value<int32_t>(out, poly->getConvexity());
+			write_polygon2d(out, *poly);
+		}
+#ifdef ENABLE_CGAL
+		else if (const auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
+			write_value(out, N->p3 ? EntryType::NEF : EntryType::NEF_EMPTY);
+			write_value<int32_t>(out, N->getConvexity());
+			if (N->p3) CGALUtils::writeNefPolyhedron(out, *N->p3);
+		}
+#endif
+		else {
+			return false;
+		}
+		return bool(out);
+	}
+
+	Geometry *read_geometry(const std::string &data)
+	{
+		EntryType type;
+		int32_t convexity;
+		if (data.size() < sizeof(type) + sizeof(convexity)) return nullptr;
+		memcpy(&type, data.data(), sizeof(type));
+		memcpy(&convexity, data.data() + sizeof(type), sizeof(convexity));
+		const size_t offset = sizeof(type) + sizeof(convexity);
+		if (type == EntryType::POLYSET) {
+			auto geom = read_polyset(data.data() + offset, data.data() + data.size());
+			if (geom) geom->setConvexity(convexity);
+			return geom;
+		}
+#ifdef ENABLE_CGAL
+		if (type == EntryType::NEF) {
+			const char *payload = data.data() + offset;
+			auto p3 = CGALUtils::readNefPolyhedron(payload, data.data() + data.size());
+			if (!p3) return nullptr;
+			auto geom = new CGAL_Nef_polyhedron(p3);
+			geom->setConvexity(convexity);
+			return geom;
+		}
+#endif
+		Geometry *geom = nullptr;
+		switch (type) {
+		case EntryType::POLYGON2D:
+			geom = read_polygon2d(data.data() + offset, data.data() + data.size());
+			break;
+#ifdef ENABLE_CGAL
+		case EntryType::NEF_EMPTY:
+			geom = new CGAL_Nef_polyhedron;
+			break;
+#endif
+		default:
+			break;
+		}
+		if (geom) geom->setConvexity(convexity);
+		return geom;
+	}
+}
+
+void DiskCache::setPath(const std::string &path)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->cachedir.clear();
+	this->totalsize = 0;
+	if (path.empty()) return;
+
+	boost::system::error_code ec;
+	fs::create_directories(path, ec);
+	if (!fs::is_directory(path, ec)) {
+		PRINTB("WARNING: Can't use geometry cache directory '%s', disk cache disabled", path);
+		return;
+	}
+	this->cachedir = fs::absolute(path);
+
+	for (fs::directory_iterator it(this->cachedir, ec), end; !ec && it != end; it.increment(ec)) {
+		if (it->path().extension() == entry_extension) this->totalsize += fs::file_size(it->path(), ec);
+	}
+}
+
+void DiskCache::setMaxSizeMB(size_t limit)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->maxsize = limit*1024*1024;
+	if (isEnabled()) trim();
+}
+
+void DiskCache::findPackages(const std::vector<std::string> &librarypaths)
+{
+	this->packages.clear();
+	boost::system::error_code ec;
+	auto addPackage = [this, &ec](const fs::path &library) {
+		const fs::path dir = library / package_dir / openscad_versionnumber;
+		if (!fs::is_directory(dir, ec)) return;
+		Package package{dir, {}};
+		for (fs::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			const auto &path = it->path();
+			if (path.extension() != entry_extension || path.stem().string().size() != 16) continue;
+			package.hashes.insert(std::strtoull(path.stem().string().c_str(), nullptr, 16));
+		}
+		PRINTDB("Geometry package: %s (%d entries)", dir.string() % package.hashes.size());
+		if (!package.hashes.empty()) this->packages.push_back(std::move(package));
+	};
+	for (const auto &librarypath : librarypaths) {
+		// The library path itself may be a library, or hold several
+		addPackage(librarypath);
+		for (fs::directory_iterator it(librarypath, ec), end; !ec && it != end; it.increment(ec)) {
+			if (fs::is_directory(it->path(), ec)) addPackage(it->path());
+		}
+		ec.clear();
+	}
+}
+
+fs::path DiskCache::entryPath(const std::string &id) const
+{
+	return this->cachedir / entry_name(hash_id(id));
+}
+
+bool DiskCache::contains(const std::string &id) const
+{
+	boost::system::error_code ec;
+	if (isEnabled() && fs::exists(entryPath(id), ec)) return true;
+	if (this->sharedtier && this->sharedtier->contains(id)) return true;
+	const auto hash = hash_id(id);
+	for (const auto &package : this->packages) {
+		if (package.hashes.count(hash)) return true;
+	}
+	return false;
+}
+
+/*!
+	Reads the payload of the entry file at path into data, if it's an entry
+	of this format for the given id.
+*/
+bool DiskCache::readEntry(const fs::path &path, const std::string &id, std::string &data)
+{
+	std::ifstream in(path.string(), std::ios::in | std::ios::binary);
+	if (!in.good()) return false;
+
+	char filemagic[sizeof(magic)];
+	uint32_t version;
+	uint64_t idsize;
+	if (!in.read(filemagic, sizeof(filemagic)) || !std::equal(magic, magic + sizeof(magic), filemagic) ||
+			!read_value(in, version) || version != format_version ||
+			!read_value(in, idsize) || idsize != id.size()) {
+		return false;
+	}
+	std::string fileid(idsize, '\0');
+	if (!in.read(&fileid[0], idsize) || fileid != id) return false;
+
+	std::ostringstream payload(std::ios::out | std::ios::binary);
+	payload << in.rdbuf();
+	data = payload.str();
+	return true;
+}
+
+/*!
+	Reads the payload of the entry for the given id into data. Returns false
+	if there is no valid entry.
+*/
+bool DiskCache::getData(const std::string &id, std::string &data)
+{
+	if (!isEnabled()) return false;
+	const fs::path path = entryPath(id);
+	if (!readEntry(path, id, data)) return false;
+
+	// Mark as recently used
+	boost::system::error_code ec;
+	fs::last_write_time(path, std::time(nullptr), ec);
+	return true;
+}
+
+/*!
+	Removes the entry for the given id, e.g. because its payload turned out
+	to be corrupt.
+*/
+void DiskCache::remove(const std::string &id)
+{
+	if (!isEnabled()) return;
+	const fs::path path = entryPath(id);
+	PRINTB("WARNING: Removing corrupt geometry cache entry '%s'", path.string());
+	boost::system::error_code ec;
+	fs::remove(path, ec);
+}
+
+shared_ptr<const Geometry> DiskCache::get(const std::string &id)
+{
+	std::string data;
+	if (getData(id, data)) {
+		auto geom = decode(data);
+		if (geom) {
+			PRINTDB("Disk Cache hit: %s", id.substr(0, 40));
+			return geom;
+		}
+		remove(id);
+	}
+	if (!this->sharedtier || !this->sharedtier->getData(id, data)) return getPackaged(id);
+
+	auto geom = decode(data);
+	if (!geom) {
+		this->sharedtier->remove(id);
+		return nullptr;
+	}
+	PRINTDB("Shared Disk Cache hit: %s", id.substr(0, 40));
+	insertData(id, data);
+	return geom;
+}
+
+// Packages are read-only, so corrupt entries are just skipped
+shared_ptr<const Geometry> DiskCache::getPackaged(const std::string &id) const
+{
+	if (this->packages.empty()) return nullptr;
+	const auto hash = hash_id(id);
+	std::string data;
+	for (const auto &package : this->packages) {
+		if (!package.hashes.count(hash)) continue;
+		if (!readEntry(package.dir / entry_name(hash), id, data)) continue;
+		if (auto geom = decode(data)) {
+			PRINTDB("Geometry package hit: %s", id.substr(0, 40));
+			return geom;
+		}
+	}
+	return nullptr;
+}
+
+bool DiskCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom)
+{
+	if (!geom) return false;
+	boost::system::error_code ec;
+	const bool local = isEnabled() && !fs::exists(entryPath(id), ec);
+	const bool shared = this->sharedtier && this->sharedtier->isEnabled() && !this->sharedtier->contains(id);
+	if (!local && !shared) return false;
+
+	std::string payload;
+	if (!encode(geom, payload)) return false;
+	bool inserted = false;
+	if (local) inserted |= insertData(id, payload);
+	if (shared) inserted |= this->sharedtier->insertData(id, payload);
+	return inserted;
+}
+
+bool DiskCache::encode(const shared_ptr<const Geometry> &geom, std::string &payload)
+{
+	std::ostringstream out(std::ios::out | std::ios::binary);
+	if (!write_geometry(out, geom)) return false;
+	payload = out.str();
+	return true;
+}
+
+shared_ptr<const Geometry> DiskCache::decode(const std::string &payload)
+{
+	return shared_ptr<const Geometry>(read_geometry(payload));
+}
+
+/*!
+	Stores data as the payload of the entry for the given id, unless there
+	already is one.
+*/
+bool DiskCache::insertData(const std::string &id, const std::string &payload)
+{
+	const fs::path path = entryPath(id);
+	boost::system::error_code ec;
+	if (!isEnabled() || fs::exists(path, ec)) return false;
+	ec.clear(); // exists() reports a missing entry as an error
+
+	std::ostringstream out(std::ios::out | std::ios::binary);
+	out.write(magic, sizeof(magic));
+	write_value(out, format_version);
+	write_value<uint64_t>(out, id.size());
+	out.write(id.data(), id.size());
+	out.write(payload.data(), payload.size());
+	const std::string data = out.str();
+	if (data.size() > this->maxsize) return false;
+
+	const fs::path tmppath = this->cachedir / fs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp", ec);
+	if (ec) return false;
+	{
+		std::ofstream f(tmppath.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!f.write(data.data(), data.size())) {
+			f.close();
+			fs::remove(tmppath, ec);
+			return false;
+		}
+	}
+	fs::rename(tmppath, path, ec);
+	if (ec) {
+		fs::remove(tmppath, ec);
+		return false;
+	}
+	PRINTDB("Disk Cache insert: %s (%d bytes)", id.substr(0, 40) % data.size());
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->totalsize += data.size();
+	if (this->totalsize > this->maxsize) trim();
+	return true;
+}
+
+/*!
+	Removes the least recently used entries until the cache directory takes
+	up at most 90% of the size limit, leaving room for further inserts before
+	the next rescan. Since other processes may share the directory, the
+	current size is recomputed from the directory contents.
+*/
+void DiskCache::trim()
+{
+	struct Entry {
+		fs::path path;
+		std::time_t time;
+		uintmax_t size;
+	};
+	std::vector<Entry> entries;
+	boost::system::error_code ec;
+	this->totalsize = 0;
+	for (fs::directory_iterator it(this->cachedir, ec), end; !ec && it != end; it.increment(ec)) {
+		if (it->path().extension() != entry_extension) continue;
+		Entry e{it->path(), fs::last_write_time(it->path(), ec), fs::file_size(it->path(), ec)};
+		if (ec) continue;
+		this->totalsize += e.size;
+		entries.push_back(e);
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.time < b.time; });
+
+	const size_t target = this->maxsize / 10 * 9;
+	for (const auto &e : entries) {
+		if (this->totalsize <= target) break;
+		if (fs::remove(e.path, ec)) this->totalsize -= e.size;
+	}
+}
+
+void DiskCache::print()
+{
+	for (const auto &package : this->packages) {
+		PRINTB("Geometry package: %s (%d entries)", package.dir.string() % package.hashes.size());
+	}
+	if (!isEnabled()) return;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	PRINTB("Geometry disk cache: %s", this->cachedir.string());
+	PRINTB("Geometry disk cache size in bytes: %d", this->totalsize);
+}
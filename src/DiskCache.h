@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "memory.h"
+
+namespace fs = boost::filesystem;
+
+class Geometry;
+
+/*!
+	Optional persistent second tier behind GeometryCache and CGALCache.
+
+	Each entry is a file in the cache directory named by a hash of the node's
+	cache key (Tree::getIdKey()). The full key is stored in the file as well,
+	so collisions of the file name hash are detected and treated as misses.
+	PolySets, Polygon2ds and Nef polyhedra are stored in compact binary
+	formats, see CGALUtils::writeNefPolyhedron() for the latter. Other users may store raw payloads using
+	their own id prefix, see getData().
+
+	The directory is kept below maxSizeMB() by evicting the least recently
+	used entries, using the file modification time as the access time.
+	Files are written to a temporary name and renamed into place, so several
+	processes can share one cache directory.
+
+	The cache is disabled until a path is set.
+
+	A second, shared tier (e.g. a directory on a network file system used by
+	a whole team or all CI agents) can be set with setSharedTier(). Since
+	cache keys are structural hashes of the subtrees, geometry entries are
+	valid on every machine with the same files. They are looked up there
+	after this cache misses, copied here on a hit, and inserted into both.
+	Raw payloads stay local.
+
+	Libraries may ship packages of precomputed entries for their standard
+	parts, see findPackages(). Packages are read-only and looked up after
+	both tiers miss.
+*/
+class DiskCache
+{
+public:
+	DiskCache() : maxsize(1024*1024*1024), totalsize(0), sharedtier(nullptr) {}
+
+	static DiskCache *instance() { if (!inst) inst = new DiskCache; return inst; }
+	// The shared tier behind instance(), see setSharedTier()
+	static DiskCache *shared() { if (!sharedinst) sharedinst = new DiskCache; return sharedinst; }
+
+	bool isEnabled() const { return !this->cachedir.empty(); }
+	const fs::path &path() const { return this->cachedir; }
+	void setPath(const std::string &path);
+	size_t maxSizeMB() const { return this->maxsize/(1024*1024); }
+	void setMaxSizeMB(size_t limit);
+	void setSharedTier(DiskCache *tier) { this->sharedtier = tier; }
+	/*!
+		Finds the packages in the given library directories: a library's
+		openscad-geometry/<version> directory holds cache entries made by
+		this version of OpenSCAD, e.g. by rendering the library's parts with
+		--cache-dir set to it. Only their names are read here.
+	*/
+	void findPackages(const std::vector<std::string> &librarypaths);
+
+	bool contains(const std::string &id) const;
+	shared_ptr<const Geometry> get(const std::string &id);
+	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom);
+	// Raw payloads, for data other than geometry (e.g. convex decompositions)
+	bool getData(const std::string &id, std::string &data);
+	bool insertData(const std::string &id, const std::string &data);
+	void remove(const std::string &id);
+	void print();
+
+	// The payload encoding of geometry entries, also used to pass results
+	// between processes. encode() returns false for unsupported types.
+	static bool encode(const shared_ptr<const Geometry> &geom, std::string &payload);
+	static shared_ptr<const Geometry> decode(const std::string &payload);
+
+private:
+	static DiskCache *inst;
+	static DiskCache *sharedinst;
+
+	struct Package {
+		fs::path dir;
+		std::unordered_set<uint64_t> hashes; // Of the ids of the entries
+	};
+
+	fs::path entryPath(const std::string &id) const;
+	static bool readEntry(const fs::path &path, const std::string &id, std::string &data);
+	shared_ptr<const Geometry> getPackaged(const std::string &id) const;
+	void trim();
+
+	fs::path cachedir;
+	size_t maxsize;
+	size_t totalsize;
+	DiskCache *sharedtier;
+	std::vector<Package> packages;
+	// Guards totalsize and eviction
+	std::mutex mutex;
+};
@@ -74,6 +74,19 @@ void DrawingCallback::add_glyph_advance(double advance_x, double advance_y)
 	advance += Vector2d(advance_x, advance_y);
 }
 
+void DrawingCallback::add_outlines(const Polygon2d::Outlines2d &outlines)
+{
+	if (this->outline.vertices.size() > 0) {
+		this->polygon->addOutline(this->outline);
+		this->outline.vertices.clear();
+	}
+	for (const auto &o : outlines) {
+		for (const auto &v : o.vertices) add_vertex(v);
+		this->polygon->addOutline(this->outline);
+		this->outline.vertices.clear();
+	}
+}
+
 void DrawingCallback::add_vertex(const Vector2d &v)
 {
 	this->outline.vertices.push_back(v + offset + advance);
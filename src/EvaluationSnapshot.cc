@@ -0,0 +1,223 @@
+#include "EvaluationSnapshot.h"
+#include "DiskCache.h"
+#include "GeometryCache.h"
+#include "GeometryEvaluator.h"
+#include "Tree.h"
+#include "node.h"
+#include "importnode.h"
+#include "linearextrudenode.h"
+#include "rotateextrudenode.h"
+#include "printutils.h"
+#include "version.h"
+#include "hash.h"
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#ifdef ENABLE_CGAL
+#include "CGALCache.h"
+#include "CGAL_Nef_polyhedron.h"
+#endif
+
+namespace {
+	const std::string snapshot_magic = "OpenSCAD snapshot";
+	// Bump when the format changes
+	const uint32_t snapshot_format_version = 2;
+
+	template <typename T> void write_value(std::ostream &out, const T &v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	template <typename T> bool read_value(std::istream &in, T &v)
+	{
+		return bool(in.read(reinterpret_cast<char *>(&v), sizeof(T)));
+	}
+
+	void write_string(std::ostream &out, const std::string &str)
+	{
+		write_value<uint64_t>(out, str.size());
+		out.write(str.data(), str.size());
+	}
+
+	bool read_string(std::istream &in, std::string &str, size_t limit)
+	{
+		uint64_t size;
+		if (!read_value(in, size) || size > limit) return false;
+		str.resize(size);
+		return size == 0 || bool(in.read(&str[0], size));
+	}
+
+	// The contents hash of a file, or false if it can't be read
+	bool hash_file(const std::string &filename, Hash128 &hash)
+	{
+		std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		std::ostringstream data;
+		data << in.rdbuf();
+		hash = hash128(data.str());
+		return true;
+	}
+
+	// Adds the files read by the nodes below root, e.g. by import()
+	void collect_files(const AbstractNode *root, std::unordered_set<std::string> &files)
+	{
+		std::unordered_set<const AbstractNode *> visited;
+		std::vector<const AbstractNode *> stack{root};
+		while (!stack.empty()) {
+			const AbstractNode *node = stack.back();
+			stack.pop_back();
+			if (!visited.insert(node).second) continue;
+			std::string filename;
+			if (auto import = dynamic_cast<const ImportNode *>(node)) filename = import->filename;
+			else if (auto extrude = dynamic_cast<const LinearExtrudeNode *>(node)) filename = extrude->filename;
+			else if (auto extrude = dynamic_cast<const RotateExtrudeNode *>(node)) filename = extrude->filename;
+			if (!filename.empty()) files.insert(filename);
+			for (auto child : node->getChildren()) stack.push_back(child);
+		}
+	}
+
+	// The result for key in the memory caches, if any
+	shared_ptr<const Geometry> cached_geometry(const std::string &key)
+	{
+		if (auto geom = GeometryCache::instance()->get(key)) return geom;
+#ifdef ENABLE_CGAL
+		if (auto N = CGALCache::instance()->get(key)) return N;
+#endif
+		return nullptr;
+	}
+
+	void cache_geometry(const std::string &key, const shared_ptr<const Geometry> &geom, double seconds)
+	{
+#ifdef ENABLE_CGAL
+		if (auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+			if (!CGALCache::instance()->contains(key)) CGALCache::instance()->insert(key, N, seconds);
+			return;
+		}
+#endif
+		if (!GeometryCache::instance()->contains(key)) GeometryCache::instance()->insert(key, geom, seconds);
+	}
+}
+
+std::string EvaluationSnapshot::path(const std::string &filename)
+{
+	const fs::path file(filename);
+	return (file.parent_path() / ("." + file.filename().string() + ".snapshot")).string();
+}
+
+/*!
+	The snapshot starts with the files read and their contents hashes,
+	followed by the entries, the root first: its cache key, the seconds it
+	took to compute and its payload.
+*/
+bool EvaluationSnapshot::save(const std::string &filename, const std::unordered_set<std::string> &dependencies,
+															const Tree &tree, const shared_ptr<const Geometry> &geom, double seconds)
+{
+	if (!tree.root() || !geom) return false;
+	std::string payload;
+	if (!DiskCache::encode(geom, payload)) return false;
+
+	std::unordered_set<std::string> files(dependencies);
+	files.insert(filename);
+	collect_files(tree.root(), files);
+
+	std::ostringstream out(std::ios::out | std::ios::binary);
+	write_string(out, snapshot_magic);
+	write_value(out, snapshot_format_version);
+	write_string(out, openscad_versionnumber);
+	write_value<uint64_t>(out, files.size());
+	for (const auto &file : files) {
+		write_string(out, file);
+		Hash128 hash;
+		uint8_t exists = hash_file(file, hash);
+		write_value(out, exists);
+		write_value(out, hash.h1);
+		write_value(out, hash.h2);
+	}
+
+	std::vector<std::pair<std::string, std::string>> entries;
+	entries.emplace_back(GeometryEvaluator::cacheKey(tree, *tree.root()), std::move(payload));
+	std::unordered_set<std::string> keys{entries[0].first};
+	for (auto child : tree.root()->getChildren()) {
+		auto key = GeometryEvaluator::cacheKey(tree, *child);
+		if (!keys.insert(key).second) continue;
+		auto childgeom = cached_geometry(key);
+		if (childgeom && DiskCache::encode(childgeom, payload)) entries.emplace_back(key, std::move(payload));
+	}
+	write_value<uint64_t>(out, entries.size());
+	for (size_t i = 0; i < entries.size(); ++i) {
+		write_string(out, entries[i].first);
+		write_value<double>(out, i == 0 ? seconds : 0);
+		write_string(out, entries[i].second);
+	}
+
+	// Written to a temporary name first, so a partial snapshot is never read
+	boost::system::error_code ec;
+	const fs::path snapshot(path(filename));
+	const fs::path tmppath(snapshot.string() + ".tmp");
+	{
+		const std::string data = out.str();
+		std::ofstream f(tmppath.string(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!f.write(data.data(), data.size())) {
+			f.close();
+			fs::remove(tmppath, ec);
+			return false;
+		}
+	}
+	fs::rename(tmppath, snapshot, ec);
+	if (ec) {
+		fs::remove(tmppath, ec);
+		return false;
+	}
+	PRINTDB("Snapshot saved: %s (%d entries)", snapshot.string() % entries.size());
+	return true;
+}
+
+shared_ptr<const Geometry> EvaluationSnapshot::load(const std::string &filename, std::string &key)
+{
+	std::ifstream f(path(filename).c_str(), std::ios::in | std::ios::binary);
+	if (!f.is_open()) return nullptr;
+	std::ostringstream data;
+	data << f.rdbuf();
+	const size_t limit = data.str().size();
+	std::istringstream in(data.str(), std::ios::in | std::ios::binary);
+
+	std::string magic, version;
+	uint32_t format;
+	if (!read_string(in, magic, limit) || magic != snapshot_magic ||
+			!read_value(in, format) || format != snapshot_format_version ||
+			!read_string(in, version, limit) || version != openscad_versionnumber) return nullptr;
+
+	uint64_t count;
+	if (!read_value(in, count)) return nullptr;
+	for (uint64_t i = 0; i < count; ++i) {
+		std::string file;
+		uint8_t existed;
+		Hash128 saved, hash;
+		if (!read_string(in, file, limit) || !read_value(in, existed) ||
+				!read_value(in, saved.h1) || !read_value(in, saved.h2)) return nullptr;
+		const bool exists = hash_file(file, hash);
+		if (exists != bool(existed) || (exists && hash != saved)) {
+			PRINTDB("Snapshot out of date, %s changed", file);
+			return nullptr;
+		}
+	}
+
+	shared_ptr<const Geometry> root;
+	if (!read_value(in, count)) return nullptr;
+	for (uint64_t i = 0; i < count; ++i) {
+		std::string entrykey, payload;
+		double seconds;
+		if (!read_string(in, entrykey, limit) || !read_value(in, seconds) || !read_string(in, payload, limit)) break;
+		auto geom = DiskCache::decode(payload);
+		if (!geom) break;
+		cache_geometry(entrykey, geom, seconds);
+		if (i == 0) {
+			root = geom;
+			key = entrykey;
+		}
+	}
+	return root;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <unordered_set>
+#include "memory.h"
+
+class Geometry;
+class AbstractNode;
+class Tree;
+
+/*!
+	The result of the last render of a design, saved next to its file so
+	that reopening it shows that result right away instead of after a full
+	parse, instantiation and render.
+
+	A snapshot holds the geometry of the root node and of its children, in
+	the DiskCache payload encoding, each with its cache key (see
+	GeometryEvaluator::cacheKey()). It also records the contents hash of
+	every file the design was read from: the main file, the included and
+	used files and the files imported. It's only loaded while all of them
+	are unchanged, which then puts its entries into the GeometryCache and
+	CGALCache, so a following render of the unchanged design is a cache hit.
+*/
+class EvaluationSnapshot
+{
+public:
+	// The file of the snapshot of the design in filename
+	static std::string path(const std::string &filename);
+
+	/*!
+		Saves the render result geom of the root of tree, which was read
+		from filename and the files in dependencies. Returns false if it
+		couldn't be written.
+	*/
+	static bool save(const std::string &filename, const std::unordered_set<std::string> &dependencies,
+									 const Tree &tree, const shared_ptr<const Geometry> &geom, double seconds);
+
+	/*!
+		Loads the snapshot of filename, returning the root geometry, or
+		nullptr if there is none or it's out of date. key is set to the
+		cache key of the root.
+	*/
+	static shared_ptr<const Geometry> load(const std::string &filename, std::string &key);
+};
@@ -33,6 +33,8 @@
 #include "parsersettings.h"
 #include "StatCache.h"
 #include "evalcontext.h"
+#include "NodeReuseCache.h"
+#include "progress.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 #include "boost-utils.h"
@@ -60,7 +62,7 @@ void FileModule::registerUse(const std::string path)
 	
 	if (boost::iequals(ext, ".otf") || boost::iequals(ext, ".ttf")) {
 		if (fs::is_regular(path)) {
-			FontCache::instance()->register_font_file(path);
+			FontCache::register_font_file(path);
 		} else {
 			PRINTB("ERROR: Can't read font with path '%s'", path);
 		}
@@ -95,6 +97,19 @@ time_t FileModule::include_modified(const IncludeFile &inc) const
 	return 0;
 }
 
+/*!
+	Adds the files this module was read from besides its own: the included
+	files and, recursively, the used libraries.
+*/
+void FileModule::collectDependencies(std::unordered_set<std::string> &files) const
+{
+	for (const auto &item : this->includes) files.insert(item.second.filename);
+	for (const auto &lib : this->usedlibs) {
+		if (!files.insert(lib).second) continue;
+		if (auto module = ModuleCache::instance()->lookup(lib)) module->collectDependencies(files);
+	}
+}
+
 /*!
 	Check if any dependencies have been modified and recompile them.
 	Returns true if anything was recompiled.
@@ -112,38 +127,36 @@ time_t FileModule::handleDependencies(bool is_root)
 	// If a lib in usedlibs was previously missing, we need to relocate it
 	// by searching the applicable paths. We can identify a previously missing module
 	// as it will have a relative path.
-	time_t latest = 0;
+	std::vector<std::string> libs;
 	for (auto filename : this->usedlibs) {
-
-		auto found = true;
-
 		// Get an absolute filename for the module
 		if (!fs::path(filename).is_absolute()) {
 			auto fullpath = find_valid_path(this->path, filename);
-			if (!fullpath.empty()) {
-				auto newfilename = fullpath.generic_string();
-				updates.emplace_back(filename, newfilename);
-				filename = newfilename;
-			}
-			else {
-				found = false;
-			}
+			if (fullpath.empty()) continue;
+			auto newfilename = fullpath.generic_string();
+			updates.emplace_back(filename, newfilename);
+			filename = newfilename;
 		}
+		libs.push_back(filename);
+	}
 
-		if (found) {
-			auto oldmodule = ModuleCache::instance()->lookup(filename);
-			FileModule *newmodule;
-			auto mtime = ModuleCache::instance()->evaluate(this->getFullpath(),filename, newmodule);
-			if (mtime > latest) latest = mtime;
-			auto changed = newmodule && newmodule != oldmodule;
-			// Detect appearance but not removal of files, and keep old module
-			// on compile errors (FIXME: Is this correct behavior?)
-			if (changed) {
-				PRINTDB("  %s: %p -> %p", filename % oldmodule % newmodule);
-			}
-			else {
-				PRINTDB("  %s: %p", filename % oldmodule);
-			}
+	// Parse the libraries concurrently, then evaluate them in order as before
+	ModuleCache::instance()->prefetch(this->getFullpath(), libs);
+
+	time_t latest = 0;
+	for (const auto &filename : libs) {
+		auto oldmodule = ModuleCache::instance()->lookup(filename);
+		FileModule *newmodule;
+		auto mtime = ModuleCache::instance()->evaluate(this->getFullpath(),filename, newmodule);
+		if (mtime > latest) latest = mtime;
+		auto changed = newmodule && newmodule != oldmodule;
+		// Detect appearance but not removal of files, and keep old module
+		// on compile errors (FIXME: Is this correct behavior?)
+		if (changed) {
+			PRINTDB("  %s: %p -> %p", filename % oldmodule % newmodule);
+		}
+		else {
+			PRINTDB("  %s: %p", filename % oldmodule);
 		}
 	}
 
@@ -155,6 +168,28 @@ time_t FileModule::handleDependencies(bool is_root)
 	return latest;
 }
 
+/*!
+	Returns true if a root modifier (!) is used in this file, its includes
+	or any library it uses, directly or indirectly. Dependencies must have
+	been handled.
+*/
+bool FileModule::hasRootTag() const
+{
+	std::unordered_set<const FileModule *> visited;
+	return hasRootTag(visited);
+}
+
+bool FileModule::hasRootTag(std::unordered_set<const FileModule *> &visited) const
+{
+	if (!visited.insert(this).second) return false;
+	if (this->scope.hasRootTag()) return true;
+	for (const auto &filename : this->usedlibs) {
+		auto lib = ModuleCache::instance()->lookup(filename);
+		if (lib && lib->hasRootTag(visited)) return true;
+	}
+	return false;
+}
+
 AbstractNode *FileModule::instantiate(const Context *ctx, const ModuleInstantiation *inst,
 																			EvalContext *evalctx) const
 {
@@ -164,8 +199,12 @@ AbstractNode *FileModule::instantiate(const Context *ctx, const ModuleInstantiat
 	return this->instantiateWithFileContext(&context, inst, evalctx);
 }
 
+/*!
+	If reuse is given, top-level statements which didn't change since the
+	last compile are taken from there instead of being instantiated again.
+*/
 AbstractNode *FileModule::instantiateWithFileContext(FileContext *ctx, const ModuleInstantiation *inst,
-																										 EvalContext *evalctx) const
+																										 EvalContext *evalctx, NodeReuseCache *reuse) const
 {
 	assert(evalctx == nullptr);
 	
@@ -173,10 +212,21 @@ AbstractNode *FileModule::instantiateWithFileContext(FileContext *ctx, const Mod
 	try {
 		ctx->initializeModule(*this); // May throw an ExperimentalFeatureException
 		// FIXME: Set document path to the path of the module
-		auto instantiatednodes = this->scope.instantiateChildren(ctx);
-		node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+		if (reuse) {
+			for (const auto &modinst : this->scope.children) {
+				if (auto child = reuse->instantiate(*modinst, ctx)) node->children.push_back(child);
+			}
+		}
+		else {
+			auto instantiatednodes = this->scope.instantiateChildren(ctx);
+			node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+		}
 	} catch (EvaluationException &e) {
 		//PRINT(e.what()); //please output the message before throwing the exception
+	} catch (const ProgressCancelException &) {
+		if (reuse) reuse->cancel(node);
+		else delete node;
+		throw;
 	}
 
 	return node;
@@ -17,7 +17,7 @@ public:
 
 	AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx = nullptr) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
-	AbstractNode *instantiateWithFileContext(class FileContext *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const;
+	AbstractNode *instantiateWithFileContext(class FileContext *ctx, const ModuleInstantiation *inst, EvalContext *evalctx, class NodeReuseCache *reuse = nullptr) const;
 
 	void setModulePath(const std::string &path) { this->path = path; }
 	const std::string &modulePath() const { return this->path; }
@@ -25,8 +25,10 @@ public:
 	void registerInclude(const std::string &localpath, const std::string &fullpath);
 	std::time_t includesChanged() const;
 	std::time_t handleDependencies(bool is_root = true);
+	void collectDependencies(std::unordered_set<std::string> &files) const;
 	bool hasIncludes() const { return !this->includes.empty(); }
 	bool usesLibraries() const { return !this->usedlibs.empty(); }
+	bool hasRootTag() const;
 	bool isHandlingDependencies() const { return this->is_handling_dependencies; }
 	void clearHandlingDependencies() { this->is_handling_dependencies = false; }
 	void setFilename(const std::string &filename) { this->filename = filename; }
@@ -37,11 +39,14 @@ public:
 	ModuleContainer usedlibs;
 
 private:
+	friend class ASTCache;
+
 	struct IncludeFile {
 		std::string filename;
 	};
 
 	std::time_t include_modified(const IncludeFile &inc) const;
+	bool hasRootTag(std::unordered_set<const FileModule *> &visited) const;
 
 	typedef std::unordered_map<std::string, struct IncludeFile> IncludeContainer;
 	IncludeContainer includes;
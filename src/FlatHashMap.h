@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+/*!
+	Insertion-ordered hash set of the small keys of the geometry code (grid
+	cells, vertices), which numbers the distinct keys in order of insertion.
+
+	The keys are stored in one vector, so the n-th distinct key has index n
+	and keys() can be used as the array of unique elements directly. The
+	table is open addressing with linear probing, at most half full, and
+	only holds the index of each key plus 32 bits of its hash, so most
+	mismatching slots are skipped without touching the key. Keys can't be
+	removed.
+*/
+template <class Key, class Hash = std::hash<Key>>
+class FlatHashIndex
+{
+public:
+	static const size_t npos = size_t(-1);
+
+	explicit FlatHashIndex(const Hash &hash = Hash()) : hash(hash), mask(0) {}
+
+	size_t size() const { return this->keys_.size(); }
+	bool empty() const { return this->keys_.empty(); }
+	// In order of insertion, i.e. by index
+	const std::vector<Key> &keys() const { return this->keys_; }
+	const Key &key(size_t i) const { return this->keys_[i]; }
+
+	void reserve(size_t n) {
+		this->keys_.reserve(n);
+		rehash(2 * n);
+	}
+
+	void clear() {
+		this->keys_.clear();
+		this->slots.clear();
+		this->mask = 0;
+	}
+
+	// Returns the index of key, or npos
+	size_t find(const Key &key) const {
+		if (this->slots.empty()) return npos;
+		const uint64_t h = this->hash(key);
+		const uint32_t tag = uint32_t(h >> 32);
+		for (size_t i = h & this->mask;; i = (i + 1) & this->mask) {
+			const Slot &slot = this->slots[i];
+			if (slot.index == 0) return npos;
+			if (slot.tag == tag && this->keys_[slot.index - 1] == key) return slot.index - 1;
+		}
+	}
+
+	// Inserts key unless it's there already. Returns its index and whether it was inserted.
+	std::pair<size_t, bool> insert(const Key &key) {
+		if (2 * (this->keys_.size() + 1) > this->slots.size()) rehash(2 * (this->keys_.size() + 1));
+		const uint64_t h = this->hash(key);
+		const uint32_t tag = uint32_t(h >> 32);
+		size_t i = h & this->mask;
+		for (;; i = (i + 1) & this->mask) {
+			const Slot &slot = this->slots[i];
+			if (slot.index == 0) break;
+			if (slot.tag == tag && this->keys_[slot.index - 1] == key) return std::make_pair(size_t(slot.index - 1), false);
+		}
+		this->keys_.push_back(key);
+		this->slots[i] = Slot{uint32_t(this->keys_.size()), tag};
+		return std::make_pair(this->keys_.size() - 1, true);
+	}
+
+private:
+	// index is the key's index + 1, 0 if the slot is empty
+	struct Slot {
+		uint32_t index;
+		uint32_t tag;
+	};
+
+	void rehash(size_t minsize) {
+		size_t size = 64;
+		while (size < minsize) size *= 2;
+		if (size <= this->slots.size()) return;
+		this->slots.assign(size, Slot{0, 0});
+		this->mask = size - 1;
+		for (size_t k = 0; k < this->keys_.size(); ++k) {
+			const uint64_t h = this->hash(this->keys_[k]);
+			size_t i = h & this->mask;
+			while (this->slots[i].index != 0) i = (i + 1) & this->mask;
+			this->slots[i] = Slot{uint32_t(k + 1), uint32_t(h >> 32)};
+		}
+	}
+
+	Hash hash;
+	std::vector<Key> keys_;
+	std::vector<Slot> slots;
+	size_t mask;
+};
+
+template <class Key, class Hash>
+const size_t FlatHashIndex<Key, Hash>::npos;
+
+/*!
+	FlatHashIndex with a value for each key, in a second vector by index.
+	Inserting invalidates references to the values, unlike in
+	std::unordered_map.
+*/
+template <class Key, class T, class Hash = std::hash<Key>>
+class FlatHashMap
+{
+public:
+	static const size_t npos = FlatHashIndex<Key, Hash>::npos;
+
+	explicit FlatHashMap(const Hash &hash = Hash()) : index(hash) {}
+
+	size_t size() const { return this->index.size(); }
+	bool empty() const { return this->index.empty(); }
+	const std::vector<Key> &keys() const { return this->index.keys(); }
+	const std::vector<T> &values() const { return this->values_; }
+	const Key &key(size_t i) const { return this->index.key(i); }
+	T &value(size_t i) { return this->values_[i]; }
+	const T &value(size_t i) const { return this->values_[i]; }
+
+	void reserve(size_t n) {
+		this->index.reserve(n);
+		this->values_.reserve(n);
+	}
+
+	void clear() {
+		this->index.clear();
+		this->values_.clear();
+	}
+
+	// Returns the index of key, or npos
+	size_t find(const Key &key) const { return this->index.find(key); }
+
+	// Inserts key with value unless it's there already. Returns its index and whether it was inserted.
+	std::pair<size_t, bool> emplace(const Key &key, const T &value) {
+		const auto result = this->index.insert(key);
+		if (result.second) this->values_.push_back(value);
+		return result;
+	}
+
+	T &operator[](const Key &key) { return this->values_[emplace(key, T()).first]; }
+
+private:
+	FlatHashIndex<Key, Hash> index;
+	std::vector<T> values_;
+};
+
+template <class Key, class T, class Hash>
+const size_t FlatHashMap<Key, T, Hash>::npos;
@@ -25,12 +25,15 @@
  */
 
 #include <iostream>
+#include <fstream>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include "boosty.h"
 #include "FontCache.h"
+#include "GlyphCache.h"
+#include "DiskCache.h"
 #include "PlatformUtils.h"
 #include "parsersettings.h"
 
@@ -99,6 +102,7 @@ const std::string &FontInfo::get_file() const
 }
 
 FontCache * FontCache::self = nullptr;
+std::vector<std::string> FontCache::pending_font_files;
 FontCache::InitHandlerFunc *FontCache::cb_handler = FontCache::defaultInitHandler;
 void *FontCache::cb_userdata = nullptr;
 const std::string FontCache::DEFAULT_FONT("Liberation Sans:style=Regular");
@@ -133,6 +137,14 @@ FontCache::FontCache()
 		return;
 	}
 
+	// fontconfig keeps a cache per font directory, validated by the directory's
+	// modification time. Where its default cache directories are read-only
+	// (e.g. in containers) it rescans all fonts on every start, so it may
+	// also write into the disk cache.
+	if (DiskCache::instance()->isEnabled()) {
+		add_cache_dir((DiskCache::instance()->path() / "fontconfig").generic_string());
+	}
+
 	// Add the built-in fonts & config
 	fs::path builtinfontpath(PlatformUtils::resourcePath("fonts"));
 	if (fs::is_directory(builtinfontpath)) {
@@ -165,6 +177,13 @@ FontCache::FontCache()
 	FontCacheInitializer initializer(this->config);
 	cb_handler(&initializer, cb_userdata);
 
+	for (const auto &path : pending_font_files) {
+		if (!FcConfigAppFontAddFile(this->config, reinterpret_cast<const FcChar8 *> (path.c_str()))) {
+			PRINTB("Can't register font '%s'", path);
+		}
+	}
+	pending_font_files.clear();
+
 	// For use by LibraryInfo
 	FcStrList *dirs = FcConfigGetFontDirs(this->config);
 	while (FcChar8 *dir = FcStrListNext(dirs)) {
@@ -213,13 +232,50 @@ void FontCache::registerProgressHandler(InitHandlerFunc *handler, void *userdata
 	FontCache::cb_userdata = userdata;
 }
 
+/**
+ * Setting up fontconfig is slow, so a use<> of a font file doesn't create
+ * the cache; the file is only added once text is rendered or fonts listed.
+ */
 void FontCache::register_font_file(const std::string &path)
 {
-	if (!FcConfigAppFontAddFile(this->config, reinterpret_cast<const FcChar8 *> (path.c_str()))) {
+	if (!self) {
+		pending_font_files.push_back(path);
+		return;
+	}
+	if (!self->config) return;
+	if (!FcConfigAppFontAddFile(self->config, reinterpret_cast<const FcChar8 *> (path.c_str()))) {
 		PRINTB("Can't register font '%s'", path);
 	}
 }
 
+/**
+ * Adds a directory for fontconfig's cache files, through a generated
+ * configuration file which is kept there as well.
+ */
+void FontCache::add_cache_dir(const std::string &path)
+{
+	boost::system::error_code ec;
+	fs::create_directories(path, ec);
+	if (!fs::is_directory(path, ec)) return;
+
+	std::string escaped;
+	for (const auto c : path) {
+		if (c == '&') escaped += "&amp;";
+		else if (c == '<') escaped += "&lt;";
+		else if (c == '>') escaped += "&gt;";
+		else escaped += c;
+	}
+	const std::string conf = (fs::path(path) / "cachedir.conf").generic_string();
+	{
+		std::ofstream out(conf.c_str(), std::ios::trunc);
+		out << "<?xml version=\"1.0\"?>\n"
+				<< "<!DOCTYPE fontconfig SYSTEM \"fonts.dtd\">\n"
+				<< "<fontconfig><cachedir>" << escaped << "</cachedir></fontconfig>\n";
+		if (!out) return;
+	}
+	FcConfigParseAndLoad(this->config, reinterpret_cast<const FcChar8 *>(conf.c_str()), false);
+}
+
 void FontCache::add_font_dir(const std::string &path)
 {
 	if (!fs::is_directory(path)) {
@@ -269,6 +325,7 @@ bool FontCache::is_init_ok() const
 void FontCache::clear()
 {
 	this->cache.clear();
+	GlyphCache::instance()->clear();
 }
 
 void FontCache::dump_cache(const std::string &info)
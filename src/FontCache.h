@@ -85,7 +85,8 @@ public:
     bool is_init_ok() const;
     FT_Face get_font(const std::string &font);
     bool is_windows_symbol_font(const FT_Face &face) const;
-    void register_font_file(const std::string &path);
+    // Font files registered before the cache is created are added when it is
+    static void register_font_file(const std::string &path);
     void clear();
     FontInfoList *list_fonts() const;
     const std::string get_freetype_version() const;
@@ -100,6 +101,7 @@ private:
     typedef std::map<std::string, cache_entry_t> cache_t;
 
     static FontCache *self;
+    static std::vector<std::string> pending_font_files;
     static InitHandlerFunc *cb_handler;
     static void *cb_userdata;
 
@@ -114,6 +116,7 @@ private:
     void dump_cache(const std::string &info);
     
     void add_font_dir(const std::string &path);
+    void add_cache_dir(const std::string &path);
     void init_pattern(FcPattern *pattern) const;
     
     FT_Face find_face(const std::string &font) const;
@@ -193,6 +193,40 @@ void FreetypeRenderer::detect_properties(FreetypeRenderer::Params &params) const
 	params.set_direction(hb_direction_to_string(direction));
 }
 
+/*!
+	Returns the outlines of the given glyph of face, which must already be
+	set to the size of params. The outlines come from the GlyphCache if
+	possible; otherwise FreeType loads and decomposes the glyph, and it's
+	cached. Returns nullptr if the glyph can't be loaded.
+*/
+std::shared_ptr<const GlyphCache::Glyph> FreetypeRenderer::load_glyph(FT_Face face, unsigned int glyph_index, const FreetypeRenderer::Params &params) const
+{
+	const auto key = GlyphCache::key(face, glyph_index, params.size, params.segments);
+	auto cached = GlyphCache::instance()->get(key);
+	if (cached) return cached;
+
+	if (FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT)) return nullptr;
+	FT_Glyph ft_glyph;
+	if (FT_Get_Glyph(face->glyph, &ft_glyph)) return nullptr;
+
+	auto glyph = std::make_shared<GlyphCache::Glyph>();
+	FT_Glyph_Get_CBox(ft_glyph, FT_GLYPH_BBOX_GRIDFIT, &glyph->cbox);
+
+	DrawingCallback callback(params.segments);
+	callback.start_glyph();
+	FT_Outline outline = reinterpret_cast<FT_OutlineGlyph>(ft_glyph)->outline;
+	FT_Outline_Decompose(&outline, &funcs, &callback);
+	callback.finish_glyph();
+	for (auto geom : callback.get_result()) {
+		glyph->outlines = static_cast<const Polygon2d *>(geom)->outlines();
+		delete geom;
+	}
+	FT_Done_Glyph(ft_glyph);
+
+	GlyphCache::instance()->insert(key, glyph);
+	return glyph;
+}
+
 std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::Params &params) const
 {
 	FT_Face face;
@@ -256,28 +290,19 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
 	GlyphArray glyph_array;
 	for (unsigned int idx = 0;idx < glyph_count;idx++) {
 		FT_UInt glyph_index = glyph_info[idx].codepoint;
-		error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-		if (error) {
+		auto glyph = load_glyph(face, glyph_index, params);
+		if (!glyph) {
 			PRINTB("Could not load glyph %u for char at index %u in text '%s'", glyph_index % idx % params.text);
 			continue;
 		}
-
-		FT_Glyph glyph;
-		error = FT_Get_Glyph(face->glyph, &glyph);
-		if (error) {
-			PRINTB("Could not get glyph %u for char at index %u in text '%s'", glyph_index % idx % params.text);
-			continue;
-		}
-		const GlyphData *glyph_data = new GlyphData(glyph, idx, &glyph_pos[idx]);
-		glyph_array.push_back(glyph_data);
+		glyph_array.emplace_back(glyph, idx, &glyph_pos[idx]);
 	}
 
 	double width = 0, ascend = 0, descend = 0;
-	for (GlyphArray::iterator it = glyph_array.begin();it != glyph_array.end();it++) {
-		const GlyphData *glyph = (*it);
+	for (const auto &glyph_data : glyph_array) {
+		const GlyphData *glyph = &glyph_data;
 		
-		FT_BBox bbox;
-		FT_Glyph_Get_CBox(glyph->get_glyph(), FT_GLYPH_BBOX_GRIDFIT, &bbox);
+		const FT_BBox &bbox = glyph->get_glyph().cbox;
 		
 		if (HB_DIRECTION_IS_HORIZONTAL(hb_buffer_get_direction(hb_buf))) {
 			double asc = std::max(0.0, bbox.yMax / 64.0 / 16.0);
@@ -295,13 +320,12 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
 	double x_offset = calc_x_offset(params.halign, width);
 	double y_offset = calc_y_offset(params.valign, ascend, descend);
 
-	for (GlyphArray::iterator it = glyph_array.begin();it != glyph_array.end();it++) {
-		const GlyphData *glyph = (*it);
+	for (const auto &glyph_data : glyph_array) {
+		const GlyphData *glyph = &glyph_data;
 		
 		callback.start_glyph();
 		callback.set_glyph_offset(x_offset + glyph->get_x_offset(), y_offset + glyph->get_y_offset());
-		FT_Outline outline = reinterpret_cast<FT_OutlineGlyph>(glyph->get_glyph())->outline;
-		FT_Outline_Decompose(&outline, &funcs, &callback);
+		callback.add_outlines(glyph->get_glyph().outlines);
 
 		double adv_x  = glyph->get_x_advance() * params.spacing;
 		double adv_y  = glyph->get_y_advance() * params.spacing;
@@ -25,6 +25,7 @@
  */
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <ostream>
@@ -34,6 +35,8 @@
 #include FT_FREETYPE_H
 #include FT_GLYPH_H
 
+#include "GlyphCache.h"
+
 class FreetypeRenderer {
 public:
     class Params {
@@ -110,32 +113,22 @@ private:
     
     class GlyphData {
     public:
-        GlyphData(FT_Glyph glyph, unsigned int idx, hb_glyph_position_t *glyph_pos) : glyph(glyph), idx(idx), glyph_pos(glyph_pos) {}
+        GlyphData(const std::shared_ptr<const GlyphCache::Glyph> &glyph, unsigned int idx, hb_glyph_position_t *glyph_pos) : glyph(glyph), idx(idx), glyph_pos(glyph_pos) {}
         unsigned int get_idx() const { return idx; };
-        FT_Glyph get_glyph() const { return glyph; };
+        const GlyphCache::Glyph &get_glyph() const { return *glyph; };
         double get_x_offset() const { return glyph_pos->x_offset / 64.0 / 16.0; };
         double get_y_offset() const { return glyph_pos->y_offset / 64.0 / 16.0; };
         double get_x_advance() const { return glyph_pos->x_advance / 64.0 / 16.0; };
         double get_y_advance() const { return glyph_pos->y_advance / 64.0 / 16.0; };
     private:
-        FT_Glyph glyph;
+        std::shared_ptr<const GlyphCache::Glyph> glyph;
         unsigned int idx;
         hb_glyph_position_t *glyph_pos;
     };
 
-    struct done_glyph : public std::unary_function<const GlyphData *, void> {
-        void operator() (const GlyphData *glyph_data) {
-            FT_Done_Glyph(glyph_data->get_glyph());
-            delete glyph_data;
-        }
-    };
+    typedef std::vector<GlyphData> GlyphArray;
 
-    class GlyphArray : public std::vector<const GlyphData *> {
-    public:
-        virtual ~GlyphArray() {
-            std::for_each(begin(), end(), done_glyph());
-        }
-    };
+    std::shared_ptr<const GlyphCache::Glyph> load_glyph(FT_Face face, unsigned int glyph_index, const FreetypeRenderer::Params &params) const;
 
     bool is_ignored_script(const hb_script_t script) const;
     hb_script_t get_script(const FreetypeRenderer::Params &params, hb_glyph_info_t *glyph_info, unsigned int glyph_count) const;
@@ -0,0 +1,132 @@
+#include "FunctionCache.h"
+#include "printutils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <boost/functional/hash.hpp>
+
+FunctionCache *FunctionCache::inst = nullptr;
+thread_local FunctionCache::Tracker *FunctionCache::Tracker::current = nullptr;
+
+namespace {
+	uint64_t bits(double d)
+	{
+		uint64_t b;
+		std::memcpy(&b, &d, sizeof(b));
+		return b;
+	}
+
+	size_t hash_arg(const ValuePtr &v)
+	{
+		switch (v->type()) {
+		case Value::ValueType::UNDEFINED: return 0;
+		case Value::ValueType::BOOL: return v->toBool() ? 1 : 2;
+		case Value::ValueType::NUMBER: return std::hash<uint64_t>()(bits(v->toDouble()));
+		default: return std::hash<const Value *>()(v.get());
+		}
+	}
+
+}
+
+bool FunctionCache::sameValue(const ValuePtr &a, const ValuePtr &b)
+{
+	if (a.get() == b.get()) return true;
+	if (a->type() != b->type()) return false;
+	switch (a->type()) {
+	case Value::ValueType::UNDEFINED: return true;
+	case Value::ValueType::BOOL: return a->toBool() == b->toBool();
+	case Value::ValueType::NUMBER: return bits(a->toDouble()) == bits(b->toDouble());
+	default: return false;
+	}
+}
+
+FunctionCache::Key::Key(const ASTNode *callee, std::vector<ValuePtr> &&args)
+	: callee(callee), args(std::move(args))
+{
+	size_t seed = std::hash<const ASTNode *>()(callee);
+	for (const auto &arg : this->args) boost::hash_combine(seed, hash_arg(arg));
+	this->hashValue = seed;
+}
+
+bool FunctionCache::Key::operator==(const Key &other) const
+{
+	if (this->hashValue != other.hashValue || this->callee != other.callee) return false;
+	if (this->args.size() != other.args.size()) return false;
+	for (size_t i = 0; i < this->args.size(); ++i) {
+		if (!sameValue(this->args[i], other.args[i])) return false;
+	}
+	return true;
+}
+
+FunctionCache::Tracker::Tracker(const Context *scope, ConfigReads *configReads)
+	: callScope(scope), configReads(configReads), outer(current), messages(printedMessageCount()), pure(true)
+{
+	current = this;
+}
+
+FunctionCache::Tracker::~Tracker()
+{
+	current = this->outer;
+}
+
+bool FunctionCache::Tracker::isPure() const
+{
+	return this->pure && printedMessageCount() == this->messages;
+}
+
+void FunctionCache::Tracker::taint()
+{
+	for (Tracker *t = current; t; t = t->outer) t->pure = false;
+}
+
+void FunctionCache::Tracker::configLookup(const VariableName &name, const ValuePtr &value,
+																					const std::vector<const Context *> &stack, int index)
+{
+	for (Tracker *t = current; t; t = t->outer) {
+		// The result of a function call would depend on its caller
+		if (!t->configReads) {
+			t->pure = false;
+			continue;
+		}
+		// Variables set within the call depend on what it has seen before
+		auto scope = std::find(stack.rbegin(), stack.rend(), t->callScope);
+		if (scope != stack.rend() && index > stack.rend() - scope - 1) continue;
+		auto &reads = *t->configReads;
+		if (std::none_of(reads.begin(), reads.end(), [&name](const std::pair<VariableName, ValuePtr> &read) {
+					return read.first == name;
+				})) {
+			reads.emplace_back(name, value);
+		}
+	}
+}
+
+bool FunctionCache::get(const Key &key, ValuePtr &result)
+{
+	if (this->cache.get(key, result)) {
+		this->hits++;
+		return true;
+	}
+	this->misses++;
+	return false;
+}
+
+void FunctionCache::insert(const Key &key, const ValuePtr &result)
+{
+	this->cache.insert(key, result, 1);
+}
+
+void FunctionCache::clear()
+{
+	this->cache.clear();
+	this->hits = 0;
+	this->misses = 0;
+}
+
+void FunctionCache::print()
+{
+	const size_t hits = this->hits, misses = this->misses;
+	if (hits + misses == 0) return;
+	PRINTDB("Function cache: %d hits, %d misses (%d%% hit rate), %d entries",
+					hits % misses % (100 * hits / (hits + misses)) % this->cache.size());
+}
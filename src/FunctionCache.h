@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include "ShardedCache.h"
+#include "value.h"
+#include "VariableName.h"
+
+class ASTNode;
+class Context;
+
+/*!
+	Results of calls of user functions, keyed by the function and the values
+	its parameters were bound to.
+
+	A call is only remembered if its evaluation turned out to be pure: it
+	printed nothing, looked up neither config variables nor variables from
+	outside the called function (which would make the result depend on the
+	caller or on the context the function was defined in), and called
+	nothing impure such as unseeded rands(). This is detected while
+	evaluating, see Tracker.
+
+	Strings, vectors and ranges are compared by identity rather than by
+	value, so building and comparing a key takes constant time per argument,
+	regardless of the size of the arguments. Numbers are compared bitwise.
+
+	Entries refer to the functions by address, so the cache must be cleared
+	before any function is deleted; it is cleared after each compile.
+*/
+class FunctionCache
+{
+public:
+	class Key
+	{
+	public:
+		// callee is the user function or module being called
+		Key(const ASTNode *callee, std::vector<ValuePtr> &&args);
+		bool operator==(const Key &other) const;
+		size_t hash() const { return this->hashValue; }
+
+		struct Hash {
+			size_t operator()(const Key &key) const { return key.hash(); }
+		};
+
+	private:
+		const ASTNode *callee;
+		std::vector<ValuePtr> args;
+		size_t hashValue;
+	};
+
+	/*!
+		While alive, watches the evaluation of a function call on the current
+		thread. scope is the context holding the parameters of the call;
+		variable lookups going past it taint the call.
+
+		Trackers nest: tainting a call taints all calls being evaluated
+		around it on the same thread.
+
+		Looking up a config variable taints the call, unless configReads is
+		given: then variables which the caller (or the call itself, from its
+		arguments) provides are recorded there with the values seen, and
+		the call stays pure as long as the same values are seen again. This
+		is used for module calls, see ModuleCallCache.
+	*/
+	class Tracker
+	{
+	public:
+		typedef std::vector<std::pair<VariableName, ValuePtr>> ConfigReads;
+
+		Tracker(const Context *scope, ConfigReads *configReads = nullptr);
+		~Tracker();
+		bool isPure() const;
+
+		static bool active() { return current != nullptr; }
+		// The scope of the innermost call being tracked, if any
+		static const Context *scope() { return current ? current->callScope : nullptr; }
+		// Marks all calls being evaluated on this thread as impure
+		static void taint();
+		/*!
+			Called for each lookup of a config variable while active(). The
+			variable was found at index of the context stack, or is undefined
+			if index is -1.
+		*/
+		static void configLookup(const VariableName &name, const ValuePtr &value,
+														 const std::vector<const Context *> &stack, int index);
+
+	private:
+		static thread_local Tracker *current;
+
+		const Context *callScope;
+		ConfigReads *configReads;
+		Tracker *outer;
+		size_t messages;
+		bool pure;
+	};
+
+	// Whether the values are the same for the purpose of caching
+	static bool sameValue(const ValuePtr &a, const ValuePtr &b);
+
+	FunctionCache(size_t maxentries = 100000) : cache(maxentries), hits(0), misses(0) {}
+
+	static FunctionCache *instance() { if (!inst) inst = new FunctionCache; return inst; }
+
+	bool get(const Key &key, ValuePtr &result);
+	void insert(const Key &key, const ValuePtr &result);
+	void clear();
+	void print();
+
+private:
+	static FunctionCache *inst;
+
+	ShardedCache<Key, ValuePtr, Key::Hash> cache;
+	std::atomic<size_t> hits, misses;
+};
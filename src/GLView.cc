@@ -26,6 +26,7 @@ GLView::GLView()
   showaxes = false;
   showcrosshairs = false;
   showscale = false;
+  refine_budget = 0;
   renderer = nullptr;
   colorscheme = &ColorMap::inst()->defaultColorScheme();
   cam = Camera();
@@ -36,7 +37,7 @@ GLView::GLView()
   opencsg_support = true;
   static int sId = 0;
   this->opencsg_id = sId++;
-  for (int i = 0; i < 10; i++) this->shaderinfo[i] = 0;
+  for (auto &info : this->shaderinfo) info = 0;
 #endif
 }
 
@@ -73,10 +74,6 @@ void GLView::setColorScheme(const std::string &cs)
 
 void GLView::resizeGL(int w, int h)
 {
-#ifdef ENABLE_OPENCSG
-  shaderinfo[9] = w;
-  shaderinfo[10] = h;
-#endif
   cam.pixel_width = w;
   cam.pixel_height = h;
   glViewport(0, 0, w, h);
@@ -149,7 +146,9 @@ void GLView::paintGL()
     // FIXME: This belongs in the OpenCSG renderer, but it doesn't know about this ID yet
     OpenCSG::setContext(this->opencsg_id);
 #endif
+    this->renderer->setRefineBudget(this->refine_budget);
     this->renderer->draw(showfaces, showedges);
+    if (!this->renderer->isRefined()) scheduleRefinement();
   }
 
   glDisable(GL_LIGHTING);
@@ -194,43 +193,21 @@ void GLView::enable_opencsg_shaders()
     Uniforms:
       1 color1 - face color
       2 color2 - edge color
-      7 xscale
-      8 yscale
 
     Attributes:
-      3 trig
-      4 pos_b
-      5 pos_c
-      6 mask
-
-    Other:
-      9 width
-      10 height
+      3 bary - barycentric coordinates, see PolySet::surface_vertices()
 
     Outputs:
-      tp
-      tr
+      tb
       shading
    */
     const char *vs_source =
-      "uniform float xscale, yscale;\n"
-      "attribute vec3 pos_b, pos_c;\n"
-      "attribute vec3 trig, mask;\n"
-      "varying vec3 tp, tr;\n"
+      "attribute vec3 bary;\n"
+      "varying vec3 tb;\n"
       "varying float shading;\n"
       "void main() {\n"
-      "  vec4 p0 = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
-      "  vec4 p1 = gl_ModelViewProjectionMatrix * vec4(pos_b, 1.0);\n"
-      "  vec4 p2 = gl_ModelViewProjectionMatrix * vec4(pos_c, 1.0);\n"
-      "  float a = distance(vec2(xscale*p1.x/p1.w, yscale*p1.y/p1.w), vec2(xscale*p2.x/p2.w, yscale*p2.y/p2.w));\n"
-      "  float b = distance(vec2(xscale*p0.x/p0.w, yscale*p0.y/p0.w), vec2(xscale*p1.x/p1.w, yscale*p1.y/p1.w));\n"
-      "  float c = distance(vec2(xscale*p0.x/p0.w, yscale*p0.y/p0.w), vec2(xscale*p2.x/p2.w, yscale*p2.y/p2.w));\n"
-      "  float s = (a + b + c) / 2.0;\n"
-      "  float A = sqrt(s*(s-a)*(s-b)*(s-c));\n"
-      "  float ha = 2.0*A/a;\n"
-      "  gl_Position = p0;\n"
-      "  tp = mask * ha;\n"
-      "  tr = trig;\n"
+      "  gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+      "  tb = bary;\n"
       "  vec3 normal, lightDir;\n"
       "  normal = normalize(gl_NormalMatrix * gl_Normal);\n"
       "  lightDir = normalize(vec3(gl_LightSource[0].position));\n"
@@ -239,17 +216,18 @@ void GLView::enable_opencsg_shaders()
 
     /*
       Inputs:
-        tp && tr - if any components of tp < tr, use color2 (edge color)
-        shading  - multiplied by color1. color2 is is without lighting
+        tb      - within about a pixel of 0 in any component, use color2 (edge color),
+                  blended over a pixel for smooth lines
+        shading - multiplied by color1. color2 is is without lighting
 		*/
     const char *fs_source =
       "uniform vec4 color1, color2;\n"
-      "varying vec3 tp, tr, tmp;\n"
+      "varying vec3 tb;\n"
       "varying float shading;\n"
       "void main() {\n"
-      "  gl_FragColor = vec4(color1.r * shading, color1.g * shading, color1.b * shading, color1.a);\n"
-      "  if (tp.x < tr.x || tp.y < tr.y || tp.z < tr.z)\n"
-      "    gl_FragColor = color2;\n"
+      "  vec3 px = tb / max(fwidth(tb), vec3(1e-6));\n"
+      "  float edge = smoothstep(0.5, 1.5, min(px.x, min(px.y, px.z)));\n"
+      "  gl_FragColor = mix(color2, vec4(color1.r * shading, color1.g * shading, color1.b * shading, color1.a), edge);\n"
       "}\n";
 
     auto vs = glCreateShader(GL_VERTEX_SHADER);
@@ -268,12 +246,7 @@ void GLView::enable_opencsg_shaders()
     shaderinfo[0] = edgeshader_prog;
     shaderinfo[1] = glGetUniformLocation(edgeshader_prog, "color1");
     shaderinfo[2] = glGetUniformLocation(edgeshader_prog, "color2");
-    shaderinfo[3] = glGetAttribLocation(edgeshader_prog, "trig");
-    shaderinfo[4] = glGetAttribLocation(edgeshader_prog, "pos_b");
-    shaderinfo[5] = glGetAttribLocation(edgeshader_prog, "pos_c");
-    shaderinfo[6] = glGetAttribLocation(edgeshader_prog, "mask");
-    shaderinfo[7] = glGetUniformLocation(edgeshader_prog, "xscale");
-    shaderinfo[8] = glGetUniformLocation(edgeshader_prog, "yscale");
+    shaderinfo[3] = glGetAttribLocation(edgeshader_prog, "bary");
 
     auto err = glGetError();
     if (err != GL_NO_ERROR) {
@@ -57,6 +57,8 @@ public:
 	virtual bool save(const char *filename) = 0;
 	virtual std::string getRendererInfo() const = 0;
 	virtual float getDPI() { return 1.0f; }
+	// Called after a frame the renderer couldn't finish within refine_budget
+	virtual void scheduleRefinement() {}
 
 	Renderer *renderer;
 	const ColorScheme *colorscheme;
@@ -68,9 +70,10 @@ public:
 	bool showedges;
 	bool showcrosshairs;
 	bool showscale;
+	double refine_budget; // Seconds per frame, 0 to draw each frame in full
 
 #ifdef ENABLE_OPENCSG
-	GLint shaderinfo[11];
+	GLint shaderinfo[4]; // The edge shader's program and locations, see enable_opencsg_shaders()
 	bool is_opencsg_capable;
 	bool has_shaders;
 	void enable_opencsg_shaders();
@@ -13,7 +13,10 @@ public:
   typedef std::pair<const class AbstractNode *, shared_ptr<const Geometry>> GeometryItem;
   typedef std::list<GeometryItem> Geometries;
 
-	Geometry() : convexity(1) {}
+	// The concrete class, see geometry_cast()
+	enum class Kind { POLYSET, POLYGON2D, NEF_POLYHEDRON, INSTANCED_POLYSET };
+
+	Geometry(Kind kind) : convexity(1), kind(kind) {}
 	virtual ~Geometry() {}
 
 	virtual size_t memsize() const = 0;
@@ -25,7 +28,28 @@ public:
 
 	unsigned int getConvexity() const { return convexity; }
 	void setConvexity(int c) { this->convexity = c; }
+	Kind getKind() const { return this->kind; }
 
 protected:
 	int convexity;
+
+private:
+	Kind kind;
 };
+
+/*!
+	Casts geom to the geometry class T if it is one, like dynamic_pointer_cast,
+	but by comparing the kind instead of with RTTI. nullptr otherwise.
+*/
+template <class T, class G>
+shared_ptr<T> geometry_cast(const shared_ptr<G> &geom)
+{
+	return geom && geom->getKind() == T::KIND ? static_pointer_cast<T>(geom) : nullptr;
+}
+
+// The same for plain pointers, like dynamic_cast
+template <class T, class G>
+T *geometry_cast(G *geom)
+{
+	return geom && geom->getKind() == T::KIND ? static_cast<T *>(geom) : nullptr;
+}
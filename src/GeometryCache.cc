@@ -8,20 +8,79 @@
   #include "CGAL_Nef_polyhedron.h"
 #endif
 
+GeometryPool *GeometryPool::inst = nullptr;
 GeometryCache *GeometryCache::inst = nullptr;
 
+bool GeometryPool::contains(Member member, const std::string &id) const
+{
+	if (this->cache.contains(key(member, id))) return true;
+	this->misscounts[int(member)]++;
+	return false;
+}
+
+shared_ptr<const Geometry> GeometryPool::get(Member member, const std::string &id) const
+{
+	// Another thread may have evicted the entry since contains() was called
+	cache_entry entry;
+	if (!this->cache.get(key(member, id), entry)) {
+		this->misscounts[int(member)]++;
+		return nullptr;
+	}
+	this->hitcounts[int(member)]++;
+	return entry.geom;
+}
+
+bool GeometryPool::insert(Member member, const std::string &id, const shared_ptr<const Geometry> &geom, double seconds)
+{
+	return this->cache.insert(key(member, id), cache_entry(geom), geom ? geom->memsize() : 0, seconds);
+}
+
+void GeometryPool::setLimit(Member member, size_t limit)
+{
+	this->limits[int(member)] = limit;
+	this->cache.setMaxCost(this->limits[0] + this->limits[1]);
+}
+
+void GeometryPool::clear(Member member)
+{
+	const char t = tag(member);
+	this->cache.removeIf([t](const std::string &key) { return key[0] == t; });
+}
+
+std::pair<size_t, size_t> GeometryPool::usage(Member member) const
+{
+	const char t = tag(member);
+	return this->cache.usage([t](const std::string &key) { return key[0] == t; });
+}
+
+GeometryPool::cache_entry::cache_entry(const shared_ptr<const Geometry> &geom)
+	: geom(geom)
+{
+	if (print_messages_stack.size() > 0) this->msg = print_messages_stack.back();
+}
+
+GeometryCache::GeometryCache(size_t memorylimit)
+{
+	GeometryPool::instance()->setLimit(GeometryPool::Member::GEOMETRY, memorylimit);
+}
+
+bool GeometryCache::contains(const std::string &id) const
+{
+	return GeometryPool::instance()->contains(GeometryPool::Member::GEOMETRY, id);
+}
+
 shared_ptr<const Geometry> GeometryCache::get(const std::string &id) const
 {
-	const auto &geom = this->cache[id]->geom;
+	auto geom = GeometryPool::instance()->get(GeometryPool::Member::GEOMETRY, id);
 #ifdef DEBUG
-	PRINTDB("Geometry Cache hit: %s (%d bytes)", id.substr(0, 40) % (geom ? geom->memsize() : 0));
+	if (geom) PRINTDB("Geometry Cache hit: %s (%d bytes)", id.substr(0, 40) % geom->memsize());
 #endif
 	return geom;
 }
 
-bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom)
+bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometry> &geom, double seconds)
 {
-	auto inserted = this->cache.insert(id, new cache_entry(geom), geom ? geom->memsize() : 0);
+	auto inserted = GeometryPool::instance()->insert(GeometryPool::Member::GEOMETRY, id, geom, seconds);
 #ifdef DEBUG
 	assert(!dynamic_cast<const CGAL_Nef_polyhedron*>(geom.get()));
 	if (inserted) PRINTDB("Geometry Cache insert: %s (%d bytes)",
@@ -34,22 +93,26 @@ bool GeometryCache::insert(const std::string &id, const shared_ptr<const Geometr
 
 size_t GeometryCache::maxSizeMB() const
 {
-	return this->cache.maxCost()/(1024*1024);
+	return GeometryPool::instance()->limit(GeometryPool::Member::GEOMETRY)/(1024*1024);
 }
 
 void GeometryCache::setMaxSizeMB(size_t limit)
 {
-	this->cache.setMaxCost(limit*1024*1024);
+	GeometryPool::instance()->setLimit(GeometryPool::Member::GEOMETRY, limit*1024*1024);
 }
 
-void GeometryCache::print()
+void GeometryCache::clear()
 {
-	PRINTB("Geometries in cache: %d", this->cache.size());
-	PRINTB("Geometry cache size in bytes: %d", this->cache.totalCost());
+	GeometryPool::instance()->clear(GeometryPool::Member::GEOMETRY);
 }
 
-GeometryCache::cache_entry::cache_entry(const shared_ptr<const Geometry> &geom)
-	: geom(geom)
+void GeometryCache::print()
 {
-	if (print_messages_stack.size() > 0) this->msg = print_messages_stack.back();
+	const auto pool = GeometryPool::instance();
+	const auto usage = pool->usage(GeometryPool::Member::GEOMETRY);
+	PRINTB("Geometries in cache: %d", usage.first);
+	PRINTB("Geometry cache size in bytes: %d", usage.second);
+	const auto stats = pool->stats();
+	PRINTB("Geometry and CGAL cache: %d hits, %d misses, %d evictions (%d bytes), shared limit %d bytes",
+				 stats.hits % stats.misses % stats.evictions % stats.evictedCost % pool->maxCost());
 }
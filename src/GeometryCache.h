@@ -1,33 +1,79 @@
 #pragma once
 
-#include "cache.h"
+#include "ShardedCache.h"
 #include "memory.h"
 #include "Geometry.h"
 
+/*!
+	The memory of the GeometryCache and the CGALCache. Both keep their
+	entries in one ShardedCache, their ids prefixed by a tag of the cache,
+	with the sum of both limits as its budget. Entries are weighted by the
+	time they took to compute, so that budget goes to whatever is most
+	expensive to recompute per byte, meshes or Nef polyhedra alike.
+*/
+class GeometryPool
+{
+	struct cache_entry {
+		shared_ptr<const class Geometry> geom;
+		std::string msg;
+		cache_entry() {}
+		cache_entry(const shared_ptr<const Geometry> &geom);
+		~cache_entry() { }
+	};
+	typedef ShardedCache<std::string, cache_entry> cache_type;
+
+public:
+	enum class Member { GEOMETRY, CGAL };
+
+	static GeometryPool *instance() { if (!inst) inst = new GeometryPool; return inst; }
+
+	bool contains(Member member, const std::string &id) const;
+	shared_ptr<const Geometry> get(Member member, const std::string &id) const;
+	bool insert(Member member, const std::string &id, const shared_ptr<const Geometry> &geom, double seconds);
+	size_t limit(Member member) const { return this->limits[int(member)]; }
+	void setLimit(Member member, size_t limit);
+	void clear(Member member);
+	// The number and total size of the entries of member
+	std::pair<size_t, size_t> usage(Member member) const;
+	// Lookups of member, counted like ShardedCache::stats()
+	size_t hits(Member member) const { return this->hitcounts[int(member)]; }
+	size_t misses(Member member) const { return this->misscounts[int(member)]; }
+	cache_type::Stats stats() const { return this->cache.stats(); }
+	size_t maxCost() const { return this->cache.maxCost(); }
+
+private:
+	GeometryPool() : cache(0) {
+		for (int i = 0; i < 2; ++i) this->limits[i] = this->hitcounts[i] = this->misscounts[i] = 0;
+	}
+	static GeometryPool *inst;
+
+	static char tag(Member member) { return char('0' + int(member)); }
+	static std::string key(Member member, const std::string &id) { return tag(member) + id; }
+
+	// Sharded, so concurrent GeometryEvaluators don't serialize on one lock
+	mutable cache_type cache;
+	std::atomic<size_t> limits[2];
+	mutable std::atomic<size_t> hitcounts[2], misscounts[2];
+};
+
 class GeometryCache
 {
 public:	
-	GeometryCache(size_t memorylimit = 100*1024*1024) : cache(memorylimit) {}
+	GeometryCache(size_t memorylimit = 100*1024*1024);
 
 	static GeometryCache *instance() { if (!inst) inst = new GeometryCache; return inst; }
 
-	bool contains(const std::string &id) const { return this->cache.contains(id); }
+	bool contains(const std::string &id) const;
 	shared_ptr<const class Geometry> get(const std::string &id) const;
-	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom);
+	// seconds is the time geom took to compute, which weighs against evicting it
+	bool insert(const std::string &id, const shared_ptr<const Geometry> &geom, double seconds = 0);
 	size_t maxSizeMB() const;
 	void setMaxSizeMB(size_t limit);
-	void clear() { cache.clear(); }
+	void clear();
 	void print();
+	size_t hits() const { return GeometryPool::instance()->hits(GeometryPool::Member::GEOMETRY); }
+	size_t misses() const { return GeometryPool::instance()->misses(GeometryPool::Member::GEOMETRY); }
 
 private:
 	static GeometryCache *inst;
-
-	struct cache_entry {
-		shared_ptr<const class Geometry> geom;
-		std::string msg;
-		cache_entry(const shared_ptr<const Geometry> &geom);
-		~cache_entry() { }
-	};
-
-	Cache<std::string, cache_entry> cache;
 };
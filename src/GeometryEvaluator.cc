@@ -2,6 +2,7 @@
 #include "Tree.h"
 #include "GeometryCache.h"
 #include "CGALCache.h"
+#include "DiskCache.h"
 #include "Polygon2d.h"
 #include "module.h"
 #include "ModuleInstantiation.h"
@@ -11,6 +12,7 @@
 #include "linearextrudenode.h"
 #include "rotateextrudenode.h"
 #include "csgnode.h"
+#include "colornode.h"
 #include "cgaladvnode.h"
 #include "projectionnode.h"
 #include "csgops.h"
@@ -20,34 +22,82 @@
 #include "rendernode.h"
 #include "clipper-utils.h"
 #include "polyset-utils.h"
+#include "GeometryUtils.h"
 #include "polyset.h"
+#include "TriangleBVH.h"
+#include "InstancedPolySet.h"
 #include "calc.h"
 #include "printutils.h"
+#include "Metrics.h"
 #include "svg.h"
 #include "calc.h"
 #include "dxfdata.h"
 #include "degree_trig.h"
+#include "ThreadPool.h"
+#include "CSGBackend.h"
+#include "hash.h"
+#include "Trace.h"
 #include <ciso646> // C alternative tokens (xor)
 #include <algorithm>
 
-#pragma push_macro("NDEBUG")
-#undef NDEBUG
-#include <CGAL/convex_hull_2.h>
-#include <CGAL/Point_2.h>
-#pragma pop_macro("NDEBUG")
+bool GeometryEvaluator::snap_rounding = false;
+// Exact coordinates with more bits than this are rounded if snap_rounding is set
+static const size_t snap_rounding_bits = 256;
+// Unions and intersections of fewer children are not worth caching by prefix
+static const size_t min_prefix_cached_children = 4;
+// Unions of this many children are evaluated as a tree, see applyUnionTree()
+static const size_t min_union_tree_children = 16;
+static const size_t union_tree_fanout = 4;
+
+/*!
+	Returns geom to be changed: geom itself if nothing else refers to it,
+	otherwise a copy. PolySet and Polygon2d copies share their data with
+	the original until they are changed, and Nef polyhedra copy a handle of
+	CGAL's reference counted representation, so a copy only to set e.g. the
+	convexity doesn't copy any mesh data. geom is released in either case.
+*/
+template <typename T>
+static shared_ptr<T> editable(shared_ptr<const Geometry> &geom)
+{
+	auto g = geometry_cast<const T>(geom);
+	assert(g);
+	geom.reset();
+	if (g.use_count() == 1) return const_pointer_cast<T>(g);
+	return shared_ptr<T>(static_cast<T *>(g->copy()));
+}
 
 GeometryEvaluator::GeometryEvaluator(const class Tree &tree):
-	tree(tree)
+	tree(tree), pendingnode(nullptr), lastgeom(nullptr), lastcache(nullptr)
+{
+}
+
+std::string GeometryEvaluator::cacheKey(const Tree &tree, const AbstractNode &node)
+{
+	return tree.getIdKey(node) + CSGBackend::current()->cacheTag();
+}
+
+/*!
+	The convexity of render() isn't part of the cache key, since it doesn't
+	change the geometry (see NodeDumper), so geometry of a RenderNode which
+	comes from the cache is given the node's convexity.
+*/
+static shared_ptr<const Geometry> with_render_convexity(const AbstractNode &node, shared_ptr<const Geometry> geom)
 {
+	auto render = dynamic_cast<const RenderNode *>(&node);
+	if (!render || !geom || int(geom->getConvexity()) == render->convexity) return geom;
+	if (!geometry_cast<const PolySet>(geom) && !geometry_cast<const CGAL_Nef_polyhedron>(geom)) return geom;
+	auto editablegeom = editable<Geometry>(geom);
+	editablegeom->setConvexity(render->convexity);
+	return editablegeom;
 }
 
 /*!
 	Set allownef to false to force the result to _not_ be a Nef polyhedron
 */
 shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNode &node, 
-																															 bool allownef)
+																															 bool allownef, bool allowinstances)
 {
-	const std::string &key = this->tree.getIdString(node);
+	const std::string &key = cacheKey(this->tree, node);
 	if (!GeometryCache::instance()->contains(key)) {
 		shared_ptr<const CGAL_Nef_polyhedron> N;
 		if (CGALCache::instance()->contains(key)) {
@@ -58,12 +108,19 @@ shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNod
 		if (N) {
 			this->root = N;
 		}	
+		else if (auto geom = DiskCache::instance()->get(key)) {
+			this->root = geom;
+		}
     else {
+			if (ThreadPool::instance()->isParallel()) evaluateChildrenInParallel(node);
 			this->traverse(node);
+			this->precomputed.clear();
 		}
 
 		if (!allownef) {
-			if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(this->root)) {
+			// Converting to a PolySet and triangulating the faces
+			Metrics::PhaseTimer timer("tessellate");
+			if (shared_ptr<const CGAL_Nef_polyhedron> N = geometry_cast<const CGAL_Nef_polyhedron>(this->root)) {
 				PolySet *ps = new PolySet(3);
 				ps->setConvexity(N->getConvexity());
 				this->root.reset(ps);
@@ -76,7 +133,8 @@ shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNod
 			}
 
 			// We cannot render concave polygons, so tessellate any 3D PolySets
-			auto ps = dynamic_pointer_cast<const PolySet>(this->root);
+			auto instances = geometry_cast<const InstancedPolySet>(this->root);
+			auto ps = instances ? instances->polySet() : geometry_cast<const PolySet>(this->root);
 			if (ps && !ps->isEmpty()) {
 				// Since is_convex() doesn't handle non-planar faces, we need to tessellate
 				// also in the indeterminate state so we cannot just use a boolean comparison. See #1061
@@ -86,17 +144,60 @@ shared_ptr<const Geometry> GeometryEvaluator::evaluateGeometry(const AbstractNod
 					auto ps_tri = new PolySet(3, ps->convexValue());
 					ps_tri->setConvexity(ps->getConvexity());
 					PolysetUtils::tessellate_faces(*ps, *ps_tri);
-					this->root.reset(ps_tri);
+					if (instances) this->root = instances->withPolySet(shared_ptr<const PolySet>(ps_tri));
+					else this->root.reset(ps_tri);
 				}
 			}
 		}
 		smartCacheInsert(node, this->root);
-		return this->root;
+		this->computetimes.clear();
+		return with_render_convexity(node, allowinstances ? this->root : InstancedPolySet::flattened(this->root));
 	}
-	return GeometryCache::instance()->get(key);
+	auto geom = GeometryCache::instance()->get(key);
+	return with_render_convexity(node, allowinstances ? geom : InstancedPolySet::flattened(geom));
 }
 
-GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const AbstractNode &node, OpenSCADOperator op)
+/*!
+	Evaluates independent child subtrees of the given node concurrently,
+	each in its own GeometryEvaluator sharing our Tree. Nested evaluators
+	recurse the same way, so parallelism is exploited at every level.
+
+	Results end up in the geometry caches and in this->precomputed, keyed
+	by cacheKey(), so the serial traversal which follows prunes
+	at those subtrees instead of recomputing them.
+
+	A chain of single children is followed down until a node with more
+	than one uncached child is found.
+*/
+void GeometryEvaluator::evaluateChildrenInParallel(const AbstractNode &node)
+{
+	std::vector<const AbstractNode *> todo;
+	for (const auto &child : node.getChildren()) {
+		if (child->modinst->isBackground() || isSmartCached(*child)) continue;
+		todo.push_back(child);
+	}
+	if (todo.empty()) return;
+	if (todo.size() == 1) {
+		evaluateChildrenInParallel(*todo.front());
+		return;
+	}
+
+	std::vector<shared_ptr<const Geometry>> results(todo.size());
+	TaskGroup group;
+	for (size_t i = 0; i < todo.size(); ++i) {
+		group.run([this, &todo, &results, i]() {
+			GeometryEvaluator evaluator(this->tree);
+			results[i] = evaluator.evaluateGeometry(*todo[i], true, true);
+		});
+	}
+	group.wait();
+
+	for (size_t i = 0; i < todo.size(); ++i) {
+		this->precomputed.emplace(cacheKey(this->tree, *todo[i]), results[i]);
+	}
+}
+
+shared_ptr<const Geometry> GeometryEvaluator::applyToChildren(const AbstractNode &node, OpenSCADOperator op)
 {
 	unsigned int dim = 0;
 	for(const auto &item : this->visitedchildren[node.index()]) {
@@ -112,57 +213,401 @@ GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren(const Abstrac
     if (dim == 2) {
         Polygon2d *p2d = applyToChildren2D(node, op);
         assert(p2d);
-        return ResultObject(p2d);
+        return shared_ptr<const Geometry>(p2d);
     }
     else if (dim == 3) return applyToChildren3D(node, op);
-	return ResultObject();
+	return nullptr;
+}
+
+/*!
+	Returns true if the convex PolySet contains all corners of the box.
+	Uses exact predicates, so corners on the boundary count as inside.
+*/
+static bool convexContainsBox(const PolySet &ps, const BoundingBox &box)
+{
+	// A point strictly inside tells us the inner side of each face
+	Vector3d center(0, 0, 0);
+	size_t numvertices = 0;
+	for (const auto &poly : ps.polygons()) {
+		for (const auto &v : poly) center += v;
+		numvertices += poly.size();
+	}
+	if (numvertices == 0) return false;
+	center /= numvertices;
+	const K::Point_3 inside(center[0], center[1], center[2]);
+
+	std::vector<K::Point_3> corners;
+	for (int i = 0; i < 8; ++i) {
+		const auto corner = box.corner(static_cast<BoundingBox::CornerType>(i));
+		corners.emplace_back(corner[0], corner[1], corner[2]);
+	}
+
+	for (const auto &poly : ps.polygons()) {
+		for (size_t i = 2; i < poly.size(); ++i) {
+			const K::Point_3 p(poly[0][0], poly[0][1], poly[0][2]);
+			const K::Point_3 q(poly[i-1][0], poly[i-1][1], poly[i-1][2]);
+			const K::Point_3 r(poly[i][0], poly[i][1], poly[i][2]);
+			if (CGAL::collinear(p, q, r)) continue;
+			const auto side = CGAL::orientation(p, q, r, inside);
+			// Flat or not actually convex
+			if (side == CGAL::COPLANAR) return false;
+			for (const auto &c : corners) {
+				const auto o = CGAL::orientation(p, q, r, c);
+				if (o != CGAL::COPLANAR && o != side) return false;
+			}
+		}
+	}
+	return true;
+}
+
+/*!
+	Culls the operands of an intersection by their bounding boxes.
+
+	Returns false if the bounding boxes don't overlap, i.e. the intersection
+	is empty. Otherwise removes operands known to be convex which contain
+	the intersection of all bounding boxes, since the result lies within
+	that box. At least one operand is kept.
+*/
+static bool cullIntersection(Geometry::Geometries &children)
+{
+	BoundingBox box;
+	bool first = true;
+	for (const auto &item : children) {
+		if (item.second->isEmpty()) return false;
+		const auto childbox = item.second->getBoundingBox();
+		box = first ? childbox : box.intersection(childbox);
+		first = false;
+		if (box.isEmpty()) return false;
+	}
+
+	for (auto it = children.begin(); it != children.end() && children.size() > 1; ) {
+		const auto ps = geometry_cast<const PolySet>(it->second);
+		const bool convex = ps && bool(ps->convexValue());
+		if (convex && convexContainsBox(*ps, box)) it = children.erase(it);
+		else ++it;
+	}
+	return true;
+}
+
+enum class Placement { APART, INSIDE, CONTAINS, UNKNOWN };
+
+/*!
+	Whether the surface of the PolySet is a single closed shell. Such a
+	surface is all on one side of any surface it doesn't come close to, so
+	one of its vertices tells which side.
+*/
+static bool isSingleShell(const PolySet &ps)
+{
+	const auto topology = ps.topology();
+	return topology->isClosed() && topology->components == 1;
+}
+
+/*!
+	Where the PolySet b is relative to a, whose bounding boxes overlap:
+	APART, INSIDE a, or CONTAINS it if their surfaces don't come close,
+	otherwise UNKNOWN. Both must be a single closed shell, else the result
+	is UNKNOWN too, as parts of a mesh of several components may be on
+	different sides. Uses the BVHs of both, so is much cheaper than a CGAL
+	operation on them.
+*/
+static Placement placement(const PolySet &a, const PolySet &b)
+{
+	if (!isSingleShell(a) || !isSingleShell(b)) return Placement::UNKNOWN;
+	auto box = a.getBoundingBox();
+	box.extend(b.getBoundingBox());
+	const auto bvha = a.bvh(), bvhb = b.bvh();
+	if (bvha->numTriangles() == 0 || bvhb->numTriangles() == 0) return Placement::UNKNOWN;
+	if (bvha->intersects(*bvhb, 1e-9 * box.sizes().maxCoeff())) return Placement::UNKNOWN;
+
+	// The surfaces are apart, so one vertex tells where all of the other surface is
+	const auto binside = bvha->contains(b.polygons().front().front());
+	if (boost::indeterminate(binside)) return Placement::UNKNOWN;
+	if (binside) return Placement::INSIDE;
+	const auto ainside = bvhb->contains(a.polygons().front().front());
+	if (boost::indeterminate(ainside)) return Placement::UNKNOWN;
+	return ainside ? Placement::CONTAINS : Placement::APART;
+}
+
+/*!
+	Drops subtrahends of a difference which are empty or whose bounding box
+	doesn't touch the one of the first operand, as they can't affect the
+	result. Of PolySets with overlapping boxes, those which are apart from
+	the first operand are dropped, too. Returns false if the first operand is
+	empty, or inside a subtrahend.
+*/
+static bool cullDifference(Geometry::Geometries &children)
+{
+	const auto &base = children.front().second;
+	if (base->isEmpty()) return false;
+	const auto box = base->getBoundingBox();
+	const auto baseps = geometry_cast<const PolySet>(base);
+	for (auto it = std::next(children.begin()); it != children.end(); ) {
+		if (it->second->isEmpty() || !box.intersects(it->second->getBoundingBox())) {
+			it = children.erase(it);
+			continue;
+		}
+		const auto ps = geometry_cast<const PolySet>(it->second);
+		const auto where = baseps && ps ? placement(*baseps, *ps) : Placement::UNKNOWN;
+		if (where == Placement::CONTAINS) return false;
+		if (where == Placement::APART) it = children.erase(it);
+		else ++it;
+	}
+	return true;
+}
+
+/*!
+	Returns the union of the children as instances of a single PolySet, if
+	they all are instances of the same PolySet and none of the instances
+	touch each other. Otherwise returns nullptr.
+*/
+static shared_ptr<const Geometry> mergeInstances(const Geometry::Geometries &children)
+{
+	shared_ptr<const PolySet> ps;
+	InstancedPolySet::Transforms transforms;
+	std::vector<BoundingBox> boxes;
+	for (const auto &item : children) {
+		if (item.second->isEmpty()) continue;
+		auto instances = geometry_cast<const InstancedPolySet>(item.second);
+		if (!instances || (ps && instances->polySet() != ps)) return nullptr;
+		ps = instances->polySet();
+		for (size_t i = 0; i < instances->numInstances(); ++i) {
+			transforms.push_back(instances->transforms()[i]);
+			boxes.push_back(instances->instanceBox(i));
+		}
+	}
+	if (!ps) return nullptr;
+
+	// Sweep the boxes sorted by their minimum x
+	std::vector<size_t> order(boxes.size());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+	std::sort(order.begin(), order.end(), [&boxes](size_t a, size_t b) { return boxes[a].min()[0] < boxes[b].min()[0]; });
+	for (size_t a = 0; a < order.size(); ++a) {
+		const auto &boxa = boxes[order[a]];
+		for (size_t b = a + 1; b < order.size() && boxes[order[b]].min()[0] <= boxa.max()[0]; ++b) {
+			if (boxa.intersects(boxes[order[b]])) return nullptr;
+		}
+	}
+	return make_shared<const InstancedPolySet>(ps, std::move(transforms), std::move(boxes));
 }
 
 /*!
 	Applies the operator to all child nodes of the given node.
 	
-	May return nullptr or any 3D Geometry object (can be either PolySet or CGAL_Nef_polyhedron)
+	May return nullptr or any 3D Geometry object (can be either PolySet or CGAL_Nef_polyhedron).
+	Instanced geometry is only returned by unions of separate instances and
+	when the operation is a noop; all other operations flatten it.
 */
-GeometryEvaluator::ResultObject GeometryEvaluator::applyToChildren3D(const AbstractNode &node, OpenSCADOperator op)
+shared_ptr<const Geometry> GeometryEvaluator::applyToChildren3D(const AbstractNode &node, OpenSCADOperator op)
 {
 	Geometry::Geometries children = collectChildren3D(node);
-	if (children.size() == 0) return ResultObject();
+	if (children.size() == 0) return nullptr;
+
+	if (op == OpenSCADOperator::UNION && children.size() > 1) {
+		if (auto instances = mergeInstances(children)) return instances;
+	}
+	if (children.size() > 1 || op == OpenSCADOperator::HULL) {
+		for (auto &item : children) item.second = InstancedPolySet::flattened(item.second);
+	}
 
 	if (op == OpenSCADOperator::HULL) {
 		PolySet *ps = new PolySet(3, true);
 
 		if (CGALUtils::applyHull(children, *ps)) {
-			return ps;
+			return shared_ptr<const Geometry>(ps);
 		}
 
 		delete ps;
-		return ResultObject();
+		return nullptr;
 	}
 	
 	// Only one child -> this is a noop
-	if (children.size() == 1) return ResultObject(children.front().second);
+	if (children.size() == 1) return children.front().second;
 
 	if (op == OpenSCADOperator::MINKOWSKI) {
 		Geometry::Geometries actualchildren;
 		for(const auto &item : children) {
 			if (!item.second->isEmpty()) actualchildren.push_back(item);
 		}
-		if (actualchildren.empty()) return ResultObject();
-		if (actualchildren.size() == 1) return ResultObject(actualchildren.front().second);
-		return ResultObject(CGALUtils::applyMinkowski(actualchildren));
+		if (actualchildren.empty()) return nullptr;
+		if (actualchildren.size() == 1) return actualchildren.front().second;
+		std::vector<std::string> keys;
+		for (const auto &item : actualchildren) keys.push_back(cacheKey(this->tree, *item.first));
+		return shared_ptr<const Geometry>(CGALUtils::applyMinkowski(actualchildren, keys));
+	}
+
+	if (op == OpenSCADOperator::INTERSECTION) {
+		if (!cullIntersection(children)) return make_shared<const CGAL_Nef_polyhedron>();
+		if (children.size() == 1) return children.front().second;
+	}
+
+	if (op == OpenSCADOperator::DIFFERENCE) {
+		if (!cullDifference(children)) return make_shared<const CGAL_Nef_polyhedron>();
+		if (children.size() == 1) return children.front().second;
+		if (children.size() > 2) {
+			// a - b - c = a - (b + c), so do a single difference with the union of
+			// all subtrahends, which benefits from the n-ary and disjoint union
+			Geometry::Geometries subtrahends(std::next(children.begin()), children.end());
+			if (auto geom = CSGBackend::apply(subtrahends, OpenSCADOperator::UNION)) {
+				const auto lastnode = children.back().first;
+				children.erase(std::next(children.begin()), children.end());
+				children.emplace_back(lastnode, geom);
+			}
+		}
+	}
+
+	if (op == OpenSCADOperator::UNION && children.size() >= min_union_tree_children) {
+		return applyUnionTree(children);
+	}
+
+	std::vector<std::string> keys;
+	const double start = RenderProfile::now();
+	if ((op == OpenSCADOperator::UNION || op == OpenSCADOperator::INTERSECTION) &&
+			children.size() >= min_prefix_cached_children) {
+		std::vector<const AbstractNode *> nodes;
+		for (const auto &item : children) nodes.push_back(item.first);
+		keys = prefixKeys(nodes, op);
+		shared_ptr<const Geometry> prefix;
+		const size_t cached = cachedPrefix(keys, prefix);
+		if (cached == children.size()) return prefix;
+		if (cached > 0) {
+			const auto end = std::next(children.begin(), cached);
+			const auto lastnode = std::prev(end)->first;
+			children.erase(children.begin(), end);
+			children.emplace_front(lastnode, prefix);
+		}
 	}
 
-	CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(children, op);
+	shared_ptr<const Geometry> geom = CSGBackend::apply(children, op);
 	// FIXME: Clarify when we can return nullptr and what that means
-	if (!N) N = new CGAL_Nef_polyhedron;
-	return ResultObject(N);
+	if (!geom) geom.reset(new CGAL_Nef_polyhedron);
+	if (!keys.empty()) cachePartial(keys.back(), geom, (RenderProfile::now() - start) / 1e6);
+	return geom;
+}
+
+
+
+/*!
+	The cache keys of the results of the operator over the first 1, 2, ...
+	n children, chained from the cache keys of the children in order.
+
+	A union or intersection over a loop, like for() or intersection_for(),
+	gets a new node and thus cache key whenever a loop bound changes. When
+	children are appended, the result over the previous children is still
+	found by its prefix key, so only one more operation is needed. 3D
+	unions of many children use applyUnionTree() instead.
+*/
+std::vector<std::string> GeometryEvaluator::prefixKeys(const std::vector<const AbstractNode *> &nodes, OpenSCADOperator op) const
+{
+	std::vector<std::string> keys;
+	keys.reserve(nodes.size());
+	Hash128 hash = hash128(op == OpenSCADOperator::UNION ? "union" : "intersection");
+	for (const auto node : nodes) {
+		hash = hash128(hash.toString() + cacheKey(this->tree, *node));
+		keys.push_back("prefix" + hash.toString());
+	}
+	return keys;
+}
+
+/*!
+	Returns the number of children of the longest prefix in the caches,
+	at least two, and its result in geom. Returns 0 if none is cached.
+*/
+size_t GeometryEvaluator::cachedPrefix(const std::vector<std::string> &keys, shared_ptr<const Geometry> &geom) const
+{
+	for (size_t n = keys.size(); n >= 2; --n) {
+		geom = cachedPartial(keys[n - 1]);
+		if (geom) {
+			PRINTDB("Prefix cache hit: %d of %d children", n % keys.size());
+			return n;
+		}
+	}
+	return 0;
 }
 
+// Partial results of operations, which have no node of their own
+shared_ptr<const Geometry> GeometryEvaluator::cachedPartial(const std::string &key) const
+{
+	if (CGALCache::instance()->contains(key)) return CGALCache::instance()->get(key);
+	if (GeometryCache::instance()->contains(key)) return GeometryCache::instance()->get(key);
+	return nullptr;
+}
+
+void GeometryEvaluator::cachePartial(const std::string &key, const shared_ptr<const Geometry> &geom, double seconds) const
+{
+	if (auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+		if (!CGALCache::instance()->contains(key)) CGALCache::instance()->insert(key, N, seconds);
+	}
+	else if (!GeometryCache::instance()->contains(key)) {
+		GeometryCache::instance()->insert(key, geom, seconds);
+	}
+}
+
+/*!
+	Union of many 3D children, as a tree of partial unions: of runs of
+	union_tree_fanout consecutive children, then of runs of those results,
+	and so on up to the root. Each partial union is cached under a key
+	built from the keys of its operands.
+
+	When one child of e.g. the top level union of a big model changes, only
+	the partial unions on the path from that child to the root are
+	recomputed, the others come from the cache. Appended children only
+	change the last partial union of each level. The partial unions of a
+	level are evaluated concurrently.
+*/
+shared_ptr<const Geometry> GeometryEvaluator::applyUnionTree(const Geometry::Geometries &children)
+{
+	std::vector<Geometry::GeometryItem> items(children.begin(), children.end());
+	std::vector<std::string> keys;
+	for (const auto &item : items) keys.push_back(cacheKey(this->tree, *item.first));
+
+	while (items.size() > 1) {
+		const size_t numgroups = (items.size() + union_tree_fanout - 1) / union_tree_fanout;
+		std::vector<Geometry::GeometryItem> next(numgroups);
+		std::vector<std::string> nextkeys(numgroups);
+		std::vector<double> seconds(numgroups);
+		std::vector<size_t> todo;
+		for (size_t g = 0; g < numgroups; ++g) {
+			const size_t begin = g * union_tree_fanout, end = std::min(begin + union_tree_fanout, items.size());
+			if (end - begin == 1) {
+				next[g] = items[begin];
+				nextkeys[g] = keys[begin];
+				continue;
+			}
+			std::string operandkeys;
+			for (size_t i = begin; i < end; ++i) operandkeys += keys[i];
+			nextkeys[g] = "union" + hash128(operandkeys).toString();
+			if (auto geom = cachedPartial(nextkeys[g])) next[g] = Geometry::GeometryItem(items[end - 1].first, geom);
+			else todo.push_back(g);
+		}
+		PRINTDB("Union tree: %d of %d partial unions to compute", todo.size() % numgroups);
+
+		TaskGroup group;
+		for (const auto g : todo) {
+			group.run([&items, &next, &seconds, g]() {
+				const double start = RenderProfile::now();
+				const size_t begin = g * union_tree_fanout, end = std::min(begin + union_tree_fanout, items.size());
+				Geometry::Geometries operands(items.begin() + begin, items.begin() + end);
+				shared_ptr<const Geometry> geom = CSGBackend::apply(operands, OpenSCADOperator::UNION);
+				if (!geom) geom.reset(new CGAL_Nef_polyhedron);
+				next[g] = Geometry::GeometryItem(items[end - 1].first, geom);
+				seconds[g] = (RenderProfile::now() - start) / 1e6;
+			});
+		}
+		group.wait();
+		for (const auto g : todo) cachePartial(nextkeys[g], next[g].second, seconds[g]);
 
+		items.swap(next);
+		keys.swap(nextkeys);
+	}
+	return items.front().second;
+}
 
 /*!
 	Apply 2D hull.
 
+	Each child is first reduced to its own hull, concurrently, so only
+	the hull vertices of the children go into the final hull.
+
 	May return an empty geometry but will not return nullptr.
 */
 Polygon2d *GeometryEvaluator::applyHull2D(const AbstractNode &node)
@@ -170,27 +615,28 @@ Polygon2d *GeometryEvaluator::applyHull2D(const AbstractNode &node)
 	std::vector<const Polygon2d *> children = collectChildren2D(node);
 	Polygon2d *geometry = new Polygon2d();
 
-	typedef CGAL::Point_2<CGAL::Cartesian<double>> CGALPoint2;
-	// Collect point cloud
-	std::list<CGALPoint2> points;
-	for(const auto &p : children) {
-		for(const auto &o : p->outlines()) {
-			for(const auto &v : o.vertices) {
-				points.push_back(CGALPoint2(v[0], v[1]));
+	std::vector<std::vector<Vector2d>> hulls(children.size());
+	TaskGroup group;
+	for (size_t i = 0; i < children.size(); ++i) {
+		group.run([&children, &hulls, i]() {
+			std::vector<Vector2d> points;
+			for (const auto &o : children[i]->outlines()) {
+				points.insert(points.end(), o.vertices.begin(), o.vertices.end());
 			}
-		}
+			hulls[i] = GeometryUtils::convexHull2d(std::move(points));
+		});
 	}
-	if (points.size() > 0) {
-		// Apply hull
-		std::list<CGALPoint2> result;
-		CGAL::convex_hull_2(points.begin(), points.end(), std::back_inserter(result));
+	group.wait();
 
-		// Construct Polygon2d
+	std::vector<Vector2d> points;
+	for (const auto &hull : hulls) points.insert(points.end(), hull.begin(), hull.end());
+	if (points.size() > 0) {
 		Outline2d outline;
-		for(const auto &p : result) {
-			outline.vertices.push_back(Vector2d(p[0], p[1]));
-		}
+		outline.vertices = hulls.size() == 1 ? std::move(hulls.front()) : GeometryUtils::convexHull2d(std::move(points));
+		// A counter-clockwise convex outline needs no sanitizing, unless it's degenerate
+		const bool sanitized = outline.vertices.size() >= 3;
 		geometry->addOutline(outline);
+		geometry->setSanitized(sanitized);
 	}
 	return geometry;
 }
@@ -217,10 +663,11 @@ Polygon2d *GeometryEvaluator::applyMinkowski2D(const AbstractNode &node)
 }
 
 /*!
-	Returns a list of Polygon2d children of the given node.
+	Returns a list of Polygon2d children of the given node, and their nodes
+	in nodes if given.
 	May return empty Polygon2d object, but not nullptr objects
 */
-std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const AbstractNode &node)
+std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const AbstractNode &node, std::vector<const AbstractNode *> *nodes)
 {
 	std::vector<const Polygon2d *> children;
 	for(const auto &item : this->visitedchildren[node.index()]) {
@@ -236,9 +683,10 @@ std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const
 		
 		if (chgeom) {
 			if (chgeom->getDimension() == 2) {
-				const Polygon2d *polygons = dynamic_cast<const Polygon2d *>(chgeom.get());
+				const Polygon2d *polygons = geometry_cast<const Polygon2d>(chgeom.get());
 				assert(polygons);
 				children.push_back(polygons);
+				if (nodes) nodes->push_back(chnode);
 			}
 			else {
 				std::string loc = item.first->modinst->location().toRelativeString(this->tree.getDocumentPath());
@@ -257,36 +705,74 @@ std::vector<const class Polygon2d *> GeometryEvaluator::collectChildren2D(const
 void GeometryEvaluator::smartCacheInsert(const AbstractNode &node, 
 																				 const shared_ptr<const Geometry> &geom)
 {
-	const std::string &key = this->tree.getIdString(node);
+	// Still lacks the transformation left pending for its parent
+	if (&node == this->pendingnode) return;
+	const std::string &key = cacheKey(this->tree, node);
+
+	// The time to recompute it weighs against evicting it
+	double seconds = 0;
+	auto t = this->computetimes.find(&node);
+	if (t != this->computetimes.end()) {
+		seconds = t->second;
+		this->computetimes.erase(t);
+	}
 
-	shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
+	shared_ptr<const CGAL_Nef_polyhedron> N = geometry_cast<const CGAL_Nef_polyhedron>(geom);
 	if (N) {
-		if (!CGALCache::instance()->contains(key)) CGALCache::instance()->insert(key, N);
+		if (!CGALCache::instance()->contains(key)) {
+			CGALCache::instance()->insert(key, N, seconds);
+			DiskCache::instance()->insert(key, N);
+		}
 	}
 	else {
 		if (!GeometryCache::instance()->contains(key)) {
-			if (!GeometryCache::instance()->insert(key, geom)) {
+			if (!GeometryCache::instance()->insert(key, geom, seconds)) {
 				PRINT("WARNING: GeometryEvaluator: Node didn't fit into cache");
 			}
+			DiskCache::instance()->insert(key, geom);
 		}
 	}
 }
 
 bool GeometryEvaluator::isSmartCached(const AbstractNode &node)
 {
-	const std::string &key = this->tree.getIdString(node);
-	return (GeometryCache::instance()->contains(key) ||
-					CGALCache::instance()->contains(key));
+	const std::string &key = cacheKey(this->tree, node);
+	if (this->precomputed.count(key) ||
+			GeometryCache::instance()->contains(key) ||
+			CGALCache::instance()->contains(key)) return true;
+
+	// Entries are loaded from the disk cache right away, so that a corrupt
+	// entry counts as a miss. They're moved to the memory caches once the
+	// parent node collects them.
+	if (auto geom = DiskCache::instance()->get(key)) {
+		this->precomputed.emplace(key, geom);
+		return true;
+	}
+	return false;
 }
 
 shared_ptr<const Geometry> GeometryEvaluator::smartCacheGet(const AbstractNode &node, bool preferNef)
 {
-	const std::string &key = this->tree.getIdString(node);
+	const std::string &key = cacheKey(this->tree, node);
+	auto it = this->precomputed.find(key);
+	if (it != this->precomputed.end()) {
+		this->lastcache = "precomputed";
+		return it->second;
+	}
+
 	shared_ptr<const Geometry> geom;
 	bool hasgeom = GeometryCache::instance()->contains(key);
 	bool hascgal = CGALCache::instance()->contains(key);
-	if (hascgal && (preferNef || !hasgeom)) geom = CGALCache::instance()->get(key);
-	else if (hasgeom) geom = GeometryCache::instance()->get(key);
+	// Mesh backends convert Nefs to meshes anyway
+	if (preferNef && CSGBackend::current() != CSGBackend::nef()) preferNef = false;
+	if (hascgal && (preferNef || !hasgeom)) {
+		geom = CGALCache::instance()->get(key);
+		this->lastcache = "CGALCache";
+	}
+	else if (hasgeom) {
+		geom = GeometryCache::instance()->get(key);
+		this->lastcache = "GeometryCache";
+	}
 	return geom;
 }
 
@@ -334,7 +820,8 @@ Polygon2d *GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSC
 		return applyHull2D(node);
 	}
 
-	std::vector<const Polygon2d *> children = collectChildren2D(node);
+	std::vector<const AbstractNode *> nodes;
+	std::vector<const Polygon2d *> children = collectChildren2D(node, &nodes);
 
 	if (children.empty()) {
 		return nullptr;
@@ -361,7 +848,23 @@ Polygon2d *GeometryEvaluator::applyToChildren2D(const AbstractNode &node, OpenSC
 		break;
 	}
 
-	return ClipperUtils::apply(children, clipType);
+	std::vector<std::string> keys;
+	shared_ptr<const Geometry> prefix;
+	const double start = RenderProfile::now();
+	if (op != OpenSCADOperator::DIFFERENCE && children.size() >= min_prefix_cached_children) {
+		keys = prefixKeys(nodes, op);
+		const size_t cached = cachedPrefix(keys, prefix);
+		auto poly = geometry_cast<const Polygon2d>(prefix);
+		if (poly && cached == children.size()) return new Polygon2d(*poly);
+		if (poly && cached > 0) {
+			children.erase(children.begin(), children.begin() + cached);
+			children.insert(children.begin(), poly.get());
+		}
+	}
+
+	Polygon2d *result = ClipperUtils::apply(children, clipType);
+	if (!keys.empty()) cachePartial(keys.back(), shared_ptr<const Geometry>(new Polygon2d(*result)), (RenderProfile::now() - start) / 1e6);
+	return result;
 }
 
 /*!
@@ -377,22 +880,40 @@ void GeometryEvaluator::addToParent(const State &state,
 																		const AbstractNode &node, 
 																		const shared_ptr<const Geometry> &geom)
 {
+	auto result = geom;
+	if (snap_rounding) {
+		if (auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+			if (auto snapped = CGALUtils::snapNefPolyhedron(*N, snap_rounding_bits)) result.reset(snapped);
+		}
+	}
+	this->lastgeom = result.get();
+	// Results added in the prefix visit were cached or taken over elsewhere
+	if (state.isPostfix()) this->computetimes[&node] = (RenderProfile::now() - state.startTime()) / 1e6;
 	this->visitedchildren.erase(node.index());
 	if (state.parent()) {
-		this->visitedchildren[state.parent()->index()].push_back(std::make_pair(&node, geom));
+		this->visitedchildren[state.parent()->index()].push_back(std::make_pair(&node, result));
 	}
 	else {
 		// Root node
-		this->root = geom;
+		this->root = result;
 		assert(this->visitedchildren.empty());
 	}
 }
 
+void GeometryEvaluator::profileNode(const AbstractNode &, RenderProfile::Event &event)
+{
+	event.cache = this->lastcache ? this->lastcache : "miss";
+	event.setGeometry(this->lastgeom);
+	this->lastcache = nullptr;
+	this->lastgeom = nullptr;
+}
+
 /*!
    Custom nodes are handled here => implicit union
 */
 Response GeometryEvaluator::visit(State &state, const AbstractNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(AbstractNode)");
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return Response::PruneTraversal;
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
@@ -400,7 +921,7 @@ Response GeometryEvaluator::visit(State &state, const AbstractNode &node)
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
-			geom = applyToChildren(node, OpenSCADOperator::UNION).constptr();
+			geom = applyToChildren(node, OpenSCADOperator::UNION);
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
@@ -426,13 +947,14 @@ Response GeometryEvaluator::visit(State &state, const RootNode &node)
 
 Response GeometryEvaluator::visit(State &state, const OffsetNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(OffsetNode)");
 	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
 			const Geometry *geometry = applyToChildren2D(node, OpenSCADOperator::UNION);
 			if (geometry) {
-				const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry);
+				const Polygon2d *polygon = geometry_cast<const Polygon2d>(geometry);
 				// ClipperLib documentation: The formula for the number of steps in a full
 				// circular arc is ... Pi / acos(1 - arc_tolerance / abs(delta))
 				double n = Calc::get_fragments_from_r(std::abs(node.delta), node.fn, node.fs, node.fa);
@@ -457,6 +979,7 @@ Response GeometryEvaluator::visit(State &state, const OffsetNode &node)
 */
 Response GeometryEvaluator::visit(State &state, const RenderNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(RenderNode)");
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return Response::PruneTraversal;
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
@@ -464,28 +987,19 @@ Response GeometryEvaluator::visit(State &state, const RenderNode &node)
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
-			ResultObject res = applyToChildren(node, OpenSCADOperator::UNION);
-
-			geom = res.constptr();
-			if (shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom)) {
-				// If we got a const object, make a copy
-				shared_ptr<PolySet> newps;
-				if (res.isConst()) newps.reset(new PolySet(*ps));
-				else newps = dynamic_pointer_cast<PolySet>(res.ptr());
-				newps->setConvexity(node.convexity);
-				geom = newps;
+			geom = applyToChildren(node, OpenSCADOperator::UNION);
+			if (auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+				geom.reset(instances->flatten());
 			}
-			else if (shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
-				// If we got a const object, make a copy
-				shared_ptr<CGAL_Nef_polyhedron> newN;
-				if (res.isConst()) newN.reset((CGAL_Nef_polyhedron*)N->copy());
-				else newN = dynamic_pointer_cast<CGAL_Nef_polyhedron>(res.ptr());
-				newN->setConvexity(node.convexity);
-				geom = newN;
+
+			if (geometry_cast<const PolySet>(geom) || geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+				auto editablegeom = editable<Geometry>(geom);
+				editablegeom->setConvexity(node.convexity);
+				geom = editablegeom;
 			}
 		}
 		else {
-			geom = smartCacheGet(node, state.preferNef());
+			geom = with_render_convexity(node, smartCacheGet(node, state.preferNef()));
 		}
 		node.progress_report();
 		addToParent(state, node, geom);
@@ -501,12 +1015,13 @@ Response GeometryEvaluator::visit(State &state, const RenderNode &node)
 */
 Response GeometryEvaluator::visit(State &state, const LeafNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(LeafNode)");
 	if (state.isPrefix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
 			const Geometry *geometry = node.createGeometry();
             assert(geometry);
-			if (const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry)) {
+			if (const Polygon2d *polygon = geometry_cast<const Polygon2d>(geometry)) {
 				if (!polygon->isSanitized()) {
 					Polygon2d *p = ClipperUtils::sanitize(*polygon);
 					delete geometry;
@@ -524,19 +1039,20 @@ Response GeometryEvaluator::visit(State &state, const LeafNode &node)
 
 Response GeometryEvaluator::visit(State &state, const TextNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(TextNode)");
 	if (state.isPrefix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
 			std::vector<const Geometry *> geometrylist = node.createGeometryList();
 			std::vector<const Polygon2d *> polygonlist;
 			for(const auto &geometry : geometrylist) {
-				const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry);
+				const Polygon2d *polygon = geometry_cast<const Polygon2d>(geometry);
 				assert(polygon);
 				polygonlist.push_back(polygon);
 			}
 			geom.reset(ClipperUtils::apply(polygonlist, ClipperLib::ctUnion));
 		}
-		else geom = GeometryCache::instance()->get(this->tree.getIdString(node));
+		else geom = smartCacheGet(node, false);
 		addToParent(state, node, geom);
 		node.progress_report();
 	}
@@ -552,6 +1068,7 @@ Response GeometryEvaluator::visit(State &state, const TextNode &node)
  */			
 Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(CsgOpNode)");
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return Response::PruneTraversal;
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
@@ -559,7 +1076,7 @@ Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			geom = applyToChildren(node, node.type).constptr();
+			geom = applyToChildren(node, node.type);
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
@@ -577,8 +1094,152 @@ Response GeometryEvaluator::visit(State &state, const CsgOpNode &node)
 	  o Union all children
 	  o Perform transform
  */			
+// True if the results of this evaluation are likely used as Nef polyhedra
+static bool needsNef(const State &state)
+{
+	return state.preferNef() && CSGBackend::current() == CSGBackend::nef();
+}
+
+/*!
+	Transforming a Nef polyhedron is exact, and the coordinates of the
+	result grow in size with every non-trivial transform. Unless the result
+	goes into exact booleans, we rather convert the Nef to a PolySet and
+	transform that. Whoever needs a Nef again converts back when it's
+	actually needed.
+
+	Returns nullptr if geom should be transformed as a Nef.
+*/
+static shared_ptr<PolySet> transformedPolySet(const shared_ptr<const Geometry> &geom,
+																							const Transform3d &matrix, const State &state)
+{
+	if (needsNef(state)) return nullptr;
+	auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom);
+	// Non-manifold Nefs don't survive the trip to a PolySet and back
+	if (!N || N->isEmpty() || !N->p3->is_simple()) return nullptr;
+	if (matrix.matrix().determinant() == 0) return nullptr;
+
+	auto ps = make_shared<PolySet>(3);
+	ps->setConvexity(N->getConvexity());
+	if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) return nullptr;
+	ps->transform(matrix);
+	return ps;
+}
+
+/*!
+	The PolySet of the Nef geometry of child, converted only once: it's
+	kept in the GeometryCache under the child's key, next to the Nef in the
+	CGALCache, so all transformed copies of the child instance the same
+	PolySet rather than each converting and transforming its own. Returns
+	nullptr where transformedPolySet() would keep the Nef, and if child is
+	nullptr, i.e. geom isn't the child's own geometry.
+*/
+shared_ptr<const PolySet> GeometryEvaluator::cachedPolySet(const AbstractNode *child, const shared_ptr<const Geometry> &geom,
+																													 const State &state)
+{
+	if (!child || needsNef(state)) return nullptr;
+	auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom);
+	if (!N || N->isEmpty() || !N->p3->is_simple()) return nullptr;
+
+	const std::string &key = cacheKey(this->tree, *child);
+	if (GeometryCache::instance()->contains(key)) {
+		if (auto ps = geometry_cast<const PolySet>(GeometryCache::instance()->get(key))) return ps;
+	}
+	auto ps = make_shared<PolySet>(3);
+	ps->setConvexity(N->getConvexity());
+	if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) return nullptr;
+	// Not into the DiskCache, which keeps the exact Nef for the key
+	GeometryCache::instance()->insert(key, ps);
+	return ps;
+}
+
+/*!
+	The 3D geometry with all its faces in the given color, so the color
+	survives into the rendered mesh and its exports. Unions of disjoint
+	objects keep the colors of their faces, other CSG operations don't.
+	A Nef polyhedron is converted to a PolySet to carry the color, unless
+	its result goes into exact booleans anyway.
+
+	Returns geom itself if it can't carry the color.
+*/
+static shared_ptr<const Geometry> coloredGeometry(const shared_ptr<const Geometry> &geom,
+																									const Color4f &color, const State &state)
+{
+	if (!geom || geom->getDimension() != 3) return geom;
+	if (auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+		auto ps = make_shared<PolySet>(*instances->polySet());
+		ps->setColor(color);
+		return instances->withPolySet(ps);
+	}
+	if (auto ps = geometry_cast<const PolySet>(geom)) {
+		// e.g. the result of this node from the cache
+		const auto &colors = ps->faceColors();
+		if (colors && colors->table.size() == 1 && colors->table[0] == color &&
+				colors->indices.size() == ps->numPolygons()) return geom;
+		auto newps = make_shared<PolySet>(*ps);
+		newps->setColor(color);
+		return newps;
+	}
+	auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom);
+	if (needsNef(state) || !N || N->isEmpty() || !N->p3->is_simple()) return geom;
+	auto ps = make_shared<PolySet>(3);
+	ps->setConvexity(N->getConvexity());
+	if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) return geom;
+	ps->setColor(color);
+	return ps;
+}
+
+/*!
+	Unions the children like visit(AbstractNode) and gives the result the
+	color, which overrides the colors of the children, as in the preview.
+	The children aren't asked for Nef results, which would lose the color.
+	The id string of a color node with a valid color includes the color
+	(see NodeDumper), so its cache entry never stands in for the uncolored
+	children. An entry may still be an uncolored Nef, cached for a parent
+	which needed one, so cached results are colored too.
+*/
+Response GeometryEvaluator::visit(State &state, const ColorNode &node)
+{
+	TRACE_ZONE("GeometryEvaluator::visit(ColorNode)");
+	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
+	if (state.isPostfix()) {
+		shared_ptr<const Geometry> geom;
+		if (!isSmartCached(node)) {
+			geom = applyToChildren(node, OpenSCADOperator::UNION);
+		}
+		else {
+			geom = smartCacheGet(node, state.preferNef());
+		}
+		if (node.color[0] >= 0) geom = coloredGeometry(geom, node.color, state);
+		addToParent(state, node, geom);
+		node.progress_report();
+	}
+	return Response::ContinueTraversal;
+}
+
+/*!
+	Whether the transformation of the node should be left to its parent:
+	chains of transformations with single children are applied at once,
+	by the outermost one, so the geometry isn't copied at each level.
+*/
+static bool defers_transform(const State &state, const TransformNode &node)
+{
+	auto parent = dynamic_cast<const TransformNode *>(state.parent());
+	return parent && parent->getChildren().size() == 1 && !node.modinst->isBackground() && node.getChildren().size() == 1;
+}
+
+/*!
+	Returns the transformation left pending by the child, see visit(TransformNode).
+*/
+Transform3d GeometryEvaluator::takePendingTransform(const AbstractNode &child)
+{
+	if (this->pendingnode != &child) return Transform3d::Identity();
+	this->pendingnode = nullptr;
+	return this->pendingtransform;
+}
+
 Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(TransformNode)");
 	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
@@ -588,50 +1249,70 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 				std::string loc = node.modinst->location().toRelativeString(this->tree.getDocumentPath());
 				PRINTB("WARNING: Transformation matrix contains Not-a-Number and/or Infinity - removing object. %s", loc);
 			}
+			else if (defers_transform(state, node)) {
+				// Pass the geometry of the child on untouched, with the transformation pending.
+				// Until then it isn't the geometry of either node, so it isn't cached.
+				const auto &children = this->visitedchildren[node.index()];
+				if (!children.empty() && !children.front().first->modinst->isBackground()) {
+					const auto &item = children.front();
+					geom = item.second;
+					if (geom) smartCacheInsert(*item.first, geom);
+					this->pendingtransform = node.matrix * takePendingTransform(*item.first);
+					this->pendingnode = &node;
+				}
+				addToParent(state, node, geom);
+				node.progress_report();
+				return Response::ContinueTraversal;
+			}
 			else {
 				// First union all children
-				ResultObject res = applyToChildren(node, OpenSCADOperator::UNION);
-				if ((geom = res.constptr())) {
+				geom = applyToChildren(node, OpenSCADOperator::UNION);
+				Transform3d matrix = node.matrix;
+				// The only child, if geom is its own cacheable geometry
+				const AbstractNode *child = nullptr;
+				if (node.getChildren().size() == 1) {
+					child = node.getChildren().front();
+					if (child == this->pendingnode || child->modinst->isBackground()) child = nullptr;
+					matrix = matrix * takePendingTransform(*node.getChildren().front());
+				}
+				if (geom) {
 					if (geom->getDimension() == 2) {
-						shared_ptr<const Polygon2d> polygons = dynamic_pointer_cast<const Polygon2d>(geom);
-						assert(polygons);
-						
-						// If we got a const object, make a copy
-						shared_ptr<Polygon2d> newpoly;
-						if (res.isConst()) newpoly.reset(new Polygon2d(*polygons));
-						else newpoly = dynamic_pointer_cast<Polygon2d>(res.ptr());
+						shared_ptr<Polygon2d> newpoly = editable<Polygon2d>(geom);
+						geom = newpoly;
 						
 						Transform2d mat2;
 						mat2.matrix() << 
-							node.matrix(0,0), node.matrix(0,1), node.matrix(0,3),
-							node.matrix(1,0), node.matrix(1,1), node.matrix(1,3),
-							node.matrix(3,0), node.matrix(3,1), node.matrix(3,3);
+							matrix(0,0), matrix(0,1), matrix(0,3),
+							matrix(1,0), matrix(1,1), matrix(1,3),
+							matrix(3,0), matrix(3,1), matrix(3,3);
+						// Keeps the winding order, and so a sanitized polygon sanitized
 						newpoly->transform(mat2);
-						// A 2D transformation may flip the winding order of a polygon.
-						// If that happens with a sanitized polygon, we need to reverse
-						// the winding order for it to be correct.
-						if (newpoly->isSanitized() && mat2.matrix().determinant() <= 0) {
-							geom.reset(ClipperUtils::sanitize(*newpoly));
-						}
 					}
 					else if (geom->getDimension() == 3) {
-						shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(geom);
-						if (ps) {
-							// If we got a const object, make a copy
-							shared_ptr<PolySet> newps;
-							if (res.isConst()) newps.reset(new PolySet(*ps));
-							else newps = dynamic_pointer_cast<PolySet>(res.ptr());
-							newps->transform(node.matrix);
+						const bool shared = geom.use_count() > 1;
+						if (auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+							geom = instances->transformed(matrix);
+						}
+						else if (geometry_cast<const PolySet>(geom)) {
+							if (shared) {
+								// Shared with others, so instance it rather than transforming a copy
+								geom = make_shared<const InstancedPolySet>(static_pointer_cast<const PolySet>(geom), matrix);
+							}
+							else {
+								shared_ptr<PolySet> newps = editable<PolySet>(geom);
+								newps->transform(matrix);
+								geom = newps;
+							}
+						}
+						else if (auto ps = cachedPolySet(child, geom, state)) {
+							geom = make_shared<const InstancedPolySet>(ps, matrix);
+						}
+						else if (shared_ptr<PolySet> newps = transformedPolySet(geom, matrix, state)) {
 							geom = newps;
 						}
 						else {
-							shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom);
-							assert(N);
-							// If we got a const object, make a copy
-							shared_ptr<CGAL_Nef_polyhedron> newN;
-							if (res.isConst()) newN.reset((CGAL_Nef_polyhedron*)N->copy());
-							else newN = dynamic_pointer_cast<CGAL_Nef_polyhedron>(res.ptr());
-							newN->transform(node.matrix);
+							shared_ptr<CGAL_Nef_polyhedron> newN = editable<CGAL_Nef_polyhedron>(geom);
+							newN->transform(matrix);
 							geom = newN;
 						}
 					}
@@ -641,6 +1322,7 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 		else {
 			geom = smartCacheGet(node, state.preferNef());
 		}
+		this->pendingnode = nullptr;
 		addToParent(state, node, geom);
 		node.progress_report();
 	}
@@ -649,57 +1331,66 @@ Response GeometryEvaluator::visit(State &state, const TransformNode &node)
 
 static void translate_PolySet(PolySet &ps, const Vector3d &translation)
 {
-	for(auto &p : ps.polygons) {
+	for(auto &p : ps.mutablePolygons()) {
 		for(auto &v : p) {
 			v += translation;
 		}
 	}
 }
 
-static void add_slice(PolySet *ps, const Polygon2d &poly, 
-											double rot1, double rot2, 
-											double h1, double h2, 
-											const Vector2d &scale1,
-											const Vector2d &scale2)
+/*!
+	Vertices of all outlines of poly, as the columns of one matrix, so the
+	vertices of a slice can be transformed in one go.
+*/
+static Eigen::Matrix2Xd outline_vertices(const Polygon2d &poly)
+{
+	size_t numvertices = 0;
+	for (const auto &o : poly.outlines()) numvertices += o.vertices.size();
+	Eigen::Matrix2Xd vertices(2, numvertices);
+	size_t i = 0;
+	for (const auto &o : poly.outlines()) {
+		for (const auto &v : o.vertices) vertices.col(i++) = v;
+	}
+	return vertices;
+}
+
+static Eigen::Matrix2d slice_transform(double rot, const Vector2d &scale)
+{
+	return (Eigen::Scaling(scale) * Eigen::Affine2d(rotate_degrees(-rot))).linear();
+}
+
+/*!
+	Adds the side faces between two slices. ring1 and ring2 hold the
+	transformed vertices of all outlines at the bottom and top of the slice,
+	in the order given by outline_vertices().
+*/
+static void add_slice(PolySet *ps, const Polygon2d &poly,
+											double rot1, double rot2,
+											const Eigen::Matrix2Xd &ring1, const Eigen::Matrix2Xd &ring2,
+											double h1, double h2, bool top_collapsed)
 {
-	Eigen::Affine2d trans1(Eigen::Scaling(scale1) * Eigen::Affine2d(rotate_degrees(-rot1)));
-	Eigen::Affine2d trans2(Eigen::Scaling(scale2) * Eigen::Affine2d(rotate_degrees(-rot2)));
-	
 	bool splitfirst = sin_degrees(rot1 - rot2) > 0.0;
+	size_t start = 0;
 	for(const auto &o : poly.outlines()) {
-		Vector2d prev1 = trans1 * o.vertices[0];
-		Vector2d prev2 = trans2 * o.vertices[0];
-		for (size_t i=1;i<=o.vertices.size();i++) {
-			Vector2d curr1 = trans1 * o.vertices[i % o.vertices.size()];
-			Vector2d curr2 = trans2 * o.vertices[i % o.vertices.size()];
-			ps->append_poly();
-			
+		const size_t n = o.vertices.size();
+		for (size_t i = 0; i < n; i++) {
+			const size_t p = start + i, c = start + (i + 1) % n;
+			const Vector3d prev1(ring1(0, p), ring1(1, p), h1);
+			const Vector3d prev2(ring2(0, p), ring2(1, p), h2);
+			const Vector3d curr1(ring1(0, c), ring1(1, c), h1);
+			const Vector3d curr2(ring2(0, c), ring2(1, c), h2);
+
 			// Make sure to split negative outlines correctly
 			if (splitfirst xor !o.positive) {
-				ps->insert_vertex(prev1[0], prev1[1], h1);
-				ps->insert_vertex(curr2[0], curr2[1], h2);
-				ps->insert_vertex(curr1[0], curr1[1], h1);
-				if (scale2[0] > 0 || scale2[1] > 0) {
-					ps->append_poly();
-					ps->insert_vertex(curr2[0], curr2[1], h2);
-					ps->insert_vertex(prev1[0], prev1[1], h1);
-					ps->insert_vertex(prev2[0], prev2[1], h2);
-				}
+				ps->append_poly({curr1, curr2, prev1});
+				if (!top_collapsed) ps->append_poly({prev2, prev1, curr2});
 			}
 			else {
-				ps->insert_vertex(prev1[0], prev1[1], h1);
-				ps->insert_vertex(prev2[0], prev2[1], h2);
-				ps->insert_vertex(curr1[0], curr1[1], h1);
-				if (scale2[0] > 0 || scale2[1] > 0) {
-					ps->append_poly();
-					ps->insert_vertex(prev2[0], prev2[1], h2);
-					ps->insert_vertex(curr2[0], curr2[1], h2);
-					ps->insert_vertex(curr1[0], curr1[1], h1);
-				}
+				ps->append_poly({curr1, prev2, prev1});
+				if (!top_collapsed) ps->append_poly({curr1, curr2, prev2});
 			}
-			prev1 = curr1;
-			prev2 = curr2;
 		}
+		start += n;
 	}
 }
 
@@ -729,7 +1420,7 @@ static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &
 	PolySet *ps_bottom = poly.tessellate(); // bottom
 	
 	// Flip vertex ordering for bottom polygon
-	for(auto &p : ps_bottom->polygons) {
+	for(auto &p : ps_bottom->mutablePolygons()) {
 		std::reverse(p.begin(), p.end());
 	}
 	translate_PolySet(*ps_bottom, Vector3d(0,0,h1));
@@ -745,18 +1436,24 @@ static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &
 		ps->append(*ps_top);
 		delete ps_top;
 	}
-    size_t slices = node.slices;
+	size_t slices = node.slices;
 
+	// The sides are built slice by slice, transforming the outline vertices
+	// once per slice boundary instead of once per face.
+	const Eigen::Matrix2Xd vertices = outline_vertices(poly);
+	ps->reserve(ps->numPolygons() + slices * vertices.cols() * 2);
+	Eigen::Matrix2Xd ring1 = slice_transform(0, Vector2d(1, 1)) * vertices, ring2;
 	for (unsigned int j = 0; j < slices; j++) {
 		double rot1 = node.twist*j / slices;
 		double rot2 = node.twist*(j+1) / slices;
 		double height1 = h1 + (h2-h1)*j / slices;
 		double height2 = h1 + (h2-h1)*(j+1) / slices;
-		Vector2d scale1(1 - (1-node.scale_x)*j / slices,
-										1 - (1-node.scale_y)*j / slices);
 		Vector2d scale2(1 - (1-node.scale_x)*(j+1) / slices,
 										1 - (1-node.scale_y)*(j+1) / slices);
-		add_slice(ps, poly, rot1, rot2, height1, height2, scale1, scale2);
+		ring2.noalias() = slice_transform(rot2, scale2) * vertices;
+		add_slice(ps, poly, rot1, rot2, ring1, ring2, height1, height2,
+							!(scale2[0] > 0 || scale2[1] > 0));
+		ring1.swap(ring2);
 	}
 
 	return ps;
@@ -771,6 +1468,7 @@ static Geometry *extrudePolygon(const LinearExtrudeNode &node, const Polygon2d &
  */			
 Response GeometryEvaluator::visit(State &state, const LinearExtrudeNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(LinearExtrudeNode)");
 	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
@@ -787,7 +1485,7 @@ Response GeometryEvaluator::visit(State &state, const LinearExtrudeNode &node)
 				geometry = applyToChildren2D(node, OpenSCADOperator::UNION);
 			}
 			if (geometry) {
-				const Polygon2d *polygons = dynamic_cast<const Polygon2d*>(geometry);
+				const Polygon2d *polygons = geometry_cast<const Polygon2d>(geometry);
 				Geometry *extruded = extrudePolygon(node, *polygons);
 				assert(extruded);
 				geom.reset(extruded);
@@ -803,24 +1501,6 @@ Response GeometryEvaluator::visit(State &state, const LinearExtrudeNode &node)
 	return Response::ContinueTraversal;
 }
 
-static void fill_ring(std::vector<Vector3d> &ring, const Outline2d &o, double a, bool flip)
-{
-	if (flip) {
-		unsigned int l = o.vertices.size()-1;
-		for (unsigned int i=0 ;i<o.vertices.size();i++) {
-			ring[i][0] = o.vertices[l-i][0] * sin_degrees(a);
-			ring[i][1] = o.vertices[l-i][0] * cos_degrees(a);
-			ring[i][2] = o.vertices[l-i][1];
-		}
-	} else {
-		for (unsigned int i=0 ;i<o.vertices.size();i++) {
-			ring[i][0] = o.vertices[i][0] * sin_degrees(a);
-			ring[i][1] = o.vertices[i][0] * cos_degrees(a);
-			ring[i][2] = o.vertices[i][1];
-		}
-	}
-}
-
 /*!
 	Input to extrude should be clean. This means non-intersecting, correct winding order
 	etc., the input coming from a library like Clipper.
@@ -864,59 +1544,80 @@ static Geometry *rotatePolygon(const RotateExtrudeNode &node, const Polygon2d &p
 	}
 
 	bool flip_faces = (min_x >= 0 && node.angle > 0 && node.angle != 360) || (min_x < 0 && (node.angle < 0 || node.angle == 360));
-	
-	if (node.angle != 360) {
-		PolySet *ps_start = poly.tessellate(); // starting face
-		Transform3d rot(angle_axis_degrees(90, Vector3d::UnitX()));
-		ps_start->transform(rot);
-		// Flip vertex ordering
-		if (!flip_faces) {
-			for(auto &p : ps_start->polygons) {
-				std::reverse(p.begin(), p.end());
-			}
-		}
-		ps->append(*ps_start);
-		delete ps_start;
-
-		PolySet *ps_end = poly.tessellate();
-		Transform3d rot2(angle_axis_degrees(node.angle, Vector3d::UnitZ()) * angle_axis_degrees(90, Vector3d::UnitX()));
-		ps_end->transform(rot2);
-		if (flip_faces) {
-			for(auto &p : ps_end->polygons) {
-				std::reverse(p.begin(), p.end());
+
+	// The sines and cosines of the ring angles are computed once for all
+	// outlines. A full revolution closes with its first ring.
+	const bool closed = node.angle == 360;
+	const unsigned int numrings = closed ? fragments : fragments + 1;
+	std::vector<double> sines(numrings), cosines(numrings);
+	for (unsigned int j = 0; j < numrings; j++) {
+		double a;
+		if (closed)
+			a = -90 + j * 360.0 / fragments; // start on the -X axis, for legacy support
+		else
+			a = 90 - j * node.angle / fragments; // start on the X axis
+		sines[j] = sin_degrees(a);
+		cosines[j] = cos_degrees(a);
+	}
+
+	// The rings of an outline lie one after the other in the vertex buffer
+	IndexedMesh mesh;
+	size_t numvertices = 0;
+	for (const auto &o : poly.outlines()) numvertices += o.vertices.size();
+	mesh.vertices.reserve(numvertices * numrings);
+	mesh.indices.reserve(numvertices * fragments * 6);
+	mesh.faceoffsets.reserve(numvertices * fragments * 2 + 1);
+	auto add_triangle = [&mesh](int a, int b, int c) {
+		mesh.indices.push_back(a);
+		mesh.indices.push_back(b);
+		mesh.indices.push_back(c);
+		mesh.faceoffsets.push_back(mesh.indices.size());
+	};
+
+	if (!closed) {
+		// Both caps are the same tessellation of the polygon, at the first and last ring
+		PolySet *caps = poly.tessellate();
+		for (const int ring : {0, int(fragments)}) {
+			if (!caps) break;
+			const bool reversed = (ring == 0) != flip_faces;
+			for (const auto &p : caps->polygons()) {
+				const int first = mesh.vertices.size();
+				for (const auto &v : p) mesh.vertices.emplace_back(v[0] * sines[ring], v[0] * cosines[ring], v[1]);
+				if (reversed) std::reverse(mesh.vertices.begin() + first, mesh.vertices.end());
+				mesh.indices.reserve(mesh.indices.size() + p.size());
+				for (int i = first; i < int(mesh.vertices.size()); i++) mesh.indices.push_back(i);
+				mesh.faceoffsets.push_back(mesh.indices.size());
 			}
 		}
-		ps->append(*ps_end);
-		delete ps_end;
+		delete caps;
 	}
 
+	std::vector<double> xs, ys;
 	for(const auto &o : poly.outlines()) {
-		std::vector<Vector3d> rings[2];
-		rings[0].resize(o.vertices.size());
-		rings[1].resize(o.vertices.size());
-
-		fill_ring(rings[0], o, (node.angle == 360) ? -90 : 90, flip_faces); // first ring
+		const size_t n = o.vertices.size();
+		xs.resize(n);
+		ys.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			const auto &v = o.vertices[flip_faces ? n - 1 - i : i];
+			xs[i] = v[0];
+			ys[i] = v[1];
+		}
+		const int base = mesh.vertices.size();
+		for (unsigned int j = 0; j < numrings; j++) {
+			const double s = sines[j], c = cosines[j];
+			for (size_t i = 0; i < n; i++) mesh.vertices.emplace_back(xs[i] * s, xs[i] * c, ys[i]);
+		}
 		for (unsigned int j = 0; j < fragments; j++) {
-			double a;
-			if (node.angle == 360)
-			    a = -90 + ((j+1)%fragments) * 360.0 / fragments; // start on the -X axis, for legacy support
-			else
-				a = 90 - (j+1)* node.angle / fragments; // start on the X axis
-			fill_ring(rings[(j+1)%2], o, a, flip_faces);
-
-			for (size_t i=0;i<o.vertices.size();i++) {
-				ps->append_poly();
-				ps->insert_vertex(rings[j%2][i]);
-				ps->insert_vertex(rings[(j+1)%2][(i+1)%o.vertices.size()]);
-				ps->insert_vertex(rings[j%2][(i+1)%o.vertices.size()]);
-				ps->append_poly();
-				ps->insert_vertex(rings[j%2][i]);
-				ps->insert_vertex(rings[(j+1)%2][i]);
-				ps->insert_vertex(rings[(j+1)%2][(i+1)%o.vertices.size()]);
+			const int ring1 = base + j * n, ring2 = base + ((j + 1) % numrings) * n;
+			for (size_t i = 0; i < n; i++) {
+				const int next = (i + 1) % n;
+				add_triangle(ring1 + next, ring2 + next, ring1 + i);
+				add_triangle(ring2 + next, ring2 + i, ring1 + i);
 			}
 		}
 	}
-	
+
+	PolysetUtils::appendIndexedMesh(mesh, *ps);
 	return ps;
 }
 
@@ -929,6 +1630,7 @@ static Geometry *rotatePolygon(const RotateExtrudeNode &node, const Polygon2d &p
  */			
 Response GeometryEvaluator::visit(State &state, const RotateExtrudeNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(RotateExtrudeNode)");
 	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
@@ -944,7 +1646,7 @@ Response GeometryEvaluator::visit(State &state, const RotateExtrudeNode &node)
 				geometry = applyToChildren2D(node, OpenSCADOperator::UNION);
 			}
 			if (geometry) {
-				const Polygon2d *polygons = dynamic_cast<const Polygon2d*>(geometry);
+				const Polygon2d *polygons = geometry_cast<const Polygon2d>(geometry);
 				Geometry *rotated = rotatePolygon(node, *polygons);
 				geom.reset(rotated);
 				delete geometry;
@@ -977,20 +1679,19 @@ Response GeometryEvaluator::visit(State & /*state*/, const AbstractPolyNode & /*
  */			
 Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(ProjectionNode)");
 	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
+			ClipperLib::Clipper sumclipper;
+			for(const auto &item : this->visitedchildren[node.index()]) {
+				const AbstractNode *chnode = item.first;
+				const shared_ptr<const Geometry> &chgeom = item.second;
+				// FIXME: Don't use deep access to modinst members
+				if (chnode->modinst->isBackground()) continue;
 
-			if (!node.cut_mode) {
-				ClipperLib::Clipper sumclipper;
-				for(const auto &item : this->visitedchildren[node.index()]) {
-					const AbstractNode *chnode = item.first;
-					const shared_ptr<const Geometry> &chgeom = item.second;
-					// FIXME: Don't use deep access to modinst members
-					if (chnode->modinst->isBackground()) continue;
-
-					const Polygon2d *poly = nullptr;
+				const Polygon2d *poly = nullptr;
 
 // CGAL version of Geometry projection
 // Causes crashes in createNefPolyhedronFromGeometry() for this model:
@@ -1002,73 +1703,54 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 //    }
 // }
 #if 0
-					shared_ptr<const PolySet> chPS = dynamic_pointer_cast<const PolySet>(chgeom);
-					const PolySet *ps2d = nullptr;
-					shared_ptr<const CGAL_Nef_polyhedron> chN = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(chgeom);
-					if (chN) chPS.reset(chN->convertToPolyset());
-					if (chPS) ps2d = PolysetUtils::flatten(*chPS);
-					if (ps2d) {
-						CGAL_Nef_polyhedron *N2d = CGALUtils::createNefPolyhedronFromGeometry(*ps2d);
-						poly = N2d->convertToPolygon2d();
-					}
+				shared_ptr<const PolySet> chPS = geometry_cast<const PolySet>(chgeom);
+				const PolySet *ps2d = nullptr;
+				shared_ptr<const CGAL_Nef_polyhedron> chN = geometry_cast<const CGAL_Nef_polyhedron>(chgeom);
+				if (chN) chPS.reset(chN->convertToPolyset());
+				if (chPS) ps2d = PolysetUtils::flatten(*chPS);
+				if (ps2d) {
+					CGAL_Nef_polyhedron *N2d = CGALUtils::createNefPolyhedronFromGeometry(*ps2d);
+					poly = N2d->convertToPolygon2d();
+				}
 #endif
 
 // Clipper version of Geometry projection
 // Clipper doesn't handle meshes very well.
 // It's better in V6 but not quite there. FIXME: stand-alone example.
 #if 1
-					// project chgeom -> polygon2d
-					shared_ptr<const PolySet> chPS = dynamic_pointer_cast<const PolySet>(chgeom);
-					if (!chPS) {
-						shared_ptr<const CGAL_Nef_polyhedron> chN = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(chgeom);
-						if (chN) {
-							PolySet *ps = new PolySet(3);
-							bool err = CGALUtils::createPolySetFromNefPolyhedron3(*chN->p3, *ps);
-							if (err) {
-								PRINT("ERROR: Nef->PolySet failed");
-							}
-							else {
-								chPS.reset(ps);
-							}
+				// project chgeom -> polygon2d
+				shared_ptr<const PolySet> chPS = geometry_cast<const PolySet>(InstancedPolySet::flattened(chgeom));
+				if (!chPS) {
+					shared_ptr<const CGAL_Nef_polyhedron> chN = geometry_cast<const CGAL_Nef_polyhedron>(chgeom);
+					if (chN) {
+						PolySet *ps = new PolySet(3);
+						bool err = CGALUtils::createPolySetFromNefPolyhedron3(*chN->p3, *ps);
+						if (err) {
+							PRINT("ERROR: Nef->PolySet failed");
+						}
+						else {
+							chPS.reset(ps);
 						}
 					}
-					if (chPS) poly = PolysetUtils::project(*chPS);
+				}
+				// The cut is sliced out of each child's mesh directly, which spares
+				// unioning the children as Nef polyhedra
+				if (chPS) poly = node.cut_mode ? PolysetUtils::slice(*chPS) : PolysetUtils::project_silhouette(*chPS);
 #endif
 
-					if (poly) {
-						ClipperLib::Paths result = ClipperUtils::fromPolygon2d(*poly);
-						// Using NonZero ensures that we don't create holes from polygons sharing
-						// edges since we're unioning a mesh
-						result = ClipperUtils::process(result, 
-																					 ClipperLib::ctUnion, 
-																					 ClipperLib::pftNonZero);
-						// Add correctly winded polygons to the main clipper
-						sumclipper.AddPaths(result, ClipperLib::ptSubject, true);
-					}
+				// Add correctly winded polygons to the main clipper
+				if (poly) sumclipper.AddPaths(ClipperUtils::fromPolygon2d(*poly), ClipperLib::ptSubject, true);
 
-					delete poly;
-				}
-				ClipperLib::PolyTree sumresult;
-				// This is key - without StrictlySimple, we tend to get self-intersecting results
-				sumclipper.StrictlySimple(true);
-				sumclipper.Execute(ClipperLib::ctUnion, sumresult, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
-				if (sumresult.Total() > 0) geom.reset(ClipperUtils::toPolygon2d(sumresult));
+				delete poly;
 			}
-			else {
-				shared_ptr<const Geometry> newgeom = applyToChildren3D(node, OpenSCADOperator::UNION).constptr();
-				if (newgeom) {
-					shared_ptr<const CGAL_Nef_polyhedron> Nptr = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(newgeom);
-					if (!Nptr) {
-						Nptr.reset(CGALUtils::createNefPolyhedronFromGeometry(*newgeom));
-					}
-					if (!Nptr->isEmpty()) {
-						Polygon2d *poly = CGALUtils::project(*Nptr, node.cut_mode);
-						if (poly) {
-							poly->setConvexity(node.convexity);
-							geom.reset(poly);
-						}
-					}
-				}
+			ClipperLib::PolyTree sumresult;
+			// This is key - without StrictlySimple, we tend to get self-intersecting results
+			sumclipper.StrictlySimple(true);
+			sumclipper.Execute(ClipperLib::ctUnion, sumresult, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+			if (sumresult.Total() > 0) {
+				Polygon2d *poly = ClipperUtils::toPolygon2d(sumresult);
+				if (node.cut_mode) poly->setConvexity(node.convexity);
+				geom.reset(poly);
 			}
 		}
 		else {
@@ -1088,51 +1770,47 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
  */			
 Response GeometryEvaluator::visit(State &state, const CgaladvNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(CgaladvNode)");
 	if (state.isPrefix() && isSmartCached(node)) return Response::PruneTraversal;
 	if (state.isPostfix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
 			switch (node.type) {
 			case CgaladvType::MINKOWSKI: {
-				ResultObject res = applyToChildren(node, OpenSCADOperator::MINKOWSKI);
-				geom = res.constptr();
+				geom = applyToChildren(node, OpenSCADOperator::MINKOWSKI);
 				// If we added convexity, we need to pass it on
 				if (geom && geom->getConvexity() != node.convexity) {
-					shared_ptr<Geometry> editablegeom;
-					// If we got a const object, make a copy
-					if (res.isConst()) editablegeom.reset(geom->copy());
-					else editablegeom = res.ptr();
-					geom = editablegeom;
+					auto editablegeom = editable<Geometry>(geom);
 					editablegeom->setConvexity(node.convexity);
+					geom = editablegeom;
 				}
 				break;
 			}
 			case CgaladvType::HULL: {
-				geom = applyToChildren(node, OpenSCADOperator::HULL).constptr();
+				geom = applyToChildren(node, OpenSCADOperator::HULL);
 				break;
 			}
 			case CgaladvType::RESIZE: {
-				ResultObject res = applyToChildren(node, OpenSCADOperator::UNION);
-				geom = res.constptr();
+				geom = applyToChildren(node, OpenSCADOperator::UNION);
+				if (auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+					geom.reset(instances->flatten());
+				}
 				if (geom) {
-					shared_ptr<Geometry> editablegeom;
-					// If we got a const object, make a copy
-					if (res.isConst()) editablegeom.reset(geom->copy());
-					else editablegeom = res.ptr();
+					auto editablegeom = editable<Geometry>(geom);
 					geom = editablegeom;
 
-					shared_ptr<CGAL_Nef_polyhedron> N = dynamic_pointer_cast<CGAL_Nef_polyhedron>(editablegeom);
+					shared_ptr<CGAL_Nef_polyhedron> N = geometry_cast<CGAL_Nef_polyhedron>(editablegeom);
 					if (N) {
 						N->resize(node.newsize, node.autosize);
 					}
 					else {
-						shared_ptr<Polygon2d> poly = dynamic_pointer_cast<Polygon2d>(editablegeom);
+						shared_ptr<Polygon2d> poly = geometry_cast<Polygon2d>(editablegeom);
 						if (poly) {
 							poly->resize(Vector2d(node.newsize[0], node.newsize[1]),
 													 Eigen::Matrix<bool,2,1>(node.autosize[0], node.autosize[1]));
 						}
 						else {
-							shared_ptr<PolySet> ps = dynamic_pointer_cast<PolySet>(editablegeom);
+							shared_ptr<PolySet> ps = geometry_cast<PolySet>(editablegeom);
 							if (ps) {
 								ps->resize(node.newsize, node.autosize);
 							}
@@ -1144,6 +1822,25 @@ Response GeometryEvaluator::visit(State &state, const CgaladvNode &node)
 				}
 				break;
 			}
+			case CgaladvType::SIMPLIFY: {
+				geom = applyToChildren(node, OpenSCADOperator::UNION);
+				// 2D children are passed on as they are
+				if (geom && geom->getDimension() == 3 && !geom->isEmpty()) {
+					auto ps = geometry_cast<const PolySet>(InstancedPolySet::flattened(geom));
+					if (!ps) {
+						if (auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+							auto nefps = new PolySet(3);
+							nefps->setConvexity(N->getConvexity());
+							ps.reset(nefps);
+							if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *nefps)) {
+								PRINT("ERROR: Nef->PolySet failed");
+							}
+						}
+					}
+					if (ps) geom.reset(PolysetUtils::simplify(*ps, node.maxtriangles, node.maxerror));
+				}
+				break;
+			}
 			default:
 				assert(false && "not implemented");
 			}
@@ -1159,6 +1856,7 @@ Response GeometryEvaluator::visit(State &state, const CgaladvNode &node)
 
 Response GeometryEvaluator::visit(State &state, const AbstractIntersectionNode &node)
 {
+	TRACE_ZONE("GeometryEvaluator::visit(AbstractIntersectionNode)");
 	if (state.isPrefix()) {
 		if (isSmartCached(node)) return Response::PruneTraversal;
 		state.setPreferNef(true); // Improve quality of CSG by avoiding conversion loss
@@ -1166,7 +1864,7 @@ Response GeometryEvaluator::visit(State &state, const AbstractIntersectionNode &
 	if (state.isPostfix()) {
 		shared_ptr<const class Geometry> geom;
 		if (!isSmartCached(node)) {
-			geom = applyToChildren(node, OpenSCADOperator::INTERSECTION).constptr();
+			geom = applyToChildren(node, OpenSCADOperator::INTERSECTION);
 		}
 		else {
 			geom = smartCacheGet(node, state.preferNef());
@@ -4,19 +4,23 @@
 #include "enums.h"
 #include "memory.h"
 #include "Geometry.h"
+#include "linalg.h"
 
 #include <utility>
 #include <list>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 class GeometryEvaluator : public NodeVisitor
 {
 public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 	GeometryEvaluator(const class Tree &tree);
 	~GeometryEvaluator() {}
 
-	shared_ptr<const Geometry> evaluateGeometry(const AbstractNode &node, bool allownef);
+	// Instanced geometry (see InstancedPolySet) is flattened unless allowinstances is set
+	shared_ptr<const Geometry> evaluateGeometry(const AbstractNode &node, bool allownef, bool allowinstances = false);
 
 	Response visit(State &state, const AbstractNode &node) override;
 	Response visit(State &state, const AbstractIntersectionNode &node) override;
@@ -33,45 +37,64 @@ public:
 	Response visit(State &state, const RenderNode &node) override;
 	Response visit(State &state, const TextNode &node) override;
 	Response visit(State &state, const OffsetNode &node) override;
+	Response visit(State &state, const ColorNode &node) override;
 
 	const Tree &getTree() const { return this->tree; }
 
-private:
-	class ResultObject {
-	public:
-		ResultObject() : is_const(true) {}
-		ResultObject(const Geometry *g) : is_const(true), const_pointer(g) {}
-		ResultObject(shared_ptr<const Geometry> &g) : is_const(true), const_pointer(g) {}
-		ResultObject(Geometry *g) : is_const(false), pointer(g) {}
-		ResultObject(shared_ptr<Geometry> &g) : is_const(false), pointer(g) {}
-		bool isConst() const { return is_const; }
-		shared_ptr<Geometry> ptr() { assert(!is_const); return pointer; }
-		shared_ptr<const Geometry> constptr() const { 
-			return is_const ? const_pointer : static_pointer_cast<const Geometry>(pointer);
-		}
-	private:
-		bool is_const;
-		shared_ptr<Geometry> pointer;
-		shared_ptr<const Geometry> const_pointer;
-	};
+	// While set, Nef results whose exact coordinates grew large are rounded
+	// to the GRID_FINE grid, see CGALUtils::snapNefPolyhedron()
+	static void setSnapRounding(bool snap) { snap_rounding = snap; }
+
+	// The key of the result of node in the caches: Tree::getIdKey(), tagged
+	// by the CSG backend if its results aren't exact, see CSGBackend::cacheTag()
+	static std::string cacheKey(const class Tree &tree, const AbstractNode &node);
+
+protected:
+	const char *profileCategory() const override { return "GeometryEvaluator"; }
+	void profileNode(const AbstractNode &node, RenderProfile::Event &event) override;
+	bool timesNodes() const override { return true; }
 
+private:
 	void smartCacheInsert(const AbstractNode &node, const shared_ptr<const Geometry> &geom);
 	shared_ptr<const Geometry> smartCacheGet(const AbstractNode &node, bool preferNef);
 	bool isSmartCached(const AbstractNode &node);
-	std::vector<const class Polygon2d *> collectChildren2D(const AbstractNode &node);
+	void evaluateChildrenInParallel(const AbstractNode &node);
+	std::vector<const class Polygon2d *> collectChildren2D(const AbstractNode &node, std::vector<const AbstractNode *> *nodes = nullptr);
 	Geometry::Geometries collectChildren3D(const AbstractNode &node);
+	std::vector<std::string> prefixKeys(const std::vector<const AbstractNode *> &nodes, OpenSCADOperator op) const;
+	size_t cachedPrefix(const std::vector<std::string> &keys, shared_ptr<const Geometry> &geom) const;
+	shared_ptr<const Geometry> cachedPartial(const std::string &key) const;
+	void cachePartial(const std::string &key, const shared_ptr<const Geometry> &geom, double seconds) const;
+	shared_ptr<const Geometry> applyUnionTree(const Geometry::Geometries &children);
 	Polygon2d *applyMinkowski2D(const AbstractNode &node);
 	Polygon2d *applyHull2D(const AbstractNode &node);
 	Geometry *applyHull3D(const AbstractNode &node);
 	void applyResize3D(class CGAL_Nef_polyhedron &N, const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize);
 	Polygon2d *applyToChildren2D(const AbstractNode &node, OpenSCADOperator op);
-	ResultObject applyToChildren3D(const AbstractNode &node, OpenSCADOperator op);
-	ResultObject applyToChildren(const AbstractNode &node, OpenSCADOperator op);
+	shared_ptr<const Geometry> applyToChildren3D(const AbstractNode &node, OpenSCADOperator op);
+	shared_ptr<const Geometry> applyToChildren(const AbstractNode &node, OpenSCADOperator op);
 	void addToParent(const State &state, const AbstractNode &node, const shared_ptr<const Geometry> &geom);
+	Transform3d takePendingTransform(const AbstractNode &child);
+	shared_ptr<const class PolySet> cachedPolySet(const AbstractNode *child, const shared_ptr<const Geometry> &geom, const State &state);
 
-	std::map<int, Geometry::Geometries> visitedchildren;
+	VisitedChildren<Geometry::Geometries> visitedchildren;
+	// Subtree results computed concurrently or loaded from the disk cache,
+	// keyed by cacheKey(). Kept here so they stay available even if
+	// evicted from the memory caches.
+	std::unordered_map<std::string, shared_ptr<const Geometry>> precomputed;
+	// Seconds each node evaluated in its postfix visit took, including its
+	// children, until its result is cached, see smartCacheInsert()
+	std::unordered_map<const AbstractNode *, double> computetimes;
 	const Tree &tree;
 	shared_ptr<const Geometry> root;
+	// The node whose geometry still needs pendingtransform, see visit(TransformNode)
+	const AbstractNode *pendingnode;
+	Transform3d pendingtransform;
+	// The geometry last added to a parent and the cache it came from, for profileNode()
+	const Geometry *lastgeom;
+	const char *lastcache;
+
+	static bool snap_rounding;
 
 public:
 };
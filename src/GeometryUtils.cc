@@ -2,20 +2,128 @@
 #include "ext/libtess2/Include/tesselator.h"
 #include "printutils.h"
 #include "Reindexer.h"
+#include "ThreadPool.h"
+#include "Trace.h"
 #include <boost/lexical_cast.hpp>
 #include <unordered_map>
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <memory>
 
 #include <boost/functional/hash.hpp>
 
+static const size_t tess_alignment = alignof(std::max_align_t);
+static const size_t tess_block_size = 256*1024;
+static const size_t tess_max_kept_blocks = 16;
+
+/*!
+	Bump allocator for libtess2, one per thread. A tessellator allocates
+	many small objects and releases all of them when it's deleted, so
+	frees are ignored and the memory is reused by the next tessellation.
+*/
+class TessArena
+{
+public:
+	TessArena() : current(0), used(0) {}
+
+	void *alloc(size_t size) {
+		// new[] returns memory aligned for any fundamental type
+		size = (size + tess_alignment - 1) / tess_alignment * tess_alignment;
+		while (this->current < this->blocks.size()) {
+			if (this->used + size <= this->blocks[this->current].size) {
+				void *ptr = this->blocks[this->current].data.get() + this->used;
+				this->used += size;
+				return ptr;
+			}
+			this->current++;
+			this->used = 0;
+		}
+		this->blocks.emplace_back(std::max(size, tess_block_size));
+		this->used = size;
+		return this->blocks.back().data.get();
+	}
+
+	// Releases everything allocated since the last reset
+	void reset() {
+		// Don't keep the memory of exceptionally large tessellations around
+		if (this->blocks.size() > tess_max_kept_blocks) {
+			this->blocks.erase(this->blocks.begin() + tess_max_kept_blocks, this->blocks.end());
+		}
+		this->current = 0;
+		this->used = 0;
+	}
+
+	static TessArena &local() {
+		static thread_local TessArena arena;
+		return arena;
+	}
+
+private:
+	struct Block {
+		Block(size_t size) : data(new char[size]), size(size) {}
+		std::unique_ptr<char[]> data;
+		size_t size;
+	};
+	std::vector<Block> blocks;
+	size_t current;
+	size_t used;
+};
+
 static void *stdAlloc(void* userData, unsigned int size) {
-	TESS_NOTUSED(userData);
-	return malloc(size);
+	return static_cast<TessArena *>(userData)->alloc(size);
 }
 
 static void stdFree(void* userData, void* ptr) {
 	TESS_NOTUSED(userData);
-	free(ptr);
+	TESS_NOTUSED(ptr);
+}
+
+static Vector3f faceNormal(const std::vector<Vector3f> &vertices, const IndexedFace &face)
+{
+	// Newell's method
+	Vector3f normal(0, 0, 0);
+	for (size_t i = 0; i < face.size(); ++i) {
+		const auto &v1 = vertices[face[i]];
+		const auto &v2 = vertices[face[(i + 1) % face.size()]];
+		normal += Vector3f((v1[1] - v2[1]) * (v1[2] + v2[2]),
+											 (v1[2] - v2[2]) * (v1[0] + v2[0]),
+											 (v1[0] - v2[0]) * (v1[1] + v2[1]));
+	}
+	return normal;
+}
+
+static float cornerAngle(const Vector3f &prev, const Vector3f &v, const Vector3f &next)
+{
+	const Vector3f a = (prev - v).normalized(), b = (next - v).normalized();
+	return std::acos(std::max(-1.0f, std::min(1.0f, a.dot(b))));
+}
+
+/*!
+	Splits a strictly convex quad into two triangles, using the diagonal a
+	Delaunay triangulation would use. Returns false if the quad isn't
+	strictly convex.
+*/
+static bool tessellateConvexQuad(const std::vector<Vector3f> &vertices, const IndexedFace &face,
+																 std::vector<IndexedTriangle> &triangles)
+{
+	const Vector3f normal = faceNormal(vertices, face);
+	Vector3f v[4];
+	for (int i = 0; i < 4; ++i) v[i] = vertices[face[i]];
+	for (int i = 0; i < 4; ++i) {
+		const Vector3f e1 = v[(i + 1) % 4] - v[i], e2 = v[(i + 2) % 4] - v[(i + 1) % 4];
+		if (!(e1.cross(e2).dot(normal) > 0)) return false;
+	}
+	// The diagonal 0-2 is Delaunay if the angles at 1 and 3 add up to at most 180 degrees
+	if (cornerAngle(v[0], v[1], v[2]) + cornerAngle(v[2], v[3], v[0]) <= float(M_PI)) {
+		triangles.emplace_back(face[0], face[1], face[2]);
+		triangles.emplace_back(face[0], face[2], face[3]);
+	}
+	else {
+		triangles.emplace_back(face[1], face[2], face[3]);
+		triangles.emplace_back(face[1], face[3], face[0]);
+	}
+	return true;
 }
 
 typedef std::pair<int,int> IndexedEdge;
@@ -193,6 +301,7 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
 																							 std::vector<IndexedTriangle> &triangles,
 																							 const Vector3f *normal)
 {
+	TRACE_ZONE("GeometryUtils::tessellatePolygonWithHoles");
 	// Algorithm outline:
   // o Remove consecutive equal vertices and null ears (i.e. 23,24,23)
 	// o Ignore polygons with < 3 vertices
@@ -246,6 +355,10 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
 		triangles.emplace_back(cleanfaces[0][0], cleanfaces[0][1], cleanfaces[0][2]);
 		return false;
 	}
+	if (cleanfaces.size() == 1 && cleanfaces[0].size() == 4 &&
+			tessellateConvexQuad(vertices, cleanfaces[0], triangles)) {
+		return false;
+	}
 
 	// Build edge dict.
   // This contains all edges in the original polygon.
@@ -266,13 +379,18 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
 
   TESSalloc ma;
   TESStesselator* tess = nullptr;
+  auto &arena = TessArena::local();
 
   memset(&ma, 0, sizeof(ma));
   ma.memalloc = stdAlloc;
   ma.memfree = stdFree;
+  ma.userData = &arena;
   ma.extraVertices = 256; // realloc not provided, allow 256 extra vertices.
   
-  if (!(tess = tessNewTess(&ma))) return true;
+  if (!(tess = tessNewTess(&ma))) {
+    arena.reset();
+    return true;
+  }
 
 	int numContours = 0;
   std::vector<TESSreal> contour;
@@ -294,7 +412,11 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
 		numContours++;
   }
 
-  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) return -1;
+  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) {
+    tessDeleteTess(tess);
+    arena.reset();
+    return true;
+  }
 
   const auto vindices = tessGetVertexIndices(tess);
   const auto elements = tessGetElements(tess);
@@ -409,10 +531,188 @@ bool GeometryUtils::tessellatePolygonWithHoles(const std::vector<Vector3f>& vert
 #endif
 
   tessDeleteTess(tess);
+  arena.reset();
 
   return false;
 }
 
+// Tessellations of faces with holes or more than this many vertices are cached
+static const size_t tess_cache_min_vertices = 5;
+static const size_t tess_cache_max_shapes = 4096;
+// Shapes are compared on a grid of this fraction of the largest coordinate
+static const int tess_cache_grid_bits = 18;
+
+/*!
+	The outlines of a polygon with holes, translated so that its first
+	vertex is at the origin and rounded to a grid. Repeated features of CAD
+	parts, e.g. patterns of pockets, give faces of the same shape, whose
+	tessellations only differ by the translation. The grid is coarser than
+	float precision, so the copies compare equal although their vertices
+	round differently.
+*/
+class FaceShape
+{
+public:
+	FaceShape(const std::vector<Vector3f> &vertices, const std::vector<IndexedFace> &faces, double quantum) : hash(0) {
+		const Vector3d origin = vertices[faces[0][0]].cast<double>();
+		for (const auto &face : faces) {
+			this->sizes.push_back(face.size());
+			for (auto idx : face) {
+				const Vector3d v = (vertices[idx].cast<double>() - origin) / quantum;
+				for (int k = 0; k < 3; ++k) this->coords.push_back(std::llround(v[k]));
+			}
+		}
+		boost::hash_combine(this->hash, boost::hash_range(this->coords.begin(), this->coords.end()));
+		boost::hash_combine(this->hash, boost::hash_range(this->sizes.begin(), this->sizes.end()));
+	}
+
+	bool operator==(const FaceShape &other) const {
+		return this->hash == other.hash && this->sizes == other.sizes && this->coords == other.coords;
+	}
+
+	struct Hash {
+		size_t operator()(const FaceShape &shape) const { return shape.hash; }
+	};
+
+private:
+	size_t hash;
+	std::vector<size_t> sizes;
+	std::vector<long long> coords;
+};
+
+/*!
+	Tessellations of the faces seen so far by their shape, with the triangles
+	as positions in the concatenated outlines of the face, so they can be
+	reused for a translated copy of it.
+*/
+class TessellationCache
+{
+public:
+	explicit TessellationCache(double quantum) : quantum(quantum) {}
+
+	// The grid for FaceShape, for the magnitude of the coordinates
+	static double quantumFor(const std::vector<Vector3f> &vertices) {
+		float maxabs = 0;
+		for (const auto &v : vertices) {
+			if (v.allFinite()) maxabs = std::max(maxabs, v.cwiseAbs().maxCoeff());
+		}
+		return maxabs > 0 ? std::ldexp(1.0, std::ilogb(maxabs) - tess_cache_grid_bits) : 1.0;
+	}
+
+	static bool cacheable(const std::vector<IndexedFace> &faces) {
+		return !faces.empty() && !faces[0].empty() && (faces.size() > 1 || faces[0].size() >= tess_cache_min_vertices);
+	}
+
+	FaceShape shape(const std::vector<Vector3f> &vertices, const std::vector<IndexedFace> &faces) const {
+		return FaceShape(vertices, faces, this->quantum);
+	}
+
+	/*!
+		Appends the cached triangles of the face. Returns false if there are
+		none, or if a triangle turns over in this copy of the shape, which
+		the rounding of the shape allows for slivers.
+	*/
+	bool lookup(const FaceShape &shape, const std::vector<Vector3f> &vertices, const std::vector<IndexedFace> &faces,
+							std::vector<IndexedTriangle> &triangles) const {
+		const auto it = this->shapes.find(shape);
+		if (it == this->shapes.end()) return false;
+		std::vector<int> indices;
+		for (const auto &face : faces) indices.insert(indices.end(), face.begin(), face.end());
+		const Vector3f normal = faceNormal(vertices, faces[0]);
+		const size_t begin = triangles.size();
+		for (const auto &t : it->second) {
+			const IndexedTriangle tri(indices[t[0]], indices[t[1]], indices[t[2]]);
+			const auto &a = vertices[tri[0]], &b = vertices[tri[1]], &c = vertices[tri[2]];
+			if (!((b - a).cross(c - a).dot(normal) > 0)) {
+				triangles.resize(begin);
+				return false;
+			}
+			triangles.push_back(tri);
+		}
+		return true;
+	}
+
+	void insert(FaceShape &&shape, const std::vector<IndexedFace> &faces, const std::vector<IndexedTriangle> &triangles) {
+		if (this->shapes.size() >= tess_cache_max_shapes) return;
+		// A vertex used more than once maps to its first position
+		std::unordered_map<int, int> positions;
+		int position = 0;
+		for (const auto &face : faces) {
+			for (auto idx : face) positions.emplace(idx, position++);
+		}
+		std::vector<IndexedTriangle> local;
+		local.reserve(triangles.size());
+		for (const auto &t : triangles) local.emplace_back(positions.at(t[0]), positions.at(t[1]), positions.at(t[2]));
+		this->shapes.emplace(std::move(shape), std::move(local));
+	}
+
+private:
+	double quantum;
+	std::unordered_map<FaceShape, std::vector<IndexedTriangle>, FaceShape::Hash> shapes;
+};
+
+/*!
+	Tessellates a list of polygons with holes, see tessellatePolygonWithHoles().
+	Polygons which fail to tessellate are skipped. The triangles are appended
+	in the order of the polygons, also when tessellating in parallel.
+
+	Polygons of the same shape as an earlier one of the same batch, up to
+	translation, reuse its tessellation (see TessellationCache).
+
+	If polygonof is given, it receives the index of the polygon each
+	appended triangle belongs to, e.g. to carry the face colors along.
+*/
+void GeometryUtils::tessellatePolygonsWithHoles(const std::vector<Vector3f> &vertices,
+																								const std::vector<std::vector<IndexedFace>> &polygons,
+																								std::vector<IndexedTriangle> &triangles,
+																								std::vector<size_t> *polygonof)
+{
+	const size_t min_parallel_polygons = 10000;
+	const auto pool = ThreadPool::instance();
+	const size_t numchunks = pool->isParallel() && polygons.size() >= min_parallel_polygons ? 4 * pool->numThreads() : 1;
+
+	const double quantum = TessellationCache::quantumFor(vertices);
+	std::vector<std::vector<IndexedTriangle>> chunks(numchunks);
+	std::vector<std::vector<size_t>> chunkpolygons(polygonof ? numchunks : 0);
+	TaskGroup group;
+	for (size_t c = 0; c < numchunks; ++c) {
+		group.run([&vertices, &polygons, &chunks, &chunkpolygons, numchunks, quantum, c]() {
+			auto &result = chunks[c];
+			const size_t begin = polygons.size() * c / numchunks, end = polygons.size() * (c + 1) / numchunks;
+			result.reserve(end - begin);
+			std::vector<IndexedTriangle> faceTriangles;
+			TessellationCache cache(quantum);
+			for (size_t i = begin; i < end; ++i) {
+				const auto &polygon = polygons[i];
+				if (!TessellationCache::cacheable(polygon)) {
+					faceTriangles.clear();
+					if (!tessellatePolygonWithHoles(vertices, polygon, faceTriangles, nullptr)) {
+						result.insert(result.end(), faceTriangles.begin(), faceTriangles.end());
+					}
+				}
+				else {
+					auto shape = cache.shape(vertices, polygon);
+					if (!cache.lookup(shape, vertices, polygon, result)) {
+						faceTriangles.clear();
+						if (!tessellatePolygonWithHoles(vertices, polygon, faceTriangles, nullptr)) {
+							result.insert(result.end(), faceTriangles.begin(), faceTriangles.end());
+							cache.insert(std::move(shape), polygon, faceTriangles);
+						}
+					}
+				}
+				if (!chunkpolygons.empty()) chunkpolygons[c].resize(result.size(), i);
+			}
+		});
+	}
+	group.wait();
+
+	size_t total = triangles.size();
+	for (const auto &chunk : chunks) total += chunk.size();
+	triangles.reserve(total);
+	for (const auto &chunk : chunks) triangles.insert(triangles.end(), chunk.begin(), chunk.end());
+	for (const auto &chunk : chunkpolygons) polygonof->insert(polygonof->end(), chunk.begin(), chunk.end());
+}
+
 /*!
 	Tessellates a single contour. Non-indexed version.
 	Appends resulting triangles to triangles.
@@ -444,35 +744,157 @@ bool GeometryUtils::tessellatePolygon(const Polygon &polygon, Polygons &triangle
 	return err;
 }
 
-int GeometryUtils::findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons)
+/*!
+	Andrew's monotone chain convex hull. Returns the hull vertices in
+	counter-clockwise order, starting with the lowest of the leftmost
+	points. Collinear points are left out.
+*/
+std::vector<Vector2d> GeometryUtils::convexHull2d(std::vector<Vector2d> points)
 {
-	EdgeDict edges;
-	for (const auto &faces : polygons) {
-		for (const auto &face : faces) {
-			edges.add(face);
-		}
+	std::sort(points.begin(), points.end(), [](const Vector2d &a, const Vector2d &b) {
+		return a[0] < b[0] || (a[0] == b[0] && a[1] < b[1]);
+	});
+	points.erase(std::unique(points.begin(), points.end()), points.end());
+	if (points.size() < 3) return points;
+
+	auto cross = [](const Vector2d &o, const Vector2d &a, const Vector2d &b) {
+		return (a[0] - o[0]) * (b[1] - o[1]) - (a[1] - o[1]) * (b[0] - o[0]);
+	};
+	std::vector<Vector2d> hull(2 * points.size());
+	size_t k = 0;
+	// Lower hull
+	for (size_t i = 0; i < points.size(); ++i) {
+		while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0) --k;
+		hull[k++] = points[i];
 	}
-#if 1 // for debugging
-	if (!edges.empty()) {
-		PRINTD("Unconnected:");
-		edges.print();
+	// Upper hull
+	for (size_t i = points.size() - 1, lower = k + 1; i > 0; --i) {
+		while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i - 1]) <= 0) --k;
+		hull[k++] = points[i - 1];
 	}
-#endif
-	return edges.size();
+	// The last point is the first one again
+	hull.resize(k - 1);
+	return hull;
 }
 
-int GeometryUtils::findUnconnectedEdges(const std::vector<IndexedTriangle> &triangles)
+namespace {
+	/*!
+		Collects the half-edges of a mesh and counts how its edges are used.
+		The half-edges are bucketed by their lower vertex index, by counting
+		sort, so each edge only needs to be found among the few others of
+		its vertex.
+	*/
+	class HalfEdgeCounter
+	{
+	public:
+		template <typename Iterator>
+		void addCycle(Iterator begin, Iterator end) {
+			if (begin == end) return;
+			for (Iterator it = begin; it != end; ++it) {
+				Iterator next = it + 1;
+				add(*it, next == end ? *begin : *next);
+			}
+		}
+
+		MeshTopology count() {
+			MeshTopology topology;
+			int maxvertex = -1;
+			for (const auto &e : this->halfedges) maxvertex = std::max(maxvertex, e.lower);
+			std::vector<size_t> offsets(maxvertex + 2, 0);
+			for (const auto &e : this->halfedges) offsets[e.lower + 1]++;
+			for (size_t v = 1; v < offsets.size(); ++v) offsets[v] += offsets[v - 1];
+			std::vector<HalfEdge> buckets(this->halfedges.size());
+			{
+				auto next = offsets;
+				for (const auto &e : this->halfedges) buckets[next[e.lower]++] = e;
+			}
+
+			// Union-find over the vertices of the edges, for the components
+			std::vector<int> parent(offsets.size() - 1);
+			std::vector<bool> used(parent.size(), false);
+			for (size_t v = 0; v < parent.size(); ++v) parent[v] = int(v);
+			auto root = [&parent](int v) {
+				while (parent[v] != v) v = parent[v] = parent[parent[v]];
+				return v;
+			};
+
+			// The upper vertex and the use counts of each edge of a vertex
+			std::vector<std::pair<int, std::pair<size_t, size_t>>> vertexedges;
+			for (size_t v = 0; v + 1 < offsets.size(); ++v) {
+				vertexedges.clear();
+				for (size_t k = offsets[v]; k < offsets[v + 1]; ++k) {
+					const auto &e = buckets[k];
+					auto it = std::find_if(vertexedges.begin(), vertexedges.end(),
+																 [&e](const std::pair<int, std::pair<size_t, size_t>> &edge) { return edge.first == e.upper; });
+					if (it == vertexedges.end()) {
+						vertexedges.emplace_back(e.upper, std::make_pair(size_t(0), size_t(0)));
+						it = vertexedges.end() - 1;
+					}
+					(e.forward ? it->second.first : it->second.second)++;
+				}
+				for (const auto &edge : vertexedges) {
+					const size_t forward = edge.second.first, backward = edge.second.second;
+					topology.edges++;
+					topology.unconnectededges += forward > backward ? forward - backward : backward - forward;
+					if (forward + backward > 2) topology.nonmanifoldedges++;
+					else if (forward + backward == 2 && forward != 1) topology.flippededges++;
+					parent[root(edge.first)] = root(int(v));
+					used[v] = true;
+					used[edge.first] = true;
+				}
+			}
+			for (size_t v = 0; v < parent.size(); ++v) {
+				if (used[v] && root(int(v)) == int(v)) topology.components++;
+			}
+			return topology;
+		}
+
+	private:
+		struct HalfEdge {
+			int lower, upper;
+			bool forward; // From lower to upper
+		};
+
+		void add(int from, int to) {
+			if (from == to) return;
+			this->halfedges.push_back(from < to ? HalfEdge{from, to, true} : HalfEdge{to, from, false});
+		}
+
+		std::vector<HalfEdge> halfedges;
+	};
+}
+
+MeshTopology GeometryUtils::analyzeTopology(const IndexedMesh &mesh)
 {
-	EdgeDict edges;
-	for (const auto &t : triangles) {
-		edges.add(t);
+	HalfEdgeCounter counter;
+	for (size_t i = 0; i < mesh.numFaces(); ++i) {
+		counter.addCycle(mesh.face(i), mesh.face(i) + mesh.faceSize(i));
 	}
-#if 1 // for debugging
-	if (!edges.empty()) {
-		PRINTD("Unconnected:");
-		edges.print();
+	return counter.count();
+}
+
+MeshTopology GeometryUtils::analyzeTopology(const std::vector<std::vector<IndexedFace>> &polygons)
+{
+	HalfEdgeCounter counter;
+	for (const auto &faces : polygons) {
+		for (const auto &face : faces) counter.addCycle(face.begin(), face.end());
 	}
-#endif
+	return counter.count();
+}
+
+MeshTopology GeometryUtils::analyzeTopology(const std::vector<IndexedTriangle> &triangles)
+{
+	HalfEdgeCounter counter;
+	for (const auto &t : triangles) counter.addCycle(t.data(), t.data() + 3);
+	return counter.count();
+}
+
+int GeometryUtils::findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons)
+{
+	return analyzeTopology(polygons).unconnectededges;
+}
 
-	return edges.size();
+int GeometryUtils::findUnconnectedEdges(const std::vector<IndexedTriangle> &triangles)
+{
+	return analyzeTopology(triangles).unconnectededges;
 }
@@ -25,6 +25,45 @@ struct IndexedPolyMesh {
 	std::vector<std::vector<IndexedFace>> polygons;
 };
 
+/*!
+	Indexed polygon mesh with a shared vertex array. The vertex indices of
+	all faces are stored back to back in one index buffer; face i uses
+	indices[faceoffsets[i]] up to indices[faceoffsets[i+1]].
+*/
+struct IndexedMesh {
+	IndexedMesh() : faceoffsets(1, 0) {}
+
+	std::vector<Vector3d> vertices;
+	std::vector<int> indices;
+	std::vector<size_t> faceoffsets;
+
+	size_t numFaces() const { return faceoffsets.size() - 1; }
+	size_t faceSize(size_t i) const { return faceoffsets[i + 1] - faceoffsets[i]; }
+	const int *face(size_t i) const { return indices.data() + faceoffsets[i]; }
+};
+
+/*!
+	How the faces of a mesh connect, from its half-edges. An edge with
+	faces on both sides is used once in each direction by them; the
+	half-edges left over after cancelling opposite pairs are unconnected.
+*/
+struct MeshTopology {
+	MeshTopology() : edges(0), unconnectededges(0), nonmanifoldedges(0), flippededges(0), components(0) {}
+
+	size_t edges; // Undirected, without degenerate ones
+	size_t unconnectededges; // Half-edges without an opposite one
+	size_t nonmanifoldedges; // Edges of more than two faces
+	size_t flippededges; // Edges of two faces which use them in the same direction
+	size_t components; // Sets of faces connected through shared vertices
+
+	// Every half-edge has an opposite one
+	bool isClosed() const { return this->unconnectededges == 0; }
+	// Closed, with two faces on each edge
+	bool isManifold() const { return isClosed() && this->nonmanifoldedges == 0; }
+	// Neighboring faces have the same orientation
+	bool isOriented() const { return this->flippededges == 0; }
+};
+
 namespace GeometryUtils {
 	bool tessellatePolygon(const Polygon &polygon,
 												 Polygons &triangles,
@@ -33,7 +72,18 @@ namespace GeometryUtils {
 																	const std::vector<IndexedFace> &faces, 
 																	std::vector<IndexedTriangle> &triangles,
 																	const Vector3f *normal = nullptr);
+	void tessellatePolygonsWithHoles(const std::vector<Vector3f> &vertices,
+																	 const std::vector<std::vector<IndexedFace>> &polygons,
+																	 std::vector<IndexedTriangle> &triangles,
+																	 std::vector<size_t> *polygonof = nullptr);
+
+	std::vector<Vector2d> convexHull2d(std::vector<Vector2d> points);
 
 	int findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons);
 	int findUnconnectedEdges(const std::vector<IndexedTriangle> &triangles);
+
+	// In one pass over the half-edges, bucketed by their lower vertex
+	MeshTopology analyzeTopology(const IndexedMesh &mesh);
+	MeshTopology analyzeTopology(const std::vector<std::vector<IndexedFace>> &polygons);
+	MeshTopology analyzeTopology(const std::vector<IndexedTriangle> &triangles);
 }
@@ -0,0 +1,41 @@
+#include "GlyphCache.h"
+
+#include <boost/format.hpp>
+
+GlyphCache *GlyphCache::inst = nullptr;
+
+size_t GlyphCache::Glyph::memsize() const
+{
+	size_t mem = sizeof(Glyph);
+	for (const auto &o : this->outlines) mem += sizeof(Outline2d) + o.vertices.size() * sizeof(Vector2d);
+	return mem;
+}
+
+/*!
+	The face is identified by what fontconfig resolved the font name to, so
+	different spellings of the same font share their glyphs.
+*/
+std::string GlyphCache::key(FT_Face face, unsigned int glyph_index, double size, double segments)
+{
+	return str(boost::format("%s\n%s\n%d/%d\n%d\n%.17g\n%.17g")
+						 % (face->family_name ? face->family_name : "")
+						 % (face->style_name ? face->style_name : "")
+						 % face->face_index % face->num_glyphs % glyph_index % size % segments);
+}
+
+std::shared_ptr<const GlyphCache::Glyph> GlyphCache::get(const std::string &key) const
+{
+	std::shared_ptr<const Glyph> glyph;
+	this->cache.get(key, glyph);
+	return glyph;
+}
+
+bool GlyphCache::insert(const std::string &key, const std::shared_ptr<const Glyph> &glyph)
+{
+	return this->cache.insert(key, glyph, glyph->memsize());
+}
+
+void GlyphCache::clear()
+{
+	this->cache.clear();
+}
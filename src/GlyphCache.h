@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "ShardedCache.h"
+#include "Polygon2d.h"
+
+/*!
+	Caches the flattened outlines of rendered glyphs, so a text which uses
+	the same glyph several times (or a label which is rendered again on the
+	next compile) decomposes its curves only once.
+
+	Entries are keyed by the font face, the glyph index, the size and the
+	number of curve segments (see FreetypeRenderer::render()). The outlines
+	are relative to the glyph origin; the layout only moves them.
+*/
+class GlyphCache
+{
+public:
+	struct Glyph {
+		Polygon2d::Outlines2d outlines;
+		FT_BBox cbox; // grid-fitted control box, in 26.6 font units
+		size_t memsize() const;
+	};
+
+	GlyphCache(size_t memorylimit = 20*1024*1024) : cache(memorylimit) {}
+
+	static GlyphCache *instance() { if (!inst) inst = new GlyphCache; return inst; }
+
+	static std::string key(FT_Face face, unsigned int glyph_index, double size, double segments);
+	std::shared_ptr<const Glyph> get(const std::string &key) const;
+	bool insert(const std::string &key, const std::shared_ptr<const Glyph> &glyph);
+	void clear();
+
+private:
+	static GlyphCache *inst;
+
+	mutable ShardedCache<std::string, std::shared_ptr<const Glyph>> cache;
+};
@@ -0,0 +1,63 @@
+#include "ImportCache.h"
+#include "StatCache.h"
+#include "printutils.h"
+
+ImportCache *ImportCache::inst = nullptr;
+
+namespace {
+	bool file_stamp(const std::string &filename, std::time_t &mtime, long long &size)
+	{
+		struct ::stat st;
+		if (StatCache::stat(filename, st) != 0) return false;
+		mtime = st.st_mtime;
+		size = st.st_size;
+		return true;
+	}
+}
+
+/*!
+	Returns the cached geometry for key, or nullptr if there is none or
+	filename changed since it was cached.
+*/
+shared_ptr<const Geometry> ImportCache::get(const std::string &key, const std::string &filename) const
+{
+	cache_entry entry;
+	if (!this->cache.get(key, entry)) return nullptr;
+	std::time_t mtime;
+	long long size;
+	if (!file_stamp(filename, mtime, size) || mtime != entry.mtime || size != entry.size) {
+		this->cache.remove(key);
+		return nullptr;
+	}
+	PRINTDB("Import Cache hit: %s", key);
+	return entry.geom;
+}
+
+bool ImportCache::insert(const std::string &key, const std::string &filename, const shared_ptr<const Geometry> &geom)
+{
+	cache_entry entry;
+	if (!geom || !file_stamp(filename, entry.mtime, entry.size)) return false;
+	entry.geom = geom;
+	return this->cache.insert(key, entry, geom->memsize());
+}
+
+size_t ImportCache::maxSizeMB() const
+{
+	return this->cache.maxCost()/(1024*1024);
+}
+
+void ImportCache::setMaxSizeMB(size_t limit)
+{
+	this->cache.setMaxCost(limit*1024*1024);
+}
+
+void ImportCache::clear()
+{
+	this->cache.clear();
+}
+
+void ImportCache::print()
+{
+	PRINTB("Imported files in cache: %d", this->cache.size());
+	PRINTB("Import cache size in bytes: %d", this->cache.totalCost());
+}
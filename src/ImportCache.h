@@ -0,0 +1,44 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include "ShardedCache.h"
+#include "memory.h"
+#include "Geometry.h"
+
+/*!
+	Caches the geometry parsed from imported files, so a file which is
+	imported several times (with different transformations, $fn or
+	convexity, or in consecutive compiles) is only parsed once.
+
+	Entries are keyed by the import type, the absolute file name and the
+	parameters which affect parsing (see ImportNode::createGeometry()). They
+	are validated against the file's modification time and size, using
+	StatCache, so changed files are parsed again.
+*/
+class ImportCache
+{
+public:
+	ImportCache(size_t memorylimit = 100*1024*1024) : cache(memorylimit) {}
+
+	static ImportCache *instance() { if (!inst) inst = new ImportCache; return inst; }
+
+	shared_ptr<const Geometry> get(const std::string &key, const std::string &filename) const;
+	bool insert(const std::string &key, const std::string &filename, const shared_ptr<const Geometry> &geom);
+	size_t maxSizeMB() const;
+	void setMaxSizeMB(size_t limit);
+	void clear();
+	void print();
+
+private:
+	static ImportCache *inst;
+
+	struct cache_entry {
+		shared_ptr<const Geometry> geom;
+		std::time_t mtime;
+		long long size;
+		cache_entry() : mtime(0), size(-1) {}
+	};
+
+	mutable ShardedCache<std::string, cache_entry> cache;
+};
@@ -0,0 +1,89 @@
+#include "InstancedPolySet.h"
+#include "polyset.h"
+#include <sstream>
+
+namespace {
+	// The exact bounding box of ps transformed by m
+	BoundingBox transformed_box(const PolySet &ps, const Transform3d &m)
+	{
+		BoundingBox box;
+		for (const auto &poly : ps.polygons()) {
+			for (const auto &v : poly) box.extend(m * v);
+		}
+		return box;
+	}
+}
+
+InstancedPolySet::InstancedPolySet(const shared_ptr<const PolySet> &ps, const Transform3d &transform)
+	: Geometry(KIND), ps(ps), trans{transform}, boxes{transformed_box(*ps, transform)}
+{
+	setConvexity(ps->getConvexity());
+}
+
+InstancedPolySet::InstancedPolySet(const shared_ptr<const PolySet> &ps, Transforms &&transforms, std::vector<BoundingBox> &&boxes)
+	: Geometry(KIND), ps(ps), trans(std::move(transforms)), boxes(std::move(boxes))
+{
+	setConvexity(ps->getConvexity());
+}
+
+size_t InstancedPolySet::memsize() const
+{
+	// The PolySet is shared, so it's accounted for where it's cached
+	return sizeof(*this) + this->trans.size() * (sizeof(Transform3d) + sizeof(BoundingBox));
+}
+
+BoundingBox InstancedPolySet::getBoundingBox() const
+{
+	BoundingBox box;
+	for (const auto &b : this->boxes) box.extend(b);
+	return box;
+}
+
+std::string InstancedPolySet::dump() const
+{
+	std::ostringstream out;
+	out << "InstancedPolySet:"
+			<< "\n instances: " << this->trans.size()
+			<< "\n " << this->ps->dump();
+	return out.str();
+}
+
+bool InstancedPolySet::isEmpty() const
+{
+	return this->trans.empty() || this->ps->isEmpty();
+}
+
+shared_ptr<const InstancedPolySet> InstancedPolySet::transformed(const Transform3d &m) const
+{
+	Transforms transforms;
+	transforms.reserve(this->trans.size());
+	std::vector<BoundingBox> boxes;
+	boxes.reserve(this->trans.size());
+	for (const auto &t : this->trans) {
+		transforms.push_back(m * t);
+		boxes.push_back(transformed_box(*this->ps, transforms.back()));
+	}
+	return make_shared<const InstancedPolySet>(this->ps, std::move(transforms), std::move(boxes));
+}
+
+shared_ptr<const InstancedPolySet> InstancedPolySet::withPolySet(const shared_ptr<const PolySet> &ps) const
+{
+	return make_shared<const InstancedPolySet>(ps, Transforms(this->trans), std::vector<BoundingBox>(this->boxes));
+}
+
+PolySet *InstancedPolySet::flatten() const
+{
+	auto result = new PolySet(3, this->trans.size() == 1 ? this->ps->convexValue() : unknown);
+	result->setConvexity(getConvexity());
+	result->reserve(this->trans.size() * this->ps->numPolygons());
+	for (const auto &t : this->trans) result->append(*this->ps, t);
+	return result;
+}
+
+shared_ptr<const Geometry> InstancedPolySet::flattened(const shared_ptr<const Geometry> &geom)
+{
+	if (auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+		return shared_ptr<const Geometry>(instances->flatten());
+	}
+	return geom;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vector>
+#include "Geometry.h"
+#include "linalg.h"
+#include "memory.h"
+
+class PolySet;
+
+/*!
+	Copies of one 3D PolySet, each with its own transformation.
+
+	GeometryEvaluator produces these when transforming a PolySet which is
+	shared with others (e.g. cached), instead of transforming a copy. Unions
+	of instances of the same PolySet which don't touch are instances again,
+	so e.g. a pattern of identical, separate parts keeps a single mesh.
+
+	Anything which needs the actual polygons (booleans, export, ...) uses
+	flatten(); the CSG preview draws the shared PolySet once per instance.
+*/
+class InstancedPolySet : public Geometry
+{
+public:
+	typedef std::vector<Transform3d, Eigen::aligned_allocator<Transform3d>> Transforms;
+	static const Kind KIND = Kind::INSTANCED_POLYSET;
+
+	InstancedPolySet(const shared_ptr<const PolySet> &ps, const Transform3d &transform);
+	// The boxes are those of the transformed instances, see instanceBox()
+	InstancedPolySet(const shared_ptr<const PolySet> &ps, Transforms &&transforms, std::vector<BoundingBox> &&boxes);
+	~InstancedPolySet() {}
+
+	size_t memsize() const override;
+	BoundingBox getBoundingBox() const override;
+	std::string dump() const override;
+	unsigned int getDimension() const override { return 3; }
+	bool isEmpty() const override;
+	Geometry *copy() const override { return new InstancedPolySet(*this); }
+
+	const shared_ptr<const PolySet> &polySet() const { return this->ps; }
+	const Transforms &transforms() const { return this->trans; }
+	size_t numInstances() const { return this->trans.size(); }
+	const BoundingBox &instanceBox(size_t i) const { return this->boxes[i]; }
+
+	// The instances transformed by m
+	shared_ptr<const InstancedPolySet> transformed(const Transform3d &m) const;
+	// The same instances of another PolySet, e.g. a tessellated one
+	shared_ptr<const InstancedPolySet> withPolySet(const shared_ptr<const PolySet> &ps) const;
+	PolySet *flatten() const;
+
+	// The geometry itself, or its flattened PolySet if it is instanced
+	static shared_ptr<const Geometry> flattened(const shared_ptr<const Geometry> &geom);
+
+private:
+	shared_ptr<const PolySet> ps;
+	Transforms trans;
+	std::vector<BoundingBox> boxes;
+};
@@ -0,0 +1,132 @@
+#include "InterpreterProfile.h"
+#include "AST.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <boost/format.hpp>
+
+InterpreterProfile *InterpreterProfile::inst = nullptr;
+bool InterpreterProfile::enabled = false;
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	struct Frame {
+		Clock::time_point start;
+		double children; // Time spent in nested frames of the same stack
+	};
+
+	// Callee and call site frames of the calls active on this thread
+	thread_local std::vector<Frame> calleeframes, siteframes;
+	// How often each callee or call site is active on this thread
+	thread_local std::unordered_map<const void *, std::unordered_map<int, int>> activecounts;
+
+	std::string locationString(const std::string &file, int line)
+	{
+		if (file.empty()) return "";
+		return (boost::format("%s:%d") % boost::filesystem::path(file).filename().generic_string() % line).str();
+	}
+}
+
+/*!
+	Doesn't measure anything unless the profile is enabled.
+*/
+InterpreterProfile::Scope::Scope(Kind kind, const ASTNode &callee, const std::string &name, const Location &callsite)
+	: active(InterpreterProfile::enabled), kind(kind), callee(&callee), name(&name), callsite(&callsite)
+{
+	if (!this->active) return;
+	this->site = callsite.isNone() ? Key{&callsite, -1} : Key{&callsite.filePath(), callsite.firstLine()};
+	activecounts[this->callee][0]++;
+	activecounts[this->site.ptr][this->site.line]++;
+	const auto now = Clock::now();
+	calleeframes.push_back(Frame{now, 0});
+	siteframes.push_back(Frame{now, 0});
+}
+
+InterpreterProfile::Scope::~Scope()
+{
+	if (!this->active) return;
+	const double elapsed = std::chrono::duration<double>(Clock::now() - calleeframes.back().start).count();
+	const double calleeexclusive = elapsed - calleeframes.back().children;
+	const double siteexclusive = elapsed - siteframes.back().children;
+	calleeframes.pop_back();
+	siteframes.pop_back();
+	if (!calleeframes.empty()) calleeframes.back().children += elapsed;
+	if (!siteframes.empty()) siteframes.back().children += elapsed;
+	// Only the outermost of recursive calls counts for the inclusive time
+	const bool calleeoutermost = --activecounts[this->callee][0] == 0;
+	const bool siteoutermost = --activecounts[this->site.ptr][this->site.line] == 0;
+
+	auto profile = InterpreterProfile::instance();
+	std::lock_guard<std::mutex> lock(profile->mutex);
+	auto &calleestats = profile->callees[Key{this->callee, 0}];
+	if (calleestats.calls++ == 0) {
+		const auto &loc = this->callee->location();
+		calleestats.kind = this->kind;
+		calleestats.name = *this->name;
+		if (!loc.isNone()) {
+			calleestats.file = loc.fileName();
+			calleestats.line = loc.firstLine();
+		}
+	}
+	if (calleeoutermost) calleestats.inclusive += elapsed;
+	calleestats.exclusive += calleeexclusive;
+
+	auto &sitestats = profile->callsites[this->site];
+	if (sitestats.calls++ == 0) {
+		const auto &loc = *this->callsite;
+		sitestats.kind = this->kind;
+		sitestats.name = *this->name;
+		if (!loc.isNone()) {
+			sitestats.file = loc.fileName();
+			sitestats.line = loc.firstLine();
+		}
+	}
+	if (siteoutermost) sitestats.inclusive += elapsed;
+	sitestats.exclusive += siteexclusive;
+}
+
+void InterpreterProfile::setEnabled(bool enable)
+{
+	// Created now, since calls are recorded from several threads
+	if (enable) instance();
+	enabled = enable;
+}
+
+void InterpreterProfile::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->callees.clear();
+	this->callsites.clear();
+}
+
+/*!
+	Writes up to limit functions and modules, and up to limit call sites,
+	sorted by their exclusive time.
+*/
+void InterpreterProfile::report(std::ostream &stream, size_t limit) const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto write = [&stream, limit](const StatsMap &map, const char *title, bool callsites) {
+		std::vector<const Stats *> sorted;
+		sorted.reserve(map.size());
+		for (const auto &entry : map) sorted.push_back(&entry.second);
+		std::sort(sorted.begin(), sorted.end(), [](const Stats *a, const Stats *b) {
+			return a->exclusive > b->exclusive || (a->exclusive == b->exclusive && a->inclusive > b->inclusive);
+		});
+		if (sorted.size() > limit) sorted.resize(limit);
+
+		stream << title << ":\n";
+		stream << boost::format("%12s %12s %12s  %s\n") % "calls" % "inclusive s" % "exclusive s" % (callsites ? "call site" : "function/module");
+		for (const auto stats : sorted) {
+			const auto loc = locationString(stats->file, stats->line);
+			const auto what = std::string(stats->kind == Kind::MODULE ? "module " : "function ") + stats->name;
+			stream << boost::format("%12d %12.3f %12.3f  %s\n") % stats->calls % stats->inclusive % stats->exclusive %
+				(callsites ? (loc.empty() ? what : loc + " (" + what + ")") : (loc.empty() ? what : what + " (" + loc + ")"));
+		}
+	};
+	write(this->callees, "Functions and modules", false);
+	stream << "\n";
+	write(this->callsites, "Call sites", true);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+class ASTNode;
+class Location;
+
+/*!
+	Counts the calls of user functions and modules and the time spent in
+	them, both per function or module and per source line calling them.
+
+	The inclusive time of a function is the time until its outermost
+	active call returns, so recursion isn't counted more than once. The
+	exclusive time doesn't include the time spent in the functions and
+	modules it calls. Call sites are measured the same way, separately.
+
+	Recording is disabled until setEnabled(true) is called, which should
+	happen before any evaluation. Calls can be recorded from several
+	threads; the time spent on other threads isn't subtracted from the
+	exclusive time of the calling function.
+*/
+class InterpreterProfile
+{
+public:
+	enum class Kind { FUNCTION, MODULE };
+
+private:
+	struct Key {
+		const void *ptr; // The callee, or the path of the call site's file
+		int line;        // 0 for callees
+		bool operator==(const Key &other) const { return ptr == other.ptr && line == other.line; }
+	};
+
+public:
+	/*!
+		Measures one call of a function or module, and the call site it was
+		called from, from construction to destruction.
+	*/
+	class Scope
+	{
+	public:
+		Scope(Kind kind, const ASTNode &callee, const std::string &name, const Location &callsite);
+		~Scope();
+	private:
+		bool active;
+		Kind kind;
+		const ASTNode *callee;
+		const std::string *name;
+		const Location *callsite;
+		Key site;
+	};
+
+	static InterpreterProfile *instance() { if (!inst) inst = new InterpreterProfile; return inst; }
+
+	static bool isEnabled() { return enabled; }
+	static void setEnabled(bool enable);
+
+	void clear();
+	// Writes the functions and modules, then the call sites, most expensive first
+	void report(std::ostream &stream, size_t limit = 50) const;
+
+private:
+	struct KeyHash {
+		size_t operator()(const Key &key) const { return std::hash<const void *>()(key.ptr) ^ (size_t(key.line) * 0x9e3779b9U); }
+	};
+	struct Stats {
+		Kind kind = Kind::FUNCTION;
+		std::string name; // The callee, or the first callee seen at the call site
+		std::string file;
+		int line = 0;
+		unsigned long calls = 0;
+		double inclusive = 0; // In seconds
+		double exclusive = 0;
+	};
+	typedef std::unordered_map<Key, Stats, KeyHash> StatsMap;
+
+	static InterpreterProfile *inst;
+	static bool enabled;
+
+	StatsMap callees, callsites;
+	// Guards callees and callsites
+	mutable std::mutex mutex;
+};
@@ -0,0 +1,106 @@
+#include "JobLimits.h"
+#include "PlatformUtils.h"
+#include "RenderProfile.h"
+#include "printutils.h"
+
+#include <sstream>
+
+JobLimits::Limits JobLimits::defaults;
+thread_local JobLimits *JobLimits::current = nullptr;
+
+namespace {
+	// Reading the resident memory takes a system call or a file
+	const double memory_check_interval = 0.01;
+
+	double seconds() { return RenderProfile::now() / 1e6; }
+}
+
+const char *JobLimits::name(Resource resource)
+{
+	switch (resource) {
+	case Resource::WALL_TIME: return "wall-time";
+	case Resource::CPU_TIME: return "cpu-time";
+	case Resource::MEMORY: return "memory";
+	case Resource::NODES: return "nodes";
+	case Resource::CSG_SIZE: return "csg-size";
+	case Resource::RECURSION_DEPTH: return "recursion-depth";
+	}
+	return "";
+}
+
+shared_ptr<JobLimits> JobLimits::start()
+{
+	if (!defaults.any()) return nullptr;
+	return make_shared<JobLimits>(defaults);
+}
+
+JobLimits::Scope::Scope(const shared_ptr<JobLimits> &job) : job(job), previous(current)
+{
+	if (!job) return;
+	job->wallstart = seconds();
+	job->cpustart = PlatformUtils::threadCPUTime();
+	current = job.get();
+}
+
+JobLimits::Scope::~Scope()
+{
+	if (!this->job) return;
+	this->job->wallused += seconds() - this->job->wallstart;
+	this->job->cpuused += PlatformUtils::threadCPUTime() - this->job->cpustart;
+	current = this->previous;
+}
+
+void JobLimits::enter()
+{
+	this->depth++;
+	if (this->limits.recursionDepth && this->depth > this->limits.recursionDepth) {
+		const auto depth = this->depth--;
+		exceeded(Resource::RECURSION_DEPTH, depth, this->limits.recursionDepth);
+	}
+	checkpoint();
+}
+
+void JobLimits::checkResources()
+{
+	const double now = seconds();
+	const double wall = this->wallused + now - this->wallstart;
+	if (this->limits.wallTime > 0 && wall > this->limits.wallTime) {
+		exceeded(Resource::WALL_TIME, wall, this->limits.wallTime);
+	}
+	if (this->limits.cpuTime > 0) {
+		const double cpu = this->cpuused + PlatformUtils::threadCPUTime() - this->cpustart;
+		if (cpu > this->limits.cpuTime) exceeded(Resource::CPU_TIME, cpu, this->limits.cpuTime);
+	}
+	if (this->limits.memory && now - this->lastmemorycheck >= memory_check_interval) {
+		this->lastmemorycheck = now;
+		const auto memory = PlatformUtils::residentMemory();
+		if (memory > this->limits.memory) exceeded(Resource::MEMORY, double(memory), double(this->limits.memory));
+	}
+}
+
+void JobLimits::exceeded(Resource resource, double used, double limit)
+{
+	ResourceLimitException e(resource, used, limit);
+	PRINTB("ERROR: %s", e.message());
+	throw e;
+}
+
+std::string ResourceLimitException::message() const
+{
+	std::ostringstream message;
+	message << "Job exceeded its " << JobLimits::name(this->resource) << " limit: ";
+	switch (this->resource) {
+	case JobLimits::Resource::WALL_TIME:
+	case JobLimits::Resource::CPU_TIME:
+		message << this->used << " s of at most " << this->limit << " s";
+		break;
+	case JobLimits::Resource::MEMORY:
+		message << PlatformUtils::toMemorySizeString(uint64_t(this->used), 3) << " of at most " <<
+			PlatformUtils::toMemorySizeString(uint64_t(this->limit), 3);
+		break;
+	default:
+		message << uint64_t(this->used) << " of at most " << uint64_t(this->limit);
+		break;
+	}
+	return message.str();
+}
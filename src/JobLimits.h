@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "memory.h"
+#include "progress.h"
+
+/*!
+	Limits on the resources a job may use, e.g. a batch job or a server
+	request, so runaway models fail instead of pinning cores for hours.
+
+	The limits are enforced cooperatively, on the threads the job runs on
+	(see Scope): node constructors and the interpreter's recursion checks
+	call checkpoint(), geometry evaluation calls check() from
+	progress_update() and progress_tick(), and the CSG normalizer checks the
+	size of its tree. A job over a limit prints an error and throws
+	ResourceLimitException, which unwinds like a cancel.
+
+	Wall and CPU time are counted while the job is current on a thread.
+	Memory is the resident memory of the whole process.
+*/
+class JobLimits
+{
+public:
+	enum class Resource { WALL_TIME, CPU_TIME, MEMORY, NODES, CSG_SIZE, RECURSION_DEPTH };
+	// The name of its command line option without "max-", e.g. "wall-time"
+	static const char *name(Resource resource);
+
+	// 0 is no limit
+	struct Limits {
+		double wallTime = 0; // seconds
+		double cpuTime = 0; // seconds
+		uint64_t memory = 0; // bytes
+		size_t nodes = 0;
+		size_t csgSize = 0; // elements of a normalized CSG tree
+		size_t recursionDepth = 0; // nested calls of user modules and functions
+		bool any() const { return wallTime > 0 || cpuTime > 0 || memory || nodes || csgSize || recursionDepth; }
+	};
+
+	// The limits of the jobs started afterwards
+	static Limits defaults;
+
+	// A job with the default limits, or nullptr if there are none
+	static shared_ptr<JobLimits> start();
+
+	explicit JobLimits(const Limits &limits)
+		: limits(limits), wallused(0), cpuused(0), wallstart(0), cpustart(0), lastmemorycheck(0), nodes(0), depth(0), ticks(0) {}
+
+	// Makes job, which may be nullptr, the current one on this thread while in scope
+	class Scope
+	{
+	public:
+		Scope(const shared_ptr<JobLimits> &job);
+		~Scope();
+	private:
+		shared_ptr<JobLimits> job;
+		JobLimits *previous;
+	};
+
+	// A nested call of a user module or function, while in scope
+	class Call
+	{
+	public:
+		Call() : job(current) { if (job) job->enter(); }
+		~Call() { if (job) job->depth--; }
+	private:
+		JobLimits *job;
+	};
+
+	// Checks the time and memory of the current job
+	static void check() { if (current) current->checkResources(); }
+	// Cheap enough for hot paths: checks every so many calls
+	static void checkpoint() { if (current && ++current->ticks % checkpoint_interval == 0) current->checkResources(); }
+	// Counts a node of the current job
+	static void countNode() {
+		if (!current) return;
+		if (++current->nodes > current->limits.nodes && current->limits.nodes) current->exceeded(Resource::NODES, current->nodes, current->limits.nodes);
+		checkpoint();
+	}
+	static void checkCSGSize(size_t size) {
+		if (current && current->limits.csgSize && size > current->limits.csgSize) current->exceeded(Resource::CSG_SIZE, size, current->limits.csgSize);
+	}
+
+private:
+	static const unsigned checkpoint_interval = 1024;
+	static thread_local JobLimits *current;
+
+	void enter();
+	void checkResources();
+	[[noreturn]] void exceeded(Resource resource, double used, double limit);
+
+	Limits limits;
+	// Times of the scopes left, and when the current one was entered
+	double wallused, cpuused, wallstart, cpustart;
+	double lastmemorycheck;
+	size_t nodes;
+	size_t depth;
+	unsigned ticks;
+};
+
+class ResourceLimitException : public ProgressCancelException
+{
+public:
+	ResourceLimitException(JobLimits::Resource resource, double used, double limit)
+		: resource(resource), used(used), limit(limit) {}
+
+	std::string message() const;
+
+	JobLimits::Resource resource;
+	double used, limit;
+};
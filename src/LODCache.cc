@@ -0,0 +1,46 @@
+#include "LODCache.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+
+#include <algorithm>
+
+LODCache *LODCache::inst = nullptr;
+bool LODCache::active = false;
+
+namespace {
+	// PolySets with fewer polygons are always drawn as they are
+	const size_t min_polygons = 4096;
+	// Larger ones are decimated to this fraction of their triangles
+	const size_t reduction = 8;
+
+	// Entries of released PolySets are deleted after this many new entries
+	const unsigned int prune_interval = 64;
+}
+
+/*!
+	Returns the coarse version of ps if it's active and ps is large enough
+	to have one, or else ps itself.
+*/
+shared_ptr<const PolySet> LODCache::lookup(const shared_ptr<const PolySet> &ps)
+{
+	if (!active || ps->getDimension() != 3 || ps->numPolygons() < min_polygons) return ps;
+
+	auto &entry = this->entries[ps.get()];
+	if (entry.ps.lock() != ps) {
+		auto lod = PolysetUtils::decimate(*ps, std::max(min_polygons, ps->numPolygons() / reduction));
+		entry.ps = ps;
+		entry.lod.reset();
+		if (lod->numPolygons() < ps->numPolygons()) entry.lod.reset(lod);
+		else delete lod;
+		if (++this->misses % prune_interval == 0) pruneExpired();
+	}
+	return entry.lod ? entry.lod : ps;
+}
+
+void LODCache::pruneExpired()
+{
+	for (auto it = this->entries.begin(); it != this->entries.end();) {
+		if (it->second.ps.expired()) it = this->entries.erase(it);
+		else ++it;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "memory.h"
+
+#include <unordered_map>
+
+class PolySet;
+
+/*!
+	Coarse versions of large PolySets, drawn instead of them while the view
+	is being dragged. Each is decimated on first use and kept for as long
+	as its PolySet lives; like in the VBOCache, the PolySets are only held
+	weakly and released ones are pruned from time to time.
+*/
+class LODCache
+{
+public:
+	static LODCache *instance() { if (!inst) inst = new LODCache; return inst; }
+
+	// While active, lookup() returns the coarse versions
+	static bool isActive() { return active; }
+	static void setActive(bool enabled) { active = enabled; }
+
+	shared_ptr<const PolySet> lookup(const shared_ptr<const PolySet> &ps);
+	void clear() { this->entries.clear(); }
+
+private:
+	LODCache() : misses(0) {}
+
+	struct Entry {
+		std::weak_ptr<const PolySet> ps;
+		shared_ptr<const PolySet> lod; // nullptr if decimating didn't help
+	};
+
+	void pruneExpired();
+
+	static LODCache *inst;
+	static bool active;
+
+	std::unordered_map<const PolySet *, Entry> entries;
+	unsigned int misses;
+};
@@ -10,6 +10,7 @@
 #include "module.h"
 #include "ModuleInstantiation.h"
 #include "Tree.h"
+#include "NodeReuseCache.h"
 #include "memory.h"
 #include "editor.h"
 #include "export.h"
@@ -38,25 +39,33 @@ public:
 
 	QTimer *autoReloadTimer;
 	QTimer *waitAfterReloadTimer;
+	QTimer *previewRestartTimer;
 	QTime renderingTime;
 	EditorInterface *customizerEditor;
 
 	BuiltinContext top_ctx;
 	FileModule *root_module;      // Result of parsing
-	FileModule *parsed_module;		// Last parse for include list
+	FileModule *parsed_module;		// Last parse for include list, owned by nodeReuseCache
 	ModuleInstantiation root_inst;	// Top level instance
 	AbstractNode *absolute_root_node; // Result of tree evaluation
 	AbstractNode *root_node;		  // Root if the root modifier (!) is used
 	Tree tree;
+	NodeReuseCache nodeReuseCache; // Unchanged top-level subtrees from the last compile
 	EditorInterface *activeEditor;
 	TabManager *tabManager;
 
 #ifdef ENABLE_CGAL
 	shared_ptr<const class Geometry> root_geom;
 	class CGALRenderer *cgalRenderer;
+	bool approximateRender; // Render with the voxel CSG backend, see actionRenderApproximate()
+	std::string exactBackend; // The CSG backend to restore after an approximate render
+	EditorInterface *renderingEditor = nullptr; // The tab the running render was started from
+	std::unordered_map<EditorInterface *, shared_ptr<const class Geometry>> tabGeometry; // The last render of each tab
+	std::unordered_map<EditorInterface *, std::string> snapshotKeys; // Of the snapshots shown but not previewed yet
 #endif
 #ifdef ENABLE_OPENCSG
 	class OpenCSGRenderer *opencsgRenderer;
+	class RayMarchRenderer *rayMarchRenderer;
 #endif
 	class ThrownTogetherRenderer *thrownTogetherRenderer;
 
@@ -92,7 +101,6 @@ private slots:
 	void setColorScheme(const QString &cs);
 	void showProgress();
 	void openCSGSettingsChanged();
-	void consoleOutput(const QString &msg);
 
 public:
 	static void consoleOutput(const std::string &msg, void *userdata);
@@ -104,12 +112,22 @@ public:
 
 private:
 	void initActionIcon(QAction *action, const char *darkResource, const char *lightResource);
+#ifdef ENABLE_CGAL
+	void startRender(bool approximate);
+	void startSpeculativeRender();
+	void showTabRender(bool showView);
+	void saveSnapshot(EditorInterface *editor);
+	void checkSnapshot();
+#endif
 	void handleFileDrop(const QString &filename);
-	void updateCamera(const class FileContext &ctx);
+	void updateCamera();
 	void updateTemporalVariables();
 	void updateCompileResult();
 	void compile(bool reload, bool forcedone = false, bool rebuildParameterWidget=true);
 	void compileCSG();
+	void createPreviewRenderers();
+	void startPreview();
+	void instantiateTree();
 	bool checkEditorModified();
 	QString dumpCSGTree(AbstractNode *root);
 
@@ -145,6 +163,8 @@ private slots:
 
 	void instantiateRoot();
 	void compileDone(bool didchange);
+	void previewDone();
+	void cancelStalePreview();
 	void compileEnded();
 	void changeParameterWidget();
 
@@ -189,6 +209,7 @@ private slots:
 	void sendToPrintService();
 #ifdef ENABLE_CGAL
 	void actionRender();
+	void actionRenderApproximate();
 	void actionRenderDone(shared_ptr<const class Geometry>);
 	void cgalRender();
 #endif
@@ -227,6 +248,9 @@ public:
 
 	void changedTopLevelConsole(bool);
 	void changedTopLevelEditor(bool);
+	void activeTabChanged();
+	void tabClosed(EditorInterface *editor);
+	void loadSnapshot(EditorInterface *editor);
 
 	QList<double> getTranslation() const;
 	QList<double> getRotation() const;
@@ -270,6 +294,7 @@ public slots:
 	void viewAll();
 	void animateUpdateDocChanged();
 	void animateUpdate();
+	void jumpToPicked(const QString &label);
 	void dragEnterEvent(QDragEnterEvent *event) override;
 	void dropEvent(QDropEvent *event) override;
 	void helpAbout();
@@ -285,7 +310,8 @@ public slots:
 
 private:
 	bool network_progress_func(const double permille);
-	static void report_func(const class AbstractNode*, void *vp, int mark);
+	static void report_func(const class AbstractNode*, void *vp, double mark);
+	static void cancel_func(void *vp);
 	static bool undockMode;
 	static bool reorderMode;
 	static const int tabStopWidth;
@@ -296,12 +322,19 @@ private:
  	shared_ptr<class CSGProducts> root_products;
 	shared_ptr<CSGProducts> highlights_products;
 	shared_ptr<CSGProducts> background_products;
+	shared_ptr<const struct RayMarchScene> rayMarchScene; // With the "advanced/rayMarchPreview" preference
+	shared_ptr<CSGProducts> rayMarchMeshProducts; // The terms of csgRoot which aren't ray marched
 
 	char const * afterCompileSlot;
 	bool procevents;
 	class QTemporaryFile *tempFile;
 	class ProgressWidget *progresswidget;
 	class CGALWorker *cgalworker;
+	class PreviewWorker *previewworker;
+	bool previewRestart; // Compile the preview again once the running one is cancelled
+	bool previewAborted; // The running preview stopped on a hard warning
+	bool previewRequested; // A preview was asked for while the GUI was locked
+	std::vector<ValuePtr> viewportValues; // $vpr, $vpt and $vpd after the last instantiation
 	QMutex consolemutex;
 	EditorInterface *renderedEditor; // stores pointer to editor which has been most recently rendered
 	time_t includes_mtime;   // latest include mod time
@@ -0,0 +1,150 @@
+#include "Metrics.h"
+#include "Arena.h"
+#include "GeometryCache.h"
+#include "ModuleCache.h"
+#include "PlatformUtils.h"
+#ifdef ENABLE_CGAL
+#include "CGALCache.h"
+#endif
+
+#include <algorithm>
+#include <sstream>
+#include <boost/format.hpp>
+
+Metrics *Metrics::inst = nullptr;
+bool Metrics::enabled = false;
+
+namespace {
+	struct CacheLookups {
+		const char *name;
+		size_t hits, misses;
+		double ratio() const { return hits + misses ? double(hits) / (hits + misses) : 0; }
+	};
+
+	std::vector<CacheLookups> cacheLookups()
+	{
+		std::vector<CacheLookups> caches;
+		caches.push_back({"geometry", GeometryCache::instance()->hits(), GeometryCache::instance()->misses()});
+#ifdef ENABLE_CGAL
+		caches.push_back({"cgal", CGALCache::instance()->hits(), CGALCache::instance()->misses()});
+#endif
+		caches.push_back({"module", ModuleCache::instance()->hits(), ModuleCache::instance()->misses()});
+		return caches;
+	}
+}
+
+void Metrics::PhaseTimer::stop()
+{
+	if (!this->phase) return;
+	const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - this->start).count();
+	Metrics::instance()->addPhase(this->phase, ms);
+	this->phase = nullptr;
+}
+
+void Metrics::add(values &values, const std::string &name, double value)
+{
+	auto it = std::find_if(values.begin(), values.end(),
+												 [&name](const std::pair<std::string, double> &p) { return p.first == name; });
+	if (it == values.end()) values.emplace_back(name, value);
+	else it->second += value;
+}
+
+void Metrics::addPhase(const std::string &phase, double ms)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	add(this->phasetimes, phase, ms);
+}
+
+void Metrics::count(const std::string &counter, double n)
+{
+	if (!enabled) return;
+	std::lock_guard<std::mutex> lock(this->mutex);
+	add(this->countervalues, counter, n);
+}
+
+std::vector<std::pair<std::string, double>> Metrics::phases() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->phasetimes;
+}
+
+std::vector<std::pair<std::string, double>> Metrics::counters() const
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->countervalues;
+}
+
+void Metrics::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->phasetimes.clear();
+	this->countervalues.clear();
+}
+
+std::string Metrics::summaryJSON(double total, int status) const
+{
+	std::ostringstream json;
+	json << "{\"phases\":{";
+	const auto phasetimes = phases();
+	for (size_t i = 0; i < phasetimes.size(); ++i) {
+		json << (i ? "," : "") << boost::format("\"%s\":%.3f") % phasetimes[i].first % phasetimes[i].second;
+	}
+	json << boost::format("},\"total\":%.3f,\"status\":%d") % total % status;
+
+	json << ",\"caches\":{";
+	const auto caches = cacheLookups();
+	for (size_t i = 0; i < caches.size(); ++i) {
+		json << (i ? "," : "") << boost::format("\"%s\":{\"hits\":%d,\"misses\":%d,\"hit_ratio\":%.4f}") %
+			caches[i].name % caches[i].hits % caches[i].misses % caches[i].ratio();
+	}
+	json << "},\"arenas\":{";
+	const auto arenas = Arena::allStats();
+	for (size_t i = 0; i < arenas.size(); ++i) {
+		json << (i ? "," : "") << boost::format("\"%s\":{\"allocations\":%d,\"bytes\":%d,\"live\":%d,\"peak\":%d,\"reserved\":%d}") %
+			arenas[i].name % arenas[i].allocations % arenas[i].bytes % arenas[i].live % arenas[i].peak % arenas[i].reserved;
+	}
+	json << "},\"peak_memory\":" << PlatformUtils::peakMemory();
+	for (const auto &counter : counters()) {
+		json << boost::format(",\"%s\":%.15g") % counter.first % counter.second;
+	}
+	json << "}";
+	return json.str();
+}
+
+std::string Metrics::prometheus() const
+{
+	std::ostringstream text;
+	text << "# TYPE openscad_phase_seconds_total counter\n";
+	for (const auto &phase : phases()) {
+		text << boost::format("openscad_phase_seconds_total{phase=\"%s\"} %.6f\n") % phase.first % (phase.second / 1000);
+	}
+	const auto caches = cacheLookups();
+	text << "# TYPE openscad_cache_hits_total counter\n";
+	for (const auto &cache : caches) {
+		text << boost::format("openscad_cache_hits_total{cache=\"%s\"} %d\n") % cache.name % cache.hits;
+	}
+	text << "# TYPE openscad_cache_misses_total counter\n";
+	for (const auto &cache : caches) {
+		text << boost::format("openscad_cache_misses_total{cache=\"%s\"} %d\n") % cache.name % cache.misses;
+	}
+	const auto arenas = Arena::allStats();
+	text << "# TYPE openscad_arena_allocations_total counter\n";
+	for (const auto &arena : arenas) {
+		text << boost::format("openscad_arena_allocations_total{arena=\"%s\"} %d\n") % arena.name % arena.allocations;
+	}
+	text << "# TYPE openscad_arena_live_bytes gauge\n";
+	for (const auto &arena : arenas) {
+		text << boost::format("openscad_arena_live_bytes{arena=\"%s\"} %d\n") % arena.name % arena.live;
+	}
+	text << "# TYPE openscad_arena_reserved_bytes gauge\n";
+	for (const auto &arena : arenas) {
+		text << boost::format("openscad_arena_reserved_bytes{arena=\"%s\"} %d\n") % arena.name % arena.reserved;
+	}
+	text << "# TYPE openscad_peak_memory_bytes gauge\n";
+	text << "openscad_peak_memory_bytes " << PlatformUtils::peakMemory() << "\n";
+	for (const auto &counter : counters()) {
+		text << "# TYPE openscad_" << counter.first << "_total counter\n";
+		text << boost::format("openscad_%s_total %.15g\n") % counter.first % counter.second;
+	}
+	return text.str();
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*!
+	Measurements of the command line, batch and server runs, for --timing,
+	--summary-json and the metrics of server mode: the time spent in each
+	phase, e.g. "parse" or "export", and counters such as the number of
+	nodes instantiated. Phases run several times (e.g. instantiating the
+	frames of an animation) and counters accumulate until clear().
+
+	Phases may nest: "normalize" is within "csg" or "export", "tessellate"
+	within "geometry". Nothing is measured unless enabled.
+*/
+class Metrics
+{
+public:
+	static Metrics *instance() { if (!inst) inst = new Metrics; return inst; }
+
+	static void setEnabled(bool on) { enabled = on; }
+	static bool isEnabled() { return enabled; }
+
+	// Adds the time until stop() or destruction to a phase, if enabled
+	class PhaseTimer
+	{
+	public:
+		PhaseTimer(const char *phase) : phase(enabled ? phase : nullptr), start(std::chrono::steady_clock::now()) {}
+		~PhaseTimer() { stop(); }
+		void stop();
+	private:
+		const char *phase;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	void addPhase(const std::string &phase, double ms);
+	void count(const std::string &counter, double n);
+	// In order of first use; phases in milliseconds
+	std::vector<std::pair<std::string, double>> phases() const;
+	std::vector<std::pair<std::string, double>> counters() const;
+	void clear();
+
+	/*!
+		The summary of a run, a JSON object of the phases, the total time in
+		milliseconds and the exit status as written by --timing, followed by
+		the lookups of the caches, the allocations of the arenas (see Arena),
+		the peak memory and the counters.
+	*/
+	std::string summaryJSON(double total, int status) const;
+	// The same, as metrics in the Prometheus text format
+	std::string prometheus() const;
+
+private:
+	Metrics() {}
+	static Metrics *inst;
+	static bool enabled;
+
+	typedef std::vector<std::pair<std::string, double>> values;
+	static void add(values &values, const std::string &name, double value);
+
+	mutable std::mutex mutex;
+	values phasetimes;
+	values countervalues;
+};
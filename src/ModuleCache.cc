@@ -1,8 +1,10 @@
 #include "ModuleCache.h"
 #include "StatCache.h"
 #include "FileModule.h"
+#include "ASTCache.h"
 #include "printutils.h"
 #include "openscad.h"
+#include "ThreadPool.h"
 
 #include <boost/format.hpp>
 
@@ -36,14 +38,20 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
   
 	// Don't try to recursively evaluate - if the file changes
 	// during evaluation, that would be really bad.
-	if (lib_mod && lib_mod->isHandlingDependencies()) return 0;
+	if (lib_mod && lib_mod->isHandlingDependencies()) {
+		discardPrefetched(filename);
+		return 0;
+	}
 
 	// Create cache ID
 	struct stat st;
 	bool valid = (StatCache::stat(filename.c_str(), st) == 0);
 
 	// If file isn't there, just return and let the cache retain the old module
-	if (!valid) return 0;
+	if (!valid) {
+		discardPrefetched(filename);
+		return 0;
+	}
 
 	// If the file is present, we'll always cache some result
 	std::string cache_id = str(boost::format("%x.%x") % st.st_mtime % st.st_size);
@@ -60,8 +68,8 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
   
 	bool shouldCompile = true;
 	if (found) {
-		// Files should only be recompiled if the cache ID changed
-		if (cacheEntry.cache_id == cache_id) {
+		// Files should only be recompiled if the cache ID or the appended -D commands changed
+		if (cacheEntry.cache_id == cache_id && cacheEntry.commands == commandline_commands) {
 			shouldCompile = false;
 			// Recompile if includes changed
 			if (cacheEntry.parsed_module) {
@@ -79,6 +87,9 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 	//if (!shouldCompile) PRINTB("Using cached library: %s (%p)", filename % lib_mod);
 #endif
 
+	if (shouldCompile) this->misscount++;
+	else this->hitcount++;
+
 	// If cache lookup failed (non-existing or old timestamp), compile module
 	if (shouldCompile) {
 #ifdef DEBUG
@@ -90,8 +101,17 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 		}
 #endif
 
+		// A prefetched parse is used if the file and the -D commands are unchanged since
+		auto pre = this->prefetched.find(filename);
+		const bool usePrefetched = pre != this->prefetched.end() &&
+			pre->second.cache_id == cache_id && pre->second.commands == commandline_commands;
+
 		std::string text;
-		{
+		if (usePrefetched) {
+			text = std::move(pre->second.text);
+		}
+		else {
+			discardPrefetched(filename);
 			std::ifstream ifs(filename.c_str());
 			if (!ifs.is_open()) {
 				PRINTB("WARNING: Can't open library file '%s'\n", filename);
@@ -102,16 +122,38 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 		
 		print_messages_push();
 		
-		delete cacheEntry.parsed_module;
-		lib_mod = parse(cacheEntry.parsed_module, text, filename, mainFile, false) ? cacheEntry.parsed_module : nullptr;
-		PRINTDB("compiled module: %s", filename);
+		if (this->keepreplaced && cacheEntry.parsed_module) this->replaced.push_back(cacheEntry.parsed_module);
+		else delete cacheEntry.parsed_module;
+		if (usePrefetched) {
+			auto &prefetched = pre->second;
+			prefetched.messages.replay();
+			cacheEntry.parsed_module = prefetched.module;
+			lib_mod = prefetched.ok ? prefetched.module : nullptr;
+			if (lib_mod && prefetched.parsed) ASTCache::store(text, filename, mainFile, *lib_mod, print_messages_stack.back());
+			this->prefetched.erase(pre);
+		}
+		else {
+			cacheEntry.parsed_module = ASTCache::load(text, filename, mainFile);
+			if (cacheEntry.parsed_module) {
+				lib_mod = cacheEntry.parsed_module;
+			}
+			else {
+				lib_mod = parse(cacheEntry.parsed_module, text, filename, mainFile, false) ? cacheEntry.parsed_module : nullptr;
+				PRINTDB("compiled module: %s", filename);
+				if (lib_mod) ASTCache::store(text, filename, mainFile, *lib_mod, print_messages_stack.back());
+			}
+		}
 		cacheEntry.module = lib_mod;
 		cacheEntry.cache_id = cache_id;
+		cacheEntry.commands = commandline_commands;
 		auto mod = lib_mod ? lib_mod : cacheEntry.parsed_module;
 		if(!found && mod)
 			cacheEntry.includes_mtime = mod->includesChanged();
 		print_messages_pop();
 	}
+	else {
+		discardPrefetched(filename);
+	}
 	
 	module = lib_mod;
 	// FIXME: Do we need to handle include-only cases?
@@ -120,9 +162,93 @@ std::time_t ModuleCache::evaluate(const std::string &mainFile,const std::string
 	return std::max({deps_mtime, cacheEntry.mtime, cacheEntry.includes_mtime});
 }
 
+/*!
+	Loads or parses those of the given files which evaluate() would compile,
+	concurrently on the ThreadPool. The results are kept until evaluate() is
+	called for each file, which then uses them instead of parsing, and prints
+	the messages of the parse at that point. All updates of the cache thus
+	still happen in the order of the evaluate() calls.
+
+	Only new and changed files are prefetched; a recompile because an
+	included file changed is left to evaluate(). So is everything with
+	hardwarnings set.
+	The given filenames must be absolute.
+*/
+void ModuleCache::prefetch(const std::string &mainFile, const std::vector<std::string> &filenames)
+{
+	// Replaying a warning would throw outside of the parser
+	if (!ThreadPool::instance()->isParallel() || OpenSCAD::hardwarnings) return;
+
+	std::vector<std::pair<std::string, std::string>> todo;
+	for (const auto &filename : filenames) {
+		struct stat st;
+		if (this->prefetched.count(filename) || StatCache::stat(filename.c_str(), st) != 0) continue;
+		std::string cache_id = str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+		auto entry = this->entries.find(filename);
+		if (entry != this->entries.end()) {
+			const auto &e = entry->second;
+			if (e.module && e.module->isHandlingDependencies()) continue;
+			if (e.cache_id == cache_id && e.commands == commandline_commands) continue;
+		}
+		todo.emplace_back(filename, cache_id);
+	}
+	if (todo.size() < 2) return;
+
+	std::vector<prefetch_entry> results(todo.size());
+	TaskGroup group;
+	for (size_t i = 0; i < todo.size(); ++i) {
+		group.run([&mainFile, &todo, &results, i]() {
+			const auto &filename = todo[i].first;
+			auto &result = results[i];
+			PrintCapture::Scope scope(result.messages);
+			std::ifstream ifs(filename.c_str());
+			if (!ifs.is_open()) return;
+			result.cache_id = todo[i].second;
+			result.commands = commandline_commands;
+			result.text = STR(ifs.rdbuf() << "\n\x03\n" << commandline_commands);
+			result.module = ASTCache::load(result.text, filename, mainFile);
+			if (result.module) {
+				result.ok = true;
+			}
+			else {
+				result.ok = parse(result.module, result.text, filename, mainFile, false);
+				result.parsed = true;
+				PRINTDB("compiled module: %s", filename);
+			}
+		});
+	}
+	group.wait();
+
+	for (size_t i = 0; i < todo.size(); ++i) {
+		if (results[i].module) this->prefetched[todo[i].first] = std::move(results[i]);
+	}
+}
+
+void ModuleCache::discardPrefetched(const std::string &filename)
+{
+	auto it = this->prefetched.find(filename);
+	if (it == this->prefetched.end()) return;
+	delete it->second.module;
+	this->prefetched.erase(it);
+}
+
 void ModuleCache::clear()
 {
 	this->entries.clear();
+	for (const auto &pre : this->prefetched) delete pre.second.module;
+	this->prefetched.clear();
+}
+
+void ModuleCache::setKeepReplaced(bool keep)
+{
+	this->keepreplaced = keep;
+	if (!keep) releaseReplaced();
+}
+
+void ModuleCache::releaseReplaced()
+{
+	for (auto module : this->replaced) delete module;
+	this->replaced.clear();
 }
 
 FileModule *ModuleCache::lookup(const std::string &filename)
@@ -3,6 +3,8 @@
 #include <string>
 #include <ctime>
 #include <unordered_map>
+#include <vector>
+#include "printutils.h"
 
 /*!
 	Caches FileModules based on their filenames
@@ -13,13 +15,22 @@ public:
 	static ModuleCache *instance() { if (!inst) inst = new ModuleCache; return inst; }
 
 	std::time_t evaluate(const std::string &mainFile, const std::string &filename, class FileModule *&module);
+	void prefetch(const std::string &mainFile, const std::vector<std::string> &filenames);
 	class FileModule *lookup(const std::string &filename);
 	size_t size() { return this->entries.size(); }
+	// Calls of evaluate() which didn't and which did need to parse the file
+	size_t hits() const { return this->hitcount; }
+	size_t misses() const { return this->misscount; }
 	void clear();
 	static void clear_markers();
 
+	// While set, replaced modules are kept until releaseReplaced(), as nodes
+	// instantiated from them may still be evaluated elsewhere (batch mode)
+	void setKeepReplaced(bool keep);
+	void releaseReplaced();
+
 private:
-	ModuleCache() {}
+	ModuleCache() : keepreplaced(false), hitcount(0), misscount(0) {}
 	~ModuleCache() {}
 
 	static ModuleCache *inst;
@@ -30,6 +41,23 @@ private:
 		std::string cache_id;
 		std::time_t mtime{};          // time file last modified
 		std::time_t includes_mtime{}; // time the includes last changed
+		std::string commands;         // commandline_commands appended when parsing
 	};
 	std::unordered_map<std::string, cache_entry> entries;
+
+	// A file parsed ahead of evaluate() by prefetch()
+	struct prefetch_entry {
+		class FileModule *module{};
+		bool ok{};                    // parsed without errors
+		bool parsed{};                // parsed, rather than loaded from the ASTCache
+		std::string cache_id;
+		std::string commands;
+		std::string text;
+		PrintCapture messages;
+	};
+	std::unordered_map<std::string, prefetch_entry> prefetched;
+	void discardPrefetched(const std::string &filename);
+	bool keepreplaced;
+	std::vector<class FileModule *> replaced;
+	size_t hitcount, misscount;
 };
@@ -0,0 +1,56 @@
+#include "ModuleCallCache.h"
+#include "context.h"
+#include "node.h"
+#include "printutils.h"
+
+ModuleCallCache *ModuleCallCache::inst = nullptr;
+
+ModuleCallCache::Entry::Entry(FunctionCache::Tracker::ConfigReads &&config, const std::vector<AbstractNode *> &children)
+	: config(std::move(config)), children(children)
+{
+	for (auto child : this->children) child->retain();
+}
+
+ModuleCallCache::Entry::~Entry()
+{
+	for (auto child : this->children) AbstractNode::release(child);
+}
+
+bool ModuleCallCache::Entry::matches(const Context &ctx) const
+{
+	for (const auto &read : this->config) {
+		if (!FunctionCache::sameValue(ctx.lookup_variable(read.first, true), read.second)) return false;
+	}
+	return true;
+}
+
+bool ModuleCallCache::get(const FunctionCache::Key &key, const Context &ctx, EntryPtr &result)
+{
+	if (this->cache.get(key, result) && result->matches(ctx)) {
+		this->hits++;
+		return true;
+	}
+	result.reset();
+	this->misses++;
+	return false;
+}
+
+void ModuleCallCache::insert(const FunctionCache::Key &key, const EntryPtr &entry)
+{
+	this->cache.insert(key, entry, 1);
+}
+
+void ModuleCallCache::clear()
+{
+	this->cache.clear();
+	this->hits = 0;
+	this->misses = 0;
+}
+
+void ModuleCallCache::print()
+{
+	const size_t hits = this->hits, misses = this->misses;
+	if (hits + misses == 0) return;
+	PRINTDB("Module call cache: %d hits, %d misses (%d%% hit rate), %d entries",
+					hits % misses % (100 * hits / (hits + misses)) % this->cache.size());
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "FunctionCache.h"
+
+class AbstractNode;
+
+/*!
+	Children instantiated by calls of user modules, keyed like the
+	FunctionCache by the module and the values its parameters were bound to.
+
+	Only calls without children of their own are remembered, and only if
+	their instantiation turned out to be pure in the same sense as for
+	functions, except that config variables may be looked up: the values
+	seen are kept with the entry, and it only matches calls which see the
+	same values.
+
+	Calls matching an entry share its nodes as the children of their own
+	group node, so identical subtrees are instantiated only once. Entries
+	hold a reference to their nodes, see AbstractNode::retain(). Like the
+	FunctionCache, the cache is cleared after each compile.
+*/
+class ModuleCallCache
+{
+public:
+	struct Entry
+	{
+		Entry(FunctionCache::Tracker::ConfigReads &&config, const std::vector<AbstractNode *> &children);
+		~Entry();
+		// Whether ctx sees the config values the children were instantiated with
+		bool matches(const Context &ctx) const;
+
+		const FunctionCache::Tracker::ConfigReads config;
+		const std::vector<AbstractNode *> children;
+	};
+	typedef std::shared_ptr<const Entry> EntryPtr;
+
+	ModuleCallCache(size_t maxentries = 10000) : cache(maxentries), hits(0), misses(0) {}
+
+	static ModuleCallCache *instance() { if (!inst) inst = new ModuleCallCache; return inst; }
+
+	// Looks up an entry which matches a call with context ctx
+	bool get(const FunctionCache::Key &key, const Context &ctx, EntryPtr &result);
+	void insert(const FunctionCache::Key &key, const EntryPtr &entry);
+	void clear();
+	void print();
+
+private:
+	static ModuleCallCache *inst;
+
+	ShardedCache<FunctionCache::Key, EntryPtr, FunctionCache::Key::Hash> cache;
+	std::atomic<size_t> hits, misses;
+};
@@ -4,6 +4,7 @@
 #include "expression.h"
 #include "exceptions.h"
 #include "printutils.h"
+#include "progress.h"
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
@@ -81,8 +82,15 @@ static void NOINLINE print_trace(const ModuleInstantiation *mod, const Context *
 	PRINTB("TRACE: called by '%s', %s.", mod->name() % mod->location().toRelativeString(ctx->documentPath()));
 }
 
+bool ModuleInstantiation::skip_background = false;
+
 AbstractNode *ModuleInstantiation::evaluate(const Context *ctx) const
 {
+	// Only previews draw background subtrees, so exports may leave them out
+	if (this->tag_background && skip_background) return nullptr;
+	// A preview of an outdated document may be cancelled before its tree is complete
+	progress_check_cancel();
+
 	EvalContext c(ctx, this->arguments, this->loc, &this->scope);
 
 #if 0 && DEBUG
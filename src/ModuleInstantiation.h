@@ -27,6 +27,9 @@ public:
 	bool isHighlight() const { return this->tag_highlight; }
 	bool isRoot() const { return this->tag_root; }
 
+	// While set, background (%) instances evaluate to no node at all
+	static void setSkipBackground(bool skip) { skip_background = skip; }
+
 	AssignmentList arguments;
 	LocalScope scope;
 
@@ -36,6 +39,9 @@ public:
 protected:
 	std::string modname;
 	std::string modpath;
+
+private:
+	static bool skip_background;
 };
 
 class IfElseModuleInstantiation : public ModuleInstantiation {
@@ -17,14 +17,15 @@ void GLView::setColorScheme(const std::string &cs) {assert(false && "not impleme
 ThrownTogetherRenderer::ThrownTogetherRenderer(shared_ptr<class CSGProducts> root_products,
                         shared_ptr<CSGProducts> highlight_products,
                         shared_ptr<CSGProducts> background_products) {}
+ThrownTogetherRenderer::~ThrownTogetherRenderer() {}
 void ThrownTogetherRenderer::draw(bool showfaces, bool showedges) const {};
 BoundingBox ThrownTogetherRenderer::getBoundingBox() const
 {
 	assert(false && "not implemented");
 	return BoundingBox();
 }
-void ThrownTogetherRenderer::renderCSGProducts(const CSGProducts &products, bool highlight_mode, bool background_mode, bool showedges, 
-                        bool fberror) const {}
+void ThrownTogetherRenderer::renderCSGProducts(const CSGProducts &products, Batches &batches, bool highlight_mode, bool background_mode,
+                        bool showedges, bool fberror) const {}
 void ThrownTogetherRenderer::renderChainObject(const class CSGChainObject &csgobj, bool highlight_mode,
                         bool background_mode, bool showedges, bool fberror, OpenSCADOperator type) const {}
 
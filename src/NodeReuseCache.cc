@@ -0,0 +1,250 @@
+#include "NodeReuseCache.h"
+#include "FileModule.h"
+#include "ModuleInstantiation.h"
+#include "UserModule.h"
+#include "function.h"
+#include "node.h"
+#include "handle_dep.h"
+#include "printutils.h"
+#include "hash.h"
+
+#include <algorithm>
+#include <cctype>
+#include <unordered_set>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
+
+namespace {
+	std::time_t file_mtime(const std::string &filename)
+	{
+		boost::system::error_code ec;
+		std::time_t mtime = fs::last_write_time(filename, ec);
+		return ec ? -1 : mtime;
+	}
+
+	std::string location_string(const Location &loc)
+	{
+		std::ostringstream stream;
+		stream << loc.firstLine() << ":" << loc.firstColumn() << "-" << loc.lastLine() << ":" << loc.lastColumn();
+		return stream.str();
+	}
+
+	// The identifiers in the source text, including those in strings and comments
+	std::vector<std::string> identifiers(const std::string &text)
+	{
+		std::vector<std::string> result;
+		auto isstart = [](char c) { return std::isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '$'; };
+		for (size_t i = 0; i < text.size(); ) {
+			if (isstart(text[i])) {
+				size_t j = i + 1;
+				while (j < text.size() && (isstart(text[j]) || std::isdigit(static_cast<unsigned char>(text[j])))) j++;
+				result.push_back(text.substr(i, j - i));
+				i = j;
+			}
+			else if (std::isdigit(static_cast<unsigned char>(text[i]))) {
+				while (i < text.size() && (std::isalnum(static_cast<unsigned char>(text[i])) || text[i] == '.')) i++;
+			}
+			else i++;
+		}
+		return result;
+	}
+}
+
+NodeReuseCache::~NodeReuseCache()
+{
+	end();
+	delete this->cancelled;
+}
+
+/*!
+	Takes ownership of the module subsequent compiles instantiate from. The
+	previously adopted module is deleted once no reused node refers to it
+	anymore.
+*/
+void NodeReuseCache::adoptModule(FileModule *module)
+{
+	if (this->module.get() != module) this->module.reset(module);
+}
+
+// Shares ownership of the module with the caller
+void NodeReuseCache::adoptModule(const shared_ptr<FileModule> &module)
+{
+	this->module = module;
+}
+
+/*!
+	Starts a compile. The top-level nodes of the previous tree which may be
+	reused are taken out of oldroot, so the caller can delete it afterwards.
+	After a cancelled compile, its partial tree is used as well.
+*/
+void NodeReuseCache::begin(AbstractNode *oldroot, const std::string &environment)
+{
+	end();
+	this->reused = 0;
+
+	for (auto root : {oldroot, this->cancelled}) {
+		if (!root || this->invalidated) continue;
+		auto &children = root->children;
+		for (auto it = children.begin(); it != children.end(); ) {
+			auto entry = this->current.find(*it);
+			if (entry != this->current.end()) {
+				this->previous.emplace(entry->second.key, std::make_pair(*it, std::move(entry->second)));
+				it = children.erase(it);
+			}
+			else ++it;
+		}
+	}
+	delete this->cancelled;
+	this->cancelled = nullptr;
+	this->current.clear();
+	this->invalidated = false;
+
+	this->environment = environment + "\n";
+	this->definitions.clear();
+	if (this->module) {
+		this->environment += this->module->getFullpath() + "\n";
+		// A function and a module of the same name are both taken for a use of the name
+		const auto &scope = this->module->scope;
+		for (const auto &f : scope.astFunctions) {
+			std::ostringstream def;
+			f.second->print(def, "");
+			this->definitions[f.first] += def.str();
+		}
+		for (const auto &m : scope.astModules) {
+			std::ostringstream def;
+			m.second->print(def, "");
+			this->definitions[m.first] += def.str();
+		}
+	}
+	// The values of the assignments are compared by readsUnchanged(), so
+	// statements not reading an assignment edited by the customizer are kept
+	this->enabled = this->module != nullptr;
+}
+
+/*!
+	Returns the source text of the root file's definitions a statement may
+	use: those named in its text, and in turn in their texts. Names which
+	aren't calls (variables, arguments, strings) only make this larger.
+*/
+std::string NodeReuseCache::usedDefinitions(const std::string &text) const
+{
+	std::string result;
+	std::unordered_set<std::string> seen;
+	std::vector<std::string> pending = identifiers(text);
+	while (!pending.empty()) {
+		const std::string name = pending.back();
+		pending.pop_back();
+		if (!seen.insert(name).second) continue;
+		auto it = this->definitions.find(name);
+		if (it == this->definitions.end()) continue;
+		result += it->second;
+		for (auto &id : identifiers(it->second)) pending.push_back(std::move(id));
+	}
+	return result;
+}
+
+/*!
+	Instantiates a top-level statement, or reuses its subtree from the
+	previous compile.
+*/
+AbstractNode *NodeReuseCache::instantiate(const ModuleInstantiation &modinst, const Context *ctx)
+{
+	std::ostringstream stmt;
+	modinst.print(stmt, "");
+	const std::string text = stmt.str() + usedDefinitions(stmt.str());
+	const bool reusable = this->enabled && text.find("rands") == std::string::npos;
+	const std::string key = hash128(this->environment + text).toString();
+
+	if (reusable) {
+		const std::string location = location_string(modinst.location());
+		auto range = this->previous.equal_range(key);
+		auto it = std::find_if(range.first, range.second, [&location](const std::pair<const std::string, std::pair<AbstractNode *, Entry>> &p) {
+			return p.second.second.messages.empty() || p.second.second.location == location;
+		});
+		if (it != range.second && filesUnchanged(it->second.second) && readsUnchanged(it->second.second, ctx)) {
+			AbstractNode *node = it->second.first;
+			Entry entry = std::move(it->second.second);
+			this->previous.erase(it);
+			this->current.emplace(node, std::move(entry));
+			this->reused++;
+
+			std::vector<std::string> messages;
+			const std::string &msgs = this->current[node].messages;
+			if (!msgs.empty()) boost::split(messages, msgs, boost::is_any_of("\n"));
+			for (const auto &msg : messages) PRINT(msg);
+			return node;
+		}
+	}
+
+	Entry entry;
+	AbstractNode *node = nullptr;
+	{
+		DependencyRecorder deps;
+		Context::LookupRecorder lookups(ctx);
+		print_messages_push();
+		try {
+			node = modinst.evaluate(ctx);
+		} catch (...) {
+			print_messages_pop();
+			throw;
+		}
+		entry.messages = print_messages_stack.back();
+		print_messages_pop();
+		if (!entry.messages.empty()) entry.location = location_string(modinst.location());
+		for (const auto &file : deps.files()) entry.files.emplace_back(file, file_mtime(file));
+		entry.reads = lookups.takeReads();
+	}
+
+	if (node && reusable) {
+		entry.key = key;
+		entry.module = this->module;
+		this->current.emplace(node, std::move(entry));
+	}
+	return node;
+}
+
+/*!
+	Finishes a compile, deleting all nodes which weren't reused.
+*/
+void NodeReuseCache::end()
+{
+	if (this->reused > 0) {
+		PRINTDB("Reused %d top-level nodes, dropped %d", this->reused % this->previous.size());
+	}
+	for (auto &p : this->previous) delete p.second.first;
+	this->previous.clear();
+}
+
+/*!
+	Finishes a cancelled compile instead of end(). Takes ownership of the
+	partial tree, so the next compile may reuse both what was instantiated
+	and the candidates which weren't reached.
+*/
+void NodeReuseCache::cancel(AbstractNode *partial)
+{
+	for (auto &p : this->previous) {
+		partial->children.push_back(p.second.first);
+		this->current.emplace(p.second.first, std::move(p.second.second));
+	}
+	this->previous.clear();
+	delete this->cancelled;
+	this->cancelled = partial;
+}
+
+bool NodeReuseCache::filesUnchanged(const Entry &entry) const
+{
+	return std::all_of(entry.files.begin(), entry.files.end(), [](const std::pair<std::string, std::time_t> &file) {
+		return file_mtime(file.first) == file.second;
+	});
+}
+
+// Variables of the file are evaluated anew by each compile, so they are compared by value
+bool NodeReuseCache::readsUnchanged(const Entry &entry, const Context *ctx)
+{
+	return std::all_of(entry.reads.begin(), entry.reads.end(), [ctx](const std::pair<VariableName, ValuePtr> &read) {
+		return *ctx->lookup_variable(read.first, true) == *read.second;
+	});
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <ctime>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "memory.h"
+#include "context.h"
+
+class AbstractNode;
+class FileModule;
+class ModuleInstantiation;
+
+/*!
+	Reuses the node subtrees of unchanged top-level statements when the same
+	document is compiled again, as happens for every preview in the GUI.
+
+	Each top-level module instantiation is keyed by a hash of its source text,
+	the text of the root file's functions and modules it may call (see
+	usedDefinitions()), the document path and the given environment
+	(dependency mtimes, special variables set by the caller). Its position
+	is not part of the key, so inserting lines above a statement or editing
+	an unrelated definition keeps it. A statement whose key is unchanged is
+	not instantiated again: its subtree from the previous compile is moved
+	into the new tree, and the messages it printed are repeated.
+
+	Subtrees referring to external files (import(), surface(), ...) are only
+	reused if those files are unchanged. Statements mentioning rands(),
+	directly or in the definitions they use, are never reused, as unseeded
+	random numbers would be frozen. Statements which printed messages are
+	only reused at the same position, as the messages may name their line.
+
+	The variables a statement looks up from the file context or above (see
+	Context::LookupRecorder) are kept with their values, and the statement
+	is only reused while they have the same values. So special variables
+	of the caller which change between compiles, like $t while animating,
+	needn't be part of the environment: statements not depending on them
+	keep their subtrees. The same goes for the top-level assignments, so
+	editing a parameter in the customizer only instantiates the statements
+	reading it (directly or through the modules and functions they call).
+
+	Reused nodes keep their node index, so the Tree can keep their cached dump
+	strings as well (see Tree::setRoot()). For the same reason, the node index
+	counter must not be reset while hasCandidates() is true. The AST a reused
+	node was instantiated from is kept alive as long as the node.
+*/
+class NodeReuseCache
+{
+public:
+	NodeReuseCache() : cancelled(nullptr), reused(0), enabled(false), invalidated(false) {}
+	~NodeReuseCache();
+
+	void adoptModule(FileModule *module);
+	void adoptModule(const shared_ptr<FileModule> &module);
+	void begin(AbstractNode *oldroot, const std::string &environment);
+	AbstractNode *instantiate(const ModuleInstantiation &modinst, const Context *ctx);
+	void end();
+	void cancel(AbstractNode *partial);
+
+	// Forget all reuse candidates on the next compile
+	void invalidate() { this->invalidated = true; }
+	bool hasCandidates() const { return !this->previous.empty(); }
+	size_t reusedCount() const { return this->reused; }
+
+private:
+	struct Entry {
+		std::string key;
+		// Messages printed while instantiating
+		std::string messages;
+		// Where the statement was, if it printed messages
+		std::string location;
+		// Files referred to, with their modification time
+		std::vector<std::pair<std::string, std::time_t>> files;
+		// Variables looked up from outside the statement
+		Context::LookupRecorder::Reads reads;
+		shared_ptr<FileModule> module;
+	};
+
+	bool filesUnchanged(const Entry &entry) const;
+	static bool readsUnchanged(const Entry &entry, const Context *ctx);
+	std::string usedDefinitions(const std::string &text) const;
+
+	// The module the current compile instantiates from
+	shared_ptr<FileModule> module;
+	std::string environment;
+	// The source text of the root file's functions and modules by name
+	std::unordered_map<std::string, std::string> definitions;
+	// Top-level nodes of the current tree; the nodes are owned by the tree
+	std::unordered_map<const AbstractNode *, Entry> current;
+	// Top-level nodes of the previous tree, owned by us until reused. Equal
+	// statements have equal keys.
+	std::unordered_multimap<std::string, std::pair<AbstractNode *, Entry>> previous;
+	// The partial tree of a cancelled compile, owned by us
+	AbstractNode *cancelled;
+	size_t reused;
+	bool enabled;
+	bool invalidated;
+};
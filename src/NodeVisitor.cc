@@ -1,35 +1,96 @@
 #include "NodeVisitor.h"
 #include "state.h"
+#include "cgaladvnode.h"
+#include "colornode.h"
+#include "csgops.h"
+#include "importnode.h"
+#include "linearextrudenode.h"
+#include "offsetnode.h"
+#include "projectionnode.h"
+#include "rendernode.h"
+#include "rotateextrudenode.h"
+#include "textnode.h"
+#include "transformnode.h"
+#include <vector>
 
 State NodeVisitor::nullstate(nullptr);
 
-Response NodeVisitor::traverse(const AbstractNode &node, const State &state)
+// The visitable classes declared in headers; PrimitiveNode and SurfaceNode
+// define theirs in their own files
+DEFINE_VISITABLE(AbstractNode)
+DEFINE_VISITABLE(AbstractIntersectionNode)
+DEFINE_VISITABLE(AbstractPolyNode)
+DEFINE_VISITABLE(GroupNode)
+DEFINE_VISITABLE(RootNode)
+DEFINE_VISITABLE(LeafNode)
+DEFINE_VISITABLE(CgaladvNode)
+DEFINE_VISITABLE(CsgOpNode)
+DEFINE_VISITABLE(LinearExtrudeNode)
+DEFINE_VISITABLE(RotateExtrudeNode)
+DEFINE_VISITABLE(ImportNode)
+DEFINE_VISITABLE(TextNode)
+DEFINE_VISITABLE(ProjectionNode)
+DEFINE_VISITABLE(RenderNode)
+DEFINE_VISITABLE(TransformNode)
+DEFINE_VISITABLE(ColorNode)
+DEFINE_VISITABLE(OffsetNode)
+
+Response NodeVisitor::traverse(const AbstractNode &root, const State &state)
 {
-	State newstate = state;
-	newstate.setNumChildren(node.getChildren().size());
-	
-	Response response = Response::ContinueTraversal;
-	newstate.setPrefix(true);
-	newstate.setParent(state.parent());
-	response = node.accept(newstate, *this);
+	const char *category = RenderProfile::isEnabled() ? profileCategory() : nullptr;
+	const bool timed = category || timesNodes();
+
+	// A node being traversed: its state, the parent it was visited with and
+	// the next child to traverse
+	struct Frame {
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+		Frame(const AbstractNode &node, const State &state)
+			: node(&node), state(state), parent(state.parent()), next(0) {}
+		const AbstractNode *node;
+		State state;
+		const AbstractNode *parent;
+		size_t next;
+	};
+	// The state has a matrix
+	std::vector<Frame, Eigen::aligned_allocator<Frame>> stack;
+
+	// The prefix visit; pushes the node unless aborted
+	auto enter = [&](const AbstractNode &node, const State &parentstate) {
+		stack.emplace_back(node, parentstate);
+		Frame &frame = stack.back();
+		frame.state.setStartTime(timed ? RenderProfile::now() : 0);
+		frame.state.setNumChildren(node.getChildren().size());
+		frame.state.setPrefix(true);
+		const Response response = node.accept(frame.state, *this);
+		// Pruned traversals mean don't traverse children
+		if (response == Response::ContinueTraversal) frame.state.setParent(&node);
+		else frame.next = node.getChildren().size();
+		return response;
+	};
 
-	// Pruned traversals mean don't traverse children
-	if (response == Response::ContinueTraversal) {
-		newstate.setParent(&node);
-		for(const auto &chnode : node.getChildren()) {
-			response = this->traverse(*chnode, newstate);
-			if (response == Response::AbortTraversal) return response; // Abort immediately
+	if (enter(root, state) == Response::AbortTraversal) return Response::AbortTraversal;
+	while (!stack.empty()) {
+		Frame &frame = stack.back();
+		const auto &children = frame.node->getChildren();
+		if (frame.next < children.size()) {
+			const AbstractNode &child = *children[frame.next++];
+			// Copied, since entering the child may move the frame
+			const State parentstate = frame.state;
+			if (enter(child, parentstate) == Response::AbortTraversal) return Response::AbortTraversal; // Abort immediately
+			continue;
 		}
-	}
 
-	// Postfix is executed for all non-aborted traversals
-	if (response != Response::AbortTraversal) {
-		newstate.setParent(state.parent());
-		newstate.setPrefix(false);
-		newstate.setPostfix(true);
-		response = node.accept(newstate, *this);
+		// Postfix is executed for all non-aborted traversals
+		frame.state.setParent(frame.parent);
+		frame.state.setPrefix(false);
+		frame.state.setPostfix(true);
+		if (frame.node->accept(frame.state, *this) == Response::AbortTraversal) return Response::AbortTraversal;
+		if (category) {
+			RenderProfile::Event event(category, *frame.node, frame.state.startTime());
+			profileNode(*frame.node, event);
+			RenderProfile::instance()->record(std::move(event));
+		}
+		stack.pop_back();
 	}
-
-	if (response != Response::AbortTraversal) response = Response::ContinueTraversal;
-	return response;
+	return Response::ContinueTraversal;
 }
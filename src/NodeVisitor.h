@@ -3,91 +3,121 @@
 #include "BaseVisitable.h"
 #include "node.h"
 #include "state.h"
+#include "RenderProfile.h"
+#include <deque>
+#include <utility>
 
-class NodeVisitor :
-	public BaseVisitor,
-	public Visitor<class AbstractNode>,
-	public Visitor<class AbstractIntersectionNode>,
-	public Visitor<class AbstractPolyNode>,
-	public Visitor<class GroupNode>,
-	public Visitor<class RootNode>,
-	public Visitor<class LeafNode>,
-	public Visitor<class CgaladvNode>,
-	public Visitor<class CsgOpNode>,
-	public Visitor<class LinearExtrudeNode>,
-	public Visitor<class RotateExtrudeNode>,
-	public Visitor<class ImportNode>,
-	public Visitor<class PrimitiveNode>,
-	public Visitor<class TextNode>,
-	public Visitor<class ProjectionNode>,
-	public Visitor<class RenderNode>,
-	public Visitor<class SurfaceNode>,
-	public Visitor<class TransformNode>,
-	public Visitor<class ColorNode>,
-	public Visitor<class OffsetNode>
+/*!
+	The results of the children visited so far, for visitors combining them
+	in the parent's postfix visit, keyed by the parent's node index. Only
+	ancestors of the node being visited have results pending, in the order
+	of their depth, so this is a stack: a node's results are looked up,
+	added to and erased at or near the end, and their memory is released as
+	soon as the parent has used them. Adding keeps references valid.
+*/
+template <typename ChildList>
+class VisitedChildren
+{
+public:
+	// The results of node's children, created empty if there are none
+	ChildList &operator[](size_t index) {
+		for (auto it = this->entries.rbegin(); it != this->entries.rend(); ++it) {
+			if (it->first == index) return it->second;
+		}
+		this->entries.emplace_back(index, ChildList());
+		return this->entries.back().second;
+	}
+	void erase(size_t index) {
+		for (auto it = this->entries.end(); it != this->entries.begin();) {
+			if ((--it)->first == index) {
+				this->entries.erase(it);
+				return;
+			}
+		}
+	}
+	void clear() { this->entries.clear(); }
+	bool empty() const { return this->entries.empty(); }
+
+private:
+	std::deque<std::pair<size_t, ChildList>> entries;
+};
+
+class NodeVisitor
 {
 public:
   NodeVisitor() {}
-  ~NodeVisitor() {}
+  virtual ~NodeVisitor() {}
   
+	// Visits node and its subtree depth first, with an explicit stack, so
+	// deep trees don't overflow the call stack
 	Response traverse(const AbstractNode &node, const class State &state = NodeVisitor::nullstate);
 
-  Response visit(class State &state, const class AbstractNode &node) override = 0;
-  Response visit(class State &state, const class AbstractIntersectionNode &node) override {
+  virtual Response visit(class State &state, const class AbstractNode &node) = 0;
+  virtual Response visit(class State &state, const class AbstractIntersectionNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class AbstractPolyNode &node) override {
+  virtual Response visit(class State &state, const class AbstractPolyNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class GroupNode &node) override {
+  virtual Response visit(class State &state, const class GroupNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const RootNode &node) override {
+  virtual Response visit(class State &state, const RootNode &node) {
 		return visit(state, (const class GroupNode &)node);
 	}
-  Response visit(class State &state, const class LeafNode &node) override {
+  virtual Response visit(class State &state, const class LeafNode &node) {
 		return visit(state, (const class AbstractPolyNode &)node);
 	}
-  Response visit(class State &state, const class CgaladvNode &node) override {
+  virtual Response visit(class State &state, const class CgaladvNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class CsgOpNode &node) override {
+  virtual Response visit(class State &state, const class CsgOpNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class LinearExtrudeNode &node) override {
+  virtual Response visit(class State &state, const class LinearExtrudeNode &node) {
 		return visit(state, (const class AbstractPolyNode &)node);
 	}
-  Response visit(class State &state, const class RotateExtrudeNode &node) override {
+  virtual Response visit(class State &state, const class RotateExtrudeNode &node) {
 		return visit(state, (const class AbstractPolyNode &)node);
 	}
-  Response visit(class State &state, const class ImportNode &node) override {
+  virtual Response visit(class State &state, const class ImportNode &node) {
 		return visit(state, (const class LeafNode &)node);
 	}
-  Response visit(class State &state, const class PrimitiveNode &node) override {
+  virtual Response visit(class State &state, const class PrimitiveNode &node) {
 		return visit(state, (const class LeafNode &)node);
 	}
-  Response visit(class State &state, const class TextNode &node) override {
+  virtual Response visit(class State &state, const class TextNode &node) {
 		return visit(state, (const class AbstractPolyNode &)node);
 	}
-  Response visit(class State &state, const class ProjectionNode &node) override {
+  virtual Response visit(class State &state, const class ProjectionNode &node) {
 		return visit(state, (const class AbstractPolyNode &)node);
 	}
-  Response visit(class State &state, const class RenderNode &node) override {
+  virtual Response visit(class State &state, const class RenderNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class SurfaceNode &node) override {
+  virtual Response visit(class State &state, const class SurfaceNode &node) {
 		return visit(state, (const class LeafNode &)node);
 	}
-  Response visit(class State &state, const class TransformNode &node) override {
+  virtual Response visit(class State &state, const class TransformNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class ColorNode &node) override {
+  virtual Response visit(class State &state, const class ColorNode &node) {
 		return visit(state, (const class AbstractNode &)node);
 	}
-  Response visit(class State &state, const class OffsetNode &node) override {
+  virtual Response visit(class State &state, const class OffsetNode &node) {
 		return visit(state, (const class AbstractPolyNode &)node);
 	}
-	// Add visit() methods for new visitable subtypes of AbstractNode here
+	// Add visit() methods for new visitable subtypes of AbstractNode here,
+	// and their DEFINE_VISITABLE() to NodeVisitor.cc
+
+protected:
+	// Visitors with a profile category have their traversal of each node
+	// recorded while the RenderProfile is enabled, with the details added
+	// by profileNode() right after the postfix visit.
+	virtual const char *profileCategory() const { return nullptr; }
+	virtual void profileNode(const AbstractNode &/*node*/, RenderProfile::Event &/*event*/) {}
+	// Visitors which time nodes get State::startTime() set even when not profiling
+	virtual bool timesNodes() const { return false; }
 
 private:
 	static State nullstate;
@@ -0,0 +1,117 @@
+#include "NumberFormat.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <double-conversion/double-conversion.h>
+
+namespace {
+	using double_conversion::DoubleToStringConverter;
+
+	// Correctly rounded to up to 15 digits, ties excepted, the digits fit a double
+	const int max_fast_digits = 15;
+
+	// printf, with the decimal point of the "C" locale
+	int printNumber(double x, int digits, char *buf)
+	{
+		const int len = snprintf(buf, NumberFormat::maxlength, "%.*g", digits, x);
+		std::replace(buf, buf + len, ',', '.');
+		return len;
+	}
+
+	// Lays out the digits of a number like %g with a precision of precision does
+	int layout(bool negative, const char *digits, int length, int point, int precision, char *buf)
+	{
+		while (length > 1 && digits[length - 1] == '0') length--;
+		char *p = buf;
+		if (negative) *p++ = '-';
+		const int exponent = point - 1;
+		if (exponent < -4 || exponent >= precision) {
+			*p++ = digits[0];
+			if (length > 1) {
+				*p++ = '.';
+				memcpy(p, digits + 1, length - 1);
+				p += length - 1;
+			}
+			*p++ = 'e';
+			*p++ = exponent < 0 ? '-' : '+';
+			int e = std::abs(exponent);
+			if (e >= 100) {
+				*p++ = char('0' + e / 100);
+				e %= 100;
+			}
+			*p++ = char('0' + e / 10);
+			*p++ = char('0' + e % 10);
+		}
+		else if (point <= 0) {
+			*p++ = '0';
+			*p++ = '.';
+			memset(p, '0', -point);
+			p += -point;
+			memcpy(p, digits, length);
+			p += length;
+		}
+		else if (point >= length) {
+			memcpy(p, digits, length);
+			p += length;
+			memset(p, '0', point - length);
+			p += point - length;
+		}
+		else {
+			memcpy(p, digits, point);
+			p += point;
+			*p++ = '.';
+			memcpy(p, digits + point, length - point);
+			p += length - point;
+		}
+		return int(p - buf);
+	}
+}
+
+namespace NumberFormat {
+	/*!
+		The shortest digits which read back as x are those of x rounded to as
+		many or more digits, so they are used where they suffice. Otherwise x
+		is rounded to digits, except for ties, which double-conversion rounds
+		up and printf to even, and precisions beyond max_fast_digits. These
+		rare cases go through snprintf.
+	*/
+	int format(double x, int digits, char *buf)
+	{
+		if (!std::isfinite(x) || digits > max_fast_digits) {
+			return printNumber(x, digits > 0 ? std::min(digits, 17) : 17, buf);
+		}
+		char shortest[DoubleToStringConverter::kBase10MaximalLength + 1];
+		bool negative;
+		int length, point;
+		DoubleToStringConverter::DoubleToAscii(x, DoubleToStringConverter::SHORTEST, 0,
+			shortest, sizeof(shortest), &negative, &length, &point);
+		if (digits <= 0) return layout(negative, shortest, length, point, std::max(length, 15), buf);
+		if (length <= digits) return layout(negative, shortest, length, point, digits, buf);
+		if (length == digits + 1 && shortest[length - 1] == '5') {
+			return printNumber(x, digits, buf);
+		}
+
+		char rounded[max_fast_digits + 1];
+		DoubleToStringConverter::DoubleToAscii(x, DoubleToStringConverter::PRECISION, digits,
+			rounded, sizeof(rounded), &negative, &length, &point);
+		return layout(negative, rounded, length, point, digits, buf);
+	}
+
+	int format(const double *x, size_t n, int digits, char separator, char *buf)
+	{
+		char *p = buf;
+		for (size_t i = 0; i < n; ++i) {
+			if (i) *p++ = separator;
+			p += format(x[i], digits, p);
+		}
+		return int(p - buf);
+	}
+
+	void append(std::string &out, double x, int digits)
+	{
+		char buf[maxlength];
+		out.append(buf, format(x, digits, buf));
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+/*!
+	Formatting of numbers for text exports, without streams or the locale.
+	The output is the same as printf's %g with the given number of
+	significant digits, which is what streams write with a precision of
+	digits. With 0 digits, uses the fewest of 15 to 17 which read back as
+	the number, see setExportPrecision().
+*/
+namespace NumberFormat {
+	// The most a number takes, including a sign, decimal point and exponent
+	const int maxlength = 32;
+
+	// Writes x to buf, which has room for maxlength. Returns the length written.
+	int format(double x, int digits, char *buf);
+	// Writes the n numbers at x separated by separator. Returns the length written.
+	int format(const double *x, size_t n, int digits, char separator, char *buf);
+	void append(std::string &out, double x, int digits);
+}
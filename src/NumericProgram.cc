@@ -0,0 +1,140 @@
+#include "NumericProgram.h"
+#include "expression.h"
+#include "context.h"
+
+#include <cmath>
+
+std::unique_ptr<NumericProgram> NumericProgram::compile(const BinaryOp &expr)
+{
+	std::unique_ptr<NumericProgram> program(new NumericProgram);
+	switch (expr.op) {
+	case BinaryOp::Op::Less:
+	case BinaryOp::Op::LessEqual:
+	case BinaryOp::Op::Greater:
+	case BinaryOp::Op::GreaterEqual:
+	case BinaryOp::Op::Equal:
+	case BinaryOp::Op::NotEqual:
+		// A comparison yields a bool, so it can only be the last instruction
+		if (!program->append(expr.left.get(), 0) || !program->append(expr.right.get(), 1)) return nullptr;
+		program->push(expr.op == BinaryOp::Op::Less ? Op::Less :
+									expr.op == BinaryOp::Op::LessEqual ? Op::LessEqual :
+									expr.op == BinaryOp::Op::Greater ? Op::Greater :
+									expr.op == BinaryOp::Op::GreaterEqual ? Op::GreaterEqual :
+									expr.op == BinaryOp::Op::Equal ? Op::Equal : Op::NotEqual);
+		program->operations++;
+		break;
+	default:
+		if (!program->append(&expr, 0)) return nullptr;
+	}
+	// With a single operation, the tree allocates no more than we do
+	if (program->operations < 2) return nullptr;
+	return program;
+}
+
+/*!
+	Appends the code for expr, which is evaluated with depth values on the
+	stack already. Returns false if expr can't be compiled.
+*/
+bool NumericProgram::append(const Expression *expr, size_t depth)
+{
+	if (depth >= MAX_DEPTH) return false;
+
+	if (expr->isConstant()) {
+		const ValuePtr &value = expr->constantValue();
+		if (value->type() != Value::ValueType::NUMBER) return false;
+		push(Op::Constant, value->toDouble());
+		return true;
+	}
+	if (auto lookup = dynamic_cast<const Lookup *>(expr)) {
+		push(Op::Variable, 0, &lookup->name);
+		return true;
+	}
+	if (auto unary = dynamic_cast<const UnaryOp *>(expr)) {
+		if (unary->op != UnaryOp::Op::Negate || !append(unary->expr.get(), depth)) return false;
+		push(Op::Negate);
+		this->operations++;
+		return true;
+	}
+	if (auto binary = dynamic_cast<const BinaryOp *>(expr)) {
+		Op op;
+		switch (binary->op) {
+		case BinaryOp::Op::Plus: op = Op::Add; break;
+		case BinaryOp::Op::Minus: op = Op::Subtract; break;
+		case BinaryOp::Op::Multiply: op = Op::Multiply; break;
+		case BinaryOp::Op::Divide: op = Op::Divide; break;
+		case BinaryOp::Op::Modulo: op = Op::Modulo; break;
+		default: return false;
+		}
+		if (!append(binary->left.get(), depth) || !append(binary->right.get(), depth + 1)) return false;
+		push(op);
+		this->operations++;
+		return true;
+	}
+	return false;
+}
+
+/*!
+	Evaluates the program into result. Returns false, leaving result
+	unchanged, if a variable isn't a number.
+*/
+bool NumericProgram::evaluate(const Context *context, ValuePtr &result) const
+{
+	double stack[MAX_DEPTH];
+	size_t top = 0;
+	for (const auto &ins : this->code) {
+		switch (ins.op) {
+		case Op::Constant:
+			stack[top++] = ins.value;
+			break;
+		case Op::Variable: {
+			ValuePtr v = context->lookup_variable(*ins.name, true);
+			if (v->type() != Value::ValueType::NUMBER) return false;
+			stack[top++] = v->toDouble();
+			break;
+		}
+		case Op::Negate:
+			stack[top - 1] = -stack[top - 1];
+			break;
+		case Op::Add:
+			--top;
+			stack[top - 1] += stack[top];
+			break;
+		case Op::Subtract:
+			--top;
+			stack[top - 1] -= stack[top];
+			break;
+		case Op::Multiply:
+			--top;
+			stack[top - 1] *= stack[top];
+			break;
+		case Op::Divide:
+			--top;
+			stack[top - 1] /= stack[top];
+			break;
+		case Op::Modulo:
+			--top;
+			stack[top - 1] = fmod(stack[top - 1], stack[top]);
+			break;
+		case Op::Less:
+			result = ValuePtr(stack[0] < stack[1]);
+			return true;
+		case Op::LessEqual:
+			result = ValuePtr(stack[0] <= stack[1]);
+			return true;
+		case Op::Greater:
+			result = ValuePtr(stack[0] > stack[1]);
+			return true;
+		case Op::GreaterEqual:
+			result = ValuePtr(stack[0] >= stack[1]);
+			return true;
+		case Op::Equal:
+			result = ValuePtr(stack[0] == stack[1]);
+			return true;
+		case Op::NotEqual:
+			result = ValuePtr(stack[0] != stack[1]);
+			return true;
+		}
+	}
+	result = ValuePtr(stack[0]);
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "value.h"
+
+class BinaryOp;
+class Context;
+class Expression;
+class VariableName;
+
+/*!
+	An arithmetic expression compiled to a compact postfix program, which is
+	evaluated on unboxed doubles.
+
+	Only trees of numeric literals, variables, unary minus and the operators
+	+ - * / % are compiled, optionally below one comparison at the root.
+	Evaluating the tree node by node allocates a Value for every
+	intermediate result; the program only allocates the final one.
+
+	evaluate() fails if a variable isn't a number, in which case the caller
+	evaluates the expression tree instead. As the program is free of side
+	effects (variables are looked up silently), this is always safe.
+*/
+class NumericProgram
+{
+public:
+	static std::unique_ptr<NumericProgram> compile(const BinaryOp &expr);
+	bool evaluate(const Context *context, ValuePtr &result) const;
+
+private:
+	enum class Op : unsigned char {
+		Constant, Variable, Negate, Add, Subtract, Multiply, Divide, Modulo,
+		Less, LessEqual, Greater, GreaterEqual, Equal, NotEqual
+	};
+
+	struct Instruction {
+		Op op;
+		double value;
+		const VariableName *name;
+	};
+
+	// Deeper programs are left to the expression tree
+	static const size_t MAX_DEPTH = 16;
+
+	bool append(const Expression *expr, size_t depth);
+	void push(Op op, double value = 0, const VariableName *name = nullptr) {
+		this->code.push_back(Instruction{op, value, name});
+	}
+
+	std::vector<Instruction> code;
+	size_t operations = 0;
+};
@@ -29,6 +29,114 @@
 #include "printutils.h"
 #include "PlatformUtils.h"
 
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <QUuid>
+
+namespace {
+	/*!
+		The multipart/form-data body of a file upload, as a sequential device
+		whose file contents are exported on a worker thread while the network
+		reads what has been produced so far. Nothing is written to disk.
+	*/
+	class ExportUploadDevice : public QIODevice
+	{
+	public:
+		ExportUploadDevice(const shared_ptr<const Geometry> &geom, FileFormat format, const QString &fileName, QObject *parent)
+			: QIODevice(parent), boundary(QUuid::createUuid().toString().mid(1, 36).toLatin1()), finished(false) {
+			open(QIODevice::ReadOnly);
+			push("--" + boundary + "\r\n"
+					 "Content-Disposition: form-data; name=\"file\"; filename=\"" + fileName.toUtf8() + "\"\r\n"
+					 "Content-Type: application/octet-stream\r\n\r\n");
+			this->worker = std::thread([this, geom, format, fileName]() {
+				Sink sink(*this);
+				std::ostream output(&sink);
+				exportFile(geom, output, format, fileName.toStdString());
+				output.flush();
+				push("\r\n--" + boundary + "--\r\n");
+				{
+					std::lock_guard<std::mutex> lock(this->mutex);
+					this->finished = true;
+				}
+				emit readChannelFinished();
+			});
+		}
+		~ExportUploadDevice() { this->worker.join(); }
+
+		QByteArray contentType() const { return "multipart/form-data; boundary=" + this->boundary; }
+
+		bool isSequential() const override { return true; }
+		qint64 bytesAvailable() const override {
+			qint64 n;
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				n = this->pending.size();
+			}
+			return n + QIODevice::bytesAvailable();
+		}
+		bool atEnd() const override {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				if (!this->finished || !this->pending.isEmpty()) return false;
+			}
+			// Calls bytesAvailable()
+			return QIODevice::atEnd();
+		}
+
+	protected:
+		qint64 readData(char *data, qint64 maxSize) override {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			const qint64 n = std::min(maxSize, qint64(this->pending.size()));
+			if (n == 0 && this->finished) return -1;
+			memcpy(data, this->pending.constData(), n);
+			this->pending.remove(0, n);
+			return n;
+		}
+		qint64 writeData(const char *, qint64) override { return -1; }
+
+	private:
+		// Hands the exported bytes to the device in blocks
+		class Sink : public std::streambuf
+		{
+		public:
+			explicit Sink(ExportUploadDevice &device) : device(device) { setp(this->buffer, this->buffer + sizeof(this->buffer)); }
+		protected:
+			int overflow(int c) override {
+				sync();
+				if (c != traits_type::eof()) sputc(traits_type::to_char_type(c));
+				return traits_type::not_eof(c);
+			}
+			int sync() override {
+				if (pptr() > pbase()) this->device.push(QByteArray(pbase(), int(pptr() - pbase())));
+				setp(this->buffer, this->buffer + sizeof(this->buffer));
+				return 0;
+			}
+		private:
+			ExportUploadDevice &device;
+			char buffer[64 * 1024];
+		};
+
+		void push(const QByteArray &data) {
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				this->pending.append(data);
+			}
+			// Queued to the thread reading the device
+			emit readyRead();
+		}
+
+		const QByteArray boundary;
+		mutable std::mutex mutex;
+		QByteArray pending;
+		bool finished;
+		std::thread worker;
+	};
+}
+
 OctoPrint::OctoPrint()
 {
 }
@@ -110,29 +218,22 @@ const std::pair<const QString, const QString> OctoPrint::getVersion() const
 	return result;
 }
 
-const QString OctoPrint::upload(const QString exportFileName, const QString fileName, network_progress_func_t progress_func) const {
-
-	QHttpMultiPart *multiPart = new QHttpMultiPart(QHttpMultiPart::FormDataType);
-	QHttpPart filePart;
-	filePart.setHeader(QNetworkRequest::ContentDispositionHeader, QVariant{"form-data; name=\"file\"; filename=\"" + fileName + "\""});
-	filePart.setHeader(QNetworkRequest::ContentTypeHeader, QVariant{"application/octet-stream"});
-
-	QFile *file = new QFile(exportFileName, multiPart);
-	file->open(QIODevice::ReadOnly);
-	filePart.setBodyDevice(file);
+const QString OctoPrint::upload(const shared_ptr<const Geometry> &geom, FileFormat format, const QString fileName, network_progress_func_t progress_func) const {
 
-	multiPart->append(filePart);
+	// Exported while it's being sent
+	auto device = new ExportUploadDevice(geom, format, fileName, nullptr);
 
 	auto networkRequest = NetworkRequest<const QString>{QUrl{url() + "/files/local"}, { 200, 201 }, 180};
 	networkRequest.set_progress_func(progress_func);
 	return networkRequest.execute(
 			[&](QNetworkRequest& request) {
 				request.setHeader(QNetworkRequest::UserAgentHeader, QString::fromStdString(PlatformUtils::user_agent()));
+				request.setHeader(QNetworkRequest::ContentTypeHeader, device->contentType());
 				request.setRawHeader(QByteArray{"X-Api-Key"}, QByteArray{apiKey().c_str()});
 			},
 			[&](QNetworkAccessManager& nam, QNetworkRequest& request) {
-				const auto reply = nam.post(request, multiPart);
-			    multiPart->setParent(reply);
+				const auto reply = nam.post(request, device);
+				device->setParent(reply);
 				return reply;
 			},
 			[](QNetworkReply *reply) -> const QString {
@@ -55,6 +55,8 @@ struct NetworkException
 #include <QJsonDocument>
 
 #include "Network.h"
+#include "export.h"
+#include "memory.h"
 
 class OctoPrint
 {
@@ -67,7 +69,8 @@ public:
 	const std::pair<const QString, const QString> getVersion() const;
 	const std::vector<std::pair<const QString, const QString>> getSlicers() const;
 	const std::vector<std::pair<const QString, const QString>> getProfiles(const QString slicer) const;
-	const QString upload(const QString exportFileName, const QString fileName, network_progress_func_t progress_func) const;
+	// Exports geom in the given format while uploading it as fileName
+	const QString upload(const shared_ptr<const class Geometry> &geom, FileFormat format, const QString fileName, network_progress_func_t progress_func) const;
 	void slice(const QString fileUrl, const QString slicer, const QString profile, const bool select, const bool print) const;
 
 private:
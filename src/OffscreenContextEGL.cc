@@ -0,0 +1,216 @@
+/*
+
+Create an OpenGL context without any window system, using EGL. For Linux
+render servers without an X server.
+
+The context has no surface at all: drawing goes to the FBO like with the
+other backends. A GPU is used through EGL_EXT_platform_device if there is
+one. Otherwise the surfaceless Mesa platform is used, which falls back to
+Mesa's software rasterizer (llvmpipe/softpipe) where there's no GPU.
+
+See also
+
+https://www.khronos.org/registry/EGL/extensions/EXT/EGL_EXT_platform_device.txt
+https://www.khronos.org/registry/EGL/extensions/MESA/EGL_MESA_platform_surfaceless.txt
+https://www.khronos.org/registry/EGL/extensions/KHR/EGL_KHR_surfaceless_context.txt
+OffscreenContextGLX.cc
+
+*/
+
+#include "OffscreenContext.h"
+#include "printutils.h"
+#include "imageutils.h"
+#include "system-gl.h"
+#include "fbo.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <assert.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+
+#include <sys/utsname.h> // for uname
+
+struct OffscreenContext
+{
+	OffscreenContext(int width, int height) :
+		display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT),
+		width(width), height(height),
+		fbo(nullptr) {}
+	EGLDisplay display;
+	EGLContext context;
+	std::string platform;
+	int width;
+	int height;
+	fbo_t *fbo;
+};
+
+#include "OffscreenContextAll.hpp"
+
+std::string get_os_info()
+{
+	struct utsname u;
+
+	if (uname(&u) < 0) {
+		return STR("OS info: unknown, uname() error\n");
+	}
+	else {
+		return STR("OS info: " << u.sysname << " " << u.release << " " << u.version << "\n" <<
+							 "Machine: " << u.machine);
+	}
+	return "";
+}
+
+std::string offscreen_context_getinfo(OffscreenContext *ctx)
+{
+	assert(ctx);
+
+	if (ctx->display == EGL_NO_DISPLAY) {
+		return std::string("No GL Context initialized. No information to report\n");
+	}
+
+	return STR("GL context creator: EGL (" << ctx->platform << ")\n" <<
+						 "PNG generator: lodepng\n" <<
+						 "EGL version: " << eglQueryString(ctx->display, EGL_VERSION) << "\n" <<
+						 "EGL vendor: " << eglQueryString(ctx->display, EGL_VENDOR) << "\n" <<
+						 get_os_info());
+}
+
+static bool has_extension(const char *extensions, const char *name)
+{
+	if (!extensions) return false;
+	const auto len = strlen(name);
+	for (auto p = strstr(extensions, name); p; p = strstr(p + len, name)) {
+		if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+	}
+	return false;
+}
+
+/*
+   Initializes EGL on the given display and creates and binds a desktop
+   OpenGL context without any surface. This function will alter
+   ctx.display and ctx.context if successful
+ */
+static bool create_egl_context(OffscreenContext &ctx, EGLDisplay display)
+{
+	if (display == EGL_NO_DISPLAY) return false;
+
+	EGLint major, minor;
+	if (!eglInitialize(display, &major, &minor)) return false;
+
+	if (!has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context") ||
+			!eglBindAPI(EGL_OPENGL_API)) {
+		eglTerminate(display);
+		return false;
+	}
+
+	const EGLint attributes[] = {
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24, // depth-stencil for OpenCSG
+		EGL_STENCIL_SIZE, 8,
+		EGL_NONE
+	};
+
+	EGLConfig config;
+	EGLint num_returned = 0;
+	if (!eglChooseConfig(display, attributes, &config, 1, &num_returned) || num_returned == 0) {
+		eglTerminate(display);
+		return false;
+	}
+
+	auto context = eglCreateContext(display, config, EGL_NO_CONTEXT, nullptr);
+	if (context == EGL_NO_CONTEXT) {
+		eglTerminate(display);
+		return false;
+	}
+
+	if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		eglDestroyContext(display, context);
+		eglTerminate(display);
+		return false;
+	}
+
+	ctx.display = display;
+	ctx.context = context;
+	return true;
+}
+
+/*
+   Tries the platforms in order: GPU devices, the surfaceless Mesa
+   platform, and the default display.
+ */
+static bool create_egl_dummy_context(OffscreenContext &ctx)
+{
+	const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+		eglGetProcAddress("eglGetPlatformDisplayEXT"));
+
+	if (getPlatformDisplay && has_extension(client_extensions, "EGL_EXT_platform_device")) {
+		auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(eglGetProcAddress("eglQueryDevicesEXT"));
+		EGLDeviceEXT devices[16];
+		EGLint num_devices = 0;
+		if (queryDevices && queryDevices(16, devices, &num_devices)) {
+			for (EGLint i = 0; i < num_devices; ++i) {
+				if (create_egl_context(ctx, getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, devices[i], nullptr))) {
+					ctx.platform = "device";
+					return true;
+				}
+			}
+		}
+	}
+
+	if (getPlatformDisplay && has_extension(client_extensions, "EGL_MESA_platform_surfaceless")) {
+		if (create_egl_context(ctx, getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr))) {
+			ctx.platform = "surfaceless";
+			return true;
+		}
+	}
+
+	if (create_egl_context(ctx, eglGetDisplay(EGL_DEFAULT_DISPLAY))) {
+		ctx.platform = "default display";
+		return true;
+	}
+
+	std::cerr << "Unable to create an EGL context: error 0x" << std::hex << eglGetError() << std::dec << "\n";
+	return false;
+}
+
+OffscreenContext *create_offscreen_context(int w, int h)
+{
+	auto ctx = new OffscreenContext(w, h);
+
+	// before an FBO can be setup, an EGL context must be created
+	// this call alters ctx->display and ctx->context if successful
+	if (!create_egl_dummy_context(*ctx)) {
+		delete ctx;
+		return nullptr;
+	}
+
+	return create_offscreen_context_common(ctx);
+}
+
+bool teardown_offscreen_context(OffscreenContext *ctx)
+{
+	if (ctx) {
+		fbo_unbind(ctx->fbo);
+		fbo_delete(ctx->fbo);
+		eglMakeCurrent(ctx->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(ctx->display, ctx->context);
+		eglTerminate(ctx->display);
+		return true;
+	}
+	return false;
+}
+
+bool save_framebuffer(OffscreenContext *ctx, std::ostream &output)
+{
+	// There's no surface to swap; the FBO is read directly
+	glFinish();
+	return save_framebuffer_common(ctx, output);
+}
@@ -4,10 +4,15 @@
 #include <stdio.h>
 #include <string.h>
 #include <cstdlib>
+#include <cassert>
 #include <sstream>
 #include "printutils.h"
+#include "imageutils.h"
+#ifndef NULLGL
+#include "VBOCache.h"
+#endif
 
-OffscreenView::OffscreenView(int width, int height)
+OffscreenView::OffscreenView(int width, int height) : width(width), height(height)
 {
   this->ctx = create_offscreen_context(width, height);
   if ( this->ctx == nullptr ) throw -1;
@@ -17,6 +22,14 @@ OffscreenView::OffscreenView(int width, int height)
 
 OffscreenView::~OffscreenView()
 {
+#ifndef NULLGL
+  // The buffers belong to our context
+  VBOCache::instance()->clear();
+  for (const auto &frame : this->frames) {
+    if (frame.pbo) this->freepbos.push_back(frame.pbo);
+  }
+  if (!this->freepbos.empty()) glDeleteBuffers(this->freepbos.size(), this->freepbos.data());
+#endif
   teardown_offscreen_context(this->ctx);
 }
 
@@ -37,6 +50,57 @@ bool OffscreenView::save(std::ostream &output)
   return save_framebuffer(this->ctx, output);
 }
 
+void OffscreenView::readFrame()
+{
+  Frame frame{0, {}};
+  const size_t size = size_t(this->width) * this->height * 4;
+#ifndef NULLGL
+  if (GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object) {
+    if (this->freepbos.empty()) {
+      glGenBuffers(1, &frame.pbo);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, frame.pbo);
+      glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    }
+    else {
+      frame.pbo = this->freepbos.back();
+      this->freepbos.pop_back();
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, frame.pbo);
+    }
+    glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  }
+  else {
+    frame.pixels.resize(size);
+    glReadPixels(0, 0, this->width, this->height, GL_RGBA, GL_UNSIGNED_BYTE, frame.pixels.data());
+  }
+#else
+  frame.pixels.resize(size);
+#endif
+  this->frames.push_back(std::move(frame));
+}
+
+std::vector<unsigned char> OffscreenView::takeFrame()
+{
+  assert(!this->frames.empty());
+  Frame frame = std::move(this->frames.front());
+  this->frames.pop_front();
+  std::vector<unsigned char> pixels(size_t(this->width) * this->height * 4);
+  // Images read from OpenGL buffers are upside-down
+#ifndef NULLGL
+  if (frame.pbo) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, frame.pbo);
+    const auto data = static_cast<const unsigned char *>(glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY));
+    if (data) flip_image(data, pixels.data(), 4, this->width, this->height);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    this->freepbos.push_back(frame.pbo);
+    return pixels;
+  }
+#endif
+  flip_image(frame.pixels.data(), pixels.data(), 4, this->width, this->height);
+  return pixels;
+}
+
 std::string OffscreenView::getRendererInfo() const
 {
   return STR(glew_dump() << offscreen_context_getinfo(this->ctx));
@@ -3,7 +3,9 @@
 #include "OffscreenContext.h"
 #include <Eigen/Core>
 #include <Eigen/Geometry>
+#include <deque>
 #include <string>
+#include <vector>
 #include "system-gl.h"
 #include <iostream>
 #include "GLView.h"
@@ -14,7 +16,15 @@ public:
 	OffscreenView(int width, int height);
 	~OffscreenView();
 	bool save(std::ostream &output);
+	/*!
+		Starts reading the frame, into a pixel buffer object if the GL has
+		them, so the next frame can be drawn before it has arrived.
+		takeFrame() returns the oldest frame read, top row first, in RGBA.
+	*/
+	void readFrame();
+	std::vector<unsigned char> takeFrame();
 	OffscreenContext *ctx;
+	const int width, height;
 
 	// overrides
 	bool save(const char *filename) override;
@@ -22,4 +32,12 @@ public:
 #ifdef ENABLE_OPENCSG
 	void display_opencsg_warning() override;
 #endif
+
+private:
+	struct Frame {
+		GLuint pbo; // 0 if read into pixels
+		std::vector<unsigned char> pixels;
+	};
+	std::deque<Frame> frames;
+	std::vector<GLuint> freepbos;
 };
@@ -28,6 +28,11 @@
 #include "OpenCSGRenderer.h"
 #include "polyset.h"
 #include "csgnode.h"
+#include "LODCache.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
 
 #ifdef ENABLE_OPENCSG
 #include <opencsg.h>
@@ -51,122 +56,344 @@ public:
 
 #endif
 
+namespace {
+	// Products are only occlusion culled in lists at least this long
+	const size_t occlusion_min_products = 16;
+
+	// The convexity given by the model, or for PolySets left at the default
+	// of 1, an estimate from their faces, so the passes of OpenCSG are right
+	// without being slowed down by a convexity chosen large to be safe
+	unsigned int primitiveConvexity(const Geometry &geom)
+	{
+		const unsigned int convexity = geom.getConvexity();
+		if (convexity > 1) return convexity;
+		if (const auto ps = dynamic_cast<const PolySet *>(&geom)) return ps->estimatedConvexity();
+		return convexity;
+	}
+
+	// 2D objects are drawn 1mm thick, differences slightly thicker
+	BoundingBox leafBoundingBox(const CSGLeaf &leaf)
+	{
+		if (leaf.geom->getDimension() != 2) return leaf.getBoundingBox();
+		auto bbox = leaf.geom->getBoundingBox();
+		if (bbox.isEmpty()) return bbox;
+		bbox.min()[2] -= 0.55;
+		bbox.max()[2] += 0.55;
+		return leaf.matrix * bbox;
+	}
+
+#ifdef ENABLE_OPENCSG
+	enum class Visibility { OUTSIDE, INSIDE, CROSSES_NEAR };
+
+	// Tests the box against the view frustum of the clip matrix
+	Visibility frustumTest(const Eigen::Matrix4d &clip, const BoundingBox &bbox)
+	{
+		int outside[6] = {0, 0, 0, 0, 0, 0};
+		bool crossesnear = false;
+		for (int i = 0; i < 8; i++) {
+			const auto corner = bbox.corner(BoundingBox::CornerType(i));
+			const Eigen::Vector4d c = clip * Eigen::Vector4d(corner[0], corner[1], corner[2], 1);
+			for (int axis = 0; axis < 3; axis++) {
+				if (c[axis] < -c[3]) outside[2 * axis]++;
+				if (c[axis] > c[3]) outside[2 * axis + 1]++;
+			}
+			if (c[2] < -c[3]) crossesnear = true;
+		}
+		for (int plane = 0; plane < 6; plane++) {
+			if (outside[plane] == 8) return Visibility::OUTSIDE;
+		}
+		return crossesnear ? Visibility::CROSSES_NEAR : Visibility::INSIDE;
+	}
+
+	void drawBox(const BoundingBox &bbox)
+	{
+		const auto &a = bbox.min(), &b = bbox.max();
+		const double quads[6][4][3] = {
+			{{a[0], a[1], a[2]}, {a[0], b[1], a[2]}, {b[0], b[1], a[2]}, {b[0], a[1], a[2]}},
+			{{a[0], a[1], b[2]}, {b[0], a[1], b[2]}, {b[0], b[1], b[2]}, {a[0], b[1], b[2]}},
+			{{a[0], a[1], a[2]}, {b[0], a[1], a[2]}, {b[0], a[1], b[2]}, {a[0], a[1], b[2]}},
+			{{a[0], b[1], a[2]}, {a[0], b[1], b[2]}, {b[0], b[1], b[2]}, {b[0], b[1], a[2]}},
+			{{a[0], a[1], a[2]}, {a[0], a[1], b[2]}, {a[0], b[1], b[2]}, {a[0], b[1], a[2]}},
+			{{b[0], a[1], a[2]}, {b[0], b[1], a[2]}, {b[0], b[1], b[2]}, {b[0], a[1], b[2]}}
+		};
+		glBegin(GL_QUADS);
+		for (const auto &quad : quads) {
+			for (const auto &v : quad) glVertex3dv(v);
+		}
+		glEnd();
+	}
+#endif
+}
+
 OpenCSGRenderer::OpenCSGRenderer(shared_ptr<CSGProducts> root_products,
 																 shared_ptr<CSGProducts> highlights_products,
 																 shared_ptr<CSGProducts> background_products,
 																 GLint *shaderinfo)
 	: root_products(root_products), 
 		highlights_products(highlights_products), 
-		background_products(background_products), shaderinfo(shaderinfo)
+		background_products(background_products), shaderinfo(shaderinfo),
+		last_clip(Eigen::Matrix4d::Zero()), refine_spent(0), refined(true)
+{
+	prepareProducts(root_products.get(), this->root_list);
+	prepareProducts(highlights_products.get(), this->highlights_list);
+	prepareProducts(background_products.get(), this->background_list);
+}
+
+/*!
+	Collects the bounding box of each product, which is the intersection of
+	the boxes of its intersections, and the subtractions overlapping it. The
+	others can't cut anything away, nor be seen, so they're never drawn. Nor
+	are products with an empty box.
+*/
+void OpenCSGRenderer::prepareProducts(const CSGProducts *products, ProductList &list)
 {
+	if (!products) return;
+	list.products.reserve(products->products.size());
+	for (const auto &product : products->products) {
+		ProductInfo info;
+		info.product = &product;
+		info.visible = true;
+		info.refined = false;
+		bool first = true;
+		for (const auto &csgobj : product.intersections) {
+			if (!csgobj.leaf->geom) continue;
+			const auto bbox = leafBoundingBox(*csgobj.leaf);
+			info.bbox = first ? bbox : info.bbox.intersection(bbox);
+			first = false;
+			const auto &c = csgobj.leaf->color;
+			if (c[3] >= 0 && c[3] < 1) list.opaque = false;
+		}
+		if (info.bbox.isEmpty()) continue;
+		for (const auto &csgobj : product.subtractions) {
+			if (csgobj.leaf->geom && info.bbox.intersects(leafBoundingBox(*csgobj.leaf))) {
+				info.subtractions.push_back(&csgobj);
+			}
+		}
+		list.products.push_back(info);
+	}
 }
 
 void OpenCSGRenderer::draw(bool /*showfaces*/, bool showedges) const
 {
+	TRACE_ZONE("OpenCSGRenderer::draw");
 	GLint *shaderinfo = this->shaderinfo;
 	if (!shaderinfo[0]) shaderinfo = nullptr;
+
+	Eigen::Matrix4d projection, modelview;
+	glGetDoublev(GL_PROJECTION_MATRIX, projection.data());
+	glGetDoublev(GL_MODELVIEW_MATRIX, modelview.data());
+	const Eigen::Matrix4d clip = projection * modelview;
+	if (clip != this->last_clip) {
+		// Refining starts over from the coarse view
+		this->last_clip = clip;
+		for (auto list : {&this->root_list, &this->background_list, &this->highlights_list}) {
+			for (auto &info : list->products) info.refined = false;
+		}
+	}
+	this->refine_spent = 0;
+	this->refined = true;
+
 	if (this->root_products) {
-		renderCSGProducts(*this->root_products, showedges ? shaderinfo : nullptr, false, false);
+		renderCSGProducts(this->root_list, showedges ? shaderinfo : nullptr, false, false);
 	}
 	if (this->background_products) {
-		renderCSGProducts(*this->background_products, showedges ? shaderinfo : nullptr, false, true);
+		renderCSGProducts(this->background_list, showedges ? shaderinfo : nullptr, false, true);
 	}
 	if (this->highlights_products) {
-		renderCSGProducts(*this->highlights_products, showedges ? shaderinfo : nullptr, true, false);
+		renderCSGProducts(this->highlights_list, showedges ? shaderinfo : nullptr, true, false);
 	}
 }
 
 // Primitive for rendering using OpenCSG
 OpenCSGPrim *OpenCSGRenderer::createCSGPrimitive(const CSGChainObject &csgobj, OpenCSG::Operation operation, bool highlight_mode, bool background_mode, OpenSCADOperator type) const
 {
-	OpenCSGPrim *prim = new OpenCSGPrim(operation, csgobj.leaf->geom->getConvexity());
+	OpenCSGPrim *prim = new OpenCSGPrim(operation, primitiveConvexity(*csgobj.leaf->geom));
 	prim->geom = csgobj.leaf->geom;
 	prim->m = csgobj.leaf->matrix;
     prim->csgmode = get_csgmode(highlight_mode, background_mode, type);
 	return prim;
 }
 
-void OpenCSGRenderer::renderCSGProducts(const CSGProducts &products, GLint *shaderinfo, 
+/*!
+	Draws the products inside the view frustum. Opaque lists are also
+	occlusion culled: the products which were visible in the last frame are
+	drawn front to back, then the boxes of all products are tested against
+	the depth buffer in one batch of occlusion queries. Those which turn out
+	to be visible now are drawn too, and the results are kept for the next
+	frame.
+*/
+void OpenCSGRenderer::renderCSGProducts(ProductList &list, GLint *shaderinfo,
 										bool highlight_mode, bool background_mode) const
 {
 #ifdef ENABLE_OPENCSG
-	for(const auto &product : products.products) {
-		std::vector<OpenCSG::Primitive*> primitives;
-		for(const auto &csgobj : product.intersections) {
-			if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Intersection, highlight_mode, background_mode, OpenSCADOperator::INTERSECTION));
+	Eigen::Matrix4d projection, modelview;
+	glGetDoublev(GL_PROJECTION_MATRIX, projection.data());
+	glGetDoublev(GL_MODELVIEW_MATRIX, modelview.data());
+	const Eigen::Matrix4d clip = projection * modelview;
+
+	const bool occlusion = list.opaque && list.products.size() >= occlusion_min_products && GLEW_VERSION_1_5;
+	std::vector<std::pair<double, ProductInfo *>> queried;
+	for (auto &info : list.products) {
+		auto visibility = frustumTest(clip, info.bbox);
+		if (visibility == Visibility::OUTSIDE) continue;
+		if (!occlusion) {
+			renderCSGProduct(info, shaderinfo, highlight_mode, background_mode);
 		}
-		for(const auto &csgobj : product.subtractions) {
-			if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Subtraction, highlight_mode, background_mode, OpenSCADOperator::DIFFERENCE));
+		else if (visibility == Visibility::CROSSES_NEAR) {
+			// The box would be clipped, so it can't be tested
+			info.visible = true;
+			renderCSGProduct(info, shaderinfo, highlight_mode, background_mode);
 		}
-		if (primitives.size() > 1) {
-			OpenCSG::render(primitives);
-			glDepthFunc(GL_EQUAL);
+		else {
+			const Eigen::Vector3d center = info.bbox.center();
+			const double depth = -(modelview * Eigen::Vector4d(center[0], center[1], center[2], 1))[2];
+			queried.emplace_back(depth, &info);
 		}
-		if (shaderinfo) glUseProgram(shaderinfo[0]);
-
-		for(const auto &csgobj : product.intersections) {
-			const Color4f &c = csgobj.leaf->color;
-				csgmode_e csgmode = get_csgmode(highlight_mode, background_mode);
-			
-			ColorMode colormode = ColorMode::NONE;
-			if (highlight_mode) {
-				colormode = ColorMode::HIGHLIGHT;
-			} else if (background_mode) {
-				colormode = ColorMode::BACKGROUND;
-			} else {
-				colormode = ColorMode::MATERIAL;
-			}
-			
-			glPushMatrix();
-			glMultMatrixd(csgobj.leaf->matrix.data());
-			
-			const Color4f c1 = setColor(colormode, c.data(), shaderinfo);
-			if (c1[3] == 1.0f) {
-				// object is opaque, draw normally
-				render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
-			} else {
-				// object is transparent, so draw rear faces first.  Issue #1496
-				glEnable(GL_CULL_FACE);
-				glCullFace(GL_FRONT);
-				render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
-				glCullFace(GL_BACK);
-				render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
-				glDisable(GL_CULL_FACE);
-			}
+	}
+	if (queried.empty()) return;
 
-			glPopMatrix();
+	std::sort(queried.begin(), queried.end(), [](const std::pair<double, ProductInfo *> &a, const std::pair<double, ProductInfo *> &b) {
+		return a.first < b.first;
+	});
+	for (const auto &q : queried) {
+		if (q.second->visible) renderCSGProduct(*q.second, shaderinfo, highlight_mode, background_mode);
+	}
+
+	std::vector<GLuint> queries(queried.size());
+	glGenQueries(GLsizei(queries.size()), queries.data());
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	for (size_t i = 0; i < queried.size(); i++) {
+		glBeginQuery(GL_SAMPLES_PASSED, queries[i]);
+		drawBox(queried[i].second->bbox);
+		glEndQuery(GL_SAMPLES_PASSED);
+	}
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+	for (size_t i = 0; i < queried.size(); i++) {
+		GLuint samples = 0;
+		glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &samples);
+		auto &info = *queried[i].second;
+		const bool drawn = info.visible;
+		info.visible = samples > 0;
+		if (info.visible && !drawn) renderCSGProduct(info, shaderinfo, highlight_mode, background_mode);
+	}
+	glDeleteQueries(GLsizei(queries.size()), queries.data());
+#endif
+}
+
+/*!
+	Draws one product. Over the refine budget, products which haven't been
+	drawn in full yet are drawn coarsely instead: their intersections only,
+	in the coarse versions of the LODCache. While the view is dragged, the
+	LODCache is active anyway and nothing counts as refined.
+*/
+void OpenCSGRenderer::renderCSGProduct(ProductInfo &info, GLint *shaderinfo,
+										bool highlight_mode, bool background_mode) const
+{
+#ifdef ENABLE_OPENCSG
+	const bool progressive = this->refine_budget > 0 && !info.refined && !LODCache::isActive();
+	const bool coarse = progressive && this->refine_spent >= this->refine_budget;
+	const auto start = std::chrono::steady_clock::now();
+	if (coarse) {
+		LODCache::setActive(true);
+		this->refined = false;
+	}
+
+	const auto &product = *info.product;
+	static const std::vector<const CSGChainObject *> nosubtractions;
+	const auto &subtractions = coarse ? nosubtractions : info.subtractions;
+	std::vector<OpenCSG::Primitive*> primitives;
+	for(const auto &csgobj : product.intersections) {
+		if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Intersection, highlight_mode, background_mode, OpenSCADOperator::INTERSECTION));
+	}
+	for(const auto csgobj : subtractions) {
+		primitives.push_back(createCSGPrimitive(*csgobj, OpenCSG::Subtraction, highlight_mode, background_mode, OpenSCADOperator::DIFFERENCE));
+	}
+	if (primitives.size() > 1) {
+		OpenCSG::render(primitives);
+		glDepthFunc(GL_EQUAL);
+	}
+	if (shaderinfo) glUseProgram(shaderinfo[0]);
+
+	for(const auto &csgobj : product.intersections) {
+		const Color4f &c = csgobj.leaf->color;
+			csgmode_e csgmode = get_csgmode(highlight_mode, background_mode);
+		
+		ColorMode colormode = ColorMode::NONE;
+		if (highlight_mode) {
+			colormode = ColorMode::HIGHLIGHT;
+		} else if (background_mode) {
+			colormode = ColorMode::BACKGROUND;
+		} else {
+			colormode = ColorMode::MATERIAL;
 		}
-		for(const auto &csgobj : product.subtractions) {
-			const Color4f &c = csgobj.leaf->color;
-				csgmode_e csgmode = get_csgmode(highlight_mode, background_mode, OpenSCADOperator::DIFFERENCE);
-			
-			ColorMode colormode = ColorMode::NONE;
-			if (highlight_mode) {
-				colormode = ColorMode::HIGHLIGHT;
-			} else if (background_mode) {
-				colormode = ColorMode::BACKGROUND;
-			} else {
-				colormode = ColorMode::CUTOUT;
-			}
-			
-			setColor(colormode, c.data(), shaderinfo);
-			glPushMatrix();
-			glMultMatrixd(csgobj.leaf->matrix.data());
-			// negative objects should only render rear faces
+		
+		glPushMatrix();
+		glMultMatrixd(csgobj.leaf->matrix.data());
+		
+		const Color4f c1 = setColor(colormode, c.data(), shaderinfo);
+		if (c1[3] == 1.0f) {
+			// object is opaque, draw normally
+			render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
+		} else {
+			// object is transparent, so draw rear faces first.  Issue #1496
 			glEnable(GL_CULL_FACE);
 			glCullFace(GL_FRONT);
 			render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
+			glCullFace(GL_BACK);
+			render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
 			glDisable(GL_CULL_FACE);
-			glPopMatrix();
 		}
 
-		if (shaderinfo) glUseProgram(0);
-		for(auto &p : primitives) delete p;
-		glDepthFunc(GL_LEQUAL);
+		glPopMatrix();
+	}
+	for(const auto csgobj : subtractions) {
+		const Color4f &c = csgobj->leaf->color;
+			csgmode_e csgmode = get_csgmode(highlight_mode, background_mode, OpenSCADOperator::DIFFERENCE);
+		
+		ColorMode colormode = ColorMode::NONE;
+		if (highlight_mode) {
+			colormode = ColorMode::HIGHLIGHT;
+		} else if (background_mode) {
+			colormode = ColorMode::BACKGROUND;
+		} else {
+			colormode = ColorMode::CUTOUT;
+		}
+		
+		setColor(colormode, c.data(), shaderinfo);
+		glPushMatrix();
+		glMultMatrixd(csgobj->leaf->matrix.data());
+		// negative objects should only render rear faces
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		render_surface(csgobj->leaf->geom, csgmode, csgobj->leaf->matrix, shaderinfo);
+		glDisable(GL_CULL_FACE);
+		glPopMatrix();
+	}
+
+	if (shaderinfo) glUseProgram(0);
+	for(auto &p : primitives) delete p;
+	glDepthFunc(GL_LEQUAL);
+
+	if (coarse) {
+		LODCache::setActive(false);
+	}
+	else if (progressive) {
+		this->refine_spent += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		info.refined = true;
 	}
 #endif
 }
 
+void OpenCSGRenderer::drawIds(std::vector<shared_ptr<const CSGLeaf>> &leaves) const
+{
+	if (this->root_products) draw_ids(*this->root_products, false, false, leaves);
+	if (this->background_products) draw_ids(*this->background_products, false, true, leaves);
+	if (this->highlights_products) draw_ids(*this->highlights_products, true, false, leaves);
+}
+
 BoundingBox OpenCSGRenderer::getBoundingBox() const
 {
 	BoundingBox bbox;
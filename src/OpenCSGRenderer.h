@@ -10,19 +10,47 @@
 class OpenCSGRenderer : public Renderer
 {
 public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 	OpenCSGRenderer(shared_ptr<class CSGProducts> root_products,
 									shared_ptr<CSGProducts> highlights_products,
 									shared_ptr<CSGProducts> background_products,
 									GLint *shaderinfo);
 	void draw(bool showfaces, bool showedges) const override;
 	BoundingBox getBoundingBox() const override;
+	void drawIds(std::vector<shared_ptr<const CSGLeaf>> &leaves) const override;
+	bool isRefined() const override { return this->refined; }
 private:
+	// A product as drawn, prepared once for culling it in each frame
+	struct ProductInfo {
+		const CSGProduct *product;
+		BoundingBox bbox; // Of the intersections
+		std::vector<const CSGChainObject *> subtractions; // Only those overlapping bbox
+		bool visible; // Result of the last occlusion query
+		bool refined; // Drawn in full since the camera last changed
+	};
+	struct ProductList {
+		std::vector<ProductInfo> products;
+		bool opaque = true;
+	};
+
+	static void prepareProducts(const CSGProducts *products, ProductList &list);
 #ifdef ENABLE_OPENCSG
 	class OpenCSGPrim *createCSGPrimitive(const class CSGChainObject &csgobj, OpenCSG::Operation operation, bool highlight_mode, bool background_mode, OpenSCADOperator type) const;
 #endif
-	void renderCSGProducts(const class CSGProducts &products, GLint *shaderinfo, 
+	void renderCSGProducts(ProductList &list, GLint *shaderinfo,
+											bool highlight_mode, bool background_mode) const;
+	void renderCSGProduct(ProductInfo &info, GLint *shaderinfo,
 											bool highlight_mode, bool background_mode) const;
 
+	mutable ProductList root_list;
+	mutable ProductList highlights_list;
+	mutable ProductList background_list;
+
+	// Progressive drawing, see Renderer::setRefineBudget()
+	mutable Eigen::Matrix4d last_clip; // Camera of the last frame
+	mutable double refine_spent; // Seconds spent refining in this frame
+	mutable bool refined;
+
 	shared_ptr<CSGProducts> root_products;
 	shared_ptr<CSGProducts> highlights_products;
 	shared_ptr<CSGProducts> background_products;
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "NumberFormat.h"
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/*!
+	Collects output in a memory buffer which is written to the stream in
+	large blocks, so exporters can format in place instead of through the
+	stream and temporary strings. Output is only complete after flush().
+*/
+class OutputBuffer
+{
+public:
+	static const size_t size = 1024 * 1024;
+
+	OutputBuffer(std::ostream &output) : output(output), data(new char[size]), pos(0) {}
+
+	// Returns room for n bytes, n must not exceed size
+	char *claim(size_t n) {
+		if (this->pos + n > size) flush();
+		char *p = this->data.get() + this->pos;
+		this->pos += n;
+		return p;
+	}
+	void append(const char *s, size_t n) { memcpy(claim(n), s, n); }
+	void append(const char *s) { append(s, strlen(s)); }
+	void append(const std::string &s) { append(s.data(), s.size()); }
+	void append(char c) { *claim(1) = c; }
+	// Appends x with the given number of significant digits, see NumberFormat
+	void appendNumber(double x, int digits) {
+		if (this->pos + NumberFormat::maxlength > size) flush();
+		this->pos += NumberFormat::format(x, digits, this->data.get() + this->pos);
+	}
+	// Appends the n numbers at x separated by separator, n must not exceed size / NumberFormat::maxlength
+	void appendNumbers(const double *x, size_t n, int digits, char separator) {
+		if (this->pos + n * NumberFormat::maxlength > size) flush();
+		this->pos += NumberFormat::format(x, n, digits, separator, this->data.get() + this->pos);
+	}
+	void flush() {
+		this->output.write(this->data.get(), this->pos);
+		this->pos = 0;
+	}
+
+private:
+	std::ostream &output;
+	std::unique_ptr<char[]> data;
+	size_t pos;
+};
@@ -1,6 +1,9 @@
 #include "PlatformUtils.h"
 #include <sys/types.h>
 #include <sys/sysctl.h>
+#include <sys/resource.h>
+#include <mach/mach.h>
+#include <time.h>
 #include <boost/lexical_cast.hpp>
 
 #import <Foundation/Foundation.h>
@@ -98,5 +101,36 @@ const std::string PlatformUtils::sysinfo(bool extended)
   return result;
 }
 
+uint64_t PlatformUtils::physicalMemory()
+{
+  int64_t physical_memory = 0;
+  size_t length64 = sizeof(int64_t);
+  if (sysctlbyname("hw.memsize", &physical_memory, &length64, nullptr, 0) != 0) return 0;
+  return physical_memory;
+}
+
+uint64_t PlatformUtils::residentMemory()
+{
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
+  return info.resident_size;
+}
+
+uint64_t PlatformUtils::peakMemory()
+{
+  // In bytes, unlike on Linux
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return uint64_t(usage.ru_maxrss);
+}
+
+double PlatformUtils::threadCPUTime()
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 void PlatformUtils::ensureStdIO(void) {}
 
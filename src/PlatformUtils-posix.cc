@@ -2,6 +2,8 @@
 #include <string>
 #include <fstream>
 #include <streambuf>
+#include <sstream>
+#include <ctime>
 #include <unistd.h>
 #include <sys/resource.h>
 #include <sys/utsname.h>
@@ -273,4 +275,53 @@ const std::string PlatformUtils::sysinfo(bool extended)
 	return result;
 }
 
+uint64_t PlatformUtils::physicalMemory()
+{
+	uint64_t memory = 0;
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pagesize = sysconf(_SC_PAGE_SIZE);
+	if ((pages > 0) && (pagesize > 0)) memory = uint64_t(pages) * pagesize;
+
+	// The memory limit of the cgroup (v2, then v1), "max" if there is none
+	for (const auto &path : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"}) {
+		const auto text = readText(path);
+		try {
+			const auto limit = boost::lexical_cast<uint64_t>(boost::trim_copy(text));
+			if (limit > 0 && (memory == 0 || limit < memory)) memory = limit;
+			break;
+		} catch (const boost::bad_lexical_cast &) {
+		}
+	}
+	return memory;
+}
+
+uint64_t PlatformUtils::residentMemory()
+{
+	// The second field is the resident set in pages
+	std::istringstream statm(readText("/proc/self/statm"));
+	uint64_t size, resident;
+	long pagesize = sysconf(_SC_PAGE_SIZE);
+	if ((statm >> size >> resident) && pagesize > 0) return resident * pagesize;
+
+	// Lacking /proc, the peak is the closest
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return uint64_t(usage.ru_maxrss) * 1024;
+}
+
+uint64_t PlatformUtils::peakMemory()
+{
+	// In kilobytes
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return uint64_t(usage.ru_maxrss) * 1024;
+}
+
+double PlatformUtils::threadCPUTime()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 void PlatformUtils::ensureStdIO(void) {}
@@ -15,6 +15,7 @@
 #define __IPreviewHandlerVisuals_INTERFACE_DEFINED__
 #define __IVisualProperties_INTERFACE_DEFINED__
 #include <shlobj.h>
+#include <psapi.h>
 
 #include "version.h"
 
@@ -189,6 +190,37 @@ const std::string PlatformUtils::sysinfo(bool extended)
 	return result;
 }
 
+uint64_t PlatformUtils::physicalMemory()
+{
+	MEMORYSTATUSEX memoryinfo;
+	memoryinfo.dwLength = sizeof(memoryinfo);
+	if (GlobalMemoryStatusEx(&memoryinfo) == 0) return 0;
+	return memoryinfo.ullTotalPhys;
+}
+
+uint64_t PlatformUtils::residentMemory()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize;
+}
+
+uint64_t PlatformUtils::peakMemory()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+}
+
+double PlatformUtils::threadCPUTime()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) return 0;
+	// In units of 100 ns
+	auto ticks = [](const FILETIME &t) { return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+	return (ticks(kernel) + ticks(user)) * 1e-7;
+}
+
 #include <io.h>
 #include <stdio.h>
 #include <fstream>
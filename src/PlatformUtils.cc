@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <iomanip>
+#include <mutex>
 
 #include "PlatformUtils.h"
 #include "boosty.h"
@@ -16,7 +17,9 @@ extern std::vector<std::string> fontpath;
 namespace {
 	bool path_initialized = false;
 	std::string applicationpath;
+	// Looked up on first use, as runs which need no resources are common
 	std::string resourcespath;
+	std::once_flag resourcespath_once;
 }
 
 const char *PlatformUtils::OPENSCAD_FOLDER_NAME = "OpenSCAD";
@@ -78,7 +81,6 @@ static std::string lookupResourcesPath()
 void PlatformUtils::registerApplicationPath(const std::string &apppath)
 {
 	applicationpath = apppath;
-	resourcespath = lookupResourcesPath();
 	path_initialized = true;
 }
 
@@ -172,6 +174,7 @@ std::string PlatformUtils::resourceBasePath()
 	if (!path_initialized) {
 	    throw std::runtime_error("PlatformUtils::resourcesPath(): application path not initialized!");
 	}
+	std::call_once(resourcespath_once, []() { resourcespath = lookupResourcesPath(); });
 	return resourcespath;
 }
 
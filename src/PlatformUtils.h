@@ -105,6 +105,36 @@ namespace PlatformUtils {
 	 */
 	std::string pathSeparatorChar();
 	
+	/**
+	 * The physical memory available to this process in bytes: the RAM of
+	 * the system, or less where a limit is set (e.g. for a container).
+	 *
+	 * @return memory in bytes, or 0 if unknown.
+	 */
+	uint64_t physicalMemory();
+
+	/**
+	 * The physical memory this process currently uses in bytes, its
+	 * resident set.
+	 *
+	 * @return memory in bytes, or 0 if unknown.
+	 */
+	uint64_t residentMemory();
+
+	/**
+	 * The most physical memory this process has used so far in bytes.
+	 *
+	 * @return memory in bytes, or 0 if unknown.
+	 */
+	uint64_t peakMemory();
+
+	/**
+	 * The CPU time the calling thread has used in seconds.
+	 *
+	 * @return time in seconds, or 0 if unknown.
+	 */
+	double threadCPUTime();
+
 	/* Provide stdout/stderr if not available.
 	 * Currently limited to MS Windows GUI application console only.
 	 */
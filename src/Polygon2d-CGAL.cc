@@ -1,6 +1,7 @@
 #include "Polygon2d-CGAL.h"
 #include "polyset.h"
 #include "printutils.h"
+#include "ThreadPool.h"
 
 #pragma push_macro("NDEBUG")
 #undef NDEBUG
@@ -9,7 +10,9 @@
 #include <CGAL/Triangulation_face_base_with_info_2.h>
 #include <CGAL/Polygon_2.h>
 #pragma pop_macro("NDEBUG")
+#include <algorithm>
 #include <iostream>
+#include <numeric>
 
 namespace Polygon2DCGAL {
 
@@ -87,21 +90,84 @@ mark_domains(CDT &cdt)
 
 }
 
+namespace {
+
+// Polygons with fewer vertices are triangulated in one go
+const size_t min_parallel_vertices = 10000;
+// Jobs get at least this many vertices, so small islands are batched
+const size_t min_job_vertices = 1000;
+// Outlines which would take more ear tests go to CGAL
+const size_t max_ear_tests = 10000000;
+
 /*!
-	Triangulates this polygon2d and returns a 2D PolySet.
+	Groups the outlines whose bounding boxes overlap, transitively. An
+	outline which is inside another or crosses it overlaps it, so each
+	group has the same nesting on its own as in the whole polygon and can
+	be triangulated independently, e.g. the letters of a text. The groups
+	are ordered by their first outline.
 */
-PolySet *Polygon2d::tessellate() const
+std::vector<std::vector<size_t>> independent_outlines(const Polygon2d::Outlines2d &outlines)
 {
-	PRINTDB("Polygon2d::tessellate(): %d outlines", this->outlines().size());
-	auto polyset = new PolySet(*this);
+	std::vector<Eigen::AlignedBox<double, 2>, Eigen::aligned_allocator<Eigen::AlignedBox<double, 2>>> boxes(outlines.size());
+	for (size_t i = 0; i < outlines.size(); ++i) {
+		for (const auto &v : outlines[i].vertices) boxes[i].extend(v);
+	}
 
+	std::vector<size_t> parent(outlines.size());
+	std::iota(parent.begin(), parent.end(), 0);
+	auto find = [&parent](size_t i) {
+		while (parent[i] != i) i = parent[i] = parent[parent[i]];
+		return i;
+	};
+
+	// Sweep along x, comparing each box with the boxes it may overlap in x
+	std::vector<size_t> order(outlines.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&boxes](size_t a, size_t b) {
+		return boxes[a].min()[0] < boxes[b].min()[0];
+	});
+	std::vector<size_t> active;
+	for (const auto i : order) {
+		const auto &box = boxes[i];
+		active.erase(std::remove_if(active.begin(), active.end(), [&boxes, &box](size_t j) {
+			return boxes[j].max()[0] < box.min()[0];
+		}), active.end());
+		for (const auto j : active) {
+			if (boxes[j].max()[1] >= box.min()[1] && boxes[j].min()[1] <= box.max()[1]) {
+				parent[find(i)] = find(j);
+			}
+		}
+		active.push_back(i);
+	}
+
+	std::vector<std::vector<size_t>> groups;
+	std::vector<size_t> groupindex(outlines.size(), size_t(-1));
+	for (size_t i = 0; i < outlines.size(); ++i) {
+		auto &g = groupindex[find(i)];
+		if (g == size_t(-1)) {
+			g = groups.size();
+			groups.emplace_back();
+		}
+		groups[g].push_back(i);
+	}
+	return groups;
+}
+
+/*!
+	Triangulates the given outlines, appending three vertices per triangle
+	to triangles. Returns false if CGAL fails.
+*/
+bool triangulate(const Polygon2d::Outlines2d &outlines, const std::vector<size_t> &indices,
+								 VectorOfVector2d &triangles)
+{
 	Polygon2DCGAL::CDT cdt; // Uses a constrained Delaunay triangulator.
 
 	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
 	try {
 
 	// Adds all vertices, and add all contours as constraints.
-	for (const auto &outline : this->outlines()) {
+	for (const auto i : indices) {
+		const auto &outline = outlines[i];
 		// Start with last point
 		auto prev = cdt.insert({outline.vertices[outline.vertices.size()-1][0], outline.vertices[outline.vertices.size()-1][1]});
 		for (const auto &v : outline.vertices) {
@@ -117,21 +183,195 @@ PolySet *Polygon2d::tessellate() const
 	catch (const CGAL::Precondition_exception &e) {
 		PRINTB("CGAL error in Polygon2d::tesselate(): %s", e.what());
 		CGAL::set_error_behaviour(old_behaviour);
-		return nullptr;
+		return false;
 	}
 	CGAL::set_error_behaviour(old_behaviour);
   
 	// To extract triangles which is part of our polygon, we need to filter away
 	// triangles inside holes.
-	mark_domains(cdt);
+	Polygon2DCGAL::mark_domains(cdt);
 	for (auto fit = cdt.finite_faces_begin(); fit != cdt.finite_faces_end(); ++fit) {
 		if (fit->info().in_domain()) {
-			polyset->append_poly();
 			for (int i=0;i<3;i++) {
-				polyset->append_vertex(fit->vertex(i)->point()[0],
-															 fit->vertex(i)->point()[1],
-															 0);
+				triangles.emplace_back(fit->vertex(i)->point()[0], fit->vertex(i)->point()[1]);
+			}
+		}
+	}
+	return true;
+}
+
+/*!
+	Triangulates a simple counter-clockwise outline without CGAL: by a fan
+	if it's strictly convex, as are those of most primitives, else by ear
+	clipping. Ears are only tested against the vertices which aren't
+	strictly convex, which are few for e.g. the outlines of glyphs. Returns
+	false, leaving triangles unchanged, if that would take too long or no
+	ear is found, e.g. for self-intersecting outlines.
+*/
+bool triangulate_simple(const VectorOfVector2d &vertices, VectorOfVector2d &triangles)
+{
+	VectorOfVector2d pts;
+	pts.reserve(vertices.size());
+	for (const auto &v : vertices) {
+		if (pts.empty() || v != pts.back()) pts.push_back(v);
+	}
+	while (pts.size() > 1 && pts.front() == pts.back()) pts.pop_back();
+	const size_t n = pts.size();
+	if (n < 3) return false;
+
+	// Positive if a, o, b turn left
+	auto cross = [](const Vector2d &a, const Vector2d &o, const Vector2d &b) {
+		return (o[0] - a[0]) * (b[1] - a[1]) - (o[1] - a[1]) * (b[0] - a[0]);
+	};
+	std::vector<size_t> prev(n), next(n);
+	std::vector<char> reflex(n);
+	std::vector<size_t> reflexes;
+	double area = 0;
+	for (size_t i = 0; i < n; ++i) {
+		prev[i] = (i + n - 1) % n;
+		next[i] = (i + 1) % n;
+		area += pts[i][0] * pts[next[i]][1] - pts[next[i]][0] * pts[i][1];
+		reflex[i] = cross(pts[prev[i]], pts[i], pts[next[i]]) <= 0;
+		if (reflex[i]) reflexes.push_back(i);
+	}
+	if (area <= 0) return false;
+
+	VectorOfVector2d result;
+	result.reserve(3 * (n - 2));
+	if (reflexes.empty()) {
+		for (size_t i = 1; i + 1 < n; ++i) {
+			result.push_back(pts[0]);
+			result.push_back(pts[i]);
+			result.push_back(pts[i + 1]);
+		}
+		triangles.insert(triangles.end(), result.begin(), result.end());
+		return true;
+	}
+	if (n * reflexes.size() > max_ear_tests) return false;
+
+	std::vector<char> removed(n);
+	auto isEar = [&](size_t i) {
+		if (reflex[i]) return false;
+		const auto &a = pts[prev[i]], &o = pts[i], &b = pts[next[i]];
+		for (const auto r : reflexes) {
+			if (removed[r] || !reflex[r] || r == prev[i] || r == next[i]) continue;
+			const auto &p = pts[r];
+			// Touching vertices, as Clipper may leave
+			if (p == a || p == b) continue;
+			if (cross(a, o, p) >= 0 && cross(o, b, p) >= 0 && cross(b, a, p) >= 0) return false;
+		}
+		return true;
+	};
+
+	size_t remaining = n, i = 0, stalled = 0;
+	while (remaining > 3) {
+		if (!isEar(i)) {
+			i = next[i];
+			if (++stalled > remaining) return false;
+			continue;
+		}
+		result.push_back(pts[prev[i]]);
+		result.push_back(pts[i]);
+		result.push_back(pts[next[i]]);
+		const auto a = prev[i], b = next[i];
+		next[a] = b;
+		prev[b] = a;
+		removed[i] = true;
+		--remaining;
+		// Clipping an ear only ever makes its neighbours more convex
+		for (const auto j : {a, b}) {
+			if (reflex[j]) reflex[j] = cross(pts[prev[j]], pts[j], pts[next[j]]) <= 0;
+		}
+		i = a;
+		stalled = 0;
+	}
+	if (cross(pts[prev[i]], pts[i], pts[next[i]]) <= 0) return false;
+	result.push_back(pts[prev[i]]);
+	result.push_back(pts[i]);
+	result.push_back(pts[next[i]]);
+	triangles.insert(triangles.end(), result.begin(), result.end());
+	return true;
+}
+
+}
+
+/*!
+	Triangulates this polygon2d and returns a 2D PolySet.
+
+	The outlines of sanitized polygons which don't overlap any other (see
+	independent_outlines()), i.e. have no holes, are triangulated by
+	triangulate_simple(). Only the rest go to CGAL's constrained Delaunay
+	triangulation, in parallel for groups of large polygons.
+*/
+PolySet *Polygon2d::tessellate() const
+{
+	PRINTDB("Polygon2d::tessellate(): %d outlines", this->outlines().size());
+	const auto &outlines = this->outlines();
+	size_t numvertices = 0;
+	for (const auto &outline : outlines) numvertices += outline.vertices.size();
+
+	VectorOfVector2d simpletriangles;
+	std::vector<std::vector<size_t>> groups;
+	const auto pool = ThreadPool::instance();
+	const bool parallel = pool->isParallel() && numvertices >= min_parallel_vertices;
+	if (this->isSanitized() || parallel) {
+		for (auto &group : independent_outlines(outlines)) {
+			if (this->isSanitized() && group.size() == 1 &&
+					triangulate_simple(outlines[group.front()].vertices, simpletriangles)) continue;
+			groups.push_back(std::move(group));
+		}
+	} else {
+		groups.emplace_back(outlines.size());
+		std::iota(groups.back().begin(), groups.back().end(), 0);
+	}
+
+	// Batch the groups into jobs of at least min_job_vertices
+	std::vector<std::vector<size_t>> jobs;
+	if (parallel) {
+		const size_t jobvertices = std::max(min_job_vertices, numvertices / (4 * pool->numThreads()));
+		size_t current = jobvertices;
+		for (const auto &group : groups) {
+			if (current >= jobvertices) {
+				jobs.emplace_back();
+				current = 0;
 			}
+			for (const auto i : group) current += outlines[i].vertices.size();
+			jobs.back().insert(jobs.back().end(), group.begin(), group.end());
+		}
+	} else if (!groups.empty()) {
+		jobs.emplace_back();
+		for (const auto &group : groups) jobs.back().insert(jobs.back().end(), group.begin(), group.end());
+	}
+
+	std::vector<VectorOfVector2d> triangles(jobs.size());
+	triangles.push_back(std::move(simpletriangles));
+	std::vector<char> ok(jobs.size());
+	// Set here, too, in case the error behaviour isn't thread local
+	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+	TaskGroup group;
+	for (size_t j = 0; j < jobs.size(); ++j) {
+		group.run([&outlines, &jobs, &triangles, &ok, j]() {
+			ok[j] = triangulate(outlines, jobs[j], triangles[j]);
+		});
+	}
+	try {
+		group.wait();
+	}
+	catch (...) {
+		CGAL::set_error_behaviour(old_behaviour);
+		throw;
+	}
+	CGAL::set_error_behaviour(old_behaviour);
+	if (std::find(ok.begin(), ok.end(), false) != ok.end()) return nullptr;
+
+	auto polyset = new PolySet(*this);
+	size_t numtriangles = 0;
+	for (const auto &t : triangles) numtriangles += t.size() / 3;
+	polyset->reserve(numtriangles);
+	for (const auto &t : triangles) {
+		for (size_t i = 0; i < t.size(); i += 3) {
+			polyset->append_poly();
+			for (int k=0;k<3;k++) polyset->append_vertex(t[i + k][0], t[i + k][1], 0);
 		}
 	}
 	return polyset;
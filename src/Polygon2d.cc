@@ -1,5 +1,8 @@
 #include "Polygon2d.h"
 #include "printutils.h"
+#include "clipper-utils.h"
+
+#include <algorithm>
 
 /*!
 	Class for holding 2D geometry.
@@ -16,11 +19,100 @@
 	the flag can be set manually.
 */
 
+Polygon2d::Polygon2d(const Polygon2d &other)
+	: Geometry(other), theoutlines(make_shared<Outlines2d>()), sanitized(other.sanitized), paths(other.paths), materialized(false)
+{
+	if (other.materialized) {
+		this->theoutlines = other.theoutlines;
+		this->materialized = true;
+	}
+}
+
+Polygon2d &Polygon2d::operator=(const Polygon2d &other)
+{
+	if (this == &other) return *this;
+	Geometry::operator=(other);
+	this->sanitized = other.sanitized;
+	this->paths = other.paths;
+	this->materialized = other.materialized.load();
+	this->theoutlines = this->materialized ? other.theoutlines : make_shared<Outlines2d>();
+	return *this;
+}
+
+const Polygon2d::Outlines2d &Polygon2d::outlines() const
+{
+	if (!this->materialized) materialize();
+	return *this->theoutlines;
+}
+
+// The outlines to change, unshared first if a copy shares them
+Polygon2d::Outlines2d &Polygon2d::mutableOutlines()
+{
+	if (this->theoutlines.use_count() > 1) this->theoutlines = make_shared<Outlines2d>(*this->theoutlines);
+	return *this->theoutlines;
+}
+
+/*!
+	Computes the outlines from the Clipper paths. Cached geometry may be
+	shared between threads, hence the lock.
+*/
+void Polygon2d::materialize() const
+{
+	std::lock_guard<std::mutex> lock(this->materializemutex);
+	if (this->materialized) return;
+	auto outlines = make_shared<Outlines2d>();
+	outlines->reserve(this->paths->size());
+	for (const auto &path : *this->paths) {
+		Outline2d outline;
+		outline.positive = ClipperLib::Orientation(path);
+		outline.vertices.reserve(path.size());
+		for (const auto &ip : path) {
+			outline.vertices.emplace_back(1.0*ip.X/ClipperUtils::CLIPPER_SCALE, 1.0*ip.Y/ClipperUtils::CLIPPER_SCALE);
+		}
+		outlines->push_back(std::move(outline));
+	}
+	this->theoutlines = outlines;
+	this->materialized = true;
+}
+
+/*!
+	Sets the paths in Clipper space this polygon consists of. The paths
+	must be sanitized and cleaned, with positive outlines counter-clockwise.
+*/
+void Polygon2d::setClipperPaths(const shared_ptr<const ClipperPaths> &paths)
+{
+	this->paths = paths;
+	this->theoutlines = make_shared<Outlines2d>();
+	this->materialized = !paths;
+	this->sanitized = true;
+}
+
+// Called before modifying the outlines, which invalidates the paths
+void Polygon2d::dropClipperPaths()
+{
+	if (!this->paths) return;
+	materialize();
+	this->paths.reset();
+}
+
+void Polygon2d::addOutline(const Outline2d &outline)
+{
+	dropClipperPaths();
+	mutableOutlines().push_back(outline);
+}
+
 size_t Polygon2d::memsize() const
 {
 	size_t mem = 0;
-	for (const auto &o : this->outlines()) {
-		mem += o.vertices.size() * sizeof(Vector2d) + sizeof(Outline2d);
+	if (!this->materialized) {
+		for (const auto &path : *this->paths) {
+			mem += path.size() * sizeof(ClipperLib::IntPoint) + sizeof(ClipperLib::Path);
+		}
+	}
+	else {
+		for (const auto &o : *this->theoutlines) {
+			mem += o.vertices.size() * sizeof(Vector2d) + sizeof(Outline2d);
+		}
 	}
 	mem += sizeof(Polygon2d);
 	return mem;
@@ -29,7 +121,15 @@ size_t Polygon2d::memsize() const
 BoundingBox Polygon2d::getBoundingBox() const
 {
 	BoundingBox bbox;
-	for (const auto &o : this->outlines()) {
+	if (!this->materialized) {
+		for (const auto &path : *this->paths) {
+			for (const auto &ip : path) {
+				bbox.extend(Vector3d(1.0*ip.X/ClipperUtils::CLIPPER_SCALE, 1.0*ip.Y/ClipperUtils::CLIPPER_SCALE, 0));
+			}
+		}
+		return bbox;
+	}
+	for (const auto &o : *this->theoutlines) {
 		for (const auto &v : o.vertices) {
 			bbox.extend(Vector3d(v[0], v[1], 0));
 		}
@@ -40,7 +140,7 @@ BoundingBox Polygon2d::getBoundingBox() const
 std::string Polygon2d::dump() const
 {
 	std::ostringstream out;
-	for (const auto &o : this->theoutlines) {
+	for (const auto &o : this->outlines()) {
 		out << "contour:\n";
 		for (const auto &v : o.vertices) {
 			out << "  " << v.transpose();
@@ -52,20 +152,27 @@ std::string Polygon2d::dump() const
 
 bool Polygon2d::isEmpty() const
 {
-	return this->theoutlines.empty();
+	if (!this->materialized) return this->paths->empty();
+	return this->theoutlines->empty();
 }
 
 void Polygon2d::transform(const Transform2d &mat)
 {
+	dropClipperPaths();
 	if (mat.matrix().determinant() == 0) {
 		PRINT("WARNING: Scaling a 2D object with 0 - removing object");
-		this->theoutlines.clear();
+		this->theoutlines = make_shared<Outlines2d>();
 		return;
 	}
-	for (auto &o : this->theoutlines) {
+	// Mirroring flips the winding order, so reverse the outlines to keep it.
+	// As transformations don't make outlines intersect, this keeps sanitized
+	// polygons sanitized.
+	const bool mirrored = mat.matrix().determinant() < 0;
+	for (auto &o : mutableOutlines()) {
 		for (auto &v : o.vertices) {
 			v = mat * v;
 		}
+		if (mirrored) std::reverse(o.vertices.begin(), o.vertices.end());
 	}
 }
 
@@ -96,6 +203,7 @@ void Polygon2d::resize(const Vector2d &newsize, const Eigen::Matrix<bool,2,1> &a
 
 bool Polygon2d::is_convex() const
 {
+	const auto &theoutlines = outlines();
 	if (theoutlines.size() > 1) return false;
 	if (theoutlines.empty()) return true;
 
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include "Geometry.h"
 #include "linalg.h"
+#include "memory.h"
+
+namespace ClipperLib { struct IntPoint; }
 
 /*!
 	A single contour.
@@ -14,10 +19,23 @@ struct Outline2d {
 	bool positive;
 };
 
+/*!
+	Polygons produced by Clipper (see ClipperUtils) keep Clipper's integer
+	paths, so chains of 2D operations don't convert to double and back
+	between operations. The outlines are only computed from the paths when
+	first needed, e.g. for extrusion, rendering or export.
+
+	Copies share the outlines until one of them changes them.
+*/
 class Polygon2d : public Geometry
 {
 public:
-	Polygon2d() : sanitized(false) {}
+	typedef std::vector<std::vector<ClipperLib::IntPoint>> ClipperPaths;
+	static const Kind KIND = Kind::POLYGON2D;
+
+	Polygon2d() : Geometry(KIND), theoutlines(make_shared<Outlines2d>()), sanitized(false), materialized(true) {}
+	Polygon2d(const Polygon2d &other);
+	Polygon2d &operator=(const Polygon2d &other);
 	size_t memsize() const override;
 	BoundingBox getBoundingBox() const override;
 	std::string dump() const override;
@@ -25,11 +43,15 @@ public:
 	bool isEmpty() const override;
 	Geometry *copy() const override { return new Polygon2d(*this); }
 
-	void addOutline(const Outline2d &outline) { this->theoutlines.push_back(outline); }
+	void addOutline(const Outline2d &outline);
 	class PolySet *tessellate() const;
 
 	typedef std::vector<Outline2d> Outlines2d;
-	const Outlines2d &outlines() const { return theoutlines; }
+	const Outlines2d &outlines() const;
+
+	// Sanitized integer paths, if produced by Clipper
+	const shared_ptr<const ClipperPaths> &clipperPaths() const { return this->paths; }
+	void setClipperPaths(const shared_ptr<const ClipperPaths> &paths);
 
 	void transform(const Transform2d &mat);
 	void resize(const Vector2d &newsize, const Eigen::Matrix<bool,2,1> &autosize);
@@ -38,6 +60,15 @@ public:
 	void setSanitized(bool s) { this->sanitized = s; }
 	bool is_convex() const;
 private:
-	Outlines2d theoutlines;
+	void materialize() const;
+	void dropClipperPaths();
+	Outlines2d &mutableOutlines();
+
+	// Shared with copies, see mutableOutlines()
+	mutable shared_ptr<Outlines2d> theoutlines;
 	bool sanitized;
+	shared_ptr<const ClipperPaths> paths;
+	// False while theoutlines still has to be computed from paths
+	mutable std::atomic<bool> materialized;
+	mutable std::mutex materializemutex;
 };
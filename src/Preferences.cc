@@ -156,11 +156,14 @@ void Preferences::init() {
 #endif
 	this->defaultmap["advanced/openCSGLimit"] = RenderSettings::inst()->openCSGTermLimit;
 	this->defaultmap["advanced/forceGoldfeather"] = false;
+	this->defaultmap["advanced/rayMarchPreview"] = false;
 	this->defaultmap["advanced/undockableWindows"] = false;
 	this->defaultmap["advanced/reorderWindows"] = true;
 	this->defaultmap["launcher/showOnStartup"] = true;
 	this->defaultmap["advanced/localization"] = true;
 	this->defaultmap["advanced/autoReloadRaise"] = false;
+	this->defaultmap["advanced/speculativeRender"] = false;
+	this->defaultmap["advanced/evaluationSnapshot"] = false;
 	this->defaultmap["advanced/enableSoundNotification"] = true;
 	this->defaultmap["advanced/timeThresholdOnRenderCompleteSound"] = 0;
 	this->defaultmap["advanced/enableHardwarnings"] = false;
@@ -499,6 +502,18 @@ void Preferences::on_autoReloadRaiseCheckBox_toggled(bool state)
 	settings.setValue("advanced/autoReloadRaise", state);
 }
 
+void Preferences::on_speculativeRenderCheckBox_toggled(bool state)
+{
+	QSettingsCached settings;
+	settings.setValue("advanced/speculativeRender", state);
+}
+
+void Preferences::on_evaluationSnapshotCheckBox_toggled(bool state)
+{
+	QSettingsCached settings;
+	settings.setValue("advanced/evaluationSnapshot", state);
+}
+
 void Preferences::on_forceGoldfeatherBox_toggled(bool state)
 {
 	QSettingsCached settings;
@@ -873,7 +888,10 @@ void Preferences::updateGUI()
 	BlockSignals<QLineEdit *>(this->opencsgLimitEdit)->setText(getValue("advanced/openCSGLimit").toString());
 	BlockSignals<QCheckBox *>(this->localizationCheckBox)->setChecked(getValue("advanced/localization").toBool());
 	BlockSignals<QCheckBox *>(this->autoReloadRaiseCheckBox)->setChecked(getValue("advanced/autoReloadRaise").toBool());
+	BlockSignals<QCheckBox *>(this->speculativeRenderCheckBox)->setChecked(getValue("advanced/speculativeRender").toBool());
+	BlockSignals<QCheckBox *>(this->evaluationSnapshotCheckBox)->setChecked(getValue("advanced/evaluationSnapshot").toBool());
 	BlockSignals<QCheckBox *>(this->forceGoldfeatherBox)->setChecked(getValue("advanced/forceGoldfeather").toBool());
+	BlockSignals<QCheckBox *>(this->rayMarchPreviewBox)->setChecked(getValue("advanced/rayMarchPreview").toBool());
 	BlockSignals<QCheckBox *>(this->reorderCheckBox)->setChecked(getValue("advanced/reorderWindows").toBool());
 	BlockSignals<QCheckBox *>(this->undockCheckBox)->setChecked(getValue("advanced/undockableWindows").toBool());
 	BlockSignals<QCheckBox *>(this->launcherBox)->setChecked(getValue("launcher/showOnStartup").toBool());
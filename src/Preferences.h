@@ -51,9 +51,12 @@ public slots:
 	void on_polysetCacheSizeMBEdit_textChanged(const QString &);
 	void on_opencsgLimitEdit_textChanged(const QString &);
 	void on_forceGoldfeatherBox_toggled(bool);
+	void on_rayMarchPreviewBox_toggled(bool);
 	void on_mouseWheelZoomBox_toggled(bool);
 	void on_localizationCheckBox_toggled(bool);
 	void on_autoReloadRaiseCheckBox_toggled(bool);
+	void on_speculativeRenderCheckBox_toggled(bool);
+	void on_evaluationSnapshotCheckBox_toggled(bool);
 	void on_updateCheckBox_toggled(bool);
 	void on_snapshotCheckBox_toggled(bool);
 	void on_reorderCheckBox_toggled(bool);
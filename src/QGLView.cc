@@ -29,6 +29,9 @@
 #include "Preferences.h"
 #include "renderer.h"
 #include "degree_trig.h"
+#include "LODCache.h"
+#include "csgnode.h"
+#include "fbo.h"
 
 #include <QApplication>
 #include <QWheelEvent>
@@ -72,6 +75,8 @@ void QGLView::init()
 
   this->mouse_drag_active = false;
   this->statusLabel = nullptr;
+  // Keeps the view responsive while huge previews are drawn
+  this->refine_budget = 0.05;
 
   setMouseTracking(true);
 
@@ -101,6 +106,12 @@ void QGLView::viewAll()
 	}
 }
 
+void QGLView::scheduleRefinement()
+{
+  // Once the events queued meanwhile are handled
+  QTimer::singleShot(0, this, SLOT(updateGL()));
+}
+
 void QGLView::initializeGL()
 {
   auto err = glewInit();
@@ -228,12 +239,93 @@ void QGLView::mouseDoubleClickEvent (QMouseEvent *event) {
 	auto success = gluUnProject(x, y, z, modelview, projection, viewport, &px, &py, &pz);
 
 	if (success == GL_TRUE) {
+		// The point on the near plane under the cursor
+		GLdouble ex, ey, ez;
+		if (gluUnProject(x, y, 0, modelview, projection, viewport, &ex, &ey, &ez) == GL_TRUE) {
+			if (const auto leaf = pickLeaf(x, y, Vector3d(ex, ey, ez), Vector3d(px, py, pz))) {
+				emit objectPicked(QString::fromStdString(leaf->label));
+			}
+		}
 		cam.object_trans -= Vector3d(px, py, pz);
 		updateGL();
 		emit doAnimateUpdate();
 	}
 }
 
+/*!
+	Returns the CSG leaf drawn at the window position (x, y), by drawing the
+	ids of the renderer's objects into a one pixel framebuffer through a pick
+	matrix, so the pass costs no more fill than a pixel even for previews of
+	many objects. The surfaces in front of the visible point, which the
+	OpenCSG renderer may have cut away, are clipped off first, so the leaf
+	drawn nearest to the point wins. eye and point are the unprojections of
+	the position at the near plane and at the depth drawn.
+*/
+shared_ptr<const CSGLeaf> QGLView::pickLeaf(double x, double y, const Vector3d &eye, const Vector3d &point)
+{
+	if (!this->renderer) return nullptr;
+	const auto bbox = this->renderer->getBoundingBox();
+	if (bbox.isEmpty()) return nullptr;
+
+	if (!this->pickfbo) {
+		// fbo_init() leaves the new framebuffer bound, and fbo_delete() doesn't
+		// free it, so the framebuffer is kept with the context
+		auto fbo = fbo_new();
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, reinterpret_cast<GLint *>(&fbo->old_fbo_id));
+		const bool ok = fbo_init(fbo, 1, 1);
+		fbo_unbind(fbo);
+		if (!ok) {
+			fbo_delete(fbo);
+			return nullptr;
+		}
+		this->pickfbo = fbo;
+	}
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	fbo_bind(this->pickfbo);
+
+	glPushAttrib(GL_ENABLE_BIT | GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_VIEWPORT_BIT | GL_TRANSFORM_BIT | GL_CURRENT_BIT);
+	glViewport(0, 0, 1, 1);
+	setupCamera();
+	GLdouble projection[16];
+	glMatrixMode(GL_PROJECTION);
+	glGetDoublev(GL_PROJECTION_MATRIX, projection);
+	glLoadIdentity();
+	gluPickMatrix(x, y, 1, 1, viewport);
+	glMultMatrixd(projection);
+	glMatrixMode(GL_MODELVIEW);
+	glTranslated(cam.object_trans.x(), cam.object_trans.y(), cam.object_trans.z());
+
+	// eye and point are in the coordinates before the translation
+	const Vector3d direction = (point - eye).normalized();
+	const double margin = 1e-3 * bbox.sizes().norm();
+	const GLdouble plane[4] = {direction.x(), direction.y(), direction.z(),
+														 margin - direction.dot(point - cam.object_trans)};
+	glClipPlane(GL_CLIP_PLANE0, plane);
+	glEnable(GL_CLIP_PLANE0);
+
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_BLEND);
+	glDisable(GL_DITHER);
+	glDisable(GL_CULL_FACE);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	std::vector<shared_ptr<const CSGLeaf>> leaves;
+	this->renderer->drawIds(leaves);
+
+	GLubyte rgba[4] = {0, 0, 0, 0};
+	glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+	glPopAttrib();
+	fbo_unbind(this->pickfbo);
+
+	const size_t id = rgba[0] | (rgba[1] << 8) | (rgba[2] << 16);
+	if (id == 0 || id > leaves.size()) return nullptr;
+	return leaves[id - 1];
+}
+
 void QGLView::normalizeAngle(GLdouble& angle)
 {
   while(angle < 0) angle += 360;
@@ -246,6 +338,8 @@ void QGLView::mouseMoveEvent(QMouseEvent *event)
   double dx = (this_mouse.x() - last_mouse.x()) * 0.7;
   double dy = (this_mouse.y() - last_mouse.y()) * 0.7;
   if (mouse_drag_active) {
+    // Draw coarse versions of large objects until the button is released
+    LODCache::setActive(true);
     if (event->buttons() & Qt::LeftButton
 #ifdef Q_OS_MAC
             && !(event->modifiers() & Qt::MetaModifier)
@@ -296,13 +390,22 @@ void QGLView::mouseReleaseEvent(QMouseEvent*)
 {
   mouse_drag_active = false;
   releaseMouse();
+  if (LODCache::isActive()) {
+    LODCache::setActive(false);
+    updateGL();
+  }
 }
 
 const QImage & QGLView::grabFrame()
 {
+	// Only complete frames are grabbed
+	const auto budget = this->refine_budget;
+	this->refine_budget = 0;
+	if (this->renderer && !this->renderer->isRefined()) updateGL();
 	// Force reading from front buffer. Some configurations will read from the back buffer here.
 	glReadBuffer(GL_FRONT);
 	this->frame = grabFrameBuffer();
+	this->refine_budget = budget;
 	return this->frame;
 }
 
@@ -15,6 +15,8 @@
 #include "GLView.h"
 #include "renderer.h"
 
+struct fbo_t;
+
 class QGLView :
 #ifdef USE_QOPENGLWIDGET
 		public QOpenGLWidget,
@@ -45,6 +47,7 @@ public:
 #if QT_VERSION >= 0x050100
 	float getDPI() override { return this->devicePixelRatio(); }
 #endif
+	void scheduleRefinement() override;
 
 	const QImage & grabFrame();
 	bool save(const char *filename) override;
@@ -81,6 +84,7 @@ private:
 	bool mouseCentricZoom=true;
 	QPoint last_mouse;
 	QImage frame; // Used by grabFrame() and save()
+	fbo_t *pickfbo = nullptr; // Used by pickLeaf()
 
 	void wheelEvent(QWheelEvent *event) override;
 	void mousePressEvent(QMouseEvent *event) override;
@@ -93,6 +97,7 @@ private:
 
 	void paintGL() override;
 	void normalizeAngle(GLdouble& angle);
+	shared_ptr<const class CSGLeaf> pickLeaf(double x, double y, const Eigen::Vector3d &eye, const Eigen::Vector3d &point);
 
 #ifdef ENABLE_OPENCSG
 	void display_opencsg_warning() override;
@@ -102,4 +107,6 @@ private slots:
 
 signals:
 	void doAnimateUpdate();
+	// A double click hit the object drawn for the CSG leaf with this label
+	void objectPicked(const QString &label);
 };
@@ -0,0 +1,508 @@
+#include "Quickhull.h"
+#include "polyset.h"
+#include "printutils.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+	struct Face {
+		int v[3];
+		// neighbor[e] shares the edge from v[e] to v[(e + 1) % 3]
+		size_t neighbor[3];
+		Vector3d normal;
+		double offset;
+		// Points above this face which aren't assigned to another face
+		std::vector<int> outside;
+		bool alive;
+		// Iteration in which visibility was last computed, and its result
+		size_t mark;
+		bool visible;
+
+		double distance(const Vector3d &p) const { return this->normal.dot(p) - this->offset; }
+	};
+
+	// Unit normals closer than this are treated as parallel when looking for redundant vertices
+	const double parallel_tolerance = 1e-9;
+
+	// Multiple of the distance tolerance by which adjacent faces may fold
+	const double fold_tolerance = 1000;
+
+	// Below this number of points, hulls and filtering run on one thread
+	const size_t min_parallel_points = 50000;
+
+	// Below this number of points, filtering isn't worth it
+	const size_t min_filtered_points = 1000;
+
+	// Directions in which extreme points are collected by filterInterior()
+	const double filter_directions[13][3] = {
+		{1, 0, 0}, {0, 1, 0}, {0, 0, 1},
+		{1, 1, 0}, {1, -1, 0}, {1, 0, 1}, {1, 0, -1}, {0, 1, 1}, {0, 1, -1},
+		{1, 1, 1}, {1, 1, -1}, {1, -1, 1}, {1, -1, -1}
+	};
+
+	size_t numChunks(size_t size)
+	{
+		return size >= min_parallel_points ? ThreadPool::instance()->numThreads() : 1;
+	}
+
+	/*!
+		Calls f(chunk, begin, end) for numChunks(size) consecutive ranges
+		covering [0, size), in parallel if there is more than one.
+	*/
+	void forChunks(size_t size, const std::function<void(size_t, size_t, size_t)> &f)
+	{
+		const size_t numchunks = numChunks(size);
+		if (numchunks <= 1) {
+			f(0, 0, size);
+			return;
+		}
+		TaskGroup group;
+		for (size_t c = 0; c < numchunks; ++c) {
+			const size_t begin = size * c / numchunks, end = size * (c + 1) / numchunks;
+			group.run([&f, c, begin, end]() { f(c, begin, end); });
+		}
+		group.wait();
+	}
+
+	class Hull
+	{
+	public:
+		Hull(const std::vector<Vector3d> &points) : points(points), eps(0) {}
+
+		bool build();
+		bool strictVertices(std::vector<Vector3d> &strict) const;
+		void vertices(std::vector<Vector3d> &result) const;
+		bool inside(const Vector3d &p) const;
+		void output(PolySet &ps) const;
+
+	private:
+		bool initialSimplex(int simplex[4]);
+		bool addFace(int a, int b, int c);
+		void link(size_t f, size_t g);
+		void assign(int p, size_t firstface);
+		bool addPoint(size_t face, size_t iteration);
+
+		const std::vector<Vector3d> &points;
+		double eps;
+		std::vector<Face> faces;
+
+		// Scratch space of addPoint(), kept to avoid reallocation
+		struct HorizonEdge {
+			int a, b;
+			// The visible face having the edge, and its non-visible neighbor
+			size_t face, neighbor;
+		};
+		std::vector<size_t> visible, stack;
+		std::vector<HorizonEdge> horizon;
+		std::vector<int> orphans;
+		// Per vertex: the new face starting at it, or none
+		std::vector<size_t> horizonface;
+	};
+
+	/*!
+		Finds four points spanning a tetrahedron of non-negligible volume,
+		starting from the extreme points along the axes.
+	*/
+	bool Hull::initialSimplex(int simplex[4])
+	{
+		int extremes[6] = {0, 0, 0, 0, 0, 0};
+		for (size_t i = 1; i < this->points.size(); ++i) {
+			for (int axis = 0; axis < 3; ++axis) {
+				if (this->points[i][axis] < this->points[extremes[2*axis]][axis]) extremes[2*axis] = i;
+				if (this->points[i][axis] > this->points[extremes[2*axis + 1]][axis]) extremes[2*axis + 1] = i;
+			}
+		}
+
+		double maxdist = 0;
+		for (int i = 0; i < 6; ++i) {
+			for (int j = i + 1; j < 6; ++j) {
+				const double dist = (this->points[extremes[i]] - this->points[extremes[j]]).squaredNorm();
+				if (dist > maxdist) {
+					maxdist = dist;
+					simplex[0] = extremes[i];
+					simplex[1] = extremes[j];
+				}
+			}
+		}
+		if (std::sqrt(maxdist) <= this->eps) return false;
+
+		const Vector3d &p0 = this->points[simplex[0]];
+		const Vector3d dir = (this->points[simplex[1]] - p0).normalized();
+		maxdist = 0;
+		for (size_t i = 0; i < this->points.size(); ++i) {
+			const double dist = (this->points[i] - p0).cross(dir).norm();
+			if (dist > maxdist) {
+				maxdist = dist;
+				simplex[2] = i;
+			}
+		}
+		if (maxdist <= this->eps) return false;
+
+		const Vector3d normal = (this->points[simplex[1]] - p0).cross(this->points[simplex[2]] - p0).normalized();
+		maxdist = 0;
+		for (size_t i = 0; i < this->points.size(); ++i) {
+			const double dist = std::fabs(normal.dot(this->points[i] - p0));
+			if (dist > maxdist) {
+				maxdist = dist;
+				simplex[3] = i;
+			}
+		}
+		if (maxdist <= this->eps) return false;
+
+		// The fourth point must be below the first face
+		if (normal.dot(this->points[simplex[3]] - p0) > 0) std::swap(simplex[1], simplex[2]);
+		return true;
+	}
+
+	/*!
+		Adds the face a,b,c, to be linked to its neighbors by the caller.
+		Returns false if the face is too thin to have a well-defined plane.
+	*/
+	bool Hull::addFace(int a, int b, int c)
+	{
+		const Vector3d ab = this->points[b] - this->points[a];
+		const Vector3d ac = this->points[c] - this->points[a];
+		Vector3d normal = ab.cross(ac);
+		const double len = normal.norm();
+		if (len <= this->eps * std::max(ab.norm(), ac.norm())) return false;
+		normal /= len;
+
+		Face face;
+		face.v[0] = a;
+		face.v[1] = b;
+		face.v[2] = c;
+		face.neighbor[0] = face.neighbor[1] = face.neighbor[2] = 0;
+		face.normal = normal;
+		face.offset = normal.dot(this->points[a]);
+		face.alive = true;
+		face.mark = 0;
+		face.visible = false;
+		this->faces.push_back(face);
+		return true;
+	}
+
+	// Links two faces of the initial simplex along their common edge
+	void Hull::link(size_t f, size_t g)
+	{
+		for (int e = 0; e < 3; ++e) {
+			for (int h = 0; h < 3; ++h) {
+				if (this->faces[f].v[e] == this->faces[g].v[(h + 1) % 3] && this->faces[f].v[(e + 1) % 3] == this->faces[g].v[h]) {
+					this->faces[f].neighbor[e] = g;
+					this->faces[g].neighbor[h] = f;
+				}
+			}
+		}
+	}
+
+	/*!
+		Assigns point p to the outside set of the face starting at firstface
+		it is furthest above. Points not above any of them are inside the
+		hull and dropped.
+	*/
+	void Hull::assign(int p, size_t firstface)
+	{
+		size_t best = 0;
+		double bestdist = this->eps;
+		for (size_t f = firstface; f < this->faces.size(); ++f) {
+			const double dist = this->faces[f].distance(this->points[p]);
+			if (dist > bestdist) {
+				bestdist = dist;
+				best = f + 1;
+			}
+		}
+		if (best) this->faces[best - 1].outside.push_back(p);
+	}
+
+	/*!
+		Adds the point of the outside set of the given face which is furthest
+		above it to the hull. Returns false if a degeneracy is detected.
+	*/
+	bool Hull::addPoint(size_t face, size_t iteration)
+	{
+		int p = -1;
+		double maxdist = -1;
+		for (const auto i : this->faces[face].outside) {
+			const double dist = this->faces[face].distance(this->points[i]);
+			if (dist > maxdist) {
+				maxdist = dist;
+				p = i;
+			}
+		}
+		const Vector3d &point = this->points[p];
+
+		// Find all faces visible from the point and the horizon bounding them
+		this->visible.assign(1, face);
+		this->stack.assign(1, face);
+		this->horizon.clear();
+		this->faces[face].mark = iteration;
+		this->faces[face].visible = true;
+		while (!this->stack.empty()) {
+			const size_t f = this->stack.back();
+			this->stack.pop_back();
+			for (int e = 0; e < 3; ++e) {
+				const size_t neighbor = this->faces[f].neighbor[e];
+				Face &nb = this->faces[neighbor];
+				if (nb.mark != iteration) {
+					nb.mark = iteration;
+					nb.visible = nb.distance(point) > this->eps;
+					if (nb.visible) {
+						this->visible.push_back(neighbor);
+						this->stack.push_back(neighbor);
+					}
+				}
+				if (!nb.visible) {
+					this->horizon.push_back(HorizonEdge{this->faces[f].v[e], this->faces[f].v[(e + 1) % 3], f, neighbor});
+				}
+			}
+		}
+
+		std::vector<int> &orphans = this->orphans;
+		orphans.clear();
+		for (const auto f : this->visible) {
+			Face &vf = this->faces[f];
+			vf.alive = false;
+			for (const auto i : vf.outside) {
+				if (i != p) orphans.push_back(i);
+			}
+			std::vector<int>().swap(vf.outside);
+		}
+
+		// One new face per horizon edge. The horizon must be a simple loop,
+		// so each of its vertices starts exactly one edge.
+		const size_t none = std::numeric_limits<size_t>::max();
+		const size_t firstnew = this->faces.size();
+		bool ok = true;
+		for (const auto &edge : this->horizon) {
+			if (this->horizonface[edge.a] != none || !addFace(edge.a, edge.b, p)) {
+				ok = false;
+				break;
+			}
+			this->horizonface[edge.a] = this->faces.size() - 1;
+		}
+		for (size_t f = firstnew; ok && f < this->faces.size(); ++f) {
+			Face &nf = this->faces[f];
+			const HorizonEdge &edge = this->horizon[f - firstnew];
+			const size_t next = this->horizonface[nf.v[1]];
+			if (next == none) {
+				ok = false;
+				break;
+			}
+			nf.neighbor[0] = edge.neighbor;
+			nf.neighbor[1] = next;
+			this->faces[next].neighbor[2] = f;
+			Face &nb = this->faces[edge.neighbor];
+			for (int e = 0; e < 3; ++e) {
+				if (nb.neighbor[e] == edge.face) nb.neighbor[e] = f;
+			}
+
+			// Points within tolerance of the visible faces may make the new
+			// faces fold back onto their neighbors. Tiny folds between nearly
+			// coplanar faces are harmless, larger ones mean trouble.
+			for (int i = 0; i < 3; ++i) {
+				if (nf.distance(this->points[nb.v[i]]) > fold_tolerance * this->eps) ok = false;
+			}
+		}
+		for (const auto &edge : this->horizon) this->horizonface[edge.a] = none;
+		if (!ok) return false;
+
+		for (const auto i : orphans) assign(i, firstnew);
+		return true;
+	}
+
+	bool Hull::build()
+	{
+		if (this->points.size() < 4) return false;
+
+		// Tolerance for plane distances, see "Implementing Quickhull" (Lloyd, 2005)
+		Vector3d maxabs(0, 0, 0);
+		for (const auto &p : this->points) maxabs = maxabs.cwiseMax(p.cwiseAbs());
+		this->eps = 3 * std::numeric_limits<double>::epsilon() * (maxabs[0] + maxabs[1] + maxabs[2]);
+
+		int simplex[4] = {0, 0, 0, 0};
+		if (!initialSimplex(simplex)) return false;
+		if (!addFace(simplex[0], simplex[1], simplex[2]) ||
+				!addFace(simplex[1], simplex[0], simplex[3]) ||
+				!addFace(simplex[2], simplex[1], simplex[3]) ||
+				!addFace(simplex[0], simplex[2], simplex[3])) {
+			return false;
+		}
+		for (size_t f = 0; f < 4; ++f) {
+			for (size_t g = f + 1; g < 4; ++g) link(f, g);
+		}
+		this->horizonface.assign(this->points.size(), std::numeric_limits<size_t>::max());
+		for (size_t i = 0; i < this->points.size(); ++i) {
+			if (i != size_t(simplex[0]) && i != size_t(simplex[1]) && i != size_t(simplex[2]) && i != size_t(simplex[3])) {
+				assign(i, 0);
+			}
+		}
+
+		// New faces are appended, so a single pass processes all of them
+		size_t iteration = 0;
+		for (size_t f = 0; f < this->faces.size(); ++f) {
+			if (!this->faces[f].alive || this->faces[f].outside.empty()) continue;
+			if (!addPoint(f, ++iteration)) {
+				PRINTD("Quickhull: degeneracy detected");
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/*!
+		Collects the vertices which are corners of the hull, i.e. whose
+		incident faces lie in at least three different planes. Returns true
+		if there are no other vertices (on edges or in the interior of faces).
+	*/
+	bool Hull::strictVertices(std::vector<Vector3d> &strict) const
+	{
+		std::unordered_map<int, std::vector<Vector3d>> normals;
+		for (const auto &f : this->faces) {
+			if (!f.alive) continue;
+			for (int i = 0; i < 3; ++i) {
+				auto &n = normals[f.v[i]];
+				if (n.size() >= 3) continue;
+				const bool parallel = std::any_of(n.begin(), n.end(), [&f](const Vector3d &m) {
+					return (m - f.normal).norm() < parallel_tolerance;
+				});
+				if (!parallel) n.push_back(f.normal);
+			}
+		}
+		bool allstrict = true;
+		for (const auto &v : normals) {
+			if (v.second.size() >= 3) strict.push_back(this->points[v.first]);
+			else allstrict = false;
+		}
+		return allstrict;
+	}
+
+	void Hull::vertices(std::vector<Vector3d> &result) const
+	{
+		std::vector<bool> used(this->points.size());
+		for (const auto &f : this->faces) {
+			if (!f.alive) continue;
+			for (int i = 0; i < 3; ++i) {
+				if (!used[f.v[i]]) result.push_back(this->points[f.v[i]]);
+				used[f.v[i]] = true;
+			}
+		}
+	}
+
+	// Returns true if p is strictly inside the hull, beyond tolerance
+	bool Hull::inside(const Vector3d &p) const
+	{
+		for (const auto &f : this->faces) {
+			if (f.alive && f.distance(p) >= -this->eps) return false;
+		}
+		return true;
+	}
+
+	void Hull::output(PolySet &ps) const
+	{
+		for (const auto &f : this->faces) {
+			if (!f.alive) continue;
+			ps.append_poly();
+			for (int i = 0; i < 3; ++i) ps.append_vertex(this->points[f.v[i]]);
+		}
+	}
+}
+
+namespace Quickhull {
+	/*!
+		Computes the convex hull of the points into result. Returns false,
+		leaving result untouched, if the points are degenerate.
+
+		Large point sets are split into one chunk per thread. The chunks are
+		hulled in parallel, and the hull of all their vertices is the result.
+	*/
+	bool hull(const std::vector<Vector3d> &points, PolySet &result)
+	{
+		std::vector<Vector3d> merged;
+		const bool chunked = numChunks(points.size()) > 1;
+		if (chunked) {
+			std::vector<std::vector<Vector3d>> chunkvertices(numChunks(points.size()));
+			forChunks(points.size(), [&points, &chunkvertices](size_t c, size_t begin, size_t end) {
+				std::vector<Vector3d> chunk(points.begin() + begin, points.begin() + end);
+				Hull h(chunk);
+				if (h.build()) h.vertices(chunkvertices[c]);
+				else chunkvertices[c].swap(chunk);
+			});
+			for (const auto &v : chunkvertices) merged.insert(merged.end(), v.begin(), v.end());
+			PRINTDB("Quickhull: %d chunk hull vertices of %d points", merged.size() % points.size());
+		}
+
+		Hull h(chunked ? merged : points);
+		if (!h.build()) return false;
+
+		std::vector<Vector3d> strict;
+		if (h.strictVertices(strict)) {
+			h.output(result);
+			return true;
+		}
+
+		// Vertices may end up on edges or faces once later points are added;
+		// hull the corners again to get rid of them
+		Hull h2(strict);
+		if (!h2.build()) return false;
+		h2.output(result);
+		return true;
+	}
+
+	/*!
+		Removes points which can't be vertices of the hull (Akl-Toussaint
+		heuristic): the points extreme in a number of fixed directions span a
+		polytope inside the hull, so all points strictly inside it can be
+		dropped. Typically removes the vast majority of points of dense
+		meshes. Exact duplicates are removed as well.
+	*/
+	void filterInterior(std::vector<Vector3d> &points)
+	{
+		if (points.size() < min_filtered_points) return;
+
+		const size_t numdirections = sizeof(filter_directions) / sizeof(filter_directions[0]);
+		std::vector<size_t> extremes(2 * numdirections, 0);
+		std::vector<double> minvalues(numdirections, std::numeric_limits<double>::max());
+		std::vector<double> maxvalues(numdirections, -std::numeric_limits<double>::max());
+		for (size_t i = 0; i < points.size(); ++i) {
+			const Vector3d &p = points[i];
+			for (size_t d = 0; d < numdirections; ++d) {
+				const double value = filter_directions[d][0] * p[0] + filter_directions[d][1] * p[1] + filter_directions[d][2] * p[2];
+				if (value < minvalues[d]) {
+					minvalues[d] = value;
+					extremes[2*d] = i;
+				}
+				if (value > maxvalues[d]) {
+					maxvalues[d] = value;
+					extremes[2*d + 1] = i;
+				}
+			}
+		}
+		std::sort(extremes.begin(), extremes.end());
+		extremes.erase(std::unique(extremes.begin(), extremes.end()), extremes.end());
+		std::vector<Vector3d> extremepoints;
+		for (const auto i : extremes) extremepoints.push_back(points[i]);
+
+		// Flat input; leave it to the hull to detect
+		Hull filter(extremepoints);
+		if (!filter.build()) return;
+
+		std::vector<char> keep(points.size());
+		forChunks(points.size(), [&points, &keep, &filter](size_t, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; ++i) keep[i] = !filter.inside(points[i]);
+		});
+		size_t n = 0;
+		for (size_t i = 0; i < points.size(); ++i) {
+			if (keep[i]) points[n++] = points[i];
+		}
+		points.resize(n);
+
+		std::sort(points.begin(), points.end(), [](const Vector3d &a, const Vector3d &b) {
+			return std::lexicographical_compare(a.data(), a.data() + 3, b.data(), b.data() + 3);
+		});
+		points.erase(std::unique(points.begin(), points.end()), points.end());
+	}
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include "linalg.h"
+
+class PolySet;
+
+/*!
+	Convex hull of a 3D point cloud in double precision (Quickhull).
+
+	This is a fast alternative to CGAL::convex_hull_3 for clouds which are
+	in general position with respect to floating point. Instead of coping
+	with degenerate configurations (flat or near-flat input, points on the
+	hull within floating point tolerance of more than one face), hull()
+	detects them and reports failure, and the caller falls back to an
+	exact hull.
+
+	The result has no vertices in the interior of faces or edges of the
+	hull. Faces are triangles, oriented counter-clockwise seen from outside.
+*/
+namespace Quickhull {
+	bool hull(const std::vector<Vector3d> &points, PolySet &result);
+	void filterInterior(std::vector<Vector3d> &points);
+}
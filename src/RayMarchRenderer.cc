@@ -0,0 +1,531 @@
+#include "RayMarchRenderer.h"
+#include "OpenCSGRenderer.h"
+#include "polyset.h"
+#include "printutils.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <sstream>
+#include <Eigen/SVD>
+
+namespace {
+	// GLSL 1.10 has no implicit conversion of integer literals
+	std::string glsl(double v)
+	{
+		std::ostringstream out;
+		out.precision(9);
+		out << v;
+		auto s = out.str();
+		if (s.find_first_of(".en") == std::string::npos) s += ".0";
+		return s;
+	}
+
+	std::string glsl(const Vector3d &v)
+	{
+		return "vec3(" + glsl(v[0]) + ", " + glsl(v[1]) + ", " + glsl(v[2]) + ")";
+	}
+
+	std::string glsl(const Eigen::Matrix3d &m)
+	{
+		std::string s = "mat3(";
+		for (int i = 0; i < 9; i++) s += (i ? ", " : "") + glsl(m(i % 3, i / 3));
+		return s + ")";
+	}
+
+	const char *vs_source =
+		"varying vec2 ndc;\n"
+		"void main() {\n"
+		"  ndc = gl_Vertex.xy;\n"
+		"  gl_Position = gl_Vertex;\n"
+		"}\n";
+
+	/*
+		The distance functions of PolySet::Shape in their own coordinates.
+		sdf() follows, written by ShaderWriter.
+	*/
+	const char *fs_header =
+		"uniform vec4 material, cutout;\n"
+		"uniform bool pick;\n"
+		"uniform float idbase;\n"
+		"varying vec2 ndc;\n"
+		"vec4 leafcolor(float k, vec4 c) {\n"
+		"  if (!pick) return c;\n"
+		"  float id = idbase + k;\n"
+		"  return vec4(mod(id, 256.0), mod(floor(id / 256.0), 256.0), floor(id / 65536.0), 255.0) / 255.0;\n"
+		"}\n"
+		"float bound(vec3 p, vec3 c, vec3 h) {\n"
+		"  vec3 d = abs(p - c) - h;\n"
+		"  return max(d.x, max(d.y, d.z));\n"
+		"}\n"
+		"float sdBox(vec3 q, vec3 c, vec3 h) {\n"
+		"  vec3 d = abs(q - c) - h;\n"
+		"  return length(max(d, 0.0)) + min(max(d.x, max(d.y, d.z)), 0.0);\n"
+		"}\n"
+		"float sdPrism(vec3 q, float r, float n, float z1, float z2) {\n"
+		"  float an = 3.14159265 / n;\n"
+		"  float a = (q.x == 0.0 && q.y == 0.0) ? 0.0 : atan(q.y, q.x);\n"
+		"  float b = mod(a - an, 2.0 * an) - an;\n"
+		"  vec2 v = length(q.xy) * vec2(cos(b), abs(sin(b)));\n"
+		"  vec2 e = v - vec2(r * cos(an), clamp(v.y, 0.0, r * sin(an)));\n"
+		"  vec2 w = vec2(e.x < 0.0 ? -length(e) : length(e), abs(q.z - 0.5 * (z1 + z2)) - 0.5 * (z2 - z1));\n"
+		"  return length(max(w, 0.0)) + min(max(w.x, w.y), 0.0);\n"
+		"}\n"
+		"float sdCone(vec3 q, float r1, float r2, float z1, float z2) {\n"
+		"  float h = 0.5 * (z2 - z1);\n"
+		"  vec2 k = vec2(length(q.xy), q.z - 0.5 * (z1 + z2));\n"
+		"  vec2 k1 = vec2(r2, h);\n"
+		"  vec2 k2 = vec2(r2 - r1, 2.0 * h);\n"
+		"  vec2 ca = vec2(k.x - min(k.x, k.y < 0.0 ? r1 : r2), abs(k.y) - h);\n"
+		"  vec2 cb = k - k1 + k2 * clamp(dot(k1 - k, k2) / dot(k2, k2), 0.0, 1.0);\n"
+		"  float s = (cb.x < 0.0 && ca.y < 0.0) ? -1.0 : 1.0;\n"
+		"  return s * sqrt(min(dot(ca, ca), dot(cb, cb)));\n"
+		"}\n";
+
+	/*
+		Marches the ray of the pixel from the near plane through the bounds
+		of the scene (lo, hi) until it's closer to a surface than eps, then
+		shades the hit like the edge shader of GLView and writes its depth.
+	*/
+	const char *fs_main =
+		"void main() {\n"
+		"  vec4 a = gl_ModelViewProjectionMatrixInverse * vec4(ndc, -1.0, 1.0);\n"
+		"  vec4 b = gl_ModelViewProjectionMatrixInverse * vec4(ndc, 1.0, 1.0);\n"
+		"  vec3 ro = a.xyz / a.w;\n"
+		"  vec3 rd = b.xyz / b.w - ro;\n"
+		"  float tfar = length(rd);\n"
+		"  rd /= tfar;\n"
+		"  vec3 r = rd;\n"
+		"  if (r.x == 0.0) r.x = 1e-20;\n"
+		"  if (r.y == 0.0) r.y = 1e-20;\n"
+		"  if (r.z == 0.0) r.z = 1e-20;\n"
+		"  vec3 t0 = (lo - ro) / r, t1 = (hi - ro) / r;\n"
+		"  vec3 tn = min(t0, t1), tx = max(t0, t1);\n"
+		"  float t = max(max(tn.x, tn.y), max(tn.z, 0.0));\n"
+		"  float tend = min(min(tx.x, tx.y), min(tx.z, tfar));\n"
+		"  if (t > tend) discard;\n"
+		"  vec4 col;\n"
+		"  bool hit = false;\n"
+		"  for (int i = 0; i < 256; i++) {\n"
+		"    float d = sdf(ro + t * rd, col);\n"
+		"    if (d < eps) { hit = true; break; }\n"
+		"    t += d;\n"
+		"    if (t > tend) break;\n"
+		"  }\n"
+		"  if (!hit) discard;\n"
+		"  vec3 p = ro + t * rd;\n"
+		"  if (pick) {\n"
+		"    gl_FragColor = col;\n"
+		"  } else {\n"
+		"    vec4 unused;\n"
+		"    vec2 k = vec2(1.0, -1.0);\n"
+		"    vec3 n = k.xyy * sdf(p + k.xyy * eps, unused) + k.yyx * sdf(p + k.yyx * eps, unused) +\n"
+		"      k.yxy * sdf(p + k.yxy * eps, unused) + k.xxx * sdf(p + k.xxx * eps, unused);\n"
+		"    vec3 normal = normalize(gl_NormalMatrix * n);\n"
+		"    vec3 lightDir = normalize(vec3(gl_LightSource[0].position));\n"
+		"    float shading = 0.2 + abs(dot(normal, lightDir));\n"
+		"    gl_FragColor = vec4(col.rgb * shading, col.a);\n"
+		"  }\n"
+		"  vec4 clip = gl_ModelViewProjectionMatrix * vec4(p, 1.0);\n"
+		"  gl_FragDepth = 0.5 * (gl_DepthRange.diff * clip.z / clip.w + gl_DepthRange.near + gl_DepthRange.far);\n"
+		"}\n";
+
+	// A sphere's mesh lies within the sphere, so bounds of meshes get a margin
+	BoundingBox padded(const BoundingBox &bbox)
+	{
+		const Vector3d pad = Vector3d::Constant(0.02 * bbox.sizes().maxCoeff());
+		return BoundingBox(bbox.min() - pad, bbox.max() + pad);
+	}
+
+	// The smallest and largest factor the linear part of m scales lengths by
+	std::pair<double, double> scaling(const Transform3d &m)
+	{
+		const Eigen::JacobiSVD<Eigen::Matrix3d> svd(m.linear());
+		const auto &s = svd.singularValues();
+		return {s.minCoeff(), s.maxCoeff()};
+	}
+
+	const PolySet::Shape *leafShape(const CSGLeaf &leaf)
+	{
+		const auto ps = geometry_cast<const PolySet>(leaf.geom.get());
+		if (!ps || ps->getDimension() != 3 || ps->shape().type == PolySet::Shape::Type::NONE) return nullptr;
+		const auto s = scaling(leaf.matrix);
+		if (!(s.first > 1e-9 * s.second)) return nullptr;
+		return &ps->shape();
+	}
+
+	// Counts the leaves of term, if all of them have a shape
+	bool analytic(const shared_ptr<CSGNode> &term, size_t &leaves)
+	{
+		leaves = 0;
+		std::vector<shared_ptr<CSGNode>> todo{term};
+		while (!todo.empty()) {
+			const auto node = std::move(todo.back());
+			todo.pop_back();
+			if (auto op = dynamic_pointer_cast<CSGOperation>(node)) {
+				const auto type = op->getType();
+				if (type != OpenSCADOperator::UNION && type != OpenSCADOperator::INTERSECTION &&
+						type != OpenSCADOperator::DIFFERENCE) return false;
+				todo.push_back(op->left());
+				todo.push_back(op->right());
+			}
+			else {
+				auto leaf = dynamic_pointer_cast<CSGLeaf>(node);
+				if (!leaf || !leafShape(*leaf)) return false;
+				leaves++;
+			}
+		}
+		return true;
+	}
+
+	// The operands of nested operations of one type, e.g. of a union of unions
+	std::vector<shared_ptr<CSGNode>> operands(const shared_ptr<CSGNode> &node, OpenSCADOperator type)
+	{
+		std::vector<shared_ptr<CSGNode>> result;
+		std::vector<shared_ptr<CSGNode>> todo{node};
+		while (!todo.empty()) {
+			const auto term = std::move(todo.back());
+			todo.pop_back();
+			auto op = dynamic_pointer_cast<CSGOperation>(term);
+			if (op && op->getType() == type) {
+				todo.push_back(op->right());
+				todo.push_back(op->left());
+			}
+			else {
+				result.push_back(term);
+			}
+		}
+		return result;
+	}
+
+	/*!
+		Writes the body of sdf(), which returns the distance of p to the
+		tree, at most the true distance, and sets col to the color of the
+		nearest surface. Each node is written to variables dN and cN.
+		Unions and subtractions skip the operands whose bounds are farther
+		than the distance so far, in a hierarchy of bounds like a BVH.
+	*/
+	class ShaderWriter
+	{
+	public:
+		std::ostringstream out;
+		std::vector<shared_ptr<const CSGLeaf>> leaves;
+
+		struct Operand {
+			shared_ptr<CSGNode> node;
+			BoundingBox bounds;
+		};
+
+		static std::vector<Operand> bounded(const std::vector<shared_ptr<CSGNode>> &nodes)
+		{
+			std::vector<Operand> result;
+			for (const auto &node : nodes) {
+				if (!node->getBoundingBox().isEmpty()) result.push_back({node, padded(node->getBoundingBox())});
+			}
+			return result;
+		}
+
+		// Returns the number of the variables
+		int writeUnion(std::vector<Operand> items, bool cut)
+		{
+			const int n = this->vars++;
+			writeUnion(n, std::move(items), cut);
+			return n;
+		}
+
+		int write(const shared_ptr<CSGNode> &node, bool cut)
+		{
+			const int n = this->vars++;
+			auto op = dynamic_pointer_cast<CSGOperation>(node);
+			if (!op) {
+				writeLeaf(n, static_pointer_cast<CSGLeaf>(node), cut);
+				return n;
+			}
+			switch (op->getType()) {
+			case OpenSCADOperator::UNION:
+				writeUnion(n, bounded(operands(node, OpenSCADOperator::UNION)), cut);
+				break;
+			case OpenSCADOperator::INTERSECTION:
+				out << "  float d" << n << " = -1e30; vec4 c" << n << " = vec4(0.0);\n";
+				for (const auto &operand : operands(node, OpenSCADOperator::INTERSECTION)) {
+					out << "  {\n";
+					const int k = write(operand, cut);
+					out << "  if (d" << k << " > d" << n << ") { d" << n << " = d" << k << "; c" << n << " = c" << k << "; }\n";
+					out << "  }\n";
+				}
+				break;
+			default: {
+				// a - b - c as a - (b + c)
+				std::vector<shared_ptr<CSGNode>> subtracted;
+				shared_ptr<CSGNode> base = node;
+				while (op && op->getType() == OpenSCADOperator::DIFFERENCE) {
+					subtracted.push_back(op->right());
+					base = op->left();
+					op = dynamic_pointer_cast<CSGOperation>(base);
+				}
+				out << "  float d" << n << "; vec4 c" << n << ";\n  {\n";
+				const int k = write(base, cut);
+				out << "  d" << n << " = d" << k << "; c" << n << " = c" << k << ";\n  }\n";
+				auto items = bounded(subtracted);
+				writeGroup(items.begin(), items.end(), n, true, !cut);
+				break;
+			}
+			}
+			return n;
+		}
+
+	private:
+		int vars = 0;
+
+		void writeUnion(int n, std::vector<Operand> items, bool cut)
+		{
+			out << "  float d" << n << " = 1e30; vec4 c" << n << " = vec4(0.0);\n";
+			writeGroup(items.begin(), items.end(), n, false, cut);
+		}
+
+		void writeBound(const BoundingBox &bounds, int n, bool subtract)
+		{
+			out << "  if (bound(p, " << glsl(Vector3d(bounds.center())) << ", " << glsl(Vector3d(bounds.sizes() / 2)) << ") < " <<
+				(subtract ? "-d" : "d") << n << ") {\n";
+		}
+
+		void writeGroup(std::vector<Operand>::iterator begin, std::vector<Operand>::iterator end, int n, bool subtract, bool cut)
+		{
+			if (end - begin <= 4) {
+				for (auto it = begin; it != end; ++it) {
+					writeBound(it->bounds, n, subtract);
+					const int k = write(it->node, cut);
+					if (subtract) out << "  if (-d" << k << " > d" << n << ") { d" << n << " = -d" << k << "; c" << n << " = c" << k << "; }\n";
+					else out << "  if (d" << k << " < d" << n << ") { d" << n << " = d" << k << "; c" << n << " = c" << k << "; }\n";
+					out << "  }\n";
+				}
+				return;
+			}
+			// Split at the median center on the axis the centers spread most along
+			BoundingBox centers;
+			for (auto it = begin; it != end; ++it) centers.extend(it->bounds.center());
+			int axis;
+			centers.sizes().maxCoeff(&axis);
+			const auto mid = begin + (end - begin) / 2;
+			std::nth_element(begin, mid, end, [axis](const Operand &a, const Operand &b) {
+				return a.bounds.center()[axis] < b.bounds.center()[axis];
+			});
+			for (const auto &half : {std::make_pair(begin, mid), std::make_pair(mid, end)}) {
+				BoundingBox bounds;
+				for (auto it = half.first; it != half.second; ++it) bounds.extend(it->bounds);
+				writeBound(bounds, n, subtract);
+				writeGroup(half.first, half.second, n, subtract, cut);
+				out << "  }\n";
+			}
+		}
+
+		void writeLeaf(int n, const shared_ptr<CSGLeaf> &leaf, bool cut)
+		{
+			const auto &shape = *leafShape(*leaf);
+			const Transform3d inverse = leaf->matrix.inverse();
+			std::string q = "p";
+			if (!inverse.linear().isIdentity()) q = glsl(Eigen::Matrix3d(inverse.linear())) + " * p";
+			if (!inverse.translation().isZero()) q = "(" + q + " + " + glsl(Vector3d(inverse.translation())) + ")";
+
+			std::string d;
+			switch (shape.type) {
+			case PolySet::Shape::Type::BOX:
+				d = "sdBox(" + q + ", " + glsl(Vector3d((shape.min + shape.max) / 2)) + ", " + glsl(Vector3d((shape.max - shape.min) / 2)) + ")";
+				break;
+			case PolySet::Shape::Type::PRISM:
+				d = "sdPrism(" + q + ", " + glsl(shape.r1) + ", " + glsl(shape.sides) + ", " + glsl(shape.z1) + ", " + glsl(shape.z2) + ")";
+				break;
+			case PolySet::Shape::Type::CONE:
+				d = "sdCone(" + q + ", " + glsl(shape.r1) + ", " + glsl(shape.r2) + ", " + glsl(shape.z1) + ", " + glsl(shape.z2) + ")";
+				break;
+			default:
+				d = "length(" + q + ") - " + glsl(shape.r1);
+				break;
+			}
+			// Distances shrink by at most the smallest scale of the matrix
+			out << "  float d" << n << " = (" << d << ") * " << glsl(scaling(leaf->matrix).first) << ";\n";
+
+			const char *base = cut ? "cutout" : "material";
+			out << "  vec4 c" << n << " = leafcolor(" << glsl(this->leaves.size()) << ", vec4(";
+			for (int i = 0; i < 4; i++) {
+				if (i) out << ", ";
+				if (leaf->color[i] >= 0) out << glsl(leaf->color[i]);
+				else out << base << "." << "rgba"[i];
+			}
+			out << "));\n";
+			this->leaves.push_back(leaf);
+		}
+	};
+}
+
+shared_ptr<RayMarchScene> RayMarchRenderer::compile(const shared_ptr<CSGNode> &root, size_t maxleaves)
+{
+	auto scene = make_shared<RayMarchScene>();
+	if (!root) return scene;
+
+	// The terms of the union at the top, split like CSGTreeNormalizer does
+	std::vector<shared_ptr<CSGNode>> terms;
+	std::vector<shared_ptr<CSGNode>> todo{root};
+	while (!todo.empty()) {
+		const auto term = std::move(todo.back());
+		todo.pop_back();
+		auto op = dynamic_pointer_cast<CSGOperation>(term);
+		if (op && op->getType() == OpenSCADOperator::UNION && op->getFlags() == CSGNode::FLAG_NONE) {
+			todo.push_back(op->right());
+			todo.push_back(op->left());
+		}
+		else {
+			terms.push_back(term);
+		}
+	}
+
+	std::vector<shared_ptr<CSGNode>> shapes;
+	size_t count = 0;
+	for (const auto &term : terms) {
+		size_t leaves;
+		if (term->getBoundingBox().isEmpty()) continue;
+		if (analytic(term, leaves) && count + leaves <= maxleaves) {
+			shapes.push_back(term);
+			scene->bbox.extend(padded(term->getBoundingBox()));
+			count += leaves;
+		}
+		else {
+			scene->meshes = CSGOperation::createCSGNode(OpenSCADOperator::UNION, scene->meshes, term);
+		}
+	}
+	if (shapes.empty()) return scene;
+
+	ShaderWriter writer;
+	const int n = writer.writeUnion(ShaderWriter::bounded(shapes), false);
+
+	std::ostringstream source;
+	source << fs_header
+				 << "float sdf(vec3 p, out vec4 col) {\n" << writer.out.str()
+				 << "  col = c" << n << ";\n  return d" << n << ";\n}\n"
+				 << "const vec3 lo = " << glsl(scene->bbox.min()) << ", hi = " << glsl(scene->bbox.max()) << ";\n"
+				 << "const float eps = " << glsl(1e-4 * scene->bbox.sizes().norm()) << ";\n"
+				 << fs_main;
+	scene->source = source.str();
+	scene->leaves = std::move(writer.leaves);
+	return scene;
+}
+
+RayMarchRenderer::RayMarchRenderer(const shared_ptr<const RayMarchScene> &scene,
+																	 shared_ptr<CSGProducts> mesh_products,
+																	 shared_ptr<CSGProducts> highlights_products,
+																	 shared_ptr<CSGProducts> background_products,
+																	 GLint *shaderinfo, OpenCSGRenderer *fallback)
+	: scene(scene), meshrenderer(new OpenCSGRenderer(mesh_products, highlights_products, background_products, shaderinfo)),
+		fallback(fallback), program(0), failed(false)
+{
+}
+
+RayMarchRenderer::~RayMarchRenderer()
+{
+	if (this->program) glDeleteProgram(this->program);
+	delete this->meshrenderer;
+}
+
+void RayMarchRenderer::setColorScheme(const ColorScheme &cs)
+{
+	Renderer::setColorScheme(cs);
+	this->meshrenderer->setColorScheme(cs);
+	this->fallback->setColorScheme(cs);
+}
+
+bool RayMarchRenderer::prepareProgram() const
+{
+	if (this->program) return true;
+	if (this->failed || this->scene->source.empty()) return false;
+	this->failed = true;
+	if (!GLEW_VERSION_2_0) return false;
+
+	const char *fs_source = this->scene->source.c_str();
+	auto vs = glCreateShader(GL_VERTEX_SHADER);
+	glShaderSource(vs, 1, (const GLchar**)&vs_source, nullptr);
+	glCompileShader(vs);
+	auto fs = glCreateShader(GL_FRAGMENT_SHADER);
+	glShaderSource(fs, 1, (const GLchar**)&fs_source, nullptr);
+	glCompileShader(fs);
+
+	auto prog = glCreateProgram();
+	glAttachShader(prog, vs);
+	glAttachShader(prog, fs);
+	glLinkProgram(prog);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+
+	GLint status;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		int loglen;
+		char logbuffer[1000];
+		glGetProgramInfoLog(prog, sizeof(logbuffer), &loglen, logbuffer);
+		PRINTB("WARNING: Ray marching disabled, the shader didn't compile: %s", std::string(logbuffer, loglen));
+		glDeleteProgram(prog);
+		return false;
+	}
+	this->program = prog;
+	this->failed = false;
+	return true;
+}
+
+// Draws the analytic terms by a quad covering the viewport, their ids if idbase isn't 0
+void RayMarchRenderer::march(GLuint idbase) const
+{
+	// The picking plane would clip the quad, not the shapes; rays stop at the nearest surface anyway
+	glPushAttrib(GL_ENABLE_BIT);
+	glDisable(GL_CLIP_PLANE0);
+	glUseProgram(this->program);
+	Color4f material, cutout;
+	getColor(ColorMode::MATERIAL, material);
+	getColor(ColorMode::CUTOUT, cutout);
+	glUniform4fv(glGetUniformLocation(this->program, "material"), 1, material.data());
+	glUniform4fv(glGetUniformLocation(this->program, "cutout"), 1, cutout.data());
+	glUniform1i(glGetUniformLocation(this->program, "pick"), idbase != 0);
+	glUniform1f(glGetUniformLocation(this->program, "idbase"), GLfloat(idbase));
+
+	glBegin(GL_QUADS);
+	glVertex2d(-1, -1);
+	glVertex2d(+1, -1);
+	glVertex2d(+1, +1);
+	glVertex2d(-1, +1);
+	glEnd();
+	glUseProgram(0);
+	glPopAttrib();
+}
+
+void RayMarchRenderer::draw(bool showfaces, bool showedges) const
+{
+	TRACE_ZONE("RayMarchRenderer::draw");
+	this->meshrenderer->setRefineBudget(this->refine_budget);
+	this->fallback->setRefineBudget(this->refine_budget);
+	if (!prepareProgram()) {
+		this->fallback->draw(showfaces, showedges);
+		return;
+	}
+	if (showfaces) march(0);
+	this->meshrenderer->draw(showfaces, showedges);
+}
+
+void RayMarchRenderer::drawIds(std::vector<shared_ptr<const CSGLeaf>> &leaves) const
+{
+	const auto base = leaves.size() + 1;
+	if (!prepareProgram() || base + this->scene->leaves.size() > 0xffffff) {
+		this->fallback->drawIds(leaves);
+		return;
+	}
+	leaves.insert(leaves.end(), this->scene->leaves.begin(), this->scene->leaves.end());
+	march(GLuint(base));
+	this->meshrenderer->drawIds(leaves);
+}
+
+bool RayMarchRenderer::isRefined() const
+{
+	return this->program ? this->meshrenderer->isRefined() : this->fallback->isRefined();
+}
+
+BoundingBox RayMarchRenderer::getBoundingBox() const
+{
+	// The same objects
+	return this->fallback->getBoundingBox();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "renderer.h"
+#include "system-gl.h"
+#include "csgnode.h"
+#include <string>
+#include <vector>
+
+class OpenCSGRenderer;
+
+// A CSG tree split into what RayMarchRenderer's shader draws and the rest
+struct RayMarchScene {
+	std::string source; // The fragment shader, empty if no term is analytic
+	BoundingBox bbox; // Of the analytic terms
+	std::vector<shared_ptr<const CSGLeaf>> leaves; // Analytic, by their index in the shader
+	shared_ptr<CSGNode> meshes; // The union of the other terms, to be normalized
+};
+
+/*!
+	Previews by ray marching, as an alternative to the stencil and depth
+	passes of OpenCSG: the terms of the CSG tree built of boxes, prisms,
+	cones and spheres (see PolySet::Shape) are compiled to the signed
+	distance function of a fragment shader, which marches a ray through
+	each pixel of a screen-filling quad and writes the depth of the hit.
+	The other terms, e.g. those of polyhedra, and the highlights and
+	background are drawn by an OpenCSGRenderer into the same depth buffer.
+	Without shaders, fallback draws the whole tree instead.
+*/
+class RayMarchRenderer : public Renderer
+{
+public:
+	/*!
+		Splits the union at the top of root. Must be called before root is
+		normalized, which changes it. At most maxleaves leaves go into the
+		shader, as compiling it gets slow.
+	*/
+	static shared_ptr<RayMarchScene> compile(const shared_ptr<CSGNode> &root, size_t maxleaves = 2048);
+
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+	RayMarchRenderer(const shared_ptr<const RayMarchScene> &scene,
+									 shared_ptr<class CSGProducts> mesh_products,
+									 shared_ptr<CSGProducts> highlights_products,
+									 shared_ptr<CSGProducts> background_products,
+									 GLint *shaderinfo, OpenCSGRenderer *fallback);
+	~RayMarchRenderer();
+	void draw(bool showfaces, bool showedges) const override;
+	BoundingBox getBoundingBox() const override;
+	void drawIds(std::vector<shared_ptr<const CSGLeaf>> &leaves) const override;
+	bool isRefined() const override;
+	void setColorScheme(const ColorScheme &cs) override;
+
+private:
+	// Compiles the shader on first use, in the GL context drawn to
+	bool prepareProgram() const;
+	void march(GLuint idbase) const;
+
+	shared_ptr<const RayMarchScene> scene;
+	OpenCSGRenderer *meshrenderer;
+	OpenCSGRenderer *fallback;
+	mutable GLuint program;
+	mutable bool failed; // The shader didn't compile, only meshes are drawn
+};
@@ -1,9 +1,8 @@
 #pragma once
 
-#include <unordered_map>
-#include <functional>
-#include <vector>
 #include <algorithm>
+#include <vector>
+#include "FlatHashMap.h"
 #include "hash.h"
 
 /*!
@@ -21,41 +20,31 @@ public:
     Looks up a value. Will insert the value if it doesn't already exist.
     Returns the new index. */
   int lookup(const T &val) {
-    typename std::unordered_map<T, int>::const_iterator iter = this->map.find(val);
-    if (iter != this->map.end()) return iter->second;
-    else {
-      this->map.insert(std::make_pair(val, this->map.size()));
-      return this->map.size() - 1;
-    }
+    return int(this->index.insert(val).first);
   }
 
   /*!
     Returns the current size of the new element array
   */
   std::size_t size() const {
-    return this->map.size();
+    return this->index.size();
   }
 
   /*!
     Return the new element array.
   */
-  const std::vector<T>& getArray() {
-    this->vec.resize(this->map.size());
-    for (const auto& entry : map) {
-      this->vec[entry.second] = entry.first;
-    }
-    return this->vec;
+  const std::vector<T>& getArray() const {
+    return this->index.keys();
   }
 
   /*!
     Copies the internal vector to the given destination
   */
-  template <class OutputIterator> void copy(OutputIterator dest) {
-    this->getArray();
-    std::copy(this->vec.begin(), this->vec.end(), dest);
+  template <class OutputIterator> void copy(OutputIterator dest) const {
+    std::copy(this->index.keys().begin(), this->index.keys().end(), dest);
   }
 
 private:
-  std::unordered_map<T, int> map;
-  std::vector<T> vec;
+  // The elements are numbered in order of insertion, so its keys are the new array
+  FlatHashIndex<T> index;
 };
@@ -0,0 +1,426 @@
+#include "RenderFarm.h"
+#include "Tree.h"
+#include "node.h"
+#include "ModuleInstantiation.h"
+#include "Geometry.h"
+#include "GeometryCache.h"
+#include "CGALCache.h"
+#include "CGAL_Nef_polyhedron.h"
+#include "DiskCache.h"
+#include "GeometryEvaluator.h"
+#include "printutils.h"
+#include "exceptions.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#ifndef _WIN32
+#include <csignal>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace pt = boost::property_tree;
+
+RenderFarm *RenderFarm::inst = nullptr;
+
+namespace {
+	// Cost of subtrees whose time isn't known, in units of one boolean of
+	// two operands, and what such a unit takes on average
+	const double seconds_per_unit = 0.01;
+	// Instantiating the model again on a worker isn't worth it for less
+	const double min_job_seconds = 0.05;
+	// Id prefix of the measured times in the DiskCache
+	const char *time_prefix = "rendertime:";
+
+	double node_cost(const AbstractNode &node, size_t numchildren)
+	{
+		const std::string name = node.name();
+		if (name == "minkowski" || name == "hull") return 4.0 * numchildren;
+		if (name == "render") return 1.0;
+		// Groups union their children, like union()
+		return numchildren > 1 ? double(numchildren) : 0.0;
+	}
+}
+
+#ifndef _WIN32
+/*!
+	A worker process, talking over its stdin and stdout. Messages of the
+	worker go to its stderr, which is ours.
+*/
+struct RenderFarm::Worker {
+	Worker(const std::string &command) : command(command), pid(-1), in(-1), out(-1) {}
+	~Worker() { stop(); }
+
+	bool start() {
+		int tochild[2], fromchild[2];
+		if (pipe(tochild) != 0) return false;
+		if (pipe(fromchild) != 0) {
+			close(tochild[0]); close(tochild[1]);
+			return false;
+		}
+		this->pid = fork();
+		if (this->pid == 0) {
+			dup2(tochild[0], STDIN_FILENO);
+			dup2(fromchild[1], STDOUT_FILENO);
+			close(tochild[0]); close(tochild[1]);
+			close(fromchild[0]); close(fromchild[1]);
+			execl("/bin/sh", "sh", "-c", this->command.c_str(), static_cast<char *>(nullptr));
+			_exit(127);
+		}
+		close(tochild[0]);
+		close(fromchild[1]);
+		if (this->pid < 0) {
+			close(tochild[1]); close(fromchild[0]);
+			return false;
+		}
+		this->in = tochild[1];
+		this->out = fromchild[0];
+		fcntl(this->in, F_SETFD, FD_CLOEXEC);
+		fcntl(this->out, F_SETFD, FD_CLOEXEC);
+		return true;
+	}
+
+	void stop() {
+		if (this->pid <= 0) return;
+		// Closing its stdin ends the worker
+		close(this->in);
+		close(this->out);
+		waitpid(this->pid, nullptr, 0);
+		this->pid = -1;
+	}
+
+	bool isRunning() const { return this->pid > 0; }
+
+	bool write(const std::string &data) {
+		for (size_t done = 0; done < data.size();) {
+			const ssize_t n = ::write(this->in, data.data() + done, data.size() - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			done += n;
+		}
+		return true;
+	}
+
+	bool read(char *data, size_t size) {
+		for (size_t done = 0; done < size;) {
+			const ssize_t n = ::read(this->out, data + done, size - done);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			done += n;
+		}
+		return true;
+	}
+
+	bool readLine(std::string &line) {
+		line.clear();
+		char c;
+		while (read(&c, 1)) {
+			if (c == '\n') return true;
+			line += c;
+		}
+		return false;
+	}
+
+	// Sends the job and waits for its result; a failed worker is stopped
+	bool run(const Source &source, const std::string &key, std::string &payload, double &seconds) {
+		pt::ptree request;
+		request.put("file", source.file);
+		request.put("commands", source.commands);
+		request.put("parameterFile", source.parameterFile);
+		request.put("parameterSet", source.parameterSet);
+		request.put("key", key);
+		std::ostringstream line;
+		pt::write_json(line, request, false);
+
+		pt::ptree response;
+		std::string header;
+		if (!write(line.str()) || !readLine(header)) {
+			PRINTB("WARNING: Worker '%s' failed, evaluating its jobs locally", this->command);
+			stop();
+			return false;
+		}
+		size_t size = 0;
+		try {
+			std::istringstream in(header);
+			pt::read_json(in, response);
+			size = response.get<size_t>("size", 0);
+			seconds = response.get<double>("time", 0);
+		}
+		catch (const pt::ptree_error &e) {
+			PRINTB("WARNING: Invalid response of worker '%s': %s", this->command % e.what());
+			stop();
+			return false;
+		}
+		payload.resize(size);
+		if (size > 0 && !read(&payload[0], size)) {
+			PRINTB("WARNING: Worker '%s' failed, evaluating its jobs locally", this->command);
+			stop();
+			return false;
+		}
+		return response.get<std::string>("status", "") == "ok";
+	}
+
+	std::string command;
+	pid_t pid;
+	int in; // The worker's stdin
+	int out; // The worker's stdout
+};
+#else
+struct RenderFarm::Worker {
+	Worker(const std::string &command) : command(command) {}
+	bool start() { return false; }
+	bool isRunning() const { return false; }
+	bool run(const Source &, const std::string &, std::string &, double &) { return false; }
+
+	std::string command;
+};
+#endif
+
+// Stops the workers, which needs the complete Worker type
+RenderFarm::~RenderFarm()
+{
+}
+
+bool RenderFarm::setWorkers(const std::string &spec, const std::string &localcommand)
+{
+	this->commands.clear();
+	this->workers.clear();
+#ifdef _WIN32
+	PRINT("WARNING: Worker processes are not supported on this platform");
+	return false;
+#else
+	std::vector<std::string> items;
+	boost::split(items, spec, boost::is_any_of(";"));
+	for (auto &item : items) {
+		boost::trim(item);
+		if (item.empty()) continue;
+		if (std::all_of(item.begin(), item.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); })) {
+			const auto n = boost::lexical_cast<unsigned int>(item);
+			for (unsigned int i = 0; i < n; ++i) this->commands.push_back(localcommand);
+		}
+		else {
+			this->commands.push_back(item);
+		}
+	}
+	return !this->commands.empty();
+#endif
+}
+
+bool RenderFarm::startWorkers()
+{
+	if (!this->workers.empty()) return true;
+#ifndef _WIN32
+	// A worker which died mustn't kill us when we write to it
+	signal(SIGPIPE, SIG_IGN);
+#endif
+	for (const auto &command : this->commands) {
+		std::unique_ptr<Worker> worker(new Worker(command));
+		if (worker->start()) this->workers.push_back(std::move(worker));
+		else PRINTB("WARNING: Can't start worker '%s'", command);
+	}
+	return !this->workers.empty();
+}
+
+/*!
+	Returns the measured time of the subtree with the given key, zero if
+	it's in the disk cache, or else the estimate.
+*/
+double RenderFarm::knownCost(const std::string &key, double estimate)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		const auto time = this->times.find(key);
+		if (time != this->times.end()) return time->second;
+	}
+	if (DiskCache::instance()->contains(key)) return 0;
+	std::string data;
+	if (DiskCache::instance()->getData(time_prefix + key, data)) {
+		try {
+			return boost::lexical_cast<double>(data);
+		} catch (const boost::bad_lexical_cast &) {
+		}
+	}
+	return estimate;
+}
+
+void RenderFarm::recordTime(const std::string &key, double seconds)
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->times[key] = seconds;
+	}
+	DiskCache::instance()->insertData(time_prefix + key, boost::lexical_cast<std::string>(seconds));
+}
+
+/*!
+	Estimates the time to evaluate the subtree at node in seconds, which is
+	zero for cached subtrees. Shared subtrees are estimated once.
+*/
+double RenderFarm::estimateCost(const Tree &tree, const AbstractNode &node, std::unordered_map<const AbstractNode *, double> &costs)
+{
+	const auto it = costs.find(&node);
+	if (it != costs.end()) return it->second;
+
+	// Subtrees in the memory caches cost nothing
+	const std::string &key = GeometryEvaluator::cacheKey(tree, node);
+	double cost = 0;
+	if (!GeometryCache::instance()->contains(key) && !CGALCache::instance()->contains(key)) {
+		size_t numchildren = 0;
+		for (const auto child : node.getChildren()) {
+			if (child->modinst->isBackground()) continue;
+			cost += estimateCost(tree, *child, costs);
+			numchildren++;
+		}
+		cost += seconds_per_unit * node_cost(node, numchildren);
+
+		// The history and the disk cache are only consulted for subtrees
+		// which may become jobs, since reading them takes file accesses
+		if (cost >= min_job_seconds) cost = knownCost(key, cost);
+	}
+	costs.emplace(&node, cost);
+	return cost;
+}
+
+/*!
+	Splits the tree into subtrees, starting at the root and replacing the
+	most expensive subtree by its children, until there are two jobs per
+	worker or no subtree can be split. Returns those worth a worker, most
+	expensive first.
+*/
+std::vector<RenderFarm::Job> RenderFarm::pickJobs(const Tree &tree)
+{
+	std::unordered_map<const AbstractNode *, double> costs;
+	auto cmp = [](const Job &a, const Job &b) { return a.cost < b.cost; };
+	std::priority_queue<Job, std::vector<Job>, decltype(cmp)> frontier(cmp);
+	std::vector<Job> done;
+	const AbstractNode *root = tree.root();
+	frontier.push(Job{root, GeometryEvaluator::cacheKey(tree, *root), estimateCost(tree, *root, costs)});
+
+	const size_t target = 2 * this->workers.size();
+	while (!frontier.empty() && frontier.size() + done.size() < target) {
+		const Job job = frontier.top();
+		frontier.pop();
+		std::vector<Job> children;
+		for (const auto child : job.node->getChildren()) {
+			if (child->modinst->isBackground()) continue;
+			const double cost = estimateCost(tree, *child, costs);
+			if (cost > 0) children.push_back(Job{child, GeometryEvaluator::cacheKey(tree, *child), cost});
+		}
+		if (children.empty()) done.push_back(job);
+		for (const auto &child : children) frontier.push(child);
+	}
+	while (!frontier.empty()) {
+		done.push_back(frontier.top());
+		frontier.pop();
+	}
+
+	std::vector<Job> jobs;
+	std::unordered_set<std::string> keys;
+	for (const auto &job : done) {
+		if (job.cost >= min_job_seconds && keys.insert(job.key).second) jobs.push_back(job);
+	}
+	std::sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) { return a.cost > b.cost; });
+	return jobs;
+}
+
+void RenderFarm::evaluate(const Tree &tree, const Source &source)
+{
+	if (!isEnabled() || !tree.root() || !startWorkers()) return;
+
+	const auto jobs = pickJobs(tree);
+	if (jobs.empty()) return;
+	PRINTB("Evaluating %d subtrees on %d workers", jobs.size() % this->workers.size());
+
+	std::mutex jobmutex;
+	size_t next = 0;
+	std::vector<std::thread> threads;
+	for (auto &worker : this->workers) {
+		threads.emplace_back([this, &worker, &jobs, &jobmutex, &next, &source]() {
+			while (worker->isRunning()) {
+				size_t i;
+				{
+					std::lock_guard<std::mutex> lock(jobmutex);
+					if (next == jobs.size()) return;
+					i = next++;
+				}
+				const auto &job = jobs[i];
+				std::string payload;
+				double seconds = 0;
+				if (!worker->run(source, job.key, payload, seconds)) continue;
+				const auto geom = DiskCache::decode(payload);
+				if (!geom) {
+					PRINTB("WARNING: Invalid result from worker '%s'", worker->command);
+					continue;
+				}
+				recordTime(job.key, seconds);
+				if (auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
+					CGALCache::instance()->insert(job.key, N);
+				}
+				else if (!GeometryCache::instance()->insert(job.key, geom)) {
+					PRINT("WARNING: RenderFarm: Result didn't fit into cache");
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) thread.join();
+	// Failed workers are dropped, their jobs are evaluated locally
+	this->workers.erase(std::remove_if(this->workers.begin(), this->workers.end(),
+																		 [](const std::unique_ptr<Worker> &worker) { return !worker->isRunning(); }),
+											this->workers.end());
+}
+
+int RenderFarm::runWorker(const EvaluateFunc &evaluate)
+{
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		boost::trim(line);
+		if (line.empty()) continue;
+
+		pt::ptree request;
+		std::string payload;
+		bool ok = false;
+		const auto start = std::chrono::steady_clock::now();
+		try {
+			std::istringstream in(line);
+			pt::read_json(in, request);
+			Source source;
+			source.file = request.get<std::string>("file", "");
+			source.commands = request.get<std::string>("commands", "");
+			source.parameterFile = request.get<std::string>("parameterFile", "");
+			source.parameterSet = request.get<std::string>("parameterSet", "");
+			const auto geom = evaluate(source, request.get<std::string>("key", ""));
+			ok = geom && DiskCache::encode(geom, payload);
+		}
+		catch (const pt::json_parser_error &e) {
+			PRINTB("ERROR: Invalid worker job: %s", e.what());
+		}
+		catch (const HardWarningException &) {
+		}
+		if (!ok) payload.clear();
+		const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		pt::ptree response;
+		response.put("key", request.get<std::string>("key", ""));
+		response.put("status", ok ? "ok" : "error");
+		response.put("time", seconds);
+		response.put("size", payload.size());
+		pt::write_json(std::cout, response, false);
+		std::cout.write(payload.data(), payload.size());
+		std::cout.flush();
+	}
+	return 0;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "memory.h"
+
+class AbstractNode;
+class Geometry;
+class Tree;
+
+/*!
+	Evaluates expensive independent subtrees of a model on worker processes
+	(openscad --worker), which may run on other machines through a remote
+	shell command, e.g. "ssh host openscad --worker".
+
+	Workers instantiate the model again from its Source, so they need the
+	same files (and libraries) at the same paths. A subtree is identified by
+	its cache key (GeometryEvaluator::cacheKey()), which is the same in every
+	process for the same source and CSG backend. The results come back in the DiskCache payload encoding
+	and are put into the CGALCache or GeometryCache, where the following
+	local evaluation of the whole tree finds them.
+
+	Subtrees are picked by their estimated cost: the time they took on a
+	worker before, if known, otherwise a count of the boolean operations in
+	them. The most expensive ones are split until there are enough jobs for
+	all workers, and the jobs are handed out longest first.
+
+	Worker processes are started on first use and kept until exit, so their
+	caches, and the model they last instantiated, survive between jobs.
+	Only supported on POSIX systems.
+*/
+class RenderFarm
+{
+public:
+	// Where a node tree was instantiated from
+	struct Source {
+		std::string file; // Absolute path
+		std::string commands; // -D assignments
+		std::string parameterFile; // Absolute path, or empty
+		std::string parameterSet;
+
+		bool operator==(const Source &other) const {
+			return file == other.file && commands == other.commands &&
+				parameterFile == other.parameterFile && parameterSet == other.parameterSet;
+		}
+	};
+
+	// Evaluates the subtree with the given key, for runWorker()
+	typedef std::function<shared_ptr<const Geometry>(const Source &source, const std::string &key)> EvaluateFunc;
+
+	static RenderFarm *instance() { if (!inst) inst = new RenderFarm; return inst; }
+	~RenderFarm();
+
+	/*!
+		Sets the worker commands, separated by ';'. A number n stands for n
+		local workers, run as localcommand. Returns false if the
+		specification is invalid or workers aren't supported.
+	*/
+	bool setWorkers(const std::string &spec, const std::string &localcommand);
+	bool isEnabled() const { return !this->commands.empty(); }
+
+	// Puts the results of the expensive subtrees of tree into the caches
+	void evaluate(const Tree &tree, const Source &source);
+
+	/*!
+		The worker side: reads jobs from stdin, evaluates them with evaluate
+		and writes the results to stdout, until stdin is closed.
+	*/
+	static int runWorker(const EvaluateFunc &evaluate);
+
+private:
+	static RenderFarm *inst;
+
+	struct Worker;
+	struct Job {
+		const AbstractNode *node;
+		std::string key;
+		double cost;
+	};
+
+	double estimateCost(const Tree &tree, const AbstractNode &node, std::unordered_map<const AbstractNode *, double> &costs);
+	std::vector<Job> pickJobs(const Tree &tree);
+	bool startWorkers();
+	double knownCost(const std::string &key, double estimate);
+	void recordTime(const std::string &key, double seconds);
+
+	std::vector<std::string> commands;
+	std::vector<std::unique_ptr<Worker>> workers;
+	// Measured evaluation time of subtrees by key, also kept in the DiskCache
+	std::unordered_map<std::string, double> times;
+	// Guards times
+	std::mutex mutex;
+};
@@ -0,0 +1,168 @@
+#include "RenderProfile.h"
+#include "node.h"
+#include "ModuleInstantiation.h"
+#include "polyset.h"
+#include "Polygon2d.h"
+#include "InstancedPolySet.h"
+#include "clipper-utils.h"
+#include "printutils.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#endif
+
+RenderProfile *RenderProfile::inst = nullptr;
+bool RenderProfile::enabled = false;
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point epoch = Clock::now();
+
+	// Small, stable thread ids for the trace, in order of first use
+	int thread_number()
+	{
+		static std::atomic<int> count(0);
+		static thread_local int number = count++;
+		return number;
+	}
+
+	void write_string(std::ostream &stream, const std::string &str)
+	{
+		stream << '"';
+		for (unsigned char c : str) {
+			switch (c) {
+			case '"': stream << "\\\""; break;
+			case '\\': stream << "\\\\"; break;
+			case '\n': stream << "\\n"; break;
+			case '\t': stream << "\\t"; break;
+			default:
+				if (c < 0x20) stream << boost::format("\\u%04x") % int(c);
+				else stream << c;
+			}
+		}
+		stream << '"';
+	}
+}
+
+RenderProfile::Event::Event(const char *category, const AbstractNode &node, double start)
+	: category(category), name(node.name()), start(start), duration(now() - start), thread(thread_number())
+{
+	if (node.modinst) {
+		const auto &loc = node.modinst->location();
+		if (!loc.isNone()) {
+			this->file = loc.fileName();
+			this->line = loc.firstLine();
+			this->column = loc.firstColumn();
+		}
+	}
+}
+
+RenderProfile::Event::Event(const char *name, double start)
+	: category("trace"), name(name), start(start), duration(now() - start), thread(thread_number())
+{
+}
+
+void RenderProfile::Event::setGeometry(const Geometry *geom)
+{
+	if (!geom) return;
+	this->hasgeom = true;
+	this->memsize = geom->memsize();
+	if (const auto ps = dynamic_cast<const PolySet *>(geom)) {
+		this->faces = ps->polygons().size();
+		for (const auto &p : ps->polygons()) this->vertices += p.size();
+	}
+	else if (const auto instances = dynamic_cast<const InstancedPolySet *>(geom)) {
+		const auto &ps = *instances->polySet();
+		this->faces = ps.polygons().size() * instances->numInstances();
+		for (const auto &p : ps.polygons()) this->vertices += p.size() * instances->numInstances();
+	}
+	else if (const auto poly = dynamic_cast<const Polygon2d *>(geom)) {
+		// Don't compute the outlines just for this
+		if (const auto &paths = poly->clipperPaths()) {
+			this->faces = paths->size();
+			for (const auto &path : *paths) this->vertices += path.size();
+		}
+		else {
+			this->faces = poly->outlines().size();
+			for (const auto &o : poly->outlines()) this->vertices += o.vertices.size();
+		}
+	}
+#ifdef ENABLE_CGAL
+	else if (const auto N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom)) {
+		if (N->p3) {
+			this->vertices = N->p3->number_of_vertices();
+			this->faces = N->p3->number_of_facets();
+		}
+	}
+#endif
+}
+
+void RenderProfile::setEnabled(bool enable)
+{
+	if (enable && !enabled) {
+		// Created now, since events are recorded from several threads
+		instance();
+		epoch = Clock::now();
+	}
+	enabled = enable;
+}
+
+double RenderProfile::now()
+{
+	return std::chrono::duration<double, std::micro>(Clock::now() - epoch).count();
+}
+
+void RenderProfile::record(Event &&event)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->events.push_back(std::move(event));
+}
+
+void RenderProfile::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->events.clear();
+}
+
+/*!
+	Writes all events as complete ("X") events of the Chrome trace format,
+	with the node details as their arguments. Returns false if the file
+	couldn't be written.
+*/
+bool RenderProfile::write(const std::string &filename) const
+{
+	std::ofstream stream(filename.c_str(), std::ios::out | std::ios::trunc);
+	if (!stream.is_open()) return false;
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	for (const auto &event : this->events) {
+		stream << (first ? "\n" : ",\n") << "{\"name\":";
+		first = false;
+		write_string(stream, event.name);
+		stream << ",\"cat\":\"" << event.category << "\",\"ph\":\"X\",\"pid\":1"
+					 << ",\"tid\":" << event.thread
+					 << boost::format(",\"ts\":%.3f,\"dur\":%.3f") % event.start % event.duration
+					 << ",\"args\":{";
+		if (!event.file.empty()) {
+			stream << "\"file\":";
+			write_string(stream, event.file);
+			stream << ",\"line\":" << event.line << ",\"column\":" << event.column << ",";
+		}
+		stream << "\"thread\":" << event.thread;
+		if (event.cache) stream << ",\"cache\":\"" << event.cache << "\"";
+		if (event.hasgeom) {
+			stream << ",\"memsize\":" << event.memsize
+						 << ",\"vertices\":" << event.vertices
+						 << ",\"faces\":" << event.faces;
+		}
+		stream << "}}";
+	}
+	stream << "\n]}\n";
+	return bool(stream);
+}
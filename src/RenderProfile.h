@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class AbstractNode;
+class Geometry;
+
+/*!
+	Records the time spent on each node by GeometryEvaluator and
+	CSGTreeEvaluator, together with the cache used and the resulting
+	geometry, and writes it in the Chrome trace event format. The events of
+	a node include those of its children, so the trace viewer (or any
+	flamegraph tool reading the format) shows where the time went. Builds
+	with the trace zones compiled in also record those, see Trace.h.
+
+	Recording is disabled until setEnabled(true) is called, which should
+	happen before any evaluation. Events can be recorded from several
+	threads.
+*/
+class RenderProfile
+{
+public:
+	struct Event {
+		Event(const char *category, const AbstractNode &node, double start);
+		// An event of a trace zone, see Zone
+		Event(const char *name, double start);
+
+		// Adds size and vertex and face counts of the given geometry
+		void setGeometry(const Geometry *geom);
+
+		const char *category; // The visitor
+		std::string name;     // The node type
+		std::string file;     // Location of the node's module instantiation
+		int line = 0;
+		int column = 0;
+		double start;         // In microseconds since setEnabled()
+		double duration = 0;
+		int thread = 0;
+		const char *cache = nullptr; // Where the result came from, or "miss", if applicable
+		bool hasgeom = false;
+		size_t memsize = 0;
+		size_t vertices = 0;
+		size_t faces = 0;
+	};
+
+	/*!
+		A scoped event of the trace zones of the hot paths, see TRACE_ZONE()
+		in Trace.h. While recording is disabled it costs a test of a flag.
+	*/
+	class Zone
+	{
+	public:
+		Zone(const char *name) : name(enabled ? name : nullptr), start(enabled ? now() : 0) {}
+		~Zone() { if (this->name) instance()->record(Event(this->name, this->start)); }
+		Zone(const Zone &) = delete;
+		Zone &operator=(const Zone &) = delete;
+
+	private:
+		const char *name;
+		double start;
+	};
+
+	static RenderProfile *instance() { if (!inst) inst = new RenderProfile; return inst; }
+
+	static bool isEnabled() { return enabled; }
+	static void setEnabled(bool enable);
+	static double now();
+
+	void record(Event &&event);
+	void clear();
+	bool write(const std::string &filename) const;
+
+private:
+	static RenderProfile *inst;
+	static bool enabled;
+
+	std::vector<Event> events;
+	// Guards events
+	mutable std::mutex mutex;
+};
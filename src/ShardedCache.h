@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/*!
+	Thread-safe cache, used where Cache<Key,T> would need one global lock.
+
+	Keys are distributed over a fixed number of shards by hash. Each shard has
+	its own mutex, LRU list and index, so threads working on different keys
+	rarely contend. The total cost over all shards is accounted atomically;
+	when an insert pushes it above maxCost(), entries are evicted round-robin
+	from all shards, starting after the inserting one.
+
+	Entries may be given a weight, the effort to recompute them, and are
+	then evicted GreedyDual-Size-Frequency style: each has the priority
+	L + uses * weight / cost at its last use, where L is the priority of the
+	last entry evicted from its shard. A shard evicts the entry of lowest
+	priority among its eviction_window least recently used ones. Expensive
+	entries thus outlive many cheap ones, until they've gone unused long
+	enough for L to pass them. With all weights 0, as by default, this is
+	LRU, which is only exact within a shard.
+
+	At most one shard lock is held at any time. Values are stored and
+	returned by copy, so T should be cheap to copy (e.g. hold a shared_ptr).
+	Evicted values are destroyed after the shard lock is released.
+
+	Lookups are counted for stats(): hits by get(), misses by get() and
+	contains(). So are the evictions to stay below maxCost(). clear()
+	doesn't reset the counts.
+*/
+template <class Key, class T, class Hash = std::hash<Key>>
+class ShardedCache
+{
+public:
+	// The least recently used entries of a shard considered for eviction
+	static const size_t eviction_window = 8;
+
+	explicit ShardedCache(size_t maxCost = 100, size_t numShards = 16);
+
+	size_t maxCost() const { return mx; }
+	void setMaxCost(size_t m) { mx = m; trim(m, 0); }
+	size_t totalCost() const { return total; }
+
+	struct Stats {
+		size_t hits, misses, evictions, evictedCost;
+	};
+	Stats stats() const { return {hits, misses, evictions, evictedcost}; }
+
+	size_t size() const;
+	bool empty() const { return size() == 0; }
+	void clear();
+	// Removes the entries whose key satisfies pred, without counting evictions
+	template <class Pred> void removeIf(Pred pred);
+	// The number and total cost of the entries whose key satisfies pred
+	template <class Pred> std::pair<size_t, size_t> usage(Pred pred) const;
+
+	bool insert(const Key &key, const T &value, size_t cost, double weight = 0);
+	bool get(const Key &key, T &value) const;
+	bool contains(const Key &key) const;
+	bool remove(const Key &key);
+
+private:
+	struct Entry {
+		Entry(const Key &key, const T &value, size_t cost, double weight, double inflation)
+			: key(key), value(value), cost(cost), weight(weight), uses(1) { prioritize(inflation); }
+		void prioritize(double inflation) { priority = inflation + uses * weight / (cost ? cost : 1); }
+		Key key;
+		T value;
+		size_t cost;
+		double weight;
+		size_t uses;
+		double priority;
+	};
+	typedef std::list<Entry> lru_list;
+
+	struct Shard {
+		Shard() : inflation(0) {}
+		std::mutex mutex;
+		// Most recently used first
+		lru_list lru;
+		std::unordered_map<Key, typename lru_list::iterator, Hash> index;
+		// L, the highest priority evicted so far
+		double inflation;
+	};
+
+	size_t shardIndex(const Key &key) const { return hasher(key) % shards.size(); }
+	void trim(size_t m, size_t first);
+
+	Hash hasher;
+	std::vector<std::unique_ptr<Shard>> shards;
+	std::atomic<size_t> mx, total;
+	mutable std::atomic<size_t> hits, misses;
+	std::atomic<size_t> evictions, evictedcost;
+};
+
+template <class Key, class T, class Hash>
+ShardedCache<Key,T,Hash>::ShardedCache(size_t maxCost, size_t numShards)
+	: mx(maxCost), total(0), hits(0), misses(0), evictions(0), evictedcost(0)
+{
+	if (numShards == 0) numShards = 1;
+	for (size_t i = 0; i < numShards; ++i) shards.emplace_back(new Shard);
+}
+
+template <class Key, class T, class Hash>
+size_t ShardedCache<Key,T,Hash>::size() const
+{
+	size_t n = 0;
+	for (const auto &shard : shards) {
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		n += shard->index.size();
+	}
+	return n;
+}
+
+template <class Key, class T, class Hash>
+void ShardedCache<Key,T,Hash>::clear()
+{
+	for (auto &shard : shards) {
+		lru_list evicted;
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		for (const auto &e : shard->lru) total -= e.cost;
+		evicted.swap(shard->lru);
+		shard->index.clear();
+	}
+}
+
+template <class Key, class T, class Hash>
+template <class Pred>
+void ShardedCache<Key,T,Hash>::removeIf(Pred pred)
+{
+	for (auto &shard : shards) {
+		lru_list evicted;
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		for (auto i = shard->lru.begin(); i != shard->lru.end();) {
+			auto next = std::next(i);
+			if (pred(i->key)) {
+				total -= i->cost;
+				shard->index.erase(i->key);
+				evicted.splice(evicted.end(), shard->lru, i);
+			}
+			i = next;
+		}
+	}
+}
+
+template <class Key, class T, class Hash>
+template <class Pred>
+std::pair<size_t, size_t> ShardedCache<Key,T,Hash>::usage(Pred pred) const
+{
+	std::pair<size_t, size_t> result(0, 0);
+	for (const auto &shard : shards) {
+		std::lock_guard<std::mutex> lock(shard->mutex);
+		for (const auto &e : shard->lru) {
+			if (pred(e.key)) {
+				result.first++;
+				result.second += e.cost;
+			}
+		}
+	}
+	return result;
+}
+
+template <class Key, class T, class Hash>
+bool ShardedCache<Key,T,Hash>::insert(const Key &key, const T &value, size_t cost, double weight)
+{
+	if (cost > mx) {
+		remove(key);
+		return false;
+	}
+	const size_t s = shardIndex(key);
+	{
+		lru_list evicted;
+		Shard &shard = *shards[s];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto i = shard.index.find(key);
+		if (i != shard.index.end()) {
+			total -= i->second->cost;
+			evicted.splice(evicted.end(), shard.lru, i->second);
+			shard.index.erase(i);
+		}
+		shard.lru.emplace_front(key, value, cost, weight, shard.inflation);
+		shard.index.emplace(key, shard.lru.begin());
+		total += cost;
+	}
+	if (total > mx) trim(mx, s + 1);
+	return true;
+}
+
+template <class Key, class T, class Hash>
+bool ShardedCache<Key,T,Hash>::get(const Key &key, T &value) const
+{
+	Shard &shard = *shards[shardIndex(key)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto i = shard.index.find(key);
+	if (i == shard.index.end()) {
+		misses++;
+		return false;
+	}
+	hits++;
+	i->second->uses++;
+	i->second->prioritize(shard.inflation);
+	shard.lru.splice(shard.lru.begin(), shard.lru, i->second);
+	value = i->second->value;
+	return true;
+}
+
+template <class Key, class T, class Hash>
+bool ShardedCache<Key,T,Hash>::contains(const Key &key) const
+{
+	Shard &shard = *shards[shardIndex(key)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	if (shard.index.find(key) != shard.index.end()) return true;
+	misses++;
+	return false;
+}
+
+template <class Key, class T, class Hash>
+bool ShardedCache<Key,T,Hash>::remove(const Key &key)
+{
+	lru_list evicted;
+	Shard &shard = *shards[shardIndex(key)];
+	std::lock_guard<std::mutex> lock(shard.mutex);
+	auto i = shard.index.find(key);
+	if (i == shard.index.end()) return false;
+	total -= i->second->cost;
+	evicted.splice(evicted.end(), shard.lru, i->second);
+	shard.index.erase(i);
+	return true;
+}
+
+/*!
+	Evicts entries, one per shard and round, until the total cost is at
+	most m. Stops early if a full round finds all shards empty, which can
+	only happen while other threads are inserting.
+
+	Of equal priorities the least recently used is evicted, so the
+	priorities of weightless entries, which only grow towards the front,
+	make this LRU.
+*/
+template <class Key, class T, class Hash>
+void ShardedCache<Key,T,Hash>::trim(size_t m, size_t first)
+{
+	const size_t n = shards.size();
+	while (total > m) {
+		bool evictedany = false;
+		for (size_t k = 0; k < n && total > m; ++k) {
+			lru_list evicted;
+			Shard &shard = *shards[(first + k) % n];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			if (shard.lru.empty()) continue;
+			auto victim = std::prev(shard.lru.end());
+			auto i = victim;
+			for (size_t w = 1; w < eviction_window && i != shard.lru.begin(); ++w) {
+				--i;
+				if (i->priority < victim->priority) victim = i;
+			}
+			shard.inflation = std::max(shard.inflation, victim->priority);
+			total -= victim->cost;
+			evictions++;
+			evictedcost += victim->cost;
+			shard.index.erase(victim->key);
+			evicted.splice(evicted.end(), shard.lru, victim);
+			evictedany = true;
+		}
+		if (!evictedany) break;
+	}
+}
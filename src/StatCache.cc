@@ -23,13 +23,24 @@
  *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  *
  */
-
 #include "StatCache.h"
 #include "printutils.h"
 
 #include <string>
 #include <unordered_map>
 #include <chrono>
+#include <mutex>
+
+#ifdef __linux__
+#include <unordered_set>
+#include <thread>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
 
 namespace {
 
@@ -44,9 +55,169 @@ struct CacheEntry
 {
 	struct stat st;        // result from stat
 	double timestamp;      // the time stat was called
+	int rv;                // result of a failed stat; only cached for watched files
+	bool watched;          // removed by the watcher instead of going stale
 };
 
 std::unordered_map<std::string, CacheEntry> statMap;
+// Imports may be stat-ed from geometry evaluation threads
+std::mutex statMutex;
+
+#ifdef __linux__
+/*
+	Removes the cache entries of files when inotify reports a change, so these
+	entries don't go stale and an unchanged file is never stat-ed again.
+	The directories are watched rather than the files, since editors save by
+	replacing the file, and so that a missing file can be cached until it is
+	created. Only absolute paths which are not symlinks are watched.
+
+	All members except the thread are guarded by statMutex.
+*/
+class Watcher
+{
+public:
+	~Watcher();
+	bool start();
+	bool active() const { return this->fd >= 0; }
+	bool watch(const std::string &path);
+
+private:
+	void run();
+	void handle(const struct inotify_event &ev);
+	void forget(std::unordered_map<std::string, std::unordered_set<std::string>> &names);
+
+	int fd = -1;
+	int stopfd[2] = {-1, -1};
+	bool failed = false;
+	std::thread thread;
+	std::unordered_map<std::string, int> dirs; // directory -> watch descriptor
+	// watch descriptor -> file name -> the keys of statMap for that file
+	std::unordered_map<int, std::unordered_map<std::string, std::unordered_set<std::string>>> files;
+};
+
+Watcher::~Watcher()
+{
+	if (this->thread.joinable()) {
+		if (write(this->stopfd[1], "", 1) < 0) {}
+		this->thread.join();
+	}
+	if (this->fd >= 0) close(this->fd);
+	if (this->stopfd[0] >= 0) close(this->stopfd[0]);
+	if (this->stopfd[1] >= 0) close(this->stopfd[1]);
+}
+
+bool Watcher::start()
+{
+	if (active()) return true;
+	if (this->failed) return false;
+	this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (this->fd < 0 || pipe2(this->stopfd, O_CLOEXEC) < 0) {
+		PRINTDB("Not watching files for changes: %s", strerror(errno));
+		if (this->fd >= 0) close(this->fd);
+		this->fd = -1;
+		this->failed = true;
+		return false;
+	}
+	this->thread = std::thread(&Watcher::run, this);
+	return true;
+}
+
+/*
+	Watches the directory of the given file. Another change of the file
+	could be missed unless this is called before the file is stat-ed.
+*/
+bool Watcher::watch(const std::string &path)
+{
+	if (!active() || path.empty() || path[0] != '/') return false;
+	const auto sep = path.find_last_of('/');
+	const auto dir = sep == 0 ? std::string("/") : path.substr(0, sep);
+	const auto name = path.substr(sep + 1);
+	if (name.empty() || name == "." || name == "..") return false;
+
+	int wd;
+	auto it = this->dirs.find(dir);
+	if (it != this->dirs.end()) {
+		wd = it->second;
+	}
+	else {
+		wd = inotify_add_watch(this->fd, dir.c_str(), IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB |
+													 IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+		if (wd < 0) return false;
+		this->dirs.emplace(dir, wd);
+	}
+	this->files[wd][name].insert(path);
+	return true;
+}
+
+void Watcher::forget(std::unordered_map<std::string, std::unordered_set<std::string>> &names)
+{
+	for (const auto &name : names) {
+		for (const auto &key : name.second) statMap.erase(key);
+	}
+	names.clear();
+}
+
+void Watcher::handle(const struct inotify_event &ev)
+{
+	if (ev.mask & IN_Q_OVERFLOW) {
+		// Events were lost, so nothing watched can be trusted
+		for (auto &dir : this->files) forget(dir.second);
+		return;
+	}
+	auto dir = this->files.find(ev.wd);
+	if (dir == this->files.end()) return;
+	if (ev.mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+		// The directory is gone; it is watched again on the next stat of one of its files
+		forget(dir->second);
+		this->files.erase(dir);
+		for (auto it = this->dirs.begin(); it != this->dirs.end();) {
+			if (it->second == ev.wd) it = this->dirs.erase(it);
+			else ++it;
+		}
+		if (ev.mask & IN_MOVE_SELF) inotify_rm_watch(this->fd, ev.wd);
+		return;
+	}
+	if (ev.len == 0) return;
+	auto name = dir->second.find(ev.name);
+	if (name == dir->second.end()) return;
+	for (const auto &key : name->second) statMap.erase(key);
+	dir->second.erase(name);
+}
+
+void Watcher::run()
+{
+	alignas(struct inotify_event) char buf[4096];
+	struct pollfd fds[2] = {{this->fd, POLLIN, 0}, {this->stopfd[0], POLLIN, 0}};
+	while (true) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		if (fds[1].revents) return;
+		auto len = read(this->fd, buf, sizeof(buf));
+		if (len < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+		if (len <= 0) break;
+		std::lock_guard<std::mutex> lock(statMutex);
+		for (auto p = buf; p < buf + len;) {
+			auto ev = reinterpret_cast<const struct inotify_event *>(p);
+			handle(*ev);
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+
+	// Without notifications everything watched would be stale forever
+	std::lock_guard<std::mutex> lock(statMutex);
+	for (auto &dir : this->files) forget(dir.second);
+	this->files.clear();
+	this->dirs.clear();
+	close(this->fd);
+	this->fd = -1;
+	this->failed = true;
+}
+
+// Destroyed before statMap and statMutex, which its thread uses
+Watcher watcher;
+#endif
 
 } // namespace
 
@@ -54,17 +225,38 @@ namespace StatCache {
 
 int stat(const std::string &path, struct ::stat &st)
 {
+	std::lock_guard<std::mutex> lock(statMutex);
 	auto iter = statMap.find(path);
 	if (iter != statMap.end()) {                      // Have we got an entry for this file?
-		if (millis_clock() - iter->second.timestamp < stale) {
+		if (iter->second.watched || millis_clock() - iter->second.timestamp < stale) {
 			st = iter->second.st;                        // Not stale yet so return it
-			return 0;
+			return iter->second.rv;
 		}
 		statMap.erase(iter);                            // Remove stale entry
 	}
+#ifdef __linux__
+	if (watcher.watch(path)) {
+		// lstat is the same as stat except for symlinks, whose targets aren't watched
+		auto rv = ::lstat(path.c_str(), &st);
+		if (rv != 0 || !S_ISLNK(st.st_mode)) {
+			statMap[path] = {st, millis_clock(), rv, true};
+			return rv;
+		}
+	}
+#endif
 	if (auto rv = ::stat(path.c_str(), &st)) return rv; // stat failed
-	statMap[path] = {st, millis_clock()};
+	statMap[path] = {st, millis_clock(), 0, false};
 	return 0;
 }   
 
+bool watch()
+{
+#ifdef __linux__
+	std::lock_guard<std::mutex> lock(statMutex);
+	return watcher.start();
+#else
+	return false;
+#endif
+}
+
 } // namespace StatCache
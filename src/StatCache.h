@@ -33,4 +33,9 @@ namespace StatCache {
 
 	int stat(const std::string &path, struct ::stat &st);
 
+	// Keeps entries until the file system reports a change of their file,
+	// rather than for a fixed time, where that is supported (Linux).
+	// Returns false if entries keep going stale over time.
+	bool watch();
+
 }
@@ -0,0 +1,180 @@
+#include "ThreadPool.h"
+
+#include <chrono>
+
+ThreadPool *ThreadPool::inst = nullptr;
+
+namespace {
+	// Index of the queue owned by the current thread, 0 for non-pool threads
+	thread_local size_t current_queue = 0;
+}
+
+unsigned int ThreadPool::hardwareThreads()
+{
+	unsigned int n = std::thread::hardware_concurrency();
+	return n > 0 ? n : 1;
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+/*!
+	Sets the total number of threads used for evaluation. Any running
+	threads are joined (after finishing all queued work) and restarted.
+	A value of 0 selects the number of hardware threads.
+*/
+void ThreadPool::setNumThreads(unsigned int n)
+{
+	if (n == 0) n = hardwareThreads();
+	stop();
+
+	this->numthreads = n;
+	this->stopping = false;
+	this->queues.clear();
+	for (unsigned int i = 0; i < n; ++i) {
+		this->queues.emplace_back(new TaskQueue);
+	}
+	for (unsigned int i = 1; i < n; ++i) {
+		this->threads.emplace_back(&ThreadPool::workerLoop, this, i);
+	}
+}
+
+void ThreadPool::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		this->stopping = true;
+	}
+	this->wakeup.notify_all();
+	for (auto &t : this->threads) t.join();
+	this->threads.clear();
+}
+
+void ThreadPool::submit(Task task)
+{
+	if (!isParallel()) {
+		task();
+		return;
+	}
+	// Counted before the push, so a thread taking the task right away can't
+	// decrement the counter below zero. Until the push, popTask() may find
+	// no task despite the count, which only makes it try again.
+	{
+		std::lock_guard<std::mutex> lock(this->sleep_mutex);
+		++this->queued;
+	}
+	auto &queue = *this->queues[current_queue];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(std::move(task));
+	}
+	this->wakeup.notify_one();
+}
+
+/*!
+	Takes a task from our own queue (LIFO, for locality), or steals the
+	oldest task of another queue.
+*/
+bool ThreadPool::popTask(Task &task)
+{
+	if (this->queued == 0) return false;
+	const size_t n = this->queues.size();
+	for (size_t i = 0; i < n; ++i) {
+		const size_t idx = (current_queue + i) % n;
+		auto &queue = *this->queues[idx];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) continue;
+		if (i == 0) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		--this->queued;
+		return true;
+	}
+	return false;
+}
+
+/*!
+	Executes one pending task in the calling thread, if there is one.
+	Returns false if no task was available.
+*/
+bool ThreadPool::runPendingTask()
+{
+	Task task;
+	if (!popTask(task)) return false;
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop(size_t index)
+{
+	current_queue = index;
+	while (true) {
+		if (runPendingTask()) continue;
+		std::unique_lock<std::mutex> lock(this->sleep_mutex);
+		this->wakeup.wait(lock, [this]() { return this->stopping || this->queued > 0; });
+		if (this->stopping && this->queued == 0) break;
+	}
+}
+
+TaskGroup::~TaskGroup()
+{
+	// Never leave tasks referring to a destroyed group behind
+	try {
+		wait();
+	} catch (...) {
+	}
+}
+
+void TaskGroup::run(const std::function<void()> &f)
+{
+	if (!this->pool->isParallel()) {
+		try {
+			f();
+		} catch (...) {
+			if (!this->error) this->error = std::current_exception();
+		}
+		return;
+	}
+
+	++this->pending;
+	this->pool->submit([this, f]() {
+		std::exception_ptr e;
+		try {
+			f();
+		} catch (...) {
+			e = std::current_exception();
+		}
+		finished(e);
+	});
+}
+
+void TaskGroup::finished(std::exception_ptr e)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (e && !this->error) this->error = e;
+	if (--this->pending == 0) this->done.notify_all();
+}
+
+void TaskGroup::wait()
+{
+	while (this->pending > 0) {
+		if (this->pool->runPendingTask()) continue;
+		// Nothing to help with; our remaining tasks are running elsewhere
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->done.wait_for(lock, std::chrono::milliseconds(1), [this]() { return this->pending == 0; });
+	}
+	// Synchronize with the last finished() call before touching the error state
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (this->error) {
+		std::exception_ptr e = this->error;
+		this->error = nullptr;
+		std::rethrow_exception(e);
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*!
+	A small work-stealing thread pool for evaluating independent pieces of
+	work (e.g. sibling subtrees of the node tree) concurrently.
+
+	Every thread owns a task deque. Tasks submitted from a pool thread are
+	pushed onto that thread's own deque; idle threads pop from the back of
+	their own deque and steal from the front of the others. Threads outside
+	the pool submit to a shared injection deque.
+
+	Work is normally submitted through a TaskGroup. TaskGroup::wait() keeps
+	executing pending tasks in the waiting thread, so nested parallelism
+	(tasks spawning and waiting on tasks) cannot deadlock the pool.
+
+	With numThreads() == 1 (the default) no threads are started, and all
+	tasks are executed inline by the submitting thread.
+*/
+class ThreadPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	static ThreadPool *instance() { if (!inst) inst = new ThreadPool; return inst; }
+	static unsigned int hardwareThreads();
+
+	// Total number of threads taking part in evaluation, including the caller
+	unsigned int numThreads() const { return this->numthreads; }
+	void setNumThreads(unsigned int n);
+	bool isParallel() const { return this->numthreads > 1; }
+
+	void submit(Task task);
+	bool runPendingTask();
+
+private:
+	ThreadPool() : numthreads(1), queued(0), stopping(false) {}
+	~ThreadPool();
+	void stop();
+	void workerLoop(size_t index);
+	bool popTask(Task &task);
+
+	struct TaskQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	static ThreadPool *inst;
+
+	unsigned int numthreads;
+	// queues[0] is the injection queue, queues[i] belongs to threads[i-1]
+	std::vector<std::unique_ptr<TaskQueue>> queues;
+	std::vector<std::thread> threads;
+	std::atomic<size_t> queued;
+	bool stopping;
+	std::mutex sleep_mutex;
+	std::condition_variable wakeup;
+};
+
+/*!
+	Fork/join helper: run() submits tasks to the pool, wait() blocks until
+	all of them are finished while helping to execute pending work.
+	The first exception thrown by a task is rethrown from wait().
+*/
+class TaskGroup
+{
+public:
+	TaskGroup(ThreadPool *pool = ThreadPool::instance()) : pool(pool), pending(0) {}
+	~TaskGroup();
+
+	void run(const std::function<void()> &f);
+	void wait();
+
+private:
+	void finished(std::exception_ptr e);
+
+	ThreadPool *pool;
+	std::atomic<int> pending;
+	std::mutex mutex;
+	std::condition_variable done;
+	std::exception_ptr error;
+};
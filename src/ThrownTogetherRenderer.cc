@@ -27,8 +27,85 @@
 #include "ThrownTogetherRenderer.h"
 #include "polyset.h"
 #include "printutils.h"
+#include "VBOCache.h"
 
 #include "system-gl.h"
+#include "Trace.h"
+
+namespace {
+	// Vertex positions and normals of the surface batches
+	const GLsizei surface_stride = 6 * sizeof(GLfloat);
+	const GLsizei edge_stride = 3 * sizeof(GLfloat);
+	// Batches are split at this many vertices, to keep each buffer at about 100 MB
+	const size_t max_batch_vertices = 1 << 22;
+
+	void colormodes(const CSGChainObject &csgobj, bool highlight_mode, bool background_mode, bool fberror,
+									OpenSCADOperator type, Renderer::ColorMode &colormode, Renderer::ColorMode &edge_colormode)
+	{
+		typedef Renderer::ColorMode ColorMode;
+		colormode = ColorMode::NONE;
+		edge_colormode = ColorMode::NONE;
+
+		if (highlight_mode) {
+			colormode = ColorMode::HIGHLIGHT;
+			edge_colormode = ColorMode::HIGHLIGHT_EDGES;
+		} else if (background_mode) {
+			if (csgobj.flags & CSGNode::FLAG_HIGHLIGHT) {
+				colormode = ColorMode::HIGHLIGHT;
+			}
+			else {
+				colormode = ColorMode::BACKGROUND;
+			}
+			edge_colormode = ColorMode::BACKGROUND_EDGES;
+		} else if (fberror) {
+		} else if (type == OpenSCADOperator::DIFFERENCE) {
+			if (csgobj.flags & CSGNode::FLAG_HIGHLIGHT) {
+				colormode = ColorMode::HIGHLIGHT;
+			}
+			else {
+				colormode = ColorMode::CUTOUT;
+			}
+			edge_colormode = ColorMode::CUTOUT_EDGES;
+		} else {
+			if (csgobj.flags & CSGNode::FLAG_HIGHLIGHT) {
+				colormode = ColorMode::HIGHLIGHT;
+			}
+			else {
+				colormode = ColorMode::MATERIAL;
+			}
+			edge_colormode = ColorMode::MATERIAL_EDGES;
+		}
+	}
+
+	// Appends the triangles of surface_vertices() transformed by m, in front facing order
+	void appendSurface(std::vector<GLfloat> &out, const std::vector<GLfloat> &in, const Transform3d &m)
+	{
+		const bool mirrored = m.matrix().determinant() < 0;
+		const Matrix3d normalmatrix = m.linear().inverse().transpose();
+		static const int order[2][3] = {{0, 1, 2}, {0, 2, 1}};
+		for (size_t t = 0; t + 27 <= in.size(); t += 27) {
+			for (int v : order[mirrored]) {
+				const GLfloat *src = &in[t + 9 * v];
+				const Vector3d p = m * Vector3d(src[0], src[1], src[2]);
+				const Vector3d n = (normalmatrix * Vector3d(src[3], src[4], src[5])).normalized();
+				const GLfloat vertex[6] = {GLfloat(p[0]), GLfloat(p[1]), GLfloat(p[2]),
+																	 GLfloat(n[0]), GLfloat(n[1]), GLfloat(n[2])};
+				out.insert(out.end(), vertex, vertex + 6);
+			}
+		}
+	}
+
+	// Appends the lines of edge_vertices() transformed by m
+	void appendEdges(std::vector<GLfloat> &out, const std::vector<GLfloat> &in, const Transform3d &m)
+	{
+		for (size_t i = 0; i + 3 <= in.size(); i += 3) {
+			const Vector3d p = m * Vector3d(in[i], in[i + 1], in[i + 2]);
+			out.push_back(GLfloat(p[0]));
+			out.push_back(GLfloat(p[1]));
+			out.push_back(GLfloat(p[2]));
+		}
+	}
+}
 
 ThrownTogetherRenderer::ThrownTogetherRenderer(shared_ptr<CSGProducts> root_products,
 																							 shared_ptr<CSGProducts> highlight_products,
@@ -37,22 +114,31 @@ ThrownTogetherRenderer::ThrownTogetherRenderer(shared_ptr<CSGProducts> root_prod
 {
 }
 
+ThrownTogetherRenderer::~ThrownTogetherRenderer()
+{
+	for (const auto *batches : {&this->root_batches, &this->highlight_batches, &this->background_batches}) {
+		for (const auto &batch : batches->surfaces) glDeleteBuffers(1, &batch.buffer);
+		for (const auto &batch : batches->edges) glDeleteBuffers(1, &batch.buffer);
+	}
+}
+
 void ThrownTogetherRenderer::draw(bool /*showfaces*/, bool showedges) const
 {
+	TRACE_ZONE("ThrownTogetherRenderer::draw");
 	PRINTD("Thrown draw");
  	if (this->root_products) {
 		glEnable(GL_CULL_FACE);
 		glCullFace(GL_BACK);
-		renderCSGProducts(*this->root_products, false, false, showedges, false);
+		renderCSGProducts(*this->root_products, this->root_batches, false, false, showedges, false);
 		glCullFace(GL_FRONT);
 		glColor3ub(255, 0, 255);
-		renderCSGProducts(*this->root_products, false, false, showedges, true);
+		renderCSGProducts(*this->root_products, this->root_batches, false, false, showedges, true);
 		glDisable(GL_CULL_FACE);
 	}
 	if (this->background_products)
-	 	renderCSGProducts(*this->background_products, false, true, showedges, false);
+	 	renderCSGProducts(*this->background_products, this->background_batches, false, true, showedges, false);
 	if (this->highlight_products)
-	 	renderCSGProducts(*this->highlight_products, true, false, showedges, false);
+	 	renderCSGProducts(*this->highlight_products, this->highlight_batches, true, false, showedges, false);
 }
 
 void ThrownTogetherRenderer::renderChainObject(const CSGChainObject &csgobj, bool highlight_mode,
@@ -61,38 +147,8 @@ void ThrownTogetherRenderer::renderChainObject(const CSGChainObject &csgobj, boo
 	if (this->geomVisitMark[std::make_pair(csgobj.leaf->geom.get(), &csgobj.leaf->matrix)]++ > 0) return;
 	const Color4f &c = csgobj.leaf->color;
 	csgmode_e csgmode = get_csgmode(highlight_mode, background_mode, type);
-	ColorMode colormode = ColorMode::NONE;
-	ColorMode edge_colormode = ColorMode::NONE;
-	
-	if (highlight_mode) {
-		colormode = ColorMode::HIGHLIGHT;
-		edge_colormode = ColorMode::HIGHLIGHT_EDGES;
-	} else if (background_mode) {
-		if (csgobj.flags & CSGNode::FLAG_HIGHLIGHT) {
-			colormode = ColorMode::HIGHLIGHT;
-		}
-		else {
-			colormode = ColorMode::BACKGROUND;
-		}
-		edge_colormode = ColorMode::BACKGROUND_EDGES;
-	} else if (fberror) {
-	} else if (type == OpenSCADOperator::DIFFERENCE) {
-		if (csgobj.flags & CSGNode::FLAG_HIGHLIGHT) {
-			colormode = ColorMode::HIGHLIGHT;
-		}
-		else {
-			colormode = ColorMode::CUTOUT;
-		}
-		edge_colormode = ColorMode::CUTOUT_EDGES;
-	} else {
-		if (csgobj.flags & CSGNode::FLAG_HIGHLIGHT) {
-			colormode = ColorMode::HIGHLIGHT;
-		}
-		else {
-			colormode = ColorMode::MATERIAL;
-		}
-		edge_colormode = ColorMode::MATERIAL_EDGES;
-	}
+	ColorMode colormode, edge_colormode;
+	colormodes(csgobj, highlight_mode, background_mode, fberror, type, colormode, edge_colormode);
 	
 	const Transform3d &m = csgobj.leaf->matrix;
 	setColor(colormode, c.data());
@@ -108,14 +164,35 @@ void ThrownTogetherRenderer::renderChainObject(const CSGChainObject &csgobj, boo
 	
 }
 
-void ThrownTogetherRenderer::renderCSGProducts(const CSGProducts &products, bool highlight_mode,
-																							 bool background_mode, bool showedges, 
-																							 bool fberror) const
+/*!
+	Draws products with vertex buffers if supported: as the products don't
+	change, the triangles of all objects of the same color are merged in
+	world coordinates, which draws even models of many thousand objects in
+	a few calls. The fberror pass draws the same batches without colors.
+*/
+void ThrownTogetherRenderer::renderCSGProducts(const CSGProducts &products, Batches &batches, bool highlight_mode,
+																							 bool background_mode, bool showedges, bool fberror) const
 {
 	PRINTD("Thrown renderCSGProducts");
 	glDepthFunc(GL_LEQUAL);
-	this->geomVisitMark.clear();
 
+	if (VBOCache::isSupported()) {
+		if (!batches.surfacesbuilt) {
+			buildBatches(products, highlight_mode, background_mode, false, batches.surfaces);
+			batches.surfacesbuilt = true;
+		}
+		renderBatches(batches.surfaces, false, fberror);
+		if (showedges) {
+			if (!batches.edgesbuilt) {
+				buildBatches(products, highlight_mode, background_mode, true, batches.edges);
+				batches.edgesbuilt = true;
+			}
+			renderBatches(batches.edges, true, fberror);
+		}
+		return;
+	}
+
+	this->geomVisitMark.clear();
 	for(const auto &product : products.products) {
 		for(const auto &csgobj : product.intersections) {
 			renderChainObject(csgobj, highlight_mode, background_mode, showedges, fberror, OpenSCADOperator::INTERSECTION);
@@ -126,6 +203,102 @@ void ThrownTogetherRenderer::renderCSGProducts(const CSGProducts &products, bool
 	}
 }
 
+/*!
+	Merges the surfaces, or the edges, of the objects of products into
+	batches by color, visiting each object once like renderChainObject().
+	Full detail PolySets are used regardless of the LODCache.
+*/
+void ThrownTogetherRenderer::buildBatches(const CSGProducts &products, bool highlight_mode, bool background_mode,
+																					bool edges, std::vector<Batch> &batches) const
+{
+	std::vector<std::vector<GLfloat>> data;
+	std::vector<GLfloat> vertices;
+	const size_t floats = edges ? 3 : 6;
+	this->geomVisitMark.clear();
+
+	for (const auto &product : products.products) {
+		for (const auto type : {OpenSCADOperator::INTERSECTION, OpenSCADOperator::DIFFERENCE}) {
+			const auto csgmode = get_csgmode(highlight_mode, background_mode, type);
+			for (const auto &csgobj : type == OpenSCADOperator::DIFFERENCE ? product.subtractions : product.intersections) {
+				if (this->geomVisitMark[std::make_pair(csgobj.leaf->geom.get(), &csgobj.leaf->matrix)]++ > 0) continue;
+				auto ps = geometry_cast<const PolySet>(csgobj.leaf->geom);
+				if (!ps) continue;
+
+				ColorMode colormode, edge_colormode;
+				colormodes(csgobj, highlight_mode, background_mode, false, type, colormode, edge_colormode);
+				if (edges) colormode = edge_colormode;
+				// Edges are drawn in their mode's color only
+				const Color4f color = edges ? Color4f(-1, -1, -1, -1) : csgobj.leaf->color;
+
+				// The last batch of this color, unless it's full
+				int index = -1;
+				for (int i = int(batches.size()) - 1; i >= 0; i--) {
+					if (batches[i].colormode == colormode && batches[i].color == color) {
+						if (data[i].size() / floats < max_batch_vertices) index = i;
+						break;
+					}
+				}
+				if (index < 0) {
+					index = int(batches.size());
+					batches.push_back({colormode, color, 0, 0});
+					data.emplace_back();
+				}
+
+				vertices.clear();
+				if (edges) {
+					ps->edge_vertices(csgmode, vertices);
+					appendEdges(data[index], vertices, csgobj.leaf->matrix);
+				}
+				else {
+					ps->surface_vertices(csgmode, vertices);
+					appendSurface(data[index], vertices, csgobj.leaf->matrix);
+				}
+			}
+		}
+	}
+
+	for (size_t i = 0; i < batches.size(); i++) {
+		glGenBuffers(1, &batches[i].buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, batches[i].buffer);
+		glBufferData(GL_ARRAY_BUFFER, data[i].size() * sizeof(GLfloat), data[i].data(), GL_STATIC_DRAW);
+		batches[i].count = GLsizei(data[i].size() / floats);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	PRINTDB("Thrown batches: %d %s", batches.size() % (edges ? "edges" : "surfaces"));
+}
+
+void ThrownTogetherRenderer::renderBatches(const std::vector<Batch> &batches, bool edges, bool fberror) const
+{
+	if (edges) glDisable(GL_LIGHTING);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if (!edges) glEnableClientState(GL_NORMAL_ARRAY);
+	for (const auto &batch : batches) {
+		// The fberror pass draws in the color set by draw()
+		if (!fberror) setColor(batch.colormode, batch.color.data());
+		glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+		if (edges) {
+			glVertexPointer(3, GL_FLOAT, edge_stride, nullptr);
+			glDrawArrays(GL_LINES, 0, batch.count);
+		}
+		else {
+			glVertexPointer(3, GL_FLOAT, surface_stride, nullptr);
+			glNormalPointer(GL_FLOAT, surface_stride, reinterpret_cast<const GLvoid *>(3 * sizeof(GLfloat)));
+			glDrawArrays(GL_TRIANGLES, 0, batch.count);
+		}
+	}
+	if (!edges) glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if (edges) glEnable(GL_LIGHTING);
+}
+
+void ThrownTogetherRenderer::drawIds(std::vector<shared_ptr<const CSGLeaf>> &leaves) const
+{
+	if (this->root_products) draw_ids(*this->root_products, false, false, leaves);
+	if (this->background_products) draw_ids(*this->background_products, false, true, leaves);
+	if (this->highlight_products) draw_ids(*this->highlight_products, true, false, leaves);
+}
+
 BoundingBox ThrownTogetherRenderer::getBoundingBox() const
 {
 	BoundingBox bbox;
@@ -3,6 +3,7 @@
 #include "renderer.h"
 #include "csgnode.h"
 #include <unordered_map>
+#include <vector>
 #include <boost/functional/hash.hpp>
 
 class ThrownTogetherRenderer : public Renderer
@@ -11,17 +12,36 @@ public:
 	ThrownTogetherRenderer(shared_ptr<class CSGProducts> root_products,
 												 shared_ptr<CSGProducts> highlight_products,
 												 shared_ptr<CSGProducts> background_products);
+	~ThrownTogetherRenderer();
 	void draw(bool showfaces, bool showedges) const override;
 	BoundingBox getBoundingBox() const override;
+	void drawIds(std::vector<shared_ptr<const CSGLeaf>> &leaves) const override;
 private:
-	void renderCSGProducts(const CSGProducts &products, bool highlight_mode, bool background_mode, bool showedges, 
-											bool fberror) const;
+	// The objects of one color merged into a vertex buffer, in world coordinates
+	struct Batch {
+		ColorMode colormode;
+		Color4f color;
+		GLuint buffer;
+		GLsizei count;
+	};
+	// The batches of a CSGProducts, built on first draw
+	struct Batches {
+		std::vector<Batch> surfaces, edges;
+		bool surfacesbuilt = false, edgesbuilt = false;
+	};
+
+	void renderCSGProducts(const CSGProducts &products, Batches &batches, bool highlight_mode, bool background_mode,
+												 bool showedges, bool fberror) const;
+	void buildBatches(const CSGProducts &products, bool highlight_mode, bool background_mode, bool edges,
+										std::vector<Batch> &batches) const;
+	void renderBatches(const std::vector<Batch> &batches, bool edges, bool fberror) const;
 	void renderChainObject(const class CSGChainObject &csgobj, bool highlight_mode,
 												 bool background_mode, bool showedges, bool fberror, OpenSCADOperator type) const;
 
 	shared_ptr<CSGProducts> root_products;
 	shared_ptr<CSGProducts> highlight_products;
 	shared_ptr<CSGProducts> background_products;
+	mutable Batches root_batches, highlight_batches, background_batches;
 	mutable std::unordered_map<std::pair<const Geometry*,const Transform3d*>,
 														 int,
 														 boost::hash<std::pair<const Geometry*,const Transform3d*>>> geomVisitMark;
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+	Trace zones of the hot paths of the interpreter, the geometry kernels
+	and the renderers. TRACE_ZONE("name") opens a zone lasting until the end
+	of the enclosing scope; name must be a string literal, and a scope can
+	hold one zone only.
+
+	The zones are only compiled in with ENABLE_TRACING (cmake -DTRACING=ON
+	or qmake CONFIG+=tracing), otherwise TRACE_ZONE() expands to nothing.
+	When compiled in, they're recorded by the RenderProfile while --profile
+	is given, and written to its file in the Chrome trace event format,
+	which chrome://tracing and Perfetto open and Tracy imports. With
+	ENABLE_TRACY (cmake -DTRACY=ON) they're also sent to a connected Tracy
+	profiler live.
+*/
+
+#ifdef ENABLE_TRACING
+
+#include "RenderProfile.h"
+
+#ifdef ENABLE_TRACY
+#include <tracy/Tracy.hpp>
+#define TRACE_TRACY_ZONE(name) ZoneScopedN(name)
+#else
+#define TRACE_TRACY_ZONE(name) do {} while (0)
+#endif
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_ZONE(name) TRACE_TRACY_ZONE(name); RenderProfile::Zone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+
+#else
+
+#define TRACE_ZONE(name) do {} while (0)
+
+#endif
@@ -1,4 +1,5 @@
 #include "Tree.h"
+#include "Arena.h"
 #include "nodedumper.h"
 #include "printutils.h"
 
@@ -6,6 +7,8 @@
 #include <algorithm>
 #include <sstream>
 #include <tuple>
+#include <unordered_set>
+#include <vector>
 
 Tree::~Tree()
 {
@@ -20,11 +23,13 @@ const std::string Tree::getString(const AbstractNode &node, const std::string &i
 {
 	assert(this->root_node);
 	bool idString = false;
+	std::lock_guard<std::mutex> lock(this->nodecachemutex);
 
 	// Retrieve a nodecache given a tuple of NodeDumper constructor options
 	NodeCache &nodecache = this->nodecachemap[std::make_tuple(indent,idString)];
 
 	if (!nodecache.contains(node)) {
+		nodecache.clear();
 		NodeDumper dumper(nodecache, this->root_node, indent, idString);
 		dumper.traverse(*this->root_node);
 		assert(nodecache.contains(*this->root_node) &&
@@ -35,7 +40,8 @@ const std::string Tree::getString(const AbstractNode &node, const std::string &i
 
 /*!
 	Returns the cached ID string representation of the subtree rooted by \a node.
-	If node is not cached, the cache will be rebuilt.
+	If node is not cached, only its subtree is dumped, reusing any cached
+	subtrees below it.
 
 	The difference between this method and getString() is that the ID string
 	is stripped for whitespace. Especially indentation whitespace is important to
@@ -46,27 +52,85 @@ const std::string Tree::getIdString(const AbstractNode &node) const
 	assert(this->root_node);
 	const std::string indent = "";
 	const bool idString = true;
+	std::lock_guard<std::mutex> lock(this->nodecachemutex);
 
 	// Retrieve a nodecache given a tuple of NodeDumper constructor options
 	NodeCache &nodecache = this->nodecachemap[make_tuple(indent,idString)];
 
 	if (!nodecache.contains(node)) {
-		nodecache.clear();
-		NodeDumper dumper(nodecache, this->root_node, indent, idString);
-		dumper.traverse(*this->root_node);
-		assert(nodecache.contains(*this->root_node) &&
+		NodeDumper dumper(nodecache, &node, indent, idString);
+		dumper.traverse(node);
+		assert(nodecache.contains(node) &&
 					 "NodeDumper failed to create id cache");
 	}
 	return nodecache[node];
 }
 
+/*!
+	Returns the key used to identify the subtree rooted by \a node in the
+	geometry caches. This is a 128-bit hash of the node's ID string, computed
+	from the hashes of its children, so the ID strings of large trees never
+	have to be built. Debug builds use the full ID string instead, to make
+	cache contents readable.
+*/
+const std::string Tree::getIdKey(const AbstractNode &node) const
+{
+#ifdef DEBUG
+	return getIdString(node);
+#else
+	assert(this->root_node);
+	std::lock_guard<std::mutex> lock(this->nodecachemutex);
+
+	if (!this->idhashcache.containsHash(node)) {
+		NodeDumper dumper(this->idhashcache, &node, "", true, true);
+		dumper.traverse(node);
+		assert(this->idhashcache.containsHash(node) &&
+					 "NodeDumper failed to create id hash cache");
+	}
+	return this->idhashcache.hash(node).toString();
+#endif
+}
+
 /*!
 	Sets a new root. Will clear the existing cache.
+
+	If keepCache is set, the cached ID strings and hashes of nodes which are
+	part of the new tree are kept (see NodeReuseCache). This requires node
+	indices to be unique across the old and new tree. With a null root,
+	nothing is removed until the next root is set.
+
+	Afterwards the slabs of the arenas that no longer hold objects are
+	freed, see Arena::releaseAll().
  */
-void Tree::setRoot(const AbstractNode *root)
+void Tree::setRoot(const AbstractNode *root, bool keepCache)
 {
+	std::lock_guard<std::mutex> lock(this->nodecachemutex);
 	this->root_node = root; 
-	this->nodecachemap.clear();
+	if (!keepCache) {
+		this->nodecachemap.clear();
+		this->idhashcache.clear();
+	}
+	else if (root) {
+		std::unordered_set<size_t> indices;
+		std::vector<const AbstractNode *> stack{root};
+		while (!stack.empty()) {
+			const AbstractNode *node = stack.back();
+			stack.pop_back();
+			indices.insert(node->index());
+			for (const auto &child : node->getChildren()) stack.push_back(child);
+		}
+		for (auto it = this->nodecachemap.begin(); it != this->nodecachemap.end(); ) {
+			// Plain dumps depend on the depth of nodes, so only ID caches can be kept
+			if (std::get<1>(it->first)) {
+				it->second.retain(indices);
+				++it;
+			}
+			else it = this->nodecachemap.erase(it);
+		}
+		this->idhashcache.retain(indices);
+	}
+	// The previous tree is gone unless a cache keeps nodes of it
+	Arena::releaseAll();
 }
 
 void Tree::setDocumentPath(const std::string path){
@@ -2,6 +2,7 @@
 
 #include "nodecache.h"
 #include <map>
+#include <mutex>
 
 /*!  
 	For now, just an abstraction of the node tree which keeps a dump
@@ -15,17 +16,22 @@ public:
 	Tree(const AbstractNode *root = nullptr) : root_node(root) {}
 	~Tree();
 
-	void setRoot(const AbstractNode *root);
+	void setRoot(const AbstractNode *root, bool keepCache = false);
 	void setDocumentPath(const std::string path);
 	const AbstractNode *root() const { return this->root_node; }
 
 	const std::string getString(const AbstractNode &node, const std::string &indent) const;
 	const std::string getIdString(const AbstractNode &node) const;
+	const std::string getIdKey(const AbstractNode &node) const;
 	const std::string getDocumentPath() const;
 
 private:
 	const AbstractNode *root_node;
 	// keep a separate nodecache per tuple of NodeDumper constructor parameters
 	mutable std::map<std::tuple<std::string, bool>, NodeCache>  nodecachemap;
+	// structural hashes of id strings, see getIdKey()
+	mutable NodeCache idhashcache;
+	// getString()/getIdString() may be called from concurrent evaluators
+	mutable std::mutex nodecachemutex;
 	std::string document_path;
 };
@@ -0,0 +1,358 @@
+#include "TriangleBVH.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+
+namespace {
+	// Nodes with at most this many triangles may become leaves
+	const uint32_t max_leaf_size = 8;
+	const int num_bins = 16;
+
+	double halfArea(const BoundingBox &box)
+	{
+		const Vector3d d = box.sizes();
+		return d[0] * d[1] + d[1] * d[2] + d[2] * d[0];
+	}
+
+	enum class RayHit { MISS, HIT, GRAZE };
+
+	/*!
+		Möller-Trumbore ray/triangle intersection. The hit is a GRAZE if it is
+		within a small relative distance of an edge, or the ray is parallel to
+		and in the plane of the triangle, so point containment can try another
+		ray instead of counting a crossing twice or not at all.
+	*/
+	template <typename Triangle>
+	RayHit intersectTriangle(const Triangle &tri, const Vector3d &origin, const Vector3d &direction, double &t)
+	{
+		const double eps = 1e-9;
+		const Vector3d e1 = tri.b - tri.a, e2 = tri.c - tri.a;
+		const Vector3d p = direction.cross(e2);
+		const double det = e1.dot(p);
+		const Vector3d s = origin - tri.a;
+		t = std::numeric_limits<double>::quiet_NaN();
+		if (std::abs(det) <= 1e-12 * direction.norm() * e1.norm() * e2.norm()) {
+			const Vector3d n = e1.cross(e2);
+			const double size = e1.norm() + e2.norm();
+			return std::abs(s.dot(n)) <= eps * size * n.norm() ? RayHit::GRAZE : RayHit::MISS;
+		}
+		const double u = s.dot(p) / det;
+		if (u < -eps || u > 1 + eps) return RayHit::MISS;
+		const Vector3d q = s.cross(e1);
+		const double v = direction.dot(q) / det;
+		if (v < -eps || u + v > 1 + eps) return RayHit::MISS;
+		t = e2.dot(q) / det;
+		if (u <= eps || v <= eps || u + v >= 1 - eps) return RayHit::GRAZE;
+		return RayHit::HIT;
+	}
+
+	/*!
+		Separating axis test of two triangles: they are apart if their
+		projections on the normal of either, on the cross products of their
+		edges, or on an in-plane normal of an edge, which separates coplanar
+		triangles, are more than tolerance apart.
+	*/
+	template <typename Triangle>
+	bool trianglesMeet(const Triangle &s, const Triangle &t, double tolerance)
+	{
+		const std::array<Vector3d, 3> es{{s.b - s.a, s.c - s.b, s.a - s.c}};
+		const std::array<Vector3d, 3> et{{t.b - t.a, t.c - t.b, t.a - t.c}};
+		const Vector3d ns = es[0].cross(es[1]), nt = et[0].cross(et[1]);
+		const auto separated = [&](const Vector3d &axis) {
+			const double len = axis.norm();
+			if (len == 0) return false;
+			const double s0 = axis.dot(s.a), s1 = axis.dot(s.b), s2 = axis.dot(s.c);
+			const double t0 = axis.dot(t.a), t1 = axis.dot(t.b), t2 = axis.dot(t.c);
+			const double gap = tolerance * len;
+			return std::min({s0, s1, s2}) > std::max({t0, t1, t2}) + gap ||
+				std::min({t0, t1, t2}) > std::max({s0, s1, s2}) + gap;
+		};
+		if (separated(ns) || separated(nt)) return false;
+		for (const auto &a : es) {
+			for (const auto &b : et) {
+				if (separated(a.cross(b))) return false;
+			}
+		}
+		for (int i = 0; i < 3; ++i) {
+			if (separated(ns.cross(es[i])) || separated(nt.cross(et[i]))) return false;
+		}
+		return true;
+	}
+}
+
+TriangleBVH::TriangleBVH(const PolySet &ps)
+{
+	bool triangulated = true;
+	for (const auto &p : ps.polygons()) {
+		if (p.size() > 3) triangulated = false;
+	}
+	PolySet tessellated(3);
+	if (!triangulated) PolysetUtils::tessellate_faces(ps, tessellated);
+	for (const auto &p : (triangulated ? ps : tessellated).polygons()) {
+		if (p.size() == 3) this->triangles.push_back(Triangle{p[0], p[1], p[2]});
+	}
+	if (this->triangles.empty()) return;
+
+	const auto n = uint32_t(this->triangles.size());
+	std::vector<uint32_t> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	std::vector<Vector3d> centroids;
+	centroids.reserve(n);
+	for (const auto &tri : this->triangles) centroids.push_back((tri.a + tri.b + tri.c) / 3);
+	this->nodes.reserve(2 * (n / max_leaf_size + 1));
+	build(order, centroids, 0, n);
+
+	// Store the triangles of each leaf next to each other
+	std::vector<Triangle> sorted;
+	sorted.reserve(n);
+	for (const auto i : order) sorted.push_back(this->triangles[i]);
+	this->triangles.swap(sorted);
+}
+
+void TriangleBVH::build(std::vector<uint32_t> &order, const std::vector<Vector3d> &centroids, uint32_t begin, uint32_t end)
+{
+	const size_t index = this->nodes.size();
+	this->nodes.emplace_back();
+
+	BoundingBox box, centroidbox;
+	for (uint32_t i = begin; i < end; ++i) {
+		const auto &tri = this->triangles[order[i]];
+		box.extend(tri.a);
+		box.extend(tri.b);
+		box.extend(tri.c);
+		centroidbox.extend(centroids[order[i]]);
+	}
+	this->nodes[index].min = box.min();
+	this->nodes[index].max = box.max();
+
+	const uint32_t count = end - begin;
+	int axis;
+	const double extent = centroidbox.sizes().maxCoeff(&axis);
+	const auto makeLeaf = [&]() {
+		this->nodes[index].start = begin;
+		this->nodes[index].count = count;
+	};
+	if (count <= 2 || extent <= 0) return makeLeaf();
+
+	// Bin the centroids along the longest axis and find the cheapest split
+	const double lo = centroidbox.min()[axis], scale = num_bins / extent;
+	const auto binOf = [&](uint32_t i) {
+		return std::min(num_bins - 1, int((centroids[i][axis] - lo) * scale));
+	};
+	std::array<BoundingBox, num_bins> binboxes;
+	std::array<uint32_t, num_bins> bincounts{};
+	for (uint32_t i = begin; i < end; ++i) {
+		const int bin = binOf(order[i]);
+		const auto &tri = this->triangles[order[i]];
+		binboxes[bin].extend(tri.a);
+		binboxes[bin].extend(tri.b);
+		binboxes[bin].extend(tri.c);
+		bincounts[bin]++;
+	}
+	// Cost of the triangles left of each split, from the left
+	std::array<double, num_bins> leftcost;
+	BoundingBox left;
+	uint32_t leftcount = 0;
+	for (int b = 0; b < num_bins - 1; ++b) {
+		left.extend(binboxes[b]);
+		leftcount += bincounts[b];
+		leftcost[b] = leftcount ? leftcount * halfArea(left) : 0;
+	}
+	BoundingBox right;
+	uint32_t rightcount = 0;
+	double bestcost = std::numeric_limits<double>::infinity();
+	int bestsplit = -1;
+	for (int b = num_bins - 1; b > 0; --b) {
+		right.extend(binboxes[b]);
+		rightcount += bincounts[b];
+		if (rightcount == 0 || rightcount == count) continue;
+		const double cost = leftcost[b - 1] + rightcount * halfArea(right);
+		if (cost < bestcost) {
+			bestcost = cost;
+			bestsplit = b;
+		}
+	}
+	if (count <= max_leaf_size && !(bestcost < count * halfArea(box))) return makeLeaf();
+
+	uint32_t mid;
+	if (bestsplit > 0) {
+		mid = uint32_t(std::partition(order.begin() + begin, order.begin() + end,
+																	[&](uint32_t i) { return binOf(i) < bestsplit; }) - order.begin());
+	}
+	else {
+		// All centroids in one bin: split at the median
+		mid = begin + count / 2;
+		std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+										 [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+	}
+
+	build(order, centroids, begin, mid);
+	this->nodes[index].start = uint32_t(this->nodes.size());
+	this->nodes[index].count = 0;
+	build(order, centroids, mid, end);
+}
+
+BoundingBox TriangleBVH::getBoundingBox() const
+{
+	if (this->nodes.empty()) return BoundingBox();
+	return BoundingBox(this->nodes[0].min, this->nodes[0].max);
+}
+
+size_t TriangleBVH::memsize() const
+{
+	return sizeof(*this) + this->triangles.capacity() * sizeof(Triangle) + this->nodes.capacity() * sizeof(Node);
+}
+
+/*!
+	Calls func(triangle, tmax) for the triangles of the leaves the ray
+	crosses within [tmin, tmax], nearer children first. func may lower tmax
+	to skip what's behind a hit.
+*/
+template <typename TriangleFunc>
+void TriangleBVH::castRay(const Vector3d &origin, const Vector3d &direction, double tmin, double &tmax, TriangleFunc func) const
+{
+	if (this->nodes.empty()) return;
+	// A huge instead of an infinite inverse, so rays in a slab plane don't make NaNs
+	Vector3d inverse;
+	for (int i = 0; i < 3; ++i) inverse[i] = direction[i] != 0 ? 1 / direction[i] : std::copysign(1e300, direction[i]);
+	// Whether the ray enters the box of node before tmax, and where
+	const auto enters = [&](const Node &node, double &tnear) {
+		const Vector3d t1 = (node.min - origin).cwiseProduct(inverse);
+		const Vector3d t2 = (node.max - origin).cwiseProduct(inverse);
+		tnear = std::max(t1.cwiseMin(t2).maxCoeff(), tmin);
+		return tnear <= std::min(t1.cwiseMax(t2).minCoeff(), tmax);
+	};
+
+	double troot;
+	if (!enters(this->nodes[0], troot)) return;
+	std::vector<std::pair<uint32_t, double>> stack{{0, troot}};
+	while (!stack.empty()) {
+		const auto item = stack.back();
+		stack.pop_back();
+		if (item.second > tmax) continue;
+		const Node &node = this->nodes[item.first];
+		if (node.count) {
+			for (uint32_t i = node.start; i < node.start + node.count; ++i) func(i, tmax);
+			continue;
+		}
+		const uint32_t first = item.first + 1, second = node.start;
+		double tfirst, tsecond;
+		const bool hitfirst = enters(this->nodes[first], tfirst), hitsecond = enters(this->nodes[second], tsecond);
+		if (hitfirst && hitsecond) {
+			// The nearer one on top
+			if (tfirst <= tsecond) {
+				stack.emplace_back(second, tsecond);
+				stack.emplace_back(first, tfirst);
+			}
+			else {
+				stack.emplace_back(first, tfirst);
+				stack.emplace_back(second, tsecond);
+			}
+		}
+		else if (hitfirst) stack.emplace_back(first, tfirst);
+		else if (hitsecond) stack.emplace_back(second, tsecond);
+	}
+}
+
+bool TriangleBVH::intersectRay(const Vector3d &origin, const Vector3d &direction, Hit &hit, double tmin, double tmax) const
+{
+	bool found = false;
+	castRay(origin, direction, tmin, tmax, [&](uint32_t i, double &tlimit) {
+		double t;
+		if (intersectTriangle(this->triangles[i], origin, direction, t) != RayHit::MISS && t >= tmin && t <= tlimit) {
+			tlimit = t;
+			hit.t = t;
+			hit.triangle = i;
+			found = true;
+		}
+	});
+	return found;
+}
+
+void TriangleBVH::intersectRayAll(const Vector3d &origin, const Vector3d &direction, std::vector<Hit> &hits, double tmin, double tmax) const
+{
+	castRay(origin, direction, tmin, tmax, [&](uint32_t i, double &) {
+		double t;
+		if (intersectTriangle(this->triangles[i], origin, direction, t) != RayHit::MISS && t >= tmin && t <= tmax) {
+			hits.push_back(Hit{t, i});
+		}
+	});
+}
+
+Vector3d TriangleBVH::normal(size_t triangle) const
+{
+	const auto &tri = this->triangles[triangle];
+	return (tri.b - tri.a).cross(tri.c - tri.a);
+}
+
+boost::tribool TriangleBVH::contains(const Vector3d &p) const
+{
+	if (this->nodes.empty()) return false;
+	const auto box = getBoundingBox();
+	if (!box.contains(p)) return false;
+
+	// Directions unlikely to be parallel to the faces of typical models
+	static const std::array<Vector3d, 3> directions{{
+		Vector3d(0.3247, 0.6014, 0.7302), Vector3d(-0.7071, 0.1652, -0.6876), Vector3d(0.1416, -0.9251, 0.3525)}};
+	const double eps = 1e-9 * box.sizes().norm();
+	int inside = 0, outside = 0;
+	for (const auto &direction : directions) {
+		bool graze = false;
+		int crossings = 0;
+		double tmax = std::numeric_limits<double>::infinity();
+		castRay(p, direction, -eps, tmax, [&](uint32_t i, double &) {
+			if (graze) return;
+			double t;
+			const auto result = intersectTriangle(this->triangles[i], p, direction, t);
+			if (result == RayHit::MISS || t < -eps) return;
+			if (result == RayHit::GRAZE || t <= eps) graze = true;
+			else crossings++;
+		});
+		if (graze) continue;
+		if (crossings % 2) inside++;
+		else outside++;
+	}
+	if (inside >= 2 && outside == 0) return true;
+	if (outside >= 2 && inside == 0) return false;
+	return boost::indeterminate;
+}
+
+bool TriangleBVH::intersects(const TriangleBVH &other, double tolerance) const
+{
+	if (this->nodes.empty() || other.nodes.empty()) return false;
+	const auto apart = [tolerance](const Node &a, const Node &b) {
+		return ((a.min.array() - tolerance) > b.max.array()).any() || ((b.min.array() - tolerance) > a.max.array()).any();
+	};
+
+	std::vector<std::pair<uint32_t, uint32_t>> stack{{0, 0}};
+	while (!stack.empty()) {
+		const auto item = stack.back();
+		stack.pop_back();
+		const Node &a = this->nodes[item.first];
+		const Node &b = other.nodes[item.second];
+		if (apart(a, b)) continue;
+		if (a.count && b.count) {
+			for (uint32_t i = a.start; i < a.start + a.count; ++i) {
+				for (uint32_t j = b.start; j < b.start + b.count; ++j) {
+					if (trianglesMeet(this->triangles[i], other.triangles[j], tolerance)) return true;
+				}
+			}
+		}
+		// Descend into the larger of two inner nodes
+		else if (b.count || (!a.count && (a.max - a.min).sum() >= (b.max - b.min).sum())) {
+			stack.emplace_back(item.first + 1, item.second);
+			stack.emplace_back(a.start, item.second);
+		}
+		else {
+			stack.emplace_back(item.first, item.second + 1);
+			stack.emplace_back(item.first, b.start);
+		}
+	}
+	return false;
+}
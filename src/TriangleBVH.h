@@ -0,0 +1,69 @@
+#pragma once
+
+#include "linalg.h"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <boost/logic/tribool.hpp>
+
+class PolySet;
+
+/*!
+	Bounding volume hierarchy over the triangles of a PolySet, for the ray
+	casts, containment and overlap tests which would otherwise have to
+	visit every face.
+
+	Faces with more than three vertices are tessellated first. The tree is
+	built top down, splitting each node where the surface area heuristic
+	over binned triangle centroids is lowest, and is stored depth first, so
+	the first child of a node follows it. It is immutable once built and can
+	be shared between threads; PolySet::bvh() builds it on first use.
+*/
+class TriangleBVH
+{
+public:
+	explicit TriangleBVH(const PolySet &ps);
+
+	struct Hit {
+		double t; // The hit point is origin + t * direction
+		size_t triangle;
+	};
+
+	size_t numTriangles() const { return this->triangles.size(); }
+	BoundingBox getBoundingBox() const;
+	size_t memsize() const;
+
+	// Finds the nearest hit of the ray with t in [tmin, tmax]
+	bool intersectRay(const Vector3d &origin, const Vector3d &direction, Hit &hit,
+										double tmin = 0, double tmax = std::numeric_limits<double>::infinity()) const;
+	// Appends all hits of the ray with t in [tmin, tmax], in no particular order
+	void intersectRayAll(const Vector3d &origin, const Vector3d &direction, std::vector<Hit> &hits,
+											 double tmin = 0, double tmax = std::numeric_limits<double>::infinity()) const;
+	// The (unnormalized) normal of a triangle, by the order of its vertices
+	Vector3d normal(size_t triangle) const;
+	// Whether p is inside the closed mesh, by the parity of the crossings of
+	// rays from p. Indeterminate if p is on the surface, or the rays graze
+	// edges or disagree, e.g. because the mesh isn't closed.
+	boost::tribool contains(const Vector3d &p) const;
+	// Whether any triangle comes within tolerance of a triangle of other
+	bool intersects(const TriangleBVH &other, double tolerance = 0) const;
+
+private:
+	struct Triangle {
+		Vector3d a, b, c;
+	};
+	struct Node {
+		Vector3d min, max;
+		uint32_t start; // The first triangle of a leaf, the second child of an inner node
+		uint32_t count; // The number of triangles of a leaf, 0 for inner nodes
+	};
+
+	void build(std::vector<uint32_t> &order, const std::vector<Vector3d> &centroids, uint32_t begin, uint32_t end);
+	template <typename TriangleFunc> void castRay(const Vector3d &origin, const Vector3d &direction,
+																								double tmin, double &tmax, TriangleFunc func) const;
+
+	std::vector<Triangle> triangles;
+	std::vector<Node> nodes;
+};
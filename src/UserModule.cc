@@ -30,13 +30,17 @@
 #include "evalcontext.h"
 #include "exceptions.h"
 #include "stackcheck.h"
+#include "JobLimits.h"
 #include "modcontext.h"
 #include "expression.h"
 #include "printutils.h"
 #include "compiler_specific.h"
+#include "ModuleCallCache.h"
+#include "InterpreterProfile.h"
+#include "Trace.h"
 #include <sstream>
 
-std::vector<std::string> UserModule::module_stack;
+thread_local std::vector<std::string> UserModule::module_stack;
 
 static void NOINLINE print_err(std::string name, const Location &loc,const Context *ctx){
 	std::string locs = loc.toRelativeString(ctx->documentPath());
@@ -45,11 +49,14 @@ static void NOINLINE print_err(std::string name, const Location &loc,const Conte
 
 AbstractNode *UserModule::instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const
 {
+	TRACE_ZONE("UserModule::instantiate");
 	if (StackCheck::inst().check()) {
 		print_err(inst->name(),loc,ctx);
 		throw RecursionException::create("module", inst->name(),loc);
 		return nullptr;
 	}
+	JobLimits::Call call;
+	InterpreterProfile::Scope profile(InterpreterProfile::Kind::MODULE, *this, this->name, inst->location());
 
 	// At this point we know that nobody will modify the dependencies of the local scope
 	// passed to this instance, so we can populate the context
@@ -60,20 +67,57 @@ AbstractNode *UserModule::instantiate(const Context *ctx, const ModuleInstantiat
 	c.set_variable("$children", ValuePtr(double(inst->scope.children.size())));
 	module_stack.push_back(inst->name());
 	c.set_variable("$parent_modules", ValuePtr(double(module_stack.size())));
-	c.initializeModule(*this);
-	// FIXME: Set document path to the path of the module
-#if 0 && DEBUG
-	c.dump(this, inst);
-#endif
 
 	AbstractNode *node = new GroupNode(inst);
-	std::vector<AbstractNode *> instantiatednodes = this->scope.instantiateChildren(&c);
-	node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+	if (this->memoize && inst->scope.numElements() == 0) {
+		instantiateMemoized(c, *node);
+	}
+	else {
+		c.initializeModule(*this);
+		// FIXME: Set document path to the path of the module
+#if 0 && DEBUG
+		c.dump(this, inst);
+#endif
+		std::vector<AbstractNode *> instantiatednodes = this->scope.instantiateChildren(&c);
+		node->children.insert(node->children.end(), instantiatednodes.begin(), instantiatednodes.end());
+	}
 	module_stack.pop_back();
 
 	return node;
 }
 
+/*!
+	Instantiates the children of a call without children of its own into
+	node, or lets node share them with an identical earlier call.
+*/
+void UserModule::instantiateMemoized(ModuleContext &c, AbstractNode &node) const
+{
+	FunctionCache::Tracker::ConfigReads config;
+	FunctionCache::Tracker tracker(&c, &config);
+	c.initializeModule(*this);
+
+	std::vector<ValuePtr> args;
+	args.reserve(definition_arguments.size());
+	for (const auto &arg : definition_arguments) args.push_back(c.lookup_variable(arg.name, true));
+	FunctionCache::Key key(this, std::move(args));
+
+	ModuleCallCache::EntryPtr entry;
+	auto cache = ModuleCallCache::instance();
+	const unsigned int calls = ++this->calls;
+	if (cache->get(key, c, entry)) {
+		this->hits++;
+		for (auto child : entry->children) child->retain();
+		node.children = entry->children;
+		return;
+	}
+
+	node.children = this->scope.instantiateChildren(&c);
+	const bool pure = tracker.isPure();
+	if (pure) cache->insert(key, std::make_shared<const ModuleCallCache::Entry>(std::move(config), node.children));
+	// Give up on impure modules, and on those whose calls rarely repeat
+	if (!pure || (calls >= 1024 && this->hits * 16 < calls)) this->memoize = false;
+}
+
 void UserModule::print(std::ostream &stream, const std::string &indent) const
 {
 	std::string tab;
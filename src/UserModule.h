@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -9,19 +10,27 @@
 class UserModule : public AbstractModule, public ASTNode
 {
 public:
-	UserModule(const char *name, const Location &loc) : ASTNode(loc), name(name) { }
-	UserModule(const char *name, const class Feature& feature, const Location &loc) : AbstractModule(feature), ASTNode(loc), name(name) { }
+	UserModule(const char *name, const Location &loc) : ASTNode(loc), name(name), memoize(true), calls(0), hits(0) { }
+	UserModule(const char *name, const class Feature& feature, const Location &loc) : AbstractModule(feature), ASTNode(loc), name(name), memoize(true), calls(0), hits(0) { }
 	~UserModule() {}
 
 	AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx = nullptr) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 	static const std::string& stack_element(int n) { return module_stack[n]; };
 	static int stack_size() { return module_stack.size(); };
+	// The instantiation stack of the current thread
+	static std::vector<std::string> &moduleStack() { return module_stack; }
 
 	std::string name;
 	AssignmentList definition_arguments;
 	LocalScope scope;
 
 private:
-	static std::vector<std::string> module_stack;
+	void instantiateMemoized(class ModuleContext &c, AbstractNode &node) const;
+
+	static thread_local std::vector<std::string> module_stack;
+
+	// Whether calls without children are looked up in and added to the ModuleCallCache
+	mutable std::atomic<bool> memoize;
+	mutable std::atomic<unsigned int> calls, hits;
 };
@@ -0,0 +1,143 @@
+#ifndef NULLGL
+
+#include "VBOCache.h"
+#include "polyset.h"
+
+#include <vector>
+
+VBOCache *VBOCache::inst = nullptr;
+
+namespace {
+	// Vertex positions, normals and barycentric coordinates, see PolySet::surface_vertices()
+	const GLsizei surface_stride = 9 * sizeof(GLfloat);
+	const GLsizei edge_stride = 3 * sizeof(GLfloat);
+
+	// Buffers of released PolySets are deleted after this many new entries
+	const unsigned int prune_interval = 64;
+
+	enum Variant { SURFACE = 0, EDGES = 1, DIFFERENCE = 2, FLAT = 4 };
+
+	// The csgmode only matters for 2D PolySets
+	int variant(const PolySet &ps, Renderer::csgmode_e csgmode, int kind)
+	{
+		if (ps.getDimension() != 2) return kind;
+		if (csgmode == Renderer::CSGMODE_NONE) kind |= FLAT;
+		if (csgmode & CSGMODE_DIFFERENCE_FLAG) kind |= DIFFERENCE;
+		return kind;
+	}
+
+	void upload(GLuint &buffer, const std::vector<GLfloat> &data)
+	{
+		if (!buffer) glGenBuffers(1, &buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLfloat), data.data(), GL_STATIC_DRAW);
+	}
+}
+
+bool VBOCache::isSupported()
+{
+	return GLEW_VERSION_1_5;
+}
+
+/*!
+	Returns the entry of ps, which is (re)built if it's missing or belongs
+	to an earlier PolySet at the same address. The entry's buffer is bound.
+*/
+VBOCache::Entry &VBOCache::lookup(const shared_ptr<const PolySet> &ps, int kind)
+{
+	auto &entry = this->entries[std::make_pair(ps.get(), kind)];
+	if (entry.buffer && entry.ps.lock() == ps) {
+		glBindBuffer(GL_ARRAY_BUFFER, entry.buffer);
+		return entry;
+	}
+
+	std::vector<GLfloat> data;
+	const auto csgmode = (kind & FLAT) ? Renderer::CSGMODE_NONE :
+		(kind & DIFFERENCE) ? Renderer::CSGMODE_DIFFERENCE : Renderer::CSGMODE_NORMAL;
+	if (kind & EDGES) {
+		ps->edge_vertices(csgmode, data);
+		entry.count = GLsizei(data.size() / 3);
+	}
+	else {
+		ps->surface_vertices(csgmode, data);
+		entry.count = GLsizei(data.size() / 9);
+	}
+	entry.ps = ps;
+	upload(entry.buffer, data);
+	if (++this->misses % prune_interval == 0) {
+		pruneExpired();
+		glBindBuffer(GL_ARRAY_BUFFER, entry.buffer);
+	}
+	return entry;
+}
+
+void VBOCache::pruneExpired()
+{
+	for (auto it = this->entries.begin(); it != this->entries.end();) {
+		if (it->second.ps.expired()) {
+			if (it->second.buffer) glDeleteBuffers(1, &it->second.buffer);
+			it = this->entries.erase(it);
+		}
+		else ++it;
+	}
+}
+
+bool VBOCache::renderSurface(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo)
+{
+	if (!isSupported()) return false;
+
+	auto &entry = lookup(ps, variant(*ps, csgmode, SURFACE));
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, surface_stride, nullptr);
+	glNormalPointer(GL_FLOAT, surface_stride, reinterpret_cast<const GLvoid *>(3 * sizeof(GLfloat)));
+
+#ifdef ENABLE_OPENCSG
+	// The edge shader draws the edges in the same pass
+	const bool edges = shaderinfo && shaderinfo[3] >= 0;
+	if (edges) {
+		glEnableVertexAttribArray(shaderinfo[3]);
+		glVertexAttribPointer(shaderinfo[3], 3, GL_FLOAT, GL_FALSE, surface_stride,
+													reinterpret_cast<const GLvoid *>(6 * sizeof(GLfloat)));
+	}
+#endif
+
+	// The triangles are in unmirrored order
+	const bool mirrored = m.matrix().determinant() < 0;
+	if (mirrored) glFrontFace(GL_CW);
+	glDrawArrays(GL_TRIANGLES, 0, entry.count);
+	if (mirrored) glFrontFace(GL_CCW);
+
+#ifdef ENABLE_OPENCSG
+	if (edges) glDisableVertexAttribArray(shaderinfo[3]);
+#endif
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+bool VBOCache::renderEdges(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode)
+{
+	if (!isSupported()) return false;
+
+	auto &entry = lookup(ps, variant(*ps, csgmode, EDGES));
+	glDisable(GL_LIGHTING);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, edge_stride, nullptr);
+	glDrawArrays(GL_LINES, 0, entry.count);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnable(GL_LIGHTING);
+	return true;
+}
+
+void VBOCache::clear()
+{
+	for (auto &entry : this->entries) {
+		if (entry.second.buffer) glDeleteBuffers(1, &entry.second.buffer);
+	}
+	this->entries.clear();
+}
+
+#endif // NULLGL
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "system-gl.h"
+#include "renderer.h"
+#include "memory.h"
+
+#include <unordered_map>
+#include <utility>
+
+class PolySet;
+
+/*!
+	Vertex buffers with the triangles and edges of PolySets, as drawn by
+	PolySet::render_surface() and render_edges(). They are built on first
+	use and reused by all renderers for as long as the PolySet lives, so
+	redrawing a frame only issues one draw call per object.
+
+	Entries are keyed by the PolySet, but only hold it weakly: buffers of
+	released PolySets are rebuilt if the address is reused, and deleted
+	from time to time. All buffers belong to the current OpenGL context;
+	call clear() before it's destroyed.
+
+	The draw functions return false if vertex buffers aren't supported,
+	in which case the caller should fall back to immediate mode.
+*/
+class VBOCache
+{
+public:
+	static VBOCache *instance() { if (!inst) inst = new VBOCache; return inst; }
+
+	bool renderSurface(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo);
+	bool renderEdges(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode);
+	void clear();
+
+	static bool isSupported();
+
+private:
+	VBOCache() : misses(0) {}
+
+	struct Entry {
+		std::weak_ptr<const PolySet> ps;
+		GLuint buffer = 0;
+		GLsizei count = 0;
+	};
+	struct KeyHash {
+		size_t operator()(const std::pair<const PolySet *, int> &key) const {
+			return std::hash<const PolySet *>()(key.first) ^ size_t(key.second);
+		}
+	};
+
+	Entry &lookup(const shared_ptr<const PolySet> &ps, int variant);
+	void pruneExpired();
+
+	static VBOCache *inst;
+
+	std::unordered_map<std::pair<const PolySet *, int>, Entry, KeyHash> entries;
+	unsigned int misses;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+/*!
+	A variable name together with its hash. Contexts key their variables by
+	VariableName, so names known in advance (identifiers in expressions) are
+	hashed once when parsed instead of at every level of every lookup.
+*/
+class VariableName
+{
+public:
+	VariableName(const std::string &name)
+		: name(name), hash(std::hash<std::string>()(name)), config(isConfig(name)), slot(config ? specialSlot(name) : -1) {}
+	VariableName(const char *name) : VariableName(std::string(name)) {}
+
+	operator const std::string &() const { return this->name; }
+	const std::string &str() const { return this->name; }
+	bool operator==(const VariableName &other) const { return this->hash == other.hash && this->name == other.name; }
+
+	// $children is not a config_variable. config_variables have dynamic scope, 
+	// meaning they are passed down the call chain implicitly.
+	// $children is simply misnamed and shouldn't have included the '$'.
+	static bool isConfig(const std::string &name) { return name[0] == '$' && name != "$children"; }
+
+	/*!
+		The config variables looked up most, by primitives and animations,
+		have a fixed slot each, which contexts use to find them in constant
+		time, see Context::lookup_variable().
+	*/
+	static const int specialCount = 5;
+	static const char *specialName(int slot) {
+		static const char *const names[specialCount] = {"$fn", "$fa", "$fs", "$t", "$preview"};
+		return names[slot];
+	}
+	// The slot of a config variable, or -1
+	static int specialSlot(const std::string &name) {
+		for (int slot = 0; slot < specialCount; ++slot) {
+			if (name == specialName(slot)) return slot;
+		}
+		return -1;
+	}
+
+	struct Hash {
+		size_t operator()(const VariableName &name) const { return name.hash; }
+	};
+
+	std::string name;
+	size_t hash;
+	// True for config variables ($fn etc.)
+	bool config;
+	// See specialSlot()
+	int slot;
+};
+
+inline std::ostream &operator<<(std::ostream &stream, const VariableName &name)
+{
+	return stream << name.name;
+}
@@ -0,0 +1,180 @@
+#include "VoxelEvaluator.h"
+#include "VoxelGrid.h"
+#include "GeometryEvaluator.h"
+#include "state.h"
+#include "csgops.h"
+#include "transformnode.h"
+#include "cgaladvnode.h"
+#include "ModuleInstantiation.h"
+#include "polyset.h"
+#include "InstancedPolySet.h"
+#include "printutils.h"
+#include "ThreadPool.h"
+
+shared_ptr<const Geometry> VoxelEvaluator::evaluateGeometry(const AbstractNode &node)
+{
+	this->failed = false;
+	this->traverse(node);
+	auto grid = this->grids[node.index()];
+	this->grids.clear();
+	this->visitedchildren.clear();
+	if (this->failed || !grid) return nullptr;
+
+	auto ps = new PolySet(3);
+	grid->triangulate(*ps);
+	return shared_ptr<const Geometry>(ps);
+}
+
+/*!
+	Combines the grids of the children, all unions in one pass, as there
+	may be many children.
+*/
+void VoxelEvaluator::applyToChildren(const AbstractNode &node, OpenSCADOperator op)
+{
+	std::vector<shared_ptr<VoxelGrid>> children;
+	for (const auto chnode : this->visitedchildren[node.index()]) {
+		auto it = this->grids.find(chnode->index());
+		if (it == this->grids.end()) continue;
+		children.push_back(it->second);
+		this->grids.erase(it);
+	}
+	this->visitedchildren.erase(node.index());
+
+	shared_ptr<VoxelGrid> result;
+	if (children.empty()) {
+		result = make_shared<VoxelGrid>(this->cellsize);
+	}
+	else if (op == OpenSCADOperator::UNION) {
+		result = children.front();
+		std::vector<const VoxelGrid *> others;
+		for (size_t i = 1; i < children.size(); ++i) others.push_back(children[i].get());
+		if (!others.empty()) result->unite(others);
+	}
+	else {
+		result = children.front();
+		for (size_t i = 1; i < children.size(); ++i) result->apply(*children[i], op);
+	}
+	this->grids[node.index()] = result;
+}
+
+/*!
+	Inserts the geometry of node, from the GeometryEvaluator and
+	transformed into the coordinates of the root, into a new grid.
+*/
+void VoxelEvaluator::insertGeometry(const State &state, const AbstractNode &node)
+{
+	auto grid = make_shared<VoxelGrid>(this->cellsize);
+	auto geom = this->geomevaluator.evaluateGeometry(node, false, true);
+	if (geom && !geom->isEmpty()) {
+		if (geom->getDimension() != 3) {
+			this->failed = true;
+		}
+		else if (auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+			// Often many small instances, so in parallel by instances
+			std::vector<VoxelGrid> parts(instances->numInstances(), VoxelGrid(this->cellsize));
+			std::vector<char> inserted(parts.size());
+			TaskGroup group;
+			for (size_t i = 0; i < parts.size(); ++i) {
+				group.run([&, i]() {
+					inserted[i] = parts[i].insert(*instances->polySet(), state.matrix() * instances->transforms()[i]);
+				});
+			}
+			group.wait();
+			std::vector<const VoxelGrid *> others;
+			for (size_t i = 0; i < parts.size(); ++i) {
+				if (!inserted[i]) this->failed = true;
+				others.push_back(&parts[i]);
+			}
+			grid->unite(others);
+		}
+		else if (auto ps = geometry_cast<const PolySet>(geom)) {
+			if (!grid->insert(*ps, state.matrix())) this->failed = true;
+		}
+		else {
+			this->failed = true;
+		}
+	}
+	this->grids[node.index()] = grid;
+	node.progress_report();
+}
+
+Response VoxelEvaluator::visit(State &state, const AbstractNode &node)
+{
+	if (this->failed) return Response::AbortTraversal;
+	if (state.isPostfix()) {
+		applyToChildren(node, OpenSCADOperator::UNION);
+		addToParent(state, node);
+	}
+	return Response::ContinueTraversal;
+}
+
+Response VoxelEvaluator::visit(State &state, const AbstractIntersectionNode &node)
+{
+	if (this->failed) return Response::AbortTraversal;
+	if (state.isPostfix()) {
+		applyToChildren(node, OpenSCADOperator::INTERSECTION);
+		addToParent(state, node);
+	}
+	return Response::ContinueTraversal;
+}
+
+Response VoxelEvaluator::visit(State &state, const CsgOpNode &node)
+{
+	if (this->failed) return Response::AbortTraversal;
+	if (state.isPostfix()) {
+		applyToChildren(node, node.type);
+		addToParent(state, node);
+	}
+	return Response::ContinueTraversal;
+}
+
+Response VoxelEvaluator::visit(State &state, const TransformNode &node)
+{
+	if (this->failed) return Response::AbortTraversal;
+	if (state.isPrefix()) {
+		if (matrix_contains_infinity(node.matrix) || matrix_contains_nan(node.matrix)) {
+			PRINT("WARNING: Transformation matrix contains Not-a-Number and/or Infinity - removing object.");
+			return Response::PruneTraversal;
+		}
+		state.setMatrix(state.matrix() * node.matrix);
+	}
+	if (state.isPostfix()) {
+		applyToChildren(node, OpenSCADOperator::UNION);
+		addToParent(state, node);
+	}
+	return Response::ContinueTraversal;
+}
+
+// Leaves, extrusions and the like, whose children are evaluated with them
+Response VoxelEvaluator::visit(State &state, const AbstractPolyNode &node)
+{
+	if (this->failed) return Response::AbortTraversal;
+	if (state.isPrefix()) {
+		insertGeometry(state, node);
+		addToParent(state, node);
+	}
+	return Response::PruneTraversal;
+}
+
+// Hulls, Minkowski sums and resizes need the exact geometry of their children
+Response VoxelEvaluator::visit(State &state, const CgaladvNode &node)
+{
+	if (this->failed) return Response::AbortTraversal;
+	if (state.isPrefix()) {
+		insertGeometry(state, node);
+		addToParent(state, node);
+	}
+	return Response::PruneTraversal;
+}
+
+/*!
+	Adds ourself to our parent's list of traversed children, unless we're
+	a background object, which isn't part of the result.
+*/
+void VoxelEvaluator::addToParent(const State &state, const AbstractNode &node)
+{
+	this->visitedchildren.erase(node.index());
+	if (state.parent() && !node.modinst->isBackground()) {
+		this->visitedchildren[state.parent()->index()].push_back(&node);
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include "NodeVisitor.h"
+#include "enums.h"
+#include "memory.h"
+
+class VoxelGrid;
+
+/*!
+	Evaluates a tree approximately, by inserting its objects into sparse
+	voxel grids (see VoxelGrid) and doing the booleans on the grids, which
+	are cheap however many objects there are. Only the final grid is
+	triangulated. For models of many overlapping objects, e.g. lattices of
+	thousands of struts, where exact booleans take too long.
+
+	Objects are evaluated by the GeometryEvaluator, from the leaves up to
+	the first node which isn't a union, intersection, difference or
+	transformation. The grids are in the coordinates of the root.
+*/
+class VoxelEvaluator : public NodeVisitor
+{
+public:
+	VoxelEvaluator(const class Tree &tree, class GeometryEvaluator &geomevaluator, double cellsize)
+		: tree(tree), geomevaluator(geomevaluator), cellsize(cellsize), failed(false) {}
+	~VoxelEvaluator() {}
+
+	// nullptr if the tree has 2D objects or is too large for the grid
+	shared_ptr<const class Geometry> evaluateGeometry(const AbstractNode &node);
+
+	Response visit(State &state, const class AbstractNode &node) override;
+	Response visit(State &state, const class AbstractIntersectionNode &node) override;
+	Response visit(State &state, const class AbstractPolyNode &node) override;
+	Response visit(State &state, const class CsgOpNode &node) override;
+	Response visit(State &state, const class TransformNode &node) override;
+	Response visit(State &state, const class CgaladvNode &node) override;
+
+protected:
+	const char *profileCategory() const override { return "VoxelEvaluator"; }
+
+private:
+	void applyToChildren(const AbstractNode &node, OpenSCADOperator op);
+	void insertGeometry(const State &state, const AbstractNode &node);
+	void addToParent(const State &state, const AbstractNode &node);
+
+	const Tree &tree;
+	GeometryEvaluator &geomevaluator;
+	double cellsize;
+	bool failed;
+	VisitedChildren<std::vector<const AbstractNode *>> visitedchildren;
+	std::map<int, shared_ptr<VoxelGrid>> grids; // The grid evaluated from each node index
+};
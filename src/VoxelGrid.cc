@@ -0,0 +1,336 @@
+#include "VoxelGrid.h"
+#include "polyset.h"
+#include "ThreadPool.h"
+#include "TriangleBVH.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+	const Vector3d offset(0.5 + 0.00131, 0.5 + 0.00217, 0.5 + 0.00173);
+
+	// Brick coordinates are stored biased, in 21 bits each
+	const long bias = 1L << 20;
+
+	// The bit of the sample at x, y, z within its brick
+	inline uint64_t bit(long x, long y, long z)
+	{
+		return uint64_t(1) << ((x & 3) | ((y & 3) << 2) | ((z & 3) << 4));
+	}
+
+	// Sorts bricks by key and ORs those with the same key together
+	void normalize(std::vector<std::pair<uint64_t, uint64_t>> &bricks)
+	{
+		if (bricks.empty()) return;
+		std::sort(bricks.begin(), bricks.end());
+		size_t last = 0;
+		for (size_t i = 1; i < bricks.size(); ++i) {
+			if (bricks[i].first == bricks[last].first) bricks[last].second |= bricks[i].second;
+			else bricks[++last] = bricks[i];
+		}
+		bricks.resize(last + 1);
+	}
+}
+
+double VoxelGrid::cellSizeFor(const BoundingBox &box, double cellsize)
+{
+	// Up to 2^24 bricks, 256 MB, if all of the box is inside
+	const double maxsamples = double(uint64_t(1) << 30);
+	if (box.isEmpty()) return cellsize;
+	const Vector3d sizes = box.sizes();
+	while ((sizes[0] / cellsize + 2) * (sizes[1] / cellsize + 2) * (sizes[2] / cellsize + 2) > maxsamples) cellsize *= 2;
+	return cellsize;
+}
+
+uint64_t VoxelGrid::key(long x, long y, long z)
+{
+	// y first, so the bricks of insert() come sorted by rows
+	return (uint64_t(y + bias) << 42) | (uint64_t(z + bias) << 21) | uint64_t(x + bias);
+}
+
+void VoxelGrid::coordinates(uint64_t key, long &x, long &y, long &z)
+{
+	const uint64_t mask = (uint64_t(1) << 21) - 1;
+	x = long(key & mask) - bias;
+	z = long((key >> 21) & mask) - bias;
+	y = long(key >> 42) - bias;
+}
+
+double VoxelGrid::coordinate(int axis, long i) const
+{
+	return (i + offset[axis]) * this->cellsize;
+}
+
+uint64_t VoxelGrid::bits(uint64_t key) const
+{
+	const auto it = std::lower_bound(this->bricks.begin(), this->bricks.end(), Brick(key, 0));
+	return it != this->bricks.end() && it->first == key ? it->second : 0;
+}
+
+/*!
+	Casts one ray in +z per column of samples, in parallel by rows of
+	bricks.
+*/
+bool VoxelGrid::insert(const PolySet &ps, const Transform3d &matrix)
+{
+	if (ps.isEmpty()) return true;
+	const PolySet *mesh = &ps;
+	PolySet transformed(3);
+	if (!matrix.matrix().isIdentity()) {
+		transformed = ps;
+		transformed.transform(matrix);
+		mesh = &transformed;
+	}
+	const auto bvh = mesh->bvh();
+	const auto box = bvh->getBoundingBox();
+
+	// The samples within box
+	std::array<long, 3> first, last;
+	for (int axis = 0; axis < 3; ++axis) {
+		const double lo = std::ceil(box.min()[axis] / this->cellsize - offset[axis]);
+		const double hi = std::floor(box.max()[axis] / this->cellsize - offset[axis]);
+		if (lo < -4.0 * (bias - 2) || hi > 4.0 * (bias - 2)) return false;
+		first[axis] = long(lo);
+		last[axis] = long(hi);
+		if (first[axis] > last[axis]) return true;
+	}
+	const double eps = 1e-9 * box.sizes().norm();
+	const double zstart = box.min()[2] - 1;
+	const Vector3d direction(0, 0, 1);
+
+	const long firstrow = first[1] >> 2, lastrow = last[1] >> 2;
+	std::vector<std::vector<Brick>> rows(lastrow - firstrow + 1);
+	TaskGroup group;
+	for (long row = firstrow; row <= lastrow; ++row) {
+		group.run([&, row]() {
+			auto &result = rows[row - firstrow];
+			std::vector<TriangleBVH::Hit> hits;
+			for (long y = std::max(row * 4, first[1]); y <= std::min(row * 4 + 3, last[1]); ++y) {
+				for (long x = first[0]; x <= last[0]; ++x) {
+					hits.clear();
+					bvh->intersectRayAll(Vector3d(coordinate(0, x), coordinate(1, y), zstart), direction, hits);
+					if (hits.empty()) continue;
+					std::sort(hits.begin(), hits.end(), [](const TriangleBVH::Hit &a, const TriangleBVH::Hit &b) {
+						return a.t < b.t;
+					});
+
+					int winding = 0, lastside = 0;
+					double lastt = -1, enter = 0;
+					for (const auto &hit : hits) {
+						const int side = bvh->normal(hit.triangle)[2] < 0 ? 1 : -1;
+						// A ray through an edge hits both faces
+						if (side == lastside && hit.t - lastt < eps) continue;
+						lastside = side;
+						lastt = hit.t;
+						const bool wasinside = winding != 0;
+						winding += side;
+						if (!wasinside) {
+							enter = zstart + hit.t;
+							continue;
+						}
+						if (winding != 0) continue;
+						// The samples from enter to here are inside
+						const long z0 = std::max(long(std::ceil(enter / this->cellsize - offset[2])), first[2]);
+						const long z1 = std::min(long(std::floor((zstart + hit.t) / this->cellsize - offset[2])), last[2]);
+						for (long z = z0; z <= z1;) {
+							const long brick = z >> 2;
+							uint64_t word = 0;
+							for (; z <= z1 && (z >> 2) == brick; ++z) word |= bit(x, y, z);
+							result.emplace_back(key(x >> 2, y >> 2, brick), word);
+						}
+					}
+				}
+			}
+			normalize(result);
+		});
+	}
+	group.wait();
+
+	// The rows are sorted, and in order of their keys
+	VoxelGrid grid(this->cellsize);
+	for (const auto &row : rows) grid.bricks.insert(grid.bricks.end(), row.begin(), row.end());
+	if (this->bricks.empty()) this->bricks.swap(grid.bricks);
+	else apply(grid, OpenSCADOperator::UNION);
+	return true;
+}
+
+void VoxelGrid::unite(const std::vector<const VoxelGrid *> &others)
+{
+	size_t size = this->bricks.size();
+	for (const auto other : others) size += other->bricks.size();
+	this->bricks.reserve(size);
+	for (const auto other : others) this->bricks.insert(this->bricks.end(), other->bricks.begin(), other->bricks.end());
+	normalize(this->bricks);
+}
+
+void VoxelGrid::apply(const VoxelGrid &other, OpenSCADOperator op)
+{
+	std::vector<Brick> result;
+	auto a = this->bricks.cbegin(), b = other.bricks.cbegin();
+	const auto aend = this->bricks.cend(), bend = other.bricks.cend();
+	switch (op) {
+	case OpenSCADOperator::UNION:
+		result.reserve(this->bricks.size() + other.bricks.size());
+		while (a != aend || b != bend) {
+			if (b == bend || (a != aend && a->first < b->first)) result.push_back(*a++);
+			else if (a == aend || b->first < a->first) result.push_back(*b++);
+			else {
+				result.emplace_back(a->first, a->second | b->second);
+				++a, ++b;
+			}
+		}
+		break;
+	case OpenSCADOperator::INTERSECTION:
+		while (a != aend && b != bend) {
+			if (a->first < b->first) ++a;
+			else if (b->first < a->first) ++b;
+			else {
+				if (const uint64_t word = a->second & b->second) result.emplace_back(a->first, word);
+				++a, ++b;
+			}
+		}
+		break;
+	default:
+		while (a != aend) {
+			while (b != bend && b->first < a->first) ++b;
+			if (b != bend && b->first == a->first) {
+				if (const uint64_t word = a->second & ~b->second) result.emplace_back(a->first, word);
+			}
+			else {
+				result.push_back(*a);
+			}
+			++a;
+		}
+		break;
+	}
+	this->bricks.swap(result);
+}
+
+/*!
+	Marches over the six tetrahedra around the main diagonal of each cell
+	between samples, for the cells with samples both inside and outside.
+	Vertices are at the midpoints of the edges between inside and outside
+	samples, computed from the indices of the samples only, so
+	neighbouring cells share them exactly and the result is closed.
+*/
+void VoxelGrid::triangulate(PolySet &ps) const
+{
+	// The six permutations of the axes, each giving the tetrahedron 0, a, a|b, 7
+	static const int permutations[6][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+	std::array<std::array<int, 4>, 6> tetrahedra;
+	for (int i = 0; i < 6; ++i) {
+		const int a = 1 << permutations[i][0], b = 1 << permutations[i][1];
+		tetrahedra[i] = {{0, a, a | b, 7}};
+	}
+
+	// The bricks whose cells have a corner in an occupied brick
+	std::vector<uint64_t> cellbricks;
+	cellbricks.reserve(this->bricks.size() * 8);
+	for (const auto &brick : this->bricks) {
+		long x, y, z;
+		coordinates(brick.first, x, y, z);
+		for (int c = 0; c < 8; ++c) cellbricks.push_back(key(x - (c & 1), y - ((c >> 1) & 1), z - ((c >> 2) & 1)));
+	}
+	std::sort(cellbricks.begin(), cellbricks.end());
+	cellbricks.erase(std::unique(cellbricks.begin(), cellbricks.end()), cellbricks.end());
+
+	typedef std::array<long, 3> Index;
+	// The midpoint of the samples p and q
+	const auto point = [this](const Index &p, const Index &q) {
+		Vector3d v;
+		for (int axis = 0; axis < 3; ++axis) v[axis] = ((p[axis] + q[axis]) * 0.5 + offset[axis]) * this->cellsize;
+		return v;
+	};
+
+	const size_t chunksize = 1024;
+	std::vector<PolySet> chunks;
+	chunks.reserve((cellbricks.size() + chunksize - 1) / chunksize);
+	while (chunks.size() < chunks.capacity()) chunks.emplace_back(3);
+	TaskGroup group;
+	for (size_t chunk = 0; chunk < chunks.size(); ++chunk) {
+		group.run([&, chunk]() {
+			PolySet &out = chunks[chunk];
+			// Appends the triangle, with its normal pointing along outward
+			const auto emit = [&out](const Vector3d &a, const Vector3d &b, const Vector3d &c, const Vector3d &outward) {
+				out.append_poly();
+				out.append_vertex(a);
+				if ((b - a).cross(c - a).dot(outward) >= 0) {
+					out.append_vertex(b);
+					out.append_vertex(c);
+				}
+				else {
+					out.append_vertex(c);
+					out.append_vertex(b);
+				}
+			};
+
+			const size_t end = std::min(cellbricks.size(), (chunk + 1) * chunksize);
+			for (size_t i = chunk * chunksize; i < end; ++i) {
+				long bx, by, bz;
+				coordinates(cellbricks[i], bx, by, bz);
+				// This brick and its neighbours in +x, +y and +z
+				std::array<uint64_t, 8> words;
+				bool any = false, all = true;
+				for (int c = 0; c < 8; ++c) {
+					words[c] = bits(key(bx + (c & 1), by + ((c >> 1) & 1), bz + ((c >> 2) & 1)));
+					any |= words[c] != 0;
+					all &= words[c] == ~uint64_t(0);
+				}
+				if (!any || all) continue;
+
+				const auto inside = [&](long x, long y, long z) {
+					return (words[(x >> 2) | ((y >> 2) << 1) | ((z >> 2) << 2)] & bit(x, y, z)) != 0;
+				};
+				for (long z = 0; z < 4; ++z) {
+					for (long y = 0; y < 4; ++y) {
+						for (long x = 0; x < 4; ++x) {
+							std::array<bool, 8> corners;
+							int occupied = 0;
+							for (int c = 0; c < 8; ++c) {
+								corners[c] = inside(x + (c & 1), y + ((c >> 1) & 1), z + ((c >> 2) & 1));
+								occupied += corners[c];
+							}
+							if (occupied == 0 || occupied == 8) continue;
+
+							for (const auto &tet : tetrahedra) {
+								std::array<Index, 4> p;
+								std::array<int, 4> in, out;
+								int nin = 0, nout = 0;
+								for (int j = 0; j < 4; ++j) {
+									const int c = tet[j];
+									p[j] = {{bx * 4 + x + (c & 1), by * 4 + y + ((c >> 1) & 1), bz * 4 + z + ((c >> 2) & 1)}};
+									if (corners[c]) in[nin++] = j;
+									else out[nout++] = j;
+								}
+								if (nin == 0 || nout == 0) continue;
+								const auto sample = [&](int j) { return point(p[j], p[j]); };
+
+								if (nin == 1 || nout == 1) {
+									// One corner cut off
+									const bool single_in = nin == 1;
+									const int apex = single_in ? in[0] : out[0];
+									const auto &others = single_in ? out : in;
+									Vector3d outward = (sample(others[0]) + sample(others[1]) + sample(others[2])) / 3 - sample(apex);
+									if (!single_in) outward = -outward;
+									emit(point(p[apex], p[others[0]]), point(p[apex], p[others[1]]), point(p[apex], p[others[2]]), outward);
+								}
+								else {
+									// The quad between the two inside and the two outside corners
+									const int a = in[0], b = in[1], c = out[0], d = out[1];
+									const Vector3d outward = (sample(c) + sample(d)) - (sample(a) + sample(b));
+									const Vector3d ac = point(p[a], p[c]), ad = point(p[a], p[d]);
+									const Vector3d bd = point(p[b], p[d]), bc = point(p[b], p[c]);
+									emit(ac, ad, bd, outward);
+									emit(ac, bd, bc, outward);
+								}
+							}
+						}
+					}
+				}
+			}
+		});
+	}
+	group.wait();
+	for (const auto &chunk : chunks) ps.append(chunk);
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "linalg.h"
+#include "enums.h"
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+class PolySet;
+
+/*!
+	Sparse occupancy grid of sample points, for approximate booleans
+	without intermediate meshes.
+
+	The samples are at (i + offset) * cellsize for integer i on each axis,
+	the same grid for every VoxelGrid of a cell size, so grids can be
+	combined sample by sample. The offsets keep the samples off the axis
+	aligned faces and the edges of typical models.
+
+	Samples are stored in bricks of 4x4x4 bits, one 64 bit word each, so
+	combining grids does 64 samples at once. Only bricks with samples
+	inside are stored, sorted by their key, so booleans are merges.
+*/
+class VoxelGrid
+{
+public:
+	explicit VoxelGrid(double cellsize) : cellsize(cellsize) {}
+
+	// The given cell size, doubled until the samples of box take at most 256 MB
+	static double cellSizeFor(const BoundingBox &box, double cellsize);
+
+	double cellSize() const { return this->cellsize; }
+	bool isEmpty() const { return this->bricks.empty(); }
+	size_t memsize() const { return sizeof(*this) + this->bricks.capacity() * sizeof(Brick); }
+
+	/*!
+		Marks the samples inside the closed mesh ps, transformed by matrix.
+		A sample is inside if the winding number of the faces below it is
+		not zero, which holds for either face orientation and for
+		overlapping shells. Returns false if the mesh is too large for the
+		grid.
+	*/
+	bool insert(const PolySet &ps, const Transform3d &matrix = Transform3d::Identity());
+	// Combines with other, of the same cell size, by union, intersection or difference
+	void apply(const VoxelGrid &other, OpenSCADOperator op);
+	// The union with all of others at once, faster than one apply() each for many
+	void unite(const std::vector<const VoxelGrid *> &others);
+	/*!
+		Triangulates the boundary of the inside samples, by marching
+		tetrahedra, into a closed PolySet with outward facing normals.
+	*/
+	void triangulate(PolySet &ps) const;
+
+private:
+	typedef std::pair<uint64_t, uint64_t> Brick; // Key and bits
+
+	static uint64_t key(long x, long y, long z);
+	static void coordinates(uint64_t key, long &x, long &y, long &z);
+	double coordinate(int axis, long i) const;
+	uint64_t bits(uint64_t key) const;
+
+	double cellsize;
+	std::vector<Brick> bricks;
+};
@@ -0,0 +1,202 @@
+#include "ZipWriter.h"
+#include "printutils.h"
+
+#include <zlib.h>
+
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const size_t zip_buffer_size = 256 * 1024;
+
+const uint32_t local_header_signature = 0x04034b50;
+const uint32_t data_descriptor_signature = 0x08074b50;
+const uint32_t central_header_signature = 0x02014b50;
+const uint32_t end_of_central_directory_signature = 0x06054b50;
+
+const uint16_t version_needed = 20; // 2.0, for deflate
+// Bit 3: sizes and CRC are in the data descriptor, bit 11: names are UTF-8
+const uint16_t general_purpose_flags = (1 << 3) | (1 << 11);
+const uint16_t method_deflate = 8;
+// All entries are dated 1980-01-01 00:00, so the output is reproducible
+const uint16_t dos_time = 0;
+const uint16_t dos_date = (1 << 5) | 1;
+
+}
+
+/*!
+	Deflates everything written through it into the archive.
+*/
+class ZipWriter::EntryBuffer : public std::streambuf
+{
+public:
+	EntryBuffer(ZipWriter &writer) : crc(crc32(0, Z_NULL, 0)), size(0), compressedSize(0),
+		writer(writer), in(new char[zip_buffer_size]), out(new char[zip_buffer_size]) {
+		memset(&this->stream, 0, sizeof(this->stream));
+		// Negative window bits: raw deflate without zlib header, as zip wants it
+		this->valid = deflateInit2(&this->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+		setp(this->in.get(), this->in.get() + zip_buffer_size);
+	}
+	~EntryBuffer() {
+		if (this->valid) deflateEnd(&this->stream);
+	}
+
+	// Compresses whatever is left, returns false on errors
+	bool finish() { return deflateBuffer(Z_FINISH); }
+
+	uint32_t crc;
+	uint64_t size;
+	uint64_t compressedSize;
+
+protected:
+	int overflow(int c) override {
+		if (!deflateBuffer(Z_NO_FLUSH)) return traits_type::eof();
+		if (!traits_type::eq_int_type(c, traits_type::eof())) {
+			*pptr() = traits_type::to_char_type(c);
+			pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+private:
+	bool deflateBuffer(int flush) {
+		if (!this->valid) return false;
+		const auto n = size_t(pptr() - pbase());
+		this->crc = crc32(this->crc, reinterpret_cast<const Bytef *>(pbase()), uInt(n));
+		this->size += n;
+		this->stream.next_in = reinterpret_cast<Bytef *>(pbase());
+		this->stream.avail_in = uInt(n);
+		int result;
+		do {
+			this->stream.next_out = reinterpret_cast<Bytef *>(this->out.get());
+			this->stream.avail_out = uInt(zip_buffer_size);
+			result = deflate(&this->stream, flush);
+			if (result == Z_STREAM_ERROR) return false;
+			const auto produced = zip_buffer_size - this->stream.avail_out;
+			this->writer.put(this->out.get(), produced);
+			this->compressedSize += produced;
+		} while (this->stream.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+		setp(this->in.get(), this->in.get() + zip_buffer_size);
+		return true;
+	}
+
+	ZipWriter &writer;
+	z_stream stream;
+	bool valid;
+	std::unique_ptr<char[]> in;
+	std::unique_ptr<char[]> out;
+};
+
+ZipWriter::ZipWriter(std::ostream &output) : output(output), written(0), ok(true)
+{
+}
+
+ZipWriter::~ZipWriter()
+{
+}
+
+std::ostream &ZipWriter::beginEntry(const std::string &name)
+{
+	endEntry();
+	this->buffer.reset(new EntryBuffer(*this));
+	this->entryStream.reset(new std::ostream(this->buffer.get()));
+
+	this->entries.push_back(Entry{name, 0, 0, 0, this->written});
+	put32(local_header_signature);
+	put16(version_needed);
+	put16(general_purpose_flags);
+	put16(method_deflate);
+	put16(dos_time);
+	put16(dos_date);
+	put32(0); // CRC and sizes are in the data descriptor
+	put32(0);
+	put32(0);
+	put16(uint16_t(name.size()));
+	put16(0); // no extra field
+	put(name.data(), name.size());
+	return *this->entryStream;
+}
+
+void ZipWriter::endEntry()
+{
+	if (!this->entryStream) return;
+	if (!(*this->entryStream) || !this->buffer->finish()) this->ok = false;
+	auto &entry = this->entries.back();
+	entry.crc = this->buffer->crc;
+	entry.compressedSize = this->buffer->compressedSize;
+	entry.size = this->buffer->size;
+	this->entryStream.reset();
+	this->buffer.reset();
+
+	put32(data_descriptor_signature);
+	put32(entry.crc);
+	put32(uint32_t(entry.compressedSize));
+	put32(uint32_t(entry.size));
+}
+
+bool ZipWriter::finish()
+{
+	endEntry();
+	const uint64_t centralDirectoryOffset = this->written;
+	bool tooLarge = false;
+	for (const auto &entry : this->entries) {
+		const auto limit = std::numeric_limits<uint32_t>::max();
+		if (entry.size > limit || entry.compressedSize > limit || entry.offset > limit) tooLarge = true;
+		put32(central_header_signature);
+		put16(version_needed); // made by
+		put16(version_needed);
+		put16(general_purpose_flags);
+		put16(method_deflate);
+		put16(dos_time);
+		put16(dos_date);
+		put32(entry.crc);
+		put32(uint32_t(entry.compressedSize));
+		put32(uint32_t(entry.size));
+		put16(uint16_t(entry.name.size()));
+		put16(0); // extra field
+		put16(0); // comment
+		put16(0); // disk number
+		put16(0); // internal attributes
+		put32(0); // external attributes
+		put32(uint32_t(entry.offset));
+		put(entry.name.data(), entry.name.size());
+	}
+	const uint64_t centralDirectorySize = this->written - centralDirectoryOffset;
+	if (centralDirectoryOffset > std::numeric_limits<uint32_t>::max()) tooLarge = true;
+	put32(end_of_central_directory_signature);
+	put16(0); // this disk
+	put16(0); // disk with the central directory
+	put16(uint16_t(this->entries.size()));
+	put16(uint16_t(this->entries.size()));
+	put32(uint32_t(centralDirectorySize));
+	put32(uint32_t(centralDirectoryOffset));
+	put16(0); // comment
+	this->output.flush();
+
+	if (tooLarge) {
+		PRINT("EXPORT-ERROR: The compressed file is larger than 4 GiB, which isn't supported.");
+		return false;
+	}
+	if (!this->ok) PRINT("EXPORT-ERROR: Error compressing the file.");
+	return this->ok;
+}
+
+void ZipWriter::put(const char *data, size_t size)
+{
+	this->output.write(data, size);
+	this->written += size;
+}
+
+void ZipWriter::put16(uint16_t x)
+{
+	// Zip is little endian, regardless of the host
+	const char bytes[] = { char(x & 0xff), char((x >> 8) & 0xff) };
+	put(bytes, sizeof(bytes));
+}
+
+void ZipWriter::put32(uint32_t x)
+{
+	const char bytes[] = { char(x & 0xff), char((x >> 8) & 0xff), char((x >> 16) & 0xff), char((x >> 24) & 0xff) };
+	put(bytes, sizeof(bytes));
+}
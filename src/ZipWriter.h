@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*!
+	Writes a zip archive to a stream while its contents are produced.
+
+	Each entry is deflated as it is written, and its CRC and sizes follow it
+	in a data descriptor, so the output stream doesn't need to be seekable
+	and only the small central directory is kept in memory, regardless of
+	the size of the entries.
+
+	Zip64 is not supported: entries and the whole archive are limited to
+	4 GiB, which finish() reports as an error.
+*/
+class ZipWriter
+{
+public:
+	ZipWriter(std::ostream &output);
+	~ZipWriter();
+
+	// Ends the current entry, if any, and starts a new one. Returns the
+	// stream to write its uncompressed contents to, valid until the next
+	// call of beginEntry() or finish().
+	std::ostream &beginEntry(const std::string &name);
+	// Ends the current entry and writes the central directory. Returns
+	// false, after printing an error, if the archive is invalid.
+	bool finish();
+
+private:
+	class EntryBuffer;
+	struct Entry {
+		std::string name;
+		uint32_t crc;
+		uint64_t compressedSize;
+		uint64_t size;
+		uint64_t offset;
+	};
+
+	void endEntry();
+	void put(const char *data, size_t size);
+	void put16(uint16_t x);
+	void put32(uint32_t x);
+
+	std::ostream &output;
+	uint64_t written;
+	bool ok;
+	std::vector<Entry> entries;
+	std::unique_ptr<EntryBuffer> buffer;
+	std::unique_ptr<std::ostream> entryStream;
+};
@@ -39,10 +39,37 @@ typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_ExactKernel2;
 typedef CGAL::Polygon_2<CGAL_ExactKernel2> CGAL_Poly2;
 typedef CGAL::Polygon_with_holes_2<CGAL_ExactKernel2> CGAL_Poly2h;
 
+#ifdef ENABLE_LAZY_KERNEL
+// Evaluates predicates in interval arithmetic first, and only computes the
+// exact rationals where the intervals can't decide
+typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_Kernel3;
+typedef CGAL_Kernel3::FT NT3;
+#else
 typedef CGAL::Gmpq NT3;
 typedef CGAL::Cartesian<NT3> CGAL_Kernel3;
-//typedef CGAL::Exact_predicates_exact_constructions_kernel::FT NT3;
-//typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_Kernel3;
+#endif
+
+/*
+	The exact rational of an NT3 and the NT3 of a rational, for the code
+	which needs the numerator and denominator. With the lazy kernel,
+	to_gmpq() computes the exact value of x if it isn't known yet.
+*/
+#ifdef ENABLE_LAZY_KERNEL
+namespace CGALUtils {
+	inline CGAL::Gmpq to_gmpq(const CGAL::Gmpq &q) { return q; }
+#ifdef CGAL_USE_GMPXX
+	inline CGAL::Gmpq to_gmpq(const mpq_class &q) { return CGAL::Gmpq(q.get_mpq_t()); }
+#endif
+	inline CGAL::Gmpq to_gmpq(const NT3 &x) { return to_gmpq(CGAL::exact(x)); }
+	inline NT3 from_gmpq(const CGAL::Gmpq &q) { return NT3(CGAL_Kernel3::Exact_kernel::FT(q.mpq())); }
+}
+#else
+namespace CGALUtils {
+	inline const CGAL::Gmpq &to_gmpq(const NT3 &x) { return x; }
+	inline const NT3 &from_gmpq(const CGAL::Gmpq &q) { return q; }
+}
+#endif
+
 typedef CGAL::Nef_polyhedron_3<CGAL_Kernel3> CGAL_Nef_polyhedron3;
 typedef CGAL_Nef_polyhedron3::Aff_transformation_3 CGAL_Aff_transformation;
 
@@ -30,6 +30,7 @@
 #include "evalcontext.h"
 #include "builtin.h"
 #include "polyset.h"
+#include "printutils.h"
 #include <sstream>
 #include <assert.h>
 #include <boost/assign/std/vector.hpp>
@@ -55,6 +56,9 @@ AbstractNode *CgaladvModule::instantiate(const Context *ctx, const ModuleInstant
 	if (type == CgaladvType::RESIZE)
 		args += Assignment("newsize"), Assignment("auto");
 
+	if (type == CgaladvType::SIMPLIFY)
+		args += Assignment("triangles"), Assignment("error");
+
 	Context c(ctx);
 	c.setVariables(evalctx, args);
 	inst->scope.apply(*evalctx);
@@ -88,6 +92,20 @@ AbstractNode *CgaladvModule::instantiate(const Context *ctx, const ModuleInstant
 		}
 	}
 
+	if (type == CgaladvType::SIMPLIFY) {
+		double triangles;
+		if (c.lookup_variable("triangles", true)->getFiniteDouble(triangles) && triangles >= 1) {
+			node->maxtriangles = static_cast<size_t>(triangles);
+		}
+		double error;
+		if (c.lookup_variable("error", true)->getDouble(error) && error >= 0) {
+			node->maxerror = error;
+		}
+		if (node->maxtriangles == 0 && node->maxerror == std::numeric_limits<double>::infinity()) {
+			PRINTB("WARNING: simplify() needs a triangle count or an error bound, %s", inst->location().toRelativeString(ctx->documentPath()));
+		}
+	}
+
 	node->convexity = static_cast<int>(convexity->toDouble());
 	node->path = path;
 
@@ -109,6 +127,9 @@ std::string CgaladvNode::name() const
 	case CgaladvType::RESIZE:
 		return "resize";
 		break;
+	case CgaladvType::SIMPLIFY:
+		return "simplify";
+		break;
 	default:
 		assert(false);
 	}
@@ -134,6 +155,9 @@ std::string CgaladvNode::toString() const
 		  << this->autosize[0] << "," << this->autosize[1] << "," << this->autosize[2] << "]"
 		  << ")";
 		break;
+	case CgaladvType::SIMPLIFY:
+		stream << "(triangles = " << this->maxtriangles << ", error = " << this->maxerror << ")";
+		break;
 	default:
 		assert(false);
 	}
@@ -146,4 +170,5 @@ void register_builtin_cgaladv()
 	Builtins::init("minkowski", new CgaladvModule(CgaladvType::MINKOWSKI));
 	Builtins::init("hull", new CgaladvModule(CgaladvType::HULL));
 	Builtins::init("resize", new CgaladvModule(CgaladvType::RESIZE));
+	Builtins::init("simplify", new CgaladvModule(CgaladvType::SIMPLIFY));
 }
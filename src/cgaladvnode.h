@@ -3,11 +3,13 @@
 #include "node.h"
 #include "value.h"
 #include "linalg.h"
+#include <limits>
 
 enum class CgaladvType {
 	MINKOWSKI,
 	HULL,
-	RESIZE
+	RESIZE,
+	SIMPLIFY
 };
 
 class CgaladvNode : public AbstractNode
@@ -16,6 +18,8 @@ public:
 	VISITABLE();
 	CgaladvNode(const ModuleInstantiation *mi, CgaladvType type) : AbstractNode(mi), type(type) {
 		convexity = 1;
+		maxtriangles = 0;
+		maxerror = std::numeric_limits<double>::infinity();
 	}
 	~CgaladvNode() { }
 	std::string toString() const override;
@@ -25,5 +29,8 @@ public:
 	unsigned int convexity;
 	Vector3d newsize;
 	Eigen::Matrix<bool,3,1> autosize;
+	// simplify(): 0 and infinity mean no limit
+	size_t maxtriangles;
+	double maxerror;
 	CgaladvType type;
 };
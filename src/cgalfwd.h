@@ -1,6 +1,7 @@
 #pragma once
 
-#ifndef CGAL_FORWARD
+// The lazy kernel's types can't be declared forward
+#if !defined(CGAL_FORWARD) || defined(ENABLE_LAZY_KERNEL)
 #include "cgal.h"
 #else
 #ifdef ENABLE_CGAL
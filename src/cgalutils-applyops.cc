@@ -10,6 +10,7 @@
 #include "polyset-utils.h"
 #include "grid.h"
 #include "node.h"
+#include "progress.h"
 
 #include "cgal.h"
 #pragma push_macro("NDEBUG")
@@ -32,7 +33,14 @@
 #include "svg.h"
 #include "Reindexer.h"
 #include "GeometryUtils.h"
-
+#include "CSGBackend.h"
+#include "ThreadPool.h"
+#include "Quickhull.h"
+#include "CGALCache.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
 #include <map>
 #include <queue>
 #include <unordered_set>
@@ -81,19 +89,22 @@ namespace CGALUtils {
 */
 	CGAL_Nef_polyhedron *applyOperator(const Geometry::Geometries &children, OpenSCADOperator op)
 	{
+		TRACE_ZONE("CGALUtils::applyOperator");
 		CGAL_Nef_polyhedron *N = nullptr;
 		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
 		try {
 			// Speeds up n-ary union operations significantly
 			CGAL::Nef_nary_union_3<CGAL_Nef_polyhedron3> nary_union;
 			int nary_union_num_inserted = 0;
+			size_t numdone = 0;
 			
 			for(const auto &item : children) {
+				progress_tick(double(numdone++) / children.size());
 				const shared_ptr<const Geometry> &chgeom = item.second;
 				shared_ptr<const CGAL_Nef_polyhedron> chN = 
-					dynamic_pointer_cast<const CGAL_Nef_polyhedron>(chgeom);
+					geometry_cast<const CGAL_Nef_polyhedron>(chgeom);
 				if (!chN) {
-					const PolySet *chps = dynamic_cast<const PolySet*>(chgeom.get());
+					const PolySet *chps = geometry_cast<const PolySet>(chgeom.get());
 					if (chps) chN.reset(createNefPolyhedronFromGeometry(*chps));
 				}
 				
@@ -134,7 +145,6 @@ namespace CGALUtils {
 				default:
 					PRINTB("ERROR: Unsupported CGAL operator: %d", static_cast<int>(op));
 				}
-				item.first->progress_report();
 			}
 
 			if (op == OpenSCADOperator::UNION && nary_union_num_inserted > 0) {
@@ -146,41 +156,147 @@ namespace CGALUtils {
 			std::string opstr = op == OpenSCADOperator::INTERSECTION ? "intersection" : op == OpenSCADOperator::DIFFERENCE ? "difference" : op == OpenSCADOperator::UNION ? "union" : "UNKNOWN";
 			PRINTB("ERROR: CGAL error in CGALUtils::applyBinaryOperator %s: %s", opstr % e.what());
 		}
+		catch (const ProgressCancelException &) {
+			delete N;
+			CGAL::set_error_behaviour(old_behaviour);
+			throw;
+		}
 		CGAL::set_error_behaviour(old_behaviour);
 		return N;
 	}
 
 
 
+	namespace {
+		// Closed boxes, so touching children end up in the same cluster
+		bool boxesOverlap(const BoundingBox &a, const BoundingBox &b)
+		{
+			for (int i = 0; i < 3; ++i) {
+				if (a.min()[i] > b.max()[i] || b.min()[i] > a.max()[i]) return false;
+			}
+			return true;
+		}
+	}
+
+/*!
+	Unions 3D children, using CGAL only where children overlap.
+
+	Children are grouped into clusters of (transitively) overlapping
+	bounding boxes, and only clusters of more than one child are unioned
+	using Nef polyhedra. Since clusters can't touch each other, their union
+	is the concatenation of their meshes, which is returned as a PolySet.
+	If there is only one cluster, the result is the same as applyOperator().
+
+	Returns nullptr if all children are empty.
+*/
+	shared_ptr<const Geometry> applyUnion3D(const Geometry::Geometries &children)
+	{
+		std::vector<const Geometry::GeometryItem *> items;
+		std::vector<BoundingBox> boxes;
+		for (const auto &item : children) {
+			if (!item.second || item.second->isEmpty()) continue;
+			items.push_back(&item);
+			boxes.push_back(item.second->getBoundingBox());
+		}
+		if (items.empty()) return nullptr;
+		if (items.size() == 1) return items.front()->second;
+
+		// Union-find over children, sweeping boxes sorted by their minimum x
+		const size_t n = items.size();
+		std::vector<size_t> parent(n), order(n);
+		for (size_t i = 0; i < n; ++i) parent[i] = order[i] = i;
+		auto find = [&parent](size_t i) -> size_t {
+			while (parent[i] != i) i = parent[i] = parent[parent[i]];
+			return i;
+		};
+		std::sort(order.begin(), order.end(), [&boxes](size_t a, size_t b) { return boxes[a].min()[0] < boxes[b].min()[0]; });
+		for (size_t a = 0; a < n; ++a) {
+			const auto &boxa = boxes[order[a]];
+			for (size_t b = a + 1; b < n && boxes[order[b]].min()[0] <= boxa.max()[0]; ++b) {
+				if (boxesOverlap(boxa, boxes[order[b]])) parent[find(order[a])] = find(order[b]);
+			}
+		}
+
+		// Clusters in order of their first child
+		std::vector<Geometry::Geometries> clusters;
+		std::map<size_t, size_t> clusterindex;
+		for (size_t i = 0; i < n; ++i) {
+			auto it = clusterindex.emplace(find(i), clusters.size()).first;
+			if (it->second == clusters.size()) clusters.emplace_back();
+			clusters[it->second].push_back(*items[i]);
+		}
+		if (clusters.size() == 1) return shared_ptr<const Geometry>(applyOperator(children, OpenSCADOperator::UNION));
+
+		PRINTDB("Union of %d children in %d disjoint clusters", n % clusters.size());
+		auto result = new PolySet(3);
+		unsigned int convexity = 1;
+		for (const auto &cluster : clusters) {
+			progress_tick(double(&cluster - &clusters.front()) / clusters.size());
+			shared_ptr<const Geometry> geom = cluster.size() == 1 ? cluster.front().second :
+				shared_ptr<const Geometry>(applyOperator(cluster, OpenSCADOperator::UNION));
+			if (!geom) continue;
+			convexity = std::max(convexity, geom->getConvexity());
+			if (const auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+				if (N->isEmpty()) continue;
+				PolySet ps(3);
+				if (createPolySetFromNefPolyhedron3(*N->p3, ps)) {
+					PRINT("ERROR: Nef->PolySet failed");
+				}
+				result->append(ps);
+			}
+			else if (const auto ps = geometry_cast<const PolySet>(geom)) {
+				result->append(*ps);
+			}
+		}
+		result->setConvexity(convexity);
+		return shared_ptr<const Geometry>(result);
+	}
+
+	/*!
+		Hulls all vertices of the children. Uses the double precision
+		Quickhull on the points left after removing interior points,
+		falling back to CGAL if it detects a degeneracy.
+	*/
 	bool applyHull(const Geometry::Geometries &children, PolySet &result)
 	{
 		typedef CGAL::Epick K;
 		// Collect point cloud
-		// NB! CGAL's convex_hull_3() doesn't like std::set iterators, so we use a list
-		// instead.
-		std::list<K::Point_3> points;
+		std::vector<Vector3d> cloud;
 
 		for(const auto &item : children) {
+			progress_tick(0);
 			const shared_ptr<const Geometry> &chgeom = item.second;
-			const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(chgeom.get());
+			const CGAL_Nef_polyhedron *N = geometry_cast<const CGAL_Nef_polyhedron>(chgeom.get());
 			if (N) {
 				if (!N->isEmpty()) {
 					for (CGAL_Nef_polyhedron3::Vertex_const_iterator i = N->p3->vertices_begin(); i != N->p3->vertices_end(); ++i) {
-						points.push_back(vector_convert<K::Point_3>(i->point()));
+						cloud.push_back(vector_convert<Vector3d>(i->point()));
 					}
 				}
 			} else {
-				const PolySet *ps = dynamic_cast<const PolySet *>(chgeom.get());
+				const PolySet *ps = geometry_cast<const PolySet>(chgeom.get());
 				if (ps) {
-					for(const auto &p : ps->polygons) {
-						for(const auto &v : p) {
-							points.push_back(K::Point_3(v[0], v[1], v[2]));
-						}
+					for(const auto &p : ps->polygons()) {
+						cloud.insert(cloud.end(), p.begin(), p.end());
 					}
 				}
 			}
 		}
 
+		if (cloud.size() <= 3) return false;
+
+		const size_t numpoints = cloud.size();
+		Quickhull::filterInterior(cloud);
+		PRINTDB("Hull: %d of %d points left after filtering", cloud.size() % numpoints);
+		progress_tick(0.1);
+		if (Quickhull::hull(cloud, result)) return true;
+		PRINTD("Hull: Degenerate point cloud, using exact hull");
+		progress_tick(0.5);
+
+		std::vector<K::Point_3> points;
+		points.reserve(cloud.size());
+		for (const auto &v : cloud) points.push_back(K::Point_3(v[0], v[1], v[2]));
+
 		if (points.size() <= 3) return false;
 
 		// Apply hull
@@ -205,196 +321,269 @@ namespace CGALUtils {
 	}
 
 
-	/*!
-		children cannot contain nullptr objects
-	*/
-	Geometry const * applyMinkowski(const Geometry::Geometries &children)
-	{
-		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
-		CGAL::Timer t,t_tot;
-		assert(children.size() >= 2);
-		Geometry::Geometries::const_iterator it = children.begin();
-		t_tot.start();
-		Geometry const* operands[2] = {it->second.get(), nullptr};
-		try {
-			while (++it != children.end()) {
-				operands[1] = it->second.get();
-
-				typedef CGAL::Epick Hull_kernel;
-
-				std::list<CGAL_Polyhedron> P[2];
-				std::list<CGAL::Polyhedron_3<Hull_kernel>> result_parts;
-
-				for (size_t i = 0; i < 2; i++) {
-					CGAL_Polyhedron poly;
-
-					const PolySet * ps = dynamic_cast<const PolySet *>(operands[i]);
-
-					const CGAL_Nef_polyhedron * nef = dynamic_cast<const CGAL_Nef_polyhedron *>(operands[i]);
-
-					if (ps) CGALUtils::createPolyhedronFromPolySet(*ps, poly);
-					else if (nef && nef->p3->is_simple()) nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(*nef->p3, poly);
-					else throw 0;
-
-					if ((ps && ps->is_convex()) ||
-							(!ps && is_weakly_convex(poly))) {
-						PRINTDB("Minkowski: child %d is convex and %s",i % (ps?"PolySet":"Nef"));
-						P[i].push_back(poly);
-					} else {
-						CGAL_Nef_polyhedron3 decomposed_nef;
-
-						if (ps) {
-							PRINTDB("Minkowski: child %d is nonconvex PolySet, transforming to Nef and decomposing...", i);
-							CGAL_Nef_polyhedron *p = createNefPolyhedronFromGeometry(*ps);
-							if (!p->isEmpty()) decomposed_nef = *p->p3;
-							delete p;
-						} else {
-							PRINTDB("Minkowski: child %d is nonconvex Nef, decomposing...",i);
-							decomposed_nef = *nef->p3;
-						}
-
-						t.start();
-						CGAL::convex_decomposition_3(decomposed_nef);
-
-						// the first volume is the outer volume, which ignored in the decomposition
-						CGAL_Nef_polyhedron3::Volume_const_iterator ci = ++decomposed_nef.volumes_begin();
-						for(; ci != decomposed_nef.volumes_end(); ++ci) {
-							if(ci->mark()) {
-								CGAL_Polyhedron poly;
-								decomposed_nef.convert_inner_shell_to_polyhedron(ci->shells_begin(), poly);
-								P[i].push_back(poly);
-							}
-						}
-
-
-						PRINTDB("Minkowski: decomposed into %d convex parts", P[i].size());
-						t.stop();
-						PRINTDB("Minkowski: decomposition took %f s", t.time());
-					}
+	namespace {
+		typedef CGAL::Epick Hull_kernel;
+
+		// Below this number of part pairs, Minkowski sums are quick enough to not report progress
+		const size_t min_reported_pairs = 100;
+
+		/*!
+			Computes the convex hull of the Minkowski sum of two convex parts,
+			given by their vertices. Returns false if the sum is degenerate.
+
+			The hull is computed in double precision from the sums snapped to
+			the grid, falling back to CGAL if Quickhull detects a degeneracy.
+		*/
+		bool minkowskiHull(const std::vector<Vector3d> &a, const std::vector<Vector3d> &b, PolySet &ps)
+		{
+			if (a.size() * b.size() <= 3) return false;
+
+			CGAL::Timer t;
+			t.start();
+			Grid3d<int> grid(GRID_FINE);
+			std::vector<Vector3d> sums;
+			sums.reserve(a.size() * b.size());
+			for (const auto &pa : a) {
+				for (const auto &pb : b) {
+					Vector3d v = pa + pb;
+					if (grid.align(v) == int(sums.size())) sums.push_back(v);
+				}
+			}
+			if (Quickhull::hull(sums, ps)) {
+				t.stop();
+				PRINTDB("Minkowski: Quickhull of %d points took %f s", sums.size() % t.time());
+				return true;
+			}
+			PRINTD("Minkowski: Degenerate point cloud, using exact hull");
+			t.reset();
+
+			t.start();
+			std::vector<Hull_kernel::Point_3> minkowski_points;
+			minkowski_points.reserve(a.size() * b.size());
+			for (size_t i = 0; i < a.size(); i++) {
+				for (size_t j = 0; j < b.size(); j++) {
+					const Vector3d v = a[i] + b[j];
+					minkowski_points.push_back(Hull_kernel::Point_3(v[0], v[1], v[2]));
 				}
+			}
 
-				std::vector<Hull_kernel::Point_3> points[2];
-				std::vector<Hull_kernel::Point_3> minkowski_points;
+			if (minkowski_points.size() <= 3) return false;
 
-				for (size_t i = 0; i < P[0].size(); i++) {
-					for (size_t j = 0; j < P[1].size(); j++) {
-						t.start();
-						points[0].clear();
-						points[1].clear();
+			CGAL::Polyhedron_3<Hull_kernel> result;
+			t.stop();
+			PRINTDB("Minkowski: Point cloud creation (%d ⨉ %d -> %d) took %f ms", a.size() % b.size() % minkowski_points.size() % (t.time()*1000));
+			t.reset();
 
-						for (int k = 0; k < 2; k++) {
-							std::list<CGAL_Polyhedron>::iterator it = P[k].begin();
-							std::advance(it, k==0?i:j);
+			t.start();
 
-							CGAL_Polyhedron const& poly = *it;
-							points[k].reserve(poly.size_of_vertices());
+			CGAL::convex_hull_3(minkowski_points.begin(), minkowski_points.end(), result);
 
-							for (CGAL_Polyhedron::Vertex_const_iterator pi = poly.vertices_begin(); pi != poly.vertices_end(); ++pi) {
-								CGAL_Polyhedron::Point_3 const& p = pi->point();
-								points[k].push_back(Hull_kernel::Point_3(to_double(p[0]),to_double(p[1]),to_double(p[2])));
-							}
-						}
+			std::vector<Hull_kernel::Point_3> strict_points;
+			strict_points.reserve(minkowski_points.size());
 
-						minkowski_points.clear();
-						minkowski_points.reserve(points[0].size() * points[1].size());
-						for (size_t i = 0; i < points[0].size(); i++) {
-							for (size_t j = 0; j < points[1].size(); j++) {
-								minkowski_points.push_back(points[0][i]+(points[1][j]-CGAL::ORIGIN));
-							}
-						}
+			for (CGAL::Polyhedron_3<Hull_kernel>::Vertex_iterator i = result.vertices_begin(); i != result.vertices_end(); ++i) {
+				Hull_kernel::Point_3 const& p = i->point();
 
-						if (minkowski_points.size() <= 3) {
-							t.stop();
-							continue;
-						}
+				CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle h,e;
+				h = i->halfedge();
+				e = h;
+				bool collinear = false;
+				bool coplanar = true;
 
+				do {
+					Hull_kernel::Point_3 const& q = h->opposite()->vertex()->point();
+					if (coplanar && !CGAL::coplanar(p,q,
+										h->next_on_vertex()->opposite()->vertex()->point(),
+										h->next_on_vertex()->next_on_vertex()->opposite()->vertex()->point())) {
+						coplanar = false;
+					}
 
-						CGAL::Polyhedron_3<Hull_kernel> result;
-						t.stop();
-						PRINTDB("Minkowski: Point cloud creation (%d ⨉ %d -> %d) took %f ms", points[0].size() % points[1].size() % minkowski_points.size() % (t.time()*1000));
-						t.reset();
 
-						t.start();
+					for (CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle j = h->next_on_vertex();
+						 j != h && !collinear && ! coplanar;
+						 j = j->next_on_vertex()) {
 
-						CGAL::convex_hull_3(minkowski_points.begin(), minkowski_points.end(), result);
+						Hull_kernel::Point_3 const& r = j->opposite()->vertex()->point();
+						if (CGAL::collinear(p,q,r)) {
+							collinear = true;
+						}
+					}
 
-						std::vector<Hull_kernel::Point_3> strict_points;
-						strict_points.reserve(minkowski_points.size());
+					h = h->next_on_vertex();
+				} while (h != e && !collinear);
 
-						for (CGAL::Polyhedron_3<Hull_kernel>::Vertex_iterator i = result.vertices_begin(); i != result.vertices_end(); ++i) {
-							Hull_kernel::Point_3 const& p = i->point();
+				if (!collinear && !coplanar)
+					strict_points.push_back(p);
+			}
 
-							CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle h,e;
-							h = i->halfedge();
-							e = h;
-							bool collinear = false;
-							bool coplanar = true;
+			result.clear();
+			CGAL::convex_hull_3(strict_points.begin(), strict_points.end(), result);
 
-							do {
-								Hull_kernel::Point_3 const& q = h->opposite()->vertex()->point();
-								if (coplanar && !CGAL::coplanar(p,q,
-																h->next_on_vertex()->opposite()->vertex()->point(),
-																h->next_on_vertex()->next_on_vertex()->opposite()->vertex()->point())) {
-									coplanar = false;
-								}
 
+			t.stop();
+			PRINTDB("Minkowski: Computing convex hull took %f s", t.time());
+			t.reset();
+			return !createPolySetFromPolyhedron(result, ps);
+		}
 
-								for (CGAL::Polyhedron_3<Hull_kernel>::Vertex::Halfedge_handle j = h->next_on_vertex();
-									 j != h && !collinear && ! coplanar;
-									 j = j->next_on_vertex()) {
+		void appendPart(const CGAL_Polyhedron &poly, CGALCache::ConvexParts &parts)
+		{
+			parts.emplace_back();
+			parts.back().reserve(poly.size_of_vertices());
+			for (CGAL_Polyhedron::Vertex_const_iterator pi = poly.vertices_begin(); pi != poly.vertices_end(); ++pi) {
+				CGAL_Polyhedron::Point_3 const& p = pi->point();
+				parts.back().push_back(Vector3d(to_double(p[0]),to_double(p[1]),to_double(p[2])));
+			}
+		}
 
-									Hull_kernel::Point_3 const& r = j->opposite()->vertex()->point();
-									if (CGAL::collinear(p,q,r)) {
-										collinear = true;
-									}
-								}
+		/*!
+			Returns the vertices of the convex parts of a Minkowski operand,
+			decomposing it if it isn't convex. Throws if the operand can't be
+			decomposed.
+		*/
+		shared_ptr<const CGALCache::ConvexParts> convexParts(const Geometry *operand, size_t i)
+		{
+			CGAL::Timer t;
+			auto parts = make_shared<CGALCache::ConvexParts>();
+			CGAL_Polyhedron poly;
+
+			const PolySet * ps = geometry_cast<const PolySet>(operand);
+
+			const CGAL_Nef_polyhedron * nef = geometry_cast<const CGAL_Nef_polyhedron>(operand);
+
+			if (ps) CGALUtils::createPolyhedronFromPolySet(*ps, poly);
+			else if (nef && nef->p3->is_simple()) nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(*nef->p3, poly);
+			else throw 0;
+
+			if ((ps && ps->is_convex()) ||
+					(!ps && is_weakly_convex(poly))) {
+				PRINTDB("Minkowski: child %d is convex and %s",i % (ps?"PolySet":"Nef"));
+				appendPart(poly, *parts);
+			} else {
+				CGAL_Nef_polyhedron3 decomposed_nef;
 
-								h = h->next_on_vertex();
-							} while (h != e && !collinear);
+				if (ps) {
+					PRINTDB("Minkowski: child %d is nonconvex PolySet, transforming to Nef and decomposing...", i);
+					CGAL_Nef_polyhedron *p = createNefPolyhedronFromGeometry(*ps);
+					if (!p->isEmpty()) decomposed_nef = *p->p3;
+					delete p;
+				} else {
+					PRINTDB("Minkowski: child %d is nonconvex Nef, decomposing...",i);
+					decomposed_nef = *nef->p3;
+				}
 
-							if (!collinear && !coplanar)
-								strict_points.push_back(p);
-						}
+				t.start();
+				CGAL::convex_decomposition_3(decomposed_nef);
+
+				// the first volume is the outer volume, which ignored in the decomposition
+				CGAL_Nef_polyhedron3::Volume_const_iterator ci = ++decomposed_nef.volumes_begin();
+				for(; ci != decomposed_nef.volumes_end(); ++ci) {
+					progress_tick(0);
+					if(ci->mark()) {
+						CGAL_Polyhedron poly;
+						decomposed_nef.convert_inner_shell_to_polyhedron(ci->shells_begin(), poly);
+						appendPart(poly, *parts);
+					}
+				}
 
-						result.clear();
-						CGAL::convex_hull_3(strict_points.begin(), strict_points.end(), result);
 
+				PRINTDB("Minkowski: decomposed into %d convex parts", parts->size());
+				t.stop();
+				PRINTDB("Minkowski: decomposition took %f s", t.time());
+			}
+			return parts;
+		}
+	}
 
-						t.stop();
-						PRINTDB("Minkowski: Computing convex hull took %f s", t.time());
-						t.reset();
+	/*!
+		children cannot contain nullptr objects. If given, keys holds the ids
+		of the children, used to cache their convex decompositions.
+	*/
+	Geometry const * applyMinkowski(const Geometry::Geometries &children, const std::vector<std::string> &keys)
+	{
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		CGAL::Timer t,t_tot;
+		assert(children.size() >= 2);
+		Geometry::Geometries::const_iterator it = children.begin();
+		t_tot.start();
+		Geometry const* operands[2] = {it->second.get(), nullptr};
+		try {
+			size_t index = 0;
+			while (++it != children.end()) {
+				operands[1] = it->second.get();
+				++index;
+				// Each operand step is split into decomposition, hulls and their union
+				const double stepbase = double(index - 1) / (children.size() - 1), step = 1.0 / (children.size() - 1);
+				progress_tick(stepbase);
 
-						result_parts.push_back(result);
+				shared_ptr<const CGALCache::ConvexParts> parts[2];
+				for (size_t i = 0; i < 2; i++) {
+					// Only children have an id, not the intermediate results
+					const size_t child = i == 0 ? 0 : index;
+					const bool haskey = (i == 1 || index == 1) && child < keys.size();
+					if (haskey) parts[i] = CGALCache::instance()->getDecomposition(keys[child]);
+					if (parts[i]) {
+						PRINTDB("Minkowski: child %d decomposition cached, %d convex parts", i % parts[i]->size());
+						continue;
 					}
+					parts[i] = convexParts(operands[i], i);
+					if (haskey) CGALCache::instance()->insertDecomposition(keys[child], parts[i]);
+				}
+				const CGALCache::ConvexParts &points0 = *parts[0], &points1 = *parts[1];
+
+				// The hulls of all pairs of parts are independent, compute them in parallel
+				const size_t numpairs = points0.size() * points1.size();
+				std::vector<shared_ptr<PolySet>> hulls(numpairs);
+				std::atomic<size_t> numdone(0);
+				const size_t reportstep = std::max<size_t>(numpairs / 10, 1);
+				t.start();
+				TaskGroup group;
+				for (size_t n = 0; n < numpairs; n++) {
+					group.run([&points0, &points1, &hulls, &numdone, numpairs, reportstep, stepbase, step, n]() {
+						progress_tick(stepbase + step * (0.1 + 0.6 * numdone / numpairs));
+						const auto &a = points0[n / points1.size()];
+						const auto &b = points1[n % points1.size()];
+						auto ps = make_shared<PolySet>(3, true);
+						if (minkowskiHull(a, b, *ps)) hulls[n] = ps;
+						const size_t done = ++numdone;
+						PRINTDB("Minkowski: convex hull %d of %d done", done % numpairs);
+						if (numpairs >= min_reported_pairs && done % reportstep == 0) {
+							PRINTB("Minkowski: %d%% of %d convex hulls done", (100 * done / numpairs) % numpairs);
+						}
+					});
+				}
+				group.wait();
+				t.stop();
+				PRINTDB("Minkowski: Computing %d convex hulls took %f s", numpairs % t.time());
+				t.reset();
+
+				progress_tick(stepbase + step * 0.7);
+				Geometry::Geometries parts;
+				for (const auto &ps : hulls) {
+					if (ps) parts.push_back(std::make_pair((const AbstractNode*)nullptr, shared_ptr<const Geometry>(ps)));
 				}
 
-				if (it != boost::next(children.begin()))
+				if (it != boost::next(children.begin())) {
 					delete operands[0];
+					operands[0] = nullptr;
+				}
 
-				if (result_parts.size() == 1) {
-					PolySet *ps = new PolySet(3,true);
-					createPolySetFromPolyhedron(*result_parts.begin(), *ps);
-					operands[0] = ps;
-				} else if (!result_parts.empty()) {
+				if (parts.size() == 1) {
+					operands[0] = new PolySet(*static_pointer_cast<const PolySet>(parts.front().second));
+				} else if (!parts.empty()) {
 					t.start();
-					PRINTDB("Minkowski: Computing union of %d parts",result_parts.size());
-					Geometry::Geometries fake_children;
-					for (std::list<CGAL::Polyhedron_3<Hull_kernel>>::iterator i = result_parts.begin(); i != result_parts.end(); ++i) {
-						PolySet ps(3,true);
-						createPolySetFromPolyhedron(*i, ps);
-						fake_children.push_back(std::make_pair((const AbstractNode*)nullptr,
-															   shared_ptr<const Geometry>(createNefPolyhedronFromGeometry(ps))));
-					}
-					CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(fake_children, OpenSCADOperator::UNION);
+					PRINTDB("Minkowski: Computing union of %d parts", parts.size());
+					shared_ptr<const Geometry> geom = CSGBackend::reduce(parts, OpenSCADOperator::UNION);
 					// FIXME: This should really never throw.
 					// Assert once we figured out what went wrong with issue #1069?
-					if (!N) throw 0;
+					if (!geom) throw 0;
 					t.stop();
 					PRINTDB("Minkowski: Union done: %f s",t.time());
 					t.reset();
-					operands[0] = N;
+					if (const auto ps = geometry_cast<const PolySet>(geom)) operands[0] = new PolySet(*ps);
+					else operands[0] = new CGAL_Nef_polyhedron(*static_pointer_cast<const CGAL_Nef_polyhedron>(geom));
 				} else {
-                    operands[0] = new CGAL_Nef_polyhedron();
+					operands[0] = new CGAL_Nef_polyhedron();
 				}
 			}
 
@@ -404,6 +593,11 @@ namespace CGALUtils {
 			CGAL::set_error_behaviour(old_behaviour);
 			return operands[0];
 		}
+		catch (const ProgressCancelException &) {
+			if (it != boost::next(children.begin())) delete operands[0];
+			CGAL::set_error_behaviour(old_behaviour);
+			throw;
+		}
 		catch (...) {
 			// If anything throws we simply fall back to Nef Minkowski
 			PRINTD("Minkowski: Falling back to Nef Minkowski");
@@ -0,0 +1,174 @@
+// Mesh corefinement backend for 3D booleans, see CSGBackend
+
+#ifdef ENABLE_CGAL
+
+#include "CSGBackend.h"
+#include "cgalutils.h"
+#include "polyset.h"
+#include "printutils.h"
+#include "polyset-utils.h"
+#include "GeometryUtils.h"
+#include "progress.h"
+
+#include <CGAL/version.h>
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,11,0)
+
+#pragma push_macro("NDEBUG")
+#undef NDEBUG
+#include <CGAL/Exact_predicates_exact_constructions_kernel.h>
+#include <CGAL/Surface_mesh.h>
+#include <CGAL/Polygon_mesh_processing/corefinement.h>
+#include <CGAL/Polygon_mesh_processing/orientation.h>
+#include <CGAL/Polygon_mesh_processing/polygon_soup_to_polygon_mesh.h>
+#include <CGAL/Polygon_mesh_processing/self_intersections.h>
+#include <CGAL/Polygon_mesh_processing/triangulate_faces.h>
+#pragma pop_macro("NDEBUG")
+
+#include <iterator>
+
+namespace {
+	typedef CGAL::Epeck EK;
+	typedef CGAL::Surface_mesh<EK::Point_3> SurfaceMesh;
+	namespace PMP = CGAL::Polygon_mesh_processing;
+
+	/*!
+		Converts to a triangle mesh fit for corefinement: closed, not
+		self-intersecting and bounding a volume. Returns false if this isn't
+		possible.
+	*/
+	bool createMeshFromGeometry(const Geometry &geom, SurfaceMesh &mesh)
+	{
+		PolySet converted(3);
+		auto ps = dynamic_cast<const PolySet *>(&geom);
+		if (!ps) {
+			auto N = dynamic_cast<const CGAL_Nef_polyhedron *>(&geom);
+			if (!N) return false;
+			if (N->isEmpty()) return true;
+			if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, converted)) return false;
+			ps = &converted;
+		}
+		if (ps->polygons().empty()) return true;
+		// Open meshes aren't worth converting
+		if (!ps->topology()->isClosed()) return false;
+
+		// PolySet faces are clockwise, seen from the outside
+		IndexedMesh indexed;
+		PolysetUtils::createIndexedMesh(*ps, indexed);
+		std::vector<std::vector<std::size_t>> polygons(indexed.numFaces());
+		for (size_t i = 0; i < indexed.numFaces(); ++i) {
+			const int *face = indexed.face(i);
+			polygons[i].assign(std::reverse_iterator<const int *>(face + indexed.faceSize(i)),
+												 std::reverse_iterator<const int *>(face));
+		}
+		std::vector<EK::Point_3> points;
+		points.reserve(indexed.vertices.size());
+		for (const auto &v : indexed.vertices) points.emplace_back(v[0], v[1], v[2]);
+
+		if (!PMP::is_polygon_soup_a_polygon_mesh(polygons)) return false;
+		PMP::polygon_soup_to_polygon_mesh(points, polygons, mesh);
+		PMP::triangulate_faces(mesh);
+		return !PMP::does_self_intersect(mesh) && PMP::does_bound_a_volume(mesh);
+	}
+
+	void createPolySetFromMesh(const SurfaceMesh &mesh, PolySet &ps)
+	{
+		for (const auto f : mesh.faces()) {
+			ps.append_poly();
+			for (const auto v : CGAL::vertices_around_face(mesh.halfedge(f), mesh)) {
+				const auto &p = mesh.point(v);
+				ps.insert_vertex(CGAL::to_double(p.x()), CGAL::to_double(p.y()), CGAL::to_double(p.z()));
+			}
+		}
+	}
+
+	class CorefineBackend : public CSGBackend
+	{
+	public:
+		const char *name() const override { return "corefine"; }
+		// Meshes instead of the Nef polyhedra stored for the same nodes by the Nef backend
+		std::string cacheTag() const override { return "~corefine"; }
+		shared_ptr<const Geometry> applyOperator(const Geometry::Geometries &children, OpenSCADOperator op) const override;
+	};
+
+	shared_ptr<const Geometry> CorefineBackend::applyOperator(const Geometry::Geometries &children, OpenSCADOperator op) const
+	{
+		if (op != OpenSCADOperator::UNION && op != OpenSCADOperator::INTERSECTION && op != OpenSCADOperator::DIFFERENCE) {
+			return nullptr;
+		}
+
+		SurfaceMesh result;
+		unsigned int convexity = 1;
+		bool first = true;
+		bool ok = true;
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		try {
+			size_t numdone = 0;
+			for (const auto &item : children) {
+				progress_tick(double(numdone++) / children.size());
+				SurfaceMesh mesh;
+				if (!createMeshFromGeometry(*item.second, mesh)) {
+					ok = false;
+					break;
+				}
+				convexity = std::max(convexity, item.second->getConvexity());
+				if (first) {
+					result.swap(mesh);
+					first = false;
+					continue;
+				}
+				// Same rules for empty operands as CGALUtils::applyOperator()
+				if (mesh.is_empty()) {
+					if (op == OpenSCADOperator::INTERSECTION) result.clear();
+					continue;
+				}
+				if (result.is_empty()) {
+					if (op == OpenSCADOperator::UNION) result.swap(mesh);
+					continue;
+				}
+				switch (op) {
+				case OpenSCADOperator::UNION:
+					ok = PMP::corefine_and_compute_union(result, mesh, result);
+					break;
+				case OpenSCADOperator::INTERSECTION:
+					ok = PMP::corefine_and_compute_intersection(result, mesh, result);
+					break;
+				default:
+					ok = PMP::corefine_and_compute_difference(result, mesh, result);
+					break;
+				}
+				if (!ok) break;
+			}
+		}
+		catch (const CGAL::Failure_exception &e) {
+			PRINTDB("CGAL error in corefinement: %s", e.what());
+			ok = false;
+		}
+		catch (const ProgressCancelException &) {
+			CGAL::set_error_behaviour(old_behaviour);
+			throw;
+		}
+		CGAL::set_error_behaviour(old_behaviour);
+		if (!ok) return nullptr;
+
+		auto ps = new PolySet(3);
+		ps->setConvexity(convexity);
+		createPolySetFromMesh(result, *ps);
+		return shared_ptr<const Geometry>(ps);
+	}
+}
+
+const CSGBackend *CSGBackend::corefine()
+{
+	static CorefineBackend backend;
+	return &backend;
+}
+
+#else // CGAL < 4.11
+
+const CSGBackend *CSGBackend::corefine()
+{
+	return nullptr;
+}
+
+#endif
+#endif // ENABLE_CGAL
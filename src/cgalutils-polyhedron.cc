@@ -51,7 +51,7 @@ namespace /* anonymous */ {
 			std::vector<std::vector<size_t>> indices;
 
 			// Align all vertices to grid and build vertex array in vertices
-			for(const auto &p : ps.polygons) {
+			for(const auto &p : ps.polygons()) {
 				indices.push_back(std::vector<size_t>());
 				indices.back().reserve(p.size());
 				for (auto v : boost::adaptors::reverse(p)) {
@@ -69,7 +69,7 @@ namespace /* anonymous */ {
 			printf("polyhedron(faces=[");
 			int pidx = 0;
 #endif
-			B.begin_surface(vertices.size(), ps.polygons.size());
+			B.begin_surface(vertices.size(), ps.polygons().size());
 			for(const auto &p : vertices) {
 				B.add_vertex(p);
 			}
@@ -119,12 +119,12 @@ namespace /* anonymous */ {
 				std::vector<size_t> indices(3);
 
 				// Estimating same # of vertices as polygons (very rough)
-				B.begin_surface(ps.polygons.size(), ps.polygons.size());
+				B.begin_surface(ps.polygons().size(), ps.polygons().size());
 				int pidx = 0;
 #ifdef GEN_SURFACE_DEBUG
 				printf("polyhedron(faces=[");
 #endif
-				for(const auto &p : ps.polygons) {
+				for(const auto &p : ps.polygons()) {
 #ifdef GEN_SURFACE_DEBUG
 					if (pidx++ > 0) printf(",");
 #endif
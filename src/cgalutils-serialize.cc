@@ -0,0 +1,442 @@
+/*
+	Compact binary encoding of Nef polyhedra, for the DiskCache and for
+	passing results between processes.
+
+	CGAL's .nef3 format prints every coordinate of the selective Nef
+	complex (SNC) as decimal numerator and denominator, so most of the time
+	of writing and reading it is spent converting big integers to and from
+	text. This format stores the same items and incidences, but with the
+	handles as uint32 indices and the rationals as their GMP limbs.
+
+	All values are in host byte order:
+
+	  nef:      uint32 number of vertices, halfedges, halffacets, volumes,
+	            shalfedges, shalfloops and sfaces, then the items of each
+	            kind in that order
+	  vertex:   point, svertices begin and last, shalfedges begin and last,
+	            sfaces begin and last, shalfloop, uint8 mark
+	  halfedge: twin, center vertex, uint8 isolated, incident sface if
+	            isolated else out sedge, int32 index, sphere point, uint8 mark
+	  facet:    twin, incident volume, uint32 number of cycles, uint32 cycle
+	            entries (shalfedge index, or shalfloop index | loop_flag),
+	            plane, uint8 mark
+	  volume:   uint32 number of shells, uint32 sface of each shell, uint8 mark
+	  shalfedge: twin, sprev, snext, source, incident sface, prev, next,
+	            facet, int32 index, forward index and backward index, circle,
+	            uint8 mark
+	  shalfloop: twin, incident sface, facet, int32 index, circle, uint8 mark
+	  sface:    center vertex, volume, uint32 number of cycles, uint32 cycle
+	            entries (svertex, shalfedge | edge_flag or
+	            shalfloop | loop_flag), uint8 mark
+
+	A handle is the uint32 index of the item among the items of its kind,
+	or none for the end of the list (i.e. empty ranges and missing loops).
+	Points are x, y, z, planes and circles a, b, c, d as rationals. A
+	rational is its numerator and denominator, each an int32 number of
+	64 bit limbs, negative for negative numbers, and the limbs, least
+	significant first.
+*/
+
+#ifdef ENABLE_CGAL
+
+#include "cgalutils.h"
+#include "printutils.h"
+
+#pragma push_macro("NDEBUG")
+#undef NDEBUG
+#include <CGAL/Nef_3/SNC_decorator.h>
+#include <CGAL/Nef_S2/SM_decorator.h>
+#pragma pop_macro("NDEBUG")
+
+#include <gmp.h>
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+	const uint32_t none = 0xffffffff;
+	// Tags of the cycle entries, the indices are well below
+	const uint32_t edge_flag = 0x40000000;
+	const uint32_t loop_flag = 0x80000000;
+	const uint32_t index_mask = 0x3fffffff;
+
+	template <typename T> void write_value(std::ostream &out, const T &v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	void write_integer(std::ostream &out, mpz_srcptr z, std::vector<uint64_t> &limbs)
+	{
+		const int sign = mpz_sgn(z);
+		const size_t count = sign == 0 ? 0 : (mpz_sizeinbase(z, 2) + 63) / 64;
+		write_value<int32_t>(out, sign < 0 ? -int32_t(count) : int32_t(count));
+		if (count == 0) return;
+		limbs.resize(count);
+		mpz_export(limbs.data(), nullptr, -1, sizeof(uint64_t), 0, 0, z);
+		out.write(reinterpret_cast<const char *>(limbs.data()), count * sizeof(uint64_t));
+	}
+
+	/*!
+		Writes the SNC of a Nef polyhedron, using only its public const
+		interface.
+	*/
+	class NefWriter
+	{
+	public:
+		typedef CGAL_Nef_polyhedron3 Nef;
+
+		NefWriter(std::ostream &out) : out(out) {}
+
+		void write(const Nef &N) {
+			number(N.vertices_begin(), N.vertices_end());
+			number(N.halfedges_begin(), N.halfedges_end());
+			number(N.halffacets_begin(), N.halffacets_end());
+			number(N.volumes_begin(), N.volumes_end());
+			number(N.shalfedges_begin(), N.shalfedges_end());
+			number(N.shalfloops_begin(), N.shalfloops_end());
+			number(N.sfaces_begin(), N.sfaces_end());
+			for (uint32_t count : this->counts) write_value(this->out, count);
+
+			for (auto v = N.vertices_begin(); v != N.vertices_end(); ++v) {
+				write_point(v->point());
+				handle(v->svertices_begin()); handle(v->svertices_last());
+				handle(v->shalfedges_begin()); handle(v->shalfedges_last());
+				handle(v->sfaces_begin()); handle(v->sfaces_last());
+				handle(v->shalfloop());
+				write_value<uint8_t>(this->out, v->mark());
+			}
+			for (auto e = N.halfedges_begin(); e != N.halfedges_end(); ++e) {
+				handle(e->twin());
+				handle(e->center_vertex());
+				write_value<uint8_t>(this->out, e->is_isolated());
+				if (e->is_isolated()) handle(e->incident_sface());
+				else handle(e->out_sedge());
+				write_value<int32_t>(this->out, e->get_index());
+				write_point(e->point());
+				write_value<uint8_t>(this->out, e->mark());
+			}
+			for (auto f = N.halffacets_begin(); f != N.halffacets_end(); ++f) {
+				handle(f->twin());
+				handle(f->incident_volume());
+				this->entries.clear();
+				for (auto fc = f->facet_cycles_begin(); fc != f->facet_cycles_end(); ++fc) {
+					if (fc.is_shalfedge()) this->entries.push_back(index(Nef::SHalfedge_const_handle(fc)));
+					else if (fc.is_shalfloop()) this->entries.push_back(index(Nef::SHalfloop_const_handle(fc)) | loop_flag);
+				}
+				write_entries();
+				write_plane(f->plane());
+				write_value<uint8_t>(this->out, f->mark());
+			}
+			for (auto c = N.volumes_begin(); c != N.volumes_end(); ++c) {
+				this->entries.clear();
+				for (auto s = c->shells_begin(); s != c->shells_end(); ++s) {
+					this->entries.push_back(index(Nef::SFace_const_handle(s)));
+				}
+				write_entries();
+				write_value<uint8_t>(this->out, c->mark());
+			}
+			for (auto se = N.shalfedges_begin(); se != N.shalfedges_end(); ++se) {
+				handle(se->twin());
+				handle(se->sprev()); handle(se->snext());
+				handle(se->source());
+				handle(se->incident_sface());
+				handle(se->prev()); handle(se->next());
+				handle(se->facet());
+				write_value<int32_t>(this->out, se->get_index());
+				write_value<int32_t>(this->out, se->get_forward_index());
+				write_value<int32_t>(this->out, se->get_backward_index());
+				write_plane(se->circle());
+				write_value<uint8_t>(this->out, se->mark());
+			}
+			for (auto sl = N.shalfloops_begin(); sl != N.shalfloops_end(); ++sl) {
+				handle(sl->twin());
+				handle(sl->incident_sface());
+				handle(sl->facet());
+				write_value<int32_t>(this->out, sl->get_index());
+				write_plane(sl->circle());
+				write_value<uint8_t>(this->out, sl->mark());
+			}
+			for (auto sf = N.sfaces_begin(); sf != N.sfaces_end(); ++sf) {
+				handle(sf->center_vertex());
+				handle(sf->volume());
+				this->entries.clear();
+				for (auto fc = sf->sface_cycles_begin(); fc != sf->sface_cycles_end(); ++fc) {
+					if (fc.is_svertex()) this->entries.push_back(index(Nef::SVertex_const_handle(fc)));
+					else if (fc.is_shalfedge()) this->entries.push_back(index(Nef::SHalfedge_const_handle(fc)) | edge_flag);
+					else if (fc.is_shalfloop()) this->entries.push_back(index(Nef::SHalfloop_const_handle(fc)) | loop_flag);
+				}
+				write_entries();
+				write_value<uint8_t>(this->out, sf->mark());
+			}
+		}
+
+	private:
+		// Numbers the items of one kind in list order
+		template <typename Iterator> void number(Iterator begin, Iterator end) {
+			uint32_t n = 0;
+			for (auto it = begin; it != end; ++it) this->indices.emplace(&*it, n++);
+			this->counts.push_back(n);
+		}
+
+		// Items which aren't numbered are list ends
+		template <typename Handle> uint32_t index(Handle h) const {
+			if (h == Handle()) return none;
+			const auto it = this->indices.find(&*h);
+			return it == this->indices.end() ? none : it->second;
+		}
+
+		template <typename Handle> void handle(Handle h) { write_value(this->out, index(h)); }
+
+		void write_entries() {
+			write_value<uint32_t>(this->out, this->entries.size());
+			for (uint32_t e : this->entries) write_value(this->out, e);
+		}
+
+		void write_rational(const NT3 &x) {
+			const auto &q = CGALUtils::to_gmpq(x);
+			write_integer(this->out, mpq_numref(q.mpq()), this->limbs);
+			write_integer(this->out, mpq_denref(q.mpq()), this->limbs);
+		}
+
+		template <typename Point> void write_point(const Point &p) {
+			write_rational(p.x()); write_rational(p.y()); write_rational(p.z());
+		}
+
+		template <typename Plane> void write_plane(const Plane &h) {
+			write_rational(h.a()); write_rational(h.b()); write_rational(h.c()); write_rational(h.d());
+		}
+
+		std::ostream &out;
+		std::unordered_map<const void *, uint32_t> indices;
+		std::vector<uint32_t> counts;
+		std::vector<uint32_t> entries;
+		std::vector<uint64_t> limbs;
+	};
+
+	/*!
+		Rebuilds the SNC of a Nef polyhedron item by item, as CGAL's
+		SNC_io_parser does for .nef3 files. This needs the protected SNC and
+		point locator of the polyhedron, hence the derived class.
+	*/
+	class NefReader : public CGAL_Nef_polyhedron3
+	{
+		typedef CGAL::SNC_decorator<SNC_structure> SNC_decorator;
+		typedef CGAL::SM_decorator<SNC_structure::Sphere_map> SM_decorator;
+		typedef SNC_structure::Vertex_handle Vertex_handle;
+		typedef SNC_structure::Halfedge_handle Halfedge_handle;
+		typedef SNC_structure::Halffacet_handle Halffacet_handle;
+		typedef SNC_structure::Volume_handle Volume_handle;
+		typedef SNC_structure::SHalfedge_handle SHalfedge_handle;
+		typedef SNC_structure::SHalfloop_handle SHalfloop_handle;
+		typedef SNC_structure::SFace_handle SFace_handle;
+
+	public:
+		NefReader(const char *&data, const char *end) : data(data), end(end), ok(true) {}
+
+		bool read() {
+			SNC_structure &snc = this->snc();
+			snc.clear();
+
+			uint32_t counts[7];
+			for (auto &count : counts) count = read_value<uint32_t>();
+			// Each item takes more than a byte, which bounds the counts of corrupt data
+			for (auto count : counts) {
+				if (!this->ok || count > size_t(this->end - this->data)) return false;
+			}
+			std::vector<Vertex_handle> vertices(counts[0]);
+			std::vector<Halfedge_handle> halfedges(counts[1]);
+			std::vector<Halffacet_handle> facets(counts[2]);
+			std::vector<Volume_handle> volumes(counts[3]);
+			std::vector<SHalfedge_handle> shalfedges(counts[4]);
+			std::vector<SHalfloop_handle> shalfloops(counts[5]);
+			std::vector<SFace_handle> sfaces(counts[6]);
+			for (auto &v : vertices) v = snc.new_vertex_only();
+			for (auto &e : halfedges) e = snc.new_halfedge_only();
+			for (auto &f : facets) f = snc.new_halffacet_only();
+			for (auto &c : volumes) c = snc.new_volume_only();
+			for (auto &se : shalfedges) se = snc.new_shalfedge_only();
+			for (auto &sl : shalfloops) sl = snc.new_shalfloop_only();
+			for (auto &sf : sfaces) sf = snc.new_sface_only();
+
+			for (auto &v : vertices) {
+				v->sncp() = &snc;
+				v->point() = read_point<Point_3>();
+				v->svertices_begin() = handle(halfedges, snc.halfedges_end());
+				v->svertices_last() = handle(halfedges, snc.halfedges_end());
+				v->shalfedges_begin() = handle(shalfedges, snc.shalfedges_end());
+				v->shalfedges_last() = handle(shalfedges, snc.shalfedges_end());
+				v->sfaces_begin() = handle(sfaces, snc.sfaces_end());
+				v->sfaces_last() = handle(sfaces, snc.sfaces_end());
+				v->shalfloop() = handle(shalfloops, snc.shalfloops_end());
+				v->mark() = read_value<uint8_t>();
+			}
+			for (auto &e : halfedges) {
+				e->twin() = handle(halfedges, snc.halfedges_end());
+				e->center_vertex() = handle(vertices, snc.vertices_end());
+				if (read_value<uint8_t>()) e->incident_sface() = handle(sfaces, snc.sfaces_end());
+				else e->out_sedge() = handle(shalfedges, snc.shalfedges_end());
+				e->set_index(read_value<int32_t>());
+				e->point() = Sphere_point(read_point<Point_3>());
+				e->mark() = read_value<uint8_t>();
+			}
+			SNC_decorator D(snc);
+			for (auto &f : facets) {
+				f->twin() = handle(facets, snc.halffacets_end());
+				f->incident_volume() = handle(volumes, snc.volumes_end());
+				const uint32_t numentries = read_value<uint32_t>();
+				for (uint32_t i = 0; this->ok && i < numentries; ++i) {
+					const uint32_t entry = read_value<uint32_t>();
+					if (entry & loop_flag) D.store_boundary_object(item(shalfloops, entry & index_mask), f);
+					else D.store_boundary_object(item(shalfedges, entry), f);
+				}
+				f->plane() = read_plane<Plane_3>();
+				f->mark() = read_value<uint8_t>();
+			}
+			for (auto &c : volumes) {
+				const uint32_t numshells = read_value<uint32_t>();
+				for (uint32_t i = 0; this->ok && i < numshells; ++i) {
+					D.store_boundary_object(item(sfaces, read_value<uint32_t>()), c);
+				}
+				c->mark() = read_value<uint8_t>();
+			}
+			for (auto &se : shalfedges) {
+				se->twin() = handle(shalfedges, snc.shalfedges_end());
+				se->sprev() = handle(shalfedges, snc.shalfedges_end());
+				se->snext() = handle(shalfedges, snc.shalfedges_end());
+				se->source() = handle(halfedges, snc.halfedges_end());
+				se->incident_sface() = handle(sfaces, snc.sfaces_end());
+				se->prev() = handle(shalfedges, snc.shalfedges_end());
+				se->next() = handle(shalfedges, snc.shalfedges_end());
+				se->facet() = handle(facets, snc.halffacets_end());
+				se->set_index(read_value<int32_t>());
+				se->set_forward_index(read_value<int32_t>());
+				se->set_backward_index(read_value<int32_t>());
+				se->circle() = Sphere_circle(read_plane<Plane_3>());
+				se->mark() = read_value<uint8_t>();
+			}
+			for (auto &sl : shalfloops) {
+				sl->twin() = handle(shalfloops, snc.shalfloops_end());
+				sl->incident_sface() = handle(sfaces, snc.sfaces_end());
+				sl->facet() = handle(facets, snc.halffacets_end());
+				sl->set_index(read_value<int32_t>());
+				sl->circle() = Sphere_circle(read_plane<Plane_3>());
+				sl->mark() = read_value<uint8_t>();
+			}
+			for (auto &sf : sfaces) {
+				sf->center_vertex() = handle(vertices, snc.vertices_end());
+				sf->volume() = handle(volumes, snc.volumes_end());
+				const uint32_t numentries = this->ok ? read_value<uint32_t>() : 0;
+				if (this->ok) {
+					SM_decorator SD(&*sf->center_vertex());
+					for (uint32_t i = 0; this->ok && i < numentries; ++i) {
+						const uint32_t entry = read_value<uint32_t>();
+						if (entry & loop_flag) SD.store_sm_boundary_object(item(shalfloops, entry & index_mask), sf);
+						else if (entry & edge_flag) SD.store_sm_boundary_object(item(shalfedges, entry & index_mask), sf);
+						else SD.store_sm_boundary_object(item(halfedges, entry), sf);
+					}
+				}
+				sf->mark() = read_value<uint8_t>();
+			}
+			if (!this->ok) return false;
+
+			this->pl()->initialize(&snc);
+			return true;
+		}
+
+	private:
+		template <typename T> T read_value() {
+			T v = T();
+			if (this->ok && size_t(this->end - this->data) >= sizeof(T)) {
+				memcpy(&v, this->data, sizeof(T));
+				this->data += sizeof(T);
+			}
+			else {
+				this->ok = false;
+			}
+			return v;
+		}
+
+		template <typename Handle> Handle handle(const std::vector<Handle> &items, Handle end) {
+			const uint32_t i = read_value<uint32_t>();
+			if (i == none) return end;
+			if (i < items.size()) return items[i];
+			this->ok = false;
+			return end;
+		}
+
+		// Cycle entries must refer to an item, unlike handles
+		template <typename Handle> Handle item(const std::vector<Handle> &items, uint32_t i) {
+			if (i < items.size()) return items[i];
+			this->ok = false;
+			return items.empty() ? Handle() : items[0];
+		}
+
+		void read_integer(mpz_ptr z) {
+			const int32_t size = read_value<int32_t>();
+			const size_t count = size < 0 ? -int64_t(size) : size;
+			if (!this->ok || count > size_t(this->end - this->data) / sizeof(uint64_t)) {
+				this->ok = false;
+				return;
+			}
+			mpz_import(z, count, -1, sizeof(uint64_t), 0, 0, this->data);
+			if (size < 0) mpz_neg(z, z);
+			this->data += count * sizeof(uint64_t);
+		}
+
+		CGAL::Gmpq read_rational() {
+			CGAL::Gmpq q;
+			read_integer(mpq_numref(q.mpq()));
+			read_integer(mpq_denref(q.mpq()));
+			if (mpz_sgn(mpq_denref(q.mpq())) <= 0) {
+				this->ok = false;
+				return CGAL::Gmpq();
+			}
+			return q;
+		}
+
+		template <typename Point> Point read_point() {
+			const auto x = read_rational();
+			const auto y = read_rational();
+			const auto z = read_rational();
+			return Point(CGALUtils::from_gmpq(x), CGALUtils::from_gmpq(y), CGALUtils::from_gmpq(z));
+		}
+
+		template <typename Plane> Plane read_plane() {
+			const auto a = read_rational();
+			const auto b = read_rational();
+			const auto c = read_rational();
+			const auto d = read_rational();
+			return Plane(CGALUtils::from_gmpq(a), CGALUtils::from_gmpq(b), CGALUtils::from_gmpq(c), CGALUtils::from_gmpq(d));
+		}
+
+		const char *&data;
+		const char *end;
+		bool ok;
+	};
+}
+
+namespace CGALUtils {
+	void writeNefPolyhedron(std::ostream &out, const CGAL_Nef_polyhedron3 &N)
+	{
+		NefWriter(out).write(N);
+	}
+
+	CGAL_Nef_polyhedron3 *readNefPolyhedron(const char *&data, const char *end)
+	{
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		CGAL_Nef_polyhedron3 *N = nullptr;
+		try {
+			NefReader reader(data, end);
+			// Shares the SNC of the reader
+			if (reader.read()) N = new CGAL_Nef_polyhedron3(reader);
+		} catch (const CGAL::Failure_exception &e) {
+			PRINTB("WARNING: Can't read Nef polyhedron: %s", e.what());
+		}
+		CGAL::set_error_behaviour(old_behaviour);
+		return N;
+	}
+}
+
+#endif // ENABLE_CGAL
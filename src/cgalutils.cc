@@ -18,6 +18,7 @@
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/normal_vector_newell_3.h>
 #include <CGAL/Handle_hash_function.h>
+#include <CGAL/Timer.h>
 
 #include <CGAL/config.h> 
 #include <CGAL/version.h> 
@@ -34,9 +35,10 @@
 #include "Reindexer.h"
 #include "hash.h"
 #include "GeometryUtils.h"
+#include "Trace.h"
 
-#include <map>
-#include <queue>
+#include <cmath>
+#include <unordered_map>
 
 static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 {
@@ -56,7 +58,7 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 		// NB! CGAL's convex_hull_3() doesn't like std::set iterators, so we use a list
 		// instead.
 		std::list<K::Point_3> points;
-		for (const auto &poly : psq.polygons) {
+		for (const auto &poly : psq.polygons()) {
 			for (const auto &p : poly) {
 				points.push_back(vector_convert<K::Point_3>(p));
 			}
@@ -72,18 +74,29 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 		return new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3(r_exact));
 	}
 
+	// Known from before for PolySets shared through the caches
+	const auto topology = ps.topology();
+	if (!topology->isManifold()) {
+		PRINTDB("PolySet isn't a closed manifold: %d unconnected edges, %d edges of more than two faces",
+						topology->unconnectededges % topology->nonmanifoldedges);
+	}
+
 	CGAL_Nef_polyhedron3 *N = nullptr;
 	auto plane_error = false;
 	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
 	try {
+		CGAL::Timer t;
+		t.start();
 		CGAL_Polyhedron P;
 		auto err = CGALUtils::createPolyhedronFromPolySet(psq, P);
-		 if (!err) {
-		 	PRINTDB("Polyhedron is closed: %d", P.is_closed());
-		 	PRINTDB("Polyhedron is valid: %d", P.is_valid(false, 0));
-		 }
+		t.stop();
+		const double polyhedrontime = t.time();
+		t.reset();
 
+		t.start();
 		if (!err) N = new CGAL_Nef_polyhedron3(P);
+		t.stop();
+		PRINTDB("PolySet->Nef: %d faces: polyhedron %f s, Nef %f s", psq.numPolygons() % polyhedrontime % t.time());
 	}
 	catch (const CGAL::Assertion_exception &e) {
 		// First two tests matches against CGAL < 4.10, the last two tests matches against CGAL >= 4.10
@@ -100,10 +113,6 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 	if (plane_error) try {
 			CGAL_Polyhedron P;
 			auto err = CGALUtils::createPolyhedronFromPolySet(ps_tri, P);
-            if (!err) {
-                PRINTDB("Polyhedron is closed: %d", P.is_closed());
-                PRINTDB("Polyhedron is valid: %d", P.is_valid(false, 0));
-            }
 			if (!err) N = new CGAL_Nef_polyhedron3(P);
 		}
 		catch (const CGAL::Assertion_exception &e) {
@@ -121,131 +130,82 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolygon2d(const Polygon2d &po
 
 namespace CGALUtils {
 
-	CGAL_Iso_cuboid_3 boundingBox(const CGAL_Nef_polyhedron3 &N)
+	/*!
+		Rounds the vertices of N to the GRID_FINE grid and rebuilds it, if
+		any of its exact coordinates needs more than maxbits bits. Chained
+		booleans make the rationals grow without bound, and with them the
+		time each further boolean takes.
+
+		Returns nullptr where N is left as it is: if its numbers are small,
+		if it isn't simple, or if it doesn't survive being rounded.
+	*/
+	CGAL_Nef_polyhedron *snapNefPolyhedron(const CGAL_Nef_polyhedron &N, size_t maxbits)
 	{
-		CGAL_Iso_cuboid_3 result(0,0,0,0,0,0);
+		if (N.isEmpty() || !N.p3->is_simple()) return nullptr;
+		auto large = [maxbits](const NT3 &x) {
+			const auto &q = to_gmpq(x);
+			return q.numerator().bit_size() > maxbits || q.denominator().bit_size() > maxbits;
+		};
+		bool snap = false;
 		CGAL_Nef_polyhedron3::Vertex_const_iterator vi;
-		std::vector<CGAL_Nef_polyhedron3::Point_3> points;
-		// can be optimized by rewriting bounding_box to accept vertices
-		CGAL_forall_vertices(vi, N) points.push_back(vi->point());
-		if (points.size()) result = CGAL::bounding_box(points.begin(), points.end());
-		return result;
-	}
-
-	namespace {
-
-		// lexicographic comparison
-		bool operator < (Vector3d const& a, Vector3d const& b) {
-			for (int i = 0; i < 3; i++) {
-				if (a[i] < b[i]) return true;
-				else if (a[i] == b[i]) continue;
-				return false;
+		CGAL_forall_vertices(vi, *N.p3) {
+			const auto &p = vi->point();
+			if (large(p.x()) || large(p.y()) || large(p.z())) {
+				snap = true;
+				break;
 			}
-			return false;
 		}
-	}
+		if (!snap) return nullptr;
 
-	struct VecPairCompare {
-		bool operator ()(std::pair<Vector3d, Vector3d> const& a,
-						 std::pair<Vector3d, Vector3d> const& b) const {
-			return a.first < b.first || (!(b.first < a.first) && a.second < b.second);
+		CGAL_Polyhedron P;
+		PolySet ps(3);
+		ps.setConvexity(N.getConvexity());
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		try {
+			if (nefworkaround::convert_to_Polyhedron<CGAL_Kernel3>(*N.p3, P) ||
+					createPolySetFromPolyhedron(P, ps)) snap = false;
 		}
-	};
-
-
-  /*!
-		Check if all faces of a polyset is within 0.1 degree of being convex.
-		
-		NB! This function can give false positives if the polyset contains
-		non-planar faces. To be on the safe side, consider passing a tessellated polyset.
-		See issue #1061.
-	*/
-	bool is_approximately_convex(const PolySet &ps) {
-
-		const double angle_threshold = cos_degrees(.1); // .1°
-
-		typedef CGAL::Simple_cartesian<double> K;
-		typedef K::Vector_3 Vector;
-		typedef K::Point_3 Point;
-		typedef K::Plane_3 Plane;
-
-		// compute edge to face relations and plane equations
-		typedef std::pair<Vector3d,Vector3d> Edge;
-		typedef std::map<Edge, int, VecPairCompare> Edge_to_facet_map;
-		Edge_to_facet_map edge_to_facet_map;
-		std::vector<Plane> facet_planes;
-		facet_planes.reserve(ps.polygons.size());
-
-		for (size_t i = 0; i < ps.polygons.size(); i++) {
-			Plane plane;
-			auto N = ps.polygons[i].size();
-			if (N >= 3) {
-				std::vector<Point> v(N);
-				for (size_t j = 0; j < N; j++) {
-					v[j] = vector_convert<Point>(ps.polygons[i][j]);
-					Edge edge(ps.polygons[i][j],ps.polygons[i][(j+1)%N]);
-					if (edge_to_facet_map.count(edge)) return false; // edge already exists: nonmanifold
-					edge_to_facet_map[edge] = i;
-				}
-				Vector normal;
-				CGAL::normal_vector_newell_3(v.begin(), v.end(), normal);
-				plane = Plane(v[0], normal);
-			}
-			facet_planes.push_back(plane);
+		catch (const CGAL::Failure_exception &e) {
+			PRINTDB("snapNefPolyhedron(): %s", e.what());
+			snap = false;
 		}
+		CGAL::set_error_behaviour(old_behaviour);
+		if (!snap) return nullptr;
 
-		for (size_t i = 0; i < ps.polygons.size(); i++) {
-			auto N = ps.polygons[i].size();
-			if (N < 3) continue;
-			for (size_t j = 0; j < N; j++) {
-				Edge other_edge(ps.polygons[i][(j+1)%N], ps.polygons[i][j]);
-				if (edge_to_facet_map.count(other_edge) == 0) return false;//
-				//Edge_to_facet_map::const_iterator it = edge_to_facet_map.find(other_edge);
-				//if (it == edge_to_facet_map.end()) return false; // not a closed manifold
-				//int other_facet = it->second;
-				int other_facet = edge_to_facet_map[other_edge];
-
-				auto p = vector_convert<Point>(ps.polygons[i][(j+2)%N]);
-
-				if (facet_planes[other_facet].has_on_positive_side(p)) {
-					// Check angle
-					const auto& u = facet_planes[other_facet].orthogonal_vector();
-					const auto& v = facet_planes[i].orthogonal_vector();
-
-					double cos_angle = u / sqrt(u*u) * v / sqrt(v*v);
-					if (cos_angle < angle_threshold) {
-						return false;
-					}
-				}
+		for (auto &poly : ps.mutablePolygons()) {
+			for (auto &v : poly) {
+				for (size_t i = 0; i < 3; ++i) v[i] = std::round(v[i] / GRID_FINE) * GRID_FINE;
 			}
 		}
+		auto snapped = createNefPolyhedronFromPolySet(ps);
+		if (snapped->isEmpty() || !snapped->p3->is_simple()) {
+			delete snapped;
+			return nullptr;
+		}
+		snapped->setConvexity(N.getConvexity());
+		return snapped;
+	}
 
-		std::set<int> explored_facets;
-		std::queue<int> facets_to_visit;
-		facets_to_visit.push(0);
-		explored_facets.insert(0);
-
-		while(!facets_to_visit.empty()) {
-			int f = facets_to_visit.front(); facets_to_visit.pop();
-
-			for (size_t i = 0; i < ps.polygons[f].size(); i++) {
-				int j = (i+1) % ps.polygons[f].size();
-				auto it = edge_to_facet_map.find(Edge(ps.polygons[f][j], ps.polygons[f][i]));
-				if (it == edge_to_facet_map.end()) return false; // Nonmanifold
-				if (!explored_facets.count(it->second)) {
-					explored_facets.insert(it->second);
-					facets_to_visit.push(it->second);
-				}
+	CGAL_Iso_cuboid_3 boundingBox(const CGAL_Nef_polyhedron3 &N)
+	{
+		if (N.number_of_vertices() == 0) return CGAL_Iso_cuboid_3(0,0,0,0,0,0);
+		// Compared in place, as copying the points copies their exact numbers
+		auto vi = N.vertices_begin();
+		const auto &first = vi->point();
+		NT3 min[3] = {first.x(), first.y(), first.z()}, max[3] = {first.x(), first.y(), first.z()};
+		for (++vi; vi != N.vertices_end(); ++vi) {
+			const auto &p = vi->point();
+			for (int i = 0; i < 3; ++i) {
+				if (p[i] < min[i]) min[i] = p[i];
+				else if (max[i] < p[i]) max[i] = p[i];
 			}
 		}
-
-		// Make sure that we were able to reach all polygons during our visit
-		return explored_facets.size() == ps.polygons.size();
+		return CGAL_Iso_cuboid_3(min[0], min[1], min[2], max[0], max[1], max[2]);
 	}
 
-
 	CGAL_Nef_polyhedron *createNefPolyhedronFromGeometry(const Geometry &geom)
 	{
+		TRACE_ZONE("CGALUtils::createNefPolyhedronFromGeometry");
 		auto ps = dynamic_cast<const PolySet*>(&geom);
 		if (ps) {
 			return createNefPolyhedronFromPolySet(*ps);
@@ -268,6 +228,7 @@ namespace CGALUtils {
 #if 1
 	bool createPolySetFromNefPolyhedron3(const CGAL_Nef_polyhedron3 &N, PolySet &ps)
 	{
+		TRACE_ZONE("CGALUtils::createPolySetFromNefPolyhedron3");
 		// 1. Build Indexed PolyMesh
 		// 2. Validate mesh (manifoldness)
 		// 3. Triangulate each face
@@ -276,10 +237,16 @@ namespace CGALUtils {
 		// 5. Create PolySet
 
 		bool err = false;
+		CGAL::Timer timer;
+		timer.start();
 
 		// 1. Build Indexed PolyMesh
 		Reindexer<Vector3f> allVertices;
 		std::vector<std::vector<IndexedFace>> polygons;
+		polygons.reserve(N.number_of_halffacets() / 2);
+		// Converting exact coordinates is expensive, so convert each Nef vertex only once
+		std::unordered_map<CGAL_Nef_polyhedron3::Vertex_const_handle, int, CGAL::Handle_hash_function> vertexindex;
+		vertexindex.reserve(N.number_of_vertices());
 
 		CGAL_Nef_polyhedron3::Halffacet_const_iterator hfaceti;
 		CGAL_forall_halffacets(hfaceti, N) {
@@ -298,9 +265,13 @@ namespace CGALUtils {
 					faces.push_back(IndexedFace());
 					auto &currface = faces.back();
 					CGAL_For_all(c1, c2) {
-						CGAL_Point_3 p = c1->source()->center_vertex()->point();
-						// Create vertex indices and remove consecutive duplicate vertices
-						auto idx = allVertices.lookup(vector_convert<Vector3f>(p));
+						const auto v = c1->source()->center_vertex();
+						auto it = vertexindex.find(v);
+						if (it == vertexindex.end()) {
+							it = vertexindex.emplace(v, allVertices.lookup(vector_convert<Vector3f>(v->point()))).first;
+						}
+						// Remove consecutive duplicate vertices
+						auto idx = it->second;
 						if (currface.empty() || idx != currface.back()) currface.push_back(idx);
 					}
 					if (!currface.empty() && currface.front() == currface.back()) currface.pop_back();
@@ -309,6 +280,9 @@ namespace CGALUtils {
 			}
 			if (faces.empty()) polygons.pop_back(); // Cull empty faces
 		}
+		timer.stop();
+		const double indextime = timer.time();
+		timer.reset();
 
 		// 2. Validate mesh (manifoldness)
 		auto unconnected = GeometryUtils::findUnconnectedEdges(polygons);
@@ -316,58 +290,20 @@ namespace CGALUtils {
 			PRINTB("Error: Non-manifold mesh encountered: %d unconnected edges", unconnected);
 		}
 		// 3. Triangulate each face
+		timer.start();
 		const auto& verts = allVertices.getArray();
 		std::vector<IndexedTriangle> allTriangles;
-		for (const auto &faces : polygons) {
-#if 0 // For debugging
-			std::cerr << "---\n";
-			for(const auto &poly : faces) {
-				for(auto i : poly) {
-					std::cerr << i << " ";
-				}
-				std::cerr << "\n";
-			}
-#if 0 // debug
-			std::cerr.precision(20);
-			for(const auto &poly : faces) {
-				for(auto i : poly) {
-					std::cerr << verts[i][0] << "," << verts[i][1] << "," << verts[i][2] << "\n";
-				}
-				std::cerr << "\n";
-			}
-#endif // debug
-			std::cerr << "-\n";
-#endif // debug
-#if 0 // For debugging
-		std::cerr.precision(20);
-		for (size_t i=0;i<allVertices.size();i++) {
-			std::cerr << verts[i][0] << ", " << verts[i][1] << ", " << verts[i][2] << "\n";
-		}		
-#endif // debug
-
-			/* at this stage, we have a sequence of polygons. the first
-				 is the "outside edge' or 'body' or 'border', and the rest of the
-				 polygons are 'holes' within the first. there are several
-				 options here to get rid of the holes. we choose to go ahead
-				 and let the tessellater deal with the holes, and then
-				 just output the resulting 3d triangles*/
-
-			// We cannot trust the plane from Nef polyhedron to be correct.
-			// Passing an incorrect normal vector can cause a crash in the constrained delaunay triangulator
-			// See http://cgal-discuss.949826.n4.nabble.com/Nef3-Wrong-normal-vector-reported-causes-triangulator-crash-tt4660282.html
-			// CGAL::Vector_3<CGAL_Kernel3> nvec = plane.orthogonal_vector();
-			// K::Vector_3 normal(CGAL::to_double(nvec.x()), CGAL::to_double(nvec.y()), CGAL::to_double(nvec.z()));
-			std::vector<IndexedTriangle> triangles;
-			auto err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, nullptr);
-			if (!err) {
-				for (const auto &t : triangles) {
-					assert(t[0] >= 0 && t[0] < static_cast<int>(allVertices.size()));
-					assert(t[1] >= 0 && t[1] < static_cast<int>(allVertices.size()));
-					assert(t[2] >= 0 && t[2] < static_cast<int>(allVertices.size()));
-					allTriangles.push_back(t);
-				}
-			}
-		}
+		allTriangles.reserve(polygons.size());
+		/* Each polygon is a sequence of outlines: the first is the "outside
+			 edge" or "border", the rest are holes within the first. We let the
+			 tessellator deal with the holes, and just output the resulting 3d
+			 triangles.
+
+			 We cannot trust the plane from Nef polyhedron to be correct.
+			 Passing an incorrect normal vector can cause a crash in the constrained delaunay triangulator
+			 See http://cgal-discuss.949826.n4.nabble.com/Nef3-Wrong-normal-vector-reported-causes-triangulator-crash-tt4660282.html
+		*/
+		GeometryUtils::tessellatePolygonsWithHoles(verts, polygons, allTriangles);
 
 #if 0 // For debugging
 		for(const auto &t : allTriangles) {
@@ -380,12 +316,13 @@ namespace CGALUtils {
 			PRINTB("Error: Non-manifold triangle mesh created: %d unconnected edges", unconnected2);
 		}
 
-		for (const auto &t : allTriangles) {
-			ps.append_poly();
-			ps.append_vertex(verts[t[0]]);
-			ps.append_vertex(verts[t[1]]);
-			ps.append_vertex(verts[t[2]]);
+		ps.reserve(ps.numPolygons() + allTriangles.size());
+		for (const auto &tri : allTriangles) {
+			ps.append_poly({verts[tri[0]].cast<double>(), verts[tri[1]].cast<double>(), verts[tri[2]].cast<double>()});
 		}
+		timer.stop();
+		PRINTDB("Nef->PolySet: %d facets, %d vertices: indexing %f s, tessellation %f s",
+						polygons.size() % allVertices.size() % indextime % timer.time());
 
 #if 0 // For debugging
 		std::cerr.precision(20);
@@ -24,12 +24,12 @@ namespace /* anonymous */ {
 namespace CGALUtils {
 	bool applyHull(const Geometry::Geometries &children, PolySet &P);
 	CGAL_Nef_polyhedron *applyOperator(const Geometry::Geometries &children, OpenSCADOperator op);
+	shared_ptr<const Geometry> applyUnion3D(const Geometry::Geometries &children);
 	//FIXME: Old, can be removed:
 	//void applyBinaryOperator(CGAL_Nef_polyhedron &target, const CGAL_Nef_polyhedron &src, OpenSCADOperator op);
 	Polygon2d *project(const CGAL_Nef_polyhedron &N, bool cut);
 	CGAL_Iso_cuboid_3 boundingBox(const CGAL_Nef_polyhedron3 &N);
-	bool is_approximately_convex(const PolySet &ps);
-	Geometry const* applyMinkowski(const Geometry::Geometries &children);
+	Geometry const* applyMinkowski(const Geometry::Geometries &children, const std::vector<std::string> &keys = std::vector<std::string>());
 
 	template <typename Polyhedron> std::string printPolyhedron(const Polyhedron &p);
 	template <typename Polyhedron> bool createPolySetFromPolyhedron(const Polyhedron &p, PolySet &ps);
@@ -38,7 +38,13 @@ namespace CGALUtils {
 	void copyPolyhedron(const Polyhedron_A &poly_a, Polyhedron_B &poly_b);
 
 	CGAL_Nef_polyhedron *createNefPolyhedronFromGeometry(const class Geometry &geom);
+	CGAL_Nef_polyhedron *snapNefPolyhedron(const CGAL_Nef_polyhedron &N, size_t maxbits);
 	bool createPolySetFromNefPolyhedron3(const CGAL_Nef_polyhedron3 &N, PolySet &ps);
+	// Compact binary encoding of the SNC, see cgalutils-serialize.cc
+	void writeNefPolyhedron(std::ostream &out, const CGAL_Nef_polyhedron3 &N);
+	// Reads a Nef polyhedron at data, advancing data past it. Returns nullptr
+	// if the data is truncated or invalid.
+	CGAL_Nef_polyhedron3 *readNefPolyhedron(const char *&data, const char *end);
 
 	bool tessellatePolygon(const PolygonK &polygon,
 												 Polygons &triangles,
@@ -3,13 +3,26 @@
 
 #include "Tree.h"
 #include "GeometryEvaluator.h"
+#include "VoxelEvaluator.h"
+#include "CSGBackend.h"
 #include "progress.h"
 #include "printutils.h"
 #include "exceptions.h"
+#include "CGALRenderer.h"
 
-CGALWorker::CGALWorker()
+namespace {
+	// Progress callback of speculative evaluations
+	void speculation_report(const AbstractNode *, void *cancelled, double)
+	{
+		if (*static_cast<std::atomic<bool> *>(cancelled)) throw ProgressCancelException();
+	}
+}
+
+CGALWorker::CGALWorker() : cancelled(false)
 {
 	this->tree = nullptr;
+	this->renderer = nullptr;
+	this->speculative = false;
 	this->thread = new QThread();
 	if (this->thread->stackSize() < 1024*1024) this->thread->setStackSize(1024*1024);
 	connect(this->thread, SIGNAL(started()), this, SLOT(work()));
@@ -18,21 +31,69 @@ CGALWorker::CGALWorker()
 
 CGALWorker::~CGALWorker()
 {
+	delete this->renderer;
 	delete this->thread;
 }
 
 void CGALWorker::start(const Tree &tree)
 {
+	cancelSpeculation(true);
+	delete this->renderer;
+	this->renderer = nullptr;
 	this->tree = &tree;
+	this->speculative = false;
 	this->thread->start();
 }
 
+void CGALWorker::speculate(const Tree &tree, AbstractNode *root)
+{
+	if (this->thread->isRunning()) return;
+	this->tree = &tree;
+	this->speculative = true;
+	this->cancelled = false;
+	progress_report_prep(root, speculation_report, &this->cancelled);
+	this->thread->start(QThread::LowestPriority);
+}
+
+void CGALWorker::cancelSpeculation(bool wait)
+{
+	if (!this->speculative) return;
+	this->cancelled = true;
+	if (wait) this->thread->wait();
+}
+
+void CGALWorker::setForeground(bool foreground)
+{
+	if (this->speculative || !this->thread->isRunning()) return;
+	this->thread->setPriority(foreground ? QThread::NormalPriority : QThread::LowPriority);
+}
+
 void CGALWorker::work()
 {
+	if (this->speculative) {
+		try {
+			GeometryEvaluator evaluator(*this->tree);
+			evaluator.evaluateGeometry(*this->tree->root(), true);
+		}
+		catch (const ProgressCancelException &) {
+		}
+		catch (const HardWarningException &) {
+		}
+		progress_report_fin();
+		thread->quit();
+		return;
+	}
+
 	shared_ptr<const Geometry> root_geom;
 	try {
 		GeometryEvaluator evaluator(*this->tree);
-		root_geom = evaluator.evaluateGeometry(*this->tree->root(), true);
+		if (CSGBackend::current() == CSGBackend::voxel()) {
+			VoxelEvaluator voxelevaluator(*this->tree, evaluator, CSGBackend::voxelSize());
+			root_geom = voxelevaluator.evaluateGeometry(*this->tree->root());
+		}
+		if (!root_geom) root_geom = evaluator.evaluateGeometry(*this->tree->root(), true);
+		// Build the meshes for drawing here too, keeping the UI responsive
+		if (root_geom) this->renderer = new CGALRenderer(root_geom);
 	}
 	catch (const ProgressCancelException &e) {
 		PRINT("Rendering cancelled.");
@@ -44,3 +105,10 @@ void CGALWorker::work()
 	emit done(root_geom);
 	thread->quit();
 }
+
+CGALRenderer *CGALWorker::takeRenderer()
+{
+	auto renderer = this->renderer;
+	this->renderer = nullptr;
+	return renderer;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <QObject>
+#include <atomic>
 #include "memory.h"
 
 class CGALWorker : public QObject
@@ -10,7 +11,24 @@ public:
 	CGALWorker();
 	~CGALWorker();
 
+	// The renderer of the last result, prepared on the worker thread. The
+	// caller takes ownership; returns nullptr if there's no result.
+	class CGALRenderer *takeRenderer();
+
+	/*!
+		Evaluates the tree rooted at root at low priority, only to fill the
+		caches, so a following start() often finishes right away. Emits
+		nothing. Does nothing while the worker is busy. The tree must not
+		change until cancelSpeculation() or start() is called.
+	*/
+	void speculate(const class Tree &tree, class AbstractNode *root);
+	// Stops a speculative evaluation, if wait is set also waits for it to stop
+	void cancelSpeculation(bool wait);
+	// Whether the tab of the running render is visible, which runs at a lower priority otherwise
+	void setForeground(bool foreground);
+
 public slots:
+	// Cancels a speculative evaluation first
 	void start(const class Tree &tree);
 
 protected slots:
@@ -23,4 +41,7 @@ protected:
 
 	class QThread *thread;
 	const class Tree *tree;
+	class CGALRenderer *renderer;
+	bool speculative;
+	std::atomic<bool> cancelled;
 };
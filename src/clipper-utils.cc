@@ -1,5 +1,10 @@
 #include "clipper-utils.h"
 #include "printutils.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
 
 namespace ClipperUtils {
 
@@ -18,6 +23,9 @@ namespace ClipperUtils {
 
 	ClipperLib::Paths fromPolygon2d(const Polygon2d &poly)
 	{
+		// Polygons from toPolygon2d() still have their paths in Clipper space
+		if (poly.clipperPaths()) return *poly.clipperPaths();
+
 		ClipperLib::Paths result;
 		for (const auto &outline : poly.outlines()) {
 			result.push_back(fromOutline2d(outline, poly.isSanitized() ? true : false));
@@ -55,28 +63,24 @@ namespace ClipperUtils {
  */
 	Polygon2d *toPolygon2d(const ClipperLib::PolyTree &poly)
 	{
-		auto result = new Polygon2d;
+		auto paths = make_shared<Polygon2d::ClipperPaths>();
 		auto node = poly.GetFirst();
 		while (node) {
-			Outline2d outline;
-			// Apparently, when using offset(), clipper gets the hole status wrong
-			//outline.positive = !node->IsHole();
-			outline.positive = Orientation(node->Contour);
-
 			ClipperLib::Path cleaned_path;
 			ClipperLib::CleanPolygon(node->Contour, cleaned_path);
 
 			// CleanPolygon can in some cases reduce the polygon down to no vertices
-			if (cleaned_path.size() >= 3)  {
-				for (const auto &ip : cleaned_path) {
-					outline.vertices.emplace_back(1.0*ip.X/CLIPPER_SCALE, 1.0*ip.Y/CLIPPER_SCALE);
-				}
-				result->addOutline(outline);
+			if (cleaned_path.size() >= 3)	{
+				paths->push_back(std::move(cleaned_path));
 			}
 
 			node = node->GetNext();
 		}
-		result->setSanitized(true);
+		// The outlines are computed on demand (see Polygon2d::outlines()), using
+		// the orientation of each path: apparently, when using offset(), clipper
+		// gets the hole status wrong.
+		auto result = new Polygon2d;
+		result->setClipperPaths(paths);
 		return result;
 	}
 
@@ -91,6 +95,148 @@ namespace ClipperUtils {
 		return result;
 	}
 
+	// Unions of fewer children are not worth tiling
+	static const size_t min_tiled_union_children = 256;
+
+	static ClipperLib::IntRect bounds(const ClipperLib::Paths &paths)
+	{
+		ClipperLib::IntRect rect = {LLONG_MAX, LLONG_MAX, LLONG_MIN, LLONG_MIN};
+		for (const auto &path : paths) {
+			for (const auto &ip : path) {
+				rect.left = std::min(rect.left, ip.X);
+				rect.top = std::min(rect.top, ip.Y);
+				rect.right = std::max(rect.right, ip.X);
+				rect.bottom = std::max(rect.bottom, ip.Y);
+			}
+		}
+		return rect;
+	}
+
+	// Appends the cleaned contours of node and all nodes nested in it
+	static void appendCleaned(const ClipperLib::PolyNode &node, ClipperLib::Paths &paths)
+	{
+		ClipperLib::Path cleaned_path;
+		ClipperLib::CleanPolygon(node.Contour, cleaned_path);
+		if (cleaned_path.size() >= 3) paths.push_back(std::move(cleaned_path));
+		for (const auto child : node.Childs) appendCleaned(*child, paths);
+	}
+
+	/*!
+		Union of many children, evaluated in parallel.
+
+		The children are binned into a grid of tiles by the center of their
+		bounding box, and each tile is unioned on its own. The union of a tile
+		consists of disjoint islands (outer outlines with everything nested in
+		them). Islands whose bounding box doesn't touch an island of another
+		tile are final; the remaining ones lie along the tile seams and are
+		unioned once more.
+	*/
+	static Polygon2d *tiledUnion(const std::vector<ClipperLib::Paths> &pathsvector)
+	{
+		std::vector<ClipperLib::IntRect> childbounds;
+		childbounds.reserve(pathsvector.size());
+		ClipperLib::IntRect total = {LLONG_MAX, LLONG_MAX, LLONG_MIN, LLONG_MIN};
+		for (const auto &paths : pathsvector) {
+			childbounds.push_back(bounds(paths));
+			const auto &b = childbounds.back();
+			if (b.left > b.right) continue;
+			total.left = std::min(total.left, b.left);
+			total.top = std::min(total.top, b.top);
+			total.right = std::max(total.right, b.right);
+			total.bottom = std::max(total.bottom, b.bottom);
+		}
+
+		const int n = std::ceil(std::sqrt(4.0 * ThreadPool::instance()->numThreads()));
+		const double width = std::max(1.0, double(total.right) - total.left);
+		const double height = std::max(1.0, double(total.bottom) - total.top);
+		std::vector<std::vector<size_t>> tiles(n * n);
+		for (size_t i = 0; i < pathsvector.size(); ++i) {
+			const auto &b = childbounds[i];
+			if (b.left > b.right) continue;
+			const int x = std::min(n - 1, int(n * ((0.5 * b.left + 0.5 * b.right) - total.left) / width));
+			const int y = std::min(n - 1, int(n * ((0.5 * b.top + 0.5 * b.bottom) - total.top) / height));
+			tiles[y * n + x].push_back(i);
+		}
+
+		struct Island {
+			ClipperLib::IntRect rect;
+			size_t tile;
+			ClipperLib::Paths paths;
+			bool seam;
+		};
+		std::vector<std::vector<Island>> tileislands(tiles.size());
+		TaskGroup group;
+		for (size_t t = 0; t < tiles.size(); ++t) {
+			if (tiles[t].empty()) continue;
+			group.run([&pathsvector, &tiles, &tileislands, t]() {
+				ClipperLib::Clipper clipper;
+				for (const auto i : tiles[t]) clipper.AddPaths(pathsvector[i], ClipperLib::ptSubject, true);
+				ClipperLib::PolyTree result;
+				clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+				for (const auto outer : result.Childs) {
+					Island island;
+					island.tile = t;
+					island.seam = false;
+					appendCleaned(*outer, island.paths);
+					if (island.paths.empty()) continue;
+					island.rect = bounds(ClipperLib::Paths(1, outer->Contour));
+					tileislands[t].push_back(std::move(island));
+				}
+			});
+		}
+		group.wait();
+
+		std::vector<Island> islands;
+		for (auto &ti : tileislands) {
+			std::move(ti.begin(), ti.end(), std::back_inserter(islands));
+		}
+
+		// Sweep along x to find islands touching islands of other tiles
+		std::vector<size_t> order(islands.size());
+		for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+		std::sort(order.begin(), order.end(), [&islands](size_t a, size_t b) {
+			return islands[a].rect.left < islands[b].rect.left;
+		});
+		std::vector<size_t> active;
+		for (const auto i : order) {
+			auto &island = islands[i];
+			active.erase(std::remove_if(active.begin(), active.end(), [&islands, &island](size_t j) {
+				return islands[j].rect.right < island.rect.left;
+			}), active.end());
+			for (const auto j : active) {
+				auto &other = islands[j];
+				if (other.tile != island.tile &&
+						other.rect.top <= island.rect.bottom && island.rect.top <= other.rect.bottom) {
+					other.seam = island.seam = true;
+				}
+			}
+			active.push_back(i);
+		}
+
+		auto paths = make_shared<Polygon2d::ClipperPaths>();
+		ClipperLib::Clipper seams;
+		bool hasseams = false;
+		for (const auto &island : islands) {
+			if (island.seam) {
+				seams.AddPaths(island.paths, ClipperLib::ptSubject, true);
+				hasseams = true;
+			}
+			else {
+				paths->insert(paths->end(), island.paths.begin(), island.paths.end());
+			}
+		}
+		if (hasseams) {
+			ClipperLib::PolyTree result;
+			seams.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+			for (const auto outer : result.Childs) appendCleaned(*outer, *paths);
+		}
+		PRINTDB("Tiled union: %d children, %d tiles, %d islands", pathsvector.size() % tiles.size() % islands.size());
+
+		auto poly = new Polygon2d;
+		poly->setClipperPaths(paths);
+		return poly;
+	}
+
 	/*!
 		Apply the clipper operator to the given paths.
 
@@ -117,6 +263,11 @@ namespace ClipperUtils {
 			return ClipperUtils::toPolygon2d(result);
 		}
 
+		if (clipType == ClipperLib::ctUnion && ThreadPool::instance()->isParallel() &&
+				pathsvector.size() >= min_tiled_union_children) {
+			return tiledUnion(pathsvector);
+		}
+
 		bool first = true;
 		for (const auto &paths : pathsvector) {
 			clipper.AddPaths(paths, first ? ClipperLib::ptSubject : ClipperLib::ptClip, true);
@@ -218,52 +369,272 @@ namespace ClipperUtils {
 		}
 	}
 
-	Polygon2d *applyMinkowski(const std::vector<const Polygon2d*> &polygons)
+	// Minkowski sums of fewer terms are not worth splitting into chunks
+	static const size_t min_parallel_minkowski_terms = 4096;
+
+	// Whether path turns in one direction and winds around once; collinear vertices are allowed
+	static bool isConvex(const ClipperLib::Path &path)
 	{
-		if (polygons.size() == 1) return new Polygon2d(*polygons[0]); // Just copy
+		const size_t n = path.size();
+		if (n < 3) return false;
+		int turn = 0, ysign = 0, ychanges = 0;
+		for (size_t i = 0; i < n; ++i) {
+			const auto &a = path[i], &b = path[(i + 1) % n], &c = path[(i + 2) % n];
+			const double cross = double(b.X - a.X) * (c.Y - b.Y) - double(b.Y - a.Y) * (c.X - b.X);
+			if (cross != 0) {
+				if (turn && (cross > 0) != (turn > 0)) return false;
+				turn = cross > 0 ? 1 : -1;
+			}
+			if (b.Y != a.Y) {
+				if (ysign && (b.Y > a.Y) != (ysign > 0)) ychanges++;
+				ysign = b.Y > a.Y ? 1 : -1;
+			}
+		}
+		return turn != 0 && ychanges <= 2;
+	}
 
-		ClipperLib::Clipper c;
-		auto lhs = ClipperUtils::fromPolygon2d(*polygons[0]);
+	static ClipperLib::Path counterClockwise(ClipperLib::Path path)
+	{
+		if (!ClipperLib::Orientation(path)) ClipperLib::ReversePath(path);
+		return path;
+	}
 
-		for (size_t i=1; i<polygons.size(); i++) {
-			ClipperLib::Paths minkowski_terms;
-			auto rhs = ClipperUtils::fromPolygon2d(*polygons[i]);
-
-			// First, convolve each outline of lhs with the outlines of rhs
-			for (auto const& rhs_path : rhs) {
-				for (auto const& lhs_path : lhs) {
-					ClipperLib::Paths result;
-					minkowski_outline(lhs_path, rhs_path, result, true, true);
-					minkowski_terms.insert(minkowski_terms.end(), result.begin(), result.end());
+	// Orders the directions of the edges a0-a1 and b0-b1 by their angle in [0, 2pi)
+	static int compareAngles(const ClipperLib::IntPoint &a0, const ClipperLib::IntPoint &a1,
+													 const ClipperLib::IntPoint &b0, const ClipperLib::IntPoint &b1)
+	{
+		const ClipperLib::cInt ax = a1.X - a0.X, ay = a1.Y - a0.Y, bx = b1.X - b0.X, by = b1.Y - b0.Y;
+		const int ahalf = ay < 0 || (ay == 0 && ax < 0), bhalf = by < 0 || (by == 0 && bx < 0);
+		if (ahalf != bhalf) return ahalf < bhalf ? -1 : 1;
+		const double cross = double(ax) * by - double(ay) * bx;
+		return cross > 0 ? -1 : cross < 0 ? 1 : 0;
+	}
+
+	/*!
+		The Minkowski sum of two counter-clockwise convex polygons, in linear
+		time: starting from the lowest vertex of each, the edges of both are
+		merged by their angle. p may also be a segment of two vertices.
+	*/
+	static ClipperLib::Path convexSum(const ClipperLib::Path &p, const ClipperLib::Path &q)
+	{
+		auto lowest = [](const ClipperLib::Path &path) {
+			return size_t(std::min_element(path.begin(), path.end(), [](const ClipperLib::IntPoint &a, const ClipperLib::IntPoint &b) {
+				return a.Y < b.Y || (a.Y == b.Y && a.X < b.X);
+			}) - path.begin());
+		};
+		const size_t np = p.size(), nq = q.size(), pstart = lowest(p), qstart = lowest(q);
+		ClipperLib::Path sum;
+		sum.reserve(np + nq);
+		size_t i = 0, j = 0;
+		while (i < np || j < nq) {
+			const auto &a = p[(pstart + i) % np], &b = q[(qstart + j) % nq];
+			sum.emplace_back(a.X + b.X, a.Y + b.Y);
+			const int order = i == np ? 1 : j == nq ? -1 : compareAngles(a, p[(pstart + i + 1) % np], b, q[(qstart + j + 1) % nq]);
+			if (order <= 0) i++;
+			if (order >= 0) j++;
+		}
+		return sum;
+	}
+
+	static size_t minkowskiChunks(size_t items, size_t terms)
+	{
+		if (!ThreadPool::instance()->isParallel() || terms < min_parallel_minkowski_terms) return 1;
+		return std::max(size_t(1), std::min(items, size_t(4 * ThreadPool::instance()->numThreads())));
+	}
+
+	/*!
+		The terms of the Minkowski sum of lhs and rhs, in chunks which are
+		computed concurrently.
+
+		If one operand is a single convex outline, each edge of the other
+		operand sweeps a convex polygon, the sum of the edge and the convex
+		outline, and the other operand translated into the convex one fills
+		the rest. Two convex outlines sum up to one convex polygon. Otherwise
+		each pair of outlines is convolved into quads.
+	*/
+	static std::vector<ClipperLib::Paths> minkowskiTerms(const ClipperLib::Paths &lhs, const ClipperLib::Paths &rhs)
+	{
+		const ClipperLib::Paths *convex = nullptr, *other = nullptr;
+		if (rhs.size() == 1 && isConvex(rhs[0])) { convex = &rhs; other = &lhs; }
+		else if (lhs.size() == 1 && isConvex(lhs[0])) { convex = &lhs; other = &rhs; }
+
+		std::vector<ClipperLib::Paths> parts;
+		if (convex) {
+			const auto q = counterClockwise((*convex)[0]);
+			if (other->size() == 1 && isConvex((*other)[0])) {
+				parts.emplace_back(1, convexSum(counterClockwise((*other)[0]), q));
+				return parts;
+			}
+
+			std::vector<ClipperLib::Path> edges;
+			for (const auto &path : *other) {
+				for (size_t i = 0; i < path.size(); ++i) {
+					const auto &a = path[i], &b = path[(i + 1) % path.size()];
+					if (a != b) edges.push_back({a, b});
 				}
 			}
-			
-			// Then, fill the central parts
-			fill_minkowski_insides(lhs, rhs, minkowski_terms);
-			fill_minkowski_insides(rhs, lhs, minkowski_terms);
-
-			// This union operation must be performed at each iteration since the minkowski_terms
-			// now contain lots of small quads
-			c.Clear();
-			c.AddPaths(minkowski_terms, ClipperLib::ptSubject, true);
-
-			if (i != polygons.size() - 1) {
-				c.Execute(ClipperLib::ctUnion, lhs, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+			parts.resize(minkowskiChunks(edges.size(), edges.size() * q.size()));
+			TaskGroup group;
+			for (size_t c = 0; c < parts.size(); ++c) {
+				group.run([&, c]() {
+					for (size_t e = edges.size() * c / parts.size(); e < edges.size() * (c + 1) / parts.size(); ++e) {
+						parts[c].push_back(convexSum(edges[e], q));
+					}
+				});
 			}
+			group.wait();
+			fill_minkowski_insides(*other, ClipperLib::Paths(1, q), parts[0]);
+			return parts;
 		}
 
+		std::vector<std::pair<const ClipperLib::Path *, const ClipperLib::Path *>> pairs;
+		size_t numterms = 0;
+		for (auto const& rhs_path : rhs) {
+			for (auto const& lhs_path : lhs) {
+				pairs.emplace_back(&lhs_path, &rhs_path);
+				numterms += lhs_path.size() * rhs_path.size();
+			}
+		}
+		parts.resize(minkowskiChunks(pairs.size(), numterms));
+		TaskGroup group;
+		for (size_t c = 0; c < parts.size(); ++c) {
+			group.run([&, c]() {
+				for (size_t i = pairs.size() * c / parts.size(); i < pairs.size() * (c + 1) / parts.size(); ++i) {
+					minkowski_outline(*pairs[i].first, *pairs[i].second, parts[c], true, true);
+				}
+			});
+		}
+		group.wait();
+
+		// Then, fill the central parts
+		fill_minkowski_insides(lhs, rhs, parts[0]);
+		fill_minkowski_insides(rhs, lhs, parts[0]);
+		return parts;
+	}
+
+	/*!
+		Union of parts which may overlap. With more than two parts, each is
+		unioned on its own, concurrently, then pairs of the results, and so
+		on, so no union sees many more paths than its result has.
+	*/
+	static void reducedUnion(std::vector<ClipperLib::Paths> &parts, ClipperLib::PolyTree &result)
+	{
+		if (parts.size() > 2) {
+			TaskGroup group;
+			for (auto &part : parts) {
+				group.run([&part]() { part = process(part, ClipperLib::ctUnion, ClipperLib::pftNonZero); });
+			}
+			group.wait();
+		}
+		while (parts.size() > 2) {
+			std::vector<ClipperLib::Paths> merged(parts.size() / 2);
+			TaskGroup group;
+			for (size_t i = 0; i < merged.size(); ++i) {
+				group.run([&parts, &merged, i]() {
+					ClipperLib::Clipper clipper;
+					clipper.AddPaths(parts[2 * i], ClipperLib::ptSubject, true);
+					clipper.AddPaths(parts[2 * i + 1], ClipperLib::ptSubject, true);
+					clipper.Execute(ClipperLib::ctUnion, merged[i], ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+				});
+			}
+			group.wait();
+			if (parts.size() % 2) merged.push_back(std::move(parts.back()));
+			parts.swap(merged);
+		}
+		ClipperLib::Clipper clipper;
+		for (const auto &part : parts) clipper.AddPaths(part, ClipperLib::ptSubject, true);
+		clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+	}
+
+	Polygon2d *applyMinkowski(const std::vector<const Polygon2d*> &polygons)
+	{
+		if (polygons.size() == 1) return new Polygon2d(*polygons[0]); // Just copy
+
+		auto lhs = ClipperUtils::fromPolygon2d(*polygons[0]);
 		ClipperLib::PolyTree polytree;
-		c.Execute(ClipperLib::ctUnion, polytree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+		for (size_t i=1; i<polygons.size(); i++) {
+			auto parts = minkowskiTerms(lhs, ClipperUtils::fromPolygon2d(*polygons[i]));
+			PRINTDB("Minkowski: %d chunks", parts.size());
+
+			// This union operation must be performed at each iteration since the terms
+			// contain lots of small polygons
+			polytree.Clear();
+			reducedUnion(parts, polytree);
+			if (i != polygons.size() - 1) ClipperLib::PolyTreeToPaths(polytree, lhs);
+		}
 
 		return toPolygon2d(polytree);
 	}
 
+	// Offsets of fewer vertices are not worth splitting into islands
+	static const size_t min_parallel_offset_vertices = 4096;
+
+	// Appends the contour of an outer node and those of its holes
+	static void appendIsland(const ClipperLib::PolyNode &outer, ClipperLib::Paths &island, std::vector<const ClipperLib::PolyNode *> &nested)
+	{
+		island.push_back(outer.Contour);
+		for (const auto hole : outer.Childs) {
+			island.push_back(hole->Contour);
+			for (const auto inner : hole->Childs) nested.push_back(inner);
+		}
+	}
+
+	/*!
+		Offsets the outlines of poly. Vertices closer than about one Clipper
+		unit to their neighbors are dropped first, since they only add tiny
+		arcs to round offsets.
+
+		Large polygons are split into islands (outer outlines with their
+		holes), which are offset concurrently on the ThreadPool and unioned
+		again, as they may overlap after growing.
+	*/
 	Polygon2d *applyOffset(const Polygon2d& poly, double offset, ClipperLib::JoinType joinType, double miter_limit, double arc_tolerance)
 	{
-		ClipperLib::ClipperOffset co(miter_limit, arc_tolerance * CLIPPER_SCALE);
-		co.AddPaths(fromPolygon2d(poly), joinType, ClipperLib::etClosedPolygon);
-		ClipperLib::PolyTree result;
-		co.Execute(result, offset * CLIPPER_SCALE);
-		return toPolygon2d(result);
+		ClipperLib::Paths paths = fromPolygon2d(poly);
+		ClipperLib::CleanPolygons(paths);
+		size_t numvertices = 0;
+		for (const auto &path : paths) numvertices += path.size();
+
+		std::vector<ClipperLib::Paths> islands;
+		if (ThreadPool::instance()->isParallel() && numvertices >= min_parallel_offset_vertices) {
+			// The tree of the outlines tells holes and their islands apart
+			ClipperLib::Clipper clipper;
+			clipper.AddPaths(paths, ClipperLib::ptSubject, true);
+			ClipperLib::PolyTree tree;
+			clipper.Execute(ClipperLib::ctUnion, tree, ClipperLib::pftEvenOdd);
+			std::vector<const ClipperLib::PolyNode *> outers(tree.Childs.begin(), tree.Childs.end());
+			while (!outers.empty()) {
+				std::vector<const ClipperLib::PolyNode *> nested;
+				for (const auto outer : outers) {
+					islands.emplace_back();
+					appendIsland(*outer, islands.back(), nested);
+				}
+				outers.swap(nested);
+			}
+		}
+
+		if (islands.size() < 2) {
+			ClipperLib::ClipperOffset co(miter_limit, arc_tolerance * CLIPPER_SCALE);
+			co.AddPaths(paths, joinType, ClipperLib::etClosedPolygon);
+			ClipperLib::PolyTree result;
+			co.Execute(result, offset * CLIPPER_SCALE);
+			return toPolygon2d(result);
+		}
+
+		std::vector<ClipperLib::Paths> offsets(islands.size());
+		const size_t numchunks = std::min(islands.size(), size_t(4 * ThreadPool::instance()->numThreads()));
+		TaskGroup group;
+		for (size_t c = 0; c < numchunks; ++c) {
+			group.run([&, c]() {
+				for (size_t i = islands.size() * c / numchunks; i < islands.size() * (c + 1) / numchunks; ++i) {
+					ClipperLib::ClipperOffset co(miter_limit, arc_tolerance * CLIPPER_SCALE);
+					co.AddPaths(islands[i], joinType, ClipperLib::etClosedPolygon);
+					co.Execute(offsets[i], offset * CLIPPER_SCALE);
+				}
+			});
+		}
+		group.wait();
+		PRINTDB("Offset: %d islands", islands.size());
+		return apply(offsets, ClipperLib::ctUnion);
 	}
 };
@@ -16,6 +16,24 @@ struct GroupInfo {
 
 typedef std::vector <GroupInfo> GroupList;
 
+/*
+  Offsets of the first character of each line, so a line is found without
+  scanning the text up to it for every parameter
+*/
+static std::vector<size_t> getLineStarts(const std::string &fulltext, int lastLine)
+{
+	std::vector<size_t> starts{0, 0}; // lines are counted from 1
+	for (size_t i = 0; i < fulltext.length() && int(starts.size()) <= lastLine; i++) {
+		if (fulltext[i] == '\n') starts.push_back(i + 1);
+	}
+	return starts;
+}
+
+static size_t getLineStart(const std::vector<size_t> &lineStarts, const std::string &fulltext, int line)
+{
+	return size_t(line) < lineStarts.size() ? lineStarts[line] : fulltext.length();
+}
+
 /*
   Finds line to break stop parsing parsing parameters
 
@@ -80,19 +98,15 @@ static int getLineToStop( const std::string &fulltext){
   Finds the given line in the given source code text, and
   extracts the comment (excluding the "//" prefix)
 */
-static std::string getComment(const std::string &fulltext, int line)
+static std::string getComment(const std::string &fulltext, const std::vector<size_t> &lineStarts, int line)
 {
 	if (line < 1) return "";
 
 	// Locate line
-	unsigned int start = 0;
-	for (; start<fulltext.length() ; start++) {
-		if (line <= 1) break;
-		if (fulltext[start] == '\n') line--;
-	}
+	const size_t start = getLineStart(lineStarts, fulltext, line);
 
-	int end = start + 1;
-	while (fulltext[end] != '\n') end++;
+	size_t end = start + 1;
+	while (end < fulltext.length() && fulltext[end] != '\n') end++;
 
 	std::string comment = fulltext.substr(start, end - start);
 
@@ -123,15 +137,11 @@ static std::string getComment(const std::string &fulltext, int line)
    Extracts a parameter description from comment on the given line.
    Returns description, without any "//"
 */
-static std::string getDescription(const std::string &fulltext, int line)
+static std::string getDescription(const std::string &fulltext, const std::vector<size_t> &lineStarts, int line)
 {
 	if (line < 1) return "";
 
-	unsigned int start = 0;
-	for (; start<fulltext.length() ; start++) {
-		if (line <= 1) break;
-		if (fulltext[start] == '\n') line--;
-	}
+	size_t start = getLineStart(lineStarts, fulltext, line);
 
 	// not a valid description
 	if (fulltext.compare(start, 2, "//") != 0) return "";
@@ -144,7 +154,7 @@ static std::string getDescription(const std::string &fulltext, int line)
 	std::string retString = "";
 
 	// go till the end of the line
-	while (fulltext[start] != '\n') {
+	while (start < fulltext.length() && fulltext[start] != '\n') {
 		// replace // with space
 		if (fulltext.compare(start, 2, "//") == 0) {
 			retString += " ";
@@ -187,16 +197,16 @@ static GroupInfo createGroup(std::string comment,int lineNo)
 
 /*
   This function collect all groups of parameters described in the
-  scad file.
+  scad file, up to the line where parameters end.
 */
-static GroupList collectGroups(const std::string &fulltext)
+static GroupList collectGroups(const std::string &fulltext, int lastLine)
 {
 	GroupList groupList; // container of all group names
 	int lineNo = 1; // tracks line number
 	bool inString = false; // check if its string or (line-) comment
 
-	// iterate through whole scad file
-	for (unsigned int i=0; i<fulltext.length(); i++) {
+	// iterate through the scad file, as far as parameters may go
+	for (unsigned int i=0; i<fulltext.length() && lineNo < lastLine; i++) {
 		// increase line number
 		if (fulltext[i] == '\n') {
 			lineNo++;
@@ -262,8 +272,9 @@ void CommentParser::collectParameters(const std::string& fulltext, FileModule *r
 	static auto EmptyStringLiteral(std::make_shared<Literal>(ValuePtr(std::string(""))));
 
 	// Get all groups of parameters
-	GroupList groupList = collectGroups(fulltext);
 	int parseTill=getLineToStop(fulltext);
+	GroupList groupList = collectGroups(fulltext, parseTill);
+	const std::vector<size_t> lineStarts = getLineStarts(fulltext, parseTill);
 	// Extract parameters for all literal assignments
 	for (auto &assignment : root_module->scope.assignments) {
 		if (!assignment.expr.get()->isLiteral()) continue; // Only consider literals
@@ -281,7 +292,7 @@ void CommentParser::collectParameters(const std::string& fulltext, FileModule *r
 		AnnotationList *annotationList = new AnnotationList();
  
 		// Extracting the parameter comment
-		std::string comment = getComment(fulltext, firstLine);
+		std::string comment = getComment(fulltext, lineStarts, firstLine);
 		// getting the node for parameter annotation
 		shared_ptr<Expression> params = CommentParser::parser(comment.c_str());
 		if (!params) {
@@ -292,7 +303,7 @@ void CommentParser::collectParameters(const std::string& fulltext, FileModule *r
 		annotationList->push_back(Annotation("Parameter", params));
 
 		//extracting the description
-		std::string descr = getDescription(fulltext, firstLine - 1);
+		std::string descr = getDescription(fulltext, lineStarts, firstLine - 1);
 		if (descr != "") {
 			//creating node for description
 			shared_ptr<Expression> expr(new Literal(ValuePtr(std::string(descr.c_str()))));
@@ -29,19 +29,83 @@
 #include "evalcontext.h"
 #include "expression.h"
 #include "function.h"
+#include "FunctionCache.h"
 #include "UserModule.h"
 #include "ModuleInstantiation.h"
 #include "builtin.h"
 #include "printutils.h"
+#include "Trace.h"
 #include <boost/filesystem.hpp>
+#include <algorithm>
 namespace fs = boost::filesystem;
 
-// $children is not a config_variable. config_variables have dynamic scope, 
-// meaning they are passed down the call chain implicitly.
-// $children is simply misnamed and shouldn't have included the '$'.
 static bool is_config_variable(const std::string &name)
 {
-	return name[0] == '$' && name != "$children";
+	return VariableName::isConfig(name);
+}
+
+namespace {
+	thread_local Context::StackFork *current_fork = nullptr;
+}
+
+Context::StackFork::StackFork(const Context *ctx)
+	: from(resolve(ctx->ctx_stack)), stack(*this->from), outer(current_fork)
+{
+	current_fork = this;
+}
+
+Context::StackFork::~StackFork()
+{
+	current_fork = this->outer;
+}
+
+Context::Stack *Context::StackFork::resolve(Stack *stack)
+{
+	return current_fork ? resolve(current_fork, stack) : stack;
+}
+
+Context::Stack *Context::StackFork::resolve(const StackFork *fork, Stack *stack)
+{
+	// A fork may copy the stack of an enclosing fork
+	if (fork->outer) stack = resolve(fork->outer, stack);
+	return fork->from == stack ? const_cast<Stack *>(&fork->stack) : stack;
+}
+
+std::atomic<Context::LookupRecorder *> Context::LookupRecorder::current{nullptr};
+
+Context::LookupRecorder::LookupRecorder(const Context *scope)
+{
+	for (const Context *c = scope; c; c = c->parent) this->outer.push_back(c);
+	assert(!current);
+	current = this;
+}
+
+Context::LookupRecorder::~LookupRecorder()
+{
+	current = nullptr;
+}
+
+Context::LookupRecorder::Reads Context::LookupRecorder::takeReads()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return std::move(this->reads);
+}
+
+/*!
+	Called for each variable lookup with the context the variable was found
+	in, or nullptr if it wasn't found.
+*/
+void Context::LookupRecorder::record(const Context *found, const VariableName &name, const ValuePtr &value)
+{
+	LookupRecorder *recorder = current.load(std::memory_order_acquire);
+	if (!recorder) return;
+	if (found && std::find(recorder->outer.begin(), recorder->outer.end(), found) == recorder->outer.end()) return;
+	std::lock_guard<std::mutex> lock(recorder->mutex);
+	// Variables from outside don't change while recording, so the first value seen is kept
+	for (const auto &read : recorder->reads) {
+		if (read.first == name) return;
+	}
+	recorder->reads.emplace_back(name, value);
 }
 
 /*!
@@ -54,14 +118,18 @@ Context::Context(const Context *parent)
 {
 	if (parent) {
 		assert(parent->ctx_stack && "Parent context stack was null!");
-		this->ctx_stack = parent->ctx_stack;
+		this->ctx_stack = StackFork::resolve(parent->ctx_stack);
 		this->document_path = parent->document_path;
 	}
 	else {
 		this->ctx_stack = new Stack;
 	}
 
+	this->stack_index = this->ctx_stack->size();
 	this->ctx_stack->push_back(this);
+	for (int slot = 0; slot < VariableName::specialCount; ++slot) {
+		this->special[slot] = this->stack_index ? (*this->ctx_stack)[this->stack_index - 1]->special[slot] : -1;
+	}
 }
 
 Context::~Context()
@@ -71,28 +139,83 @@ Context::~Context()
 	if (!parent) delete this->ctx_stack;
 }
 
+/*!
+	The stack seen by lookups through this context on the current thread.
+*/
+const Context::Stack *Context::stack() const
+{
+	return StackFork::resolve(this->ctx_stack);
+}
+
+/*!
+	Records that this context sets the special variable of slot, for it and
+	the contexts above it which don't set the variable themselves.
+	Variables are nearly always set on the top context.
+*/
+void Context::setSpecial(int slot) const
+{
+	const Stack &stack = *this->stack();
+	assert(stack[this->stack_index] == this);
+	const int index = int(this->stack_index);
+	this->special[slot] = index;
+	for (size_t i = this->stack_index + 1; i < stack.size() && stack[i]->special[slot] < index; ++i) {
+		stack[i]->special[slot] = index;
+	}
+}
+
+/*!
+	Recomputes the special variable slots of the contexts from index from
+	up to the top of the stack, after variables were moved between them.
+*/
+void Context::updateSpecials(size_t from) const
+{
+	const Stack &stack = *this->stack();
+	for (size_t i = from; i < stack.size(); ++i) {
+		const Context *c = stack[i];
+		for (int slot = 0; slot < VariableName::specialCount; ++slot) {
+			const bool sets = c->config_variables.find(VariableName::specialName(slot)) != c->config_variables.end();
+			c->special[slot] = sets ? int(i) : i ? stack[i - 1]->special[slot] : -1;
+		}
+	}
+}
+
 /*!
 	Initialize context from a module argument list and a evaluation context
 	which may pass variables which will be preferred over default values.
 */
 void Context::setVariables(const EvalContext *evalctx, const AssignmentList &args, const AssignmentList &optargs, bool usermodule)
 {
-	// Set any default values
+	// Evaluate all default values first, each parameter is then set once
+	std::vector<ValuePtr> values;
+	values.reserve(args.size());
 	for (const auto &arg : args) {
-		set_variable(arg.name, arg.expr ? arg.expr->evaluate(this->parent) : ValuePtr::undefined);
+		values.push_back(arg.expr ? arg.expr->evaluate(this->parent) : ValuePtr::undefined);
 	}
 	
 	if (evalctx) {
-		auto assignments = evalctx->resolveArguments(args, optargs, usermodule && !OpenSCAD::parameterCheck);
-		for (const auto &ass : assignments) {
-			this->set_variable(ass.first, ass.second->evaluate(evalctx));
+		std::vector<int> params;
+		evalctx->bindArguments(args, optargs, usermodule && !OpenSCAD::parameterCheck, params);
+		for (size_t i = 0; i < params.size(); i++) {
+			const int param = params[i];
+			if (param == EvalContext::UNUSED) continue;
+			ValuePtr value = evalctx->getArgs()[i].expr->evaluate(evalctx);
+			if (param == EvalContext::BY_NAME) this->set_variable(evalctx->getArgName(i), value);
+			else if (size_t(param) < args.size()) values[param] = std::move(value);
+			else this->set_variable(optargs[param - args.size()].name, value);
 		}
 	}
+	for (size_t i = 0; i < args.size(); i++) {
+		this->set_variable(args[i].name, values[i]);
+	}
 }
 
 void Context::set_variable(const std::string &name, const ValuePtr &value)
 {
-	if (is_config_variable(name)) this->config_variables[name] = value;
+	if (is_config_variable(name)) {
+		const VariableName key(name);
+		this->config_variables[key] = value;
+		if (key.slot >= 0) setSpecial(key.slot);
+	}
 	else this->variables[name] = value;
 }
 
@@ -123,40 +246,68 @@ void Context::apply_variables(const Context &other)
 	}
 }
 
-ValuePtr Context::lookup_variable(const std::string &name, bool silent, const Location &loc) const
+/*!
+	Replaces all variables of this context by the ones of other, which is
+	left without variables.
+*/
+void Context::take_variables(Context &other)
+{
+	this->variables = std::move(other.variables);
+	this->config_variables = std::move(other.config_variables);
+	other.variables.clear();
+	other.config_variables.clear();
+	updateSpecials(std::min(this->stack_index, other.stack_index));
+}
+
+ValuePtr Context::lookup_variable(const VariableName &name, bool silent, const Location &loc) const
 {
+	TRACE_ZONE("Context::lookup_variable");
 	if (!this->ctx_stack) {
 		PRINT("ERROR: Context had null stack in lookup_variable()!!");
 		return ValuePtr::undefined;
 	}
-	if (is_config_variable(name)) {
-		for (int i = this->ctx_stack->size()-1; i >= 0; i--) {
-			const auto &confvars = ctx_stack->at(i)->config_variables;
-			if (confvars.find(name) != confvars.end()) {
-				return confvars.find(name)->second;
+	const Context *last = this;
+	if (name.config) {
+		const bool tracked = FunctionCache::Tracker::active();
+		const Stack *stack = this->stack();
+		// Special variables are only looked for where they are set
+		const int top = name.slot >= 0 ? stack->back()->special[name.slot] : int(stack->size()) - 1;
+		for (int i = top; i >= 0; i--) {
+			const auto &confvars = stack->at(i)->config_variables;
+			auto it = confvars.find(name);
+			if (it != confvars.end()) {
+				if (tracked) FunctionCache::Tracker::configLookup(name, it->second, *stack, i);
+				LookupRecorder::record(stack->at(i), name, it->second);
+				return it->second;
 			}
 		}
-		if (!silent) {
-			PRINTB("WARNING: Ignoring unknown variable '%s', %s.", name % loc.toRelativeString(this->documentPath()));
-		}
-		return ValuePtr::undefined;
-	}
-	if (!this->parent && this->constants.find(name) != this->constants.end()) {
-		return this->constants.find(name)->second;
+		if (tracked) FunctionCache::Tracker::configLookup(name, ValuePtr::undefined, *stack, -1);
+		LookupRecorder::record(nullptr, name, ValuePtr::undefined);
 	}
-	if (this->variables.find(name) != this->variables.end()) {
-		return this->variables.find(name)->second;
-	}
-	if (this->parent) {
-		return this->parent->lookup_variable(name, silent, loc);
+	else {
+		const Context *scope = FunctionCache::Tracker::scope();
+		for (const Context *c = this; c; c = c->parent) {
+			if (!c->parent) {
+				auto it = c->constants.find(name);
+				if (it != c->constants.end()) return it->second;
+			}
+			auto it = c->variables.find(name);
+			if (it != c->variables.end()) {
+				LookupRecorder::record(c, name, it->second);
+				return it->second;
+			}
+			// Leaving the function being evaluated
+			if (c == scope) FunctionCache::Tracker::taint();
+			last = c;
+		}
+		LookupRecorder::record(nullptr, name, ValuePtr::undefined);
 	}
 	if (!silent) {
-		PRINTB("WARNING: Ignoring unknown variable '%s', %s.", name % loc.toRelativeString(this->documentPath()));
+		PRINTB("WARNING: Ignoring unknown variable '%s', %s.", name % loc.toRelativeString(last->documentPath()));
 	}
 	return ValuePtr::undefined;
 }
 
-
 double Context::lookup_variable_with_default(const std::string &variable, const double &def, const Location &loc) const
 {
 	ValuePtr v = this->lookup_variable(variable, true, loc);
@@ -1,18 +1,66 @@
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include "value.h"
 #include "Assignment.h"
 #include "memory.h"
+#include "VariableName.h"
 
 class Context
 {
 public:
 	typedef std::vector<const Context*> Stack;
 
+	/*!
+		While alive, contexts created by the current thread underneath the
+		stack of ctx are pushed onto a private copy of that stack, and variable
+		lookups through that stack see the copy. This lets several threads
+		evaluate below the same context concurrently.
+	*/
+	class StackFork
+	{
+	public:
+		StackFork(const Context *ctx);
+		~StackFork();
+		// The stack the current thread uses in place of stack
+		static Stack *resolve(Stack *stack);
+	private:
+		static Stack *resolve(const StackFork *fork, Stack *stack);
+
+		Stack *from;
+		Stack stack;
+		StackFork *outer;
+	};
+
+	/*!
+		While alive, records the variables looked up from outside the given
+		scope, i.e. found in scope or one of its parents, or not found at
+		all, with the values seen. Builtin constants aren't recorded. Lookups
+		on all threads are recorded, so only one recorder may be alive.
+	*/
+	class LookupRecorder
+	{
+	public:
+		typedef std::vector<std::pair<VariableName, ValuePtr>> Reads;
+
+		LookupRecorder(const Context *scope);
+		~LookupRecorder();
+		Reads takeReads();
+
+		static void record(const Context *found, const VariableName &name, const ValuePtr &value);
+	private:
+		static std::atomic<LookupRecorder *> current;
+
+		std::vector<const Context *> outer;
+		std::mutex mutex;
+		Reads reads;
+	};
+
 	Context(const Context *parent = nullptr);
 	virtual ~Context();
 
@@ -28,7 +76,8 @@ public:
 	void set_constant(const std::string &name, const Value &value);
 
 	void apply_variables(const Context &other);
-	ValuePtr lookup_variable(const std::string &name, bool silent = false, const Location &loc=Location::NONE) const;
+	void take_variables(Context &other);
+	ValuePtr lookup_variable(const VariableName &name, bool silent = false, const Location &loc=Location::NONE) const;
 	double lookup_variable_with_default(const std::string &variable, const double &def, const Location &loc=Location::NONE) const;
 	std::string lookup_variable_with_default(const std::string &variable, const std::string &def, const Location &loc=Location::NONE) const;
 
@@ -41,13 +90,25 @@ public:
 public:
 
 protected:
+	const Stack *stack() const;
+	void setSpecial(int slot) const;
+	void updateSpecials(size_t from) const;
+
 	const Context *parent;
 	Stack *ctx_stack;
 
-	typedef std::unordered_map<std::string, ValuePtr> ValueMap;
+	typedef std::unordered_map<VariableName, ValuePtr, VariableName::Hash> ValueMap;
 	ValueMap constants;
 	ValueMap variables;
 	ValueMap config_variables;
+	/*!
+		For each special variable (see VariableName::specialSlot()), the
+		index in the stack of the topmost context at or below this one which
+		sets it, or -1. The dynamic scope lookup of a special variable is
+		then just the entry of the context on top of the stack.
+	*/
+	mutable int special[VariableName::specialCount];
+	size_t stack_index;
 
 	std::string document_path;
 
@@ -32,6 +32,10 @@
 #include "expression.h"
 #include "builtin.h"
 #include "printutils.h"
+#include "UserModule.h"
+#include "ThreadPool.h"
+#include "FunctionCache.h"
+#include <algorithm>
 #include <cstdint>
 
 class ControlModule : public AbstractModule
@@ -55,52 +59,99 @@ public: // methods
 
 	AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const override;
 
-	static void for_eval(AbstractNode &node, const ModuleInstantiation &inst, size_t l, 
+	static std::vector<ValuePtr> loop_values(const ModuleInstantiation &inst, size_t l,
+											 const Context *ctx, const EvalContext *evalctx);
+	static void for_eval(std::vector<AbstractNode *> &children, const ModuleInstantiation &inst, size_t l, 
 						 const Context *ctx, const EvalContext *evalctx);
+	static void for_eval_parallel(AbstractNode &node, const ModuleInstantiation &inst, const EvalContext *evalctx);
 
 	static const EvalContext* getLastModuleCtx(const EvalContext *evalctx);
 	
-	static AbstractNode* getChild(const ValuePtr &value, const EvalContext* modulectx);
+	static AbstractNode* getChild(const ValuePtr &value, const EvalContext* modulectx, const EvalContext *evalctx);
 
 private: // data
 	Type type;
 
 }; // class ControlModule
 
-void ControlModule::for_eval(AbstractNode &node, const ModuleInstantiation &inst, size_t l, 
+namespace {
+	// Loops with fewer iterations are always instantiated serially
+	const size_t FOR_PARALLEL_MIN = 16;
+
+	thread_local bool in_parallel_for = false;
+
+	/*!
+		Prepares the current thread for instantiating iterations of a loop
+		concurrently with other threads: contexts get a private stack below
+		ctx, the module stack is the one of the thread running the loop, and
+		printed messages go into capture. Loops nested in the iterations are
+		instantiated serially.
+	*/
+	class ParallelIteration
+	{
+	public:
+		ParallelIteration(const Context *ctx, const std::vector<std::string> &modules, PrintCapture &capture)
+			: fork(ctx), capture(capture), outer_modules(std::move(UserModule::moduleStack())), outer_in_parallel_for(in_parallel_for) {
+			UserModule::moduleStack() = modules;
+			in_parallel_for = true;
+		}
+		~ParallelIteration() {
+			UserModule::moduleStack() = std::move(this->outer_modules);
+			in_parallel_for = this->outer_in_parallel_for;
+		}
+
+	private:
+		Context::StackFork fork;
+		PrintCapture::Scope capture;
+		std::vector<std::string> outer_modules;
+		bool outer_in_parallel_for;
+	};
+}
+
+/*!
+	Returns the values the l'th loop variable iterates over.
+*/
+std::vector<ValuePtr> ControlModule::loop_values(const ModuleInstantiation &inst, size_t l,
+												 const Context *ctx, const EvalContext *evalctx)
+{
+	std::vector<ValuePtr> values;
+	ValuePtr it_values = evalctx->getArgValue(l, ctx);
+	if (it_values->type() == Value::ValueType::RANGE) {
+		RangeType range = it_values->toRange();
+		uint32_t steps = range.numValues();
+		if (steps >= 10000) {
+			PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu), %s", steps % inst.location().toRelativeString(ctx->documentPath()));
+		} else {
+			values.reserve(steps);
+			for (RangeType::iterator it = range.begin();it != range.end();it++) {
+				values.emplace_back(*it);
+			}
+		}
+	}
+	else if (it_values->type() == Value::ValueType::VECTOR) {
+		values = it_values->toVector();
+	}
+	else if (it_values->type() == Value::ValueType::STRING) {
+		utf8_split(it_values->toString(), [&](ValuePtr v) {
+			values.push_back(v);
+		});
+	}
+	else if (it_values->type() != Value::ValueType::UNDEFINED) {
+		values.push_back(it_values);
+	}
+	return values;
+}
+
+void ControlModule::for_eval(std::vector<AbstractNode *> &children, const ModuleInstantiation &inst, size_t l, 
 							const Context *ctx, const EvalContext *evalctx)
 {
 	if (evalctx->numArgs() > l) {
 		const std::string &it_name = evalctx->getArgName(l);
-		ValuePtr it_values = evalctx->getArgValue(l, ctx);
+		const std::vector<ValuePtr> values = loop_values(inst, l, ctx, evalctx);
 		Context c(ctx);
-		if (it_values->type() == Value::ValueType::RANGE) {
-			RangeType range = it_values->toRange();
-			uint32_t steps = range.numValues();
-			if (steps >= 10000) {
-				PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu), %s", steps % inst.location().toRelativeString(ctx->documentPath()));
-			} else {
-				for (RangeType::iterator it = range.begin();it != range.end();it++) {
-					c.set_variable(it_name, ValuePtr(*it));
-					for_eval(node, inst, l+1, &c, evalctx);
-				}
-			}
-		}
-		else if (it_values->type() == Value::ValueType::VECTOR) {
-			for (size_t i = 0; i < it_values->toVector().size(); i++) {
-				c.set_variable(it_name, it_values->toVector()[i]);
-				for_eval(node, inst, l+1, &c, evalctx);
-			}
-		}
-                else if (it_values->type() == Value::ValueType::STRING) {
-                        utf8_split(it_values->toString(), [&](ValuePtr v) {
-                            c.set_variable(it_name, v);
-                            for_eval(node, inst, l+1, &c, evalctx);
-                        });
-                }
-		else if (it_values->type() != Value::ValueType::UNDEFINED) {
-			c.set_variable(it_name, it_values);
-			for_eval(node, inst, l+1, &c, evalctx);
+		for (const auto &value : values) {
+			c.set_variable(it_name, value);
+			for_eval(children, inst, l+1, &c, evalctx);
 		}
 	} else if (l > 0) {
 		// At this point, the for loop variables have been set and we can initialize
@@ -111,7 +162,67 @@ void ControlModule::for_eval(AbstractNode &node, const ModuleInstantiation &inst
 		}
 		
 		std::vector<AbstractNode *> instantiatednodes = inst.instantiateChildren(&c);
-		node.children.insert(node.children.end(), instantiatednodes.begin(), instantiatednodes.end());
+		children.insert(children.end(), instantiatednodes.begin(), instantiatednodes.end());
+	}
+}
+
+/*!
+	Instantiates a for() or intersection_for() loop into node. With multiple
+	threads, chunks of the iterations of the outermost loop variable are
+	instantiated concurrently, each below its own contexts. The nodes and
+	messages of the chunks are merged in iteration order afterwards. If any
+	iteration throws, the whole loop is instantiated again serially, so
+	errors are reported exactly as without threads.
+*/
+void ControlModule::for_eval_parallel(AbstractNode &node, const ModuleInstantiation &inst, const EvalContext *evalctx)
+{
+	if (evalctx->numArgs() == 0) return;
+	const std::string &it_name = evalctx->getArgName(0);
+	const std::vector<ValuePtr> values = loop_values(inst, 0, evalctx, evalctx);
+
+	auto pool = ThreadPool::instance();
+	if (pool->isParallel() && !in_parallel_for && values.size() >= FOR_PARALLEL_MIN) {
+		// Calls being tracked on this thread wouldn't see what the iterations do
+		FunctionCache::Tracker::taint();
+		const size_t numchunks = std::min(values.size(), size_t(4 * pool->numThreads()));
+		std::vector<std::vector<AbstractNode *>> chunks(numchunks);
+		std::vector<PrintCapture> captures(numchunks);
+		const std::vector<std::string> modules = UserModule::moduleStack();
+		bool failed = false;
+		{
+			TaskGroup group;
+			for (size_t i = 0; i < numchunks; ++i) {
+				group.run([&, i]() {
+					ParallelIteration iteration(evalctx, modules, captures[i]);
+					Context c(evalctx);
+					for (size_t j = values.size()*i/numchunks; j < values.size()*(i+1)/numchunks; ++j) {
+						c.set_variable(it_name, values[j]);
+						for_eval(chunks[i], inst, 1, &c, evalctx);
+					}
+				});
+			}
+			try {
+				group.wait();
+			} catch (...) {
+				failed = true;
+			}
+		}
+		if (!failed) {
+			for (const auto &nodes : chunks) {
+				node.children.insert(node.children.end(), nodes.begin(), nodes.end());
+			}
+			for (const auto &capture : captures) capture.replay();
+			return;
+		}
+		for (const auto &nodes : chunks) {
+			for (auto child : nodes) delete child;
+		}
+	}
+
+	Context c(evalctx);
+	for (const auto &value : values) {
+		c.set_variable(it_name, value);
+		for_eval(node.children, inst, 1, &c, evalctx);
 	}
 }
 
@@ -136,7 +247,7 @@ const EvalContext* ControlModule::getLastModuleCtx(const EvalContext *evalctx)
 }
 
 // static
-AbstractNode* ControlModule::getChild(const ValuePtr &value, const EvalContext* modulectx)
+AbstractNode* ControlModule::getChild(const ValuePtr &value, const EvalContext* modulectx, const EvalContext *evalctx)
 {
 	if (value->type()!=Value::ValueType::NUMBER) {
 		// Invalid parameter
@@ -163,7 +274,7 @@ AbstractNode* ControlModule::getChild(const ValuePtr &value, const EvalContext*
 		return nullptr;
 	}
 	// OK
-	return modulectx->getChild(n)->evaluate(modulectx);
+	return modulectx->instantiateChild(n, evalctx);
 }
 
 AbstractNode *ControlModule::instantiate(const Context* ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const
@@ -193,7 +304,7 @@ AbstractNode *ControlModule::instantiate(const Context* ctx, const ModuleInstant
 		}
 		// This will trigger if trying to invoke child from the root of any file
         if (n < (int)modulectx->numChildren()) {
-			node = modulectx->getChild(n)->evaluate(modulectx);
+			node = modulectx->instantiateChild(n, evalctx);
 		}
 		else {
 			// How to deal with negative objects in this case?
@@ -216,7 +327,7 @@ AbstractNode *ControlModule::instantiate(const Context* ctx, const ModuleInstant
 			// no parameters => all children
 			AbstractNode* node = new GroupNode(inst);
 			for (int n = 0; n < (int)modulectx->numChildren(); ++n) {
-				AbstractNode* childnode = modulectx->getChild(n)->evaluate(modulectx);
+				AbstractNode* childnode = modulectx->instantiateChild(n, evalctx);
 				if (childnode==nullptr) continue; // error
 				node->children.push_back(childnode);
 			}
@@ -226,13 +337,13 @@ AbstractNode *ControlModule::instantiate(const Context* ctx, const ModuleInstant
 			// one (or more ignored) parameter
 			ValuePtr value = evalctx->getArgValue(0);
 			if (value->type() == Value::ValueType::NUMBER) {
-				return getChild(value, modulectx);
+				return getChild(value, modulectx, evalctx);
 			}
 			else if (value->type() == Value::ValueType::VECTOR) {
 				AbstractNode* node = new GroupNode(inst);
 				const Value::VectorType& vect = value->toVector();
 				for(const auto &vectvalue : vect) {
-					AbstractNode* childnode = getChild(vectvalue,modulectx);
+					AbstractNode* childnode = getChild(vectvalue, modulectx, evalctx);
 					if (childnode==nullptr) continue; // error
 					node->children.push_back(childnode);
 				}
@@ -247,7 +358,7 @@ AbstractNode *ControlModule::instantiate(const Context* ctx, const ModuleInstant
 				}
 				AbstractNode* node = new GroupNode(inst);
 				for (RangeType::iterator it = range.begin();it != range.end();it++) {
-					AbstractNode* childnode = getChild(ValuePtr(*it),modulectx); // with error cases
+					AbstractNode* childnode = getChild(ValuePtr(*it), modulectx, evalctx); // with error cases
 					if (childnode==nullptr) continue; // error
 					node->children.push_back(childnode);
 				}
@@ -310,12 +421,12 @@ AbstractNode *ControlModule::instantiate(const Context* ctx, const ModuleInstant
 
 	case Type::FOR:
 		node = new GroupNode(inst);
-		for_eval(*node, *inst, 0, evalctx, evalctx);
+		for_eval_parallel(*node, *inst, evalctx);
 		break;
 
 	case Type::INT_FOR:
 		node = new AbstractIntersectionNode(inst);
-		for_eval(*node, *inst, 0, evalctx, evalctx);
+		for_eval_parallel(*node, *inst, evalctx);
 		break;
 
 	case Type::IF: {
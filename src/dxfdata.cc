@@ -38,12 +38,17 @@
 #include <algorithm>
 #include <sstream>
 #include <map>
+#include <set>
+#include <cmath>
+#include <cstdint>
 
 #include "value.h"
 #include "boost-utils.h"
 #include "Polygon2d.h"
 #include "printutils.h"
 #include "degree_trig.h"
+#include "DiskCache.h"
+#include "StatCache.h"
 
 
 namespace fs = boost::filesystem;
@@ -68,6 +73,39 @@ struct Line {
 	Line(int i1 = -1, int i2 = -1) : idx{i1, i2}, disabled(false) { }
 };
 
+namespace {
+	const std::string cache_prefix = "dxf ";
+
+	template <typename T> void write_value(std::ostream &out, const T &v)
+	{
+		out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+	}
+
+	template <typename T> bool read_value(std::istream &in, T &v)
+	{
+		return bool(in.read(reinterpret_cast<char *>(&v), sizeof(T)));
+	}
+
+	/*!
+		Id of the DiskCache entry for the parsed file, or an empty string if
+		the disk cache isn't used. Changed files get a new id, the old
+		entries are evicted eventually.
+	*/
+	std::string disk_cache_id(const std::string &filename, const std::string &layername,
+														double fn, double fs, double fa, double xorigin, double yorigin, double scale)
+	{
+		if (!DiskCache::instance()->isEnabled()) return "";
+		struct ::stat st;
+		if (StatCache::stat(filename, st) != 0) return "";
+		std::ostringstream id;
+		id.precision(17);
+		id << cache_prefix << fs::absolute(filename).generic_string() << ":" << st.st_mtime << ":" << st.st_size
+			 << ":" << QuotedString(layername) << ":" << xorigin << ":" << yorigin << ":" << scale
+			 << ":" << fn << ":" << fs << ":" << fa;
+		return id.str();
+	}
+}
+
 DxfData::DxfData()
 {
 }
@@ -79,13 +117,24 @@ DxfData::DxfData(double fn, double fs, double fa,
 								 const std::string &filename, const std::string &layername, 
 								 double xorigin, double yorigin, double scale)
 {
+	const std::string cache_id = disk_cache_id(filename, layername, fn, fs, fa, xorigin, yorigin, scale);
+	if (!cache_id.empty()) {
+		std::string data;
+		if (DiskCache::instance()->getData(cache_id, data)) {
+			if (read(data)) return;
+			*this = DxfData();
+			DiskCache::instance()->remove(cache_id);
+		}
+	}
+
 	std::ifstream stream(filename.c_str());
 	if (!stream.good()) {
 		PRINTB("WARNING: Can't open DXF file '%s'.", filename);
 		return;
 	}
 
-	Grid2d<std::vector<int>> grid(GRID_COARSE);
+	// Only used to align points; the lines are joined after parsing
+	Grid2d<char> grid(GRID_COARSE);
 	std::vector<Line> lines;                       // Global lines
 	std::unordered_map<std::string, std::vector<Line>> blockdata; // Lines in blocks
 
@@ -102,8 +151,6 @@ DxfData::DxfData(double fn, double fs, double fa,
 			break;                                                \
 		grid.align(_p1x, _p1y);                                 \
 		grid.align(_p2x, _p2y);                                 \
-		grid.data(_p1x, _p1y).push_back(lines.size());          \
-		grid.data(_p2x, _p2y).push_back(lines.size());          \
 		if (in_entities_section)                                \
 			lines.emplace_back(                                   \
 			  addPoint(_p1x, _p1y), addPoint(_p2x, _p2y));        \
@@ -420,103 +467,101 @@ DxfData::DxfData(double fn, double fs, double fa,
 		}
 	}
 
-	// Extract paths from parsed data
+	// Extract paths from parsed data. The endpoints were aligned to the
+	// grid, so the lines meeting at a point have endpoints in the same cell.
 
-	typedef std::map<int, int> LineMap;
-	LineMap enabled_lines;
+	typedef std::pair<int64_t, int64_t> Cell;
+	FlatHashIndex<Cell, SpatialHash> cellids; // numbered like cellrefs
+	std::vector<std::vector<int>> cellrefs; // endpoints (2 * line + end) in each cell, in line order
+	std::vector<int> endcell(2 * lines.size());
+	for (size_t i = 0; i < lines.size(); i++) {
+		for (int j = 0; j < 2; j++) {
+			const auto &p = this->points[lines[i].idx[j]];
+			const Cell cell(std::llround(p[0] / grid.res), std::llround(p[1] / grid.res));
+			const auto id = cellids.insert(cell);
+			if (id.second) cellrefs.emplace_back();
+			endcell[2 * i + j] = id.first;
+			cellrefs[id.first].push_back(2 * i + j);
+		}
+	}
+	cellids.clear();
+
+	// Number of endpoints of enabled lines in each cell
+	std::vector<int> live(cellrefs.size());
+	for (size_t c = 0; c < cellrefs.size(); c++) live[c] = cellrefs[c].size();
+	// Index of the first endpoint of an enabled line in each cell
+	std::vector<size_t> firstref(cellrefs.size(), 0);
+
+	// An end is open if no other enabled line meets it
+	const auto is_open_end = [&](int line, int j) {
+		const int c = endcell[2 * line + j];
+		return live[c] == (endcell[2 * line] == c) + (endcell[2 * line + 1] == c);
+	};
+
+	// Lines with an open end, the start of the next open path is the first one
+	std::set<int> open_lines;
 	for (size_t i = 0; i < lines.size(); i++) {
-		enabled_lines[i] = i;
+		if (is_open_end(i, 0) || is_open_end(i, 1)) open_lines.insert(i);
 	}
 
-	// extract all open paths
-	while (enabled_lines.size() > 0) {
-		int current_line, current_point;
-
-		for (const auto &l : enabled_lines) {
-			int idx = l.second;
-			for (int j = 0; j < 2; j++) {
-				auto lv = grid.data(this->points[lines[idx].idx[j]][0], this->points[lines[idx].idx[j]][1]);
-				for (size_t ki = 0; ki < lv.size(); ki++) {
-					int k = lv.at(ki);
-					if (k == idx || lines[k].disabled) continue;
-					goto next_open_path_j;
-				}
-				current_line = idx;
-				current_point = j;
-				goto create_open_path;
-			next_open_path_j:;
+	const auto disable = [&](int line) {
+		lines[line].disabled = true;
+		for (int j = 0; j < 2; j++) {
+			const int c = endcell[2 * line + j];
+			live[c]--;
+			if (live[c] > 2) continue;
+			for (const auto ref : cellrefs[c]) {
+				const int l = ref / 2;
+				if (!lines[l].disabled && is_open_end(l, ref % 2)) open_lines.insert(l);
 			}
 		}
+	};
+
+	// Finds the first enabled line with an endpoint in cell c
+	const auto next_line = [&](int c, int &line, int &point) {
+		const auto &refs = cellrefs[c];
+		while (firstref[c] < refs.size() && lines[refs[firstref[c]] / 2].disabled) firstref[c]++;
+		for (size_t i = firstref[c]; i < refs.size(); i++) {
+			const int l = refs[i] / 2;
+			if (lines[l].disabled) continue;
+			line = l;
+			point = endcell[2 * l] == c ? 0 : 1;
+			return true;
+		}
+		return false;
+	};
+
+	const auto walk = [&](Path &path, int line, int point) {
+		path.indices.push_back(lines[line].idx[point]);
+		while (true) {
+			path.indices.push_back(lines[line].idx[!point]);
+			const int c = endcell[2 * line + !point];
+			disable(line);
+			if (!next_line(c, line, point)) break;
+		}
+	};
 
-		break;
-
-	create_open_path:
+	// extract all open paths
+	while (!open_lines.empty()) {
+		const int line = *open_lines.begin();
+		open_lines.erase(open_lines.begin());
+		if (lines[line].disabled) continue;
 		this->paths.push_back(Path());
-		Path *this_path = &this->paths.back();
-
-		this_path->indices.push_back(lines[current_line].idx[current_point]);
-		while (1) {
-			this_path->indices.push_back(lines[current_line].idx[!current_point]);
-			const auto &ref_point = this->points[lines[current_line].idx[!current_point]];
-			lines[current_line].disabled = true;
-			enabled_lines.erase(current_line);
-			auto lv = grid.data(ref_point[0], ref_point[1]);
-			for (size_t ki = 0; ki < lv.size(); ki++) {
-				int k = lv.at(ki);
-				if (lines[k].disabled) continue;
-				if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[0]][0], this->points[lines[k].idx[0]][1])) {
-					current_line = k;
-					current_point = 0;
-					goto found_next_line_in_open_path;
-				}
-				if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[1]][0], this->points[lines[k].idx[1]][1])) {
-					current_line = k;
-					current_point = 1;
-					goto found_next_line_in_open_path;
-				}
-			}
-			break;
-		found_next_line_in_open_path:;
-		}
+		walk(this->paths.back(), line, is_open_end(line, 0) ? 0 : 1);
 	}
 
 	// extract all closed paths
-	while (enabled_lines.size() > 0) {
-		int current_line = enabled_lines.begin()->second;
-		int current_point = 0;
-
+	for (size_t line = 0; line < lines.size(); line++) {
+		if (lines[line].disabled) continue;
 		this->paths.push_back(Path());
-		auto& this_path = this->paths.back();
-		this_path.is_closed = true;
-		
-		this_path.indices.push_back(lines[current_line].idx[current_point]);
-		while (1) {
-			this_path.indices.push_back(lines[current_line].idx[!current_point]);
-			const auto &ref_point = this->points[lines[current_line].idx[!current_point]];
-			lines[current_line].disabled = true;
-			enabled_lines.erase(current_line);
-			auto lv = grid.data(ref_point[0], ref_point[1]);
-			for (size_t ki = 0; ki < lv.size(); ki++) {
-				int k = lv.at(ki);
-				if (lines[k].disabled) continue;
-				if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[0]][0], this->points[lines[k].idx[0]][1])) {
-					current_line = k;
-					current_point = 0;
-					goto found_next_line_in_closed_path;
-				}
-					if (grid.eq(ref_point[0], ref_point[1], this->points[lines[k].idx[1]][0], this->points[lines[k].idx[1]][1])) {
-					current_line = k;
-					current_point = 1;
-					goto found_next_line_in_closed_path;
-				}
-			}
-			break;
-		found_next_line_in_closed_path:;
-		}
+		this->paths.back().is_closed = true;
+		walk(this->paths.back(), line, 0);
 	}
 
 	fixup_path_direction();
 
+	if (!cache_id.empty()) DiskCache::instance()->insertData(cache_id, write());
+
 #if 0
 	printf("----- DXF Data -----\n");
 	for (int i = 0; i < this->paths.size(); i++) {
@@ -567,6 +612,81 @@ void DxfData::fixup_path_direction()
 	}
 }
 
+/*!
+	Binary form of the parsed data, for the DiskCache.
+*/
+std::string DxfData::write() const
+{
+	std::ostringstream out(std::ios::out | std::ios::binary);
+	write_value<uint64_t>(out, this->points.size());
+	for (const auto &p : this->points) {
+		write_value(out, p[0]);
+		write_value(out, p[1]);
+	}
+	write_value<uint64_t>(out, this->paths.size());
+	for (const auto &path : this->paths) {
+		write_value<uint8_t>(out, (path.is_closed ? 1 : 0) | (path.is_inner ? 2 : 0));
+		write_value<uint64_t>(out, path.indices.size());
+		for (const auto idx : path.indices) write_value<int32_t>(out, idx);
+	}
+	write_value<uint64_t>(out, this->dims.size());
+	for (const auto &dim : this->dims) {
+		write_value<uint32_t>(out, dim.type);
+		out.write(reinterpret_cast<const char *>(dim.coords), sizeof(dim.coords));
+		write_value(out, dim.angle);
+		write_value(out, dim.length);
+		write_value<uint64_t>(out, dim.name.size());
+		out.write(dim.name.data(), dim.name.size());
+	}
+	return out.str();
+}
+
+/*!
+	Reads data written by write(). Returns false if it's invalid.
+*/
+bool DxfData::read(const std::string &data)
+{
+	std::istringstream in(data, std::ios::in | std::ios::binary);
+	uint64_t numpoints;
+	if (!read_value(in, numpoints) || numpoints > data.size()) return false;
+	this->points.resize(numpoints);
+	for (auto &p : this->points) {
+		read_value(in, p[0]);
+		read_value(in, p[1]);
+	}
+	uint64_t numpaths;
+	if (!read_value(in, numpaths) || numpaths > data.size()) return false;
+	this->paths.resize(numpaths);
+	for (auto &path : this->paths) {
+		uint8_t flags;
+		uint64_t numindices;
+		if (!read_value(in, flags) || !read_value(in, numindices) || numindices > data.size()) return false;
+		path.is_closed = flags & 1;
+		path.is_inner = flags & 2;
+		path.indices.resize(numindices);
+		for (auto &idx : path.indices) {
+			int32_t i;
+			if (!read_value(in, i) || i < 0 || uint64_t(i) >= numpoints) return false;
+			idx = i;
+		}
+	}
+	uint64_t numdims;
+	if (!read_value(in, numdims) || numdims > data.size()) return false;
+	this->dims.resize(numdims);
+	for (auto &dim : this->dims) {
+		uint32_t type;
+		uint64_t namesize;
+		if (!read_value(in, type) ||
+				!in.read(reinterpret_cast<char *>(dim.coords), sizeof(dim.coords)) ||
+				!read_value(in, dim.angle) || !read_value(in, dim.length) ||
+				!read_value(in, namesize) || namesize > data.size()) return false;
+		dim.type = type;
+		dim.name.resize(namesize);
+		if (namesize > 0 && !in.read(&dim.name[0], namesize)) return false;
+	}
+	return bool(in);
+}
+
 /*!
 	Adds a vertex and returns the index into DxfData::points
  */
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include "linalg.h"
 
@@ -40,5 +41,7 @@ public:
 
 	void fixup_path_direction();
 	std::string dump() const;
+	std::string write() const;
+	bool read(const std::string &data);
 	class Polygon2d *toPolygon2d() const;
 };
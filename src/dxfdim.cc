@@ -36,12 +36,16 @@
 #include "degree_trig.h"
 
 #include <cmath>
+#include <mutex>
 #include <sstream>
 #include <cstdint>
 
 #include <boost/filesystem.hpp>
 std::unordered_map<std::string, ValuePtr> dxf_dim_cache;
 std::unordered_map<std::string, ValuePtr> dxf_cross_cache;
+// Guards both caches and serializes reading DXF files, as for() may
+// evaluate iterations concurrently
+std::mutex dxf_cache_mutex;
 namespace fs = boost::filesystem;
 
 ValuePtr builtin_dxf_dim(const Context *ctx, const EvalContext *evalctx)
@@ -97,6 +101,7 @@ ValuePtr builtin_dxf_dim(const Context *ctx, const EvalContext *evalctx)
 	std::string key = STR(filename << "|" << layername << "|" << name << "|" << xorigin
 												<< "|" << yorigin <<"|" << scale << "|" << lastwritetime
 												<< "|" << filesize);
+	std::lock_guard<std::mutex> lock(dxf_cache_mutex);
 	if (dxf_dim_cache.find(key) != dxf_dim_cache.end())
 		return dxf_dim_cache.find(key)->second;
 	handle_dep(filepath.string());
@@ -206,6 +211,7 @@ ValuePtr builtin_dxf_cross(const Context *ctx, const EvalContext *evalctx)
 												<< "|" << scale << "|" << lastwritetime
 												<< "|" << filesize);
 
+	std::lock_guard<std::mutex> lock(dxf_cache_mutex);
 	if (dxf_cross_cache.find(key) != dxf_cross_cache.end()) {
 		return dxf_cross_cache.find(key)->second;
 	}
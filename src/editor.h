@@ -42,6 +42,8 @@ public slots:
 	virtual void setPlainText(const QString &) = 0;
 	virtual void highlightError(int) = 0;
 	virtual void unhighlightLastError() = 0;
+	// Lines and columns start at 0
+	virtual void setCursorPosition(int line, int col) = 0;
 	virtual void setHighlightScheme(const QString&) = 0;
 	virtual void insert(const QString&) = 0;
 	virtual void setText(const QString&) = 0;
@@ -60,4 +62,5 @@ public:
 	int findState;
 	QString filepath;
 	std::string autoReloadId;
+	bool parsePending = false; // The customizer parse waits until the tab is shown
 };
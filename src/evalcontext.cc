@@ -7,6 +7,10 @@
 #include "builtin.h"
 #include "localscope.h"
 #include "exceptions.h"
+#include "node.h"
+
+const int EvalContext::BY_NAME;
+const int EvalContext::UNUSED;
 
 EvalContext::EvalContext(const Context *parent, 
 												 const AssignmentList &args, const Location &loc, const class LocalScope *const scope)
@@ -31,45 +35,77 @@ ValuePtr EvalContext::getArgValue(size_t i, const Context *ctx) const
 	return v;
 }
 
-/*!
-  Resolves arguments specified by evalctx, using args to lookup positional arguments.
-  optargs is for optional arguments that are not positional arguments.
-  Returns an AssignmentMap (string -> Expression*)
-*/
-AssignmentMap EvalContext::resolveArguments(const AssignmentList &args, const AssignmentList &optargs, bool silent) const
+namespace {
+	int findParameter(const AssignmentList &args, const AssignmentList &optargs, const std::string &name)
+	{
+		for (size_t i = 0; i < args.size(); i++) {
+			if (args[i].name == name) return i;
+		}
+		for (size_t i = 0; i < optargs.size(); i++) {
+			if (optargs[i].name == name) return args.size() + i;
+		}
+		return -1;
+	}
+}
+
+void EvalContext::bindArguments(const AssignmentList &args, const AssignmentList &optargs, bool silent, std::vector<int> &params) const
 {
-  AssignmentMap resolvedArgs;
+  params.assign(this->numArgs(), UNUSED);
+  // The argument bound to each parameter
+  std::vector<int> bound(args.size() + optargs.size(), -1);
   size_t posarg = 0;
   bool tooManyWarned=false;
-  // Iterate over positional args
   for (size_t i=0; i<this->numArgs(); i++) {
     const auto &name = this->getArgName(i); // name is optional
-    const auto expr = this->getArgs()[i].expr.get();
     if (!name.empty()) {
-      if(name.at(0)!='$' && !silent){
-        bool found=false;
-        for(auto const& arg: args) {
-          if(arg.name == name) found=true;
-        }
-        for(auto const& arg: optargs) {
-          if(arg.name == name) found=true;
-        }
-        if(!found){
-          PRINTB("WARNING: variable %s not specified as parameter, %s", name % this->loc.toRelativeString(this->documentPath()));
+      const int param = findParameter(args, optargs, name);
+      if(param < 0 && name.at(0)!='$' && !silent){
+        PRINTB("WARNING: variable %s not specified as parameter, %s", name % this->loc.toRelativeString(this->documentPath()));
+      }
+      int previous = -1;
+      if (param >= 0) previous = bound[param];
+      else {
+        for (size_t j = 0; j < i && previous < 0; j++) {
+          if (params[j] == BY_NAME && this->getArgName(j) == name) previous = j;
         }
       }
-      if(resolvedArgs.find(name) != resolvedArgs.end()){
-          PRINTB("WARNING: argument %s supplied more then once, %s", name % this->loc.toRelativeString(this->documentPath()));
+      if (previous >= 0) {
+        PRINTB("WARNING: argument %s supplied more then once, %s", name % this->loc.toRelativeString(this->documentPath()));
+        params[previous] = UNUSED;
       }
-      resolvedArgs[name] = expr;
+      if (param >= 0) bound[param] = i;
+      params[i] = param >= 0 ? param : BY_NAME;
+    }
+    // If positional, the parameter with this position
+    else if (posarg < args.size()) {
+      if (bound[posarg] >= 0) params[bound[posarg]] = UNUSED;
+      bound[posarg] = i;
+      params[i] = posarg++;
     }
-    // If positional, find name of arg with this position
-    else if (posarg < args.size()) resolvedArgs[args[posarg++].name] = expr;
     else if (!silent && !tooManyWarned){
       PRINTB("WARNING: Too many unnamed arguments supplied, %s", this->loc.toRelativeString(this->documentPath()));
       tooManyWarned=true;
     }
   }
+}
+
+/*!
+  Resolves arguments specified by evalctx, using args to lookup positional arguments.
+  optargs is for optional arguments that are not positional arguments.
+  Returns an AssignmentMap (string -> Expression*)
+*/
+AssignmentMap EvalContext::resolveArguments(const AssignmentList &args, const AssignmentList &optargs, bool silent) const
+{
+  std::vector<int> params;
+  bindArguments(args, optargs, silent, params);
+  AssignmentMap resolvedArgs;
+  for (size_t i=0; i<params.size(); i++) {
+    const int param = params[i];
+    if (param == UNUSED) continue;
+    const auto &name = param == BY_NAME ? this->getArgName(i) :
+      size_t(param) < args.size() ? args[param].name : optargs[param - args.size()].name;
+    resolvedArgs[name] = this->getArgs()[i].expr.get();
+  }
   return resolvedArgs;
 }
 
@@ -83,6 +119,31 @@ ModuleInstantiation *EvalContext::getChild(size_t i) const
 	return this->scope ? this->scope->children[i] : nullptr; 
 }
 
+AbstractNode *EvalContext::instantiateChild(size_t i, const Context *ctx) const
+{
+	{
+		std::lock_guard<std::mutex> lock(this->instantiatedMutex);
+		for (const auto &entry : this->instantiated) {
+			// Matching looks the variables up again, for the calls tracked around
+			if (entry.first == i && entry.second->matches(*ctx)) {
+				AbstractNode *node = entry.second->children.front();
+				node->retain();
+				return node;
+			}
+		}
+	}
+
+	FunctionCache::Tracker::ConfigReads config;
+	FunctionCache::Tracker tracker(ctx, &config);
+	AbstractNode *node = getChild(i)->evaluate(this);
+	if (node && tracker.isPure()) {
+		auto entry = std::make_shared<const ModuleCallCache::Entry>(std::move(config), std::vector<AbstractNode *>{node});
+		std::lock_guard<std::mutex> lock(this->instantiatedMutex);
+		this->instantiated.emplace_back(i, entry);
+	}
+	return node;
+}
+
 void EvalContext::assignTo(Context &target) const
 {
 	for (const auto &assignment : this->eval_arguments) {
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <mutex>
 #include "context.h"
 #include "Assignment.h"
+#include "ModuleCallCache.h"
 
 /*!
   This hold the evaluation context (the parameters actually sent
@@ -23,8 +25,29 @@ public:
 
 	AssignmentMap resolveArguments(const AssignmentList &args, const AssignmentList &optargs, bool silent) const;
 
+	// Argument bound to no parameter, see bindArguments()
+	static const int BY_NAME = -1;
+	static const int UNUSED = -2;
+	/*!
+		Binds the arguments to parameters without building a map. For each
+		argument, params gets the index of its parameter in args, or in
+		optargs after args, BY_NAME for named arguments which aren't
+		parameters, or UNUSED for extra positional arguments and ones
+		replaced by a later argument for the same name. Warns like
+		resolveArguments().
+	*/
+	void bindArguments(const AssignmentList &args, const AssignmentList &optargs, bool silent, std::vector<int> &params) const;
+
 	size_t numChildren() const;
 	ModuleInstantiation *getChild(size_t i) const;
+	/*!
+		Instantiates child i in this context for children() called in ctx.
+		Like a module call in the ModuleCallCache, the node is shared by
+		later calls seeing the same config variables, e.g. $fn, if its
+		instantiation was pure. The nodes are kept while this context lives,
+		i.e. for one call of the module.
+	*/
+	class AbstractNode *instantiateChild(size_t i, const Context *ctx) const;
 
 	void assignTo(Context &target) const;
 
@@ -37,6 +60,10 @@ public:
 private:
 	const AssignmentList &eval_arguments;
 	const LocalScope *const scope;
+
+	// Children instantiated by instantiateChild(), with their indices
+	mutable std::vector<std::pair<size_t, ModuleCallCache::EntryPtr>> instantiated;
+	mutable std::mutex instantiatedMutex;
 };
 
 std::ostream &operator<<(std::ostream &stream, const EvalContext &ec);
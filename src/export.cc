@@ -27,27 +27,84 @@
 #include "export.h"
 #include "printutils.h"
 #include "Geometry.h"
+#include "InstancedPolySet.h"
+#include "Metrics.h"
+#include "polyset.h"
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#include "cgalutils.h"
+#endif
 
 #include <fstream>
+#include <functional>
+#include <boost/filesystem.hpp>
+
+namespace fs = boost::filesystem;
 
 #define QUOTE(x__) # x__
 #define QUOTED(x__) QUOTE(x__)
 
-void exportFile(const shared_ptr<const Geometry> &root_geom, std::ostream &output, FileFormat format)
+static int export_precision = 6;
+static bool svg_path_per_outline = false;
+
+void setExportPrecision(int digits) { export_precision = digits; }
+int exportPrecision() { return export_precision; }
+void setSvgPathPerOutline(bool on) { svg_path_per_outline = on; }
+bool svgPathPerOutline() { return svg_path_per_outline; }
+
+// The triangles of the faces of geom once triangulated, for the "triangles" counter of Metrics
+static double countTriangles(const shared_ptr<const Geometry> &geom)
 {
+	double triangles = 0;
+	if (const auto ps = geometry_cast<const PolySet>(geom)) {
+		for (const auto &polygon : ps->polygons()) {
+			if (polygon.size() > 2) triangles += polygon.size() - 2;
+		}
+	}
+	else if (const auto instances = geometry_cast<const InstancedPolySet>(geom)) {
+		triangles = countTriangles(instances->polySet()) * instances->numInstances();
+	}
+#ifdef ENABLE_CGAL
+	else if (const auto N = geometry_cast<const CGAL_Nef_polyhedron>(geom)) {
+		if (N->getDimension() == 3 && !N->isEmpty()) {
+			auto ps = make_shared<PolySet>(3);
+			if (!CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *ps)) triangles = countTriangles(ps);
+		}
+	}
+#endif
+	return triangles;
+}
+
+/*!
+	Exports root_geom in the given format. Formats which are archives name
+	their contents after the file being written, which is name.
+*/
+void exportFile(const shared_ptr<const Geometry> &root_geom, std::ostream &output, FileFormat format, const std::string &name)
+{
+	if (Metrics::isEnabled()) Metrics::instance()->count("triangles", countTriangles(root_geom));
 	switch (format) {
 	case FileFormat::STL:
 		export_stl(root_geom, output);
 		break;
+	case FileFormat::BINSTL:
+		export_binstl(root_geom, output);
+		break;
 	case FileFormat::OFF:
 		export_off(root_geom, output);
 		break;
 	case FileFormat::AMF:
 		export_amf(root_geom, output);
 		break;
+	case FileFormat::ZIPAMF:
+		export_zipamf(root_geom, output, name);
+		break;
 	case FileFormat::_3MF:
 		export_3mf(root_geom, output);
 		break;
+	case FileFormat::OSMESH:
+		export_osmesh(root_geom, output);
+		break;
 	case FileFormat::DXF:
 		export_dxf(root_geom, output);
 		break;
@@ -65,11 +122,16 @@ void exportFile(const shared_ptr<const Geometry> &root_geom, std::ostream &outpu
 	}
 }
 
-void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat format,
-	const char *name2open, const char *name2display)
+/*!
+	Opens the named file for export in the given format and calls write for
+	it. Errors are reported using name2display.
+*/
+static void exportToFile(FileFormat format, const char *name2open, const char *name2display,
+												 const std::function<void(std::ostream &)> &write)
 {
 	std::ios::openmode mode = std::ios::out | std::ios::trunc;
-	if (format == FileFormat::_3MF) {
+	if (format == FileFormat::_3MF || format == FileFormat::BINSTL || format == FileFormat::ZIPAMF ||
+			format == FileFormat::OSMESH) {
 		mode |= std::ios::binary;
 	}
 	std::ofstream fstream(name2open, mode);
@@ -79,7 +141,7 @@ void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat fo
 		bool onerror = false;
 		fstream.exceptions(std::ios::badbit|std::ios::failbit);
 		try {
-			exportFile(root_geom, fstream, format);
+			write(fstream);
 		} catch (std::ios::failure&) {
 			onerror = true;
 		}
@@ -93,3 +155,22 @@ void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat fo
 		}
 	}
 }
+
+void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat format,
+	const char *name2open, const char *name2display)
+{
+	exportToFile(format, name2open, name2display, [&](std::ostream &output) {
+		exportFile(root_geom, output, format, fs::path(name2open).filename().string());
+	});
+}
+
+void exportPartsByName(const std::vector<ExportPart> &parts, FileFormat format,
+	const char *name2open, const char *name2display)
+{
+	assert((format == FileFormat::_3MF || format == FileFormat::OSMESH || format == FileFormat::SVG) && "Unsupported file format");
+	exportToFile(format, name2open, name2display, [&](std::ostream &output) {
+		if (format == FileFormat::OSMESH) export_osmesh(parts, output);
+		else if (format == FileFormat::SVG) export_svg(parts, output);
+		else export_3mf(parts, output);
+	});
+}
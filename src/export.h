@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <fstream>
 #include <iostream>
 
 #include <boost/range/algorithm.hpp>
@@ -8,13 +10,17 @@
 #include "Tree.h"
 #include "Camera.h"
 #include "memory.h"
+#include "linalg.h"
 
 
 enum class FileFormat {
 	STL,
+	BINSTL,
 	OFF,
 	AMF,
+	ZIPAMF,
 	_3MF,
+	OSMESH,
 	DXF,
 	SVG,
 	NEFDBG,
@@ -29,16 +35,69 @@ enum class FileFormat {
 void exportFileByName(const shared_ptr<const class Geometry> &root_geom, FileFormat format,
 											const char *name2open, const char *name2display);
 
+// One of several objects exported to the same file, e.g. a part of an assembly
+struct ExportPart {
+	shared_ptr<const Geometry> geom;
+	Color4f color; // the color() of the part, or negative components for none
+	std::string name; // e.g. the label of an SVG layer
+};
+
+// Only 3MF, OSMESH and SVG (as layers) support several objects in one file
+void exportPartsByName(const std::vector<ExportPart> &parts, FileFormat format,
+											 const char *name2open, const char *name2display);
+
+/*!
+	Writes a STL or binary STL file one object at a time, so objects can be
+	written as soon as they are evaluated. The facets of all objects end up
+	in one solid, which is only their union if they don't overlap.
+*/
+class StlStreamExporter
+{
+public:
+	StlStreamExporter(FileFormat format, const char *name2open, const char *name2display);
+	~StlStreamExporter();
+
+	bool isOpen() const { return this->fstream.is_open(); }
+	void append(const shared_ptr<const Geometry> &geom);
+	// Completes the file. Returns false if writing it failed.
+	bool close();
+
+private:
+	bool binary;
+	std::string name2display;
+	std::ofstream fstream;
+	uint32_t facets;
+	bool onerror;
+};
+
 void export_stl(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_binstl(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_3mf(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_3mf(const std::vector<ExportPart> &parts, std::ostream &output);
 void export_off(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_osmesh(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_osmesh(const std::vector<ExportPart> &parts, std::ostream &output);
 void export_amf(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_zipamf(const shared_ptr<const Geometry> &geom, std::ostream &output, const std::string &entryname);
 void export_dxf(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output);
+void export_svg(const std::vector<ExportPart> &layers, std::ostream &output);
 void export_nefdbg(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_nef3(const shared_ptr<const Geometry> &geom, std::ostream &output);
 
-// void exportFile(const class Geometry *root_geom, std::ostream &output, FileFormat format);
+/*!
+	The number of significant digits of the coordinates in text exports
+	(STL, OFF, AMF, DXF and SVG), default 6. With 0, as many as needed to
+	read them back exactly. See NumberFormat.
+*/
+void setExportPrecision(int digits);
+int exportPrecision();
+// Whether SVG files get a path per outline instead of one per object
+void setSvgPathPerOutline(bool on);
+bool svgPathPerOutline();
+
+// Formats which are archives name their contents name
+void exportFile(const shared_ptr<const class Geometry> &root_geom, std::ostream &output, FileFormat format, const std::string &name);
 
 enum class Previewer { OPENCSG, THROWNTOGETHER };
 enum class RenderType { GEOMETRY, CGAL, OPENCSG, THROWNTOGETHER };
@@ -46,9 +105,12 @@ enum class RenderType { GEOMETRY, CGAL, OPENCSG, THROWNTOGETHER };
 struct ExportFileFormatOptions {
 	const std::map<const std::string, FileFormat> exportFileFormats{
 		{"stl", FileFormat::STL},
+		{"binstl", FileFormat::BINSTL},
 		{"off", FileFormat::OFF},
 		{"amf", FileFormat::AMF},
+		{"zipamf", FileFormat::ZIPAMF},
 		{"3mf", FileFormat::_3MF},
+		{"osmesh", FileFormat::OSMESH},
 		{"dxf", FileFormat::DXF},
 		{"svg", FileFormat::SVG},
 		{"nefdbg", FileFormat::NEFDBG},
@@ -94,5 +156,11 @@ struct ViewOptions {
 	
 };
 
-bool export_png(const shared_ptr<const class Geometry> &root_geom, const ViewOptions& options, Camera camera, std::ostream &output);
-bool export_preview_png(Tree &tree, const ViewOptions& options, Camera camera, std::ostream &output);
+bool export_png(const shared_ptr<const class Geometry> &root_geom, const ViewOptions& options, const std::vector<Camera> &cameras, const std::vector<std::ostream *> &outputs);
+bool export_preview_png(Tree &tree, const ViewOptions& options, const std::vector<Camera> &cameras, const std::vector<std::ostream *> &outputs);
+/*!
+	The images of export_png() and export_preview_png() are encoded in the
+	background, their outputs must stay open until this returns. Returns
+	false if any couldn't be written.
+*/
+bool wait_png_exports();
@@ -28,208 +28,193 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "printutils.h"
+#include "ZipWriter.h"
 
-#ifdef ENABLE_LIB3MF
 #ifdef ENABLE_CGAL
-#include <Model/COM/NMR_DLLInterfaces.h>
-#undef BOOL
-using namespace NMR;
-
-#include <algorithm>
-
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
 #include "cgalutils.h"
 
-bool triangle_sort_predicate (const CGAL_Triangle_3 t1, const CGAL_Triangle_3 t2) {
-	if (t1.vertex(0) == t2.vertex(0)) {
-		if (t1.vertex(1) == t2.vertex(1)) {
-			return t1.vertex(2) < t2.vertex(2);
-		}
-		return t1.vertex(1) < t2.vertex(1);
-	}
-	return t1.vertex(0) < t2.vertex(0);
-}
-
-static uint32_t lib3mf_write_callback(const char *data, uint32_t bytes, std::ostream *stream)
-{
-	stream->write(data, bytes);
-	return !(*stream);
-}
-
-static uint32_t lib3mf_seek_callback(uint64_t pos, std::ostream *stream)
-{
-	stream->seekp(pos);
-	return !(*stream);
-}
-
-static void export_3mf_error(const std::string msg, PLib3MFModel *model = NULL)
-{
-	PRINT(msg);
-	if (model) {
-		lib3mf_release(model);
-	}
-}
+#include <algorithm>
 
 /*!
-    Saves the current 3D CGAL Nef polyhedron as 3MF to the given file.
-    The file must be open.
+    Triangulates the given 3D geometry into mesh, sharing vertices, and
+    gives colors the colors of its triangles, if it has any.
+    Returns false if the geometry can't be exported.
  */
-static void append_3mf(const CGAL_Nef_polyhedron &root_N, std::ostream &output)
+static bool create_3mf_mesh(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh,
+														shared_ptr<const PolySet::FaceColors> &colors)
 {
-	if (!root_N.p3 || !root_N.p3->is_simple()) {
-		PRINT("EXPORT-WARNING: Export failed, the object isn't a valid 2-manifold.");
-		return;
-	}
-
-	DWORD interfaceVersionMajor, interfaceVersionMinor, interfaceVersionMicro;
-	HRESULT result = lib3mf_getinterfaceversion(&interfaceVersionMajor, &interfaceVersionMinor, &interfaceVersionMicro);
-	if (result != LIB3MF_OK) {
-		PRINT("EXPORT-ERROR: Error reading 3MF library version");
-		return;
+	PolySet triangulated(3);
+	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (!N->p3 || !N->p3->is_simple()) {
+			PRINT("EXPORT-WARNING: Export failed, the object isn't a valid 2-manifold.");
+			return false;
+		}
+		PolySet ps(3);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), ps)) {
+			PRINT("EXPORT-ERROR: Nef->PolySet failed");
+			return false;
+		}
+		PolysetUtils::tessellate_faces(ps, triangulated);
 	}
-
-	if ((interfaceVersionMajor != NMR_APIVERSION_INTERFACE_MAJOR)) {
-		PRINTB("EXPORT-ERROR: Invalid 3MF library major version %d.%d.%d, expected %d.%d.%d",
-                        interfaceVersionMajor % interfaceVersionMinor % interfaceVersionMicro %
-                        NMR_APIVERSION_INTERFACE_MAJOR % NMR_APIVERSION_INTERFACE_MINOR % NMR_APIVERSION_INTERFACE_MICRO);
-		return;
+	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+		PolysetUtils::tessellate_faces(*ps, triangulated);
 	}
-
-	PLib3MFModel *model;
-	result = lib3mf_createmodel(&model);
-	if (result != LIB3MF_OK) {
-		export_3mf_error("EXPORT-ERROR: Can't create 3MF model.");
-		return;
+	else if (dynamic_cast<const Polygon2d *>(geom.get())) {
+		assert(false && "Unsupported file format");
+		return false;
+	} else {
+		assert(false && "Not implemented");
+		return false;
 	}
+	PolysetUtils::createIndexedMesh(triangulated, mesh);
+	colors = triangulated.faceColors();
+	return true;
+}
 
-	PLib3MFModelMeshObject *mesh;
-	if (lib3mf_model_addmeshobject(model, &mesh) != LIB3MF_OK) {
-		export_3mf_error("EXPORT-ERROR: Can't add mesh to 3MF model.", model);
-		return;
+/*!
+    Writes the given triangle mesh as the mesh of a 3MF object. Triangles
+    with repeated vertices are dropped, as 3MF doesn't allow them.
+    Triangles with a color get the base material materials gives for the
+    index of their color, if it isn't negative.
+ */
+static void append_3mf_mesh(const IndexedMesh &mesh, const PolySet::FaceColors *colors,
+														const std::vector<int> &materials, std::ostream &output)
+{
+	// Coordinates are written as single precision, which is what 3MF readers use
+	char buf[256];
+	output << "   <mesh>\n"
+		"    <vertices>\n";
+	for (const auto &v : mesh.vertices) {
+		const int len = snprintf(buf, sizeof(buf), "     <vertex x=\"%.9g\" y=\"%.9g\" z=\"%.9g\" />\n",
+			double(float(v[0])), double(float(v[1])), double(float(v[2])));
+		output.write(buf, len);
 	}
-	if (lib3mf_object_setnameutf8(mesh, "OpenSCAD Model") != LIB3MF_OK) {
-		export_3mf_error("EXPORT-ERROR: Can't set name for 3MF model.", model);
-		return;
+	output << "    </vertices>\n"
+		"    <triangles>\n";
+	for (size_t i = 0; i < mesh.numFaces(); ++i) {
+		const int *face = mesh.face(i);
+		if (face[0] == face[1] || face[0] == face[2] || face[1] == face[2]) continue;
+		const auto color = colors ? colors->index(i) : PolySet::FaceColors::nocolor;
+		const int material = color != PolySet::FaceColors::nocolor ? materials[color] : -1;
+		const int len = material < 0 ?
+			snprintf(buf, sizeof(buf), "     <triangle v1=\"%d\" v2=\"%d\" v3=\"%d\" />\n", face[0], face[1], face[2]) :
+			snprintf(buf, sizeof(buf), "     <triangle v1=\"%d\" v2=\"%d\" v3=\"%d\" pid=\"1\" p1=\"%d\" />\n",
+				face[0], face[1], face[2], material);
+		output.write(buf, len);
 	}
+	output << "    </triangles>\n"
+		"   </mesh>\n";
+}
 
-	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
-	try {
-		CGAL_Polyhedron P;
-		root_N.p3->convert_to_Polyhedron(P);
-
-		typedef CGAL_Polyhedron::Vertex Vertex;
-		typedef CGAL_Polyhedron::Vertex_const_iterator VCI;
-		typedef CGAL_Polyhedron::Facet_const_iterator FCI;
-		typedef CGAL_Polyhedron::Halfedge_around_facet_const_circulator HFCC;
-
-		// use sorted sets to get a stable sort order in the exported file
-		typedef std::set<CGAL_Polyhedron::Point_3> vertex_set_t;
-		typedef std::vector<CGAL_Triangle_3> triangle_list_t;
-
-		vertex_set_t vertices;
-		triangle_list_t triangles;
-
-		for (FCI fi = P.facets_begin(); fi != P.facets_end(); ++fi) {
-			HFCC hc = fi->facet_begin();
-			HFCC hc_end = hc;
-			Vertex v1, v2, v3;
-			v1 = *VCI((hc++)->vertex());
-			vertices.insert(v1.point());
-			v3 = *VCI((hc++)->vertex());
-			vertices.insert(v3.point());
-			do {
-				v2 = v3;
-				v3 = *VCI((hc++)->vertex());
-
-				CGAL_Polyhedron::Point_3 p1, p2, p3;
-				p1 = v1.point();
-				p2 = v2.point();
-				p3 = v3.point();
-				vertices.insert(p3);
-
-				triangles.push_back(CGAL_Triangle_3(p1, p2, p3));
-			} while (hc != hc_end);
+/*!
+    Saves the given parts as 3MF objects to the given file, each with its
+    color as base material, if it has one. The faces colored by color()
+    get their colors as base materials of their triangles, so one object
+    can have several colors. The file must be open.
+
+    The package is zipped while it is written, and each part is only
+    triangulated when it is written, so memory use doesn't grow with the
+    size of the file.
+ */
+static void append_3mf(const std::vector<ExportPart> &parts, std::ostream &output)
+{
+	ZipWriter zip(output);
+	zip.beginEntry("[Content_Types].xml") <<
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">\n"
+		" <Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\" />\n"
+		" <Default Extension=\"model\" ContentType=\"application/vnd.ms-package.3dmanufacturing-3dmodel+xml\" />\n"
+		"</Types>\n";
+	zip.beginEntry("_rels/.rels") <<
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">\n"
+		" <Relationship Target=\"/3D/3dmodel.model\" Id=\"rel0\" Type=\"http://schemas.microsoft.com/3dmanufacturing/2013/01/3dmodel\" />\n"
+		"</Relationships>\n";
+
+	auto &model = zip.beginEntry("3D/3dmodel.model");
+	model << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<model unit=\"millimeter\" xml:lang=\"en-US\" xmlns=\"http://schemas.microsoft.com/3dmanufacturing/core/2015/02\">\n"
+		" <resources>\n";
+
+	// Parts and faces of the same color share their base material, the
+	// materials are resource 1 and the objects follow
+	std::vector<Color4f> colors;
+	const auto addColor = [&colors](const Color4f &color) {
+		if (color[0] >= 0 && std::find(colors.begin(), colors.end(), color) == colors.end()) colors.push_back(color);
+	};
+	for (const auto &part : parts) {
+		addColor(part.color);
+		const auto ps = dynamic_cast<const PolySet *>(part.geom.get());
+		if (ps && ps->hasColors()) {
+			for (const auto &color : ps->faceColors()->table) addColor(color);
 		}
-
-		for (const auto &vertex : vertices) {
-			MODELMESHVERTEX v;
-			v.m_fPosition[0] = CGAL::to_double(vertex.x());
-			v.m_fPosition[1] = CGAL::to_double(vertex.y());
-			v.m_fPosition[2] = CGAL::to_double(vertex.z());
-			if (lib3mf_meshobject_addvertex(mesh, &v, NULL) != LIB3MF_OK) {
-				export_3mf_error("EXPORT-ERROR: Can't add vertex to 3MF model.", model);
-				return;
-			}
+	}
+	const auto materialOf = [&colors](const Color4f &color) {
+		const auto it = std::find(colors.begin(), colors.end(), color);
+		return it == colors.end() ? -1 : int(it - colors.begin());
+	};
+	if (!colors.empty()) {
+		model << "  <basematerials id=\"1\">\n";
+		for (size_t i = 0; i < colors.size(); ++i) {
+			const auto byte = [&](int c) { return int(std::min(std::max(colors[i][c], 0.0f), 1.0f) * 255.0f + 0.5f); };
+			char buf[128];
+			snprintf(buf, sizeof(buf), "   <base name=\"Color %d\" displaycolor=\"#%02X%02X%02X%02X\" />\n",
+				int(i + 1), byte(0), byte(1), byte(2), byte(3));
+			model << buf;
 		}
+		model << "  </basematerials>\n";
+	}
 
-		std::sort(triangles.begin(), triangles.end(), triangle_sort_predicate);
-		for (const auto &triangle : triangles) {
-			MODELMESHTRIANGLE t;
-			t.m_nIndices[0] = std::distance(vertices.begin(), std::find(vertices.begin(), vertices.end(), triangle.vertex(0)));
-			t.m_nIndices[1] = std::distance(vertices.begin(), std::find(vertices.begin(), vertices.end(), triangle.vertex(1)));
-			t.m_nIndices[2] = std::distance(vertices.begin(), std::find(vertices.begin(), vertices.end(), triangle.vertex(2)));
-			if (lib3mf_meshobject_addtriangle(mesh, &t, NULL) != LIB3MF_OK) {
-				export_3mf_error("EXPORT-ERROR: Can't add triangle to 3MF model.", model);
-				return;
-			}
-		}
+	std::vector<int> objectIds;
+	for (const auto &part : parts) {
+		IndexedMesh mesh;
+		shared_ptr<const PolySet::FaceColors> facecolors;
+		if (!create_3mf_mesh(part.geom, mesh, facecolors)) continue;
 
-		PLib3MFModelBuildItem *builditem;
-		if (lib3mf_model_addbuilditem(model, mesh, NULL, &builditem) != LIB3MF_OK) {
-			export_3mf_error("EXPORT-ERROR: Can't add triangle to 3MF model.", model);
-			return;
+		// The base materials of the face colors
+		std::vector<int> materials;
+		if (facecolors) {
+			for (const auto &color : facecolors->table) materials.push_back(materialOf(color));
 		}
-
-		PLib3MFModelWriter *writer;
-		if (lib3mf_model_querywriter(model, "3mf", &writer) != LIB3MF_OK) {
-			export_3mf_error("EXPORT-ERROR: Can't get writer for 3MF model.", model);
-			return;
+		// Objects with colored triangles need a material of their own, which
+		// the triangles without one get
+		int material = materialOf(part.color);
+		for (size_t i = 0; material < 0 && facecolors && i < facecolors->indices.size(); ++i) {
+			if (facecolors->indices[i] != PolySet::FaceColors::nocolor) material = materials[facecolors->indices[i]];
 		}
 
-		result = lib3mf_writer_writetocallback(writer, (void *)lib3mf_write_callback, (void *)lib3mf_seek_callback, &output);
-		output.flush();
-		lib3mf_release(writer);
-		lib3mf_release(model);
-		if (result != LIB3MF_OK) {
-			export_3mf_error("EXPORT-ERROR: Error writing 3MF model.");
-		}
-	} catch (CGAL::Assertion_exception& e) {
-		PRINTB("EXPORT-ERROR: CGAL error in CGAL_Nef_polyhedron3::convert_to_Polyhedron(): %s", e.what());
+		const int id = int(objectIds.size() + 2);
+		model << "  <object id=\"" << id << "\" type=\"model\" name=\"OpenSCAD Model";
+		if (parts.size() > 1) model << " " << objectIds.size() + 1;
+		model << "\"";
+		if (material >= 0) model << " pid=\"1\" pindex=\"" << material << "\"";
+		model << ">\n";
+		append_3mf_mesh(mesh, facecolors.get(), materials, model);
+		model << "  </object>\n";
+		objectIds.push_back(id);
 	}
-	CGAL::set_error_behaviour(old_behaviour);
-}
 
-static void append_3mf(const shared_ptr<const Geometry> &geom, std::ostream &output)
-{
-	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
-		append_3mf(*N, output);
-	}
-	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
-		// FIXME: Implement this without creating a Nef polyhedron
-		CGAL_Nef_polyhedron *N = CGALUtils::createNefPolyhedronFromGeometry(*ps);
-		append_3mf(*N, output);
-		delete N;
-	}
-	else if (const Polygon2d *poly = dynamic_cast<const Polygon2d *>(geom.get())) {
-		assert(false && "Unsupported file format");
-	} else {
-		assert(false && "Not implemented");
-	}
+	model << " </resources>\n"
+		" <build>\n";
+	for (const auto id : objectIds) model << "  <item objectid=\"" << id << "\" />\n";
+	model << " </build>\n"
+		"</model>\n";
+
+	zip.finish();
 }
 
 void export_3mf(const shared_ptr<const Geometry> &geom, std::ostream &output)
 {
-	append_3mf(geom, output);
+	export_3mf({ExportPart{geom, Color4f(-1.0f, -1.0f, -1.0f, 1.0f)}}, output);
 }
 
-#endif // ENABLE_CGAL
-
-#else // ENABLE_LIB3MF
-
-void export_3mf(const shared_ptr<const Geometry> &, std::ostream &)
+void export_3mf(const std::vector<ExportPart> &parts, std::ostream &output)
 {
-	PRINT("Export to 3MF format was not enabled when building the application.");
+	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
+	append_3mf(parts, output);
+	setlocale(LC_NUMERIC, ""); // Set default locale
 }
 
-#endif // ENABLE_LIB3MF
+#endif // ENABLE_CGAL
@@ -28,142 +28,180 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "NumberFormat.h"
+#include "ZipWriter.h"
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
 #include "cgalutils.h"
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
 #define QUOTE(x__) # x__
 #define QUOTED(x__) QUOTE(x__)
 
-struct triangle {
-    std::string vs1;
-    std::string vs2;
-    std::string vs3;
-};
+static const size_t amf_buffer_size = 1024 * 1024;
 
 static int objectid;
 
 /*!
-    Saves the current 3D CGAL Nef polyhedron as AMF to the given file.
-    The file must be open.
+    Triangulates the given 3D geometry into mesh, sharing vertices, and
+    gives colors the colors of its triangles, if it has any.
+    Returns false if there is nothing to export.
  */
-static void append_amf(const CGAL_Nef_polyhedron &root_N, std::ostream &output)
+static bool create_amf_mesh(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh,
+														shared_ptr<const PolySet::FaceColors> &colors)
 {
-	if (!root_N.p3->is_simple()) {
-		PRINT("EXPORT-WARNING: Export failed, the object isn't a valid 2-manifold.");
-		return;
-	}
-	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
-	try {
-		CGAL_Polyhedron P;
-		root_N.p3->convert_to_Polyhedron(P);
-
-		typedef CGAL_Polyhedron::Vertex Vertex;
-		typedef CGAL_Polyhedron::Vertex_const_iterator VCI;
-		typedef CGAL_Polyhedron::Facet_const_iterator FCI;
-		typedef CGAL_Polyhedron::Halfedge_around_facet_const_circulator HFCC;
-
-		std::vector<std::string> vertices;
-		std::vector<triangle> triangles;
-
-		for (FCI fi = P.facets_begin(); fi != P.facets_end(); ++fi) {
-			HFCC hc = fi->facet_begin();
-			HFCC hc_end = hc;
-			Vertex v1, v2, v3;
-			v1 = *VCI((hc++)->vertex());
-			v3 = *VCI((hc++)->vertex());
-			do {
-				v2 = v3;
-				v3 = *VCI((hc++)->vertex());
-				double x1 = CGAL::to_double(v1.point().x());
-				double y1 = CGAL::to_double(v1.point().y());
-				double z1 = CGAL::to_double(v1.point().z());
-				double x2 = CGAL::to_double(v2.point().x());
-				double y2 = CGAL::to_double(v2.point().y());
-				double z2 = CGAL::to_double(v2.point().z());
-				double x3 = CGAL::to_double(v3.point().x());
-				double y3 = CGAL::to_double(v3.point().y());
-				double z3 = CGAL::to_double(v3.point().z());
-				std::string vs1{STR(x1 << " " << y1 << " " << z1)};
-				std::string vs2{STR(x2 << " " << y2 << " " << z2)};
-				std::string vs3{STR(x3 << " " << y3 << " " << z3)};
-				if (std::find(vertices.begin(), vertices.end(), vs1) == vertices.end())
-					vertices.push_back(vs1);
-				if (std::find(vertices.begin(), vertices.end(), vs2) == vertices.end())
-					vertices.push_back(vs2);
-				if (std::find(vertices.begin(), vertices.end(), vs3) == vertices.end())
-					vertices.push_back(vs3);
-
-				if (vs1 != vs2 && vs1 != vs3 && vs2 != vs3) {
-					// The above condition ensures that there are 3 distinct vertices, but
-					// they may be collinear. If they are, the unit normal is meaningless
-					// so the default value of "1 0 0" can be used. If the vertices are not
-					// collinear then the unit normal must be calculated from the
-					// components.
-					triangle tri = {vs1, vs2, vs3};
-					triangles.push_back(tri);
-				}
-			} while (hc != hc_end);
-		}
-
-		output << " <object id=\"" << objectid++ << "\">\r\n"
-					 << "  <mesh>\r\n";
-		output << "   <vertices>\r\n";
-		for (size_t i = 0; i < vertices.size(); i++) {
-			std::string s = vertices[i];
-			output << "    <vertex><coordinates>\r\n";
-			char* chrs = new char[s.length() + 1];
-			strcpy(chrs, s.c_str());
-			std::string coords = strtok(chrs, " ");
-			output << "     <x>" << coords << "</x>\r\n";
-			coords = strtok(nullptr, " ");
-			output << "     <y>" << coords << "</y>\r\n";
-			coords = strtok(nullptr, " ");
-			output << "     <z>" << coords << "</z>\r\n";
-			output << "    </coordinates></vertex>\r\n";
-			delete[] chrs;
+	PolySet triangulated(3);
+	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (N->isEmpty()) return false;
+		if (!N->p3->is_simple()) {
+			PRINT("EXPORT-WARNING: Export failed, the object isn't a valid 2-manifold.");
+			return false;
 		}
-		output << "   </vertices>\r\n";
-		output << "   <volume>\r\n";
-		for (size_t i = 0; i < triangles.size(); i++) {
-			triangle t = triangles[i];
-			output << "    <triangle>\r\n";
-			size_t index;
-			index = std::distance(vertices.begin(), std::find(vertices.begin(), vertices.end(), t.vs1));
-			output << "     <v1>" << index << "</v1>\r\n";
-			index = std::distance(vertices.begin(), std::find(vertices.begin(), vertices.end(), t.vs2));
-			output << "     <v2>" << index << "</v2>\r\n";
-			index = std::distance(vertices.begin(), std::find(vertices.begin(), vertices.end(), t.vs3));
-			output << "     <v3>" << index << "</v3>\r\n";
-			output << "    </triangle>\r\n";
+		PolySet ps(3);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), ps)) {
+			PRINT("EXPORT-ERROR: Nef->PolySet failed");
+			return false;
 		}
-		output << "   </volume>\r\n";
-		output << "  </mesh>\r\n"
-					 << " </object>\r\n";
-	} catch (CGAL::Assertion_exception& e) {
-		PRINTB("EXPORT-ERROR: CGAL error in CGAL_Nef_polyhedron3::convert_to_Polyhedron(): %s", e.what());
-	}
-	CGAL::set_error_behaviour(old_behaviour);
-}
-
-static void append_amf(const shared_ptr<const Geometry> &geom, std::ostream &output)
-{
-	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
-		if (!N->isEmpty()) append_amf(*N, output);
+		PolysetUtils::tessellate_faces(ps, triangulated);
 	}
 	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
-		// FIXME: Implement this without creating a Nef polyhedron
-		CGAL_Nef_polyhedron *N = CGALUtils::createNefPolyhedronFromGeometry(*ps);
-		if (!N->isEmpty()) append_amf(*N, output);
-		delete N;
+		if (ps->isEmpty()) return false;
+		PolysetUtils::tessellate_faces(*ps, triangulated);
 	}
 	else if (dynamic_cast<const Polygon2d *>(geom.get())) {
 		assert(false && "Unsupported file format");
+		return false;
 	} else {
 		assert(false && "Not implemented");
+		return false;
+	}
+	PolysetUtils::createIndexedMesh(triangulated, mesh);
+	colors = triangulated.faceColors();
+	return true;
+}
+
+/*!
+    Writes the colors of the faces as AMF materials, the material of
+    color i of the table having id i + 1.
+ */
+static void append_amf_materials(const PolySet::FaceColors &colors, std::ostream &output)
+{
+	std::string out;
+	for (size_t i = 0; i < colors.table.size(); ++i) {
+		out += STR(" <material id=\"" << i + 1 << "\">\r\n"
+			"  <color>");
+		const char *channels[] = {"r", "g", "b", "a"};
+		for (int c = 0; c < 4; ++c) {
+			out += std::string("<") + channels[c] + ">";
+			NumberFormat::append(out, std::min(std::max(colors.table[i][c], 0.0f), 1.0f), 6);
+			out += std::string("</") + channels[c] + ">";
+		}
+		out += "</color>\r\n"
+			" </material>\r\n";
 	}
+	output.write(out.data(), out.size());
+}
+
+/*!
+    Saves the given triangle mesh as an AMF object. Vertices are merged by
+    their formatted coordinates, and triangles which become degenerate by
+    that are dropped, so the file is consistent at the written precision.
+    The triangles of each face color go into a volume of their own, with
+    the material of the color, see append_amf_materials().
+    The XML is formatted into a buffer which is written in large blocks.
+ */
+static void append_amf(const IndexedMesh &mesh, const PolySet::FaceColors *colors, std::ostream &output)
+{
+	std::string out;
+	out.reserve(amf_buffer_size + 256);
+	auto flush = [&]() {
+		output.write(out.data(), out.size());
+		out.clear();
+	};
+
+	std::unordered_map<std::string, int> written;
+	std::vector<int> indices(mesh.vertices.size());
+	const int digits = exportPrecision();
+	char buf[256];
+
+	out += STR(" <object id=\"" << objectid++ << "\">\r\n");
+	out += "  <mesh>\r\n"
+		"   <vertices>\r\n";
+	for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+		const auto &v = mesh.vertices[i];
+		// The key is the coordinates as written, separated by spaces
+		const int len = NumberFormat::format(v.data(), 3, digits, ' ', buf);
+		auto res = written.emplace(std::string(buf, len), int(written.size()));
+		indices[i] = res.first->second;
+		if (!res.second) continue;
+		const char *y = static_cast<const char *>(memchr(buf, ' ', len)) + 1;
+		const char *z = static_cast<const char *>(memchr(y, ' ', buf + len - y)) + 1;
+		out += "    <vertex><coordinates>\r\n"
+			"     <x>";
+		out.append(buf, y - 1 - buf);
+		out += "</x>\r\n"
+			"     <y>";
+		out.append(y, z - 1 - y);
+		out += "</y>\r\n"
+			"     <z>";
+		out.append(z, buf + len - z);
+		out += "</z>\r\n"
+			"    </coordinates></vertex>\r\n";
+		if (out.size() >= amf_buffer_size) flush();
+	}
+	out += "   </vertices>\r\n";
+
+	// The triangles ordered by their color, the uncolored ones first
+	std::vector<size_t> order(mesh.numFaces());
+	for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+	const auto colorOf = [colors](size_t face) {
+		const auto index = colors ? colors->index(face) : PolySet::FaceColors::nocolor;
+		return index == PolySet::FaceColors::nocolor ? -1 : int(index);
+	};
+	if (colors) {
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return colorOf(a) < colorOf(b); });
+	}
+	if (order.empty()) out += "   <volume>\r\n";
+	for (size_t n = 0; n < order.size(); ++n) {
+		const size_t i = order[n];
+		const int color = colorOf(i);
+		if (n == 0 || color != colorOf(order[n - 1])) {
+			if (n > 0) out += "   </volume>\r\n";
+			if (color < 0) out += "   <volume>\r\n";
+			else out += STR("   <volume materialid=\"" << color + 1 << "\">\r\n");
+		}
+		const int *face = mesh.face(i);
+		const int v1 = indices[face[0]], v2 = indices[face[1]], v3 = indices[face[2]];
+		// The vertices may still be collinear; the unit normal is then
+		// meaningless, so the default value of "1 0 0" can be used.
+		if (v1 == v2 || v1 == v3 || v2 == v3) continue;
+		const int len = snprintf(buf, sizeof(buf),
+			"    <triangle>\r\n"
+			"     <v1>%d</v1>\r\n"
+			"     <v2>%d</v2>\r\n"
+			"     <v3>%d</v3>\r\n"
+			"    </triangle>\r\n", v1, v2, v3);
+		out.append(buf, len);
+		if (out.size() >= amf_buffer_size) flush();
+	}
+	out += "   </volume>\r\n"
+		"  </mesh>\r\n"
+		" </object>\r\n";
+	flush();
+}
+
+static void append_amf(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	IndexedMesh mesh;
+	shared_ptr<const PolySet::FaceColors> colors;
+	if (!create_amf_mesh(geom, mesh, colors)) return;
+	if (colors) append_amf_materials(*colors, output);
+	append_amf(mesh, colors.get(), output);
 }
 
 void export_amf(const shared_ptr<const Geometry> &geom, std::ostream &output)
@@ -185,4 +223,16 @@ void export_amf(const shared_ptr<const Geometry> &geom, std::ostream &output)
 	setlocale(LC_NUMERIC, ""); // Set default locale
 }
 
+/*!
+    Writes AMF as a zip archive, containing the AMF file as entryname. AMF
+    readers expect the entry to have the name of the archive itself.
+    The XML is compressed while it is written.
+ */
+void export_zipamf(const shared_ptr<const Geometry> &geom, std::ostream &output, const std::string &entryname)
+{
+	ZipWriter zip(output);
+	export_amf(geom, zip.beginEntry(entryname));
+	zip.finish();
+}
+
 #endif // ENABLE_CGAL
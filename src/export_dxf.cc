@@ -28,6 +28,7 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "OutputBuffer.h"
 
 /*!
 	Saves the current Polygon2d as DXF to the given absolute filename.
@@ -47,31 +48,27 @@ void export_dxf(const Polygon2d &poly, std::ostream &output)
 				 << "  2\n"
 				 << "ENTITIES\n";
 
+	const int digits = exportPrecision();
+	OutputBuffer buffer(output);
 	for(const auto &o : poly.outlines()) {
 		for (unsigned int i=0;i<o.vertices.size();i++) {
 			const Vector2d &p1 = o.vertices[i];
 			const Vector2d &p2 = o.vertices[(i+1)%o.vertices.size()];
-			double x1 = p1[0];
-			double y1 = p1[1];
-			double x2 = p2[0];
-			double y2 = p2[1];
-			output << "  0\n"
-						 << "LINE\n";
 			// Some importers (e.g. Inkscape) needs a layer to be specified
-      // The [X1 Y1 X2 Y2] order is the most common and can be parsed linearly.
+			// The [X1 Y1 X2 Y2] order is the most common and can be parsed linearly.
 			// Some libraries, like the python libraries dxfgrabber and ezdxf, cannot open [X1 X2 Y1 Y2] order.
-			output << "  8\n"
-						 << "0\n"
-						 << " 10\n"
-						 << x1 << "\n"
-						 << " 20\n"
-						 << y1 << "\n"
-						 << " 11\n"
-						 << x2 << "\n"
-						 << " 21\n"
-						 << y2 << "\n";
+			buffer.append("  0\nLINE\n  8\n0\n 10\n");
+			buffer.appendNumber(p1[0], digits);
+			buffer.append("\n 20\n");
+			buffer.appendNumber(p1[1], digits);
+			buffer.append("\n 11\n");
+			buffer.appendNumber(p2[0], digits);
+			buffer.append("\n 21\n");
+			buffer.appendNumber(p2[1], digits);
+			buffer.append('\n');
 		}
 	}
+	buffer.flush();
 
 	output << "  0\n"
 				 << "ENDSEC\n";
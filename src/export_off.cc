@@ -28,47 +28,27 @@
 #include "polyset.h"
 #include "polyset-utils.h"
 #include "dxfdata.h"
+#include "OutputBuffer.h"
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgal.h"
 #include "cgalutils.h"
 
-#include "Reindexer.h"
-#include "grid.h"
+#include "GeometryUtils.h"
 
-struct IndexedMesh {
-	IndexedMesh() : numfaces(0) {}
-
-	Reindexer<Vector3d> vertices;
-	std::vector<int> indices;
-	size_t numfaces;
-};
-
-
-static void append_geometry(const PolySet &ps, IndexedMesh &mesh)
-{
-	for(const auto &p : ps.polygons) {
-		for(const auto &v : p) {
-			mesh.indices.push_back(mesh.vertices.lookup(v));
-		}
-		mesh.numfaces++;
-		mesh.indices.push_back(-1);
-	}
-}
-
-void append_geometry(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
+static void create_mesh(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
 {
 	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
 		PolySet ps(3);
 		bool err = CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), ps);
 		if (err) { PRINT("ERROR: Nef->PolySet failed"); }
 		else {
-			append_geometry(ps, mesh);
+			PolysetUtils::createIndexedMesh(ps, mesh);
 		}
 	}
 	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
-		append_geometry(*ps, mesh);
+		PolysetUtils::createIndexedMesh(*ps, mesh);
 	}
 	else if (dynamic_cast<const Polygon2d *>(geom.get())) {
 		assert(false && "Unsupported file format");
@@ -80,25 +60,25 @@ void append_geometry(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
 void export_off(const shared_ptr<const Geometry> &geom, std::ostream &output)
 {
 	IndexedMesh mesh;
-	append_geometry(geom, mesh);
+	create_mesh(geom, mesh);
 
-	output << "OFF " << mesh.vertices.size() << " " << mesh.numfaces << " 0\n";
-	const auto& v = mesh.vertices.getArray();
-	size_t numverts = mesh.vertices.size();
-	for (size_t i=0;i<numverts;i++) {
-		output << v[i][0] << " " << v[i][1] << " " << v[i][2] << " " << "\n";
+	const int digits = exportPrecision();
+	OutputBuffer buffer(output);
+	char buf[64];
+	buffer.append(buf, snprintf(buf, sizeof(buf), "OFF %d %d 0\n", int(mesh.vertices.size()), int(mesh.numFaces())));
+	for (const auto &v : mesh.vertices) {
+		buffer.appendNumbers(v.data(), 3, digits, ' ');
+		buffer.append(" \n");
 	}
-	size_t cnt = 0;
-	for (size_t i=0;i<mesh.numfaces;i++) {
-		size_t nverts = 0;
-		while (mesh.indices[cnt++] != -1) nverts++;
-		output << nverts;
-		cnt -= nverts + 1;
-		for (size_t n=0;n<nverts;n++) output << " " << mesh.indices[cnt++];
-		output << "\n";
-        cnt++; // Skip the -1 marker
+	for (size_t i = 0; i < mesh.numFaces(); ++i) {
+		const int *face = mesh.face(i);
+		buffer.append(buf, snprintf(buf, sizeof(buf), "%d", int(mesh.faceSize(i))));
+		for (size_t n = 0; n < mesh.faceSize(i); ++n) {
+			buffer.append(buf, snprintf(buf, sizeof(buf), " %d", face[n]));
+		}
+		buffer.append('\n');
 	}
-
+	buffer.flush();
 }
 
 #endif // ENABLE_CGAL
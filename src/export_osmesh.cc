@@ -0,0 +1,89 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "export.h"
+#include "osmesh.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "printutils.h"
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#include "cgal.h"
+#include "cgalutils.h"
+
+/*!
+	Converts the given 3D geometry into mesh, keeping its polygons. Returns
+	false if the geometry couldn't be converted.
+*/
+static bool create_osmesh(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
+{
+	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (!N->p3) return true;
+		PolySet ps(3);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), ps)) {
+			PRINT("EXPORT-ERROR: Nef->PolySet failed");
+			return false;
+		}
+		PolysetUtils::createIndexedMesh(ps, mesh);
+	}
+	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+		PolysetUtils::createIndexedMesh(*ps, mesh);
+	}
+	else if (dynamic_cast<const Polygon2d *>(geom.get())) {
+		assert(false && "Unsupported file format");
+		return false;
+	} else {
+		assert(false && "Not implemented");
+		return false;
+	}
+	return true;
+}
+
+void export_osmesh(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	IndexedMesh mesh;
+	if (!create_osmesh(geom, mesh)) return;
+	OSMesh::writeHeader(output, 1);
+	OSMesh::writeObject(output, mesh);
+}
+
+/*!
+	Writes each part as an object, with its color if it has one. Parts which
+	can't be converted are written as empty objects, as the number of
+	objects is written first.
+*/
+void export_osmesh(const std::vector<ExportPart> &parts, std::ostream &output)
+{
+	OSMesh::writeHeader(output, uint32_t(parts.size()));
+	for (const auto &part : parts) {
+		IndexedMesh mesh;
+		if (!create_osmesh(part.geom, mesh)) mesh = IndexedMesh();
+		OSMesh::writeObject(output, mesh, part.color[0] >= 0 ? &part.color : nullptr);
+	}
+}
+
+#endif // ENABLE_CGAL
@@ -5,6 +5,121 @@
 #include <stdio.h>
 #include "polyset.h"
 #include "rendersettings.h"
+#include "imageutils.h"
+#include <assert.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+	/*!
+		Encodes and writes images on a thread of its own, so the next images
+		can be drawn and the next frames evaluated meanwhile.
+	*/
+	class PngEncoder
+	{
+	public:
+		static PngEncoder &instance() {
+			static PngEncoder *encoder = new PngEncoder; // The thread never ends
+			return *encoder;
+		}
+
+		void encode(std::vector<unsigned char> &&pixels, int width, int height, std::ostream &output) {
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->jobs.push_back(Job{std::move(pixels), width, height, &output});
+			this->changed.notify_all();
+		}
+
+		bool wait() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->changed.wait(lock, [this]{ return this->jobs.empty() && !this->busy; });
+			const bool ok = !this->failed;
+			this->failed = false;
+			return ok;
+		}
+
+	private:
+		struct Job {
+			std::vector<unsigned char> pixels;
+			int width, height;
+			std::ostream *output;
+		};
+
+		PngEncoder() : busy(false), failed(false) {
+			std::thread([this]{ run(); }).detach();
+		}
+
+		void run() {
+			std::unique_lock<std::mutex> lock(this->mutex);
+			while (true) {
+				this->changed.wait(lock, [this]{ return !this->jobs.empty(); });
+				Job job = std::move(this->jobs.front());
+				this->jobs.pop_front();
+				this->busy = true;
+				lock.unlock();
+				const bool ok = write_png(*job.output, job.pixels.data(), job.width, job.height);
+				job.output->flush();
+				lock.lock();
+				if (!ok || !job.output->good()) this->failed = true;
+				this->busy = false;
+				this->changed.notify_all();
+			}
+		}
+
+		std::mutex mutex;
+		std::condition_variable changed;
+		std::deque<Job> jobs;
+		bool busy;
+		bool failed;
+	};
+
+	/*!
+		Reads each image back while the next one is drawn, and passes it on
+		to the PngEncoder. The view of the image being read must stay alive
+		until the next read() or finish().
+	*/
+	class FrameReader
+	{
+	public:
+		FrameReader() : view(nullptr), output(nullptr) {}
+		~FrameReader() { finish(); }
+
+		void read(OffscreenView &view, std::ostream &output) {
+#ifdef NULLGL
+			view.save(output);
+#else
+			view.readFrame();
+			finish();
+			this->view = &view;
+			this->output = &output;
+#endif
+		}
+
+		// An image of another size replaces the view, so must wait
+		void prepare(const Camera &camera) {
+			if (this->view && (this->view->width != int(camera.pixel_width) || this->view->height != int(camera.pixel_height))) {
+				finish();
+			}
+		}
+
+		void finish() {
+			if (!this->view) return;
+			PngEncoder::instance().encode(this->view->takeFrame(), this->view->width, this->view->height, *this->output);
+			this->view = nullptr;
+		}
+
+	private:
+		OffscreenView *view;
+		std::ostream *output;
+	};
+}
+
+bool wait_png_exports()
+{
+	return PngEncoder::instance().wait();
+}
 
 #ifdef ENABLE_CGAL
 #include "CGALRenderer.h"
@@ -17,31 +132,64 @@ static void setupCamera(Camera &cam, const BoundingBox &bbox)
 	if (cam.viewall) cam.viewAll(bbox);
 }
 
-bool export_png(const shared_ptr<const Geometry> &root_geom, const ViewOptions& options, Camera camera, std::ostream &output)
+/*!
+	Returns an offscreen view of the given size. Creating the GL context takes
+	much longer than rendering a thumbnail, so the last view is kept for all
+	further exports and only replaced if another size is asked for.
+	Returns nullptr if no context could be created.
+*/
+static OffscreenView *get_offscreen_view(unsigned int width, unsigned int height)
 {
-	PRINTD("export_png geom");
-	OffscreenView *glview;
+	static OffscreenView *glview = nullptr;
+	static unsigned int view_width = 0, view_height = 0;
+
+	if (glview && view_width == width && view_height == height) return glview;
+	delete glview;
+	glview = nullptr;
 	try {
-		glview = new OffscreenView(camera.pixel_width, camera.pixel_height);
+		glview = new OffscreenView(width, height);
 	} catch (int error) {
 		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
-		return false;
+		return nullptr;
 	}
-	CGALRenderer cgalRenderer(root_geom);
+	view_width = width;
+	view_height = height;
+	return glview;
+}
 
+/*!
+	Writes one image per camera to the corresponding output. The renderer is
+	set up once for all of them.
+*/
+bool export_png(const shared_ptr<const Geometry> &root_geom, const ViewOptions& options, const std::vector<Camera> &cameras, const std::vector<std::ostream *> &outputs)
+{
+	PRINTD("export_png geom");
+	assert(cameras.size() == outputs.size());
+	if (cameras.empty()) return true;
+	// The renderer's display lists and buffers need a current context
+	if (!get_offscreen_view(cameras[0].pixel_width, cameras[0].pixel_height)) return false;
+	CGALRenderer cgalRenderer(root_geom);
 	BoundingBox bbox = cgalRenderer.getBoundingBox();
-	setupCamera(camera, bbox);
-
-	glview->setCamera(camera);
-	glview->setRenderer(&cgalRenderer);
-	glview->setColorScheme(RenderSettings::inst()->colorscheme);
-	glview->setShowFaces(!options["wireframe"]);
-	glview->setShowCrosshairs(options["crosshairs"]);
-	glview->setShowAxes(options["axes"]);
-	glview->setShowScaleProportional(options["scales"]);
-	glview->setShowEdges(options["edges"]);
-	glview->paintGL();
-	glview->save(output);
+
+	FrameReader reader;
+	for (size_t i = 0; i < cameras.size(); ++i) {
+		auto camera = cameras[i];
+		reader.prepare(camera);
+		auto glview = get_offscreen_view(camera.pixel_width, camera.pixel_height);
+		if (!glview) return false;
+		setupCamera(camera, bbox);
+
+		glview->setCamera(camera);
+		glview->setRenderer(&cgalRenderer);
+		glview->setColorScheme(RenderSettings::inst()->colorscheme);
+		glview->setShowFaces(!options["wireframe"]);
+		glview->setShowCrosshairs(options["crosshairs"]);
+		glview->setShowAxes(options["axes"]);
+		glview->setShowScaleProportional(options["scales"]);
+		glview->setShowEdges(options["edges"]);
+		glview->paintGL();
+		reader.read(*glview, *outputs[i]);
+	}
 	return true;
 }
 
@@ -51,50 +199,62 @@ bool export_png(const shared_ptr<const Geometry> &root_geom, const ViewOptions&
 #endif
 #include "ThrownTogetherRenderer.h"
 
-bool export_preview_png(Tree &tree, const ViewOptions& options, Camera camera, std::ostream &output)
+/*!
+	Writes one preview image per camera to the corresponding output. The CSG
+	products are compiled once for all of them.
+*/
+bool export_preview_png(Tree &tree, const ViewOptions& options, const std::vector<Camera> &cameras, const std::vector<std::ostream *> &outputs)
 {
 	PRINTD("export_png_preview_common");
+	assert(cameras.size() == outputs.size());
 	CsgInfo csgInfo = CsgInfo();
 	csgInfo.compile_products(tree);
 
-	OffscreenView *glview;
-	try {
-		glview = new OffscreenView(camera.pixel_width, camera.pixel_height);
-	} catch (int error) {
-		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
+#ifndef ENABLE_OPENCSG
+	if (options.previewer == Previewer::OPENCSG) {
+		fprintf(stderr,"This openscad was built without OpenCSG support\n");
 		return false;
 	}
-
-#ifdef ENABLE_OPENCSG
-	OpenCSGRenderer openCSGRenderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products, glview->shaderinfo);
 #endif
-	ThrownTogetherRenderer thrownTogetherRenderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products);
 
-	if (options.previewer == Previewer::OPENCSG) {
+	OffscreenView *lastview = nullptr;
+	std::unique_ptr<Renderer> renderer;
+	FrameReader reader;
+	for (size_t i = 0; i < cameras.size(); ++i) {
+		auto camera = cameras[i];
+		reader.prepare(camera);
+		auto glview = get_offscreen_view(camera.pixel_width, camera.pixel_height);
+		if (!glview) return false;
+
+		// The OpenCSG renderer refers to the shaders of its view
+		if (glview != lastview) {
+			renderer.reset();
 #ifdef ENABLE_OPENCSG
-		glview->setRenderer(&openCSGRenderer);
-#else
-		fprintf(stderr,"This openscad was built without OpenCSG support\n");
-		return false;
+			if (options.previewer == Previewer::OPENCSG) {
+				renderer.reset(new OpenCSGRenderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products, glview->shaderinfo));
+			}
 #endif
-	}
-	else {
-		glview->setRenderer(&thrownTogetherRenderer);
-	}
+			if (!renderer) {
+				renderer.reset(new ThrownTogetherRenderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products));
+			}
+			lastview = glview;
+		}
+		glview->setRenderer(renderer.get());
 #ifdef ENABLE_OPENCSG
-	BoundingBox bbox = glview->getRenderer()->getBoundingBox();
-	setupCamera(camera, bbox);
+		BoundingBox bbox = glview->getRenderer()->getBoundingBox();
+		setupCamera(camera, bbox);
 
-	glview->setCamera(camera);
-	OpenCSG::setContext(0);
-	OpenCSG::setOption(OpenCSG::OffscreenSetting, OpenCSG::FrameBufferObject);
+		glview->setCamera(camera);
+		OpenCSG::setContext(0);
+		OpenCSG::setOption(OpenCSG::OffscreenSetting, OpenCSG::FrameBufferObject);
 #endif
-	glview->setColorScheme(RenderSettings::inst()->colorscheme);
-	glview->setShowAxes(options["axes"]);
-	glview->setShowScaleProportional(options["scales"]);
-	glview->setShowEdges(options["edges"]);
-	glview->paintGL();
-	glview->save(output);
+		glview->setColorScheme(RenderSettings::inst()->colorscheme);
+		glview->setShowAxes(options["axes"]);
+		glview->setShowScaleProportional(options["scales"]);
+		glview->setShowEdges(options["edges"]);
+		glview->paintGL();
+		reader.read(*glview, *outputs[i]);
+	}
 	return true;
 }
 
@@ -25,9 +25,18 @@
  */
 
 #include "export.h"
+#include "printutils.h"
 #include "polyset.h"
 #include "polyset-utils.h"
+#include "GeometryUtils.h"
 #include "dxfdata.h"
+#include "OutputBuffer.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
@@ -36,94 +45,181 @@
 
 namespace {
 
-std::string toString(const Vector3d &v)
+// Formats a vector as its components separated by spaces, returns the length written to buf
+int format_vector(const Vector3d &v, int digits, char *buf)
 {
-	return STR(v[0] << " " << v[1] << " " << v[2]);
+	return NumberFormat::format(v.data(), 3, digits, ' ', buf);
 }
 
-Vector3d fromString(const std::string &vertexString)
+char *put_uint32(char *p, uint32_t x)
 {
-	Vector3d v;
-	std::istringstream stream{vertexString};
-	stream >> v[0] >> v[1] >> v[2];
-	return v;
+	// STL is little endian, regardless of the host
+	p[0] = char(x & 0xff);
+	p[1] = char((x >> 8) & 0xff);
+	p[2] = char((x >> 16) & 0xff);
+	p[3] = char((x >> 24) & 0xff);
+	return p + 4;
 }
-	
-void append_stl(const PolySet &ps, std::ostream &output)
+
+char *put_float(char *p, float f)
+{
+	// as in import_stl.cc, we assume float is an IEEE binary32
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+	return put_uint32(p, x);
+}
+
+/*!
+	Triangulates the given PolySet into mesh, sharing vertices.
+*/
+void create_stl_mesh(const PolySet &ps, IndexedMesh &mesh)
 {
 	PolySet triangulated(3);
 	PolysetUtils::tessellate_faces(ps, triangulated);
+	PolysetUtils::createIndexedMesh(triangulated, mesh);
+}
 
-	for(const auto &p : triangulated.polygons) {
-		assert(p.size() == 3); // STL only allows triangles
-		std::array<std::string, 3> vertexStrings;
-		std::transform(p.cbegin(), p.cend(), vertexStrings.begin(), toString);
+/*!
+	Triangulates the given 3D geometry into mesh. Returns false if
+	there is nothing to export.
+*/
+bool create_stl_mesh(const shared_ptr<const Geometry> &geom, IndexedMesh &mesh)
+{
+	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
+		if (!N->p3->is_simple()) {
+			PRINT("EXPORT-WARNING: Exported object may not be a valid 2-manifold and may need repair");
+		}
+		PolySet ps(3);
+		if (CGALUtils::createPolySetFromNefPolyhedron3(*(N->p3), ps)) {
+			PRINT("EXPORT-ERROR: Nef->PolySet failed");
+			return false;
+		}
+		create_stl_mesh(ps, mesh);
+	}
+	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
+		create_stl_mesh(*ps, mesh);
+	}
+	else if (dynamic_cast<const Polygon2d *>(geom.get())) {
+		assert(false && "Unsupported file format");
+		return false;
+	} else {
+		assert(false && "Not implemented");
+		return false;
+	}
+	return true;
+}
+
+void append_stl(const IndexedMesh &mesh, OutputBuffer &output)
+{
+	// Each vertex is formatted once, together with the coordinates read back
+	// from its text, as the normal is calculated from the written values.
+	std::vector<std::string> vertexStrings;
+	std::vector<Vector3d> written;
+	vertexStrings.reserve(mesh.vertices.size());
+	written.reserve(mesh.vertices.size());
+	const int digits = exportPrecision();
+	char buf[3 * NumberFormat::maxlength];
+	for (const auto &v : mesh.vertices) {
+		const int len = format_vector(v, digits, buf);
+		vertexStrings.emplace_back(buf, len);
+		char *end;
+		Vector3d p;
+		p[0] = strtod(buf, &end);
+		p[1] = strtod(end, &end);
+		p[2] = strtod(end, nullptr);
+		written.push_back(p);
+	}
+	auto distinct = [&vertexStrings](int a, int b) {
+		return a != b && vertexStrings[a] != vertexStrings[b];
+	};
 
-		if (vertexStrings[0] != vertexStrings[1] &&
-				vertexStrings[0] != vertexStrings[2] &&
-				vertexStrings[1] != vertexStrings[2]) {
+	for (size_t i = 0; i < mesh.numFaces(); ++i) {
+		assert(mesh.faceSize(i) == 3); // STL only allows triangles
+		const int *face = mesh.face(i);
+		if (distinct(face[0], face[1]) && distinct(face[0], face[2]) && distinct(face[1], face[2])) {
 			// The above condition ensures that there are 3 distinct vertices, but
 			// they may be collinear. If they are, the unit normal is meaningless
 			// so the default value of "0 0 0" can be used. If the vertices are not
 			// collinear then the unit normal must be calculated from the
 			// components.
-			output << "  facet normal ";
+			output.append("  facet normal ");
+
+			const Vector3d &p0 = written[face[0]];
+			const Vector3d &p1 = written[face[1]];
+			const Vector3d &p2 = written[face[2]];
 
-			Vector3d p0 = fromString(vertexStrings[0]);
-			Vector3d p1 = fromString(vertexStrings[1]);
-			Vector3d p2 = fromString(vertexStrings[2]);
-			
 			Vector3d normal = (p1 - p0).cross(p2 - p0);
 			normal.normalize();
 			if (is_finite(normal) && !is_nan(normal)) {
-				output << normal[0] << " " << normal[1] << " " << normal[2] << "\n";
+				output.appendNumbers(normal.data(), 3, digits, ' ');
+				output.append('\n');
 			}
 			else {
-				output << "0 0 0\n";
+				output.append("0 0 0\n");
 			}
-			output << "    outer loop\n";
-		
-			for (const auto &vertexString : vertexStrings) {
-				output << "      vertex " << vertexString << "\n";
+			output.append("    outer loop\n");
+
+			for (int j = 0; j < 3; ++j) {
+				output.append("      vertex ");
+				output.append(vertexStrings[face[j]]);
+				output.append("\n", 1);
 			}
-			output << "    endloop\n";
-			output << "  endfacet\n";
+			output.append("    endloop\n");
+			output.append("  endfacet\n");
 		}
 	}
 }
 
-/*!
-	Saves the current 3D CGAL Nef polyhedron as STL to the given file.
-	The file must be open.
- */
-void append_stl(const CGAL_Nef_polyhedron &root_N, std::ostream &output)
+void put_binstl_header(char *header, uint32_t count)
 {
-	if (!root_N.p3->is_simple()) {
-		PRINT("EXPORT-WARNING: Exported object may not be a valid 2-manifold and may need repair");
-	}
-
-	PolySet ps(3);
-	if (!CGALUtils::createPolySetFromNefPolyhedron3(*(root_N.p3), ps)) {
-		append_stl(ps, output);
-	}
-	else {
-		PRINT("EXPORT-ERROR: Nef->PolySet failed");
-	}
+	memset(header, 0, 80);
+	const char name[] = "OpenSCAD Model";
+	memcpy(header, name, sizeof(name) - 1);
+	put_uint32(header + 80, count);
 }
 
-void append_stl(const shared_ptr<const Geometry> &geom, std::ostream &output)
+/*!
+	Appends the facets of mesh, preceded by the header with their count if
+	header is set. Returns the number of facets.
+*/
+uint32_t append_binstl(const IndexedMesh &mesh, OutputBuffer &output, bool header)
 {
-	if (const CGAL_Nef_polyhedron *N = dynamic_cast<const CGAL_Nef_polyhedron *>(geom.get())) {
-		append_stl(*N, output);
-	}
-	else if (const PolySet *ps = dynamic_cast<const PolySet *>(geom.get())) {
-		append_stl(*ps, output);
+	std::vector<Vector3f> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (const auto &v : mesh.vertices) vertices.push_back(v.cast<float>());
+
+	// Like in ASCII STL, triangles which are degenerate after rounding to
+	// the output precision are dropped. The count precedes the facets.
+	auto keep = [&vertices](const int *face) {
+		const Vector3f &p0 = vertices[face[0]], &p1 = vertices[face[1]], &p2 = vertices[face[2]];
+		return p0 != p1 && p0 != p2 && p1 != p2;
+	};
+	uint32_t count = 0;
+	for (size_t i = 0; i < mesh.numFaces(); ++i) {
+		assert(mesh.faceSize(i) == 3); // STL only allows triangles
+		if (keep(mesh.face(i))) count++;
 	}
-	else if (dynamic_cast<const Polygon2d *>(geom.get())) {
-		assert(false && "Unsupported file format");
-	} else {
-		assert(false && "Not implemented");
+
+	if (header) put_binstl_header(output.claim(84), count);
+
+	for (size_t i = 0; i < mesh.numFaces(); ++i) {
+		const int *face = mesh.face(i);
+		if (!keep(face)) continue;
+		const Vector3f &p0 = vertices[face[0]], &p1 = vertices[face[1]], &p2 = vertices[face[2]];
+		Vector3d normal = (p1 - p0).cast<double>().cross((p2 - p0).cast<double>());
+		normal.normalize();
+		if (!is_finite(normal) || is_nan(normal)) normal = Vector3d::Zero();
+
+		char *p = output.claim(50);
+		for (int j = 0; j < 3; ++j) p = put_float(p, float(normal[j]));
+		for (int k = 0; k < 3; ++k) {
+			const Vector3f &v = vertices[face[k]];
+			for (int j = 0; j < 3; ++j) p = put_float(p, v[j]);
+		}
+		// attribute byte count
+		p[0] = p[1] = 0;
 	}
+	return count;
 }
 
 } // namespace
@@ -131,12 +227,109 @@ void append_stl(const shared_ptr<const Geometry> &geom, std::ostream &output)
 void export_stl(const shared_ptr<const Geometry> &geom, std::ostream &output)
 {
 	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
-	output << "solid OpenSCAD_Model\n";
+	OutputBuffer buffer(output);
+	buffer.append("solid OpenSCAD_Model\n");
 
-	append_stl(geom, output);
+	IndexedMesh mesh;
+	if (create_stl_mesh(geom, mesh)) append_stl(mesh, buffer);
 
-	output << "endsolid OpenSCAD_Model\n";
+	buffer.append("endsolid OpenSCAD_Model\n");
+	buffer.flush();
 	setlocale(LC_NUMERIC, "");      // Set default locale
 }
 
+/*!
+	Binary STL: an 80 byte header, the number of facets and 50 bytes per
+	facet (normal, three vertices as 32-bit floats and a zero attribute).
+*/
+void export_binstl(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	OutputBuffer buffer(output);
+	IndexedMesh mesh;
+	create_stl_mesh(geom, mesh);
+	append_binstl(mesh, buffer, true);
+	buffer.flush();
+}
+
+StlStreamExporter::StlStreamExporter(FileFormat format, const char *name2open, const char *name2display)
+	: binary(format == FileFormat::BINSTL), name2display(name2display), facets(0), onerror(false)
+{
+	assert((format == FileFormat::STL || format == FileFormat::BINSTL) && "Unsupported file format");
+	std::ios::openmode mode = std::ios::out | std::ios::trunc;
+	if (this->binary) mode |= std::ios::binary;
+	this->fstream.open(name2open, mode);
+	if (!this->fstream.is_open()) {
+		PRINTB(_("Can't open file \"%s\" for export"), name2display);
+		return;
+	}
+	this->fstream.exceptions(std::ios::badbit|std::ios::failbit);
+	try {
+		if (this->binary) {
+			// The facet count is filled in by close()
+			char header[84];
+			put_binstl_header(header, 0);
+			this->fstream.write(header, sizeof(header));
+		}
+		else {
+			this->fstream << "solid OpenSCAD_Model\n";
+		}
+	} catch (std::ios::failure&) {
+		this->onerror = true;
+	}
+}
+
+StlStreamExporter::~StlStreamExporter()
+{
+	if (this->fstream.is_open()) close();
+}
+
+/*!
+	Appends the facets of a 3D geometry, and writes them to the file right
+	away.
+*/
+void StlStreamExporter::append(const shared_ptr<const Geometry> &geom)
+{
+	if (!isOpen() || this->onerror) return;
+	IndexedMesh mesh;
+	if (!create_stl_mesh(geom, mesh)) return;
+	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
+	try {
+		OutputBuffer buffer(this->fstream);
+		if (this->binary) this->facets += append_binstl(mesh, buffer, false);
+		else append_stl(mesh, buffer);
+		buffer.flush();
+		this->fstream.flush();
+	} catch (std::ios::failure&) {
+		this->onerror = true;
+	}
+	setlocale(LC_NUMERIC, "");      // Set default locale
+}
+
+bool StlStreamExporter::close()
+{
+	if (!isOpen()) return false;
+	try {
+		if (this->binary) {
+			char count[4];
+			put_uint32(count, this->facets);
+			this->fstream.seekp(80);
+			this->fstream.write(count, sizeof(count));
+		}
+		else {
+			this->fstream << "endsolid OpenSCAD_Model\n";
+		}
+	} catch (std::ios::failure&) {
+		this->onerror = true;
+	}
+	try { // make sure file closed - resources released
+		this->fstream.close();
+	} catch (std::ios::failure&) {
+		this->onerror = true;
+	}
+	if (this->onerror) {
+		PRINTB(_("ERROR: \"%s\" write error. (Disk full?)"), this->name2display);
+	}
+	return !this->onerror;
+}
+
 #endif // ENABLE_CGAL
@@ -27,28 +27,45 @@
 #include "export.h"
 #include "polyset.h"
 #include "polyset-utils.h"
+#include "OutputBuffer.h"
 
+static void append_point(const Vector2d &p, int digits, OutputBuffer &buffer)
+{
+	buffer.appendNumber(p.x(), digits);
+	buffer.append(',');
+	buffer.appendNumber(-p.y(), digits);
+}
+
+/*!
+	Writes the outlines as one path, which fills the holes correctly, or
+	as a path per outline, unfilled, see svgPathPerOutline().
+*/
 static void append_svg(const Polygon2d &poly, std::ostream &output)
 {
-	output << "<path d=\"\n";
+	const int digits = exportPrecision();
+	const bool separate = svgPathPerOutline();
+	OutputBuffer buffer(output);
+	if (!separate) buffer.append("<path d=\"\n");
 	for(const auto &o : poly.outlines()) {
 		if (o.vertices.empty()) {
 			continue;
 		}
 		
-		const Eigen::Vector2d& p0 = o.vertices[0];
-		output << "M " << p0.x() << "," << -p0.y();
+		if (separate) buffer.append("<path d=\"");
+		buffer.append("M ");
+		append_point(o.vertices[0], digits, buffer);
 		for (unsigned int idx = 1;idx < o.vertices.size();idx++) {
-			const Eigen::Vector2d& p = o.vertices[idx];
-			output << " L " << p.x() << "," << -p.y();
+			buffer.append(" L ");
+			append_point(o.vertices[idx], digits, buffer);
 			if ((idx % 6) == 5) {
-				output << "\n";
+				buffer.append('\n');
 			}
 		}
-		output << " z\n";
+		if (separate) buffer.append(" z\" stroke=\"black\" fill=\"none\" stroke-width=\"0.5\"/>\n");
+		else buffer.append(" z\n");
 	}
-	output << "\" stroke=\"black\" fill=\"lightgray\" stroke-width=\"0.5\"/>\n";
-
+	if (!separate) buffer.append("\" stroke=\"black\" fill=\"lightgray\" stroke-width=\"0.5\"/>\n");
+	buffer.flush();
 }
 
 static void append_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
@@ -63,11 +80,8 @@ static void append_svg(const shared_ptr<const Geometry> &geom, std::ostream &out
 	}
 }
 
-void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
+static void append_header(const BoundingBox &bbox, bool layers, std::ostream &output)
 {
-	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
-	
-	BoundingBox bbox = geom->getBoundingBox();
 	int minx = (int)floor(bbox.min().x());
 	int miny = (int)floor(-bbox.max().y());
 	int maxx = (int)ceil(bbox.max().x());
@@ -80,11 +94,40 @@ void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
 		<< "<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" \"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n"
 		<< "<svg width=\"" << width << "mm\" height=\"" << height
 		<< "mm\" viewBox=\"" << minx << " " << miny << " " << width << " " << height
-		<< "\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\">\n"
+		<< "\" xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\"";
+	if (layers) output << " xmlns:inkscape=\"http://www.inkscape.org/namespaces/inkscape\"";
+	output << ">\n"
 		<< "<title>OpenSCAD Model</title>\n";
+}
 
+void export_svg(const shared_ptr<const Geometry> &geom, std::ostream &output)
+{
+	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
+	
+	append_header(geom->getBoundingBox(), false, output);
 	append_svg(geom, output);
 
 	output << "</svg>\n";	
 	setlocale(LC_NUMERIC, "");      // Set default locale
 }
+
+/*!
+	Exports each of the 2D geometries as a group, which Inkscape shows as a
+	layer labeled with its name.
+*/
+void export_svg(const std::vector<ExportPart> &layers, std::ostream &output)
+{
+	setlocale(LC_NUMERIC, "C"); // Ensure radix is . (not ,) in output
+
+	BoundingBox bbox;
+	for (const auto &layer : layers) bbox.extend(layer.geom->getBoundingBox());
+	append_header(bbox, true, output);
+	for (size_t i = 0; i < layers.size(); ++i) {
+		output << "<g id=\"layer" << (i + 1) << "\" inkscape:groupmode=\"layer\" inkscape:label=\"" << layers[i].name << "\">\n";
+		append_svg(layers[i].geom, output);
+		output << "</g>\n";
+	}
+
+	output << "</svg>\n";
+	setlocale(LC_NUMERIC, "");      // Set default locale
+}
@@ -27,15 +27,18 @@
 #include "expression.h"
 #include "value.h"
 #include "evalcontext.h"
+#include "NumericProgram.h"
 #include <cstdint>
 #include <assert.h>
 #include <sstream>
 #include <algorithm>
 #include "printutils.h"
 #include "stackcheck.h"
+#include "JobLimits.h"
 #include "exceptions.h"
 #include "feature.h"
 #include "printutils.h"
+#include "Trace.h"
 #include <boost/bind.hpp>
 
 #include <boost/assign/std/vector.hpp>
@@ -47,24 +50,15 @@ namespace {
 		return dynamic_cast<const ListComprehension *>(e.get());
 	}
 
-	Value::VectorType flatten(Value::VectorType const& vec) {
-		int n = 0;
-		for (unsigned int i = 0; i < vec.size(); i++) {
-			if (vec[i]->type() == Value::ValueType::VECTOR) {
-				n += vec[i]->toVector().size();
-			} else {
-				n++;
-			}
-		}
-		Value::VectorType ret; ret.reserve(n);
-		for (unsigned int i = 0; i < vec.size(); i++) {
-			if (vec[i]->type() == Value::ValueType::VECTOR) {
-				std::copy(vec[i]->toVector().begin(),vec[i]->toVector().end(),std::back_inserter(ret));
-			} else {
-				ret.push_back(vec[i]);
-			}
-		}
-		return ret;
+	// Like reserve(), but keeps growing geometrically when called repeatedly on a growing vector
+	void reserve_more(Value::VectorType &vec, size_t n) {
+		if (vec.capacity() < vec.size() + n) vec.reserve(std::max(vec.size() + n, 2 * vec.capacity()));
+	}
+
+	// Appends the elements of a list comprehension, or the value of any other expression
+	void append_elements(const shared_ptr<Expression> &e, const Context *context, Value::VectorType &vec) {
+		if (auto lc = dynamic_cast<const ListComprehension *>(e.get())) lc->evaluateInto(context, vec);
+		else vec.push_back(e->evaluate(context));
 	}
 
 	void evaluate_sequential_assignment(const AssignmentList &assignment_list, Context *context, const Location &loc) {
@@ -92,12 +86,27 @@ bool Expression::isLiteral() const
     return false;
 }
 
+/*!
+	Evaluates the expression once, to be returned by all later evaluations.
+	Called by the constructors of expressions whose operands are all
+	constant, so e.g. [0, 2 * 180, -1] is a single vector built when parsing.
+	Expressions printing messages (e.g. warnings about their operands) must
+	not be folded, as the messages would only be printed once.
+*/
+void Expression::fold()
+{
+	this->constant = this->evaluate(nullptr);
+	this->folded = true;
+}
+
 UnaryOp::UnaryOp(UnaryOp::Op op, Expression *expr, const Location &loc) : Expression(loc), op(op), expr(expr)
 {
+	if (this->expr->isConstant()) fold();
 }
 
 ValuePtr UnaryOp::evaluate(const Context *context) const
 {
+	if (this->folded) return this->constant;
 	switch (this->op) {
 	case (Op::Not):
 		return !this->expr->evaluate(context);
@@ -137,11 +146,32 @@ void UnaryOp::print(std::ostream &stream, const std::string &) const
 }
 
 BinaryOp::BinaryOp(Expression *left, BinaryOp::Op op, Expression *right, const Location &loc) :
-	Expression(loc), op(op), left(left), right(right)
+	Expression(loc), op(op), left(left), right(right), numeric(true)
+{
+	// Not fold(), which would compile a program for a single evaluation
+	if (this->left->isConstant() && this->right->isConstant()) {
+		this->constant = evaluateOperands(nullptr);
+		this->folded = true;
+	}
+}
+
+BinaryOp::~BinaryOp()
 {
 }
 
 ValuePtr BinaryOp::evaluate(const Context *context) const
+{
+	if (this->folded) return this->constant;
+	std::call_once(this->compiled, [this]() { this->program = NumericProgram::compile(*this); });
+	if (this->program && this->numeric) {
+		ValuePtr result;
+		if (this->program->evaluate(context, result)) return result;
+		this->numeric = false;
+	}
+	return evaluateOperands(context);
+}
+
+ValuePtr BinaryOp::evaluateOperands(const Context *context) const
 {
 	switch (this->op) {
 	case Op::LogicalAnd:
@@ -245,10 +275,14 @@ void BinaryOp::print(std::ostream &stream, const std::string &) const
 TernaryOp::TernaryOp(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc)
 	: Expression(loc), cond(cond), ifexpr(ifexpr), elseexpr(elseexpr)
 {
+	if (this->cond->isConstant()) {
+		if ((this->cond->constantValue() ? this->ifexpr : this->elseexpr)->isConstant()) fold();
+	}
 }
 
 ValuePtr TernaryOp::evaluate(const Context *context) const
 {
+	if (this->folded) return this->constant;
 	return (this->cond->evaluate(context) ? this->ifexpr : this->elseexpr)->evaluate(context);
 }
 
@@ -260,9 +294,11 @@ void TernaryOp::print(std::ostream &stream, const std::string &) const
 ArrayLookup::ArrayLookup(Expression *array, Expression *index, const Location &loc)
 	: Expression(loc), array(array), index(index)
 {
+	if (this->array->isConstant() && this->index->isConstant()) fold();
 }
 
 ValuePtr ArrayLookup::evaluate(const Context *context) const {
+	if (this->folded) return this->constant;
 	return this->array->evaluate(context)[this->index->evaluate(context)];
 }
 
@@ -273,6 +309,8 @@ void ArrayLookup::print(std::ostream &stream, const std::string &) const
 
 Literal::Literal(const ValuePtr &val, const Location &loc) : Expression(loc), value(val)
 {
+	this->constant = val;
+	this->folded = true;
 }
 
 ValuePtr Literal::evaluate(const class Context *) const
@@ -288,15 +326,18 @@ void Literal::print(std::ostream &stream, const std::string &) const
 Range::Range(Expression *begin, Expression *end, const Location &loc)
 	: Expression(loc), begin(begin), end(end)
 {
+	if (this->begin->isConstant() && this->end->isConstant()) fold();
 }
 
 Range::Range(Expression *begin, Expression *step, Expression *end, const Location &loc)
 	: Expression(loc), begin(begin), step(step), end(end)
 {
+	if (this->begin->isConstant() && this->step->isConstant() && this->end->isConstant()) fold();
 }
 
 ValuePtr Range::evaluate(const Context *context) const
 {
+	if (this->folded) return this->constant;
 	ValuePtr beginValue = this->begin->evaluate(context);
 	if (beginValue->type() == Value::ValueType::NUMBER) {
 		ValuePtr endValue = this->end->evaluate(context);
@@ -353,21 +394,28 @@ void Vector::push_back(Expression *expr)
 	this->children.push_back(shared_ptr<Expression>(expr));
 }
 
+void Vector::finish()
+{
+	for (const auto &e : this->children) {
+		if (!e->isConstant()) return;
+	}
+	fold();
+}
+
 ValuePtr Vector::evaluate(const Context *context) const
 {
+	if (this->folded) return this->constant;
+	// [for (...) ...] is the vector the list comprehension made already
+	if (this->children.size() == 1 && isListComprehension(this->children[0])) {
+		return this->children[0]->evaluate(context);
+	}
+
 	Value::VectorType vec;
+	vec.reserve(this->children.size());
 	for(const auto &e : this->children) {
-		ValuePtr tmpval = e->evaluate(context);
-		if (isListComprehension(e)) {
-			const Value::VectorType result = tmpval->toVector();
-			for (size_t i = 0;i < result.size();i++) {
-				vec.push_back(result[i]);
-			}
-		} else {
-			vec.push_back(tmpval);
-		}
+		append_elements(e, context, vec);
 	}
-	return ValuePtr(vec);
+	return ValuePtr(std::move(vec));
 }
 
 void Vector::print(std::ostream &stream, const std::string &) const
@@ -456,10 +504,12 @@ static void NOINLINE print_trace(const FunctionCall *val, const Context *ctx){
 
 ValuePtr FunctionCall::evaluate(const Context *context) const
 {
+	TRACE_ZONE("FunctionCall::evaluate");
 	if (StackCheck::inst().check()) {
 		print_err(this->name.c_str(),loc,context);
 		throw RecursionException::create("function", this->name,this->loc);
 	}
+	JobLimits::Call call;
 	try{
 		EvalContext c(context, this->arguments, this->loc);
 		ValuePtr result = context->evaluate_function(this->name, &c);
@@ -558,25 +608,22 @@ ListComprehension::ListComprehension(const Location &loc) : Expression(loc)
 {
 }
 
+ValuePtr ListComprehension::evaluate(const Context *context) const
+{
+	Value::VectorType vec;
+	evaluateInto(context, vec);
+	return ValuePtr(std::move(vec));
+}
+
 LcIf::LcIf(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc)
 	: ListComprehension(loc), cond(cond), ifexpr(ifexpr), elseexpr(elseexpr)
 {
 }
 
-ValuePtr LcIf::evaluate(const Context *context) const
+void LcIf::evaluateInto(const Context *context, Value::VectorType &vec) const
 {
     const shared_ptr<Expression> &expr = this->cond->evaluate(context) ? this->ifexpr : this->elseexpr;
-	
-    Value::VectorType vec;
-    if (expr) {
-        if (isListComprehension(expr)) {
-            return expr->evaluate(context);
-        } else {
-           vec.push_back(expr->evaluate(context));
-        }
-    }
-
-    return ValuePtr(vec);
+    if (expr) append_elements(expr, context, vec);
 }
 
 void LcIf::print(std::ostream &stream, const std::string &) const
@@ -593,25 +640,54 @@ LcEach::LcEach(Expression *expr, const Location &loc) : ListComprehension(loc),
 
 ValuePtr LcEach::evaluate(const Context *context) const
 {
-	Value::VectorType vec;
+    if (!isListComprehension(this->expr)) {
+        ValuePtr v = this->expr->evaluate(context);
+        // The elements are the vector's own, so share it instead of copying
+        if (v->type() == Value::ValueType::VECTOR) return v;
+        Value::VectorType vec;
+        append_each(v, context, vec);
+        return ValuePtr(std::move(vec));
+    }
+    return ListComprehension::evaluate(context);
+}
 
-    ValuePtr v = this->expr->evaluate(context);
+void LcEach::evaluateInto(const Context *context, Value::VectorType &vec) const
+{
+    if (isListComprehension(this->expr)) {
+        // each flattens the elements of the nested list comprehension once more
+        Value::VectorType elements;
+        static_cast<const ListComprehension *>(this->expr.get())->evaluateInto(context, elements);
+        for (const auto &e : elements) {
+            if (e->type() == Value::ValueType::VECTOR) {
+                vec.insert(vec.end(), e->toVector().begin(), e->toVector().end());
+            } else {
+                vec.push_back(e);
+            }
+        }
+    } else {
+        append_each(this->expr->evaluate(context), context, vec);
+    }
+}
 
+/*!
+	Appends the elements of v to vec: the numbers of a range, the
+	elements of a vector, or the characters of a string.
+*/
+void LcEach::append_each(const ValuePtr &v, const Context *context, Value::VectorType &vec) const
+{
     if (v->type() == Value::ValueType::RANGE) {
         RangeType range = v->toRange();
         uint32_t steps = range.numValues();
         if (steps >= 1000000) {
             PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu), %s", steps % loc.toRelativeString(context->documentPath()));
         } else {
+            reserve_more(vec, steps);
             for (RangeType::iterator it = range.begin();it != range.end();it++) {
                 vec.push_back(ValuePtr(*it));
             }
         }
     } else if (v->type() == Value::ValueType::VECTOR) {
-        Value::VectorType vector = v->toVector();
-        for (size_t i = 0; i < v->toVector().size(); i++) {
-            vec.push_back(vector[i]);
-        }
+        vec.insert(vec.end(), v->toVector().begin(), v->toVector().end());
     } else if (v->type() == Value::ValueType::STRING) {
         utf8_split(v->toString(), [&](ValuePtr v) {
             vec.push_back(v);
@@ -619,12 +695,6 @@ ValuePtr LcEach::evaluate(const Context *context) const
     } else if (v->type() != Value::ValueType::UNDEFINED) {
         vec.push_back(v);
     }
-
-    if (isListComprehension(this->expr)) {
-        return ValuePtr(flatten(vec));
-    } else {
-        return ValuePtr(vec);
-    }
 }
 
 void LcEach::print(std::ostream &stream, const std::string &) const
@@ -637,10 +707,8 @@ LcFor::LcFor(const AssignmentList &args, Expression *expr, const Location &loc)
 {
 }
 
-ValuePtr LcFor::evaluate(const Context *context) const
+void LcFor::evaluateInto(const Context *context, Value::VectorType &vec) const
 {
-	Value::VectorType vec;
-
     EvalContext for_context(context, this->arguments, this->loc);
 
     Context assign_context(context);
@@ -650,6 +718,8 @@ ValuePtr LcFor::evaluate(const Context *context) const
     ValuePtr it_values = for_context.getArgValue(0, &assign_context);
 
     Context c(context);
+    // Without a nested list comprehension, each iteration yields one element
+    const bool single = !isListComprehension(this->expr);
 
     if (it_values->type() == Value::ValueType::RANGE) {
         RangeType range = it_values->toRange();
@@ -657,30 +727,27 @@ ValuePtr LcFor::evaluate(const Context *context) const
         if (steps >= 1000000) {
             PRINTB("WARNING: Bad range parameter in for statement: too many elements (%lu), %s", steps % loc.toRelativeString(context->documentPath()));
         } else {
+            if (single) reserve_more(vec, steps);
             for (RangeType::iterator it = range.begin();it != range.end();it++) {
                 c.set_variable(it_name, ValuePtr(*it));
-                vec.push_back(this->expr->evaluate(&c));
+                append_elements(this->expr, &c, vec);
             }
         }
     } else if (it_values->type() == Value::ValueType::VECTOR) {
-        for (size_t i = 0; i < it_values->toVector().size(); i++) {
-            c.set_variable(it_name, it_values->toVector()[i]);
-            vec.push_back(this->expr->evaluate(&c));
+        const Value::VectorType &values = it_values->toVector();
+        if (single) reserve_more(vec, values.size());
+        for (size_t i = 0; i < values.size(); i++) {
+            c.set_variable(it_name, values[i]);
+            append_elements(this->expr, &c, vec);
         }
     } else if (it_values->type() == Value::ValueType::STRING) {
         utf8_split(it_values->toString(), [&](ValuePtr v) {
             c.set_variable(it_name, v);
-            vec.push_back(this->expr->evaluate(&c));
+            append_elements(this->expr, &c, vec);
         });
     } else if (it_values->type() != Value::ValueType::UNDEFINED) {
         c.set_variable(it_name, it_values);
-        vec.push_back(this->expr->evaluate(&c));
-    }
-
-    if (isListComprehension(this->expr)) {
-        return ValuePtr(flatten(vec));
-    } else {
-        return ValuePtr(vec);
+        append_elements(this->expr, &c, vec);
     }
 }
 
@@ -694,16 +761,14 @@ LcForC::LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expre
 {
 }
 
-ValuePtr LcForC::evaluate(const Context *context) const
+void LcForC::evaluateInto(const Context *context, Value::VectorType &vec) const
 {
-	Value::VectorType vec;
-
     Context c(context);
     evaluate_sequential_assignment(this->arguments, &c, this->loc);
 
 	unsigned int counter = 0;
     while (this->cond->evaluate(&c)) {
-        vec.push_back(this->expr->evaluate(&c));
+        append_elements(this->expr, &c, vec);
 
         if (counter++ == 1000000) {
             std::string locs = loc.toRelativeString(context->documentPath());
@@ -715,12 +780,6 @@ ValuePtr LcForC::evaluate(const Context *context) const
         evaluate_sequential_assignment(this->incr_arguments, &tmp, this->loc);
         c.apply_variables(tmp);
     }    
-
-    if (isListComprehension(this->expr)) {
-        return ValuePtr(flatten(vec));
-    } else {
-        return ValuePtr(vec);
-    }
 }
 
 void LcForC::print(std::ostream &stream, const std::string &) const
@@ -737,11 +796,11 @@ LcLet::LcLet(const AssignmentList &args, Expression *expr, const Location &loc)
 {
 }
 
-ValuePtr LcLet::evaluate(const Context *context) const
+void LcLet::evaluateInto(const Context *context, Value::VectorType &vec) const
 {
     Context c(context);
     evaluate_sequential_assignment(this->arguments, &c, this->loc);
-    return this->expr->evaluate(&c);
+    append_elements(this->expr, &c, vec);
 }
 
 void LcLet::print(std::ostream &stream, const std::string &) const
@@ -2,19 +2,33 @@
 
 #include "AST.h"
 
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "value.h"
 #include "memory.h"
 #include "Assignment.h"
+#include "VariableName.h"
 
 class Expression : public ASTNode
 {
 public:
-	Expression(const Location &loc) : ASTNode(loc) {}
+	Expression(const Location &loc) : ASTNode(loc), folded(false) {}
 	~Expression() {}
 	virtual bool isLiteral() const;
+	// True if the value doesn't depend on the context, see fold()
+	bool isConstant() const { return this->folded; }
+	const ValuePtr &constantValue() const { return this->constant; }
 	virtual ValuePtr evaluate(const class Context *context) const = 0;
+
+protected:
+	void fold();
+
+	// The value of a constant expression, computed once when parsing
+	ValuePtr constant;
+	bool folded;
 };
 
 class UnaryOp : public Expression
@@ -30,6 +44,8 @@ public:
 	void print(std::ostream &stream, const std::string &indent) const override;
 
 private:
+	friend class ASTCache;
+	friend class NumericProgram;
 	const char *opString() const;
 
 	Op op;
@@ -56,15 +72,24 @@ public:
 	};
 
 	BinaryOp(Expression *left, Op op, Expression *right, const Location &loc);
+	~BinaryOp();
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 
 private:
+	friend class ASTCache;
+	friend class NumericProgram;
 	const char *opString() const;
+	ValuePtr evaluateOperands(const class Context *context) const;
 
 	Op op;
 	shared_ptr<Expression> left;
 	shared_ptr<Expression> right;
+
+	// Compiled on first evaluation, and dropped once a variable wasn't a number
+	mutable std::once_flag compiled;
+	mutable std::unique_ptr<class NumericProgram> program;
+	mutable std::atomic<bool> numeric;
 };
 
 class TernaryOp : public Expression
@@ -86,6 +111,7 @@ public:
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	shared_ptr<Expression> array;
 	shared_ptr<Expression> index;
 };
@@ -98,6 +124,8 @@ public:
 	void print(std::ostream &stream, const std::string &indent) const override;
 	bool isLiteral() const override { return true;}
 private:
+	friend class ASTCache;
+	friend class NumericProgram;
 	ValuePtr value;
 };
 
@@ -110,6 +138,7 @@ public:
 	void print(std::ostream &stream, const std::string &indent) const override;
 	bool isLiteral() const override;
 private:
+	friend class ASTCache;
 	shared_ptr<Expression> begin;
 	shared_ptr<Expression> step;
 	shared_ptr<Expression> end;
@@ -122,8 +151,11 @@ public:
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 	void push_back(Expression *expr);
+	// Called by the parser once all elements are added
+	void finish();
 	bool isLiteral() const override;
 private:
+	friend class ASTCache;
 	std::vector<shared_ptr<Expression>> children;
 };
 
@@ -135,7 +167,9 @@ public:
 	ValuePtr evaluateSilently(const class Context *context) const;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
-	std::string name;
+	friend class ASTCache;
+	friend class NumericProgram;
+	VariableName name;
 };
 
 class MemberLookup : public Expression
@@ -145,6 +179,7 @@ public:
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	shared_ptr<Expression> expr;
 	std::string member;
 };
@@ -168,6 +203,7 @@ public:
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -179,6 +215,7 @@ public:
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -189,7 +226,7 @@ public:
 	Let(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
-private:
+
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -199,15 +236,22 @@ class ListComprehension : public Expression
 public:
 	ListComprehension(const Location &loc);
 	~ListComprehension() = default;
+	ValuePtr evaluate(const class Context *context) const override;
+	/*!
+		Appends the elements to vec. Nested list comprehensions append to the
+		same vector, instead of each building a vector to be flattened.
+	*/
+	virtual void evaluateInto(const class Context *context, Value::VectorType &vec) const = 0;
 };
 
 class LcIf : public ListComprehension
 {
 public:
 	LcIf(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc);
-	ValuePtr evaluate(const class Context *context) const override;
+	void evaluateInto(const class Context *context, Value::VectorType &vec) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	shared_ptr<Expression> cond;
 	shared_ptr<Expression> ifexpr;
 	shared_ptr<Expression> elseexpr;
@@ -217,9 +261,10 @@ class LcFor : public ListComprehension
 {
 public:
 	LcFor(const AssignmentList &args, Expression *expr, const Location &loc);
-	ValuePtr evaluate(const class Context *context) const override;
+	void evaluateInto(const class Context *context, Value::VectorType &vec) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -228,9 +273,10 @@ class LcForC : public ListComprehension
 {
 public:
 	LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expression *cond, Expression *expr, const Location &loc);
-	ValuePtr evaluate(const class Context *context) const override;
+	void evaluateInto(const class Context *context, Value::VectorType &vec) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	AssignmentList arguments;
 	AssignmentList incr_arguments;
 	shared_ptr<Expression> cond;
@@ -242,8 +288,12 @@ class LcEach : public ListComprehension
 public:
 	LcEach(Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const override;
+	void evaluateInto(const class Context *context, Value::VectorType &vec) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
+	void append_each(const ValuePtr &v, const class Context *context, Value::VectorType &vec) const;
+
 	shared_ptr<Expression> expr;
 };
 
@@ -251,9 +301,10 @@ class LcLet : public ListComprehension
 {
 public:
 	LcLet(const AssignmentList &args, Expression *expr, const Location &loc);
-	ValuePtr evaluate(const class Context *context) const override;
+	void evaluateInto(const class Context *context, Value::VectorType &vec) const override;
 	void print(std::ostream &stream, const std::string &indent) const override;
 private:
+	friend class ASTCache;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -25,6 +25,7 @@
  */
 
 #include "function.h"
+#include "FunctionCache.h"
 #include "expression.h"
 #include "evalcontext.h"
 #include "builtin.h"
@@ -34,12 +35,17 @@
 #include "memory.h"
 #include "UserModule.h"
 #include "degree_trig.h"
+#include "ShardedCache.h"
 
 #include <cmath>
 #include <sstream>
 #include <ctime>
 #include <limits>
 #include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <boost/functional/hash.hpp>
 
 /*
  Random numbers
@@ -67,6 +73,8 @@ int process_id = getpid();
 
 boost::mt19937 deterministic_rng;
 boost::mt19937 lessdeterministic_rng( std::time(nullptr) + process_id );
+// Guards both generators, as for() may evaluate iterations concurrently
+std::mutex rng_mutex;
 
 static void print_argCnt_warning(const char *name, const Context *ctx, const EvalContext *evalctx){
 	PRINTB("WARNING: %s() number of parameters does not match, %s", name % evalctx->loc.toRelativeString(ctx->documentPath()));
@@ -143,28 +151,30 @@ ValuePtr builtin_rands(const Context *ctx, const EvalContext *evalctx)
 		size_t numresults = boost_numeric_cast<size_t,double>( numresultsd );
 
 		bool deterministic = false;
-		if (n > 3) {
-			ValuePtr v3 = evalctx->getArgValue(3);
-			if (v3->type() != Value::ValueType::NUMBER) goto quit;
-			uint32_t seed = static_cast<uint32_t>(hash_floating_point( v3->toDouble() ));
-			deterministic_rng.seed( seed );
-			deterministic = true;
-		}
-		Value::VectorType vec;
-		if (min==max) { // Boost doesn't allow min == max
-			for (size_t i=0; i < numresults; i++)
-				vec.push_back(ValuePtr(min));
-		} else {
-			boost::uniform_real<> distributor( min, max );
-			for (size_t i=0; i < numresults; i++) {
-				if ( deterministic ) {
-					vec.push_back(ValuePtr(distributor(deterministic_rng)));
-				} else {
-					vec.push_back(ValuePtr(distributor(lessdeterministic_rng)));
-				}
+		ValuePtr v3 = n > 3 ? evalctx->getArgValue(3) : ValuePtr::undefined;
+		if (n > 3 && v3->type() != Value::ValueType::NUMBER) goto quit;
+		// Boost doesn't allow min == max. Values are immutable, so one is shared by all results.
+		if (min==max) return ValuePtr(std::vector<ValuePtr>(numresults, ValuePtr(min)));
+
+		// The numbers are drawn in one go, the lock isn't held while boxing them
+		std::vector<double> numbers(numresults);
+		{
+			std::lock_guard<std::mutex> lock(rng_mutex);
+			if (n > 3) {
+				uint32_t seed = static_cast<uint32_t>(hash_floating_point( v3->toDouble() ));
+				deterministic_rng.seed( seed );
+				deterministic = true;
 			}
+			boost::mt19937 &rng = deterministic ? deterministic_rng : lessdeterministic_rng;
+			boost::uniform_real<> distributor( min, max );
+			for (auto &number : numbers) number = distributor(rng);
 		}
-		return ValuePtr(vec);
+		// Unseeded results must not be memoized
+		if (!deterministic) FunctionCache::Tracker::taint();
+		Value::VectorType vec;
+		vec.reserve(numresults);
+		for (const auto number : numbers) vec.emplace_back(number);
+		return ValuePtr(std::move(vec));
 	}else{
 		print_argCnt_warning("rands", ctx, evalctx);
 	}
@@ -448,8 +458,7 @@ ValuePtr builtin_length(const Context *ctx, const EvalContext *evalctx)
 		if (v->type() == Value::ValueType::VECTOR) return ValuePtr(int(v->toVector().size()));
 		if (v->type() == Value::ValueType::STRING) {
 			//Unicode glyph count for the length -- rather than the string (num. of bytes) length.
-			std::string text = v->toString();
-			return ValuePtr(int( g_utf8_strlen( text.c_str(), text.size() ) ));
+			return ValuePtr(int(v->toStrUtf8Wrapper().get_utf8_strlen()));
 		}
 		print_argConvert_warning("len", ctx, evalctx);
 	}else{
@@ -498,12 +507,23 @@ ValuePtr builtin_ln(const Context *ctx, const EvalContext *evalctx)
 
 ValuePtr builtin_str(const Context *, const EvalContext *evalctx)
 {
-	std::ostringstream stream;
+	// Strings are concatenated without copying them, see str_utf8_wrapper
+	str_utf8_wrapper result;
+	std::string str;
 
 	for (size_t i = 0; i < evalctx->numArgs(); i++) {
-		stream << evalctx->getArgValue(i)->toString();
+		ValuePtr v = evalctx->getArgValue(i);
+		if (v->type() == Value::ValueType::STRING) {
+			if (!str.empty()) result = str_utf8_wrapper::concat(result, str_utf8_wrapper(std::move(str)));
+			str.clear();
+			result = str_utf8_wrapper::concat(result, v->toStrUtf8Wrapper());
+		}
+		else {
+			v->appendString(str);
+		}
 	}
-	return ValuePtr(stream.str());
+	if (!str.empty()) result = str_utf8_wrapper::concat(result, str_utf8_wrapper(std::move(str)));
+	return ValuePtr(result);
 }
 
 ValuePtr builtin_chr(const Context *, const EvalContext *evalctx)
@@ -529,20 +549,19 @@ ValuePtr builtin_ord(const Context *ctx, const EvalContext *evalctx)
 	}
 
 	const ValuePtr& arg = evalctx->getArgValue(0);
-	const std::string arg_str = arg->toString();
-	const char *ptr = arg_str.c_str();
-
 	if (arg->type() != Value::ValueType::STRING) {
-		PRINTB("WARNING: ord() argument %s is not of type string, %s", arg_str % evalctx->loc.toRelativeString(ctx->documentPath()));
+		PRINTB("WARNING: ord() argument %s is not of type string, %s", arg->toString() % evalctx->loc.toRelativeString(ctx->documentPath()));
 		return ValuePtr::undefined;
 	}
 
+	const str_utf8_wrapper &arg_str = arg->toStrUtf8Wrapper();
+	const char *ptr = arg_str.c_str();
 	if (!g_utf8_validate(ptr, -1, NULL)) {
-		PRINTB("WARNING: ord() argument '%s' is not valid utf8 string, %s", arg_str % evalctx->loc.toRelativeString(ctx->documentPath()));
+		PRINTB("WARNING: ord() argument '%s' is not valid utf8 string, %s", arg_str.toString() % evalctx->loc.toRelativeString(ctx->documentPath()));
 		return ValuePtr::undefined;
 	}
 
-	if (g_utf8_strlen(ptr, -1) == 0) {
+	if (arg_str.empty()) {
 		return ValuePtr::undefined;
 	}
 	const gunichar ch = g_utf8_get_char(ptr);
@@ -551,19 +570,157 @@ ValuePtr builtin_ord(const Context *ctx, const EvalContext *evalctx)
 
 ValuePtr builtin_concat(const Context *, const EvalContext *evalctx)
 {
-	Value::VectorType result;
-
+	std::vector<ValuePtr> args;
+	args.reserve(evalctx->numArgs());
+	size_t size = 0;
+	size_t numnonempty = 0;
+	size_t nonempty = 0;
 	for (size_t i = 0; i < evalctx->numArgs(); i++) {
-		ValuePtr val = evalctx->getArgValue(i);
+		args.push_back(evalctx->getArgValue(i));
+		const size_t n = args[i]->type() == Value::ValueType::VECTOR ? args[i]->toVector().size() : 1;
+		if (n > 0) {
+			size += n;
+			numnonempty++;
+			nonempty = i;
+		}
+	}
+	// A vector concatenated with empty ones is that vector, so share it
+	if (numnonempty == 1 && args[nonempty]->type() == Value::ValueType::VECTOR) return args[nonempty];
+
+	Value::VectorType result;
+	result.reserve(size);
+	for (const auto &val : args) {
 		if (val->type() == Value::ValueType::VECTOR) {
-			for(const auto &v : val->toVector()) { 
-				result.push_back(v);
-			}
+			result.insert(result.end(), val->toVector().begin(), val->toVector().end());
 		} else {
 			result.push_back(val);
 		}
 	}
-	return ValuePtr(result);
+	return ValuePtr(std::move(result));
+}
+
+/*
+	Indices of the large tables given to search() and lookup(), so repeated
+	calls with the same table don't have to scan it each time. They are
+	built on first use and kept for the table Value, identified by its
+	address; a weak reference detects another table reusing the address.
+	Values are immutable, so an index never has to be updated.
+*/
+namespace {
+	const size_t table_index_min_rows = 64;
+	// Total rows of the cached indices
+	const size_t table_index_max_rows = 10*1000*1000;
+
+	// Consistent with Value::operator==: the same type and the same value
+	size_t value_hash(const Value &v)
+	{
+		size_t seed = size_t(v.type());
+		switch (v.type()) {
+		case Value::ValueType::BOOL:
+			boost::hash_combine(seed, v.toBool());
+			break;
+		case Value::ValueType::NUMBER: {
+			const double d = v.toDouble();
+			boost::hash_combine(seed, d == 0 ? 0.0 : d); // -0 == 0
+			break;
+		}
+		case Value::ValueType::STRING:
+			boost::hash_combine(seed, v.toString());
+			break;
+		case Value::ValueType::VECTOR:
+			for (const auto &e : v.toVector()) boost::hash_combine(seed, value_hash(*e));
+			break;
+		default:
+			break;
+		}
+		return seed;
+	}
+
+	struct ValueHash {
+		size_t operator()(const Value *v) const { return value_hash(*v); }
+	};
+	struct ValueEqual {
+		bool operator()(const Value *a, const Value *b) const { return *a == *b; }
+	};
+
+	// The rows of a table by the value searched for, in ascending order
+	typedef std::unordered_map<const Value *, std::vector<size_t>, ValueHash, ValueEqual> SearchIndex;
+	// The points of a table sorted by position, with earlier rows first where they are equal
+	typedef std::vector<std::pair<double, double>> LookupIndex;
+
+	struct TableKey {
+		const Value *table;
+		unsigned int column;
+		bool operator==(const TableKey &other) const { return table == other.table && column == other.column; }
+		struct Hash {
+			size_t operator()(const TableKey &key) const {
+				size_t seed = std::hash<const Value *>()(key.table);
+				boost::hash_combine(seed, key.column);
+				return seed;
+			}
+		};
+	};
+
+	template <class Index> struct CachedIndex {
+		std::weak_ptr<const Value> table;
+		// nullptr if the table can't be indexed
+		shared_ptr<const Index> index;
+	};
+
+	template <class Index>
+	shared_ptr<const Index> cached_index(ShardedCache<TableKey, CachedIndex<Index>, TableKey::Hash> &cache,
+																			 const ValuePtr &table, unsigned int column,
+																			 const std::function<shared_ptr<const Index>()> &build)
+	{
+		const TableKey key{table.get(), column};
+		CachedIndex<Index> entry;
+		if (cache.get(key, entry) && entry.table.lock() == table) return entry.index;
+		entry.table = table;
+		entry.index = build();
+		cache.insert(key, entry, table->toVector().size());
+		return entry.index;
+	}
+
+	ShardedCache<TableKey, CachedIndex<SearchIndex>, TableKey::Hash> search_indices(table_index_max_rows);
+	ShardedCache<TableKey, CachedIndex<LookupIndex>, TableKey::Hash> lookup_indices(table_index_max_rows);
+
+	shared_ptr<const LookupIndex> lookup_index(const ValuePtr &table)
+	{
+		if (table->toVector().size() < table_index_min_rows) return nullptr;
+		return cached_index<LookupIndex>(lookup_indices, table, 0, [&table]() -> shared_ptr<const LookupIndex> {
+			auto index = make_shared<LookupIndex>();
+			for (const auto &row : table->toVector()) {
+				double p, v;
+				if (!row->getVec2(p, v)) continue;
+				// The scan treats NaN positions in its own way
+				if (std::isnan(p)) return nullptr;
+				index->emplace_back(p, v);
+			}
+			std::stable_sort(index->begin(), index->end(), [](const std::pair<double, double> &a, const std::pair<double, double> &b) {
+				return a.first < b.first;
+			});
+			return index;
+		});
+	}
+
+	shared_ptr<const SearchIndex> search_index(const ValuePtr &table, unsigned int column)
+	{
+		if (table->type() != Value::ValueType::VECTOR || table->toVector().size() < table_index_min_rows) return nullptr;
+		return cached_index<SearchIndex>(search_indices, table, column, [&table, column]() {
+			auto index = make_shared<SearchIndex>();
+			const auto &rows = table->toVector();
+			for (size_t j = 0; j < rows.size(); ++j) {
+				// See search_rows() for what matches
+				if (column == 0) (*index)[rows[j].get()].push_back(j);
+				const auto &row = rows[j]->toVector();
+				if (column < row.size()) {
+					auto &matches = (*index)[row[column].get()];
+					if (matches.empty() || matches.back() != j) matches.push_back(j);
+				}
+			}
+			return shared_ptr<const SearchIndex>(index);
+		});
+	}
 }
 
 ValuePtr builtin_lookup(const Context *ctx, const EvalContext *evalctx)
@@ -585,16 +742,34 @@ ValuePtr builtin_lookup(const Context *ctx, const EvalContext *evalctx)
 
 	if (!vec[0]->getVec2(low_p, low_v) || !vec[0]->getVec2(high_p, high_v))
 		return ValuePtr::undefined;
-	for (size_t i = 1; i < vec.size(); i++) {
-		double this_p, this_v;
-		if (vec[i]->getVec2(this_p, this_v)) {
-			if (this_p <= p && (this_p > low_p || low_p > p)) {
-				low_p = this_p;
-				low_v = this_v;
-			}
-			if (this_p >= p && (this_p < high_p || high_p < p)) {
-				high_p = this_p;
-				high_v = this_v;
+	if (auto index = lookup_index(v1)) {
+		// The nearest points below and above p, the first of several at the same position
+		typedef std::pair<double, double> Point;
+		auto byPosition = [](const Point &a, const Point &b) { return a.first < b.first; };
+		auto above = std::upper_bound(index->begin(), index->end(), Point(p, 0), byPosition);
+		if (above != index->begin()) {
+			auto low = std::lower_bound(index->begin(), index->end(), *std::prev(above), byPosition);
+			low_p = low->first;
+			low_v = low->second;
+		}
+		auto high = std::lower_bound(index->begin(), index->end(), Point(p, 0), byPosition);
+		if (high != index->end()) {
+			high_p = high->first;
+			high_v = high->second;
+		}
+	}
+	else {
+		for (size_t i = 1; i < vec.size(); i++) {
+			double this_p, this_v;
+			if (vec[i]->getVec2(this_p, this_v)) {
+				if (this_p <= p && (this_p > low_p || low_p > p)) {
+					low_p = this_p;
+					low_v = this_v;
+				}
+				if (this_p >= p && (this_p < high_p || high_p < p)) {
+					high_p = this_p;
+					high_v = this_v;
+				}
 			}
 		}
 	}
@@ -656,21 +831,30 @@ ValuePtr builtin_lookup(const Context *ctx, const EvalContext *evalctx)
 
 */
 
+// The unicode characters of str, decoded once rather than at each index
+static std::vector<gunichar> utf8_chars(const str_utf8_wrapper &str)
+{
+	std::vector<gunichar> chars;
+	chars.reserve(str.get_utf8_strlen());
+	const char *ptr = str.c_str();
+	for (glong i = 0; i < str.get_utf8_strlen(); i++, ptr = g_utf8_next_char(ptr)) {
+		chars.push_back(g_utf8_get_char(ptr));
+	}
+	return chars;
+}
+
 static Value::VectorType search(const str_utf8_wrapper &find, const str_utf8_wrapper &table,
 																unsigned int num_returns_per_match,
 																const Location &, const Context *)
 {
 	Value::VectorType returnvec;
-	//Unicode glyph count for the length
-	size_t findThisSize = find.get_utf8_strlen();
-	size_t searchTableSize = table.get_utf8_strlen();
-	for (size_t i = 0; i < findThisSize; i++) {
+	const auto findChars = utf8_chars(find);
+	const auto tableChars = utf8_chars(table);
+	for (size_t i = 0; i < findChars.size(); i++) {
 		unsigned int matchCount = 0;
 		Value::VectorType resultvec;
-		const gchar *ptr_ft = g_utf8_offset_to_pointer(find.c_str(), i);
-		for (size_t j = 0; j < searchTableSize; j++) {
-			const gchar *ptr_st = g_utf8_offset_to_pointer(table.c_str(), j);
-			if (ptr_ft && ptr_st && (g_utf8_get_char(ptr_ft) == g_utf8_get_char(ptr_st)) ) {
+		for (size_t j = 0; j < tableChars.size(); j++) {
+			if (findChars[i] == tableChars[j]) {
 				matchCount++;
 				if (num_returns_per_match == 1) {
 					returnvec.push_back(ValuePtr(double(j)));
@@ -683,10 +867,6 @@ static Value::VectorType search(const str_utf8_wrapper &find, const str_utf8_wra
 				}
 			}
 		}
-		if (matchCount == 0) {
-			gchar utf8_of_cp[6] = ""; //A buffer for a single unicode character to be copied into
-			if (ptr_ft) g_utf8_strncpy(utf8_of_cp, ptr_ft, 1);
-		}
 		if (num_returns_per_match == 0 || num_returns_per_match > 1) {
 			returnvec.push_back(ValuePtr(resultvec));
 		}
@@ -698,21 +878,19 @@ static Value::VectorType search(const str_utf8_wrapper &find, const Value::Vecto
 																unsigned int num_returns_per_match, unsigned int index_col_num, const Location &loc, const Context *ctx)
 {
 	Value::VectorType returnvec;
-	//Unicode glyph count for the length
-	unsigned int findThisSize =  find.get_utf8_strlen();
+	const auto findChars = utf8_chars(find);
 	unsigned int searchTableSize = table.size();
-	for (size_t i = 0; i < findThisSize; i++) {
+	for (size_t i = 0; i < findChars.size(); i++) {
 		unsigned int matchCount = 0;
 		Value::VectorType resultvec;
-		const gchar *ptr_ft = g_utf8_offset_to_pointer(find.c_str(), i);
 		for (size_t j = 0; j < searchTableSize; j++) {
 			const Value::VectorType &entryVec = table[j]->toVector();
 			if (entryVec.size() <= index_col_num) {
 				PRINTB("WARNING: Invalid entry in search vector at index %d, required number of values in the entry: %d. Invalid entry: %s, %s", j % (index_col_num + 1) % table[j]->toEchoString() % loc.toRelativeString(ctx->documentPath()));
 				return Value::VectorType();
 			}
-			const gchar *ptr_st = g_utf8_offset_to_pointer(entryVec[index_col_num]->toString().c_str(), 0);
-			if (ptr_ft && ptr_st && (g_utf8_get_char(ptr_ft) == g_utf8_get_char(ptr_st)) ) {
+			const std::string entry = entryVec[index_col_num]->toString();
+			if (findChars[i] == g_utf8_get_char(entry.c_str())) {
 				matchCount++;
 				if (num_returns_per_match == 1) {
 					returnvec.push_back(ValuePtr(double(j)));
@@ -727,7 +905,7 @@ static Value::VectorType search(const str_utf8_wrapper &find, const Value::Vecto
 		}
 		if (matchCount == 0) {
 			gchar utf8_of_cp[6] = ""; //A buffer for a single unicode character to be copied into
-			if (ptr_ft) g_utf8_strncpy(utf8_of_cp, ptr_ft, 1);
+			g_unichar_to_utf8(findChars[i], utf8_of_cp);
 			PRINTB("  WARNING: search term not found: \"%s\", %s", utf8_of_cp % loc.toRelativeString(ctx->documentPath()));
 		}
 		if (num_returns_per_match == 0 || num_returns_per_match > 1) {
@@ -737,6 +915,33 @@ static Value::VectorType search(const str_utf8_wrapper &find, const Value::Vecto
 	return returnvec;
 }
 
+/*!
+	Calls match with the index of each row of table matching needle, in
+	ascending order, until it returns false. A row matches if the value in
+	its column index_col_num equals needle, or with index_col_num 0 if the
+	row itself equals needle. Large tables are looked up in an index.
+*/
+static void search_rows(const ValuePtr &needle, const ValuePtr &table, unsigned int index_col_num,
+												const std::function<bool(size_t)> &match)
+{
+	if (auto index = search_index(table, index_col_num)) {
+		auto rows = index->find(needle.get());
+		if (rows == index->end()) return;
+		for (const auto j : rows->second) {
+			if (!match(j)) break;
+		}
+		return;
+	}
+	for (size_t j = 0; j < table->toVector().size(); j++) {
+		const ValuePtr &search_element = table->toVector()[j];
+		if ((index_col_num == 0 && needle == search_element) ||
+				(index_col_num < search_element->toVector().size() &&
+				 needle        == search_element->toVector()[index_col_num])) {
+			if (!match(j)) break;
+		}
+	}
+}
+
 ValuePtr builtin_search(const Context *ctx, const EvalContext *evalctx)
 {
 	if (evalctx->numArgs() < 2){
@@ -754,23 +959,17 @@ ValuePtr builtin_search(const Context *ctx, const EvalContext *evalctx)
 	if (findThis->type() == Value::ValueType::NUMBER) {
 		unsigned int matchCount = 0;
 
-		for (size_t j = 0; j < searchTable->toVector().size(); j++) {
-			const ValuePtr &search_element = searchTable->toVector()[j];
-
-			if ((index_col_num == 0 && findThis == search_element) ||
-					(index_col_num < search_element->toVector().size() &&
-					 findThis      == search_element->toVector()[index_col_num])) {
-				returnvec.push_back(ValuePtr(double(j)));
-				matchCount++;
-				if (num_returns_per_match != 0 && matchCount >= num_returns_per_match) break;
-			}
-		}
+		search_rows(findThis, searchTable, index_col_num, [&](size_t j) {
+			returnvec.push_back(ValuePtr(double(j)));
+			matchCount++;
+			return num_returns_per_match == 0 || matchCount < num_returns_per_match;
+		});
 	} else if (findThis->type() == Value::ValueType::STRING) {
 		if (searchTable->type() == Value::ValueType::STRING) {
-			returnvec = search(findThis->toString(), searchTable->toString(), num_returns_per_match, evalctx->loc, ctx);
+			returnvec = search(findThis->toStrUtf8Wrapper(), searchTable->toStrUtf8Wrapper(), num_returns_per_match, evalctx->loc, ctx);
 		}
 		else {
-			returnvec = search(findThis->toString(), searchTable->toVector(), num_returns_per_match, index_col_num, evalctx->loc, ctx);
+			returnvec = search(findThis->toStrUtf8Wrapper(), searchTable->toVector(), num_returns_per_match, index_col_num, evalctx->loc, ctx);
 		}
 	} else if (findThis->type() == Value::ValueType::VECTOR) {
 		for (size_t i = 0; i < findThis->toVector().size(); i++) {
@@ -779,24 +978,16 @@ ValuePtr builtin_search(const Context *ctx, const EvalContext *evalctx)
 
 			const ValuePtr &find_value = findThis->toVector()[i];
 
-			for (size_t j = 0; j < searchTable->toVector().size(); j++) {
-
-				const ValuePtr &search_element = searchTable->toVector()[j];
-
-				if ((index_col_num == 0 && find_value == search_element) ||
-						(index_col_num < search_element->toVector().size() &&
-						 find_value    == search_element->toVector()[index_col_num])) {
-					ValuePtr resultValue((double(j)));
-		      matchCount++;
-		      if (num_returns_per_match == 1) {
-						returnvec.push_back(resultValue);
-						break;
-		      } else {
-						resultvec.push_back(resultValue);
-		      }
-		      if (num_returns_per_match > 1 && matchCount >= num_returns_per_match) break;
-		    }
-		  }
+			search_rows(find_value, searchTable, index_col_num, [&](size_t j) {
+				ValuePtr resultValue((double(j)));
+				matchCount++;
+				if (num_returns_per_match == 1) {
+					returnvec.push_back(resultValue);
+					return false;
+				}
+				resultvec.push_back(resultValue);
+				return !(num_returns_per_match > 1 && matchCount >= num_returns_per_match);
+			});
 		  if (num_returns_per_match == 1 && matchCount == 0) {
 		    returnvec.push_back(ValuePtr(resultvec));
 		  }
@@ -839,6 +1030,8 @@ ValuePtr builtin_parent_module(const Context *ctx, const EvalContext *evalctx)
 {
 	int n;
 	double d;
+	// Depends on the module being instantiated, not only on the arguments
+	FunctionCache::Tracker::taint();
 	int s = UserModule::stack_size();
 	if (evalctx->numArgs() == 0)
 		d=1; // parent module
@@ -25,17 +25,28 @@
  */
 
 #include "function.h"
+#include "FunctionCache.h"
+#include "InterpreterProfile.h"
 #include "evalcontext.h"
 #include "expression.h"
 #include "printutils.h"
+#include <memory>
+#include <vector>
 
 AbstractFunction::~AbstractFunction()
 {
 }
 
 UserFunction::UserFunction(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc)
-	: ASTNode(loc), name(name), definition_arguments(definition_arguments), expr(expr)
+	: ASTNode(loc), name(name), definition_arguments(definition_arguments), expr(expr),
+		literalDefaults(true), memoize(true), calls(0), hits(0)
 {
+	for (const auto &arg : definition_arguments) {
+		if (arg.expr && !arg.expr->isConstant()) this->literalDefaults = false;
+		// Config variable parameters are seen by everything called from the body
+		if (!arg.name.empty() && arg.name[0] == '$') this->memoize = false;
+	}
+	if (!this->literalDefaults) this->memoize = false;
 }
 
 UserFunction::~UserFunction()
@@ -45,10 +56,39 @@ UserFunction::~UserFunction()
 ValuePtr UserFunction::evaluate(const Context *ctx, const EvalContext *evalctx) const
 {
 	if (!expr) return ValuePtr::undefined;
+	InterpreterProfile::Scope profile(InterpreterProfile::Kind::FUNCTION, *this, this->name, evalctx ? evalctx->loc : Location::NONE);
 	Context c(ctx);
 	c.setVariables(evalctx, definition_arguments);
-	ValuePtr result = expr->evaluate(&c);
+	if (!this->memoize) {
+		// A call being tracked is only as pure as what it calls
+		if (!FunctionCache::Tracker::active()) return expr->evaluate(&c);
+		if (!this->literalDefaults) FunctionCache::Tracker::taint();
+		FunctionCache::Tracker tracker(&c);
+		return expr->evaluate(&c);
+	}
+
+	std::vector<ValuePtr> args;
+	args.reserve(definition_arguments.size());
+	for (const auto &arg : definition_arguments) args.push_back(c.lookup_variable(arg.name, true));
+	FunctionCache::Key key(this, std::move(args));
+
+	ValuePtr result;
+	auto cache = FunctionCache::instance();
+	const unsigned int calls = ++this->calls;
+	if (cache->get(key, result)) {
+		this->hits++;
+		return result;
+	}
 
+	bool pure;
+	{
+		FunctionCache::Tracker tracker(&c);
+		result = expr->evaluate(&c);
+		pure = tracker.isPure();
+	}
+	if (pure) cache->insert(key, result);
+	// Give up on impure functions, and on those whose calls rarely repeat
+	if (!pure || (calls >= 1024 && this->hits * 16 < calls)) this->memoize = false;
 	return result;
 }
 
@@ -64,65 +104,114 @@ void UserFunction::print(std::ostream &stream, const std::string &indent) const
 	stream << ") = " << *expr << ";\n";
 }
 
+/*!
+	A function whose body ends in a call to itself, possibly below
+	conditions and let() expressions, e.g.
+
+	function sum(v, i = 0, acc = 0) = i >= len(v) ? acc : let(x = v[i]) sum(v, i + 1, acc + x);
+
+	Instead of recursing, such self-calls rebind the arguments in the
+	context of the function and evaluate the body again, so the depth of
+	the recursion isn't limited by the stack.
+*/
 class FunctionTailRecursion : public UserFunction
 {
-private:
-	bool invert;
-	shared_ptr<TernaryOp> op;
-	shared_ptr<FunctionCall> call;
-	shared_ptr<Expression> endexpr;
-
 public:
 	FunctionTailRecursion(const char *name, AssignmentList &definition_arguments,
-												shared_ptr<TernaryOp> expr, shared_ptr<FunctionCall> call,
-												shared_ptr<Expression> endexpr, bool invert,
-												const Location &loc)
-		: UserFunction(name, definition_arguments, expr, loc),
-			invert(invert), op(expr), call(call), endexpr(endexpr) {
+												shared_ptr<Expression> expr, const Location &loc)
+		: UserFunction(name, definition_arguments, expr, loc) {
 	}
 
 	~FunctionTailRecursion() { }
 
+	/*!
+		Returns true if expr may end in a call of the function name, through
+		conditions and let() expressions. let() expressions assigning config
+		variables are not looked into, as those variables would be seen by
+		the nested call.
+	*/
+	static bool hasTailCall(const Expression *expr, const std::string &name) {
+		if (!expr) return false;
+		if (auto ternary = dynamic_cast<const TernaryOp *>(expr)) {
+			return hasTailCall(ternary->ifexpr.get(), name) || hasTailCall(ternary->elseexpr.get(), name);
+		}
+		if (auto let = dynamic_cast<const Let *>(expr)) {
+			for (const auto &ass : let->arguments) {
+				if (!ass.name.empty() && ass.name[0] == '$') return false;
+			}
+			return hasTailCall(let->expr.get(), name);
+		}
+		auto call = dynamic_cast<const FunctionCall *>(expr);
+		return call && call->name == name;
+	}
+
 	ValuePtr evaluate(const Context *ctx, const EvalContext *evalctx) const override {
 		if (!expr) return ValuePtr::undefined;
+		InterpreterProfile::Scope profile(InterpreterProfile::Kind::FUNCTION, *this, this->name, evalctx ? evalctx->loc : Location::NONE);
 		
 		Context c(ctx);
 		c.setVariables(evalctx, definition_arguments);
+		// Not memoized, but may be called from a call which is
+		std::unique_ptr<FunctionCache::Tracker> tracker;
+		if (FunctionCache::Tracker::active()) {
+			if (!this->literalDefaults) FunctionCache::Tracker::taint();
+			tracker.reset(new FunctionCache::Tracker(&c));
+		}
 		
-		EvalContext ec(&c, call->arguments, loc);
-		Context tmp(&c);
 		unsigned int counter = 0;
-		while (invert ^ this->op->cond->evaluate(&c)) {
-			tmp.setVariables(&ec, definition_arguments);
-			c.apply_variables(tmp);
-			
+		while (true) {
+			// Contexts of the let() expressions on the way to the tail
+			std::vector<std::unique_ptr<Context>> lets;
+			const Context *context = &c;
+			const Expression *tail = this->expr.get();
+			while (true) {
+				if (auto ternary = dynamic_cast<const TernaryOp *>(tail)) {
+					tail = (ternary->cond->evaluate(context) ? ternary->ifexpr : ternary->elseexpr).get();
+				}
+				else if (auto let = dynamic_cast<const Let *>(tail)) {
+					lets.emplace_back(new Context(context));
+					EvalContext letctx(lets.back().get(), let->arguments, let->location());
+					letctx.assignTo(*lets.back());
+					context = lets.back().get();
+					tail = let->expr.get();
+				}
+				else break;
+			}
+
+			auto call = dynamic_cast<const FunctionCall *>(tail);
+			if (!call || call->name != this->name) {
+				ValuePtr result = tail->evaluate(context);
+				popContexts(lets);
+				return result;
+			}
+
 			if (counter++ == 1000000){
 				std::string locs = loc.toRelativeString(ctx->documentPath());
 				PRINTB("ERROR: Recursion detected calling function '%s' %s", this->name % locs);
 				throw RecursionException::create("function", this->name,loc);
 			}
+			{
+				// Bind the arguments as the call would, then make them ours
+				EvalContext ec(context, call->arguments, call->location());
+				Context args(ctx);
+				args.setVariables(&ec, definition_arguments);
+				c.take_variables(args);
+			}
+			popContexts(lets);
 		}
-		
-		ValuePtr result = endexpr->evaluate(&c);
-		
-		return result;
+	}
+
+private:
+	// Contexts must leave the context stack in reverse order
+	static void popContexts(std::vector<std::unique_ptr<Context>> &contexts) {
+		while (!contexts.empty()) contexts.pop_back();
 	}
 };
 
 UserFunction *UserFunction::create(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc)
 {
-	if (shared_ptr<TernaryOp> ternary = dynamic_pointer_cast<TernaryOp>(expr)) {
-		shared_ptr<FunctionCall> ifcall = dynamic_pointer_cast<FunctionCall>(ternary->ifexpr);
-		shared_ptr<FunctionCall> elsecall = dynamic_pointer_cast<FunctionCall>(ternary->elseexpr);
-		if (ifcall && !elsecall) {
-			if (name == ifcall->name) {
-				return new FunctionTailRecursion(name, definition_arguments, ternary, ifcall, ternary->elseexpr, false, loc);
-			}
-		} else if (elsecall && !ifcall) {
-			if (name == elsecall->name) {
-				return new FunctionTailRecursion(name, definition_arguments, ternary, elsecall, ternary->ifexpr, true, loc);
-			}
-		}
+	if (FunctionTailRecursion::hasTailCall(expr.get(), name)) {
+		return new FunctionTailRecursion(name, definition_arguments, expr, loc);
 	}
 	return new UserFunction(name, definition_arguments, expr, loc);
 }
@@ -5,6 +5,7 @@
 #include "Assignment.h"
 #include "feature.h"
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -49,4 +50,11 @@ public:
 	void print(std::ostream &stream, const std::string &indent) const override;
         
 	static UserFunction *create(const char *name, AssignmentList &definition_arguments, shared_ptr<Expression> expr, const Location &loc);
+
+protected:
+	// False if default arguments depend on the context the function is defined in
+	bool literalDefaults;
+	// Whether calls are looked up in and added to the FunctionCache
+	mutable std::atomic<bool> memoize;
+	mutable std::atomic<unsigned int> calls, hits;
 };
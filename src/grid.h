@@ -2,11 +2,10 @@
 
 #include "linalg.h"
 #include "hash.h"
-#include <boost/functional/hash.hpp>
+#include "FlatHashMap.h"
 #include <cmath>
 
 #include <cstdint> // int64_t
-#include <unordered_map>
 #include <utility>
 
 //const double GRID_COARSE = 0.001;
@@ -19,12 +18,18 @@ for ctest -R CGAL. We choose 1/1024 and 1/(1024*1024) In python: print
 const double GRID_COARSE = 0.0009765625;
 const double GRID_FINE   = 0.00000095367431640625;
 
+/*!
+	Snaps 2D points to a grid, merging points which end up in the same or
+	adjacent cells. Inserting a cell invalidates the references to the
+	values returned before.
+*/
 template <typename T>
 class Grid2d
 {
 public:
 	double res;
-	std::unordered_map<std::pair<int64_t,int64_t>, T, boost::hash<std::pair<int64_t,int64_t>>> db;
+	typedef std::pair<int64_t, int64_t> Key;
+	FlatHashMap<Key, T, SpatialHash> db;
 
 	Grid2d(double resolution) {
 		res = resolution;
@@ -37,11 +42,11 @@ public:
 	T &align(double &x, double &y) {
 		int64_t ix = (int64_t)std::round(x / res);
 		int64_t iy = (int64_t)std::round(y / res);
-		if (db.find(std::make_pair(ix, iy)) == db.end()) {
+		if (db.find(Key(ix, iy)) == db.npos) {
 			int dist = 10;
 			for (int64_t jx = ix - 1; jx <= ix + 1; jx++) {
 				for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-					if (db.find(std::make_pair(jx, jy)) == db.end())
+					if (db.find(Key(jx, jy)) == db.npos)
 						continue;
 					int d = abs(int(ix-jx)) + abs(int(iy-jy));
 					if (d < dist) {
@@ -53,17 +58,15 @@ public:
 			}
 		}
 		x = ix * res, y = iy * res;
-		return db[std::make_pair(ix, iy)];
+		return db[Key(ix, iy)];
 	}
 
 	bool has(double x, double y) const {
 		int64_t ix = (int64_t)std::round(x / res);
 		int64_t iy = (int64_t)std::round(y / res);
-		if (db.find(std::make_pair(ix, iy)) != db.end())
-			return true;
 		for (int64_t jx = ix - 1; jx <= ix + 1; jx++)
 		for (int64_t jy = iy - 1; jy <= iy + 1; jy++) {
-			if (db.find(std::make_pair(jx, jy)) != db.end())
+			if (db.find(Key(jx, jy)) != db.npos)
 				return true;
 		}
 		return false;
@@ -84,43 +87,47 @@ public:
 	}
 };
 
+/*!
+	Snaps 3D points to a grid, merging points which end up in the same or
+	adjacent cells, and numbers the distinct ones in order of insertion.
+*/
 template <typename T>
 class Grid3d
 {
 public:
 	double res;
 	typedef Vector3l Key;
-	typedef std::unordered_map<Key, T> GridContainer;
-	GridContainer db;
 
-	Grid3d(double resolution) {
-		res = resolution;
-	}
+	Grid3d(double resolution) : res(resolution) {}
 
-	inline void createGridVertex(const Vector3d &v, Vector3l &i) {
+	inline void createGridVertex(const Vector3d &v, Vector3l &i) const {
 		i[0] = int64_t(v[0] / this->res);
 		i[1] = int64_t(v[1] / this->res);
 		i[2] = int64_t(v[2] / this->res);
 	}
 
+	size_t size() const { return this->db.size(); }
+	void reserve(size_t n) { this->db.reserve(n); }
+
 	// Aligns vertex to the grid. Returns index of the vertex.
 	// Will automatically increase the index as new unique vertices are added.
 	T align(Vector3d &v) {
 		Vector3l key;
 		createGridVertex(v, key);
-		typename GridContainer::iterator iter = db.find(key);
-		if (iter == db.end()) {
+		size_t pos = this->db.find(key);
+		if (pos == this->db.npos) {
 			float dist = 10.0f; // > max possible distance
 			for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++) {
 				for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
 					for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
 						Vector3l k(jx, jy, jz);
-						typename GridContainer::iterator tmpiter = db.find(k);
-						if (tmpiter == db.end()) continue;
+						if (k == key) continue;
+						const size_t tmppos = this->db.find(k);
+						if (tmppos == this->db.npos) continue;
 						float d = sqrt((key-k).squaredNorm());
 						if (d < dist) {
-						  dist = d;
-							iter = tmpiter;
+							dist = d;
+							pos = tmppos;
 						}
 					}
 				}
@@ -128,14 +135,14 @@ public:
 		}
 
 		T data;
-		if (iter == db.end()) { // Not found: insert using key
-			data = db.size();
-			db[key] = data;
+		if (pos == this->db.npos) { // Not found: insert using key
+			data = T(this->db.size());
+			this->db.emplace(key, data);
 		}
 		else {
 			// If found return existing data
-			key = iter->first;
-			data = iter->second;
+			key = this->db.key(pos);
+			data = this->db.value(pos);
 		}
 
 		// Align vertex
@@ -146,19 +153,15 @@ public:
 		return data;
 	}
 
-	bool has(const Vector3d &v, T *data = nullptr) {
-		Vector3l key = createGridVertex(v);
-		typename GridContainer::iterator pos = db.find(key);
-		if (pos != db.end()) {
-			if (data) *data = pos->second;
-			return true;
-		}
+	bool has(const Vector3d &v, T *data = nullptr) const {
+		Vector3l key;
+		createGridVertex(v, key);
 		for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++)
 			for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++)
 				for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
-					pos = db.find(Vector3l(jx, jy, jz));
-					if (pos != db.end()) {
-						if (data) *data = pos->second;
+					const size_t pos = this->db.find(Vector3l(jx, jy, jz));
+					if (pos != this->db.npos) {
+						if (data) *data = this->db.value(pos);
 						return true;
 					}
 				}
@@ -169,4 +172,6 @@ public:
 		return align(v);
 	}
 
+private:
+	FlatHashMap<Key, T, SpatialHash> db;
 };
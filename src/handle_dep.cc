@@ -1,8 +1,10 @@
 #include "handle_dep.h"
 #include "printutils.h"
+#include "FunctionCache.h"
 #include <string>
 #include <sstream>
 #include <stdlib.h> // for system()
+#include <mutex>
 #include <unordered_set>
 #include <boost/regex.hpp>
 #include <boost/filesystem.hpp>
@@ -10,9 +12,21 @@ namespace fs = boost::filesystem;
 
 std::unordered_set<std::string> dependencies;
 const char *make_command = nullptr;
+DependencyRecorder *DependencyRecorder::current = nullptr;
+
+namespace {
+	// Modules may be instantiated on several threads, see for()
+	std::mutex dep_mutex;
+}
 
 void handle_dep(const std::string &filename)
 {
+	// Cached results wouldn't record the dependency again
+	FunctionCache::Tracker::taint();
+	std::lock_guard<std::mutex> lock(dep_mutex);
+	for (auto recorder = DependencyRecorder::current; recorder; recorder = recorder->outer) {
+		recorder->deps.push_back(filename);
+	}
 	fs::path filepath(filename);
 	std::string dep = boost::regex_replace(filepath.generic_string(), boost::regex("\\ "), "\\\\ ");
 	if (dependencies.find(dep) != dependencies.end()) {
@@ -1,7 +1,27 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 extern const char *make_command;
 void handle_dep(const std::string &filename);
 bool write_deps(const std::string &filename, const std::string &output_file);
+
+/*!
+	While alive, records every file passed to handle_dep(), e.g. to find out
+	which files the nodes instantiated in the meantime depend on.
+	Recorders may be nested; all active recorders see each file.
+*/
+class DependencyRecorder
+{
+public:
+	DependencyRecorder() : outer(current) { current = this; }
+	~DependencyRecorder() { current = this->outer; }
+	const std::vector<std::string> &files() const { return this->deps; }
+
+private:
+	friend void handle_dep(const std::string &filename);
+	static DependencyRecorder *current;
+	DependencyRecorder *outer;
+	std::vector<std::string> deps;
+};
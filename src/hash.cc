@@ -1,5 +1,5 @@
 #include "hash.h"
-#include <boost/functional/hash.hpp>
+#include <cstring>
 
 namespace std {
 	std::size_t hash<Vector3f>::operator()(const Vector3f &s) const {
@@ -13,20 +13,116 @@ namespace std {
 	}
 }
 
+namespace {
+	// The bits of x, with -0 as 0 as they compare equal
+	inline uint64_t bits(double x)
+	{
+		x += 0.0;
+		uint64_t b;
+		std::memcpy(&b, &x, sizeof(b));
+		return b;
+	}
+
+	inline uint64_t bits(float x)
+	{
+		x += 0.0f;
+		uint32_t b;
+		std::memcpy(&b, &x, sizeof(b));
+		return b;
+	}
+
+	template <typename V> size_t hash_elements(const V &v)
+	{
+		uint64_t h = bits(v[0]);
+		h = mix64(h) ^ bits(v[1]);
+		h = mix64(h) ^ bits(v[2]);
+		return size_t(mix64(h));
+	}
+}
+
 namespace Eigen {
-  size_t hash_value(Vector3f const &v) {
-    size_t seed = 0;
-    for (int i=0;i<3;i++) boost::hash_combine(seed, v[i]);
-    return seed;
-  }
-  size_t hash_value(Vector3d const &v) {
-    size_t seed = 0;
-    for (int i=0;i<3;i++) boost::hash_combine(seed, v[i]);
-    return seed;
-  }
-  size_t hash_value(Eigen::Matrix<int64_t, 3, 1> const &v) {
-    size_t seed = 0;
-    for (int i=0;i<3;i++) boost::hash_combine(seed, v[i]);
-    return seed;
-  }
+	size_t hash_value(Vector3f const &v) {
+		return hash_elements(v);
+	}
+	size_t hash_value(Vector3d const &v) {
+		return hash_elements(v);
+	}
+	size_t hash_value(Eigen::Matrix<int64_t, 3, 1> const &v) {
+		uint64_t h = uint64_t(v[0]);
+		h = mix64(h) ^ uint64_t(v[1]);
+		h = mix64(h) ^ uint64_t(v[2]);
+		return size_t(mix64(h));
+	}
+}
+
+std::string Hash128::toString() const
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string str(32, '0');
+	for (int i = 0; i < 16; ++i) {
+		str[15 - i] = digits[(this->h1 >> (4*i)) & 0xf];
+		str[31 - i] = digits[(this->h2 >> (4*i)) & 0xf];
+	}
+	return str;
+}
+
+namespace {
+	inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+}
+
+/*!
+	MurmurHash3_x64_128 by Austin Appleby (public domain).
+	Input blocks are read in native byte order.
+*/
+Hash128 hash128(const void *key, size_t len, uint32_t seed)
+{
+	const uint8_t *data = static_cast<const uint8_t *>(key);
+	const size_t nblocks = len / 16;
+	const uint64_t c1 = 0x87c37b91114253d5ULL;
+	const uint64_t c2 = 0x4cf5ad432745937fULL;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+
+	for (size_t i = 0; i < nblocks; ++i) {
+		uint64_t k1, k2;
+		std::memcpy(&k1, data + i*16, 8);
+		std::memcpy(&k2, data + i*16 + 8, 8);
+
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = rotl64(h1, 27); h1 += h2; h1 = h1*5 + 0x52dce729;
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = rotl64(h2, 31); h2 += h1; h2 = h2*5 + 0x38495ab5;
+	}
+
+	const uint8_t *tail = data + nblocks*16;
+	uint64_t k1 = 0;
+	uint64_t k2 = 0;
+	switch (len & 15) {
+	case 15: k2 ^= uint64_t(tail[14]) << 48; // fallthrough
+	case 14: k2 ^= uint64_t(tail[13]) << 40; // fallthrough
+	case 13: k2 ^= uint64_t(tail[12]) << 32; // fallthrough
+	case 12: k2 ^= uint64_t(tail[11]) << 24; // fallthrough
+	case 11: k2 ^= uint64_t(tail[10]) << 16; // fallthrough
+	case 10: k2 ^= uint64_t(tail[9]) << 8; // fallthrough
+	case 9:
+		k2 ^= uint64_t(tail[8]);
+		k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+		// fallthrough
+	case 8: k1 ^= uint64_t(tail[7]) << 56; // fallthrough
+	case 7: k1 ^= uint64_t(tail[6]) << 48; // fallthrough
+	case 6: k1 ^= uint64_t(tail[5]) << 40; // fallthrough
+	case 5: k1 ^= uint64_t(tail[4]) << 32; // fallthrough
+	case 4: k1 ^= uint64_t(tail[3]) << 24; // fallthrough
+	case 3: k1 ^= uint64_t(tail[2]) << 16; // fallthrough
+	case 2: k1 ^= uint64_t(tail[1]) << 8; // fallthrough
+	case 1:
+		k1 ^= uint64_t(tail[0]);
+		k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= len; h2 ^= len;
+	h1 += h2; h2 += h1;
+	h1 = mix64(h1); h2 = mix64(h2);
+	h1 += h2; h2 += h1;
+	return Hash128(h1, h2);
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "linalg.h"
+#include <cstdint>
+#include <string>
+#include <utility>
 
 typedef Eigen::Matrix<int64_t, 3, 1> Vector3l;
 
@@ -15,3 +18,85 @@ namespace Eigen {
 	size_t hash_value(Vector3d const &v);
 	size_t hash_value(Vector3l const &v);
 }
+
+// The finalizer of MurmurHash3, which mixes every bit of k into every bit of the result
+inline uint64_t mix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+// Interleaves the low 32 bits of x and y: bit i of x becomes bit 2i of the result
+inline uint64_t morton_code(uint64_t x, uint64_t y)
+{
+	auto spread = [](uint64_t v) {
+		v &= 0xffffffffULL;
+		v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+		v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+		v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+		v = (v | (v << 2)) & 0x3333333333333333ULL;
+		v = (v | (v << 1)) & 0x5555555555555555ULL;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1);
+}
+
+// Interleaves the low 21 bits of x, y and z: bit i of x becomes bit 3i of the result
+inline uint64_t morton_code(uint64_t x, uint64_t y, uint64_t z)
+{
+	auto spread = [](uint64_t v) {
+		v &= 0x1fffffULL;
+		v = (v | (v << 32)) & 0x001f00000000ffffULL;
+		v = (v | (v << 16)) & 0x001f0000ff0000ffULL;
+		v = (v | (v << 8)) & 0x100f00f00f00f00fULL;
+		v = (v | (v << 4)) & 0x10c30c30c30c30c3ULL;
+		v = (v | (v << 2)) & 0x1249249249249249ULL;
+		return v;
+	};
+	return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+/*!
+	Hash of grid cells for open-addressing tables like FlatHashIndex. The
+	block of 4x4(x4) cells a cell is in is hashed, and the Morton code of
+	the cell within its block is xor'ed into the low bits, so the cells of
+	a block map to the same 16 or 64 slots of a table. Looking up the
+	neighbours of a cell, as the grids do to snap points, then mostly stays
+	within a few cache lines.
+*/
+struct SpatialHash {
+	size_t operator()(const Vector3l &k) const {
+		const uint64_t block = mix64(uint64_t(k[0] >> 2) * 0x9e3779b97f4a7c15ULL ^
+																 uint64_t(k[1] >> 2) * 0xc2b2ae3d27d4eb4fULL ^
+																 uint64_t(k[2] >> 2) * 0x165667b19e3779f9ULL);
+		return size_t(block ^ morton_code(uint64_t(k[0]) & 3, uint64_t(k[1]) & 3, uint64_t(k[2]) & 3));
+	}
+	size_t operator()(const std::pair<int64_t, int64_t> &k) const {
+		const uint64_t block = mix64(uint64_t(k.first >> 2) * 0x9e3779b97f4a7c15ULL ^
+																 uint64_t(k.second >> 2) * 0xc2b2ae3d27d4eb4fULL);
+		return size_t(block ^ morton_code(uint64_t(k.first) & 3, uint64_t(k.second) & 3));
+	}
+};
+
+/*!
+	128-bit hash value, used to key caches by content without having to keep
+	the hashed content around.
+*/
+struct Hash128 {
+	Hash128() : h1(0), h2(0) {}
+	Hash128(uint64_t h1, uint64_t h2) : h1(h1), h2(h2) {}
+	bool operator==(const Hash128 &other) const { return h1 == other.h1 && h2 == other.h2; }
+	bool operator!=(const Hash128 &other) const { return !(*this == other); }
+	// 32 hex digits
+	std::string toString() const;
+
+	uint64_t h1, h2;
+};
+
+// MurmurHash3 (x64, 128-bit variant)
+Hash128 hash128(const void *data, size_t len, uint32_t seed = 0);
+inline Hash128 hash128(const std::string &str) { return hash128(str.data(), str.size()); }
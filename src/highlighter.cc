@@ -222,7 +222,7 @@ Highlighter::Highlighter(QTextDocument *parent)
                            << "ln" << "log" << "lookup" << "min" << "max" << "pow" << "sqrt" << "exp" << "rands" << "chr" << "ord"
                            << "is_undef" << "is_list" << "is_num" << "is_bool" << "is_string";
 	tokentypes["keyword"] << "module" << "function" << "for" << "intersection_for" << "if" << "assign" << "echo"<< "search" << "str" << "let" << "each" << "assert";
-	tokentypes["transform"] << "scale" << "translate" << "rotate" << "multmatrix" << "color" << "projection" << "hull" << "resize" << "mirror" << "minkowski";
+	tokentypes["transform"] << "scale" << "translate" << "rotate" << "multmatrix" << "color" << "projection" << "hull" << "resize" << "mirror" << "minkowski" << "simplify";
 	tokentypes["csgop"]	<< "union" << "intersection" << "difference" << "render";
 	tokentypes["prim3d"] << "cube" << "cylinder" << "sphere" << "polyhedron";
 	tokentypes["prim2d"] << "square" << "polygon" << "circle";
@@ -351,39 +351,45 @@ void Highlighter::highlightBlock(const QString &text)
 		}
 	}
 
-	// Quoting and Comments.
+	// Quoting and Comments. Each quote or comment is formatted with a single
+	// setFormat(), see the speed note above.
 	state_e state = static_cast<state_e>(previousBlockState());
 	int quote_esc_state = 0;
+	int run_start = 0;
 	for (int n = 0; n < text.size(); ++n){
 		if (state == state_e::NORMAL){
 			if (text[n] == '"'){
 				state = state_e::QUOTE;
-				setFormat(n,1,quoteFormat);
+				run_start = n;
 			} else if (text[n] == '/'){
 				if ( n+1 < text.size() && text[n+1] == '/'){
 					setFormat(n,text.size(),commentFormat);
 					break;
 				} else if ( n+1 < text.size() && text[n+1] == '*'){
-					setFormat(n++,2,commentFormat);
+					run_start = n++;
 					state = state_e::COMMENT;
 				}
 			}
 		} else if (state == state_e::QUOTE){
-			setFormat(n,1,quoteFormat);
 			if (quote_esc_state > 0)
 				quote_esc_state = 0;
 			else if (text[n] == '\\')
 				quote_esc_state = 1;
-			else if (text[n] == '"')
+			else if (text[n] == '"') {
+				setFormat(run_start,n+1-run_start,quoteFormat);
 				state = state_e::NORMAL;
+			}
 		} else if (state == state_e::COMMENT){
-			setFormat(n,1,commentFormat);
 			if (text[n] == '*' && n+1 < text.size() && text[n+1] == '/'){
-				setFormat(++n,1,commentFormat);
+				++n;
+				setFormat(run_start,n+1-run_start,commentFormat);
 				state = state_e::NORMAL;
 			}
 		}
 	}
+	// A quote or comment continuing on the next block
+	if (state == state_e::QUOTE) setFormat(run_start,text.size()-run_start,quoteFormat);
+	else if (state == state_e::COMMENT) setFormat(run_start,text.size()-run_start,commentFormat);
 	setCurrentBlockState(static_cast<int>(state));
 
 	// Highlight an error. Do it last to 'overwrite' other formatting.
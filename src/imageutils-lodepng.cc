@@ -5,6 +5,22 @@
 #include <vector>
 #include <iterator>
 #include <algorithm>
+#include <zlib.h>
+
+/*!
+	Compresses with zlib at png_compression(), much faster than lodepng's
+	own deflate for the same size.
+*/
+static unsigned zlib_compress(unsigned char **out, size_t *outsize, const unsigned char *in, size_t insize,
+															const LodePNGCompressSettings *)
+{
+	uLongf size = compressBound(insize);
+	*out = static_cast<unsigned char *>(malloc(size)); // freed by lodepng
+	if (!*out) return 83;
+	if (compress2(*out, &size, in, insize, png_compression()) != Z_OK) return 111;
+	*outsize = size;
+	return 0;
+}
 
 bool write_png(std::ostream &output, unsigned char *pixels, int width, int height)
 {
@@ -14,6 +30,9 @@ bool write_png(std::ostream &output, unsigned char *pixels, int width, int heigh
 	// some png renderers have different interpretations of alpha, so don't use it
 	state.info_png.color.colortype = LCT_RGB;
 	state.info_png.color.bitdepth = 8;
+	state.encoder.zlibsettings.custom_zlib = zlib_compress;
+	// Filtering barely helps fast compression, but takes longer than it
+	if (png_compression() <= 1) state.encoder.filter_strategy = LFS_ZERO;
 	unsigned err = lodepng::encode(dataout, pixels, width, height, state);
 	if ( err ) return false;
 	output.write( reinterpret_cast<const char *>(&dataout[0]), dataout.size());
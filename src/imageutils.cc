@@ -3,6 +3,18 @@
 #include <string.h>
 #include <fstream>
 
+static int compression = 6;
+
+void set_png_compression(int level)
+{
+  compression = level < 0 ? 0 : level > 9 ? 9 : level;
+}
+
+int png_compression()
+{
+  return compression;
+}
+
 void flip_image(const unsigned char *src, unsigned char *dst, size_t pixelsize, size_t width, size_t height)
 {
   assert(src && dst);
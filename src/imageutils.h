@@ -5,4 +5,7 @@
 
 bool write_png(const char *filename, unsigned char *pixels, int width, int height);
 bool write_png(std::ostream &output, unsigned char *pixels, int width, int height);
+// The zlib level of written PNGs, from 0 (stored uncompressed) to 9, default 6
+void set_png_compression(int level);
+int png_compression();
 void flip_image(const unsigned char *src, unsigned char *dst, size_t pixelsize, size_t width, size_t height);
@@ -41,6 +41,7 @@
 #include "fileutils.h"
 #include "feature.h"
 #include "handle_dep.h"
+#include "ImportCache.h"
 
 #include <sys/types.h>
 #include <sstream>
@@ -98,6 +99,7 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 		std::string ext = boost::algorithm::to_lower_copy(extraw);
 		if (ext == ".stl") actualtype = ImportType::STL;
 		else if (ext == ".off") actualtype = ImportType::OFF;
+		else if (ext == ".osmesh") actualtype = ImportType::OSMESH;
 		else if (ext == ".dxf") actualtype = ImportType::DXF;
 		else if (ext == ".nef3") actualtype = ImportType::NEF3;
 		else if (ext == ".3mf") actualtype = ImportType::_3MF;
@@ -160,50 +162,104 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 	return node;
 }
 
-/*!
-	Will return an empty geometry if the import failed, but not nullptr
-*/
-const Geometry *ImportNode::createGeometry() const
+namespace {
+
+Geometry *import_geometry(const ImportNode &node)
 {
 	Geometry *g = nullptr;
-	auto loc = this->modinst->location();
+	auto loc = node.modinst->location();
 
-	switch (this->type) {
+	switch (node.type) {
 	case ImportType::STL: {
-		g = import_stl(this->filename, loc);
+		g = import_stl(node.filename, loc);
 		break;
 	}
 	case ImportType::AMF: {
-		g = import_amf(this->filename, loc);
+		g = import_amf(node.filename, loc);
 		break;
 	}
 	case ImportType::_3MF: {
-		g = import_3mf(this->filename, loc);
+		g = import_3mf(node.filename, loc);
 		break;
 	}
 	case ImportType::OFF: {
-		g = import_off(this->filename, loc);
+		g = import_off(node.filename, loc);
+		break;
+	}
+	case ImportType::OSMESH: {
+		g = import_osmesh(node.filename, loc);
 		break;
 	}
 	case ImportType::SVG: {
-		g = import_svg(this->filename, this->dpi, this->center, loc);
+		g = import_svg(node.filename, node.dpi, node.center, node.fn, node.fs, node.fa, loc);
  		break;
 	}
 	case ImportType::DXF: {
-		DxfData dd(this->fn, this->fs, this->fa, this->filename, this->layername, this->origin_x, this->origin_y, this->scale);
+		DxfData dd(node.fn, node.fs, node.fa, node.filename, node.layername, node.origin_x, node.origin_y, node.scale);
 		g = dd.toPolygon2d();
 		break;
 	}
 #ifdef ENABLE_CGAL
 	case ImportType::NEF3: {
-		g = import_nef3(this->filename, loc);
+		g = import_nef3(node.filename, loc);
 		break;
 	}
 #endif
 	default:
-		PRINTB("ERROR: Unsupported file format while trying to import file '%s', import() at Line %d", this->filename % loc.firstLine());
+		PRINTB("ERROR: Unsupported file format while trying to import file '%s', import() at Line %d", node.filename % loc.firstLine());
 		g = new PolySet(3);
 	}
+	return g;
+}
+
+/*!
+	Key for ImportCache: the file and the parameters affecting parsing.
+	Unsupported types return an empty key and aren't cached.
+*/
+std::string import_cache_key(const ImportNode &node)
+{
+	std::ostringstream key;
+	key << int(node.type) << ":" << node.filename;
+	switch (node.type) {
+	case ImportType::SVG:
+		key << ":" << node.dpi << ":" << node.center << ":" << node.fn << ":" << node.fa << ":" << node.fs;
+		break;
+	case ImportType::DXF:
+		key << ":" << QuotedString(node.layername) << ":" << node.origin_x << ":" << node.origin_y << ":" << node.scale
+				<< ":" << node.fn << ":" << node.fa << ":" << node.fs;
+		break;
+	case ImportType::UNKNOWN:
+		return "";
+	default:
+		break;
+	}
+	return key.str();
+}
+
+} // namespace
+
+/*!
+	Will return an empty geometry if the import failed, but not nullptr
+
+	Parsed geometry is kept in ImportCache, so importing the same file
+	again only costs a copy.
+*/
+const Geometry *ImportNode::createGeometry() const
+{
+	const std::string key = import_cache_key(*this);
+	Geometry *g = nullptr;
+	if (!key.empty()) {
+		if (auto cached = ImportCache::instance()->get(key, this->filename)) g = cached->copy();
+	}
+	if (!g) {
+		g = import_geometry(*this);
+		// Failed imports are not cached, so their warnings are repeated
+		if (g && !key.empty() && !g->isEmpty()) {
+			shared_ptr<const Geometry> parsed(g);
+			ImportCache::instance()->insert(key, this->filename, parsed);
+			g = parsed->copy();
+		}
+	}
 
 	if (g) g->setConvexity(this->convexity);
 	return g;
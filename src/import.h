@@ -3,9 +3,14 @@
 #include <string>
 #include "AST.h"
 
+struct IndexedMesh;
+
 class PolySet *import_stl(const std::string &filename, const Location &loc);
+bool import_stl_mesh(const std::string &filename, const Location &loc, IndexedMesh &mesh);
 PolySet *import_off(const std::string &filename, const Location &loc);
-class Polygon2d *import_svg(const std::string &filename, const double dpi, const bool center, const Location &loc);
+bool import_off_mesh(const std::string &filename, const Location &loc, IndexedMesh &mesh);
+PolySet *import_osmesh(const std::string &filename, const Location &loc);
+class Polygon2d *import_svg(const std::string &filename, const double dpi, const bool center, double fn, double fs, double fa, const Location &loc);
 #ifdef ENABLE_CGAL
 class CGAL_Nef_polyhedron *import_nef3(const std::string &filename, const Location &loc);
 #endif
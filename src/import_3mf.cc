@@ -27,6 +27,7 @@
 #include "importnode.h"
 
 #include "polyset.h"
+#include "polyset-utils.h"
 #include "Geometry.h"
 #include "printutils.h"
 #include "version_helper.h"
@@ -150,30 +151,30 @@ Geometry * import_3mf(const std::string &filename, const Location &loc)
 
 		PRINTDB("%s: mesh %d, vertex count: %lu, triangle count: %lu", filename.c_str() % mesh_idx % vertex_count % triangle_count);
 
-		PolySet *p = new PolySet(3);
-		for (DWORD idx = 0;idx < triangle_count;idx++) {
-			MODELMESHTRIANGLE triangle;
-			if (lib3mf_meshobject_gettriangle(object, idx, &triangle) != LIB3MF_OK) {
-				return import_3mf_error(model, object_it, first_mesh, p);
-			}
-			
-			MODELMESHVERTEX vertex1, vertex2, vertex3;
-			if (lib3mf_meshobject_getvertex(object, triangle.m_nIndices[0], &vertex1) != LIB3MF_OK) {
-				return import_3mf_error(model, object_it, first_mesh, p);
-			}
-			if (lib3mf_meshobject_getvertex(object, triangle.m_nIndices[1], &vertex2) != LIB3MF_OK) {
-				return import_3mf_error(model, object_it, first_mesh, p);
-			}
-			if (lib3mf_meshobject_getvertex(object, triangle.m_nIndices[2], &vertex3) != LIB3MF_OK) {
-				return import_3mf_error(model, object_it, first_mesh, p);
+		// Vertices and triangles are fetched from lib3mf in one call each
+		IndexedMesh mesh;
+		std::vector<MODELMESHVERTEX> vertices(vertex_count);
+		std::vector<MODELMESHTRIANGLE> triangles(triangle_count);
+		DWORD count;
+		if ((vertex_count && lib3mf_meshobject_getvertices(object, vertices.data(), vertex_count, &count) != LIB3MF_OK) ||
+				(triangle_count && lib3mf_meshobject_gettriangleindices(object, triangles.data(), triangle_count, &count) != LIB3MF_OK)) {
+			return import_3mf_error(model, object_it, first_mesh);
+		}
+		mesh.vertices.reserve(vertex_count);
+		for (const auto &v : vertices) mesh.vertices.emplace_back(v.m_fPosition[0], v.m_fPosition[1], v.m_fPosition[2]);
+		mesh.indices.reserve(3 * size_t(triangle_count));
+		mesh.faceoffsets.reserve(triangle_count + 1);
+		for (const auto &t : triangles) {
+			for (int i = 0; i < 3; ++i) {
+				if (t.m_nIndices[i] >= vertex_count) return import_3mf_error(model, object_it, first_mesh);
+				mesh.indices.push_back(int(t.m_nIndices[i]));
 			}
-			
-			p->append_poly();
-			p->append_vertex(vertex1.m_fPosition[0], vertex1.m_fPosition[1], vertex1.m_fPosition[2]);
-			p->append_vertex(vertex2.m_fPosition[0], vertex2.m_fPosition[1], vertex2.m_fPosition[2]);
-			p->append_vertex(vertex3.m_fPosition[0], vertex3.m_fPosition[1], vertex3.m_fPosition[2]);
+			mesh.faceoffsets.push_back(mesh.indices.size());
 		}
 
+		PolySet *p = new PolySet(3);
+		PolysetUtils::appendIndexedMesh(mesh, *p);
+
 		if (first_mesh) {
 			meshes.push_back(std::shared_ptr<PolySet>(p));
 		} else {
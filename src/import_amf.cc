@@ -27,6 +27,7 @@
 #include "importnode.h"
 
 #include "polyset.h"
+#include "polyset-utils.h"
 #include "printutils.h"
 #include "AST.h"
 
@@ -35,210 +36,245 @@
 #endif
 
 #include <sys/types.h>
-#include <map>
-#include <fstream>
+#include <cstdio>
+#include <cstring>
 #include <assert.h>
-#include <libxml/xmlreader.h>
+#include <libxml/parser.h>
 #include <boost/filesystem.hpp>
+#include <boost/spirit/include/qi.hpp>
 
-static const std::string text_node("#text");
-static const std::string object("/amf/object");
-static const std::string coordinates("/amf/object/mesh/vertices/vertex/coordinates");
-static const std::string coordinates_x = coordinates + "/x";
-static const std::string coordinates_y = coordinates + "/y";
-static const std::string coordinates_z = coordinates + "/z";
-static const std::string triangle("/amf/object/mesh/volume/triangle");
-static const std::string triangle_v1 = triangle + "/v1";
-static const std::string triangle_v2 = triangle + "/v2";
-static const std::string triangle_v3 = triangle + "/v3";
+namespace qi = boost::spirit::qi;
 
+/*!
+	Reads the meshes of an AMF file with libxml2's SAX parser. Only the
+	elements on the paths /amf/object/mesh/vertices/vertex/coordinates/{x,y,z}
+	and /amf/object/mesh/volume/triangle/{v1,v2,v3} are looked at; their text
+	is collected and parsed once the element ends. Each object becomes an
+	indexed mesh, which is turned into a PolySet in one go.
+*/
 class AmfImporter {
 private:
-	std::string xpath;   // element nesting stack
+	enum class Tag { AMF, OBJECT, MESH, VERTICES, VERTEX, COORDINATES, X, Y, Z, VOLUME, TRIANGLE, V1, V2, V3, OTHER };
 
-	typedef void (*cb_func)(AmfImporter *, const xmlChar *);
+	// Elements which are open, and how many of the outermost ones are on a
+	// path we use
+	std::vector<Tag> tags;
+	size_t known;
+	std::string text;
 
-	PolySet *polySet;
+	IndexedMesh mesh;
 	std::vector<PolySet *> polySets;
-	
-	double x, y, z;
-	int idx_v1, idx_v2, idx_v3;
-	std::vector<Eigen::Vector3d> vertex_list;
-
-	std::map<const std::string, cb_func> funcs;
-	std::map<const std::string, cb_func> start_funcs;
-	std::map<const std::string, cb_func> end_funcs;
-
-	static void set_x(AmfImporter *importer, const xmlChar *value);
-	static void set_y(AmfImporter *importer, const xmlChar *value);
-	static void set_z(AmfImporter *importer, const xmlChar *value);
-	static void set_v1(AmfImporter *importer, const xmlChar *value);
-	static void set_v2(AmfImporter *importer, const xmlChar *value);
-	static void set_v3(AmfImporter *importer, const xmlChar *value);
-	static void start_object(AmfImporter *importer, const xmlChar *value);
-	static void end_object(AmfImporter *importer, const xmlChar *value);
-	static void end_triangle(AmfImporter *importer, const xmlChar *vlue);
-	static void end_vertex(AmfImporter *importer, const xmlChar *value);
-	
+	double coords[3];
+	int indices[3];
+	bool failed;
+	xmlParserCtxtPtr parser;
+
+	static Tag tagOf(const xmlChar *name);
+	static bool isChild(Tag parent, Tag child);
+	bool parseDouble(double &value) const;
+	bool parseIndex(int &value) const;
+	void fail();
+
+	static void startElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI,
+													 int nb_namespaces, const xmlChar **namespaces, int nb_attributes, int nb_defaulted, const xmlChar **attributes);
+	static void endElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI);
+	static void characters(void *ctx, const xmlChar *ch, int len);
+
 	int streamFile(const char *filename);
-	void processNode(xmlTextReaderPtr reader);
 
 protected:
 	const Location &loc;
-	
+
+	// Opens the file to parse, and reads up to len bytes of it into buffer.
+	// readInput() returns the number of bytes read, 0 at the end or -1 on errors.
+	virtual bool openInput(const char *filepath);
+	virtual int readInput(char *buffer, int len);
+	virtual void closeInput();
+
+	FILE *file;
+
 public:
 	AmfImporter(const Location &loc);
 	virtual ~AmfImporter();
 	PolySet *read(const std::string filename);
-	
-	virtual xmlTextReaderPtr createXmlReader(const char *filename);
 };
 
-AmfImporter::AmfImporter(const Location &loc) : polySet(nullptr), x(0), y(0), z(0), idx_v1(0), idx_v2(0), idx_v3(0), loc(loc)
+AmfImporter::AmfImporter(const Location &loc) : known(0), failed(false), parser(nullptr), loc(loc), file(nullptr)
 {
 }
 
 AmfImporter::~AmfImporter()
 {
-}
-	
-void AmfImporter::set_x(AmfImporter *importer, const xmlChar *value)
-{
-	importer->x = boost::lexical_cast<double>(std::string((const char *)value));
+	for (auto ps : this->polySets) delete ps;
 }
 
-void AmfImporter::set_y(AmfImporter *importer, const xmlChar *value)
+AmfImporter::Tag AmfImporter::tagOf(const xmlChar *name)
 {
-	importer->y = boost::lexical_cast<double>(std::string((const char *)value));
+	static const std::pair<const char *, Tag> names[] = {
+		{"amf", Tag::AMF}, {"object", Tag::OBJECT}, {"mesh", Tag::MESH}, {"vertices", Tag::VERTICES},
+		{"vertex", Tag::VERTEX}, {"coordinates", Tag::COORDINATES}, {"x", Tag::X}, {"y", Tag::Y}, {"z", Tag::Z},
+		{"volume", Tag::VOLUME}, {"triangle", Tag::TRIANGLE}, {"v1", Tag::V1}, {"v2", Tag::V2}, {"v3", Tag::V3},
+	};
+	for (const auto &n : names) {
+		if (strcmp(reinterpret_cast<const char *>(name), n.first) == 0) return n.second;
+	}
+	return Tag::OTHER;
 }
 
-void AmfImporter::set_z(AmfImporter *importer, const xmlChar *value)
+bool AmfImporter::isChild(Tag parent, Tag child)
 {
-	importer->z = boost::lexical_cast<double>(std::string((const char *)value));
+	switch (parent) {
+	case Tag::AMF: return child == Tag::OBJECT;
+	case Tag::OBJECT: return child == Tag::MESH;
+	case Tag::MESH: return child == Tag::VERTICES || child == Tag::VOLUME;
+	case Tag::VERTICES: return child == Tag::VERTEX;
+	case Tag::VERTEX: return child == Tag::COORDINATES;
+	case Tag::COORDINATES: return child == Tag::X || child == Tag::Y || child == Tag::Z;
+	case Tag::VOLUME: return child == Tag::TRIANGLE;
+	case Tag::TRIANGLE: return child == Tag::V1 || child == Tag::V2 || child == Tag::V3;
+	default: return false;
+	}
 }
 
-void AmfImporter::set_v1(AmfImporter *importer, const xmlChar *value)
+bool AmfImporter::parseDouble(double &value) const
 {
-	importer->idx_v1 = boost::lexical_cast<int>(std::string((const char *)value));
+	auto it = this->text.begin();
+	return qi::phrase_parse(it, this->text.end(), qi::double_, qi::space, value) && it == this->text.end();
 }
 
-void AmfImporter::set_v2(AmfImporter *importer, const xmlChar *value)
+bool AmfImporter::parseIndex(int &value) const
 {
-	importer->idx_v2 = boost::lexical_cast<int>(std::string((const char *)value));
+	auto it = this->text.begin();
+	return qi::phrase_parse(it, this->text.end(), qi::int_, qi::space, value) && it == this->text.end();
 }
 
-void AmfImporter::set_v3(AmfImporter *importer, const xmlChar *value)
+void AmfImporter::fail()
 {
-	importer->idx_v3 = boost::lexical_cast<int>(std::string((const char *)value));
+	this->failed = true;
+	xmlStopParser(this->parser);
 }
 
-void AmfImporter::start_object(AmfImporter *importer, const xmlChar *)
+void AmfImporter::startElement(void *ctx, const xmlChar *localname, const xmlChar *, const xmlChar *,
+															 int, const xmlChar **, int, int, const xmlChar **)
 {
-	importer->polySet = new PolySet(3);
+	auto importer = static_cast<AmfImporter *>(ctx);
+	const Tag tag = tagOf(localname);
+	auto &tags = importer->tags;
+	if (importer->known == tags.size() &&
+			(tags.empty() ? tag == Tag::AMF : isChild(tags.back(), tag))) {
+		++importer->known;
+		if (tag == Tag::OBJECT) importer->mesh = IndexedMesh();
+	}
+	tags.push_back(tag);
+	importer->text.clear();
 }
 
-void AmfImporter::end_object(AmfImporter *importer, const xmlChar *)
+void AmfImporter::endElement(void *ctx, const xmlChar *, const xmlChar *, const xmlChar *)
 {
-	PRINTDB("AMF: add object %d", importer->polySets.size());
-	importer->polySets.push_back(importer->polySet);
-	importer->vertex_list.clear();
-	importer->polySet = nullptr;
+	auto importer = static_cast<AmfImporter *>(ctx);
+	auto &tags = importer->tags;
+	assert(!tags.empty());
+	const Tag tag = tags.back();
+	tags.pop_back();
+	if (importer->known <= tags.size()) return;
+	importer->known = tags.size();
+
+	auto &mesh = importer->mesh;
+	switch (tag) {
+	case Tag::X:
+	case Tag::Y:
+	case Tag::Z:
+		if (!importer->parseDouble(importer->coords[int(tag) - int(Tag::X)])) importer->fail();
+		break;
+	case Tag::V1:
+	case Tag::V2:
+	case Tag::V3:
+		if (!importer->parseIndex(importer->indices[int(tag) - int(Tag::V1)])) importer->fail();
+		break;
+	case Tag::COORDINATES:
+		mesh.vertices.emplace_back(importer->coords[0], importer->coords[1], importer->coords[2]);
+		break;
+	case Tag::TRIANGLE:
+		// Vertices come before the volumes referring to them
+		for (const auto idx : importer->indices) {
+			if (idx < 0 || size_t(idx) >= mesh.vertices.size()) {
+				importer->fail();
+				return;
+			}
+			mesh.indices.push_back(idx);
+		}
+		mesh.faceoffsets.push_back(mesh.indices.size());
+		break;
+	case Tag::OBJECT: {
+		PRINTDB("AMF: add object %d", importer->polySets.size());
+		auto ps = new PolySet(3);
+		PolysetUtils::appendIndexedMesh(mesh, *ps);
+		importer->polySets.push_back(ps);
+		mesh = IndexedMesh();
+		break;
+	}
+	default:
+		break;
+	}
 }
 
-void AmfImporter::end_vertex(AmfImporter *importer, const xmlChar *)
+void AmfImporter::characters(void *ctx, const xmlChar *ch, int len)
 {
-	PRINTDB("AMF: add vertex %d - (%.2f, %.2f, %.2f)", importer->vertex_list.size() % importer->x % importer->y % importer->z);
-	importer->vertex_list.push_back(Eigen::Vector3d(importer->x, importer->y, importer->z));
+	auto importer = static_cast<AmfImporter *>(ctx);
+	// Only the text of the innermost elements on known paths is parsed
+	if (importer->known == importer->tags.size()) importer->text.append(reinterpret_cast<const char *>(ch), len);
 }
 
-void AmfImporter::end_triangle(AmfImporter *importer, const xmlChar *)
+bool AmfImporter::openInput(const char *filepath)
 {
-	int idx_v1 = importer->idx_v1;
-	int idx_v2 = importer->idx_v2;
-	int idx_v3 = importer->idx_v3;
-	PRINTDB("AMF: add triangle %d - (%.2f, %.2f, %.2f)", importer->vertex_list.size() % idx_v1 % idx_v2 % idx_v3);
-
-	std::vector<Eigen::Vector3d> &v = importer->vertex_list;
-	
-	importer->polySet->append_poly();
-	importer->polySet->append_vertex(v[idx_v1].x(), v[idx_v1].y(), v[idx_v1].z());
-	importer->polySet->append_vertex(v[idx_v2].x(), v[idx_v2].y(), v[idx_v2].z());
-	importer->polySet->append_vertex(v[idx_v3].x(), v[idx_v3].y(), v[idx_v3].z());
+	this->file = fopen(filepath, "rb");
+	return this->file != nullptr;
 }
 
-void AmfImporter::processNode(xmlTextReaderPtr reader)
+int AmfImporter::readInput(char *buffer, int len)
 {
-	const char *name = reinterpret_cast<const char *> (xmlTextReaderName(reader));
-	if (name == nullptr)
-		name = reinterpret_cast<const char *> (xmlStrdup(BAD_CAST "--"));
-	xmlChar *value = xmlTextReaderValue(reader);
-	int node_type = xmlTextReaderNodeType(reader);
-	switch (node_type) {
-	case XML_READER_TYPE_ELEMENT:
-	{
-		xpath += '/';
-		xpath += name;
-		cb_func startFunc = start_funcs[xpath];
-		if (startFunc) {
-			PRINTDB("AMF: start %s", xpath);
-			startFunc(this, nullptr);
-		}
-	}
-		break;
-	case XML_READER_TYPE_END_ELEMENT:
-	{
-		cb_func endFunc = end_funcs[xpath];
-		if (endFunc) {
-			PRINTDB("AMF: end   %s", xpath);
-			endFunc(this, value);
-		}
-        size_t pos = xpath.find_last_of('/');
-        if(pos != std::string::npos)
-            xpath.erase(pos);
-	}
-		break;
-	case XML_READER_TYPE_TEXT:
-	{
-		cb_func textFunc = funcs[xpath];
-		if (textFunc) {
-			PRINTDB("AMF: text  %s - '%s'", xpath % value);
-			textFunc(this, value);
-		}
-	}
-		break;
-	}
-
-	xmlFree(value);
-	xmlFree((void *) (name));
+	const auto n = fread(buffer, 1, len, this->file);
+	return n == 0 && ferror(this->file) ? -1 : int(n);
 }
 
-xmlTextReaderPtr AmfImporter::createXmlReader(const char *filename)
+void AmfImporter::closeInput()
 {
-	return xmlReaderForFile(filename, nullptr, XML_PARSE_NOENT | XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+	if (this->file) fclose(this->file);
+	this->file = nullptr;
 }
 
 int AmfImporter::streamFile(const char *filename)
 {
-	int ret;
-
-	xmlTextReaderPtr reader = createXmlReader(filename);
-	
-	if (reader == nullptr) {
+	if (!openInput(filename)) {
 		PRINTB("WARNING: Can't open import file '%s', import() at line %d", filename % this->loc.firstLine());
 		return 1;
 	}
 
-	try {
-		xmlTextReaderSetParserProp(reader, XML_PARSER_SUBST_ENTITIES, 1);
-		ret = xmlTextReaderRead(reader);
-		while (ret == 1) {
-			processNode(reader);
-			ret = xmlTextReaderRead(reader);
+	xmlSAXHandler handler;
+	memset(&handler, 0, sizeof(handler));
+	handler.initialized = XML_SAX2_MAGIC;
+	handler.startElementNs = startElement;
+	handler.endElementNs = endElement;
+	handler.characters = characters;
+
+	std::vector<char> buffer(256 * 1024);
+	this->parser = xmlCreatePushParserCtxt(&handler, this, nullptr, 0, filename);
+	xmlCtxtUseOptions(this->parser, XML_PARSE_NOENT | XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+	int ret = 0;
+	for (;;) {
+		const int n = readInput(buffer.data(), int(buffer.size()));
+		if (n < 0) {
+			ret = -1;
+			break;
 		}
-		xmlFreeTextReader(reader);
-	} catch (boost::bad_lexical_cast &) {
-		ret = -1;
+		ret = xmlParseChunk(this->parser, buffer.data(), n, n == 0);
+		if (ret != 0 || this->failed || n == 0) break;
 	}
+	if (this->failed) ret = -1;
+	xmlFreeParserCtxt(this->parser);
+	this->parser = nullptr;
+	closeInput();
+
 	if (ret != 0) {
 		PRINTB("WARNING: Failed to parse file '%s', import() at line %d", filename % this->loc.firstLine());
 	}
@@ -247,18 +283,7 @@ int AmfImporter::streamFile(const char *filename)
 
 PolySet * AmfImporter::read(const std::string filename)
 {
-	funcs[coordinates_x] = set_x;
-	funcs[coordinates_y] = set_y;
-	funcs[coordinates_z] = set_z;
-	funcs[triangle_v1] = set_v1;
-	funcs[triangle_v2] = set_v2;
-	funcs[triangle_v3] = set_v3;
-	start_funcs[object] = start_object;
-	end_funcs[coordinates] = end_vertex;
-	end_funcs[triangle] = end_triangle;
-	end_funcs[object] = end_object;
 	streamFile(filename.c_str());
-	vertex_list.clear();
 
 	PolySet *p = nullptr;
 #ifdef ENABLE_CGAL
@@ -298,14 +323,14 @@ private:
 	struct zip *archive;
 	struct zip_file *zipfile;
 
-	static int read_callback(void *context, char *buffer, int len);
-	static int close_callback(void *context);
+protected:
+	bool openInput(const char *filepath) override;
+	int readInput(char *buffer, int len) override;
+	void closeInput() override;
 
 public:
 	AmfImporterZIP(const Location &loc);
 	~AmfImporterZIP();
-
-	xmlTextReaderPtr createXmlReader(const char *filename) override;
 };
 
 AmfImporterZIP::AmfImporterZIP(const Location &loc) : AmfImporter(loc), archive(nullptr), zipfile(nullptr)
@@ -316,19 +341,24 @@ AmfImporterZIP::~AmfImporterZIP()
 {
 }
 
-int AmfImporterZIP::read_callback(void *context, char *buffer, int len)
+int AmfImporterZIP::readInput(char *buffer, int len)
 {
-	AmfImporterZIP *importer = (AmfImporterZIP *)context;
-	return zip_fread(importer->zipfile, buffer, len);
+	if (!zipfile) return AmfImporter::readInput(buffer, len);
+	return int(zip_fread(zipfile, buffer, len));
 }
 
-int AmfImporterZIP::close_callback(void *context)
+void AmfImporterZIP::closeInput()
 {
-	AmfImporterZIP *importer = (AmfImporterZIP *)context;
-	return zip_fclose(importer->zipfile);
+	if (zipfile) {
+		zip_fclose(zipfile);
+		zip_close(archive);
+		zipfile = nullptr;
+		archive = nullptr;
+	}
+	AmfImporter::closeInput();
 }
 
-xmlTextReaderPtr AmfImporterZIP::createXmlReader(const char *filepath)
+bool AmfImporterZIP::openInput(const char *filepath)
 {
 	archive = zip_open(filepath, 0, nullptr);
 	if (archive) {
@@ -347,15 +377,14 @@ xmlTextReaderPtr AmfImporterZIP::createXmlReader(const char *filepath)
 			zipfile = zip_fopen_index(archive, 0, 0);
 		}
 		if (zipfile) {
-			return xmlReaderForIO(read_callback, close_callback, this, filename, nullptr,
-				XML_PARSE_NOENT | XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+			return true;
 		} else {
 			zip_close(archive);
-			zipfile = nullptr;
-			return nullptr;
+			archive = nullptr;
+			return false;
 		}
 	} else {
-		return AmfImporter::createXmlReader(filepath);
+		return AmfImporter::openInput(filepath);
 	}
 }
 
@@ -1,15 +1,180 @@
 #include "import.h"
 #include "polyset.h"
+#include "polyset-utils.h"
 #include "printutils.h"
+#include "ThreadPool.h"
 #include "AST.h"
 #ifdef ENABLE_CGAL
 #include "cgalutils.h"
 #endif
 
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+namespace qi = boost::spirit::qi;
+
+namespace {
+
+const size_t min_parallel_lines = 20000;
+
+typedef std::pair<const char *, const char *> Line;
+
+/*!
+	Splits the file into lines, dropping comments and blank lines.
+*/
+void split_lines(const char *data, size_t size, std::vector<Line> &lines)
+{
+	const char *end = data + size;
+	const char *line = data;
+	while (line < end) {
+		const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+		if (!eol) eol = end;
+		const char *comment = static_cast<const char *>(memchr(line, '#', eol - line));
+		const char *b = line, *e = comment ? comment : eol;
+		line = eol + 1;
+		while (b != e && isspace(static_cast<unsigned char>(*b))) ++b;
+		while (e != b && isspace(static_cast<unsigned char>(*(e - 1)))) --e;
+		if (b != e) lines.emplace_back(b, e);
+	}
+}
+
+/*!
+	Parses the given lines with one task per chunk. parse(line, chunk)
+	returns false on errors; chunk results are kept in order.
+*/
+template<typename Result, typename F>
+bool parse_chunks(const Line *lines, size_t count, std::vector<Result> &chunks, F parse)
+{
+	const auto pool = ThreadPool::instance();
+	const size_t numchunks = pool->isParallel() && count >= min_parallel_lines ? 4 * pool->numThreads() : 1;
+	chunks.resize(numchunks);
+	std::atomic<bool> ok(true);
+	TaskGroup group;
+	for (size_t c = 0; c < numchunks; ++c) {
+		group.run([lines, count, numchunks, c, &chunks, &ok, &parse]() {
+			for (size_t i = count * c / numchunks; i < count * (c + 1) / numchunks && ok; ++i) {
+				if (!parse(lines[i], chunks[c])) ok = false;
+			}
+		});
+	}
+	group.wait();
+	return ok;
+}
+
+/*!
+	Reads the ASCII OFF file in data into mesh. Vertices and faces are
+	expected one per line, as written by all common exporters. Colors, normals
+	and texture coordinates (COFF, NOFF, STOFF) are ignored.
+*/
+bool parse_off(const char *data, size_t size, IndexedMesh &mesh)
+{
+	std::vector<Line> lines;
+	split_lines(data, size, lines);
+	if (lines.empty()) return false;
+
+	// Header keyword, optionally followed by the counts on the same line
+	const char *p = lines[0].first, *end = lines[0].second;
+	const char *keyword = p;
+	while (p != end && !isspace(static_cast<unsigned char>(*p))) ++p;
+	const std::string header(keyword, p);
+	if (header.size() < 3 || header.compare(header.size() - 3, 3, "OFF") != 0 ||
+			header.find_first_of("4n") != std::string::npos) {
+		return false;
+	}
+	size_t next = 1;
+	if (p == end) {
+		if (lines.size() < 2) return false;
+		p = lines[1].first;
+		end = lines[1].second;
+		next = 2;
+	}
+	unsigned int numvertices, numfaces;
+	if (!qi::phrase_parse(p, end, qi::uint_ >> qi::uint_, qi::space, numvertices, numfaces)) return false;
+	if (lines.size() < next + numvertices + numfaces) return false;
+
+	std::vector<std::vector<Vector3d>> vertexchunks;
+	auto parse_vertex = [](const Line &line, std::vector<Vector3d> &vertices) -> bool {
+		const char *it = line.first;
+		double x, y, z;
+		if (!qi::phrase_parse(it, line.second, qi::double_ >> qi::double_ >> qi::double_, qi::space, x, y, z)) return false;
+		vertices.emplace_back(x, y, z);
+		return true;
+	};
+	if (!parse_chunks(&lines[next], numvertices, vertexchunks, parse_vertex)) return false;
+
+	// Faces: indices and sizes per chunk
+	typedef std::pair<std::vector<int>, std::vector<size_t>> Faces;
+	std::vector<Faces> facechunks;
+	auto parse_face = [numvertices](const Line &line, Faces &faces) -> bool {
+		const char *it = line.first;
+		unsigned int n;
+		if (!qi::phrase_parse(it, line.second, qi::uint_, qi::space, n)) return false;
+		for (unsigned int k = 0; k < n; ++k) {
+			unsigned int idx;
+			if (!qi::phrase_parse(it, line.second, qi::uint_, qi::space, idx) || idx >= numvertices) return false;
+			faces.first.push_back(int(idx));
+		}
+		if (n < 3) faces.first.resize(faces.first.size() - n);
+		else faces.second.push_back(n);
+		return true;
+	};
+	if (!parse_chunks(&lines[next + numvertices], numfaces, facechunks, parse_face)) return false;
+
+	mesh = IndexedMesh();
+	mesh.vertices.reserve(numvertices);
+	for (const auto &chunk : vertexchunks) mesh.vertices.insert(mesh.vertices.end(), chunk.begin(), chunk.end());
+	for (const auto &chunk : facechunks) {
+		mesh.indices.insert(mesh.indices.end(), chunk.first.begin(), chunk.first.end());
+		for (auto n : chunk.second) mesh.faceoffsets.push_back(mesh.faceoffsets.back() + n);
+	}
+	return true;
+}
+
+} // namespace
+
+/*!
+	Reads an OFF file into mesh. The file is memory mapped, and vertex
+	and face lines are parsed in parallel.
+*/
+bool import_off_mesh(const std::string &filename, const Location &loc, IndexedMesh &mesh)
+{
+	mesh = IndexedMesh();
+	boost::system::error_code ec;
+	const auto filesize = fs::file_size(filename, ec);
+	if (!ec && filesize == 0) return false;
+
+	bip::file_mapping mapping;
+	bip::mapped_region region;
+	try {
+		bip::file_mapping(filename.c_str(), bip::read_only).swap(mapping);
+		bip::mapped_region(mapping, bip::read_only).swap(region);
+	} catch (const bip::interprocess_exception &) {
+		PRINTB("WARNING: Can't open import file '%s', import() at line %d", filename % loc.firstLine());
+		return false;
+	}
+	return parse_off(static_cast<const char *>(region.get_address()), region.get_size(), mesh);
+}
+
 PolySet *import_off(const std::string &filename, const Location &loc)
 {
 	PolySet *p = new PolySet(3);
+	IndexedMesh mesh;
+	if (import_off_mesh(filename, loc, mesh)) {
+		PolysetUtils::appendIndexedMesh(mesh, *p);
+		return p;
+	}
+	if (!fs::exists(filename)) return p;
 #ifdef ENABLE_CGAL
+	// Fall back to CGAL's reader for layouts the line based reader doesn't
+	// handle (e.g. binary OFF, several records per line)
 	CGAL_Polyhedron poly;
 	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
 	if (!file.good()) {
@@ -21,8 +186,7 @@ PolySet *import_off(const std::string &filename, const Location &loc)
 		CGALUtils::createPolySetFromPolyhedron(poly, *p);
 	}
 #else
-	PRINTB("WARNING: OFF import requires CGAL, import() at line %d", loc.firstLine());
+	PRINTB("WARNING: Can't read OFF file '%s', import() at line %d", filename % loc.firstLine());
 #endif
 	return p;
 }
-	
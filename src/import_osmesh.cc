@@ -0,0 +1,99 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "import.h"
+#include "osmesh.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "printutils.h"
+#include "AST.h"
+
+#ifdef ENABLE_CGAL
+#include "cgalutils.h"
+#endif
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+/*!
+	Reads an .osmesh file, which is memory mapped and decoded in place.
+	Several objects are unioned like for AMF and 3MF; their colors are
+	ignored, as imported geometry has no color.
+*/
+PolySet *import_osmesh(const std::string &filename, const Location &loc)
+{
+	std::vector<OSMesh::Object> objects;
+	boost::system::error_code ec;
+	const auto filesize = fs::file_size(filename, ec);
+	if (ec) {
+		PRINTB("WARNING: Can't open import file '%s', import() at line %d", filename % loc.firstLine());
+		return new PolySet(3);
+	}
+	if (filesize > 0) {
+		bip::file_mapping mapping;
+		bip::mapped_region region;
+		try {
+			bip::file_mapping(filename.c_str(), bip::read_only).swap(mapping);
+			bip::mapped_region(mapping, bip::read_only).swap(region);
+		} catch (const bip::interprocess_exception &) {
+			PRINTB("WARNING: Can't open import file '%s', import() at line %d", filename % loc.firstLine());
+			return new PolySet(3);
+		}
+		if (!OSMesh::read(static_cast<const char *>(region.get_address()), region.get_size(), objects)) {
+			PRINTB("WARNING: Failed to parse file '%s', import() at line %d", filename % loc.firstLine());
+			return new PolySet(3);
+		}
+	}
+
+	std::vector<PolySet *> polySets;
+	for (const auto &object : objects) {
+		auto ps = new PolySet(3);
+		PolysetUtils::appendIndexedMesh(object.mesh, *ps);
+		polySets.push_back(ps);
+	}
+
+	if (polySets.empty()) return new PolySet(3);
+	if (polySets.size() == 1) return polySets[0];
+	PolySet *p = new PolySet(3);
+#ifdef ENABLE_CGAL
+	Geometry::Geometries children;
+	for (auto ps : polySets) {
+		children.push_back(std::make_pair((const AbstractNode*)nullptr, shared_ptr<const Geometry>(ps)));
+	}
+	CGAL_Nef_polyhedron *N = CGALUtils::applyOperator(children, OpenSCADOperator::UNION);
+	if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *p)) {
+		PRINTB("ERROR: Error importing multi-object file '%s', import() at line %d", filename % loc.firstLine());
+	}
+	delete N;
+#else
+	for (auto ps : polySets) delete ps;
+#endif
+	return p;
+}
@@ -1,139 +1,291 @@
 #include "import.h"
 #include "polyset.h"
 #include "printutils.h"
+#include "ThreadPool.h"
+#include "hash.h"
 #include "AST.h"
 
-#include <boost/algorithm/string.hpp>
-#include <boost/regex.hpp>
-#include <boost/lexical_cast.hpp>
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/spirit/include/qi.hpp>
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+namespace qi = boost::spirit::qi;
 
 #define STL_FACET_NUMBYTES 4*3*4+2
-// as there is no 'float32_t' standard, we assume the systems 'float'
-// is a 'binary32' aka 'single' standard IEEE 32-bit floating point type
-union stl_facet {
-	uint8_t data8[ STL_FACET_NUMBYTES ];
-	uint32_t data32[4*3];
-	struct facet_data {
-	  float i, j, k;
-	  float x1, y1, z1;
-	  float x2, y2, z2;
-	  float x3, y3, z3;
-	  uint16_t attribute_byte_count;
-	} data;
-};
-
-#ifdef BOOST_BIG_ENDIAN
-static void uint32_byte_swap(uint32_t &x)
+
+namespace {
+
+const size_t min_parallel_facets = 20000;
+
+uint32_t get_uint32(const char *p)
 {
-# if __GNUC__ >= 4 && __GNUC_MINOR__ >= 3
-	x = __builtin_bswap32( x );
-# elif defined(__clang__)
-	x = __builtin_bswap32( x );
-# elif defined(_MSC_VER)
-	x = _byteswap_ulong( x );
-# else
-	uint32_t b1 = ( 0x000000FF & x ) << 24;
-	uint32_t b2 = ( 0x0000FF00 & x ) << 8;
-	uint32_t b3 = ( 0x00FF0000 & x ) >> 8;
-	uint32_t b4 = ( 0xFF000000 & x ) >> 24;
-	x = b1 | b2 | b3 | b4;
-# endif
+	// STL is little endian, regardless of the host
+	const unsigned char *b = reinterpret_cast<const unsigned char *>(p);
+	return uint32_t(b[0]) | (uint32_t(b[1]) << 8) | (uint32_t(b[2]) << 16) | (uint32_t(b[3]) << 24);
 }
-#endif
 
-static void read_stl_facet(std::ifstream &f, stl_facet &facet)
+float get_float(const char *p)
 {
-	f.read( (char*)facet.data8, STL_FACET_NUMBYTES );
-#ifdef BOOST_BIG_ENDIAN
-	for ( int i = 0; i < 12; i++ ) {
-		uint32_byte_swap( facet.data32[ i ] );
-	}
-	// we ignore attribute byte count
-#endif
+	// as there is no 'float32_t' standard, we assume the systems 'float'
+	// is a 'binary32' aka 'single' standard IEEE 32-bit floating point type
+	const uint32_t x = get_uint32(p);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
 }
 
-PolySet *import_stl(const std::string &filename, const Location &loc)
+/*!
+	Builds mesh from a triangle soup of three consecutive points per
+	triangle, merging equal points.
+
+	Large inputs are deduplicated in parallel: each task owns the points
+	whose hash falls in its shard, and maps them to the first equal point.
+	Vertices are then numbered in order of first use, so the result doesn't
+	depend on the number of threads.
+*/
+void create_mesh(const std::vector<Vector3d> &points, IndexedMesh &mesh)
 {
-	PolySet *p = new PolySet(3);
+	const size_t n = points.size();
+	const auto pool = ThreadPool::instance();
+	const size_t numshards = pool->isParallel() && n >= 3 * min_parallel_facets ? pool->numThreads() : 1;
 
-	// Open file and position at the end
-	std::ifstream f(filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
-	if (!f.good()) {
-		PRINTB("WARNING: Can't open import file '%s', import() at line %d", filename % loc.firstLine());
-		return p;
+	std::vector<size_t> hashes(n);
+	std::vector<int> first(n);
+	TaskGroup group;
+	for (size_t c = 0; c < numshards; ++c) {
+		group.run([&points, &hashes, n, numshards, c]() {
+			const std::hash<Vector3d> hasher;
+			for (size_t i = n * c / numshards; i < n * (c + 1) / numshards; ++i) hashes[i] = hasher(points[i]);
+		});
 	}
-	
-	boost::regex ex_sfe("solid|facet|endloop");
-	boost::regex ex_outer("outer loop");
-	boost::regex ex_vertex("vertex");
-	boost::regex ex_vertices("\\s*vertex\\s+([^\\s]+)\\s+([^\\s]+)\\s+([^\\s]+)");
-	
-	bool binary = false;
-	std::streampos file_size = f.tellg();
-	f.seekg(80);
-	if (f.good() && !f.eof()) {
-		uint32_t facenum = 0;
-		f.read((char *)&facenum, sizeof(uint32_t));
-#ifdef BOOST_BIG_ENDIAN
-		uint32_byte_swap( facenum );
-#endif
-		if (file_size ==  static_cast<std::streamoff>(80 + 4 + 50*facenum)) {
-			binary = true;
+	group.wait();
+
+	for (size_t s = 0; s < numshards; ++s) {
+		group.run([&points, &hashes, &first, n, numshards, s]() {
+			auto hash = [&hashes](int i) { return hashes[i]; };
+			auto equal = [&points](int a, int b) { return points[a] == points[b]; };
+			std::unordered_set<int, decltype(hash), decltype(equal)> seen(n / numshards + 1, hash, equal);
+			for (size_t i = 0; i < n; ++i) {
+				if ((hashes[i] ^ (hashes[i] >> 29)) % numshards != s) continue;
+				first[i] = *seen.insert(int(i)).first;
+			}
+		});
+	}
+	group.wait();
+
+	mesh = IndexedMesh();
+	mesh.indices.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		if (first[i] == int(i)) {
+			mesh.indices[i] = int(mesh.vertices.size());
+			mesh.vertices.push_back(points[i]);
+		}
+		else {
+			mesh.indices[i] = mesh.indices[first[i]];
 		}
 	}
-	f.seekg(0);
-	
-	char data[5];
-	f.read(data, 5);
-	if (!binary && !f.eof() && f.good() && !memcmp(data, "solid", 5)) {
-		int i = 0;
-		double vdata[3][3];
-		std::string line;
-		std::getline(f, line);
-		while (!f.eof()) {
-			std::getline(f, line);
-			boost::trim(line);
-			if (boost::regex_search(line, ex_sfe)) {
-				continue;
-			}
-			if (boost::regex_search(line, ex_outer)) {
-				i = 0;
-				continue;
+	mesh.faceoffsets.reserve(n / 3 + 1);
+	for (size_t i = 3; i <= n; i += 3) mesh.faceoffsets.push_back(i);
+}
+
+/*!
+	Builds a PolySet from a triangle soup, creating the polygons in
+	parallel chunks.
+*/
+void create_polyset(const std::vector<Vector3d> &points, PolySet &ps)
+{
+	const size_t n = points.size() / 3;
+	const auto pool = ThreadPool::instance();
+	const size_t numchunks = pool->isParallel() && n >= min_parallel_facets ? 4 * pool->numThreads() : 1;
+
+	std::vector<Polygons> chunks(numchunks);
+	TaskGroup group;
+	for (size_t c = 0; c < numchunks; ++c) {
+		group.run([&points, &chunks, n, numchunks, c]() {
+			const size_t begin = n * c / numchunks, end = n * (c + 1) / numchunks;
+			chunks[c].reserve(end - begin);
+			for (size_t i = begin; i < end; ++i) {
+				chunks[c].push_back({points[3 * i], points[3 * i + 1], points[3 * i + 2]});
 			}
-			boost::smatch results;
-			if (boost::regex_search(line, results, ex_vertices)) {
-				try {
-					for (int v=0;v<3;v++) {
-						vdata[i][v] = boost::lexical_cast<double>(results[v+1]);
-					}
-				}
-				catch (const boost::bad_lexical_cast &blc) {
-					PRINTB("WARNING: Can't parse vertex line '%s', import() at line %d", line % loc.firstLine());
-					i = 10;
-					continue;
-				}
-				if (++i == 3) {
-					p->append_poly();
-					p->append_vertex(vdata[0][0], vdata[0][1], vdata[0][2]);
-					p->append_vertex(vdata[1][0], vdata[1][1], vdata[1][2]);
-					p->append_vertex(vdata[2][0], vdata[2][1], vdata[2][2]);
+		});
+	}
+	group.wait();
+
+	ps.reserve(n);
+	for (auto &chunk : chunks) {
+		for (auto &poly : chunk) ps.append_poly(std::move(poly));
+	}
+}
+
+/*!
+	Reads the facets of a binary STL file in parallel chunks.
+*/
+void read_binary_stl(const char *data, uint32_t facenum, std::vector<Vector3d> &points)
+{
+	points.resize(size_t(facenum) * 3);
+	const auto pool = ThreadPool::instance();
+	const size_t numchunks = pool->isParallel() && facenum >= min_parallel_facets ? 4 * pool->numThreads() : 1;
+	const char *facets = data + 84;
+
+	TaskGroup group;
+	for (size_t c = 0; c < numchunks; ++c) {
+		group.run([&points, facets, facenum, numchunks, c]() {
+			for (size_t i = facenum * c / numchunks; i < facenum * (c + 1) / numchunks; ++i) {
+				// skip the normal, we ignore attribute byte count
+				const char *p = facets + i * (STL_FACET_NUMBYTES) + 12;
+				for (int k = 0; k < 3; ++k, p += 12) {
+					points[3 * i + k] = Vector3d(get_float(p), get_float(p + 4), get_float(p + 8));
 				}
 			}
+		});
+	}
+	group.wait();
+}
+
+bool contains(const char *begin, const char *end, const char *word)
+{
+	return std::search(begin, end, word, word + strlen(word)) != end;
+}
+
+bool is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+/*!
+	Parses the three coordinates following "vertex" in the given line.
+	Returns false if there are no such tokens, and sets error if they are
+	there but aren't numbers.
+*/
+bool parse_vertex(const char *begin, const char *end, double v[3], bool &error)
+{
+	error = false;
+	const char *word = "vertex";
+	const char *p = std::search(begin, end, word, word + 6);
+	if (p == end) return false;
+	p += 6;
+
+	const char *tokens[3][2];
+	for (int k = 0; k < 3; ++k) {
+		const char *start = p;
+		while (p != end && is_space(*p)) ++p;
+		if (p == start || p == end) return false;
+		tokens[k][0] = p;
+		while (p != end && !is_space(*p)) ++p;
+		tokens[k][1] = p;
+	}
+	for (int k = 0; k < 3; ++k) {
+		const char *it = tokens[k][0];
+		if (!qi::parse(it, tokens[k][1], qi::double_, v[k]) || it != tokens[k][1]) {
+			error = true;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*!
+	Reads an ASCII STL file. Accepts the same input as the previous
+	regex based reader: lines are matched by keyword, and three vertex lines
+	after an "outer loop" line make a facet.
+*/
+void read_ascii_stl(const char *data, size_t size, const Location &loc, std::vector<Vector3d> &points)
+{
+	const char *end = data + size;
+	// skip the "solid" line
+	const char *line = static_cast<const char *>(memchr(data, '\n', size));
+	line = line ? line + 1 : end;
+
+	int i = 0;
+	double vdata[3][3];
+	while (line < end) {
+		const char *eol = static_cast<const char *>(memchr(line, '\n', end - line));
+		if (!eol) eol = end;
+		const char *b = line, *e = eol;
+		line = eol + 1;
+		while (b != e && is_space(*b)) ++b;
+		while (e != b && is_space(*(e - 1))) --e;
+
+		if (contains(b, e, "solid") || contains(b, e, "facet") || contains(b, e, "endloop")) {
+			continue;
+		}
+		if (contains(b, e, "outer loop")) {
+			i = 0;
+			continue;
+		}
+		bool error;
+		if (parse_vertex(b, e, vdata[std::min(i, 2)], error)) {
+			if (++i == 3) {
+				for (int k = 0; k < 3; ++k) points.emplace_back(vdata[k][0], vdata[k][1], vdata[k][2]);
+			}
+		}
+		else if (error) {
+			PRINTB("WARNING: Can't parse vertex line '%s', import() at line %d", std::string(b, e) % loc.firstLine());
+			i = 10;
 		}
 	}
-	else if (binary && !f.eof() && f.good())
-	{
-		f.ignore(80-5+4);
-		while (1) {
-			stl_facet facet;
-			read_stl_facet( f, facet );
-			if (f.eof()) break;
-			p->append_poly();
-			p->append_vertex(facet.data.x1, facet.data.y1, facet.data.z1);
-			p->append_vertex(facet.data.x2, facet.data.y2, facet.data.z2);
-			p->append_vertex(facet.data.x3, facet.data.y3, facet.data.z3);
+}
+
+/*!
+	Reads the triangles of an STL file, three points each. The file is
+	memory mapped; binary files are parsed in parallel.
+*/
+bool read_stl(const std::string &filename, const Location &loc, std::vector<Vector3d> &points)
+{
+	boost::system::error_code ec;
+	const auto filesize = fs::file_size(filename, ec);
+	if (!ec && filesize == 0) return false;
+
+	bip::file_mapping mapping;
+	bip::mapped_region region;
+	try {
+		bip::file_mapping(filename.c_str(), bip::read_only).swap(mapping);
+		bip::mapped_region(mapping, bip::read_only).swap(region);
+	} catch (const bip::interprocess_exception &) {
+		PRINTB("WARNING: Can't open import file '%s', import() at line %d", filename % loc.firstLine());
+		return false;
+	}
+	const char *data = static_cast<const char *>(region.get_address());
+	const size_t size = region.get_size();
+
+	if (size >= 84) {
+		const uint64_t facenum = get_uint32(data + 80);
+		if (size == 84 + (STL_FACET_NUMBYTES) * facenum) {
+			read_binary_stl(data, uint32_t(facenum), points);
+			return true;
 		}
 	}
+	if (size >= 5 && !memcmp(data, "solid", 5)) {
+		read_ascii_stl(data, size, loc, points);
+		return true;
+	}
+	return false;
+}
+
+} // namespace
+
+/*!
+	Reads an STL file into mesh, merging equal vertices.
+*/
+bool import_stl_mesh(const std::string &filename, const Location &loc, IndexedMesh &mesh)
+{
+	mesh = IndexedMesh();
+	std::vector<Vector3d> points;
+	if (!read_stl(filename, loc, points)) return false;
+	create_mesh(points, mesh);
+	return true;
+}
+
+PolySet *import_stl(const std::string &filename, const Location &loc)
+{
+	PolySet *p = new PolySet(3);
+	std::vector<Vector3d> points;
+	if (read_stl(filename, loc, points)) create_polyset(points, *p);
 	return p;
 }
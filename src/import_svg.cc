@@ -24,6 +24,7 @@
  *
  */
 
+#include <memory>
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
@@ -79,10 +80,15 @@ double calc_alignment(const libsvg::align_t alignment, double page_mm, double sc
 
 }
 
-Polygon2d *import_svg(const std::string &filename, const double dpi, const bool center, const Location &loc)
+Polygon2d *import_svg(const std::string &filename, const double dpi, const bool center, double fn, double fs, double fa, const Location &loc)
 {
 	try {
-		const auto shapes = libsvg::libsvg_read_file(filename.c_str());
+		libsvg::fn_params_t fn_params;
+		fn_params.fn = fn;
+		fn_params.fs = fs;
+		fn_params.fa = fa;
+		fn_params.unit_mm = INCH_TO_MM / dpi;
+		const std::unique_ptr<libsvg::shapes_list_t> shapes(libsvg::libsvg_read_file(filename.c_str(), fn_params));
 
 		double width_mm = 0.0;
 		double height_mm = 0.0;
@@ -9,6 +9,7 @@ enum class ImportType {
 	_3MF,
 	STL,
 	OFF,
+	OSMESH,
 	SVG,
 	DXF,
 	NEF3,
@@ -38,9 +38,11 @@ InputEventMapper * InputEventMapper::self = nullptr;
 InputEventMapper::InputEventMapper()
 {
     stopRequest=false;
+    wakeRequested=false;
 
     for (int a = 0;a < max_axis;a++) {
         axisRawValue[a] = 0.0;
+        axisShownValue[a] = NAN;
         axisTrimValue[a] = 0.0;
         axisDeadzone[a] = 0.1;
     }
@@ -106,9 +108,29 @@ double InputEventMapper::getAxisValue(int config)
     return scale(val);
 }
 
+/*
+ * Called on input, also from the driver threads. Posts at most one wake up
+ * until it's handled.
+ */
+void InputEventMapper::wake()
+{
+    if (!wakeRequested.exchange(true)) {
+        QMetaObject::invokeMethod(this, "onWake", Qt::QueuedConnection);
+    }
+}
+
+void InputEventMapper::onWake()
+{
+    wakeRequested = false;
+    if (!stopRequest && !timer->isActive()) {
+        timer->start(30);
+    }
+}
+
 void InputEventMapper::onTimer()
 {
     const double threshold = 0.01;
+    bool active = false;
 
     double tx = getAxisValue(translate[0])*translationGain;
     double ty = getAxisValue(translate[1])*translationGain;
@@ -116,6 +138,7 @@ void InputEventMapper::onTimer()
     if ((fabs(tx) > threshold) || (fabs(ty) > threshold) || (fabs(tz) > threshold)) {
         InputEvent *inputEvent = new InputEventTranslate(tx, ty, tz);
         InputDriverManager::instance()->postEvent(inputEvent);
+        active = true;
     }
     
     double txVPRel = getAxisValue(translate[3])*translationVPRelGain;
@@ -124,6 +147,7 @@ void InputEventMapper::onTimer()
     if ((fabs(txVPRel) > threshold) || (fabs(tyVPRel) > threshold) || (fabs(tzVPRel) > threshold)) {
         InputEvent *inputEvent = new InputEventTranslate(txVPRel, tyVPRel, tzVPRel, true, true, false);
         InputDriverManager::instance()->postEvent(inputEvent);
+        active = true;
     }
     
     double rx = getAxisValue(rotate[0])*rotateGain;
@@ -132,6 +156,7 @@ void InputEventMapper::onTimer()
     if ((fabs(rx) > threshold) || (fabs(ry) > threshold) || (fabs(rz) > threshold)) {
         InputEvent *inputEvent = new InputEventRotate(rx, ry, rz);
         InputDriverManager::instance()->postEvent(inputEvent);
+        active = true;
     }
     
     double rxVPRel = getAxisValue(rotate[3])*rotateVPRelGain;
@@ -140,12 +165,14 @@ void InputEventMapper::onTimer()
     if ((fabs(rxVPRel) > threshold) || (fabs(ryVPRel) > threshold) || (fabs(rzVPRel) > threshold)) {
         InputEvent *inputEvent = new InputEventRotate2(rxVPRel, ryVPRel, rzVPRel);
         InputDriverManager::instance()->postEvent(inputEvent);
+        active = true;
     }
     
     double z = (getAxisValue(zoom)+getAxisValue(zoom2))*zoomGain;
     if (fabs(z) > threshold) {
         InputEvent *inputEvent = new InputEventZoom(z);
         InputDriverManager::instance()->postEvent(inputEvent);
+        active = true;
     }
 
     //update the UI on time, NOT on event as a joystick can fire a high rate of events
@@ -156,14 +183,23 @@ void InputEventMapper::onTimer()
         }
     }
     for (int i = 0; i < max_axis; i++ ){ 
-       Preferences::inst()->AxisConfig->AxesChanged(i,axisRawValue[i] + axisTrimValue[i]);
+        const double value = axisRawValue[i] + axisTrimValue[i];
+        if (value != axisShownValue[i]) {
+            axisShownValue[i] = value;
+            Preferences::inst()->AxisConfig->AxesChanged(i, value);
+        }
     }
 
+    // Nothing moves until the next input
+    if (!active) {
+        timer->stop();
+    }
 }
 
 void InputEventMapper::onAxisChanged(InputEventAxisChanged *event)
 {
     axisRawValue[event->axis] = event->value;
+    wake();
 }
 
 void InputEventMapper::onButtonChanged(InputEventButtonChanged *event)
@@ -171,6 +207,7 @@ void InputEventMapper::onButtonChanged(InputEventButtonChanged *event)
     int button = event->button;
 
     if (button < max_buttons) {
+        wake();
         if (event->down) {
             this->button_state[button]=true;
         }else{
@@ -245,6 +282,7 @@ void InputEventMapper::onInputMappingUpdated()
     rotate[5] = parseSettingValue(s->get(Settings::Settings::inputRotateZVPRel).toString());
     zoom = parseSettingValue(s->get(Settings::Settings::inputZoom).toString());
     zoom2 = parseSettingValue(s->get(Settings::Settings::inputZoom2).toString());
+    wake();
 }
 
 void InputEventMapper::onInputGainUpdated()
@@ -260,6 +298,7 @@ void InputEventMapper::onInputGainUpdated()
     rotateVPRelGain = s->get(Settings::Settings::inputRotateVPRelGain).toDouble();
 
     zoomGain = s->get(Settings::Settings::inputZoomGain).toDouble();
+    wake();
 }
 
 void InputEventMapper::onInputCalibrationUpdated()
@@ -278,6 +317,7 @@ void InputEventMapper::onInputCalibrationUpdated()
             axisDeadzone[a] = setting->get(*ent).toDouble();
         }
     }
+    wake();
 }
 
 void InputEventMapper::onAxisAutoTrim()
@@ -289,6 +329,7 @@ void InputEventMapper::onAxisAutoTrim()
         Settings::SettingsEntry* ent =s->getSettingEntryByName("axisTrim" +is);
         s->set(*ent, axisTrimValue[i]);
     }
+    wake();
 }
 
 void InputEventMapper::onAxisTrimReset()
@@ -300,6 +341,7 @@ void InputEventMapper::onAxisTrimReset()
         Settings::SettingsEntry* ent =s->getSettingEntryByName("axisTrim" +is);
         s->set(*ent, axisTrimValue[i]);
     }
+    wake();
 }
 
 void InputEventMapper::stop(){
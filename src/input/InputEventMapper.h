@@ -25,6 +25,7 @@
  */
 #pragma once
 
+#include <atomic>
 #include <QTimer>
 #include <QObject>
 
@@ -38,8 +39,15 @@ private:
     const static int max_axis = 9;
     const static int max_buttons = 16;
 
+    /*
+     * Runs while an axis is deflected or the configuration widgets need an
+     * update, and is restarted by wake() on the next input, so an idle
+     * device doesn't keep waking the GUI.
+     */
     QTimer *timer;
+    std::atomic<bool> wakeRequested;
     double axisRawValue[max_axis];
+    double axisShownValue[max_axis];
     double axisTrimValue[max_axis];
     double axisDeadzone[max_axis];
     QString actions[max_buttons];
@@ -49,6 +57,7 @@ private:
     int zoom2;
     volatile bool stopRequest;
 
+    void wake();
     double scale(double val);
     double getAxisValue(int config);
     int parseSettingValue(const std::string val);
@@ -91,4 +100,5 @@ public:
 
 private slots:
     void onTimer();
+    void onWake();
 };
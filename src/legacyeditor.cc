@@ -2,6 +2,8 @@
 #include "Preferences.h"
 #include "highlighter.h"
 #include "QSettingsCached.h"
+#include <QTextBlock>
+#include <algorithm>
 
 LegacyEditor::LegacyEditor(QWidget *parent) : EditorInterface(parent)
 {
@@ -145,6 +147,17 @@ void LegacyEditor::highlightError(int error_pos)
 
 }
 
+void LegacyEditor::setCursorPosition(int line, int col)
+{
+	const auto block = this->textedit->document()->findBlockByNumber(line);
+	if (!block.isValid()) return;
+	QTextCursor cursor(block);
+	cursor.movePosition(QTextCursor::Right, QTextCursor::MoveAnchor, std::min(col, block.length() - 1));
+	this->textedit->setTextCursor(cursor);
+	this->textedit->ensureCursorVisible();
+	this->textedit->setFocus();
+}
+
 void LegacyEditor::unhighlightLastError()
 {
 	highlighter->unhighlightLastError();
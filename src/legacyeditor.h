@@ -32,6 +32,7 @@ public slots:
 	void setPlainText(const QString&) override;
 	void highlightError(int) override;
 	void unhighlightLastError() override;
+	void setCursorPosition(int line, int col) override;
 	void setHighlightScheme(const QString&) override;
 	void insert(const QString&) override;
 	void setText(const QString&) override;
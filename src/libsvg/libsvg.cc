@@ -40,6 +40,7 @@
 #include "polygon.h"
 #include "polyline.h"
 #include "rect.h"
+#include "ThreadPool.h"
 
 namespace fs = boost::filesystem;
 
@@ -50,6 +51,9 @@ namespace libsvg {
 static bool in_defs = false;
 static shapes_list_t stack;
 static shapes_list_t *shape_list;
+static fn_params_t fn_params;
+// Shapes whose outline is computed after parsing, see flatten_shapes()
+static std::vector<std::pair<shape *, attr_map_t>> pending;
 
 #if SVG_DEBUG
 static std::string dump_stack() {
@@ -104,15 +108,18 @@ void processNode(xmlTextReaderPtr reader)
 		auto s = shared_ptr<shape>(shape::create_from_name(name));
 		if (!in_defs && s) {
 			attr_map_t attrs = read_attributes(reader);
-			s->set_attrs(attrs);
+			s->set_fn_params(fn_params);
 			shape_list->push_back(s);
 			if (!stack.empty()) {
 				stack.back()->add_child(s.get());
 			}
 			if (s->is_container()) {
+				s->set_attrs(attrs);
+				s->apply_transform();
 				stack.push_back(s);
+			} else {
+				pending.emplace_back(s.get(), std::move(attrs));
 			}
-			s->apply_transform();
 		}
 	}	
 	if (!isEmpty) {
@@ -162,11 +169,36 @@ void processNode(xmlTextReaderPtr reader)
 	xmlFree((void *) (name));
 }
 
+/**
+ * Computes the outlines of the shapes collected while parsing. Paths are
+ * flattened and transformed independently of each other, so that's done
+ * concurrently. Their containers are complete at this point, which
+ * apply_transform() needs for the transformations of the parents.
+ */
+static void flatten_shapes()
+{
+	const auto pool = ThreadPool::instance();
+	const size_t count = pending.size();
+	const size_t numchunks = pool->isParallel() && count >= 64 ? 4 * pool->numThreads() : 1;
+	TaskGroup group;
+	for (size_t c = 0;c < numchunks;c++) {
+		group.run([count, numchunks, c]() {
+			for (size_t i = count * c / numchunks;i < count * (c + 1) / numchunks;i++) {
+				pending[i].first->set_attrs(pending[i].second);
+				pending[i].first->apply_transform();
+			}
+		});
+	}
+	group.wait();
+}
+
 int streamFile(const char *filename)
 {
 	xmlTextReaderPtr reader;
 
 	in_defs = false;
+	stack.clear();
+	pending.clear();
 	reader = xmlNewTextReaderFilename(filename);
 	xmlTextReaderSetParserProp(reader, XML_PARSER_SUBST_ENTITIES, 1);
 	if (reader != nullptr) {
@@ -177,8 +209,16 @@ int streamFile(const char *filename)
 		}
 		xmlFreeTextReader(reader);
 		if (ret != 0) {
+			pending.clear();
 			throw SvgException((boost::format("Error parsing file '%1%'") % filename).str());
 		}
+		try {
+			flatten_shapes();
+		} catch (...) {
+			pending.clear();
+			throw;
+		}
+		pending.clear();
 	} else {
 		throw SvgException((boost::format("Can't open file '%1%'") % filename).str());
 	}
@@ -196,8 +236,9 @@ void dump(int idx, shape *s) {
 }
 
 shapes_list_t *
-libsvg_read_file(const char *filename)
+libsvg_read_file(const char *filename, const fn_params_t &params)
 {
+	fn_params = params;
 	shape_list = new shapes_list_t();
 	streamFile(filename);
 
@@ -50,7 +50,7 @@ private:
 using shapes_list_t = std::vector<shared_ptr<shape>>;
 
 shapes_list_t *
-libsvg_read_file(const char *filename);
+libsvg_read_file(const char *filename, const fn_params_t &params = fn_params_t());
 
 void
 libsvg_free(shapes_list_t *shapes);
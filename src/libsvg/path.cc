@@ -132,7 +132,8 @@ path::arc_to(path_t& path, double x1, double y1, double rx, double ry, double x2
 		delta -= 360;
 	}
 	
-	int steps = std::fabs(delta) * 10.0 / 180 + 4;
+	const double fragments = get_fragments_from_r(std::fmax(rx, ry)) * std::fabs(delta) / 360;
+	const int steps = std::isfinite(fragments) && fragments > 1 ? static_cast<int>(std::ceil(fragments)) : 1;
 	for (int a = 0;a <= steps;a++) {
 		double phi = theta + delta * a / steps;
 
@@ -146,7 +147,7 @@ path::arc_to(path_t& path, double x1, double y1, double rx, double ry, double x2
 void
 path::curve_to(path_t& path, double x, double y, double cx1, double cy1, double x2, double y2)
 {
-	unsigned long fn = 20;
+	const unsigned long fn = get_curve_segments({{x, y}, {cx1, cy1}, {x2, y2}});
 	for (unsigned long idx = 1;idx <= fn;idx++) {
 		const double a = idx * (1.0 / (double)fn);
 		const double xx = x * t(a, 2) + cx1 * 2 * t(a, 1) * a + x2 * a * a;
@@ -158,7 +159,7 @@ path::curve_to(path_t& path, double x, double y, double cx1, double cy1, double
 void
 path::curve_to(path_t& path, double x, double y, double cx1, double cy1, double cx2, double cy2, double x2, double y2)
 {
-	unsigned long fn = 20;
+	const unsigned long fn = get_curve_segments({{x, y}, {cx1, cy1}, {cx2, cy2}, {x2, y2}});
 	for (unsigned long idx = 1;idx <= fn;idx++) {
 		const double a = idx * (1.0 / (double)fn);
 		const double xx = x * t(a, 3) + cx1 * 3 * t(a, 2) * a + cx2 * 3 * t(a, 1) * a * a + x2 * a * a * a;
@@ -46,6 +46,7 @@
 
 #include "transformation.h"
 #include "degree_trig.h"
+#include "calc.h"
 
 namespace libsvg {
 
@@ -281,9 +282,45 @@ shape::offset_path(path_list_t& path_list, path_t& path, double stroke_width, Cl
 	}
 }
 
+/**
+ * Number of segments of a full circle with radius r, in user units.
+ */
+int
+shape::get_fragments_from_r(double r) const
+{
+	return Calc::get_fragments_from_r(r * fn_params.unit_mm, fn_params.fn, fn_params.fs, fn_params.fa);
+}
+
+/**
+ * Number of segments of a Bezier curve, estimated from its control
+ * polygon: the polygon's length is an upper bound of the curve's, and
+ * its turning angle bounds the curve's. $fn gives the number directly.
+ */
+int
+shape::get_curve_segments(const std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>>& control_points) const
+{
+	if (fn_params.fn > 0.0) return fn_params.fn >= 1 ? static_cast<int>(fn_params.fn) : 1;
+
+	double length = 0;
+	double turn = 0;
+	Eigen::Vector2d last_dir(0, 0);
+	for (size_t i = 1;i < control_points.size();i++) {
+		const Eigen::Vector2d d = control_points[i] - control_points[i - 1];
+		const double l = d.norm();
+		if (l == 0) continue;
+		if (length > 0) {
+			turn += std::fabs(atan2_degrees(last_dir.x() * d.y() - last_dir.y() * d.x(), last_dir.dot(d)));
+		}
+		length += l;
+		last_dir = d;
+	}
+	const double segments = std::fmax(std::fmin(turn / fn_params.fa, length * fn_params.unit_mm / fn_params.fs), 1);
+	return std::isfinite(segments) ? static_cast<int>(std::ceil(segments)) : 1;
+}
+
 void
 shape::draw_ellipse(path_t& path, double x, double y, double rx, double ry) {
-	unsigned long fn = 40;
+	unsigned long fn = get_fragments_from_r(std::fmax(rx, ry));
 	for (unsigned long idx = 1;idx <= fn;idx++) {
 		const double a = idx * 360.0 / fn;
 		const double xx = rx * sin_degrees(a) + x;
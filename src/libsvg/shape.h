@@ -42,6 +42,17 @@ using path_t = std::vector<Eigen::Vector3d>;
 using path_list_t = std::vector<path_t>;
 using attr_map_t = std::map<std::string, std::string>;
 
+/**
+ * How curves are flattened, by $fn, $fs and $fa like circles. As $fs is
+ * a length in mm, user units are converted with unit_mm.
+ */
+struct fn_params_t {
+    double fn = 0;
+    double fs = 2;
+    double fa = 12;
+    double unit_mm = 25.4 / 72;
+};
+
 class shape {
 private:
     shape *parent;
@@ -57,11 +68,14 @@ protected:
     std::string stroke_linecap;
     std::string stroke_linejoin;
     std::string style;
+    fn_params_t fn_params;
 
     double get_stroke_width() const;
     ClipperLib::EndType get_stroke_linecap() const;
     ClipperLib::JoinType get_stroke_linejoin() const;
     const std::string get_style(std::string name) const;
+    int get_fragments_from_r(double r) const;
+    int get_curve_segments(const std::vector<Eigen::Vector2d, Eigen::aligned_allocator<Eigen::Vector2d>>& control_points) const;
     void draw_ellipse(path_t& path, double x, double y, double rx, double ry);
     void offset_path(path_list_t& path_list, path_t& path, double stroke_width, ClipperLib::EndType stroke_linecap);
     void collect_transform_matrices(std::vector<Eigen::Matrix3d>& matrices, shape *s);
@@ -75,6 +89,8 @@ public:
     virtual void add_child(shape *s) { children.push_back(s); s->set_parent(this); }
     virtual const std::vector<shape *>& get_children() const { return children; }
     
+    void set_fn_params(const fn_params_t& params) { fn_params = params; }
+
     virtual const std::string& get_id() const { return id; }
     virtual double get_x() const { return x; }
     virtual double get_y() const { return y; }
@@ -71,6 +71,23 @@ std::vector<AbstractNode*> LocalScope::instantiateChildren(const Context *evalct
 	return childnodes;
 }
 
+/*!
+	Returns true if a root modifier (!) is used anywhere in this scope,
+	including nested scopes and the bodies of modules defined here.
+*/
+bool LocalScope::hasRootTag() const
+{
+	for (const auto &inst : this->children) {
+		if (inst->isRoot() || inst->scope.hasRootTag()) return true;
+		auto ifelse = dynamic_cast<const IfElseModuleInstantiation *>(inst);
+		if (ifelse && ifelse->else_scope.hasRootTag()) return true;
+	}
+	for (const auto &m : this->astModules) {
+		if (m.second->scope.hasRootTag()) return true;
+	}
+	return false;
+}
+
 /*!
 	When instantiating a module which can take a scope as parameter (i.e. non-leaf nodes),
 	use this method to apply the local scope definitions to the evaluation context.
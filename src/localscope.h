@@ -18,6 +18,7 @@ public:
 	void addAssignment(const class Assignment &ass);
 	void apply(Context &ctx) const;
 	bool hasChildren() const {return !(children.empty());};
+	bool hasRootTag() const;
 
 	AssignmentList assignments;
 	std::vector<ModuleInstantiation*> children;
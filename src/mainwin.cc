@@ -24,10 +24,16 @@
  *
  */
 #include <iostream>
+#include <sstream>
+#include <mutex>
 #include "comment.h"
 #include "openscad.h"
 #include "GeometryCache.h"
+#include "FunctionCache.h"
+#include "ModuleCallCache.h"
+#include "ImportCache.h"
 #include "ModuleCache.h"
+#include "StatCache.h"
 #include "MainWindow.h"
 #include "OpenSCADApp.h"
 #include "parsersettings.h"
@@ -37,6 +43,7 @@
 #include "node.h"
 #include "polyset.h"
 #include "csgnode.h"
+#include "ModuleInstantiation.h"
 #include "highlighter.h"
 #include "builtin.h"
 #include "memory.h"
@@ -51,9 +58,11 @@
 #ifdef ENABLE_OPENCSG
 #include "CSGTreeEvaluator.h"
 #include "OpenCSGRenderer.h"
+#include "RayMarchRenderer.h"
 #include <opencsg.h>
 #endif
 #include "ProgressWidget.h"
+#include "previewworker.h"
 #include "ThrownTogetherRenderer.h"
 #include "CSGTreeNormalizer.h"
 #include "QGLView.h"
@@ -68,6 +77,7 @@
 
 #include <QMenu>
 #include <QTime>
+#include <QThread>
 #include <QMenuBar>
 #include <QSplitter>
 #include <QFileDialog>
@@ -96,11 +106,8 @@
 #include <QSound>
 
 #if (QT_VERSION < QT_VERSION_CHECK(5, 0, 0))
-#include <QTextDocument>
-#define QT_HTML_ESCAPE(qstring) Qt::escape(qstring)
 #undef ENABLE_3D_PRINTING
 #else
-#define QT_HTML_ESCAPE(qstring) (qstring).toHtmlEscaped()
 #define ENABLE_3D_PRINTING
 #include "OctoPrint.h"
 #include "PrintService.h"
@@ -109,6 +116,7 @@
 #include <fstream>
 
 #include <algorithm>
+#include <unordered_set>
 #include <boost/version.hpp>
 #include <sys/stat.h>
 
@@ -121,6 +129,8 @@
 #include "cgal.h"
 #include "cgalworker.h"
 #include "cgalutils.h"
+#include "CSGBackend.h"
+#include "EvaluationSnapshot.h"
 
 #endif // ENABLE_CGAL
 
@@ -191,6 +201,7 @@ MainWindow::MainWindow(const QStringList &filenames)
 	knownFileExtensions["stl"] = importStatement;
 	knownFileExtensions["3mf"] = importStatement;
 	knownFileExtensions["off"] = importStatement;
+	knownFileExtensions["osmesh"] = importStatement;
 	knownFileExtensions["dxf"] = importStatement;
 	knownFileExtensions["svg"] = importStatement;
 	knownFileExtensions["amf"] = importStatement;
@@ -237,12 +248,19 @@ MainWindow::MainWindow(const QStringList &filenames)
 	connect(this->cgalworker, SIGNAL(done(shared_ptr<const Geometry>)),
 					this, SLOT(actionRenderDone(shared_ptr<const Geometry>)));
 #endif
+	this->previewworker = new PreviewWorker();
+	connect(this->previewworker, SIGNAL(done()), this, SLOT(previewDone()));
+	this->previewRestart = false;
+	this->previewAborted = false;
+	this->previewRequested = false;
 
 #ifdef ENABLE_CGAL
 	this->cgalRenderer = nullptr;
+	this->approximateRender = false;
 #endif
 #ifdef ENABLE_OPENCSG
 	this->opencsgRenderer = nullptr;
+	this->rayMarchRenderer = nullptr;
 #endif
 	this->thrownTogetherRenderer = nullptr;
 
@@ -271,11 +289,19 @@ MainWindow::MainWindow(const QStringList &filenames)
 	autoReloadTimer->setSingleShot(false);
 	autoReloadTimer->setInterval(200);
 	connect(autoReloadTimer, SIGNAL(timeout()), this, SLOT(checkAutoReload()));
+	// Lets the reload polls answer from memory for files which haven't changed
+	StatCache::watch();
 
 	waitAfterReloadTimer = new QTimer(this);
 	waitAfterReloadTimer->setSingleShot(true);
 	waitAfterReloadTimer->setInterval(200);
 	connect(waitAfterReloadTimer, SIGNAL(timeout()), this, SLOT(waitAfterReload()));
+
+	// A preview cancelled by an edit starts again once the typing pauses
+	previewRestartTimer = new QTimer(this);
+	previewRestartTimer->setSingleShot(true);
+	previewRestartTimer->setInterval(300);
+	connect(previewRestartTimer, SIGNAL(timeout()), this, SLOT(actionRenderPreview()));
 	connect(this->parameterWidget, SIGNAL(previewRequested(bool)), this, SLOT(actionRenderPreview(bool)));
 	connect(Preferences::inst(), SIGNAL(ExperimentalChanged()), this, SLOT(changeParameterWidget()));
 	connect(this->e_tval, SIGNAL(textChanged(QString)), this, SLOT(updatedAnimTval()));
@@ -340,8 +366,10 @@ MainWindow::MainWindow(const QStringList &filenames)
 	connect(this->designActionPreview, SIGNAL(triggered()), this, SLOT(actionRenderPreview()));
 #ifdef ENABLE_CGAL
 	connect(this->designActionRender, SIGNAL(triggered()), this, SLOT(actionRender()));
+	connect(this->designActionRenderApproximate, SIGNAL(triggered()), this, SLOT(actionRenderApproximate()));
 #else
 	this->designActionRender->setVisible(false);
+	this->designActionRenderApproximate->setVisible(false);
 #endif
 	connect(this->designAction3DPrint, SIGNAL(triggered()), this, SLOT(action3DPrint()));
 	connect(this->designCheckValidity, SIGNAL(triggered()), this, SLOT(actionCheckValidity()));
@@ -427,6 +455,7 @@ MainWindow::MainWindow(const QStringList &filenames)
 	PRINT(copyrighttext);
 
 	connect(this->qglview, SIGNAL(doAnimateUpdate()), this, SLOT(animateUpdate()));
+	connect(this->qglview, SIGNAL(objectPicked(QString)), this, SLOT(jumpToPicked(QString)));
 
 	connect(Preferences::inst(), SIGNAL(requestRedraw()), this->qglview, SLOT(updateGL()));
 	connect(Preferences::inst(), SIGNAL(updateMouseCentricZoom(bool)), this->qglview, SLOT(setMouseCentricZoom(bool)));
@@ -575,7 +604,7 @@ MainWindow::MainWindow(const QStringList &filenames)
 	setAcceptDrops(true);
 	clearCurrentOutput();
 
-	this->console->setMaximumBlockCount(5000);
+	this->console->setMaximumBlockCount(Console::maxLines);
 
 	for(int i = 1; i < filenames.size(); i++)
 		tabManager->createTab(filenames[i]);
@@ -746,9 +775,14 @@ void MainWindow::updateReorderMode(bool reorderMode)
 
 MainWindow::~MainWindow()
 {
+	// The preview worker uses the members below
+	if (this->previewworker->isRunning() && this->progresswidget) this->progresswidget->cancel();
+	delete this->previewworker;
+#ifdef ENABLE_CGAL
+	this->cgalworker->cancelSpeculation(true);
+#endif
 	// If root_module is not null then it will be the same as parsed_module,
-	// so no need to delete it.
-	delete parsed_module;
+	// which is owned by nodeReuseCache, so no need to delete it.
 	delete root_node;
 #ifdef ENABLE_CGAL
 	this->root_geom.reset();
@@ -756,6 +790,7 @@ MainWindow::~MainWindow()
 #endif
 #ifdef ENABLE_OPENCSG
 	delete this->opencsgRenderer;
+	delete this->rayMarchRenderer;
 #endif
 	delete this->thrownTogetherRenderer;
 	scadApp->windowManager.remove(this);
@@ -771,11 +806,15 @@ void MainWindow::showProgress()
 	updateStatusBar(qobject_cast<ProgressWidget*>(sender()));
 }
 
-void MainWindow::report_func(const class AbstractNode*, void *vp, int mark)
+void MainWindow::report_func(const class AbstractNode*, void *vp, double mark)
 {
-	// limit to progress bar update calls to 5 per second
+	// limit to progress bar update calls to 5 per second. Reports come from
+	// several threads while rendering in parallel; those finding the throttle
+	// taken by another thread skip their update.
 	static const qint64 MIN_TIMEOUT = 200;
-	if (progressThrottle->hasExpired(MIN_TIMEOUT)) {
+	static std::mutex throttle_mutex;
+	std::unique_lock<std::mutex> lock(throttle_mutex, std::try_to_lock);
+	if (lock.owns_lock() && progressThrottle->hasExpired(MIN_TIMEOUT)) {
 		progressThrottle->start();
 
 		auto thisp = static_cast<MainWindow*>(vp);
@@ -784,7 +823,8 @@ void MainWindow::report_func(const class AbstractNode*, void *vp, int mark)
 		if (permille > thisp->progresswidget->value()) {
 			QMetaObject::invokeMethod(thisp->progresswidget, "setValue", Qt::QueuedConnection,
 																Q_ARG(int, permille));
-			QApplication::processEvents();
+			// Workers leave the GUI thread alone
+			if (QThread::currentThread() == thisp->thread()) QApplication::processEvents();
 		}
 
 		// FIXME: Check if cancel was requested by e.g. Application quit
@@ -792,6 +832,12 @@ void MainWindow::report_func(const class AbstractNode*, void *vp, int mark)
 	}
 }
 
+void MainWindow::cancel_func(void *vp)
+{
+	auto thisp = static_cast<MainWindow*>(vp);
+	if (thisp->progresswidget->wasCanceled()) throw ProgressCancelException();
+}
+
 bool MainWindow::network_progress_func(const double permille)
 {
 	QMetaObject::invokeMethod(this->progresswidget, "setValue", Qt::QueuedConnection, Q_ARG(int, (int)permille));
@@ -900,6 +946,10 @@ void MainWindow::compile(bool reload, bool forcedone, bool rebuildParameterWidge
 	OpenSCAD::hardwarnings = Preferences::inst()->getValue("advanced/enableHardwarnings").toBool();
 	OpenSCAD::parameterCheck = Preferences::inst()->getValue("advanced/enableParameterCheck").toBool();
 	OpenSCAD::rangeCheck = Preferences::inst()->getValue("advanced/enableParameterRangeCheck").toBool();
+#ifdef ENABLE_CGAL
+	// The tree and the progress reporting are about to be replaced
+	this->cgalworker->cancelSpeculation(true);
+#endif
 
 	try{
 		bool shouldcompiletoplevel = false;
@@ -934,19 +984,30 @@ void MainWindow::compile(bool reload, bool forcedone, bool rebuildParameterWidge
 			shouldcompiletoplevel = true;
 		}
 
+		bool includesChanged = false;
 		if (this->parsed_module) {
 			auto mtime = this->parsed_module->includesChanged();
 			if (mtime > this->includes_mtime) {
 				this->includes_mtime = mtime;
 				shouldcompiletoplevel = true;
+				includesChanged = true;
 			}
 		}
 		// Parsing and dependency handling must run to completion even with stop on errors to prevent auto
 		// reload picking up where it left off, thwarting the stop, so we turn off exceptions in PRINT.
 		no_exceptions_for_warnings();
 		if (shouldcompiletoplevel) {
-			if (activeEditor->isContentModified()) saveBackup();
-			parseTopLevelDocument(rebuildParameterWidget);
+			// A customizer edit leaves the text as it was, so the last parse just takes the new values.
+			// The statements not reading the changed parameters then keep their subtrees.
+			if (!reload && !rebuildParameterWidget && !includesChanged && this->root_module &&
+					customizerEditor == activeEditor && activeEditor->toPlainText() == this->last_compiled_doc) {
+				resetSuppressedMessages();
+				this->parameterWidget->applyParameters(this->root_module);
+			}
+			else {
+				if (activeEditor->isContentModified()) saveBackup();
+				parseTopLevelDocument(rebuildParameterWidget);
+			}
 			didcompile = true;
 		}
 
@@ -1050,6 +1111,11 @@ void MainWindow::compileDone(bool didchange)
 		const char *callslot;
 		if (didchange) {
 			updateTemporalVariables();
+			// The preview worker invokes afterCompileSlot when done
+			if (!strcmp(afterCompileSlot, "csgRender") || !strcmp(afterCompileSlot, "csgReloadRender")) {
+				startPreview();
+				return;
+			}
 			instantiateRoot();
 			updateCompileResult();
 			callslot = afterCompileSlot;
@@ -1081,39 +1147,84 @@ void MainWindow::instantiateRoot()
 #ifdef ENABLE_OPENCSG
 	delete this->opencsgRenderer;
 	this->opencsgRenderer = nullptr;
+	delete this->rayMarchRenderer;
+	this->rayMarchRenderer = nullptr;
 #endif
 	delete this->thrownTogetherRenderer;
 	this->thrownTogetherRenderer = nullptr;
 
-	// Remove previous CSG tree
+	boost::filesystem::path doc(activeEditor->filepath.toStdString());
+	this->tree.setDocumentPath(doc.remove_filename().string());
+
+	instantiateTree();
+	updateCamera();
+}
+
+/*!
+	Instantiates root_node from root_module. Touches no widgets, so it can
+	run on the preview worker.
+*/
+void MainWindow::instantiateTree()
+{
+	// Keep unchanged top-level subtrees, remove the rest of the previous CSG tree.
+	// Statements reading $t are told apart by their lookups, so the others
+	// are kept while animating.
+	std::ostringstream environment;
+	environment << this->includes_mtime << " " << this->deps_mtime;
+	for (const auto &name : {"$vpt", "$vpr", "$vpd", "$preview"}) {
+		environment << " " << name << "=" << this->top_ctx.lookup_variable(name, true)->toString();
+	}
+	this->nodeReuseCache.begin(this->absolute_root_node, environment.str());
 	delete this->absolute_root_node;
 	this->absolute_root_node = nullptr;
 
 	this->csgRoot.reset();
 	this->normalizedRoot.reset();
 	this->root_products.reset();
+	this->rayMarchScene.reset();
+	this->rayMarchMeshProducts.reset();
 
 	this->root_node = nullptr;
-	this->tree.setRoot(nullptr);
-
-	boost::filesystem::path doc(activeEditor->filepath.toStdString());
-	this->tree.setDocumentPath(doc.remove_filename().string());
-
+	this->tree.setRoot(nullptr, true);
+
+	this->viewportValues.clear();
+	bool cancelled = false;
+	// Reused nodes keep their index, so new nodes must not collide with them.
+	// Without any, the indices start over, and the ids cached for the old
+	// nodes would be taken for the new nodes of the same index.
+	const bool keepCache = this->nodeReuseCache.hasCandidates();
 	if (this->root_module) {
 		// Evaluate CSG tree
 		PRINT("Compiling design (CSG Tree generation)...");
 		this->processEvents();
 
-		AbstractNode::resetIndexCounter();
+		if (!keepCache) {
+			AbstractNode::resetIndexCounter();
+			this->tree.setRoot(nullptr, false);
+		}
 
 		// split these two lines - gcc 4.7 bug
 		auto mi = ModuleInstantiation( "group" );
 		this->root_inst = mi;
 
 		FileContext filectx(&top_ctx);
-		this->absolute_root_node = this->root_module->instantiateWithFileContext(&filectx, &this->root_inst, nullptr);
-		this->updateCamera(filectx);
-		
+		// Entries of an aborted compile may refer to deleted functions
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+		try {
+			this->absolute_root_node = this->root_module->instantiateWithFileContext(&filectx, &this->root_inst, nullptr, &this->nodeReuseCache);
+		} catch (const ProgressCancelException &) {
+			PRINT("Compiling design cancelled.");
+			cancelled = true;
+		}
+		FunctionCache::instance()->print();
+		ModuleCallCache::instance()->print();
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+		for (const auto &name : {"$vpr", "$vpt", "$vpd"}) {
+			this->viewportValues.push_back(filectx.lookup_variable(name));
+		}
+
 		if (this->absolute_root_node) {
 			// Do we have an explicit root node (! modifier)?
 			if (!(this->root_node = find_root_tag(this->absolute_root_node))) {
@@ -1121,11 +1232,12 @@ void MainWindow::instantiateRoot()
 			}
 
 			// FIXME: Consider giving away ownership of root_node to the Tree, or use reference counted pointers
-			this->tree.setRoot(this->root_node);
+			this->tree.setRoot(this->root_node, keepCache);
 		}
 	}
+	this->nodeReuseCache.end();
 
-	if (!this->root_node) {
+	if (!this->root_node && !cancelled) {
 		if (parser_error_pos < 0) {
 			PRINT("ERROR: Compilation failed! (no top level object found)");
 		} else {
@@ -1136,126 +1248,239 @@ void MainWindow::instantiateRoot()
 	}
 }
 
+/*!
+	Starts the compile of a preview on the preview worker: instantiates the
+	root and generates the CSG products. The previous preview stays on
+	display until previewDone() replaces it. Edits made meanwhile cancel
+	the compile, also while instantiating, and start a new one once the
+	typing pauses, see cancelStalePreview().
+*/
+void MainWindow::startPreview()
+{
+	boost::filesystem::path doc(activeEditor->filepath.toStdString());
+	this->tree.setDocumentPath(doc.remove_filename().string());
+
+	OpenSCAD::hardwarnings = Preferences::inst()->getValue("advanced/enableHardwarnings").toBool();
+	this->previewRestart = false;
+	this->previewAborted = false;
+	this->progresswidget = new ProgressWidget(this);
+	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
+
+	this->previewworker->start([this]() {
+		progress_cancel_prep(cancel_func, this);
+		try {
+			instantiateTree();
+			// Edits during the instantiation cancel before generating products
+			if (this->root_node && !this->progresswidget->wasCanceled()) compileCSG();
+		} catch (const HardWarningException &) {
+			this->previewAborted = true;
+		}
+		progress_cancel_fin();
+	});
+}
+
+void MainWindow::previewDone()
+{
+	const bool restart = this->previewRestart && this->progresswidget->wasCanceled();
+	updateStatusBar(nullptr);
+	updateCamera();
+	updateCompileResult();
+	this->procevents = false;
+
+	if (this->previewAborted) {
+		exceptionCleanup();
+	}
+	else if (restart) {
+		PRINT("Preview cancelled, the design was changed.");
+		compileEnded();
+		this->previewRestartTimer->start();
+	}
+	else {
+		createPreviewRenderers();
+		QMetaObject::invokeMethod(this, this->afterCompileSlot);
+#ifdef ENABLE_CGAL
+		checkSnapshot();
+		if (!this->previewRequested) startSpeculativeRender();
+#endif
+	}
+	// Requested while compiling
+	if (this->previewRequested && !restart) QTimer::singleShot(0, this, SLOT(actionRenderPreview()));
+}
+
+/*!
+	Called for edits of the document; cancels a running compile of a
+	preview, which is then compiled again. Further edits postpone that
+	compile, so only the latest one is previewed.
+*/
+void MainWindow::cancelStalePreview()
+{
+	if (sender() != activeEditor) return;
+#ifdef ENABLE_CGAL
+	this->cgalworker->cancelSpeculation(false);
+#endif
+	if (this->previewRestartTimer->isActive()) {
+		this->previewRestartTimer->start();
+		return;
+	}
+	if (!this->previewworker->isRunning() || !this->progresswidget) return;
+	this->previewRestart = true;
+	this->progresswidget->cancel();
+}
+
 /*!
 	Generates CSG tree for OpenCSG evaluation.
 	Assumes that the design has been parsed and evaluated (this->root_node is set)
+	Runs on the preview worker, see startPreview().
 */
 void MainWindow::compileCSG()
 {
-	OpenSCAD::hardwarnings = Preferences::inst()->getValue("advanced/enableHardwarnings").toBool();
-	try{
-		assert(this->root_node);
-		PRINT("Compiling design (CSG Products generation)...");
-		this->processEvents();
-
-		// Main CSG evaluation
-		this->progresswidget = new ProgressWidget(this);
-		connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
+	assert(this->root_node);
+	PRINT("Compiling design (CSG Products generation)...");
 
+	// Main CSG evaluation
 #ifdef ENABLE_CGAL
-			GeometryEvaluator geomevaluator(this->tree);
+	GeometryEvaluator geomevaluator(this->tree);
 #else
-			// FIXME: Will we support this?
+	// FIXME: Will we support this?
 #endif
 #ifdef ENABLE_OPENCSG
-			CSGTreeEvaluator csgrenderer(this->tree, &geomevaluator);
+	CSGTreeEvaluator csgrenderer(this->tree, &geomevaluator);
 #endif
 
-		progress_report_prep(this->root_node, report_func, this);
-		try {
+	progress_report_prep(this->root_node, report_func, this);
+	try {
 #ifdef ENABLE_OPENCSG
-			this->processEvents();
-			this->csgRoot = csgrenderer.buildCSGTree(*root_node);
+		this->csgRoot = csgrenderer.buildCSGTree(*root_node);
 #endif
-			GeometryCache::instance()->print();
+		GeometryCache::instance()->print();
 #ifdef ENABLE_CGAL
-			CGALCache::instance()->print();
+		CGALCache::instance()->print();
 #endif
-			this->processEvents();
-		}
-		catch (const ProgressCancelException &) {
-			PRINT("CSG generation cancelled.");
-		}catch(const HardWarningException &){
-			PRINT("CSG generation cancelled due to hardwarning being enabled.");
-		}
-		progress_report_fin();
-		updateStatusBar(nullptr);
+	}
+	catch (const ProgressCancelException &) {
+		PRINT("CSG generation cancelled.");
+	}catch(const HardWarningException &){
+		PRINT("CSG generation cancelled due to hardwarning being enabled.");
+	}
+	progress_report_fin();
 
-		PRINT("Compiling design (CSG Products normalization)...");
-		this->processEvents();
+	PRINT("Compiling design (CSG Products normalization)...");
 
-		size_t normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
-		CSGTreeNormalizer normalizer(normalizelimit);
+	size_t normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
+	CSGTreeNormalizer normalizer(normalizelimit);
 	
-		if (this->csgRoot) {
-			this->normalizedRoot = normalizer.normalize(this->csgRoot);
-			if (this->normalizedRoot) {
-				this->root_products.reset(new CSGProducts());
-				this->root_products->import(this->normalizedRoot);
-			}
-			else {
-				this->root_products.reset();
-				PRINT("WARNING: CSG normalization resulted in an empty tree");
-				this->processEvents();
-			}
-		}
-
-		const std::vector<shared_ptr<CSGNode> > &highlight_terms = csgrenderer.getHighlightNodes();
-		if (highlight_terms.size() > 0) {
-			PRINTB("Compiling highlights (%d CSG Trees)...", highlight_terms.size());
-			this->processEvents();
+	const std::vector<shared_ptr<CSGNode> > &highlight_terms = csgrenderer.getHighlightNodes();
+	if (highlight_terms.size() > 0) {
+		PRINTB("Compiling highlights (%d CSG Trees)...", highlight_terms.size());
 		
-			this->highlights_products.reset(new CSGProducts());
-			for (unsigned int i = 0; i < highlight_terms.size(); i++) {
-				auto nterm = normalizer.normalize(highlight_terms[i]);
-				this->highlights_products->import(nterm);
-			}
-		}
-		else {
-			this->highlights_products.reset();
+		this->highlights_products.reset(new CSGProducts());
+		for (unsigned int i = 0; i < highlight_terms.size(); i++) {
+			auto nterm = normalizer.normalize(highlight_terms[i]);
+			this->highlights_products->import(nterm);
 		}
+	}
+	else {
+		this->highlights_products.reset();
+	}
 	
-		const auto &background_terms = csgrenderer.getBackgroundNodes();
-		if (background_terms.size() > 0) {
-			PRINTB("Compiling background (%d CSG Trees)...", background_terms.size());
-			this->processEvents();
+	const auto &background_terms = csgrenderer.getBackgroundNodes();
+	if (background_terms.size() > 0) {
+		PRINTB("Compiling background (%d CSG Trees)...", background_terms.size());
 		
-			this->background_products.reset(new CSGProducts());
-			for (unsigned int i = 0; i < background_terms.size(); i++) {
-				auto nterm = normalizer.normalize(background_terms[i]);
-				this->background_products->import(nterm);
-			}
+		this->background_products.reset(new CSGProducts());
+		for (unsigned int i = 0; i < background_terms.size(); i++) {
+			auto nterm = normalizer.normalize(background_terms[i]);
+			this->background_products->import(nterm);
 		}
-		else {
-			this->background_products.reset();
+	}
+	else {
+		this->background_products.reset();
+	}
+
+#ifdef ENABLE_OPENCSG
+	// The ray marched terms are split off first, since normalizing the root changes it
+	this->rayMarchScene.reset();
+	this->rayMarchMeshProducts.reset();
+	if (this->csgRoot && Preferences::inst()->getValue("advanced/rayMarchPreview").toBool()) {
+		auto scene = RayMarchRenderer::compile(this->csgRoot);
+		if (!scene->source.empty()) {
+			PRINTB("Compiling %d objects for ray marching...", scene->leaves.size());
+			if (scene->meshes) {
+				auto nterm = normalizer.normalize(scene->meshes);
+				if (nterm) {
+					this->rayMarchMeshProducts.reset(new CSGProducts());
+					this->rayMarchMeshProducts->import(nterm);
+				}
+			}
+			this->rayMarchScene = scene;
 		}
+	}
+#endif
 
-		if (this->root_products &&
-				(this->root_products->size() >
-				Preferences::inst()->getValue("advanced/openCSGLimit").toUInt())) {
-			PRINTB("UI-WARNING: Normalized tree has %d elements!", this->root_products->size());
-			PRINT("UI-WARNING: OpenCSG rendering has been disabled.");
+	// The root goes last, since the terms it caches may share nodes with the
+	// highlight and background terms, and normalizing modifies terms
+	CSGTreeNormalizer rootnormalizer(normalizelimit, CSGTermCache::instance());
+	if (this->csgRoot) {
+		this->normalizedRoot = rootnormalizer.normalize(this->csgRoot);
+		if (this->normalizedRoot) {
+			this->root_products.reset(new CSGProducts());
+			this->root_products->import(this->normalizedRoot);
 		}
-#ifdef ENABLE_OPENCSG
 		else {
-			PRINTB("Normalized CSG tree has %d elements",
-						(this->root_products ? this->root_products->size() : 0));
-			this->opencsgRenderer = new OpenCSGRenderer(this->root_products,
-																								this->highlights_products,
-																								this->background_products,
-																								this->qglview->shaderinfo);
+			this->root_products.reset();
+			PRINT("WARNING: CSG normalization resulted in an empty tree");
 		}
+	}
+	CSGTermCache::instance()->prune();
+}
+
+/*!
+	Replaces the preview renderers by ones for the products of the last
+	compileCSG().
+*/
+void MainWindow::createPreviewRenderers()
+{
+	this->qglview->setRenderer(nullptr);
+#ifdef ENABLE_OPENCSG
+	delete this->opencsgRenderer;
+	this->opencsgRenderer = nullptr;
+	delete this->rayMarchRenderer;
+	this->rayMarchRenderer = nullptr;
 #endif
-		this->thrownTogetherRenderer = new ThrownTogetherRenderer(this->root_products,
-																														this->highlights_products,
-																														this->background_products);
-		PRINT("Compile and preview finished.");
-		int s = this->renderingTime.elapsed() / 1000;
-		PRINTB("Total rendering time: %d hours, %d minutes, %d seconds\n", (s / (60*60)) % ((s / 60) % 60) % (s % 60));
-		this->processEvents();
-	}catch(const HardWarningException&){
-		exceptionCleanup();
+	delete this->thrownTogetherRenderer;
+	this->thrownTogetherRenderer = nullptr;
+	if (!this->root_node) return;
+
+	if (this->root_products &&
+			(this->root_products->size() >
+			Preferences::inst()->getValue("advanced/openCSGLimit").toUInt())) {
+		PRINTB("UI-WARNING: Normalized tree has %d elements!", this->root_products->size());
+		PRINT("UI-WARNING: OpenCSG rendering has been disabled.");
 	}
+#ifdef ENABLE_OPENCSG
+	else {
+		PRINTB("Normalized CSG tree has %d elements",
+					(this->root_products ? this->root_products->size() : 0));
+		this->opencsgRenderer = new OpenCSGRenderer(this->root_products,
+																							this->highlights_products,
+																							this->background_products,
+																							this->qglview->shaderinfo);
+		if (this->rayMarchScene) {
+			this->rayMarchRenderer = new RayMarchRenderer(this->rayMarchScene,
+																										this->rayMarchMeshProducts,
+																										this->highlights_products,
+																										this->background_products,
+																										this->qglview->shaderinfo,
+																										this->opencsgRenderer);
+		}
+	}
+#endif
+	this->thrownTogetherRenderer = new ThrownTogetherRenderer(this->root_products,
+																													this->highlights_products,
+																													this->background_products);
+	PRINT("Compile and preview finished.");
+	int s = this->renderingTime.elapsed() / 1000;
+	PRINTB("Total rendering time: %d hours, %d minutes, %d seconds\n", (s / (60*60)) % ((s / 60) % 60) % (s % 60));
 }
 
 void MainWindow::actionOpen()
@@ -1639,24 +1864,26 @@ void MainWindow::updateTemporalVariables()
  * are assigned on top-level, the values are used to change the camera
  * rotation, translation and distance.
  */
-void MainWindow::updateCamera(const FileContext &ctx)
+void MainWindow::updateCamera()
 {
+	if (this->viewportValues.size() != 3) return;
+
 	double x, y, z;
-	const auto vpr = ctx.lookup_variable("$vpr");
+	const auto &vpr = this->viewportValues[0];
 	if (vpr->getVec3(x, y, z, 0.0)){
 		qglview->cam.setVpr(x, y, z);
 	}else{
 		PRINTB("UI-WARNING: Unable to convert $vpr=%s to a vec3 or vec2 of numbers", vpr->toEchoString());
 	}
 
-	const auto vpt = ctx.lookup_variable("$vpt");
+	const auto &vpt = this->viewportValues[1];
 	if (vpt->getVec3(x, y, z, 0.0)){
 		qglview->cam.setVpt(x, y, z);
 	}else{
 		PRINTB("UI-WARNING: Unable to convert $vpt=%s to a vec3 or vec2 of numbers", vpt->toEchoString());
 	}
 
-	const auto vpd = ctx.lookup_variable("$vpd");
+	const auto &vpd = this->viewportValues[2];
 	if (vpd->type() == Value::ValueType::NUMBER){
 		qglview->cam.setVpd(vpd->toDouble());
 	}else{
@@ -1673,7 +1900,7 @@ bool MainWindow::fileChangedOnDisk()
 	if (!activeEditor->filepath.isEmpty()) {
 		struct stat st;
 		memset(&st, 0, sizeof(struct stat));
-		bool valid = (stat(activeEditor->filepath.toLocal8Bit(), &st) == 0);
+		bool valid = (StatCache::stat(activeEditor->filepath.toLocal8Bit().constData(), st) == 0);
 		// If file isn't there, just return and use current editor text
 		if (!valid) return false;
 
@@ -1695,6 +1922,7 @@ void MainWindow::parseTopLevelDocument(bool rebuildParameterWidget)
 	customizerEditor = nullptr;
 	this->parameterWidget->setEnabled(false);
 	resetSuppressedMessages();
+	activeEditor->parsePending = false;
 
 	this->last_compiled_doc = activeEditor->toPlainText();
 
@@ -1704,8 +1932,8 @@ void MainWindow::parseTopLevelDocument(bool rebuildParameterWidget)
 
 	auto fnameba = activeEditor->filepath.toLocal8Bit();
 	const char* fname = activeEditor->filepath.isEmpty() ? "" : fnameba;
-	delete this->parsed_module;
 	this->root_module = parse(this->parsed_module, fulltext, fname, fname, false) ? this->parsed_module : nullptr;
+	this->nodeReuseCache.adoptModule(this->parsed_module);
 
 	if (this->root_module!=nullptr) {
 		//add parameters as annotation in AST
@@ -1772,8 +2000,6 @@ void MainWindow::actionReloadRenderPreview()
 
 void MainWindow::csgReloadRender()
 {
-	if (this->root_node) compileCSG();
-
 	// Go to non-CGAL view mode
 	if (viewActionThrownTogether->isChecked()) {
 		viewModeThrownTogether();
@@ -1790,13 +2016,12 @@ void MainWindow::csgReloadRender()
 
 void MainWindow::actionRenderPreview(bool rebuildParameterWidget)
 {
-	static bool preview_requested;
-
-	preview_requested=true;
+	this->previewRequested = true;
 	if (GuiLocker::isLocked()) return;
 	GuiLocker::lock();
 	autoReloadTimer->stop();
-	preview_requested=false;
+	previewRestartTimer->stop();
+	this->previewRequested = false;
 	setCurrentOutput();
 
 	PRINT("Parsing design (AST generation)...");
@@ -1805,7 +2030,7 @@ void MainWindow::actionRenderPreview(bool rebuildParameterWidget)
 	this->procevents = !viewActionAnimate->isChecked();
 	this->top_ctx.set_variable("$preview", ValuePtr(true));
 	compile(false,false,rebuildParameterWidget);
-	if (preview_requested) {
+	if (this->previewRequested && !this->previewworker->isRunning()) {
 		// if the action was called when the gui was locked, we must request it one more time
 		// however, it's not possible to call it directly NOR make the loop
 		// it must be called from the mainloop
@@ -1815,8 +2040,6 @@ void MainWindow::actionRenderPreview(bool rebuildParameterWidget)
 
 void MainWindow::csgRender()
 {
-	if (this->root_node) compileCSG();
-
 	// Go to non-CGAL view mode
 	if (viewActionThrownTogether->isChecked()) {
 		viewModeThrownTogether();
@@ -1910,28 +2133,19 @@ void MainWindow::sendToOctoPrint()
 		exportFileFormat = FileFormat::STL;
 	}
 
-	QTemporaryFile exportFile{QDir::temp().filePath("OpenSCAD.XXXXXX." + fileFormat.toLower())};
-	if (!exportFile.open()) {
-		PRINT("Could not open temporary file.");
-		return;
-	}
-	const QString exportFileName = exportFile.fileName();
-	exportFile.close();
-
 	QString userFileName;
 	if (activeEditor->filepath.isEmpty()) {
-		userFileName = exportFileName;
+		userFileName = "unsaved." + fileFormat.toLower();
 	} else {
 		QFileInfo fileInfo{activeEditor->filepath};
 		userFileName = fileInfo.baseName() + "." + fileFormat.toLower();
 	}
 
-	exportFileByName(this->root_geom, exportFileFormat, exportFileName.toLocal8Bit().constData(), exportFileName.toUtf8());
-
 	try {
 		this->progresswidget = new ProgressWidget(this);
 		connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
-		const QString fileUrl = octoPrint.upload(exportFileName, userFileName, [this](double v) -> bool { return network_progress_func(v); });
+		// The design is exported as it's sent, without a temporary file
+		const QString fileUrl = octoPrint.upload(this->root_geom, exportFileFormat, userFileName, [this](double v) -> bool { return network_progress_func(v); });
 
 		const std::string action = s->get(Settings::Settings::octoPrintAction).toString();
 		if (action == "upload") {
@@ -2007,9 +2221,25 @@ void MainWindow::sendToPrintService()
 #ifdef ENABLE_CGAL
 
 void MainWindow::actionRender()
+{
+	startRender(false);
+}
+
+/*!
+	Renders like actionRender(), but with the booleans done on voxels (see
+	CSGBackend::voxel()), which is much faster for complex models. The
+	results are cached apart from exact ones.
+*/
+void MainWindow::actionRenderApproximate()
+{
+	startRender(true);
+}
+
+void MainWindow::startRender(bool approximate)
 {
 	if (GuiLocker::isLocked()) return;
 	GuiLocker::lock();
+	this->approximateRender = approximate;
 	autoReloadTimer->stop();
 	setCurrentOutput();
 
@@ -2032,8 +2262,16 @@ void MainWindow::cgalRender()
 	delete this->cgalRenderer;
 	this->cgalRenderer = nullptr;
 	this->root_geom.reset();
+	this->renderingEditor = this->activeEditor;
 
-	PRINT("Rendering Polygon Mesh using CGAL...");
+	if (this->approximateRender) {
+		this->exactBackend = CSGBackend::current()->name();
+		CSGBackend::select(CSGBackend::voxel()->name());
+		PRINT("Rendering approximate Polygon Mesh using voxels...");
+	}
+	else {
+		PRINT("Rendering Polygon Mesh using CGAL...");
+	}
 
 	this->progresswidget = new ProgressWidget(this);
 	connect(this->progresswidget, SIGNAL(requestShow()), this, SLOT(showProgress()));
@@ -2043,9 +2281,26 @@ void MainWindow::cgalRender()
 	this->cgalworker->start(this->tree);
 }
 
+/*!
+	If enabled in the preferences, renders the just previewed design in
+	the background, to fill the caches so a following render finishes
+	sooner. Edits cancel it, compiles stop it before replacing the tree.
+*/
+void MainWindow::startSpeculativeRender()
+{
+	if (!Preferences::inst()->getValue("advanced/speculativeRender").toBool()) return;
+	if (!this->root_node || GuiLocker::isLocked()) return;
+	this->cgalworker->speculate(this->tree, this->root_node);
+}
+
 void MainWindow::actionRenderDone(shared_ptr<const Geometry> root_geom)
 {
 	progress_report_fin();
+	const bool approximate = !this->exactBackend.empty();
+	if (approximate) {
+		CSGBackend::select(this->exactBackend);
+		this->exactBackend.clear();
+	}
 
 	unsigned int s = this->renderingTime.elapsed() / 1000;
 
@@ -2088,9 +2343,15 @@ void MainWindow::actionRenderDone(shared_ptr<const Geometry> root_geom)
 		PRINT("Rendering finished.\n");
 
 		this->root_geom = root_geom;
-		this->cgalRenderer = new CGALRenderer(root_geom);
-		// Go to CGAL view mode
-		if (viewActionWireframe->isChecked()) viewModeWireframe();
+		this->cgalRenderer = this->cgalworker->takeRenderer();
+		if (!this->cgalRenderer) this->cgalRenderer = new CGALRenderer(root_geom);
+		if (this->renderingEditor) this->tabGeometry[this->renderingEditor] = root_geom;
+		if (this->renderingEditor && !approximate) saveSnapshot(this->renderingEditor);
+		// Go to CGAL view mode, unless another tab was switched to meanwhile
+		if (this->renderingEditor != this->activeEditor) {
+			PRINT("The render is of another tab, it's shown when switching to that tab.");
+		}
+		else if (viewActionWireframe->isChecked()) viewModeWireframe();
 		else viewModeSurface();
 	}
 	else {
@@ -2106,8 +2367,9 @@ void MainWindow::actionRenderDone(shared_ptr<const Geometry> root_geom)
 		QSound::play(":sounds/complete.wav");
 	}
 
-	renderedEditor = activeEditor;
-	activeEditor->contentsRendered = true;
+	renderedEditor = this->renderingEditor;
+	if (this->renderingEditor) this->renderingEditor->contentsRendered = true;
+	this->renderingEditor = nullptr;
 	compileEnded();
 }
 
@@ -2414,12 +2676,15 @@ void MainWindow::actionCopyViewport()
 void MainWindow::actionFlushCaches()
 {
 	GeometryCache::instance()->clear();
+	ImportCache::instance()->clear();
 #ifdef ENABLE_CGAL
 	CGALCache::instance()->clear();
 #endif
 	dxf_dim_cache.clear();
 	dxf_cross_cache.clear();
 	ModuleCache::instance()->clear();
+	CSGTermCache::instance()->clear();
+	this->nodeReuseCache.invalidate();
 }
 
 void MainWindow::viewModeActionsUncheck()
@@ -2443,7 +2708,10 @@ void MainWindow::viewModePreview()
 	if (this->qglview->hasOpenCSGSupport()) {
 		viewModeActionsUncheck();
 		viewActionPreview->setChecked(true);
-		this->qglview->setRenderer(this->opencsgRenderer ? (Renderer *)this->opencsgRenderer : (Renderer *)this->thrownTogetherRenderer);
+		Renderer *renderer = this->thrownTogetherRenderer;
+		if (this->rayMarchRenderer) renderer = this->rayMarchRenderer;
+		else if (this->opencsgRenderer) renderer = this->opencsgRenderer;
+		this->qglview->setRenderer(renderer);
 		this->qglview->updateColorScheme();
 		this->qglview->updateGL();
 	} else {
@@ -2453,6 +2721,127 @@ void MainWindow::viewModePreview()
 
 #endif /* ENABLE_OPENCSG */
 
+/*!
+	Called when another tab was switched to. A running render of another
+	tab goes on at a lower priority. Otherwise the last render of the tab,
+	if any, is the one shown and exported from now on.
+*/
+void MainWindow::activeTabChanged()
+{
+#ifdef ENABLE_CGAL
+	if (this->renderingEditor) {
+		this->cgalworker->setForeground(this->renderingEditor == this->activeEditor);
+		return;
+	}
+	if (!GuiLocker::isLocked()) showTabRender(false);
+#endif
+}
+
+#ifdef ENABLE_CGAL
+
+/*!
+	Makes the last render of the current tab, if any, the one shown and
+	exported. The view switches to it if showView is set or a render is
+	shown already.
+*/
+void MainWindow::showTabRender(bool showView)
+{
+	auto it = this->tabGeometry.find(this->activeEditor);
+	if (it == this->tabGeometry.end()) return;
+	const bool shown = viewActionSurfaces->isChecked() || viewActionWireframe->isChecked();
+	if (it->second != this->root_geom) {
+		if (shown) this->qglview->setRenderer(nullptr);
+		delete this->cgalRenderer;
+		this->root_geom = it->second;
+		this->cgalRenderer = new CGALRenderer(this->root_geom);
+		this->renderedEditor = this->activeEditor;
+	}
+	else if (shown || !showView) return;
+	if (viewActionWireframe->isChecked()) viewModeWireframe();
+	else if (shown || showView) viewModeSurface();
+}
+
+/*!
+	Saves the render just done of the file of editor as its snapshot, if
+	enabled in the preferences, see EvaluationSnapshot. Only renders of the
+	saved contents of the file are stored.
+*/
+void MainWindow::saveSnapshot(EditorInterface *editor)
+{
+	if (!Preferences::inst()->getValue("advanced/evaluationSnapshot").toBool()) return;
+	if (editor->filepath.isEmpty() || editor->isContentModified() || !this->root_module || !this->root_geom) return;
+	if (editor->toPlainText() != this->last_compiled_doc) return;
+
+	std::unordered_set<std::string> dependencies;
+	this->root_module->collectDependencies(dependencies);
+	if (!EvaluationSnapshot::save(editor->filepath.toStdString(), dependencies, this->tree,
+																this->root_geom, this->renderingTime.elapsed() / 1000.0)) {
+		PRINTB("WARNING: Can't write the snapshot %s", EvaluationSnapshot::path(editor->filepath.toStdString()));
+	}
+}
+
+/*!
+	Compares the snapshot shown for the current tab, if any, with the
+	design just previewed. The snapshot is dropped if the cache key of the
+	root differs, e.g. as the customizer set other values.
+*/
+void MainWindow::checkSnapshot()
+{
+	auto it = this->snapshotKeys.find(this->activeEditor);
+	if (it == this->snapshotKeys.end() || !this->tree.root()) return;
+	const bool current = GeometryEvaluator::cacheKey(this->tree, *this->tree.root()) == it->second;
+	this->snapshotKeys.erase(it);
+	if (current) return;
+
+	PRINT("The snapshot of the last render is out of date, render again (F6) to update it.");
+	this->activeEditor->contentsRendered = false;
+	auto geom = this->tabGeometry.find(this->activeEditor);
+	if (geom != this->tabGeometry.end() && geom->second == this->root_geom) {
+		if (viewActionSurfaces->isChecked() || viewActionWireframe->isChecked()) this->qglview->setRenderer(nullptr);
+		delete this->cgalRenderer;
+		this->cgalRenderer = nullptr;
+		this->root_geom.reset();
+		this->renderedEditor = nullptr;
+	}
+	this->tabGeometry.erase(this->activeEditor);
+}
+
+#endif /* ENABLE_CGAL */
+
+void MainWindow::tabClosed(EditorInterface *editor)
+{
+#ifdef ENABLE_CGAL
+	this->tabGeometry.erase(editor);
+	this->snapshotKeys.erase(editor);
+	if (this->renderingEditor == editor) this->renderingEditor = nullptr;
+#endif
+	if (this->renderedEditor == editor) this->renderedEditor = nullptr;
+}
+
+/*!
+	Shows the snapshot of the last render of the file of editor right away,
+	if enabled in the preferences and the files it was read from are
+	unchanged. Its geometry goes into the caches, so a render of the
+	unchanged design finishes right away too. The snapshot is checked
+	against the design once it's previewed, see checkSnapshot().
+*/
+void MainWindow::loadSnapshot(EditorInterface *editor)
+{
+#ifdef ENABLE_CGAL
+	if (!Preferences::inst()->getValue("advanced/evaluationSnapshot").toBool()) return;
+	if (editor->filepath.isEmpty()) return;
+
+	std::string key;
+	auto geom = EvaluationSnapshot::load(editor->filepath.toStdString(), key);
+	if (!geom) return;
+	this->tabGeometry[editor] = geom;
+	this->snapshotKeys[editor] = key;
+	editor->contentsRendered = true;
+	PRINT("Showing the snapshot of the last render.");
+	if (editor == this->activeEditor && !this->renderingEditor && !GuiLocker::isLocked()) showTabRender(true);
+#endif
+}
+
 #ifdef ENABLE_CGAL
 
 void MainWindow::viewModeSurface()
@@ -2559,6 +2948,37 @@ void MainWindow::animateUpdate()
 	}
 }
 
+// The node of a CSG leaf, whose label is the node name and index
+static const AbstractNode *find_leaf_node(const AbstractNode *node, const std::string &label,
+																					std::unordered_set<const AbstractNode *> &visited)
+{
+	if (!visited.insert(node).second) return nullptr;
+	if (STR(node->name() << node->index()) == label) return node;
+	for (const auto child : node->getChildren()) {
+		if (const auto found = find_leaf_node(child, label, visited)) return found;
+	}
+	return nullptr;
+}
+
+/*!
+	Moves the editor cursor to the module instantiation of the object which
+	was double-clicked in the preview, given the label of its CSG leaf.
+*/
+void MainWindow::jumpToPicked(const QString &label)
+{
+	if (!this->root_node) return;
+
+	std::unordered_set<const AbstractNode *> visited;
+	const auto node = find_leaf_node(this->root_node, label.toStdString(), visited);
+	if (!node || !node->modinst || node->modinst->location().isNone()) return;
+	const auto &loc = node->modinst->location();
+	PRINTB("Picked %s in %s, line %d", node->name() % loc.fileName() % loc.firstLine());
+	const QFileInfo editorfile(activeEditor->filepath);
+	if (editorfile.canonicalFilePath() == QFileInfo(QString::fromStdString(loc.fileName())).canonicalFilePath()) {
+		activeEditor->setCursorPosition(loc.firstLine() - 1, loc.firstColumn() - 1);
+	}
+}
+
 void MainWindow::viewAngleTop()
 {
 	qglview->cam.object_rot << 90,0,0;
@@ -2897,42 +3317,22 @@ void MainWindow::quit()
 #endif
 }
 
+/*!
+	Output handler for any thread. The console shows the messages in
+	batches, see Console::post().
+*/
 void MainWindow::consoleOutput(const std::string &msg, void *userdata)
 {
-	// Invoke the method in the main thread in case the output
-	// originates in a worker thread.
 	auto thisp = static_cast<MainWindow*>(userdata);
-	QMetaObject::invokeMethod(thisp, "consoleOutput", Q_ARG(QString, QString::fromStdString(msg)));
-}
-
-void MainWindow::consoleOutput(const QString &msg)
-{
-	auto c = this->console->textCursor();
-	c.movePosition(QTextCursor::End);
-	this->console->setTextCursor(c);
-
-	if (msg.startsWith("WARNING:") || msg.startsWith("DEPRECATED:")) {
-		this->compileWarnings++;
-		this->console->appendHtml("<span style=\"color: black; background-color: #ffffb0;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
-	} else if (msg.startsWith("UI-WARNING:") || msg.startsWith("FONT-WARNING:") || msg.startsWith("EXPORT-WARNING:")) {
-		this->console->appendHtml("<span style=\"color: black; background-color: #ffffb0;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
-	} else if (msg.startsWith("ERROR:")) {
-		this->compileErrors++;
-		this->console->appendHtml("<span style=\"color: black; background-color: #ffb0b0;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
-	} else if (msg.startsWith("EXPORT-ERROR:") || msg.startsWith("UI-ERROR:") || msg.startsWith("PARSER-ERROR:")) {
-		this->console->appendHtml("<span style=\"color: black; background-color: #ffb0b0;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
-	} else if (msg.startsWith("TRACE:")) {
-		this->console->appendHtml("<span style=\"color: black; background-color: #d0d0ff;\">" + QT_HTML_ESCAPE(QString(msg)) + "</span>");
-	} else {
-		QString qmsg = msg;
-		if(qmsg.contains('\t') && !qmsg.contains("<pre>", Qt::CaseInsensitive))
-			this->console->appendPlainText(qmsg);
-		else {
-			qmsg.replace("\n","<br>");
-			this->console->appendHtml(qmsg);
-		}
+	const auto qmsg = QString::fromStdString(msg);
+	if (qmsg.startsWith("WARNING:") || qmsg.startsWith("DEPRECATED:")) {
+		QMutexLocker lock(&thisp->consolemutex);
+		thisp->compileWarnings++;
+	} else if (qmsg.startsWith("ERROR:")) {
+		QMutexLocker lock(&thisp->consolemutex);
+		thisp->compileErrors++;
 	}
-	this->processEvents();
+	if (thisp->console->post(qmsg)) thisp->processEvents();
 }
 
 void MainWindow::setCurrentOutput()
@@ -2960,7 +3360,7 @@ void MainWindow::openCSGSettingsChanged()
 
 void MainWindow::processEvents()
 {
-	if (this->procevents) QApplication::processEvents();
+	if (this->procevents && QThread::currentThread() == this->thread()) QApplication::processEvents();
 }
 
 QString MainWindow::exportPath(const char *suffix) {
@@ -25,23 +25,64 @@
  */
 
 #include "node.h"
+#include "Arena.h"
 #include "module.h"
 #include "ModuleInstantiation.h"
 #include "progress.h"
+#include "JobLimits.h"
 #include "printutils.h"
 #include <functional>
 #include <iostream>
 #include <algorithm>
+#include <mutex>
 
-size_t AbstractNode::idx_counter;
+std::atomic<size_t> AbstractNode::idx_counter(0);
 
-AbstractNode::AbstractNode(const ModuleInstantiation *mi) : modinst(mi), progress_mark(0), idx(idx_counter++)
+void *AbstractNode::operator new(size_t size)
 {
+	return Arena::instantiate().allocate(size);
+}
+
+void AbstractNode::operator delete(void *ptr, size_t size)
+{
+	Arena::instantiate().deallocate(ptr, size);
+}
+
+AbstractNode::AbstractNode(const ModuleInstantiation *mi) : modinst(mi), progress_mark(0), idx(idx_counter++), owners(1)
+{
+	JobLimits::countNode();
 }
 
 AbstractNode::~AbstractNode()
 {
-	std::for_each(this->children.begin(), this->children.end(), std::default_delete<AbstractNode>());
+	releaseChildren(this->children);
+}
+
+void AbstractNode::release(const AbstractNode *node)
+{
+	if (!node || --node->owners != 0) return;
+	auto last = const_cast<AbstractNode *>(node);
+	releaseChildren(last->children);
+	delete last;
+}
+
+/*!
+	Releases nodes and, of those deleted, their children, without
+	recursing, so deep trees can't overflow the stack. Leaves nodes empty.
+*/
+void AbstractNode::releaseChildren(std::vector<AbstractNode *> &nodes)
+{
+	if (nodes.empty()) return;
+	std::vector<AbstractNode *> pending;
+	pending.swap(nodes);
+	while (!pending.empty()) {
+		AbstractNode *node = pending.back();
+		pending.pop_back();
+		if (!node || --node->owners != 0) continue;
+		pending.insert(pending.end(), node->children.begin(), node->children.end());
+		node->children.clear();
+		delete node;
+	}
 }
 
 std::string AbstractNode::toString() const
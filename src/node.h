@@ -1,14 +1,15 @@
 #pragma once
 
+#include <atomic>
 #include <vector>
 #include <string>
 #include "BaseVisitable.h"
 
-extern int progress_report_count;
-extern void (*progress_report_f)(const class AbstractNode*, void*, int);
+extern std::atomic<int> progress_report_count;
+extern void (*progress_report_f)(const class AbstractNode*, void*, double);
 extern void *progress_report_vp;
 
-void progress_report_prep(class AbstractNode *root, void (*f)(const class AbstractNode *node, void *vp, int mark), void *vp);
+void progress_report_prep(class AbstractNode *root, void (*f)(const class AbstractNode *node, void *vp, double mark), void *vp);
 void progress_report_fin();
 
 /*!  
@@ -24,11 +25,16 @@ class AbstractNode : public BaseVisitable
 	// We can hash on pointer value or smth. else.
   //  -> remove and
 	// use smth. else to display node identifier in CSG tree output?
-	static size_t idx_counter;   // Node instantiation index
+	static std::atomic<size_t> idx_counter;   // Node instantiation index
 public:
 	VISITABLE();
 	AbstractNode(const class ModuleInstantiation *mi);
 	~AbstractNode();
+
+	// Nodes are allocated from Arena::instantiate()
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+
 	virtual std::string toString() const;
 	/*! The 'OpenSCAD name' of this node, defaults to classname, but can be 
 	    overloaded to provide specialization for e.g. CSG nodes, primitive nodes etc.
@@ -42,6 +48,12 @@ public:
 
 	static void resetIndexCounter() { idx_counter = 1; }
 
+	// Nodes may have several owners, e.g. nodes shared by identical module
+	// calls (see ModuleCallCache). retain() adds one, and release() deletes
+	// the node once the last one is gone. Parents release their children.
+	void retain() const { ++this->owners; }
+	static void release(const AbstractNode *node);
+
 	// FIXME: Make protected
 	std::vector<AbstractNode*> children;
 	const ModuleInstantiation *modinst;
@@ -53,6 +65,11 @@ public:
 	void progress_report() const;
 
 	int idx; // Node index (unique per tree)
+
+private:
+	static void releaseChildren(std::vector<AbstractNode *> &nodes);
+
+	mutable std::atomic<unsigned int> owners;
 };
 
 class AbstractIntersectionNode : public AbstractNode
@@ -2,14 +2,26 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <vector>
 #include <assert.h>
 #include "node.h"
 #include "printutils.h"
+#include "hash.h"
 
 /*!
 	Caches string values per node based on the node.index().
 	The node index guaranteed to be unique per node tree since the index is reset
 	every time a new tree is generated.
+
+	Every dump (of the whole tree or of a single subtree) is kept in its own
+	string, and each node refers to a substring of the dump it was last
+	written by. Dumps can thus be added incrementally without invalidating
+	earlier ones.
+
+	Optionally also caches a structural hash of each node's id string,
+	see NodeDumper.
 */
 
 class NodeCache
@@ -21,41 +33,81 @@ public:
     bool contains(const AbstractNode &node) const {
         auto result = this->cache.find(node.index()); 
         return result != this->cache.end() && 
-            result->second.second >= 0L && 
-            (long)this->rootString.size() >= result->second.second;
+            result->second.text &&
+            result->second.end >= 0L;
     }
 
     std::string operator[](const AbstractNode &node) const {
         // throws std::out_of_range on miss
-        auto indexpair = this->cache.at(node.index()); 
-        return rootString.substr(indexpair.first, indexpair.second - indexpair.first);
+        const auto &entry = this->cache.at(node.index()); 
+        return entry.text->substr(entry.start, entry.end - entry.start);
     }
 
     void insertStart(const size_t nodeidx, const long startindex) {
-        assert(this->cache.count(nodeidx) == 0 && "start index inserted twice");
-        this->cache.emplace(nodeidx, std::make_pair(startindex, -1L));
+        auto result = this->cache.find(nodeidx);
+        // Shared nodes are dumped once for each parent
+        assert((result == this->cache.end() || result->second.text || result->second.end >= 0L) && "start index inserted twice");
+        this->cache[nodeidx] = Entry(startindex);
+        this->pending.push_back(nodeidx);
     }
 
     void insertEnd(const size_t nodeidx, const long endindex) {
         // throws std::out_of_range on miss
-        auto indexpair = this->cache.at(nodeidx); 
-        assert(indexpair.second == -1L && "end index inserted twice");
-        this->cache[nodeidx] = std::make_pair(indexpair.first, endindex);
+        auto &entry = this->cache.at(nodeidx); 
+        assert(entry.end == -1L && "end index inserted twice");
+        entry.end = endindex;
 #ifdef DEBUG
-        PRINTDB("NodeCache insert {%i,[%d:%d]}", nodeidx % indexpair.first % endindex );
+        PRINTDB("NodeCache insert {%i,[%d:%d]}", nodeidx % entry.start % endindex );
 #endif
     }
 
+    // Completes a dump; all nodes inserted since the last call refer to it
     void setRootString(const std::string &rootString) {
-        this->rootString = rootString;
+        auto text = std::make_shared<const std::string>(rootString);
+        for (const auto nodeidx : this->pending) this->cache[nodeidx].text = text;
+        this->pending.clear();
+    }
+
+    bool containsHash(const AbstractNode &node) const {
+        return this->hashes.find(node.index()) != this->hashes.end();
+    }
+
+    const Hash128 &hash(const AbstractNode &node) const {
+        // throws std::out_of_range on miss
+        return this->hashes.at(node.index());
+    }
+
+    void insertHash(const size_t nodeidx, const Hash128 &hash) {
+        this->hashes[nodeidx] = hash;
     }
 
     void clear() {
         this->cache.clear();
-        this->rootString = "";
+        this->pending.clear();
+        this->hashes.clear();
+    }
+
+    // Drops everything but the given nodes
+    void retain(const std::unordered_set<size_t> &nodeindices) {
+        for (auto it = this->cache.begin(); it != this->cache.end(); ) {
+            if (nodeindices.count(it->first)) ++it;
+            else it = this->cache.erase(it);
+        }
+        for (auto it = this->hashes.begin(); it != this->hashes.end(); ) {
+            if (nodeindices.count(it->first)) ++it;
+            else it = this->hashes.erase(it);
+        }
+        this->pending.clear();
     }
 
 private:
-    std::unordered_map<size_t, std::pair<long,long>> cache;
-    std::string rootString;
+    struct Entry {
+        Entry(long start = -1L) : start(start), end(-1L) {}
+        std::shared_ptr<const std::string> text;
+        long start, end;
+    };
+    std::unordered_map<size_t, Entry> cache;
+    // nodes of the dump in progress
+    std::vector<size_t> pending;
+    std::unordered_map<size_t, Hash128> hashes;
 };
@@ -2,6 +2,8 @@
 #include "state.h"
 #include "module.h"
 #include "ModuleInstantiation.h"
+#include "colornode.h"
+#include "rendernode.h"
 #include <string>
 #include <sstream>
 #include <boost/regex.hpp>
@@ -25,6 +27,18 @@ int GroupNodeChecker::getChildCount(int groupNodeIndex) const {
 }
 
 Response GroupNodeChecker::visit(State &state, const GroupNode &node)
+{
+	return visitGroup(state, node);
+}
+
+// Colored geometry depends on the color, see NodeDumper::visit(ColorNode)
+Response GroupNodeChecker::visit(State &state, const ColorNode &node)
+{
+	if (node.color[0] >= 0) return visit(state, (const AbstractNode &)node);
+	return visitGroup(state, node);
+}
+
+Response GroupNodeChecker::visitGroup(State &state, const AbstractNode &node)
 {
 	if (state.isPrefix()) {
 		// create entry for group node, which children may increment
@@ -58,7 +72,7 @@ void NodeDumper::initCache()
 {
 	this->dumpstream.str("");
 	this->dumpstream.clear();
-	this->cache.clear();
+	this->hashstack.clear();
 }
 
 void NodeDumper::finalizeCache()
@@ -68,14 +82,124 @@ void NodeDumper::finalizeCache()
 
 bool NodeDumper::isCached(const AbstractNode &node) const
 {
-	return this->cache.contains(node);
+	return this->hashOnly ? this->cache.containsHash(node) : this->cache.contains(node);
 }
 
-Response NodeDumper::visit(State &state, const GroupNode &node)
+/*!
+	Returns the modifier prefix for a node. This is part of the parent's
+	text rather than the node's own.
+*/
+static std::string modifier_prefix(const AbstractNode &node, bool idString)
 {
-	if (!this->idString) {
-		return NodeDumper::visit(state, (const AbstractNode &)node);
+	std::string prefix;
+	if (node.modinst->isBackground()) prefix += "%";
+	// Highlighting doesn't change the geometry
+	if (node.modinst->isHighlight() && !idString) prefix += "#";
+
+// If IDPREFIX is set, we will output "/*id*/" in front of each node
+// which is useful for debugging.
+#ifdef IDPREFIX
+	if (idString) prefix += "\n";
+	prefix += STR("/*" << node.index() << "*/");
+#else
+	(void)idString;
+#endif
+	return prefix;
+}
+
+/*!
+	Appends to the dump, and to the id data of the innermost node being hashed.
+*/
+void NodeDumper::write(const std::string &str)
+{
+	if (!this->hashOnly) this->dumpstream << str;
+	if (this->idString && !this->hashstack.empty()) this->hashstack.back().data += str;
+}
+
+void NodeDumper::beginNode(const AbstractNode &node)
+{
+	if (!this->hashOnly) this->cache.insertStart(node.index(), this->dumpstream.tellp());
+	if (this->idString) this->hashstack.emplace_back();
+}
+
+/*!
+	Finishes the dump and hash of the given node, and adds its hash to the
+	parent's id data.
+
+	Passthrough nodes have no id text of their own, so with a single child
+	their id string equals the child's, and so does their hash.
+*/
+void NodeDumper::endNode(const AbstractNode &node, bool passthrough)
+{
+	if (!this->hashOnly) this->cache.insertEnd(node.index(), this->dumpstream.tellp());
+	if (!this->idString) return;
+
+	const HashFrame &frame = this->hashstack.back();
+	const bool empty = frame.data.empty();
+	const Hash128 hash = (passthrough && frame.children == 1 && frame.data.size() == 1 + sizeof(Hash128)) ?
+		frame.lastchild : hash128(frame.data);
+	this->hashstack.pop_back();
+	this->cache.insertHash(node.index(), hash);
+
+	// Empty subtrees don't show up in the id string of the parent either
+	if (!empty) addChildHash(hash);
+}
+
+void NodeDumper::addChildHash(const Hash128 &hash)
+{
+	if (this->hashstack.empty()) return;
+	// NUL never occurs in id text, so it marks child hashes unambiguously
+	HashFrame &parent = this->hashstack.back();
+	parent.data += '\0';
+	parent.data.append(reinterpret_cast<const char *>(&hash), sizeof(Hash128));
+	parent.children++;
+	parent.lastchild = hash;
+}
+
+/*!
+	When dumping id strings, subtrees below the dump root which are already
+	cached are copied from the cache instead of being traversed. Returns true
+	if the given node was handled this way.
+*/
+bool NodeDumper::reuseCached(State &state, const AbstractNode &node)
+{
+	if (!this->idString || this->root == &node || !isCached(node)) return false;
+	if (state.isPrefix()) {
+		write(modifier_prefix(node, this->idString));
+		if (!this->hashOnly) this->dumpstream << this->cache[node];
+		static const Hash128 emptyhash = hash128("");
+		const Hash128 &hash = this->cache.hash(node);
+		if (hash != emptyhash) addChildHash(hash);
 	}
+	return true;
+}
+
+Response NodeDumper::visit(State &state, const GroupNode &node)
+{
+	if (!this->idString) return dumpNode(state, node);
+	return dumpGroup(state, node);
+}
+
+/*!
+	The geometry of a color() is the union of its children, given the color
+	(see GeometryEvaluator::visit(ColorNode)), so the color is part of its id.
+	Without a valid color it's the plain union, identified like a group's.
+*/
+Response NodeDumper::visit(State &state, const ColorNode &node)
+{
+	if (!this->idString || node.color[0] >= 0) return dumpNode(state, node);
+	return dumpGroup(state, node);
+}
+
+// The convexity is only passed on to the geometry, see GeometryEvaluator
+Response NodeDumper::visit(State &state, const RenderNode &node)
+{
+	return dumpNode(state, node, "render()");
+}
+
+Response NodeDumper::dumpGroup(State &state, const AbstractNode &node)
+{
+	if (reuseCached(state, node)) return Response::PruneTraversal;
 	if (state.isPrefix()) {
 		// For handling root modifier '!'
 		// Check if we are processing the root of the current Tree and init cache
@@ -83,30 +207,20 @@ Response NodeDumper::visit(State &state, const GroupNode &node)
 			this->initCache();
 		}
 
-		if (node.modinst->isBackground()) this->dumpstream << "%";
-		if (node.modinst->isHighlight()) this->dumpstream << "#";
-
-// If IDPREFIX is set, we will output "/*id*/" in front of each node
-// which is useful for debugging.
-#ifdef IDPREFIX
-		if (this->idString) this->dumpstream << "\n";	
-		this->dumpstream << "/*" << node.index() << "*/";
-#endif
-
-		// insert start index
-		this->cache.insertStart(node.index(), this->dumpstream.tellp());
+		write(modifier_prefix(node, this->idString));
+		beginNode(node);
 		
 		if(this->groupChecker.getChildCount(node.index()) > 1) {
-			this->dumpstream << node << "{";
+			write("group(){");
 		}
 		this->currindent++;
 	} else if (state.isPostfix()) {
 		this->currindent--;
-		if (this->groupChecker.getChildCount(node.index()) > 1) {
-			this->dumpstream << "}";
+		const bool passthrough = this->groupChecker.getChildCount(node.index()) <= 1;
+		if (!passthrough) {
+			write("}");
 		}
-		// insert end index
-		this->cache.insertEnd(node.index(), this->dumpstream.tellp());
+		endNode(node, passthrough);
 
 		// For handling root modifier '!'
 		// Check if we are processing the root of the current Tree and finalize cache
@@ -124,6 +238,15 @@ Response NodeDumper::visit(State &state, const GroupNode &node)
 */
 Response NodeDumper::visit(State &state, const AbstractNode &node)
 {
+	return dumpNode(state, node);
+}
+
+/*!
+	Dumps the node. idtext replaces its text in id strings.
+*/
+Response NodeDumper::dumpNode(State &state, const AbstractNode &node, const char *idtext)
+{
+	if (reuseCached(state, node)) return Response::PruneTraversal;
 	if (state.isPrefix()) {
 
 		// For handling root modifier '!'
@@ -132,40 +255,32 @@ Response NodeDumper::visit(State &state, const AbstractNode &node)
 			this->initCache();
 		}
 
-		if (node.modinst->isBackground()) this->dumpstream << "%";
-		if (node.modinst->isHighlight()) this->dumpstream << "#";
-
-// If IDPREFIX is set, we will output "/*id*/" in front of each node
-// which is useful for debugging.
-#ifdef IDPREFIX
-		if (this->idString) this->dumpstream << "\n";	
-		this->dumpstream << "/*" << node.index() << "*/";
-#endif
-
-		// insert start index
-		this->cache.insertStart(node.index(), this->dumpstream.tellp());
+		write(modifier_prefix(node, this->idString));
+		beginNode(node);
 		
+		std::ostringstream text;
 		if (this->idString) {
 			
 			static const boost::regex re("[^\\s\\\"]+|\\\"(?:[^\\\"\\\\]|\\\\.)*\\\"");
-			const auto name = STR(node);
+			const auto name = idtext ? std::string(idtext) : STR(node);
 			boost::sregex_token_iterator it(name.begin(), name.end(), re, 0);
-			std::copy(it, boost::sregex_token_iterator(), std::ostream_iterator<std::string>(this->dumpstream));
+			std::copy(it, boost::sregex_token_iterator(), std::ostream_iterator<std::string>(text));
 		
 			if (node.getChildren().size() > 0) {
-				this->dumpstream << "{";
+				text << "{";
 			}
 
 		} else {
 
 			for(int i = 0; i < this->currindent; ++i) {
-				this->dumpstream << this->indent;
+				text << this->indent;
 			}
-			this->dumpstream << node;
+			text << node;
 			if (node.getChildren().size() > 0) {
-				this->dumpstream << " {\n";
+				text << " {\n";
 			}
 		}
+		write(text.str());
 
 		this->currindent++;
 
@@ -175,23 +290,23 @@ Response NodeDumper::visit(State &state, const AbstractNode &node)
 		
 		if (this->idString) {
 			if (node.getChildren().size() > 0) {
-				this->dumpstream << "}";
+				write("}");
 			} else {
-				this->dumpstream << ";";
+				write(";");
 			}
 		} else {
 			if (node.getChildren().size() > 0) {
+				std::string text;
 				for(int i = 0; i < this->currindent; ++i) {
-					this->dumpstream << this->indent;
+					text += this->indent;
 				}
-				this->dumpstream << "}\n";
+				write(text + "}\n");
 			} else {
-				this->dumpstream << ";\n";
+				write(";\n");
 			}
 		}
 	
-		// insert end index
-		this->cache.insertEnd(node.index(), this->dumpstream.tellp());
+		endNode(node, false);
 
 		// For handling root modifier '!'
 		// Check if we are processing the root of the current Tree and finalize cache
@@ -212,9 +327,9 @@ Response NodeDumper::visit(State &state, const RootNode &node)
 
 	if (state.isPrefix()) {
 		this->initCache();
-		this->cache.insertStart(node.index(), this->dumpstream.tellp());
+		beginNode(node);
 	} else if (state.isPostfix()) {
-		this->cache.insertEnd(node.index(), this->dumpstream.tellp());
+		endNode(node, true);
 		this->finalizeCache();
 	}
 
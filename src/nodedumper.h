@@ -3,6 +3,7 @@
 #include <string>
 #include <unordered_map>
 #include <list>
+#include <vector>
 #include "NodeVisitor.h"
 #include "node.h"
 #include "nodecache.h"
@@ -12,6 +13,8 @@
 // If a GroupNode has 1 child, we replace it with its child
 // This makes id strings much more compact for deeply nested trees, recursive scad scripts,
 // and increases likelihood of node cache hits.
+// ColorNodes without a valid color count as GroupNodes, since their geometry
+// is the plain union. Colored geometry carries its color, so it doesn't.
 class GroupNodeChecker : public NodeVisitor 
 {
 public:
@@ -19,20 +22,32 @@ public:
 
     Response visit(State &state, const AbstractNode &node) override;
     Response visit(State &state, const GroupNode &node) override;
+    Response visit(State &state, const ColorNode &node) override;
     void incChildCount(int groupNodeIndex);
     int getChildCount(int groupNodeIndex) const;
     void reset() { groupChildCounts.clear(); }
 
 private:
+    Response visitGroup(State &state, const AbstractNode &node);
+
     // stores <node_idx,nonEmptyChildCount> for each group node
     std::unordered_map<int, int> groupChildCounts;
 };
 
+// When dumping id strings, NodeDumper also computes a Merkle-style 128-bit
+// hash of each node's id string bottom-up: a node's hash covers its own text
+// and the hashes of its children. Setting hashOnly skips building the text
+// dump entirely, so only the hashes end up in the cache.
+// Id string dumps reuse subtrees which are already in the cache, so a
+// missing subtree can be added without dumping the rest of the tree.
+// Id strings leave out what doesn't change the geometry, so it doesn't
+// split the geometry caches: colors, the highlight modifier and the
+// convexity of render().
 class NodeDumper : public NodeVisitor
 {
 public:
-    NodeDumper(NodeCache &cache, const AbstractNode *root_node, const std::string& indent, bool idString) :
-            cache(cache), indent(indent), idString(idString), currindent(0), root(root_node) { 
+    NodeDumper(NodeCache &cache, const AbstractNode *root_node, const std::string& indent, bool idString, bool hashOnly = false) :
+            cache(cache), indent(indent), idString(idString), hashOnly(idString && hashOnly), currindent(0), root(root_node) { 
         if (idString) { 
             groupChecker.traverse(*root);
         }
@@ -42,22 +57,40 @@ public:
     Response visit(State &state, const AbstractNode &node) override;
     Response visit(State &state, const GroupNode &node) override;
     Response visit(State &state, const RootNode &node) override;
+    Response visit(State &state, const ColorNode &node) override;
+    Response visit(State &state, const RenderNode &node) override;
 
 private:
+    Response dumpNode(State &state, const AbstractNode &node, const char *idtext = nullptr);
+    Response dumpGroup(State &state, const AbstractNode &node);
     void initCache();
     void finalizeCache();
     bool isCached(const AbstractNode &node) const;
+    void write(const std::string &str);
+    void beginNode(const AbstractNode &node);
+    void endNode(const AbstractNode &node, bool passthrough);
+    void addChildHash(const Hash128 &hash);
+    bool reuseCached(State &state, const AbstractNode &node);
 
     NodeCache &cache;
     // Output Formatting options
     std::string indent;
     bool idString;
+    bool hashOnly;
 
     int currindent;
     const AbstractNode *root;
     GroupNodeChecker groupChecker;
     std::ostringstream dumpstream;
 
+    struct HashFrame {
+        HashFrame() : children(0) {}
+        // Own id text, interleaved with the hashes of non-empty children
+        std::string data;
+        int children;
+        Hash128 lastchild;
+    };
+    std::vector<HashFrame> hashstack;
 };
 
 
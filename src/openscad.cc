@@ -32,6 +32,7 @@
 #include "builtincontext.h"
 #include "value.h"
 #include "export.h"
+#include "imageutils.h"
 #include "builtin.h"
 #include "printutils.h"
 #include "handle_dep.h"
@@ -46,18 +47,46 @@
 #include "FontCache.h"
 #include "OffscreenView.h"
 #include "GeometryEvaluator.h"
+#include "InstancedPolySet.h"
+#include "CGALCache.h"
+#include "polyset-utils.h"
+#include "ThreadPool.h"
+#include "DiskCache.h"
+#include "GeometryCache.h"
+#include "RenderProfile.h"
+#include "InterpreterProfile.h"
+#include "hash.h"
+#include "version.h"
+#include "FunctionCache.h"
+#include "ModuleCallCache.h"
+#include "JobLimits.h"
+#include "Metrics.h"
+#include "ModuleCache.h"
+#include "NodeReuseCache.h"
+#include "modcontext.h"
+#include "expression.h"
 
 #include"parameter/parameterset.h"
+#include <boost/property_tree/json_parser.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <string>
 #include <vector>
 #include <fstream>
+#include <sstream>
 
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgalutils.h"
+#include "CSGBackend.h"
+#include "VoxelEvaluator.h"
+#include "RenderFarm.h"
 #endif
 
 #include "csgnode.h"
+#include "colornode.h"
 #include "CSGTreeEvaluator.h"
 
 #include "Camera.h"
@@ -91,12 +120,107 @@ std::string commandline_commands;
 std::string currentdir;
 static bool arg_info = false;
 static std::string arg_colorscheme;
+static unsigned int arg_animate = 0;
+static bool arg_export_parts = false;
+static bool arg_export_stream = false;
+static bool arg_export_shells = false;
+static bool arg_deps_only = false;
+static std::vector<double> arg_slice_heights;
+static bool arg_slice_layers = false;
+static bool arg_timing = false;
+static bool arg_skip_unchanged = false;
+
+// Phases of the runs for --timing and --summary-json, see Metrics
+typedef Metrics::PhaseTimer PhaseTimer;
+
+static bool writeTiming(const std::string &filename, double total, int rc)
+{
+	std::ofstream stream(filename.c_str(), std::ios::out | std::ios::trunc);
+	if (!stream.is_open()) return false;
+	stream << "{\"phases\":{";
+	const auto phases = Metrics::instance()->phases();
+	for (size_t i = 0; i < phases.size(); ++i) {
+		stream << (i ? "," : "") << boost::format("\"%s\":%.3f") % phases[i].first % phases[i].second;
+	}
+	stream << boost::format("},\"total\":%.3f,\"status\":%d}\n") % total % rc;
+	return bool(stream);
+}
+
+static bool writeSummary(const std::string &filename, double total, int rc)
+{
+	std::ofstream stream(filename.c_str(), std::ios::out | std::ios::trunc);
+	if (!stream.is_open()) return false;
+	stream << Metrics::instance()->summaryJSON(total, rc) << "\n";
+	return bool(stream);
+}
+
+// The nodes of a tree, for the "nodes" counter of Metrics
+static size_t countNodes(const AbstractNode *root)
+{
+	size_t count = 0;
+	std::vector<const AbstractNode *> stack{root};
+	while (!stack.empty()) {
+		const AbstractNode *node = stack.back();
+		stack.pop_back();
+		count++;
+		for (const auto child : node->children) stack.push_back(child);
+	}
+	return count;
+}
+
+/*!
+	Hashes the inputs of a command line export, for --skip-unchanged: the
+	OpenSCAD version, the options and the contents of the given files.
+	Contents rather than modification times, which checkouts reset.
+*/
+static std::string inputHash(const std::string &options, const std::vector<std::string> &files)
+{
+	std::ostringstream key;
+	key << openscad_versionnumber << "\n" << options << "\n";
+	for (const auto &file : files) {
+		key << file << "\n";
+		std::ifstream stream(file.c_str(), std::ios::in | std::ios::binary);
+		if (!stream.is_open()) {
+			key << "missing\n";
+			continue;
+		}
+		const std::string contents((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+		key << hash128(contents).toString() << "\n";
+	}
+	return hash128(key.str()).toString();
+}
+
+/*!
+	The stamp of an export is its input hash followed by the files it was
+	computed from, one per line, so the next run can hash the same files
+	before parsing anything.
+*/
+static bool isUpToDate(const std::string &stampfile, const std::string &options)
+{
+	std::ifstream stream(stampfile.c_str());
+	std::string hash, file;
+	if (!std::getline(stream, hash)) return false;
+	std::vector<std::string> files;
+	while (std::getline(stream, file)) files.push_back(file);
+	return inputHash(options, files) == hash;
+}
+
+static bool writeStamp(const std::string &stampfile, const std::string &options, std::vector<std::string> files)
+{
+	std::sort(files.begin(), files.end());
+	files.erase(std::unique(files.begin(), files.end()), files.end());
+	std::ofstream stream(stampfile.c_str(), std::ios::out | std::ios::trunc);
+	if (!stream.is_open()) return false;
+	stream << inputHash(options, files) << "\n";
+	for (const auto &file : files) stream << file << "\n";
+	return bool(stream);
+}
 
 
 class Echostream : public std::ofstream
 {
 public:
-	Echostream(const char * filename) : std::ofstream(filename) {
+	Echostream(const char * filename) : std::ofstream(filename), prevhandler(outputhandler), prevdata(outputhandler_data) {
 		set_output_handler( &Echostream::output, this );
 	}
 	static void output(const std::string &msg, void *userdata) {
@@ -104,14 +228,25 @@ public:
 		*thisp << msg << "\n";
 	}
 	~Echostream() {
+		// Batch and server mode keep running after an echo export
+		set_output_handler(this->prevhandler, this->prevdata);
 		this->close();
 	}
+private:
+	OutputHandlerFunc *prevhandler;
+	void *prevdata;
 };
 
 static void help(const char *arg0, const po::options_description &desc, bool failure = false)
 {
 	const fs::path progpath(arg0);
 	PRINTB("Usage: %s [options] file.scad\n%s", progpath.filename().string() % STR(desc));
+	// Only loaded here, as the color schemes are read from files
+	std::vector<std::string> schemes;
+	for (const auto &name : ColorMap::inst()->colorSchemeNames()) {
+		schemes.push_back((name == ColorMap::inst()->defaultColorSchemeName() ? "*" : "") + name);
+	}
+	PRINTB("Color schemes for --colorscheme: %s", boost::join(schemes, " | "));
 	exit(failure ? 1 : 0);
 }
 
@@ -157,14 +292,18 @@ void localization_init() {
 	}
 }
 
-Camera get_camera(const po::variables_map &vm)
+/*!
+	Sets up a camera from the given --camera and --imgsize values, which are
+	empty if the option wasn't given.
+*/
+static Camera get_camera(const po::variables_map &vm, const std::string &view, const std::string &imgsize)
 {
 	Camera camera;
 
-	if (vm.count("camera")) {
+	if (!view.empty()) {
 		vector<string> strs;
 		vector<double> cam_parameters;
-		boost::split(strs, vm["camera"].as<string>(), is_any_of(","));
+		boost::split(strs, view, is_any_of(","));
 		if (strs.size() == 6 || strs.size() == 7) {
 			try {
 				for (const auto &s : strs) cam_parameters.push_back(lexical_cast<double>(s));
@@ -208,9 +347,9 @@ Camera get_camera(const po::variables_map &vm)
 
 	auto w = RenderSettings::inst()->img_width;
 	auto h = RenderSettings::inst()->img_height;
-	if (vm.count("imgsize")) {
+	if (!imgsize.empty()) {
 		vector<string> strs;
-		boost::split(strs, vm["imgsize"].as<string>(), is_any_of(","));
+		boost::split(strs, imgsize, is_any_of(","));
 		if ( strs.size() != 2 ) {
 			PRINT("Need 2 numbers for imgsize");
 			exit(1);
@@ -230,10 +369,111 @@ Camera get_camera(const po::variables_map &vm)
 	return camera;
 }
 
+/*!
+	Returns one camera for each view given to --camera and --imgsize as a
+	list separated by ';'. If only one of them is a list, the other applies
+	to all its views.
+*/
+std::vector<Camera> get_cameras(const po::variables_map &vm)
+{
+	vector<string> views{""}, sizes{""};
+	if (vm.count("camera")) boost::split(views, vm["camera"].as<string>(), is_any_of(";"));
+	if (vm.count("imgsize")) boost::split(sizes, vm["imgsize"].as<string>(), is_any_of(";"));
+	if (views.size() > 1 && sizes.size() > 1 && views.size() != sizes.size()) {
+		PRINT("Need one imgsize for all cameras or one for each camera");
+		exit(1);
+	}
+
+	std::vector<Camera> cameras;
+	const auto n = std::max(views.size(), sizes.size());
+	for (size_t i = 0; i < n; ++i) {
+		cameras.push_back(get_camera(vm, views[views.size() > 1 ? i : 0], sizes[sizes.size() > 1 ? i : 0]));
+	}
+	return cameras;
+}
+
+/*!
+	Returns the name of the image of the given animation frame and view.
+	Frame numbers and view numbers are only added if there are several.
+*/
+static std::string png_output_name(const std::string &output, unsigned frames, unsigned frame, size_t views, size_t view)
+{
+	if (frames <= 1 && views <= 1) return output;
+	const fs::path path(output);
+	auto name = (path.parent_path() / path.stem()).generic_string();
+	if (frames > 1) name += (boost::format("%05d") % frame).str();
+	if (views > 1) name += STR("-" << view);
+	return name + path.extension().generic_string();
+}
+
 #ifndef OPENSCAD_NOGUI
 #include "QSettingsCached.h"
 #define OPENSCAD_QTGUI 1
 #endif
+/*!
+	Returns the dimension of the geometry exported in the given format,
+	or 0 for formats which don't export geometry.
+*/
+static unsigned exportDimension(FileFormat format)
+{
+	switch (format) {
+	case FileFormat::STL:
+	case FileFormat::BINSTL:
+	case FileFormat::OFF:
+	case FileFormat::AMF:
+	case FileFormat::ZIPAMF:
+	case FileFormat::_3MF:
+	case FileFormat::OSMESH:
+	case FileFormat::NEFDBG:
+	case FileFormat::NEF3:
+		return 3;
+	case FileFormat::DXF:
+	case FileFormat::SVG:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+/*!
+	Parses the argument of --slice-heights, a range or vector expression
+	like [0:0.2:10] or [1, 2.5, 4].
+*/
+static bool parseSliceHeights(const std::string &arg, std::vector<double> &heights)
+{
+	const auto expr = CommentParser::parser(arg.c_str());
+	ModuleContext ctx;
+	const ValuePtr values = expr ? expr->evaluate(&ctx) : ValuePtr::undefined;
+	heights.clear();
+	if (values->type() == Value::ValueType::RANGE) {
+		RangeType r = values->toRange();
+		if (r.numValues() >= 100000) {
+			PRINTB("ERROR: Too many values in --slice-heights '%s'", arg);
+			return false;
+		}
+		for (RangeType::iterator it = r.begin(); it != r.end(); it++) heights.push_back(*it);
+	}
+	else if (values->type() == Value::ValueType::VECTOR) {
+		for (const auto &value : values->toVector()) {
+			double z;
+			if (!value->getDouble(z)) {
+				heights.clear();
+				break;
+			}
+			heights.push_back(z);
+		}
+	}
+	else {
+		double z;
+		if (values->getDouble(z)) heights.push_back(z);
+	}
+	if (heights.empty()) {
+		PRINTB("ERROR: Invalid --slice-heights '%s', expected [start:step:end] or [z1, z2, ...]", arg);
+		return false;
+	}
+	return true;
+}
+
 static bool checkAndExport(shared_ptr<const Geometry> root_geom, unsigned nd,
 													 FileFormat format, const char *filename)
 {
@@ -249,6 +489,236 @@ static bool checkAndExport(shared_ptr<const Geometry> root_geom, unsigned nd,
 	return true;
 }
 
+#ifdef ENABLE_CGAL
+static shared_ptr<const Geometry> evaluateRootGeometry(Tree &tree, RenderType renderer)
+{
+	GeometryEvaluator geomevaluator(tree);
+	shared_ptr<const Geometry> root_geom;
+	if (CSGBackend::current() == CSGBackend::voxel()) {
+		VoxelEvaluator voxelevaluator(tree, geomevaluator, CSGBackend::voxelSize());
+		root_geom = voxelevaluator.evaluateGeometry(*tree.root());
+		if (!root_geom) PRINT("Can't evaluate the model on voxels, evaluating it object by object");
+	}
+	// Force creation of CGAL objects (for testing)
+	if (!root_geom) root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
+	if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
+	if (renderer == RenderType::CGAL && root_geom->getDimension() == 3) {
+		auto N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
+		if (!N) {
+			N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
+			root_geom.reset(N);
+			PRINT("Converted to Nef polyhedron");
+		}
+	}
+	return root_geom;
+}
+
+/*!
+	Returns the outermost color() of the given top-level object, looking
+	through nodes with a single child, or negative components if it has none.
+*/
+static Color4f partColor(const AbstractNode *node)
+{
+	for (;;) {
+		if (auto colornode = dynamic_cast<const ColorNode *>(node)) return colornode->color;
+		if (node->getChildren().size() != 1) return Color4f(-1.0f, -1.0f, -1.0f, 1.0f);
+		node = node->getChildren().front();
+	}
+}
+
+/*!
+	The top-level objects, which the root unions, or the root itself if it
+	is not a group (e.g. it's selected with !).
+*/
+static std::vector<const AbstractNode *> topLevelNodes(const Tree &tree)
+{
+	const AbstractNode *root = tree.root();
+	std::vector<const AbstractNode *> nodes;
+	if (dynamic_cast<const GroupNode *>(root)) {
+		for (auto child : root->getChildren()) {
+			if (!child->modinst->isBackground()) nodes.push_back(child);
+		}
+	}
+	else {
+		nodes.push_back(root);
+	}
+	return nodes;
+}
+
+/*!
+	Evaluates each top-level object separately and exports them as separate
+	objects, for --export-parts. The objects are not unioned, so overlapping
+	parts stay overlapping.
+*/
+static bool evaluateAndExportParts(Tree &tree, FileFormat format, const char *filename)
+{
+	const auto nodes = topLevelNodes(tree);
+	GeometryEvaluator geomevaluator(tree);
+	std::vector<ExportPart> parts;
+	for (auto node : nodes) {
+		auto geom = geomevaluator.evaluateGeometry(*node, true);
+		if (!geom || geom->isEmpty()) continue;
+		if (geom->getDimension() != 3) {
+			PRINT("WARNING: Skipping top level object which is not a 3D object.");
+			continue;
+		}
+		parts.push_back(ExportPart{geom, partColor(node)});
+	}
+	if (parts.empty()) {
+		PRINT("Current top level object is empty.");
+		return false;
+	}
+	exportPartsByName(parts, format, filename, filename);
+	return true;
+}
+
+/*!
+	Exports the union of the top-level objects to a STL file, writing each
+	object as soon as it's evaluated rather than when all of them are, for
+	--export-stream. Just writing their facets gives the union only while
+	the objects are apart, which is the usual case for the parts of a print
+	plate. If an object's bounding box meets one of an object written
+	before, the root is evaluated the usual way (with the objects already
+	cached) and the file is written again. With --export-shells, overlapping
+	objects are written as they are.
+*/
+static bool evaluateAndExportStream(Tree &tree, RenderType renderer, FileFormat format, const char *filename)
+{
+	const auto nodes = topLevelNodes(tree);
+	if (nodes.size() > 1) {
+		GeometryEvaluator geomevaluator(tree);
+		StlStreamExporter exporter(format, filename, filename);
+		if (!exporter.isOpen()) return false;
+		std::vector<BoundingBox> written;
+		bool apart = true;
+		for (auto node : nodes) {
+			auto geom = InstancedPolySet::flattened(geomevaluator.evaluateGeometry(*node, true));
+			if (!geom || geom->isEmpty()) continue;
+			if (geom->getDimension() != 3) {
+				apart = false;
+				break;
+			}
+			const BoundingBox bbox = geom->getBoundingBox();
+			for (const auto &other : written) {
+				if (!arg_export_shells && bbox.intersects(other)) apart = false;
+			}
+			if (!apart) break;
+			exporter.append(geom);
+			written.push_back(bbox);
+		}
+		if (!exporter.close()) return false;
+		if (apart) {
+			if (!written.empty()) return true;
+			PRINT("Current top level object is empty.");
+			return false;
+		}
+		PRINT("Top-level objects overlap, exporting their union instead.");
+	}
+	return checkAndExport(evaluateRootGeometry(tree, renderer), 3, format, filename);
+}
+
+/*!
+	Exports the meshes of the top-level objects together as one mesh,
+	without computing their union, for --export-shells. Where objects
+	overlap, the mesh has overlapping shells, which slicers accept. The
+	union of the objects of a print plate barely changes them but can take
+	much of the rendering time.
+*/
+static bool evaluateAndExportShells(Tree &tree, FileFormat format, const char *filename)
+{
+	GeometryEvaluator geomevaluator(tree);
+	auto shells = make_shared<PolySet>(3);
+	unsigned int convexity = 1;
+	bool empty = true;
+	for (auto node : topLevelNodes(tree)) {
+		auto geom = InstancedPolySet::flattened(geomevaluator.evaluateGeometry(*node, true));
+		if (!geom || geom->isEmpty()) continue;
+		if (geom->getDimension() != 3) {
+			PRINT("WARNING: Skipping top level object which is not a 3D object.");
+			continue;
+		}
+		convexity = std::max(convexity, geom->getConvexity());
+		if (auto ps = dynamic_pointer_cast<const PolySet>(geom)) {
+			shells->append(*ps);
+		}
+		else if (auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
+			PolySet ps(3);
+			if (CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, ps)) {
+				PRINT("ERROR: Nef->PolySet failed");
+				return false;
+			}
+			shells->append(ps);
+		}
+		empty = false;
+	}
+	if (empty) {
+		PRINT("Current top level object is empty.");
+		return false;
+	}
+	shells->setConvexity(convexity);
+	exportFileByName(shells, format, filename, filename);
+	return true;
+}
+
+/*!
+	Evaluates the 3D geometry once and exports its cross-sections at all
+	of the --slice-heights, as projection(cut = true) would give for it
+	moved down by each height. Each slice goes to a file named after its
+	height, e.g. out_z=2.5.svg, or with --slice-layers, all are layers of
+	one SVG file.
+*/
+static bool evaluateAndExportSlices(Tree &tree, RenderType renderer, FileFormat format, const char *filename)
+{
+	auto root_geom = InstancedPolySet::flattened(evaluateRootGeometry(tree, renderer));
+	if (root_geom->getDimension() != 3) {
+		PRINT("Current top level object is not a 3D object.");
+		return false;
+	}
+	if (root_geom->isEmpty()) {
+		PRINT("Current top level object is empty.");
+		return false;
+	}
+	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(root_geom);
+	if (!ps) {
+		auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(root_geom);
+		auto nps = new PolySet(3);
+		if (!N || CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *nps)) {
+			PRINT("ERROR: Nef->PolySet failed");
+			delete nps;
+			return false;
+		}
+		ps.reset(nps);
+	}
+
+	const auto slices = PolysetUtils::slice(*ps, arg_slice_heights);
+	std::vector<ExportPart> layers;
+	for (size_t i = 0; i < slices.size(); ++i) {
+		shared_ptr<const Geometry> slice(slices[i]);
+		const std::string name = STR("z=" << arg_slice_heights[i]);
+		if (slice->isEmpty()) {
+			PRINTB("WARNING: The slice at %s is empty, skipping it.", name);
+			continue;
+		}
+		layers.push_back(ExportPart{slice, Color4f(-1.0f, -1.0f, -1.0f, 1.0f), name});
+	}
+	if (layers.empty()) {
+		PRINT("All slices are empty.");
+		return false;
+	}
+
+	if (arg_slice_layers && format == FileFormat::SVG) {
+		exportPartsByName(layers, format, filename, filename);
+		return true;
+	}
+	const fs::path outpath(filename);
+	for (const auto &layer : layers) {
+		const auto name = (outpath.parent_path() / (outpath.stem().string() + "_" + layer.name + outpath.extension().string())).string();
+		exportFileByName(layer.geom, format, name.c_str(), name.c_str());
+	}
+	return true;
+}
+#endif
+
 void set_render_color_scheme(const std::string color_scheme, const bool exit_if_not_found)
 {
 	if (color_scheme.empty()) {
@@ -269,14 +739,30 @@ void set_render_color_scheme(const std::string color_scheme, const bool exit_if_
 	}
 }
 
-int cmdline(const char *deps_output_file, const std::string &filename, const char *output_file, const fs::path &original_path, const std::string &parameterFile, const std::string &setName, const ViewOptions& viewOptions, Camera camera, const char *export_format)
+/*!
+	Exports a single file. If deferred is given, geometry evaluation and
+	export of geometry formats (see exportDimension()) are not done here but
+	stored in *deferred, which may then be run on another thread. It owns
+	the node tree, and returns the exit code.
+
+	If source is given, it is used as the contents of filename instead of
+	reading the file. If parameters is given, its set setName is applied
+	instead of reading parameterFile.
+
+	The export is a job with the JobLimits::defaults, deferred part
+	included. Throws ResourceLimitException when it exceeds them, except
+	from *deferred, which then fails.
+*/
+int cmdline(const char *deps_output_file, const std::string &filename, const char *output_file, const fs::path &original_path, const std::string &parameterFile, const std::string &setName, const ViewOptions& viewOptions, const std::vector<Camera> &cameras, const char *export_format, std::function<int()> *deferred = nullptr,
+						const std::string *source = nullptr, ParameterSet *parameters = nullptr)
 {
-	Tree tree;
+	const auto limits = JobLimits::start();
+	JobLimits::Scope limitsscope(limits);
+
+	auto tree_ptr = make_shared<Tree>();
+	Tree &tree = *tree_ptr;
 	boost::filesystem::path doc(filename);
 	tree.setDocumentPath(doc.remove_filename().string());
-#ifdef ENABLE_CGAL
-	GeometryEvaluator geomevaluator(tree);
-#endif
 
 	ExportFileFormatOptions exportFileFormatOptions;
 	FileFormat curFormat;
@@ -303,6 +789,9 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	}
 	
 	curFormat = exportFileFormatOptions.exportFileFormats.at(extsn);
+	// Binary STL and compressed AMF files use the same extension as the plain ones
+	if (curFormat == FileFormat::BINSTL) extsn = "stl";
+	else if (curFormat == FileFormat::ZIPAMF) extsn = "amf";
 	std::string filename_str = fs::path(output_file_str).replace_extension(extsn).generic_string();
 	new_output_file = filename_str.c_str();
 
@@ -316,7 +805,7 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	PRINTDB("BuiltinContext:\n%s", top_ctx.dump(nullptr, nullptr));
 #endif
 	shared_ptr<Echostream> echostream;
-	if (curFormat == FileFormat::ECHO) {
+	if (curFormat == FileFormat::ECHO && !arg_deps_only) {
 		echostream.reset(new Echostream(new_output_file));
 	}
 
@@ -328,12 +817,19 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 
 	handle_dep(filename);
 
-	std::ifstream ifs(filename.c_str());
-	if (!ifs.is_open()) {
-		PRINTB("Can't open input file '%s'!\n", filename.c_str());
-		return 1;
+	PhaseTimer parseTimer("parse");
+	std::string text;
+	if (source) {
+		text = *source;
+	}
+	else {
+		std::ifstream ifs(filename.c_str());
+		if (!ifs.is_open()) {
+			PRINTB("Can't open input file '%s'!\n", filename.c_str());
+			return 1;
+		}
+		text.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
 	}
-	std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
 	text += "\n\x03\n" + commandline_commands;
 	if (!parse(root_module, text, filename, filename, false)) {
 		delete root_module;  // parse failed
@@ -343,30 +839,80 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 		PRINTB("Can't parse file '%s'!\n", filename.c_str());
 		return 1;
 	}
+	shared_ptr<FileModule> root_module_owner(root_module);
 
 	// add parameter to AST
 	CommentParser::collectParameters(text.c_str(), root_module);
-	if (!parameterFile.empty() && !setName.empty()) {
+	if (parameters) {
+		parameters->applyParameterSet(root_module, setName);
+	}
+	else if (!parameterFile.empty() && !setName.empty()) {
 		ParameterSet param;
 		param.readParameterSet(parameterFile);
 		param.applyParameterSet(root_module, setName);
 	}
     
 	root_module->handleDependencies();
+	parseTimer.stop();
 
 	auto fpath = fs::absolute(fs::path(filename));
 	auto fparent = fpath.parent_path();
 	fs::current_path(fparent);
 	top_ctx.setDocumentPath(fparent.string());
 
-	AbstractNode::resetIndexCounter();
-	absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, nullptr);
-
-	// Do we have an explicit root node (! modifier)?
-	if (!(root_node = find_root_tag(absolute_root_node))) {
-		root_node = absolute_root_node;
-	}
-	tree.setRoot(root_node);
+	// Background (%) subtrees are only drawn by previews and would just be
+	// skipped by geometry exports, so they aren't instantiated for those.
+	// A root modifier (!) inside one would select it, so then they are.
+	const bool geometryOnly = !preview && curFormat != FileFormat::CSG && curFormat != FileFormat::AST &&
+		curFormat != FileFormat::TERM && curFormat != FileFormat::ECHO;
+	const bool skipBackground = geometryOnly && !root_module->hasRootTag();
+
+	// Animated images are instantiated again for each frame. Only top-level
+	// statements depending on $t are, the others keep their subtrees
+	// and thus hit the geometry caches.
+	if (curFormat == FileFormat::PNG && arg_animate) top_ctx.set_variable("$t", ValuePtr(0.0));
+	const bool animate = curFormat == FileFormat::PNG && arg_animate > 1;
+	NodeReuseCache reuse;
+	if (animate) reuse.adoptModule(root_module_owner);
+
+	// Replaces the previous tree, if any
+	auto instantiate = [&](AbstractNode *previous) {
+		PhaseTimer timer("instantiate");
+		if (animate) {
+			tree.setRoot(nullptr, true);
+			reuse.begin(previous, "");
+		}
+		delete previous;
+
+		ModuleInstantiation::setSkipBackground(skipBackground);
+		// Reused nodes keep their index, so new nodes must not collide with them.
+		// Without any, the indices start over, so the ids cached for the
+		// previous frame's nodes must go.
+		const bool keepCache = animate && reuse.hasCandidates();
+		if (!keepCache) {
+			AbstractNode::resetIndexCounter();
+			tree.setRoot(nullptr, false);
+		}
+		// Entries of an aborted compile may refer to deleted functions
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+		FileContext filectx(&top_ctx);
+		absolute_root_node = root_module->instantiateWithFileContext(&filectx, &root_inst, nullptr, animate ? &reuse : nullptr);
+		ModuleInstantiation::setSkipBackground(false);
+		FunctionCache::instance()->print();
+		ModuleCallCache::instance()->print();
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+
+		// Do we have an explicit root node (! modifier)?
+		if (!(root_node = find_root_tag(absolute_root_node))) {
+			root_node = absolute_root_node;
+		}
+		tree.setRoot(root_node, keepCache);
+		if (animate) reuse.end();
+		if (Metrics::isEnabled()) Metrics::instance()->count("nodes", countNodes(absolute_root_node));
+	};
+	instantiate(nullptr);
 
 	if (deps_output_file) {
 		fs::current_path(original_path);
@@ -377,9 +923,12 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 			PRINT("error writing deps");
 			return 1;
 		}
+		// All files are known once the tree is instantiated
+		if (arg_deps_only) return 0;
 	}
 
 	if (curFormat == FileFormat::CSG) {
+		PhaseTimer timer("export");
 		fs::current_path(original_path);
 		std::ofstream fstream(new_output_file);
 		if (!fstream.is_open()) {
@@ -392,6 +941,7 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 		}
 	}
 	else if (curFormat == FileFormat::AST) {
+		PhaseTimer timer("export");
 		fs::current_path(original_path);
 		std::ofstream fstream(new_output_file);
 		if (!fstream.is_open()) {
@@ -404,9 +954,12 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 		}
 	}
 	else if (curFormat == FileFormat::TERM) {
+		PhaseTimer csgTimer("csg");
 		CSGTreeEvaluator csgRenderer(tree);
 		auto root_raw_term = csgRenderer.buildCSGTree(*root_node);
+		csgTimer.stop();
 
+		PhaseTimer timer("export");
 		fs::current_path(original_path);
 		std::ofstream fstream(new_output_file);
 		if (!fstream.is_open()) {
@@ -423,58 +976,125 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	}
 	else {
 #ifdef ENABLE_CGAL
-		if ((curFormat == FileFormat::ECHO || curFormat == FileFormat::PNG) && (viewOptions.renderer == RenderType::OPENCSG || viewOptions.renderer == RenderType::THROWNTOGETHER)) {
-			// echo or OpenCSG png -> don't necessarily need geometry evaluation
-		} else {
-			// Force creation of CGAL objects (for testing)
-			root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
-			if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
-			if (viewOptions.renderer == RenderType::CGAL && root_geom->getDimension() == 3) {
-				auto N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
-				if (!N) {
-					N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
-					root_geom.reset(N);
-					PRINT("Converted to Nef polyhedron");
+		const unsigned nd = exportDimension(curFormat);
+		// Each top-level object is its own object in the file, so there is no root geometry
+		const bool exportParts = arg_export_parts && (curFormat == FileFormat::_3MF || curFormat == FileFormat::OSMESH);
+		// Slices of a 3D root are exported instead of the 2D root geometry
+		const bool exportSlices = !arg_slice_heights.empty() && nd == 2;
+		// Top-level objects are written as they are evaluated
+		const bool exportStream = arg_export_stream && (curFormat == FileFormat::STL || curFormat == FileFormat::BINSTL);
+		// The top-level objects are exported without their union, as one mesh
+		const bool exportShells = arg_export_shells && !exportStream && nd == 3 &&
+			curFormat != FileFormat::NEFDBG && curFormat != FileFormat::NEF3;
+		if (deferred && nd) {
+			// Neither evaluation nor export depend on the current directory or
+			// any other global state from here on
+			fs::current_path(original_path);
+			const std::string output = fs::absolute(new_output_file).string();
+			const RenderType renderer = viewOptions.renderer;
+			*deferred = [tree_ptr, root_module_owner, root_node, renderer, nd, curFormat, output, exportParts, exportSlices, exportStream, exportShells, limits]() {
+				JobLimits::Scope limitsscope(limits);
+				bool ok = false;
+				try {
+					ok = exportParts ? evaluateAndExportParts(*tree_ptr, curFormat, output.c_str()) :
+						exportSlices ? evaluateAndExportSlices(*tree_ptr, renderer, curFormat, output.c_str()) :
+						exportStream ? evaluateAndExportStream(*tree_ptr, renderer, curFormat, output.c_str()) :
+						exportShells ? evaluateAndExportShells(*tree_ptr, curFormat, output.c_str()) :
+						checkAndExport(evaluateRootGeometry(*tree_ptr, renderer), nd, curFormat, output.c_str());
+				} catch (const ResourceLimitException &) {
 				}
-			}
+				delete root_node;
+				return ok ? 0 : 1;
+			};
+			return 0;
+		}
+
+		// echo or OpenCSG png -> don't necessarily need geometry evaluation
+		const bool needGeometry = !exportParts && !exportSlices && !exportStream && !exportShells && !((curFormat == FileFormat::ECHO || curFormat == FileFormat::PNG) &&
+			(viewOptions.renderer == RenderType::OPENCSG || viewOptions.renderer == RenderType::THROWNTOGETHER));
+		// Workers instantiate the file again, which they can't for sources given in memory
+		if ((needGeometry || exportParts || exportSlices || exportStream || exportShells) && RenderFarm::instance()->isEnabled() && !source && !parameters) {
+			PhaseTimer timer("geometry");
+			RenderFarm::Source farmsource;
+			farmsource.file = fpath.string();
+			farmsource.commands = commandline_commands;
+			if (!parameterFile.empty()) farmsource.parameterFile = fs::absolute(parameterFile, original_path).string();
+			farmsource.parameterSet = setName;
+			RenderFarm::instance()->evaluate(tree, farmsource);
+		}
+		if (needGeometry) {
+			PhaseTimer timer("geometry");
+			root_geom = evaluateRootGeometry(tree, viewOptions.renderer);
 		}
 
 		fs::current_path(original_path);
 
-		if(curFormat == FileFormat::STL ||
-			curFormat == FileFormat::OFF ||
-			curFormat == FileFormat::AMF ||
-			curFormat == FileFormat::_3MF ||
-			curFormat == FileFormat::NEFDBG ||
-			curFormat == FileFormat::NEF3 )
-		{
-			if(!checkAndExport(root_geom, 3, curFormat, new_output_file)) {
-				return 1;
-			}
+		// Parts, slices, streamed objects and shells are exported as they are evaluated
+		if (exportParts) {
+			PhaseTimer timer("geometry");
+			if (!evaluateAndExportParts(tree, curFormat, new_output_file)) return 1;
 		}
-
-		if(curFormat == FileFormat::DXF || curFormat == FileFormat::SVG) {
-			if (!checkAndExport(root_geom, 2, curFormat, new_output_file)) {
-				return 1;
-			}
+		else if (exportSlices) {
+			PhaseTimer timer("geometry");
+			if (!evaluateAndExportSlices(tree, viewOptions.renderer, curFormat, new_output_file)) return 1;
+		}
+		else if (exportStream) {
+			PhaseTimer timer("geometry");
+			if (!evaluateAndExportStream(tree, viewOptions.renderer, curFormat, new_output_file)) return 1;
+		}
+		else if (exportShells) {
+			PhaseTimer timer("geometry");
+			if (!evaluateAndExportShells(tree, curFormat, new_output_file)) return 1;
+		}
+		else if (nd) {
+			PhaseTimer timer("export");
+			if (!checkAndExport(root_geom, nd, curFormat, new_output_file)) return 1;
 		}
 
 		if (curFormat == FileFormat::PNG) {
-			auto success = true;
-			std::ofstream fstream(new_output_file,std::ios::out|std::ios::binary);
-			if (!fstream.is_open()) {
-				PRINTB("Can't open file \"%s\" for export", new_output_file);
-				success = false;
-			}
-			else {
+			// All views of all frames are drawn in the same offscreen context.
+			// The images of a frame are written while the next one is evaluated.
+			const unsigned int frames = std::max(arg_animate, 1u);
+			std::vector<std::unique_ptr<std::ofstream>> fstreams;
+			for (unsigned int frame = 0; frame < frames; ++frame) {
+				if (frame > 0) {
+					top_ctx.set_variable("$t", ValuePtr(double(frame) / frames));
+					fs::current_path(fparent);
+					instantiate(absolute_root_node);
+					if (needGeometry) {
+						PhaseTimer timer("geometry");
+						root_geom = evaluateRootGeometry(tree, viewOptions.renderer);
+					}
+					fs::current_path(original_path);
+				}
+
+				PhaseTimer timer("export");
+
+				if (!wait_png_exports()) return 1;
+				fstreams.clear();
+				std::vector<std::ostream *> outputs;
+				for (size_t view = 0; view < cameras.size(); ++view) {
+					const auto name = png_output_name(new_output_file, frames, frame, cameras.size(), view);
+					fstreams.emplace_back(new std::ofstream(name, std::ios::out|std::ios::binary));
+					if (!fstreams.back()->is_open()) {
+						PRINTB("Can't open file \"%s\" for export", name);
+						wait_png_exports();
+						return 1;
+					}
+					outputs.push_back(fstreams.back().get());
+				}
+				bool success;
 				if (viewOptions.renderer == RenderType::CGAL || viewOptions.renderer == RenderType::GEOMETRY) {
-					success = export_png(root_geom, viewOptions, camera, fstream);
+					success = export_png(root_geom, viewOptions, cameras, outputs);
 				} else {
-					success = export_preview_png(tree, viewOptions, camera, fstream);
+					success = export_preview_png(tree, viewOptions, cameras, outputs);
+				}
+				if (!success) {
+					wait_png_exports();
+					return 1;
 				}
-				fstream.close();
 			}
-			return success ? 0 : 1;
+			return wait_png_exports() ? 0 : 1;
 		}
 
 #else
@@ -486,6 +1106,468 @@ int cmdline(const char *deps_output_file, const std::string &filename, const cha
 	return 0;
 }
 
+struct BatchJob
+{
+	std::string input;
+	std::string output;
+	std::string commands;
+	std::string exportFormat;
+	std::string parameterFile;
+	std::string parameterSet;
+};
+
+/*!
+	Reads a batch manifest: one job per line, given as command line
+	arguments (input file, -o, -D, -p, -P, --export-format). Empty lines
+	and lines starting with # are ignored.
+*/
+static bool readBatchManifest(const std::string &filename, std::vector<BatchJob> &jobs)
+{
+	std::ifstream ifs(filename.c_str());
+	if (!ifs.is_open()) {
+		PRINTB("Can't open batch manifest '%s'!", filename);
+		return false;
+	}
+
+	po::options_description desc;
+	desc.add_options()
+		("o,o", po::value<string>())
+		("D,D", po::value<vector<string>>())
+		("p,p", po::value<string>())
+		("P,P", po::value<string>())
+		("export-format", po::value<string>())
+		("input-file", po::value<string>());
+	po::positional_options_description p;
+	p.add("input-file", 1);
+
+	std::string line;
+	for (int lineno = 1; std::getline(ifs, line); ++lineno) {
+		boost::trim(line);
+		if (line.empty() || line[0] == '#') continue;
+
+		po::variables_map vm;
+		try {
+			po::store(po::command_line_parser(po::split_unix(line)).options(desc).positional(p).run(), vm);
+		}
+		catch (const std::exception &e) {
+			PRINTB("ERROR: %s, line %d: %s", filename % lineno % e.what());
+			return false;
+		}
+		if (!vm.count("input-file") || !vm.count("o")) {
+			PRINTB("ERROR: %s, line %d: a job needs an input file and -o", filename % lineno);
+			return false;
+		}
+
+		BatchJob job;
+		job.input = vm["input-file"].as<string>();
+		job.output = vm["o"].as<string>();
+		if (vm.count("D")) {
+			for (const auto &cmd : vm["D"].as<vector<string>>()) job.commands += cmd + ";\n";
+		}
+		if (vm.count("export-format")) {
+			job.exportFormat = vm["export-format"].as<string>();
+			ExportFileFormatOptions exportFileFormatOptions;
+			if (!exportFileFormatOptions.exportFileFormats.count(job.exportFormat)) {
+				PRINTB("ERROR: %s, line %d: unknown --export-format '%s'", filename % lineno % job.exportFormat);
+				return false;
+			}
+		}
+		if (vm.count("p")) job.parameterFile = vm["p"].as<string>();
+		if (vm.count("P")) job.parameterSet = vm["P"].as<string>();
+		jobs.push_back(job);
+	}
+	return true;
+}
+
+/*!
+	Runs the given jobs in this process, so builtins, fonts and the module
+	and geometry caches are only initialized once.
+
+	Parsing and instantiation use global state and are done one job at a
+	time. Geometry evaluation and export of geometry formats is run on the
+	ThreadPool, overlapping with the following jobs. Other options given on
+	the command line apply to all jobs; -D assignments of a job are added to
+	those of the command line.
+*/
+static int runJobs(const std::vector<BatchJob> &jobs, const fs::path &original_path, const ViewOptions &viewOptions, const std::vector<Camera> &cameras, const char *export_format)
+{
+	const std::string global_commands = commandline_commands;
+	// Limits the number of jobs in flight, and thus the number of node trees
+	// and replaced library modules kept in memory
+	const size_t window = 2 * ThreadPool::instance()->numThreads();
+	size_t inflight = 0;
+	std::atomic<int> failed(0);
+	TaskGroup group;
+	auto flush = [&]() {
+		group.wait();
+		inflight = 0;
+		ModuleCache::instance()->releaseReplaced();
+	};
+
+	ModuleCache::instance()->setKeepReplaced(true);
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		const auto &job = jobs[i];
+		PRINTB("Batch job %d/%d: %s -> %s", (i + 1) % jobs.size() % job.input % job.output);
+
+		const char *format = job.exportFormat.empty() ? export_format : job.exportFormat.c_str();
+		const std::string extension = format ? std::string(format) : boost::algorithm::to_lower_copy(fs::path(job.output).extension().generic_string());
+		// Echo output captures all messages, so don't mix in those of other jobs
+		if (extension == "echo" || extension == ".echo") flush();
+
+		fs::current_path(original_path);
+		commandline_commands = global_commands + job.commands;
+		std::function<int()> deferred;
+		try {
+			if (cmdline(nullptr, job.input, job.output.c_str(), original_path, job.parameterFile, job.parameterSet, viewOptions, cameras, format, &deferred) != 0) failed++;
+		} catch (const HardWarningException &) {
+			failed++;
+		} catch (const ResourceLimitException &) {
+			failed++;
+		}
+
+		if (deferred) {
+			group.run([deferred, &failed]() {
+				try {
+					if (deferred() != 0) failed++;
+				} catch (const HardWarningException &) {
+					failed++;
+				}
+			});
+			if (++inflight >= window) flush();
+		}
+	}
+	flush();
+	ModuleCache::instance()->setKeepReplaced(false);
+	fs::current_path(original_path);
+	commandline_commands = global_commands;
+
+	if (failed > 0) {
+		PRINTB("Batch: %d of %d jobs failed", failed % jobs.size());
+		return 1;
+	}
+	return 0;
+}
+
+int batch(const std::string &manifest, const fs::path &original_path, const ViewOptions &viewOptions, const std::vector<Camera> &cameras, const char *export_format)
+{
+	std::vector<BatchJob> jobs;
+	if (!readBatchManifest(manifest, jobs)) return 1;
+	return runJobs(jobs, original_path, viewOptions, cameras, export_format);
+}
+
+/*!
+	Expands a parameter sweep into jobs: one for every parameter set in
+	parameterFile if sweepSets is set (otherwise just setName), times the
+	cartesian product of the values of all ranges. A range is given as
+	name=expression, where the expression evaluates to a range or a vector.
+
+	The variant is appended to the base name of output, e.g. out.stl
+	becomes out_set1_width=10.stl. Since subtrees are cached by their
+	structure, those not depending on the swept parameters are evaluated
+	only once for all variants.
+*/
+static bool sweepJobs(const std::string &input, const std::string &output, const std::string &parameterFile, const std::string &setName,
+											bool sweepSets, const std::vector<std::string> &ranges, std::vector<BatchJob> &jobs)
+{
+	// Jobs with the file name suffix describing their variant
+	BatchJob base;
+	base.input = input;
+	base.parameterFile = parameterFile;
+	base.parameterSet = setName;
+	std::vector<std::pair<BatchJob, std::string>> variants{{base, ""}};
+
+	if (sweepSets) {
+		ParameterSet param;
+		if (!param.readParameterSet(parameterFile)) return false;
+		const auto names = param.getParameterNames();
+		if (names.empty()) {
+			PRINTB("ERROR: No parameter sets in '%s'", parameterFile);
+			return false;
+		}
+		std::vector<std::pair<BatchJob, std::string>> expanded;
+		for (const auto &variant : variants) {
+			for (const auto &name : names) {
+				auto job = variant.first;
+				job.parameterSet = name;
+				expanded.emplace_back(job, variant.second + "_" + name);
+			}
+		}
+		variants.swap(expanded);
+	}
+
+	for (const auto &range : ranges) {
+		const auto eq = range.find('=');
+		const std::string name = eq == std::string::npos ? "" : boost::trim_copy(range.substr(0, eq));
+		const auto expr = name.empty() ? nullptr : CommentParser::parser(range.substr(eq + 1).c_str());
+		if (!expr) {
+			PRINTB("ERROR: Invalid --sweep-range '%s', expected name=[start:step:end] or name=[values]", range);
+			return false;
+		}
+		ModuleContext ctx;
+		const ValuePtr values = expr->evaluate(&ctx);
+		Value::VectorType list;
+		if (values->type() == Value::ValueType::RANGE) {
+			RangeType r = values->toRange();
+			if (r.numValues() >= 10000) {
+				PRINTB("ERROR: Too many values in --sweep-range '%s'", range);
+				return false;
+			}
+			for (RangeType::iterator it = r.begin(); it != r.end(); it++) list.push_back(ValuePtr(*it));
+		}
+		else if (values->type() == Value::ValueType::VECTOR) {
+			list = values->toVector();
+		}
+		else {
+			list.push_back(values);
+		}
+
+		std::vector<std::pair<BatchJob, std::string>> expanded;
+		for (const auto &variant : variants) {
+			for (const auto &value : list) {
+				auto job = variant.first;
+				const std::string assignment = name + "=" + value->toEchoString();
+				job.commands += assignment + ";\n";
+				expanded.emplace_back(job, variant.second + "_" + assignment);
+			}
+		}
+		variants.swap(expanded);
+	}
+
+	const fs::path outpath(output);
+	for (auto &variant : variants) {
+		auto suffix = variant.second;
+		for (auto &c : suffix) {
+			if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != '-' && c != '.' && c != '=') c = '_';
+		}
+		const auto filename = outpath.stem().string() + suffix + outpath.extension().string();
+		variant.first.output = (outpath.parent_path() / filename).string();
+		jobs.push_back(variant.first);
+	}
+	return true;
+}
+
+int sweep(const std::string &input, const std::string &output, const std::string &parameterFile, const std::string &setName,
+					bool sweepSets, const std::vector<std::string> &ranges,
+					const fs::path &original_path, const ViewOptions &viewOptions, const std::vector<Camera> &cameras, const char *export_format)
+{
+	std::vector<BatchJob> jobs;
+	if (!sweepJobs(input, output, parameterFile, setName, sweepSets, ranges, jobs)) return 1;
+	return runJobs(jobs, original_path, viewOptions, cameras, export_format);
+}
+
+/*!
+	Handles one server request, see serve(). Returns the exported file
+	contents in data.
+*/
+static bool serveRequest(const pt::ptree &request, const fs::path &original_path, const ViewOptions &viewOptions, const Camera &camera, std::string &data)
+{
+	const std::string format = request.get<string>("format", "");
+	ExportFileFormatOptions exportFileFormatOptions;
+	if (!exportFileFormatOptions.exportFileFormats.count(format)) {
+		PRINTB("ERROR: Unknown export format '%s'", format);
+		return false;
+	}
+
+	const auto source = request.get_optional<string>("source");
+	std::string filename = request.get<string>("file", "");
+	if (!source && filename.empty()) {
+		PRINT("ERROR: A request needs a file or source");
+		return false;
+	}
+	// Sources without a file name resolve relative paths against the current directory
+	filename = fs::absolute(filename.empty() ? fs::path("untitled.scad") : fs::path(filename), original_path).string();
+
+	ParameterSet parameterSet;
+	const auto parameters = request.get_child_optional("parameters");
+	if (parameters) parameterSet.addParameterSet("request", *parameters);
+
+	boost::system::error_code ec;
+	const fs::path output = fs::temp_directory_path(ec) / fs::unique_path("openscad-%%%%-%%%%-%%%%." + (format == "binstl" ? std::string("stl") : format == "zipamf" ? std::string("amf") : format), ec);
+	if (ec) {
+		PRINTB("ERROR: Can't create temporary output file: %s", ec.message());
+		return false;
+	}
+
+	fs::current_path(original_path);
+	const auto rc = cmdline(nullptr, filename, output.string().c_str(), original_path, "", "request", viewOptions, {camera}, nullptr, nullptr,
+													source.get_ptr(), parameters ? &parameterSet : nullptr);
+	fs::current_path(original_path);
+
+	std::ifstream ifs(output.string().c_str(), std::ios::in | std::ios::binary);
+	if (ifs.is_open()) data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+	ifs.close();
+	fs::remove(output, ec);
+	return rc == 0 && !data.empty();
+}
+
+/*!
+	Server mode: reads render requests from stdin, one JSON object per line,
+	and writes a JSON response line followed by the exported bytes for each
+	to stdout. Caches, libraries and fonts stay loaded between requests.
+
+	Request:  {"id": "...", "file": "path.scad" | "source": "cube(1);",
+	           "parameters": {"name": "value", ...}, "format": "stl"}
+	Response: {"id": "...", "status": "ok" | "error", "format": "stl",
+	           "size": "n", "messages": "..."}, then n bytes of output.
+	A request which exceeded a limit given by the --max-* options has the
+	error status and "limit": the name of the limit, e.g. "wall-time".
+
+	Request {"id": "...", "metrics": true} gets the metrics of all requests
+	so far (see Metrics), with "format": "prometheus" and the metrics in the
+	Prometheus text format as output.
+
+	"parameters" uses the format of a set in a parameter set file. With
+	"source", "file" is only used to resolve relative paths.
+*/
+int serve(const fs::path &original_path, const ViewOptions &viewOptions, const Camera &camera)
+{
+	std::string line;
+	while (std::getline(std::cin, line)) {
+		boost::trim(line);
+		if (line.empty()) continue;
+
+		pt::ptree request;
+		std::string data;
+		const char *limit = nullptr;
+		auto ok = false;
+		auto metrics = false;
+		resetSuppressedMessages();
+		print_messages_push();
+		try {
+			std::istringstream in(line);
+			pt::read_json(in, request);
+			metrics = request.get<bool>("metrics", false);
+			if (metrics) {
+				data = Metrics::instance()->prometheus();
+				ok = true;
+			}
+			else {
+				PhaseTimer timer("request");
+				ok = serveRequest(request, original_path, viewOptions, camera, data);
+			}
+		}
+		catch (const pt::json_parser_error &e) {
+			PRINTB("ERROR: Invalid request: %s", e.what());
+		}
+		catch (const HardWarningException &) {
+		}
+		catch (const ResourceLimitException &e) {
+			limit = JobLimits::name(e.resource);
+		}
+		const std::string messages = print_messages_stack.back();
+		print_messages_pop();
+		if (!metrics) Metrics::instance()->count("requests", 1);
+		if (!ok) {
+			data.clear();
+			Metrics::instance()->count("failed_requests", 1);
+		}
+
+		pt::ptree response;
+		response.put("id", request.get<string>("id", ""));
+		response.put("status", ok ? "ok" : "error");
+		response.put("format", metrics ? std::string("prometheus") : request.get<string>("format", ""));
+		response.put("size", data.size());
+		response.put("messages", messages);
+		if (limit) response.put("limit", limit);
+		pt::write_json(std::cout, response, false);
+		std::cout.write(data.data(), data.size());
+		std::cout.flush();
+	}
+	return 0;
+}
+
+#ifdef ENABLE_CGAL
+/*!
+	Worker mode for --workers, see RenderFarm. The model of the last job is
+	kept instantiated, so the following jobs for it only evaluate.
+*/
+int worker()
+{
+	struct Model {
+		RenderFarm::Source source;
+		shared_ptr<FileModule> module;
+		ModuleInstantiation root_inst{"group"};
+		AbstractNode *absolute_root_node = nullptr;
+		Tree tree;
+
+		~Model() {
+			tree.setRoot(nullptr);
+			delete absolute_root_node;
+		}
+	};
+	std::unique_ptr<Model> model;
+
+	auto load = [](const RenderFarm::Source &source) -> Model * {
+		std::ifstream ifs(source.file.c_str());
+		if (!ifs.is_open()) {
+			PRINTB("Can't open input file '%s'!\n", source.file);
+			return nullptr;
+		}
+		std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+		text += "\n\x03\n" + source.commands;
+		FileModule *root_module;
+		if (!parse(root_module, text, source.file, source.file, false)) {
+			delete root_module;
+			PRINTB("Can't parse file '%s'!\n", source.file);
+			return nullptr;
+		}
+
+		std::unique_ptr<Model> m(new Model);
+		m->source = source;
+		m->module.reset(root_module);
+		CommentParser::collectParameters(text.c_str(), root_module);
+		if (!source.parameterFile.empty() && !source.parameterSet.empty()) {
+			ParameterSet param;
+			param.readParameterSet(source.parameterFile);
+			param.applyParameterSet(root_module, source.parameterSet);
+		}
+		root_module->handleDependencies();
+
+		const auto fparent = fs::path(source.file).parent_path();
+		fs::current_path(fparent);
+		BuiltinContext top_ctx;
+		top_ctx.set_variable("$preview", ValuePtr(false));
+		top_ctx.setDocumentPath(fparent.string());
+
+		// Instantiated as for a geometry export, see cmdline()
+		ModuleInstantiation::setSkipBackground(!root_module->hasRootTag());
+		AbstractNode::resetIndexCounter();
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+		FileContext filectx(&top_ctx);
+		m->absolute_root_node = root_module->instantiateWithFileContext(&filectx, &m->root_inst, nullptr);
+		ModuleInstantiation::setSkipBackground(false);
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+
+		AbstractNode *root_node = find_root_tag(m->absolute_root_node);
+		m->tree.setDocumentPath(fparent.string());
+		m->tree.setRoot(root_node ? root_node : m->absolute_root_node);
+		return m.release();
+	};
+
+	return RenderFarm::runWorker([&](const RenderFarm::Source &source, const std::string &key) -> shared_ptr<const Geometry> {
+		if (!model || !(model->source == source)) {
+			model.reset();
+			model.reset(load(source));
+			if (!model) return nullptr;
+		}
+		std::vector<const AbstractNode *> stack{model->tree.root()};
+		while (!stack.empty()) {
+			const AbstractNode *node = stack.back();
+			stack.pop_back();
+			if (GeometryEvaluator::cacheKey(model->tree, *node) == key) {
+				GeometryEvaluator evaluator(model->tree);
+				return evaluator.evaluateGeometry(*node, true);
+			}
+			for (const auto child : node->getChildren()) stack.push_back(child);
+		}
+		PRINT("ERROR: The subtree of the job is not in the model");
+		return nullptr;
+	});
+}
+#endif
+
 #ifdef OPENSCAD_QTGUI
 #include <QtPlugin>
 #if defined(__MINGW64__) || defined(__MINGW32__) || defined(_MSCVER)
@@ -792,7 +1874,18 @@ int main(int argc, char **argv)
 	int rc = 0;
 	StackCheck::inst();
 
-#ifdef OPENSCAD_QTGUI
+#if defined(OPENSCAD_QTGUI) && defined(__linux__)
+	{
+		// Where Qt would find it, without the cost of starting Qt for command line runs
+		boost::system::error_code ec;
+		const auto exe = fs::read_symlink("/proc/self/exe", ec);
+		if (!ec) PlatformUtils::registerApplicationPath(exe.parent_path().generic_string());
+		else {
+			QCoreApplication app(argc, argv);
+			PlatformUtils::registerApplicationPath(app.applicationDirPath().toLocal8Bit().constData());
+		}
+	}
+#elif defined(OPENSCAD_QTGUI)
 	{   // Need a dummy app instance to get the application path but it needs to be destroyed before the GUI is launched.
 		QCoreApplication app(argc, argv);
 		PlatformUtils::registerApplicationPath(app.applicationDirPath().toLocal8Bit().constData());
@@ -824,8 +1917,15 @@ int main(int argc, char **argv)
 	ViewOptions viewOptions{};
 	po::options_description desc("Allowed options");
 	desc.add_options()
-		("export-format", po::value<string>(), "format of exported scad file, arg can be any of file extension in -o option. It overrides the file extension in -o option\n")
-		("o,o", po::value<string>(), "output specified file instead of running the GUI, the file extension specifies the type: stl, off, amf, 3mf, csg, dxf, svg, png, echo, ast, term, nef3, nefdbg\n")
+		("export-format", po::value<string>(), "format of exported scad file, arg can be any of file extension in -o option, binstl for binary STL or zipamf for compressed AMF. It overrides the file extension in -o option\n")
+		("o,o", po::value<string>(), "output specified file instead of running the GUI, the file extension specifies the type: stl, off, amf, 3mf, osmesh, csg, dxf, svg, png, echo, ast, term, nef3, nefdbg\n")
+		("export-parts", "export each top-level object as a separate 3MF or osmesh object with its color, instead of their union")
+		("export-stream", "write each top-level object to the STL file as soon as it is evaluated, as long as the objects don't touch")
+		("export-shells", "export the top-level objects as one mesh without their union, which may have overlapping shells (accepted by slicers)")
+		("export-precision", po::value<unsigned int>(), "=n -write the coordinates of text exports (stl, off, amf, dxf, svg) with n significant digits, 0 for as many as needed to read them back exactly (default 6)")
+		("svg-path-per-outline", "write each outline of an svg file as a separate unfilled path, e.g. for laser cutters")
+		("slice-heights", po::value<string>(), "=[start:step:end] or [z1,z2,...] -with a dxf or svg output file, export the cross-sections of the 3D object at these heights, each to a file named after its height")
+		("slice-layers", "with --slice-heights and an svg output file, write all slices as layers of that file")
 		("D,D", po::value<vector<string>>(), "var=val -pre-define variables")
 		("p,p", po::value<string>(), "customizer parameter file")
 		("P,P", po::value<string>(), "customizer parameter set")
@@ -841,22 +1941,49 @@ int main(int argc, char **argv)
 		("version,v", "print the version")
 		("info", "print information about the build process\n")
 
-		("camera", po::value<string>(), "camera parameters when exporting png: =translate_x,y,z,rot_x,y,z,dist or =eye_x,y,z,center_x,y,z")
+		("camera", po::value<string>(), "camera parameters when exporting png: =translate_x,y,z,rot_x,y,z,dist or =eye_x,y,z,center_x,y,z; several views separated by ; are written to files numbered -0, -1, ...")
 		("autocenter", "adjust camera to look at object's center")
 		("viewall", "adjust camera to fit object")
-		("imgsize", po::value<string>(), "=width,height of exported png")
+		("imgsize", po::value<string>(), "=width,height of exported png, or one per camera separated by ;")
+		("png-compression", po::value<int>(), "=n -zlib level of exported png from 0 (uncompressed) to 9 (default 6)")
+		("animate", po::value<unsigned int>(), "=n -export n png frames for $t from 0 to (n-1)/n, numbered as output_file00000.png, ...")
 		("render", po::value<string>()->implicit_value(""), "for full geometry evaluation when exporting png")
 		("preview", po::value<string>()->implicit_value(""), "[=throwntogether] -for ThrownTogether preview png")
 		("view", po::value<CommaSeparatedVector>(), ("=view options: " + boost::join(viewOptions.names(), " | ")).c_str())
 		("projection", po::value<string>(), "=(o)rtho or (p)erspective when exporting png")
 		("csglimit", po::value<unsigned int>(), "=n -stop rendering at n CSG elements when exporting png")
-		("colorscheme", po::value<string>(), ("=colorscheme: " +
-		                                      join(ColorMap::inst()->colorSchemeNames(), " | ",
-		                                           [](const std::string& colorScheme) {
-		                                               return (colorScheme == ColorMap::inst()->defaultColorSchemeName() ? "*" : "") + colorScheme;
-		                                           }) +
-		                                      "\n").c_str())
+		("sweep", "with -p, export every parameter set of the file, each to a file named after the set")
+		("sweep-range", po::value<vector<string>>(), "name=values -export a variant for every value of a range or vector expression, e.g. width=[10:5:30]; several ranges export their cartesian product")
+		("serve", "run as a server, reading render requests as JSON lines from stdin and writing the results to stdout")
+		("batch", po::value<string>(), "manifest -export all jobs listed in the manifest file, one per line as: input_file -o output_file [-D var=val] [-p file] [-P set] [--export-format arg]")
+#ifdef ENABLE_CGAL
+		("csg-backend", po::value<string>(), ("=backend for 3D booleans: " + boost::join(CSGBackend::names(), " | ") + " (default nef)").c_str())
+		("voxel-size", po::value<double>(), "=mm -size of the voxels of the approximate voxel backend for 3D booleans (default 0.5)")
+		("snap-rounding", "-round the exact coordinates of 3D boolean results to a fine grid once they grow large, which keeps long chains of booleans fast")
+		("workers", po::value<string>(), "=n|commands -evaluate expensive subtrees on n local worker processes, or on the workers started by the given shell commands separated by ;, e.g. \"ssh host openscad --worker\"")
+		("worker", "run as a worker process for --workers, reading jobs from stdin and writing the results to stdout")
+#endif
+		("threads", po::value<unsigned int>(), "=n -evaluate independent subtrees on n threads, 0 uses all CPU cores (default 1)")
+		("cache-dir", po::value<string>(), "=path -keep evaluated geometry in a persistent cache in the given directory")
+		("cache-size", po::value<unsigned int>(), "=n -limit the persistent geometry cache to n megabytes (default 1024)")
+		("shared-cache-dir", po::value<string>(), "=path -look up geometry missing from the caches in a cache directory shared with other users or machines, e.g. on a network file system, and store results there")
+		("shared-cache-size", po::value<unsigned int>(), "=n -limit the shared geometry cache to n megabytes (default 1024)")
+		("memory-cache-size", po::value<string>(), "=n|auto -limit the in-memory geometry and CGAL caches to n megabytes each, or to an eighth of the available memory each with auto (default 100)")
+		("stats", "print the hits, misses and evictions of the geometry caches when done")
+		("max-wall-time", po::value<double>(), "=seconds -fail a job, e.g. of --batch or --server, which runs longer")
+		("max-cpu-time", po::value<double>(), "=seconds -fail a job which uses more CPU time")
+		("max-memory", po::value<unsigned int>(), "=n -fail a job while the process uses more than n megabytes of memory")
+		("max-nodes", po::value<unsigned int>(), "=n -fail a job which instantiates more than n nodes")
+		("max-csg-size", po::value<unsigned int>(), "=n -fail a job whose normalized CSG tree grows past n elements")
+		("max-recursion-depth", po::value<unsigned int>(), "=n -fail a job which nests more than n calls of user modules and functions")
+		("profile", po::value<string>(), "=file -write the time spent on each node and its geometry to the file, in the Chrome trace format, along with the trace zones if compiled in")
+		("profile-interpreter", po::value<string>()->implicit_value(""), "[=file] -report the calls of and the time spent in user functions and modules, to the file or the console")
+		("timing", po::value<string>(), "=file -write the time spent parsing, instantiating, building CSG products, evaluating geometry and exporting to the file, as JSON")
+		("summary-json", po::value<string>(), "=file -write the timing, cache hit ratios, arena allocations, peak memory, node and triangle counts to the file, as JSON")
+		("colorscheme", po::value<string>(), "=colorscheme: the name of a color scheme, see the list below\n")
 		("d,d", po::value<string>(), "deps_file -generate a dependency file for make")
+		("deps-only", "with -d, only write the dependency file, without evaluating the geometry or writing the output file")
+		("skip-unchanged", "skip the export if the input files, options and version are the same as when the output file was written, as recorded in output_file.hash")
 		("m,m", po::value<string>(), "make_cmd -runs make_cmd file if file is missing")
 		("quiet,q", "quiet mode (don't print anything *except* errors)")
 		("hardwarnings", "Stop on the first warning")
@@ -946,6 +2073,96 @@ int main(int argc, char **argv)
 	if (vm.count("csglimit")) {
 		RenderSettings::inst()->openCSGTermLimit = vm["csglimit"].as<unsigned int>();
 	}
+	if (vm.count("png-compression")) {
+		set_png_compression(vm["png-compression"].as<int>());
+	}
+
+#ifdef ENABLE_CGAL
+	if (vm.count("csg-backend")) {
+		const auto backend = vm["csg-backend"].as<string>();
+		if (!CSGBackend::select(backend)) {
+			PRINTB("Unknown --csg-backend '%s', using '%s'. Valid backends: %s", backend % CSGBackend::current()->name() % boost::join(CSGBackend::names(), ", "));
+		}
+	}
+	if (vm.count("voxel-size")) {
+		const double size = vm["voxel-size"].as<double>();
+		if (size > 0) CSGBackend::setVoxelSize(size);
+		else PRINTB("Invalid --voxel-size %g, it must be positive", size);
+	}
+	if (vm.count("snap-rounding")) GeometryEvaluator::setSnapRounding(true);
+#endif
+	if (vm.count("threads")) {
+		ThreadPool::instance()->setNumThreads(vm["threads"].as<unsigned int>());
+	}
+	if (vm.count("cache-size")) {
+		DiskCache::instance()->setMaxSizeMB(vm["cache-size"].as<unsigned int>());
+	}
+	if (vm.count("cache-dir")) {
+		DiskCache::instance()->setPath(vm["cache-dir"].as<string>());
+	}
+	if (vm.count("shared-cache-size")) {
+		DiskCache::shared()->setMaxSizeMB(vm["shared-cache-size"].as<unsigned int>());
+	}
+	if (vm.count("shared-cache-dir")) {
+		DiskCache::shared()->setPath(vm["shared-cache-dir"].as<string>());
+		DiskCache::instance()->setSharedTier(DiskCache::shared());
+	}
+#ifdef ENABLE_CGAL
+	if (vm.count("workers")) {
+		// Local workers run this executable, with the options affecting evaluation
+		auto quote = [](const std::string &arg) { return "'" + boost::replace_all_copy(arg, "'", "'\\''") + "'"; };
+		const fs::path self(argv[0]);
+		std::string localcommand = quote(self.has_parent_path() ? fs::absolute(self).string() : self.string()) + " --worker";
+		if (vm.count("csg-backend")) localcommand += std::string(" --csg-backend=") + CSGBackend::current()->name();
+		if (vm.count("voxel-size")) localcommand += " --voxel-size=" + lexical_cast<std::string>(vm["voxel-size"].as<double>());
+		if (vm.count("snap-rounding")) localcommand += " --snap-rounding";
+		if (vm.count("cache-dir")) localcommand += " --cache-dir=" + quote(DiskCache::instance()->path().string());
+		if (vm.count("shared-cache-dir")) localcommand += " --shared-cache-dir=" + quote(DiskCache::shared()->path().string());
+		if (vm.count("enable")) {
+			for (const auto &feature : vm["enable"].as<vector<string>>()) localcommand += " --enable=" + quote(feature);
+		}
+		if (!RenderFarm::instance()->setWorkers(vm["workers"].as<string>(), localcommand)) {
+			PRINTB("ERROR: Invalid --workers '%s'", vm["workers"].as<string>());
+			return 1;
+		}
+	}
+#endif
+	if (vm.count("memory-cache-size")) {
+		const auto arg = vm["memory-cache-size"].as<string>();
+		size_t limit = 0;
+		if (arg == "auto") {
+			limit = PlatformUtils::physicalMemory() / 8 / (1024 * 1024);
+		}
+		else {
+			try {
+				limit = boost::lexical_cast<size_t>(arg);
+			} catch (const boost::bad_lexical_cast &) {
+				help(argv[0], desc, true);
+			}
+		}
+		if (limit > 0) {
+			GeometryCache::instance()->setMaxSizeMB(limit);
+#ifdef ENABLE_CGAL
+			CGALCache::instance()->setMaxSizeMB(limit);
+#endif
+		}
+	}
+	if (vm.count("max-wall-time")) JobLimits::defaults.wallTime = vm["max-wall-time"].as<double>();
+	if (vm.count("max-cpu-time")) JobLimits::defaults.cpuTime = vm["max-cpu-time"].as<double>();
+	if (vm.count("max-memory")) JobLimits::defaults.memory = uint64_t(vm["max-memory"].as<unsigned int>()) * 1024 * 1024;
+	if (vm.count("max-nodes")) JobLimits::defaults.nodes = vm["max-nodes"].as<unsigned int>();
+	if (vm.count("max-csg-size")) JobLimits::defaults.csgSize = vm["max-csg-size"].as<unsigned int>();
+	if (vm.count("max-recursion-depth")) JobLimits::defaults.recursionDepth = vm["max-recursion-depth"].as<unsigned int>();
+	if (vm.count("profile")) {
+		RenderProfile::setEnabled(true);
+	}
+	if (vm.count("profile-interpreter")) {
+		InterpreterProfile::setEnabled(true);
+	}
+	arg_timing = vm.count("timing") > 0;
+	const bool arg_summary = vm.count("summary-json") > 0;
+	Metrics::setEnabled(arg_timing || arg_summary || vm.count("serve") > 0);
+	arg_skip_unchanged = vm.count("skip-unchanged") > 0;
 
 	if (vm.count("o")) {
 		// FIXME: Allow for multiple output files?
@@ -966,6 +2183,10 @@ int main(int argc, char **argv)
 		if (deps_output_file) help(argv[0], desc, true);
 		deps_output_file = vm["d"].as<string>().c_str();
 	}
+	if (vm.count("deps-only")) {
+		if (!deps_output_file) help(argv[0], desc, true);
+		arg_deps_only = true;
+	}
 	if (vm.count("m")) {
 		if (make_command) help(argv[0], desc, true);
 		make_command = vm["m"].as<string>().c_str();
@@ -1007,6 +2228,30 @@ int main(int argc, char **argv)
 	if (vm.count("colorscheme")) {
 		arg_colorscheme = vm["colorscheme"].as<string>();
 	}
+	if (vm.count("animate")) {
+		arg_animate = vm["animate"].as<unsigned int>();
+	}
+	if (vm.count("export-parts")) {
+		arg_export_parts = true;
+	}
+	if (vm.count("export-stream")) {
+		arg_export_stream = true;
+	}
+	if (vm.count("export-shells")) {
+		arg_export_shells = true;
+	}
+	if (vm.count("export-precision")) {
+		setExportPrecision(std::min(vm["export-precision"].as<unsigned int>(), 17u));
+	}
+	if (vm.count("svg-path-per-outline")) {
+		setSvgPathPerOutline(true);
+	}
+	if (vm.count("slice-heights")) {
+		if (!parseSliceHeights(vm["slice-heights"].as<string>(), arg_slice_heights)) return 1;
+	}
+	if (vm.count("slice-layers")) {
+		arg_slice_layers = true;
+	}
 
 	ExportFileFormatOptions exportFileFormatOptions;
     if(vm.count("export-format")) {
@@ -1021,27 +2266,88 @@ int main(int argc, char **argv)
 
 	currentdir = fs::current_path().generic_string();
 
-	Camera camera = get_camera(vm);
+	const auto cameras = get_cameras(vm);
 
 	auto cmdlinemode = false;
 	if (output_file) { // cmd-line mode
 		cmdlinemode = true;
 		if (!inputFiles.size()) help(argv[0], desc, true);
 	}
-
-	if (arg_info || cmdlinemode) {
+	const auto batchmode = vm.count("batch") > 0;
+	const auto servermode = vm.count("serve") > 0;
+	const auto workermode = vm.count("worker") > 0;
+	if ((batchmode || servermode || workermode) && (cmdlinemode || inputFiles.size() || deps_output_file)) help(argv[0], desc, true);
+	if (int(batchmode) + int(servermode) + int(workermode) > 1) help(argv[0], desc, true);
+	// A server request returns a single image
+	if (servermode && (arg_animate || cameras.size() > 1)) help(argv[0], desc, true);
+	const auto sweepmode = vm.count("sweep") > 0 || vm.count("sweep-range") > 0;
+	if (sweepmode && (!cmdlinemode || deps_output_file || batchmode || servermode)) help(argv[0], desc, true);
+	if (vm.count("sweep") && (parameterFile.empty() || !parameterSet.empty())) help(argv[0], desc, true);
+
+	if (arg_info || cmdlinemode || batchmode || servermode || workermode) {
 		if (inputFiles.size() > 1) help(argv[0], desc, true);
 		try {
 			parser_init();
-			localization_init();
+			set_localization_handler(localization_init);
 			if (arg_info) {
 				rc = info();
 			}
+			else if (batchmode) {
+				rc = batch(vm["batch"].as<string>(), original_path, viewOptions, cameras, export_format);
+			}
+			else if (servermode) {
+				rc = serve(original_path, viewOptions, cameras[0]);
+			}
+#ifdef ENABLE_CGAL
+			else if (workermode) {
+				rc = worker();
+			}
+#endif
+			else if (sweepmode) {
+				const auto ranges = vm.count("sweep-range") ? vm["sweep-range"].as<vector<string>>() : vector<string>();
+				rc = sweep(inputFiles[0], output_file, parameterFile, parameterSet, vm.count("sweep") > 0, ranges,
+									 original_path, viewOptions, cameras, export_format);
+			}
 			else {
-				rc = cmdline(deps_output_file, inputFiles[0], output_file, original_path, parameterFile, parameterSet, viewOptions, camera, export_format);
+				// cmdline() changes the current directory
+				const auto timingfile = arg_timing ? fs::absolute(vm["timing"].as<string>()).string() : std::string();
+				const auto summaryfile = arg_summary ? fs::absolute(vm["summary-json"].as<string>()).string() : std::string();
+				const auto start = std::chrono::steady_clock::now();
+				// Any option may change the output
+				std::string options;
+				for (int i = 1; i < argc; ++i) options += std::string(argv[i]) + '\n';
+				const auto stampfile = fs::absolute(std::string(output_file) + ".hash").string();
+				const bool unchanged = arg_skip_unchanged && !arg_deps_only && fs::exists(output_file) &&
+					(!deps_output_file || fs::exists(deps_output_file)) && isUpToDate(stampfile, options);
+				if (unchanged) {
+					PRINTB("'%s' is up to date", output_file);
+					rc = 0;
+				}
+				else {
+					DependencyRecorder recorder;
+					rc = cmdline(deps_output_file, inputFiles[0], output_file, original_path, parameterFile, parameterSet, viewOptions, cameras, export_format);
+					if (rc == 0 && arg_skip_unchanged && !arg_deps_only) {
+						// The output itself is hashed too, in case it's written by another run in the meantime
+						std::vector<std::string> files{fs::absolute(output_file, original_path).string()};
+						for (const auto &file : recorder.files()) files.push_back(fs::absolute(file, original_path).string());
+						if (!parameterFile.empty()) files.push_back(fs::absolute(parameterFile, original_path).string());
+						if (!writeStamp(stampfile, options, files)) {
+							PRINTB("WARNING: Can't write '%s'", stampfile);
+						}
+					}
+				}
+				const double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+				if (arg_timing && !writeTiming(timingfile, total, rc)) {
+					PRINTB("ERROR: Can't write timing to '%s'", timingfile);
+				}
+				if (arg_summary && !writeSummary(summaryfile, total, rc)) {
+					PRINTB("ERROR: Can't write summary to '%s'", summaryfile);
+				}
 			}
 		} catch (const HardWarningException &) {
 			rc = 1;
+		} catch (const ResourceLimitException &) {
+			rc = 1;
 		}
 	}
 	else if (QtUseGUI()) {
@@ -1055,6 +2361,35 @@ int main(int argc, char **argv)
 		help(argv[0], desc, true);
 	}
 
+	if (vm.count("profile")) {
+		const auto profilefile = vm["profile"].as<string>();
+		if (!RenderProfile::instance()->write(profilefile)) {
+			PRINTB("ERROR: Can't write profile to '%s'", profilefile);
+		}
+	}
+	if (vm.count("profile-interpreter")) {
+		const auto profilefile = vm["profile-interpreter"].as<string>();
+		if (profilefile.empty()) {
+			std::ostringstream report;
+			InterpreterProfile::instance()->report(report);
+			PRINTB("%s", report.str());
+		}
+		else {
+			std::ofstream report(profilefile.c_str());
+			if (report.is_open()) InterpreterProfile::instance()->report(report);
+			else PRINTB("ERROR: Can't write interpreter profile to '%s'", profilefile);
+		}
+	}
+
+	if (vm.count("stats")) {
+		GeometryCache::instance()->print();
+#ifdef ENABLE_CGAL
+		CGALCache::instance()->print();
+#endif
+		DiskCache::instance()->print();
+		DiskCache::shared()->print();
+	}
+
 	Builtins::instance(true);
 
 	return rc;
@@ -0,0 +1,151 @@
+#include "osmesh.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+const char magic[6] = {'O', 'S', 'M', 'E', 'S', 'H'};
+
+bool host_is_little_endian()
+{
+	const uint16_t x = 1;
+	char c;
+	memcpy(&c, &x, 1);
+	return c == 1;
+}
+
+const bool little_endian = host_is_little_endian();
+
+template <typename T> T byteswap(T v)
+{
+	char bytes[sizeof(T)];
+	memcpy(bytes, &v, sizeof(T));
+	for (size_t i = 0; i < sizeof(T) / 2; ++i) std::swap(bytes[i], bytes[sizeof(T) - 1 - i]);
+	memcpy(&v, bytes, sizeof(T));
+	return v;
+}
+
+template <typename T> void write_le(std::ostream &out, T v)
+{
+	if (!little_endian) v = byteswap(v);
+	out.write(reinterpret_cast<const char *>(&v), sizeof(T));
+}
+
+// Writes count values of type T starting at values
+template <typename T> void write_array_le(std::ostream &out, const T *values, size_t count)
+{
+	if (little_endian) {
+		out.write(reinterpret_cast<const char *>(values), count * sizeof(T));
+	}
+	else {
+		for (size_t i = 0; i < count; ++i) write_le(out, values[i]);
+	}
+}
+
+template <typename T> bool read_le(const char *&data, const char *end, T &v)
+{
+	if (size_t(end - data) < sizeof(T)) return false;
+	memcpy(&v, data, sizeof(T));
+	if (!little_endian) v = byteswap(v);
+	data += sizeof(T);
+	return true;
+}
+
+template <typename T> bool read_array_le(const char *&data, const char *end, T *values, uint64_t count)
+{
+	if (uint64_t(end - data) / sizeof(T) < count) return false;
+	memcpy(values, data, count * sizeof(T));
+	if (!little_endian) {
+		for (uint64_t i = 0; i < count; ++i) values[i] = byteswap(values[i]);
+	}
+	data += count * sizeof(T);
+	return true;
+}
+
+}
+
+namespace OSMesh {
+
+void writeMesh(std::ostream &out, const IndexedMesh &mesh)
+{
+	write_le<uint64_t>(out, mesh.vertices.size());
+	write_le<uint64_t>(out, mesh.numFaces());
+	static_assert(sizeof(Vector3d) == 3 * sizeof(double), "Vector3d must be packed");
+	write_array_le(out, mesh.vertices.empty() ? nullptr : mesh.vertices[0].data(), 3 * mesh.vertices.size());
+	std::vector<uint32_t> facesizes(mesh.numFaces());
+	for (size_t i = 0; i < mesh.numFaces(); ++i) facesizes[i] = uint32_t(mesh.faceSize(i));
+	write_array_le(out, facesizes.data(), facesizes.size());
+	static_assert(sizeof(int) == sizeof(uint32_t), "indices are written as they are");
+	write_array_le(out, reinterpret_cast<const uint32_t *>(mesh.indices.data()), mesh.indices.size());
+}
+
+bool readMesh(const char *&data, const char *end, IndexedMesh &mesh)
+{
+	uint64_t numvertices, numfaces;
+	if (!read_le(data, end, numvertices) || !read_le(data, end, numfaces)) return false;
+	// Checked against the remaining size before allocating anything
+	if (numvertices > uint64_t(end - data) / (3 * sizeof(double)) ||
+			numfaces > uint64_t(end - data) / sizeof(uint32_t)) {
+		return false;
+	}
+
+	mesh = IndexedMesh();
+	mesh.vertices.resize(numvertices);
+	if (!read_array_le(data, end, mesh.vertices.empty() ? nullptr : mesh.vertices[0].data(), 3 * numvertices)) return false;
+
+	std::vector<uint32_t> facesizes(numfaces);
+	if (!read_array_le(data, end, facesizes.data(), numfaces)) return false;
+	mesh.faceoffsets.reserve(numfaces + 1);
+	uint64_t numindices = 0;
+	for (const auto size : facesizes) {
+		numindices += size;
+		mesh.faceoffsets.push_back(numindices);
+	}
+	if (numindices > uint64_t(end - data) / sizeof(uint32_t)) return false;
+
+	mesh.indices.resize(numindices);
+	if (!read_array_le(data, end, reinterpret_cast<uint32_t *>(mesh.indices.data()), numindices)) return false;
+	for (const auto idx : mesh.indices) {
+		if (uint32_t(idx) >= numvertices) return false;
+	}
+	return true;
+}
+
+void writeHeader(std::ostream &out, uint32_t numobjects)
+{
+	out.write(magic, sizeof(magic));
+	write_le(out, version);
+	write_le(out, numobjects);
+}
+
+void writeObject(std::ostream &out, const IndexedMesh &mesh, const Color4f *color)
+{
+	write_le<uint8_t>(out, color ? 1 : 0);
+	if (color) write_array_le(out, color->data(), 4);
+	writeMesh(out, mesh);
+}
+
+bool read(const char *data, size_t size, std::vector<Object> &objects)
+{
+	const char *end = data + size;
+	uint16_t fileversion;
+	uint32_t numobjects;
+	if (size < sizeof(magic) || memcmp(data, magic, sizeof(magic)) != 0) return false;
+	data += sizeof(magic);
+	if (!read_le(data, end, fileversion) || fileversion != version || !read_le(data, end, numobjects)) return false;
+
+	objects.clear();
+	for (uint32_t i = 0; i < numobjects; ++i) {
+		Object object;
+		uint8_t flags;
+		if (!read_le(data, end, flags)) return false;
+		object.hasColor = flags & 1;
+		if (object.hasColor && !read_array_le(data, end, object.color.data(), 4)) return false;
+		if (!readMesh(data, end, object.mesh)) return false;
+		objects.push_back(std::move(object));
+	}
+	return true;
+}
+
+}
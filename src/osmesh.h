@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "GeometryUtils.h"
+#include "linalg.h"
+
+/*!
+	OpenSCAD's native binary mesh format (.osmesh), for passing meshes
+	between tools without formatting and parsing text. It's also the
+	encoding of meshes in the DiskCache.
+
+	All values are little-endian:
+
+	  file:   "OSMESH", uint16 version, uint32 number of objects, objects
+	  object: uint8 flags (bit 0: has color), float r, g, b, a if it has
+	          a color, mesh
+	  mesh:   uint64 number of vertices, uint64 number of faces,
+	          x, y, z as double for each vertex, uint32 size of each face,
+	          uint32 vertex indices of all faces
+
+	Faces are polygons of any size, as in IndexedMesh.
+*/
+namespace OSMesh {
+	const uint16_t version = 1;
+
+	struct Object {
+		IndexedMesh mesh;
+		bool hasColor = false;
+		Color4f color;
+	};
+
+	void writeMesh(std::ostream &out, const IndexedMesh &mesh);
+	// Reads a mesh at data, advancing data past it. Returns false if the
+	// data is truncated or invalid.
+	bool readMesh(const char *&data, const char *end, IndexedMesh &mesh);
+
+	void writeHeader(std::ostream &out, uint32_t numobjects);
+	void writeObject(std::ostream &out, const IndexedMesh &mesh, const Color4f *color = nullptr);
+	bool read(const char *data, size_t size, std::vector<Object> &objects);
+}
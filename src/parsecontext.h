@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <stack>
+#include <string>
+#include <vector>
+#include "AST.h"
+
+class FileModule;
+class LocalScope;
+
+/*!
+	The state of one run of the parser, shared by the pure bison parser and
+	the reentrant flex lexer (as its extra data). Nothing else is kept
+	between tokens, so several files can be parsed on different threads at
+	the same time.
+*/
+struct ParseContext
+{
+	void *scanner = nullptr; // the lexer's yyscan_t
+
+	// Parser
+	FileModule *rootmodule = nullptr;
+	std::stack<LocalScope *> scope_stack;
+	fs::path mainFilePath;
+	std::string main_file_folder;
+	bool fileEnded = false;
+
+	// Lexer
+	const char *input_buffer = nullptr;
+	int error_pos = -1;
+	int column = 1;
+	std::string stringcontents;
+	// Parts of the include<> or use<> statement being lexed
+	std::string filename;
+	std::string filepath;
+	uint32_t parser_sourcefile = 0; // Interned, see Location::internFile()
+	std::vector<uint32_t> filename_stack;
+	std::vector<FILE *> openfiles;
+	std::vector<std::string> openfilenames;
+
+	// Id of the source file currently being lexed
+	uint32_t sourcefileId() const {
+		return this->filename_stack.empty() ? this->parser_sourcefile : this->filename_stack.back();
+	}
+	const fs::path &sourcefile() const { return Location::internedFile(sourcefileId()); }
+};
@@ -26,6 +26,14 @@
 
 %expect 2 /* Expect 2 shift/reduce conflict for ifelse_statement - "dangling else problem" */
 
+%define api.pure full
+%locations
+%param {ParseContext &context}
+
+%code requires {
+#include "parsecontext.h"
+}
+
 %{
 
 #include <sys/types.h>
@@ -44,6 +52,7 @@
 #include "value.h"
 #include "function.h"
 #include "printutils.h"
+#include "parsersettings.h"
 #include "memory.h"
 #include <sstream>
 #include <boost/filesystem.hpp>
@@ -52,30 +61,22 @@
 namespace fs = boost::filesystem;
 
 #define YYMAXDEPTH 20000
-#define LOC(loc) Location(loc.first_line, loc.first_column, loc.last_line, loc.last_column, sourcefile())
+#define LOC(loc) Location(loc.first_line, loc.first_column, loc.last_line, loc.last_column, context.sourcefileId())
   
-int parser_error_pos = -1;
-
-int parserlex(void);
-void yyerror(char const *s);
+std::atomic<int> parser_error_pos(-1);
 
-int lexerget_lineno(void);
-std::shared_ptr<fs::path> sourcefile(void);
-void lexer_set_parser_sourcefile(const fs::path& path);
-int lexerlex_destroy(void);
-int lexerlex(void);
-
-std::stack<LocalScope *> scope_stack;
-FileModule *rootmodule;
+%}
 
-extern void lexerdestroy();
-extern FILE *lexerin;
-const char *parser_input_buffer;
-static fs::path mainFilePath;
-static std::string main_file_folder;
+%code {
+int parserlex(YYSTYPE *lval, YYLTYPE *lloc, ParseContext &context);
+void parsererror(YYLTYPE *lloc, ParseContext &context, char const *s);
 
-bool fileEnded=false;
-%}
+int lexerget_lineno(void *scanner);
+int lexerlex_init_extra(ParseContext *context, void **scanner);
+int lexerlex_destroy(void *scanner);
+int lexerlex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+void lexerclose(ParseContext &context);
+}
 
 %union {
   char *text;
@@ -162,7 +163,7 @@ input:    /* empty */
         | input
           TOK_USE
             {
-              rootmodule->registerUse(std::string($2));
+              context.rootmodule->registerUse(std::string($2));
               free($2);
             }
         | input statement
@@ -173,33 +174,33 @@ statement:
         | '{' inner_input '}'
         | module_instantiation
             {
-              if ($1) scope_stack.top()->addChild($1);
+              if ($1) context.scope_stack.top()->addChild($1);
             }
         | assignment
         | TOK_MODULE TOK_ID '(' arguments_decl optional_commas ')'
             {
               UserModule *newmodule = new UserModule($2, LOC(@$));
               newmodule->definition_arguments = *$4;
-              scope_stack.top()->addModule($2, newmodule);
-              scope_stack.push(&newmodule->scope);
+              context.scope_stack.top()->addModule($2, newmodule);
+              context.scope_stack.push(&newmodule->scope);
               free($2);
               delete $4;
             }
           statement
             {
-                scope_stack.pop();
+                context.scope_stack.pop();
             }
         | TOK_FUNCTION TOK_ID '(' arguments_decl optional_commas ')' '=' expr
             {
               UserFunction *func = UserFunction::create($2, *$4, shared_ptr<Expression>($8), LOC(@$));
-              scope_stack.top()->addFunction(func);
+              context.scope_stack.top()->addFunction(func);
               free($2);
               delete $4;
             }
           ';'
         | TOK_EOT
             {
-                fileEnded=true;
+                context.fileEnded = true;
             }
         ;
 
@@ -212,15 +213,15 @@ assignment:
           TOK_ID '=' expr ';'
             {
                 bool found = false;
-                for (auto &assignment : scope_stack.top()->assignments) {
+                for (auto &assignment : context.scope_stack.top()->assignments) {
                     if (assignment.name == $1) {
-                        auto mainFile = mainFilePath.string();
+                        auto mainFile = context.mainFilePath.string();
                         auto prevFile = assignment.location().fileName();
                         auto currFile = LOC(@$).fileName();
                         
-                        const auto uncPathCurr = boostfs_uncomplete(currFile, mainFilePath.parent_path());
-                        const auto uncPathPrev = boostfs_uncomplete(prevFile, mainFilePath.parent_path());
-                        if(fileEnded){
+                        const auto uncPathCurr = boostfs_uncomplete(currFile, context.mainFilePath.parent_path());
+                        const auto uncPathPrev = boostfs_uncomplete(prevFile, context.mainFilePath.parent_path());
+                        if(context.fileEnded){
                             //assignments via commandline
                         }else if(prevFile==mainFile && currFile == mainFile){
                             //both assignments in the mainFile
@@ -254,7 +255,7 @@ assignment:
                     }
                 }
                 if (!found) {
-                  scope_stack.top()->addAssignment(Assignment($1, shared_ptr<Expression>($3), LOC(@$)));
+                  context.scope_stack.top()->addAssignment(Assignment($1, shared_ptr<Expression>($3), LOC(@$)));
                 }
                 free($1);
             }
@@ -284,11 +285,11 @@ module_instantiation:
         | single_module_instantiation
             {
                 $<inst>$ = $1;
-                scope_stack.push(&$1->scope);
+                context.scope_stack.push(&$1->scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                context.scope_stack.pop();
                 $$ = $<inst>2;
             }
         | ifelse_statement
@@ -304,11 +305,11 @@ ifelse_statement:
             }
         | if_statement TOK_ELSE
             {
-                scope_stack.push(&$1->else_scope);
+                context.scope_stack.push(&$1->else_scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                context.scope_stack.pop();
                 $$ = $1;
             }
         ;
@@ -316,12 +317,12 @@ ifelse_statement:
 if_statement:
           TOK_IF '(' expr ')'
             {
-                $<ifelse>$ = new IfElseModuleInstantiation(shared_ptr<Expression>($3), main_file_folder, LOC(@$));
-                scope_stack.push(&$<ifelse>$->scope);
+                $<ifelse>$ = new IfElseModuleInstantiation(shared_ptr<Expression>($3), context.main_file_folder, LOC(@$));
+                context.scope_stack.push(&$<ifelse>$->scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                context.scope_stack.pop();
                 $$ = $<ifelse>5;
             }
         ;
@@ -337,7 +338,7 @@ child_statement:
         | '{' child_statements '}'
         | module_instantiation
             {
-                if ($1) scope_stack.top()->addChild($1);
+                if ($1) context.scope_stack.top()->addChild($1);
             }
         ;
 
@@ -354,7 +355,7 @@ module_id:
 single_module_instantiation:
           module_id '(' arguments_call ')'
             {
-                $$ = new ModuleInstantiation($1, *$3, main_file_folder, LOC(@$));
+                $$ = new ModuleInstantiation($1, *$3, context.main_file_folder, LOC(@$));
                 free($1);
                 delete $3;
             }
@@ -406,6 +407,7 @@ expr:
             }
         | '[' vector_expr optional_commas ']'
             {
+              $2->finish();
               $$ = $2;
             }
         | expr '*' expr
@@ -661,51 +663,45 @@ argument_call:
 
 %%
 
-int parserlex(void)
+int parserlex(YYSTYPE *lval, YYLTYPE *lloc, ParseContext &context)
 {
-  return lexerlex();
+  return lexerlex(lval, lloc, context.scanner);
 }
 
-void yyerror (char const *s)
+void parsererror(YYLTYPE *, ParseContext &context, char const *s)
 {
   // FIXME: We leak memory on parser errors...
   PRINTB("ERROR: Parser error in file %s, line %d: %s\n",
-         (*sourcefile()) % lexerget_lineno() % s);
+         context.sourcefile() % lexerget_lineno(context.scanner) % s);
 }
 
 bool parse(FileModule *&module, const std::string& text, const std::string &filename, const std::string &mainFile, int debug)
 {
+  ParseContext context;
   fs::path parser_sourcefile = fs::path(fs::absolute(fs::path(filename)).generic_string());
-  main_file_folder = parser_sourcefile.parent_path().string();
-  lexer_set_parser_sourcefile(parser_sourcefile);
-  mainFilePath = fs::absolute(fs::path(mainFile));
-
-  lexerin = NULL;
-  parser_error_pos = -1;
-  parser_input_buffer = text.c_str();
-  fileEnded=false;
-
-  rootmodule = new FileModule(main_file_folder, parser_sourcefile.filename().string());
-  scope_stack.push(&rootmodule->scope);
-  //        PRINTB_NOCACHE("New module: %s %p", "root" % rootmodule);
-
-  parserdebug = debug;
+  context.main_file_folder = parser_sourcefile.parent_path().string();
+  context.parser_sourcefile = Location::internFile(parser_sourcefile);
+  context.mainFilePath = fs::absolute(fs::path(mainFile));
+  context.input_buffer = text.c_str();
+
+  context.rootmodule = new FileModule(context.main_file_folder, parser_sourcefile.filename().string());
+  context.scope_stack.push(&context.rootmodule->scope);
+  //        PRINTB_NOCACHE("New module: %s %p", "root" % context.rootmodule);
+
+  lexerlex_init_extra(&context, &context.scanner);
+  // Global in the generated parser, so only written when it changes
+  if (parserdebug != debug) parserdebug = debug;
   int parserretval = -1;
   try{
-     parserretval = parserparse();
+     parserretval = parserparse(context);
   }catch (const HardWarningException &e) {
-    yyerror("stop on first warning");
+    parsererror(nullptr, context, "stop on first warning");
   }
 
-  lexerdestroy();
-  lexerlex_destroy();
-
-  module = rootmodule;
-  if (parserretval != 0) return false;
-
-  parser_error_pos = -1;
-  parser_input_buffer = nullptr;
-  scope_stack.pop();
+  lexerclose(context);
+  lexerlex_destroy(context.scanner);
 
-  return true;
+  module = context.rootmodule;
+  parser_error_pos = parserretval != 0 ? context.error_pos : -1;
+  return parserretval == 0;
 }
@@ -3,6 +3,7 @@
 #include "boosty.h"
 #include <boost/algorithm/string.hpp>
 #include "PlatformUtils.h"
+#include "DiskCache.h"
 
 namespace fs = boost::filesystem;
 
@@ -111,4 +112,6 @@ void parser_init()
 	add_librarydir(PlatformUtils::userLibraryPath());
 
 	add_librarydir(fs::absolute(PlatformUtils::resourcePath("libraries")).string());
+
+	DiskCache::instance()->findPackages(librarypath);
 }
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <boost/filesystem.hpp>
 
 namespace fs = boost::filesystem;
 
-extern int parser_error_pos;
+// Position of the error in the text of the last failed parse, or -1
+extern std::atomic<int> parser_error_pos;
 
 /**
  * Initialize library path.
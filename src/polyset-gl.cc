@@ -7,38 +7,42 @@
 // all GL functions grouped together here
 
 
+#ifndef NULLGL
+/*!
+	The barycentric coordinates of vertex i of a triangle for the edge
+	shader, which draws the lines where one of them is close to 0. Edge k
+	joins vertices k and k+1; for those which aren't outline edges the
+	coordinate of the opposite vertex is 1 at all three vertices instead.
+*/
+static Vector3d barycentric(int i, bool e0, bool e1, bool e2)
+{
+	Vector3d b = Vector3d::Unit(i);
+	if (!e0) b[2] = 1;
+	if (!e1) b[0] = 1;
+	if (!e2) b[1] = 1;
+	return b;
+}
+
 #ifdef ENABLE_OPENCSG
 static void draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
-													double e0f, double e1f, double e2f, double z, bool mirror)
-{  
-	glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-	glVertexAttrib3d(shaderinfo[4], p1[0], p1[1], p1[2] + z);
-	glVertexAttrib3d(shaderinfo[5], p2[0], p2[1], p2[2] + z);
-	glVertexAttrib3d(shaderinfo[6], 0.0, 1.0, 0.0);
-	glVertex3d(p0[0], p0[1], p0[2] + z); 
+													bool e0, bool e1, bool e2, double z, bool mirror)
+{
+	const Vector3d b0 = barycentric(0, e0, e1, e2), b1 = barycentric(1, e0, e1, e2), b2 = barycentric(2, e0, e1, e2);
+	glVertexAttrib3d(shaderinfo[3], b0[0], b0[1], b0[2]);
+	glVertex3d(p0[0], p0[1], p0[2] + z);
 	if (!mirror) {
-		glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-		glVertexAttrib3d(shaderinfo[4], p0[0], p0[1], p0[2] + z);
-		glVertexAttrib3d(shaderinfo[5], p2[0], p2[1], p2[2] + z);
-		glVertexAttrib3d(shaderinfo[6], 0.0, 0.0, 1.0);
-		glVertex3d(p1[0], p1[1], p1[2] + z); 
+		glVertexAttrib3d(shaderinfo[3], b1[0], b1[1], b1[2]);
+		glVertex3d(p1[0], p1[1], p1[2] + z);
 	}
-	glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-	glVertexAttrib3d(shaderinfo[4], p0[0], p0[1], p0[2] + z);
-	glVertexAttrib3d(shaderinfo[5], p1[0], p1[1], p1[2] + z);
-	glVertexAttrib3d(shaderinfo[6], 1.0, 0.0, 0.0);
+	glVertexAttrib3d(shaderinfo[3], b2[0], b2[1], b2[2]);
 	glVertex3d(p2[0], p2[1], p2[2] + z);
 	if (mirror) {
-		glVertexAttrib3d(shaderinfo[3], e0f, e1f, e2f);
-		glVertexAttrib3d(shaderinfo[4], p0[0], p0[1], p0[2] + z);
-		glVertexAttrib3d(shaderinfo[5], p2[0], p2[1], p2[2] + z);
-		glVertexAttrib3d(shaderinfo[6], 0.0, 0.0, 1.0);
+		glVertexAttrib3d(shaderinfo[3], b1[0], b1[1], b1[2]);
 		glVertex3d(p1[0], p1[1], p1[2] + z);
 	}
 }
 #endif
 
-#ifndef NULLGL
 static void draw_tri(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, double z, bool mirror)
 {
 	glVertex3d(p0[0], p0[1], p0[2] + z);
@@ -59,10 +63,7 @@ static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector
 	glNormal3d(nx / nl, ny / nl, nz / nl);
 #ifdef ENABLE_OPENCSG
 	if (shaderinfo) {
-		double e0f = e0 ? 2.0 : -1.0;
-		double e1f = e1 ? 2.0 : -1.0;
-		double e2f = e2 ? 2.0 : -1.0;
-		draw_triangle(shaderinfo, p0, p1, p2, e0f, e1f, e2f, z, mirrored);
+		draw_triangle(shaderinfo, p0, p1, p2, e0, e1, e2, z, mirrored);
 	}
 	else
 #endif
@@ -71,39 +72,36 @@ static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector
 	}
 }
 
-void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const
+/*!
+	Calls triangle(p0, p1, p2, e0, e1, e2, z) for each triangle drawn by
+	render_surface(), where e0..e2 tell which of the edges are outline edges,
+	and z is the offset to add to the z coordinates.
+*/
+template <typename TriangleFunc>
+void PolySet::surface_triangles(Renderer::csgmode_e csgmode, TriangleFunc triangle) const
 {
-	PRINTD("Polyset render");
-	bool mirrored = m.matrix().determinant() < 0;
-#ifdef ENABLE_OPENCSG
-	if (shaderinfo) {
-		glUniform1f(shaderinfo[7], shaderinfo[9]);
-		glUniform1f(shaderinfo[8], shaderinfo[10]);
-	}
-#endif /* ENABLE_OPENCSG */
 	if (this->dim == 2) {
 		// Render 2D objects 1mm thick, but differences slightly larger
 		double zbase = 1 + ((csgmode & CSGMODE_DIFFERENCE_FLAG) ? 0.1 : 0);
-		glBegin(GL_TRIANGLES);
 
 		// Render top+bottom
 		for (double z = -zbase/2; z < zbase; z += zbase) {
-			for (size_t i = 0; i < polygons.size(); i++) {
-				const Polygon *poly = &polygons[i];
+			for (size_t i = 0; i < polygons().size(); i++) {
+				const Polygon *poly = &polygons()[i];
 				if (poly->size() == 3) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(2), poly->at(1), true, true, true, z, mirrored);
+						triangle(poly->at(0), poly->at(2), poly->at(1), true, true, true, z);
 					} else {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(2), true, true, true, z, mirrored);
+						triangle(poly->at(0), poly->at(1), poly->at(2), true, true, true, z);
 					}
 				}
 				else if (poly->size() == 4) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(3), poly->at(1), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, poly->at(2), poly->at(1), poly->at(3), true, false, true, z, mirrored);
+						triangle(poly->at(0), poly->at(3), poly->at(1), true, false, true, z);
+						triangle(poly->at(2), poly->at(1), poly->at(3), true, false, true, z);
 					} else {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(3), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, poly->at(2), poly->at(3), poly->at(1), true, false, true, z, mirrored);
+						triangle(poly->at(0), poly->at(1), poly->at(3), true, false, true, z);
+						triangle(poly->at(2), poly->at(3), poly->at(1), true, false, true, z);
 					}
 				}
 				else {
@@ -116,11 +114,9 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					center[1] /= poly->size();
 					for (size_t j = 1; j <= poly->size(); j++) {
 						if (z < 0) {
-							gl_draw_triangle(shaderinfo, center, poly->at(j % poly->size()), poly->at(j - 1),
-									false, true, false, z, mirrored);
+							triangle(center, poly->at(j % poly->size()), poly->at(j - 1), false, true, false, z);
 						} else {
-							gl_draw_triangle(shaderinfo, center, poly->at(j - 1), poly->at(j % poly->size()),
-									false, true, false, z, mirrored);
+							triangle(center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, z);
 						}
 					}
 				}
@@ -135,15 +131,15 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					Vector3d p2(o.vertices[j-1][0], o.vertices[j-1][1], zbase/2);
 					Vector3d p3(o.vertices[j % o.vertices.size()][0], o.vertices[j % o.vertices.size()][1], -zbase/2);
 					Vector3d p4(o.vertices[j % o.vertices.size()][0], o.vertices[j % o.vertices.size()][1], zbase/2);
-					gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
-					gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
+					triangle(p2, p1, p3, true, true, false, 0);
+					triangle(p2, p3, p4, false, true, true, 0);
 				}
 			}
 		}
 		else {
 			// If we don't have borders, use the polygons as borders.
 			// FIXME: When is this used?
-			const Polygons *borders_p = &polygons;
+			const Polygons *borders_p = &polygons();
 			for (size_t i = 0; i < borders_p->size(); i++) {
 				const Polygon *poly = &borders_p->at(i);
 				for (size_t j = 1; j <= poly->size(); j++) {
@@ -151,22 +147,20 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					Vector3d p3 = poly->at(j % poly->size()), p4 = poly->at(j % poly->size());
 					p1[2] -= zbase/2, p2[2] += zbase/2;
 					p3[2] -= zbase/2, p4[2] += zbase/2;
-					gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
-					gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
+					triangle(p2, p1, p3, true, true, false, 0);
+					triangle(p2, p3, p4, false, true, true, 0);
 				}
 			}
 		}
-		glEnd();
 	} else if (this->dim == 3) {
-		for (size_t i = 0; i < polygons.size(); i++) {
-			const Polygon *poly = &polygons[i];
-			glBegin(GL_TRIANGLES);
+		for (size_t i = 0; i < polygons().size(); i++) {
+			const Polygon *poly = &polygons()[i];
 			if (poly->size() == 3) {
-				gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(2), true, true, true, 0, mirrored);
+				triangle(poly->at(0), poly->at(1), poly->at(2), true, true, true, 0);
 			}
 			else if (poly->size() == 4) {
-				gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(3), true, false, true, 0, mirrored);
-				gl_draw_triangle(shaderinfo, poly->at(2), poly->at(3), poly->at(1), true, false, true, 0, mirrored);
+				triangle(poly->at(0), poly->at(1), poly->at(3), true, false, true, 0);
+				triangle(poly->at(2), poly->at(3), poly->at(1), true, false, true, 0);
 			}
 			else {
 				Vector3d center = Vector3d::Zero();
@@ -179,10 +173,9 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 				center[1] /= poly->size();
 				center[2] /= poly->size();
 				for (size_t j = 1; j <= poly->size(); j++) {
-					gl_draw_triangle(shaderinfo, center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, 0, mirrored);
+					triangle(center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, 0);
 				}
 			}
-			glEnd();
 		}
 	}
 	else {
@@ -190,6 +183,80 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 	}
 }
 
+void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const
+{
+	PRINTD("Polyset render");
+	bool mirrored = m.matrix().determinant() < 0;
+	glBegin(GL_TRIANGLES);
+	surface_triangles(csgmode, [shaderinfo, mirrored](const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, bool e0, bool e1, bool e2, double z) {
+		gl_draw_triangle(shaderinfo, p0, p1, p2, e0, e1, e2, z, mirrored);
+	});
+	glEnd();
+}
+
+/*!
+	Appends the triangles of render_surface() to data, for drawing as
+	GL_TRIANGLES from vertex buffers. Each vertex has its position, normal
+	and the barycentric coordinates the edge shader draws the outline
+	edges by, so showing edges needs no further vertex data.
+
+	Triangles are always in their unmirrored order; use glFrontFace() for
+	mirroring transformations instead.
+*/
+void PolySet::surface_vertices(Renderer::csgmode_e csgmode, std::vector<GLfloat> &data) const
+{
+	auto append = [&data](const Vector3d &p) {
+		data.push_back(GLfloat(p[0]));
+		data.push_back(GLfloat(p[1]));
+		data.push_back(GLfloat(p[2]));
+	};
+	surface_triangles(csgmode, [&append](const Vector3d &t0, const Vector3d &t1, const Vector3d &t2, bool e0, bool e1, bool e2, double z) {
+		const Vector3d offset(0, 0, z);
+		const Vector3d p0 = t0 + offset, p1 = t1 + offset, p2 = t2 + offset;
+		// Same normal as gl_draw_triangle()
+		const Vector3d normal = (p1 - p0).cross(p1 - p2).normalized();
+		append(p0); append(normal); append(barycentric(0, e0, e1, e2));
+		append(p1); append(normal); append(barycentric(1, e0, e1, e2));
+		append(p2); append(normal); append(barycentric(2, e0, e1, e2));
+	});
+}
+
+/*!
+	Appends the lines of render_edges() to data, as pairs of vertex
+	positions for drawing as GL_LINES.
+*/
+void PolySet::edge_vertices(Renderer::csgmode_e csgmode, std::vector<GLfloat> &data) const
+{
+	auto line = [&data](double x0, double y0, double z0, double x1, double y1, double z1) {
+		const GLfloat v[6] = {GLfloat(x0), GLfloat(y0), GLfloat(z0), GLfloat(x1), GLfloat(y1), GLfloat(z1)};
+		data.insert(data.end(), v, v + 6);
+	};
+	if (this->dim == 2) {
+		const bool flat = csgmode == Renderer::CSGMODE_NONE;
+		double zbase = 1 + ((csgmode & CSGMODE_DIFFERENCE_FLAG) ? 0.1 : 0);
+		for (const Outline2d &o : polygon.outlines()) {
+			const size_t n = o.vertices.size();
+			for (size_t j = 0; j < n; j++) {
+				const Vector2d &a = o.vertices[j], &b = o.vertices[(j + 1) % n];
+				if (flat) {
+					line(a[0], a[1], 0, b[0], b[1], 0);
+					continue;
+				}
+				line(a[0], a[1], -zbase/2, b[0], b[1], -zbase/2);
+				line(a[0], a[1], zbase/2, b[0], b[1], zbase/2);
+				line(a[0], a[1], -zbase/2, a[0], a[1], zbase/2);
+			}
+		}
+	} else if (dim == 3) {
+		for (const auto &poly : polygons()) {
+			for (size_t j = 0; j < poly.size(); j++) {
+				const Vector3d &a = poly[j], &b = poly[(j + 1) % poly.size()];
+				line(a[0], a[1], a[2], b[0], b[1], b[2]);
+			}
+		}
+	}
+}
+
 /*! This is used in throwntogether and CGAL mode
 
 	csgmode is set to CSGMODE_NONE in CGAL mode. In this mode a pure 2D rendering is performed.
@@ -233,8 +300,8 @@ void PolySet::render_edges(Renderer::csgmode_e csgmode) const
 			}
 		}
 	} else if (dim == 3) {
-		for (size_t i = 0; i < polygons.size(); i++) {
-			const Polygon *poly = &polygons[i];
+		for (size_t i = 0; i < polygons().size(); i++) {
+			const Polygon *poly = &polygons()[i];
 			glBegin(GL_LINE_LOOP);
 			for (size_t j = 0; j < poly->size(); j++) {
 				const Vector3d &p = poly->at(j);
@@ -253,6 +320,8 @@ void PolySet::render_edges(Renderer::csgmode_e csgmode) const
 #else //NULLGL
 static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, bool e0, bool e1, bool e2, double z, bool mirrored) {}
 void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const {}
+void PolySet::surface_vertices(Renderer::csgmode_e csgmode, std::vector<GLfloat> &data) const {}
+void PolySet::edge_vertices(Renderer::csgmode_e csgmode, std::vector<GLfloat> &data) const {}
 void PolySet::render_edges(Renderer::csgmode_e csgmode) const {}
 #endif //NULLGL
 
@@ -5,10 +5,22 @@
 #include "GeometryUtils.h"
 #include "Reindexer.h"
 #include "grid.h"
+#include "clipper-utils.h"
+#include "ThreadPool.h"
+#include "FlatHashMap.h"
+#include "hash.h"
+#include "degree_trig.h"
+#include "Trace.h"
 #ifdef ENABLE_CGAL
 #include "cgalutils.h"
 #endif
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+
 namespace PolysetUtils {
 
 	// Project all polygons (also back-facing) into a Polygon2d instance.
@@ -17,7 +29,7 @@ namespace PolysetUtils {
 	Polygon2d *project(const PolySet &ps) {
 		auto poly = new Polygon2d;
 
-		for (const auto &p : ps.polygons) {
+		for (const auto &p : ps.polygons()) {
 			Outline2d outline;
 			for (const auto &v : p) {
 				outline.vertices.emplace_back(v[0], v[1]);
@@ -27,6 +39,270 @@ namespace PolysetUtils {
 		return poly;
 	}
 
+	// Faces per batch of project_silhouette(). Clipper's unions slow down much
+	// more than linearly with their size.
+	static const size_t silhouette_batch_faces = 1024;
+
+	static ClipperLib::Paths union_nonzero(const ClipperLib::Paths &a, const ClipperLib::Paths &b = ClipperLib::Paths())
+	{
+		ClipperLib::Clipper clipper;
+		clipper.AddPaths(a, ClipperLib::ptSubject, true);
+		clipper.AddPaths(b, ClipperLib::ptSubject, true);
+		ClipperLib::Paths result;
+		clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+		return result;
+	}
+
+	/*!
+		The shadow of ps on the xy plane, as the union of its projected faces.
+		Returns a sanitized Polygon2d.
+
+		For a closed mesh, the faces pointing up already cover the shadow, so
+		those pointing clearly down are skipped. Near-vertical faces are kept
+		either way, as the sign of their normal isn't reliable (see project()).
+		The faces are unioned in batches, concurrently on the ThreadPool, and
+		the batches merged pairwise.
+	*/
+	Polygon2d *project_silhouette(const PolySet &ps)
+	{
+		ClipperLib::Paths faces;
+		faces.reserve(ps.polygons().size());
+		for (const auto &p : ps.polygons()) {
+			if (p.size() < 3) continue;
+			Vector3d normal(0, 0, 0);
+			for (size_t i = 0; i < p.size(); ++i) normal += p[i].cross(p[(i + 1) % p.size()]);
+			if (normal[2] < -1e-9 * normal.norm()) continue;
+			Outline2d outline;
+			outline.vertices.reserve(p.size());
+			for (const auto &v : p) outline.vertices.emplace_back(v[0], v[1]);
+			// Using NonZero ensures that we don't create holes from polygons sharing
+			// edges, with all faces made to point up
+			faces.push_back(ClipperUtils::fromOutline2d(outline, false));
+		}
+
+		const size_t numbatches = std::max(size_t(1), faces.size() / silhouette_batch_faces);
+		std::vector<ClipperLib::Paths> batches(numbatches);
+		TaskGroup group;
+		for (size_t b = 0; b < numbatches; ++b) {
+			group.run([&faces, &batches, b, numbatches]() {
+				const auto begin = faces.begin() + faces.size() * b / numbatches;
+				const auto end = faces.begin() + faces.size() * (b + 1) / numbatches;
+				batches[b] = union_nonzero(ClipperLib::Paths(begin, end));
+			});
+		}
+		group.wait();
+
+		while (batches.size() > 2) {
+			std::vector<ClipperLib::Paths> merged((batches.size() + 1) / 2);
+			for (size_t i = 0; i < merged.size(); ++i) {
+				group.run([&batches, &merged, i]() {
+					if (2 * i + 1 < batches.size()) merged[i] = union_nonzero(batches[2 * i], batches[2 * i + 1]);
+					else merged[i] = std::move(batches[2 * i]);
+				});
+			}
+			group.wait();
+			batches = std::move(merged);
+		}
+
+		ClipperLib::Clipper clipper;
+		for (const auto &paths : batches) clipper.AddPaths(paths, ClipperLib::ptSubject, true);
+		// This is key - without StrictlySimple, we tend to get self-intersecting results
+		clipper.StrictlySimple(true);
+		ClipperLib::PolyTree result;
+		clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+		return ClipperUtils::toPolygon2d(result);
+	}
+
+	namespace {
+		// A crossing of a cut plane is identified by the mesh edge it lies on, as the
+		// pair (vertex below, vertex above). Both faces sharing the edge hence agree on
+		// it, and on its point.
+		typedef uint64_t EdgeKey;
+
+		EdgeKey edge_key(int below, int above) {
+			return (EdgeKey(uint32_t(below)) << 32) | uint32_t(above);
+		}
+
+		struct Crossing {
+			EdgeKey key;
+			Vector2d p;
+			bool up;
+		};
+
+		struct SlicePlane {
+			SlicePlane(const std::vector<Vector3d> &vertices, double z, bool on_above)
+				: vertices(vertices), z(z), on_above(on_above) {}
+
+			const std::vector<Vector3d> &vertices;
+			double z;
+			// Whether vertices exactly at z count as above the plane
+			bool on_above;
+			// Each runs from the crossing going down to the one going up, which
+			// makes outer outlines counter-clockwise
+			std::vector<std::pair<EdgeKey, EdgeKey>> segments;
+
+			bool above(int v) const {
+				return on_above ? this->vertices[v][2] >= this->z : this->vertices[v][2] > this->z;
+			}
+
+			Vector2d point(EdgeKey key) const {
+				const auto &below = this->vertices[key >> 32];
+				const auto &above = this->vertices[key & 0xffffffff];
+				const double t = (this->z - below[2]) / (above[2] - below[2]);
+				return Vector2d(below[0] + t * (above[0] - below[0]), below[1] + t * (above[1] - below[1]));
+			}
+
+			void addFace(const int *face, size_t size, std::vector<Crossing> &crossings) {
+				crossings.clear();
+				for (size_t i = 0; i < size; ++i) {
+					const int a = face[i], b = face[(i + 1) % size];
+					const bool a_above = above(a);
+					if (a_above == above(b)) continue;
+					const auto key = a_above ? edge_key(b, a) : edge_key(a, b);
+					crossings.push_back({key, point(key), !a_above});
+				}
+				if (crossings.size() == 2) {
+					if (crossings[0].up) this->segments.emplace_back(crossings[1].key, crossings[0].key);
+					else this->segments.emplace_back(crossings[0].key, crossings[1].key);
+					return;
+				}
+				if (crossings.size() < 2) return;
+
+				// A non-convex face: the crossings alternate between entering and
+				// leaving the face along the cut line
+				Vector2d min = crossings[0].p, max = crossings[0].p;
+				for (const auto &c : crossings) {
+					min = min.cwiseMin(c.p);
+					max = max.cwiseMax(c.p);
+				}
+				const int axis = (max[0] - min[0] >= max[1] - min[1]) ? 0 : 1;
+				std::sort(crossings.begin(), crossings.end(), [axis](const Crossing &c1, const Crossing &c2) {
+					return c1.p[axis] < c2.p[axis];
+				});
+				for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+					const auto &c1 = crossings[i], &c2 = crossings[i + 1];
+					if (c1.up == c2.up) continue;
+					if (c1.up) this->segments.emplace_back(c2.key, c1.key);
+					else this->segments.emplace_back(c1.key, c2.key);
+				}
+			}
+
+			// Chains the segments into outlines
+			void addOutlines(Polygon2d &poly) {
+				auto &segments = this->segments;
+				std::sort(segments.begin(), segments.end());
+				std::vector<bool> used(segments.size());
+				for (size_t i = 0; i < segments.size(); ++i) {
+					if (used[i]) continue;
+					Outline2d outline;
+					const auto start = segments[i].first;
+					size_t j = i;
+					while (true) {
+						used[j] = true;
+						outline.vertices.push_back(point(segments[j].first));
+						const auto next = segments[j].second;
+						if (next == start) break;
+						auto it = std::lower_bound(segments.begin(), segments.end(), std::make_pair(next, EdgeKey(0)));
+						while (it != segments.end() && it->first == next && used[it - segments.begin()]) ++it;
+						// An open mesh leaves an open chain, which is closed as is
+						if (it == segments.end() || it->first != next) break;
+						j = it - segments.begin();
+					}
+					if (outline.vertices.size() >= 3) poly.addOutline(outline);
+				}
+			}
+		};
+	}
+
+	/*!
+		Cross-section of the closed mesh ps at the given z, as for
+		projection(cut = true), by intersecting its faces with the plane directly.
+	*/
+	Polygon2d *slice(const PolySet &ps, double z)
+	{
+		auto polys = slice(ps, std::vector<double>{z});
+		return polys.front();
+	}
+
+	/*!
+		Cross-sections of the closed mesh ps at each of the given heights, in one
+		pass over its faces. The result has one sanitized Polygon2d per height,
+		which may be empty.
+
+		Vertices lying exactly at a height would make the sections there
+		ambiguous. Such cuts are computed twice, with the vertices counted as
+		below and as above the plane, and the union of both is used.
+	*/
+	std::vector<Polygon2d *> slice(const PolySet &ps, const std::vector<double> &heights)
+	{
+		IndexedMesh mesh;
+		createIndexedMesh(ps, mesh);
+		const auto &verts = mesh.vertices;
+
+		std::vector<double> sorted(heights);
+		std::sort(sorted.begin(), sorted.end());
+		sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+		std::vector<bool> exact(sorted.size());
+		for (const auto &v : verts) {
+			auto it = std::lower_bound(sorted.begin(), sorted.end(), v[2]);
+			if (it != sorted.end() && *it == v[2]) exact[it - sorted.begin()] = true;
+		}
+
+		// Planes for vertices at the height counting as below, then as above
+		std::vector<SlicePlane> planes;
+		planes.reserve(2 * sorted.size());
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			planes.emplace_back(verts, sorted[i], false);
+			planes.emplace_back(verts, sorted[i], true);
+		}
+
+		std::vector<Crossing> crossings;
+		for (size_t f = 0; f < mesh.numFaces(); ++f) {
+			const int *face = mesh.face(f);
+			const size_t size = mesh.faceSize(f);
+			if (size < 3) continue;
+			double zmin = verts[face[0]][2], zmax = zmin;
+			for (size_t i = 1; i < size; ++i) {
+				zmin = std::min(zmin, verts[face[i]][2]);
+				zmax = std::max(zmax, verts[face[i]][2]);
+			}
+			auto it = std::lower_bound(sorted.begin(), sorted.end(), zmin);
+			for (; it != sorted.end() && *it <= zmax; ++it) {
+				const size_t i = it - sorted.begin();
+				planes[2 * i].addFace(face, size, crossings);
+				if (exact[i]) planes[2 * i + 1].addFace(face, size, crossings);
+			}
+		}
+
+		std::vector<Polygon2d *> sections(sorted.size());
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			Polygon2d outlines;
+			planes[2 * i].addOutlines(outlines);
+			if (exact[i]) planes[2 * i + 1].addOutlines(outlines);
+
+			ClipperLib::Paths paths;
+			for (const auto &o : outlines.outlines()) paths.push_back(ClipperUtils::fromOutline2d(o, true));
+			ClipperLib::Clipper clipper;
+			clipper.AddPaths(paths, ClipperLib::ptSubject, true);
+			// NonZero keeps holes, and fills the part of either cut of an exact height
+			clipper.StrictlySimple(true);
+			ClipperLib::PolyTree result;
+			clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+			sections[i] = ClipperUtils::toPolygon2d(result);
+		}
+
+		// Repeated heights get copies, so each result can be deleted on its own
+		std::vector<Polygon2d *> result;
+		result.reserve(heights.size());
+		std::vector<bool> returned(sorted.size());
+		for (const auto z : heights) {
+			const size_t i = std::lower_bound(sorted.begin(), sorted.end(), z) - sorted.begin();
+			result.push_back(returned[i] ? new Polygon2d(*sections[i]) : sections[i]);
+			returned[i] = true;
+		}
+		return result;
+	}
+
 /* Tessellation of 3d PolySet faces
 	 
 	 This code is for tessellating the faces of a 3d PolySet, assuming that
@@ -49,13 +325,17 @@ namespace PolysetUtils {
 */
 	void tessellate_faces(const PolySet &inps, PolySet &outps)
 	{
+		TRACE_ZONE("PolysetUtils::tessellate_faces");
 		int degeneratePolygons = 0;
 
 		// Build Indexed PolyMesh
 		Reindexer<Vector3f> allVertices;
 		std::vector<std::vector<IndexedFace>> polygons;
+		// The face of inps of each polygon, for the face colors
+		std::vector<size_t> faceof;
+		const auto &colors = inps.faceColors();
 
-		for (const auto &pgon : inps.polygons) {
+		for (const auto &pgon : inps.polygons()) {
 			if (pgon.size() < 3) {
 				degeneratePolygons++;
 				continue;
@@ -75,38 +355,425 @@ namespace PolysetUtils {
 				faces.pop_back(); // Cull empty triangles
 				if (faces.empty()) polygons.pop_back(); // All faces were culled
 			}
+			if (colors && faceof.size() < polygons.size()) faceof.push_back(&pgon - inps.polygons().data());
 		}
 
 		// Tessellate indexed mesh
 		const auto& verts = allVertices.getArray();
 		std::vector<IndexedTriangle> allTriangles;
-		for (const auto &faces : polygons) {
-			std::vector<IndexedTriangle> triangles;
-			auto err = false;
-			if (faces[0].size() == 3) {
-				triangles.emplace_back(faces[0][0], faces[0][1], faces[0][2]);
-			}
-			else {
-				err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, nullptr);
-			}
-			if (!err) {
-				for (const auto &t : triangles) {
-					outps.append_poly();
-					outps.append_vertex(verts[t[0]]);
-					outps.append_vertex(verts[t[1]]);
-					outps.append_vertex(verts[t[2]]);
-				}
-			}
+		std::vector<size_t> polygonof;
+		GeometryUtils::tessellatePolygonsWithHoles(verts, polygons, allTriangles, colors ? &polygonof : nullptr);
+		PolySet triangles(3);
+		auto &outpolygons = colors ? triangles : outps;
+		outpolygons.reserve(outpolygons.numPolygons() + allTriangles.size());
+		for (const auto &t : allTriangles) {
+			outpolygons.append_poly({verts[t[0]].cast<double>(), verts[t[1]].cast<double>(), verts[t[2]].cast<double>()});
+		}
+		if (colors) {
+			// The triangles take the colors of their faces
+			auto tricolors = make_shared<PolySet::FaceColors>();
+			tricolors->table = colors->table;
+			tricolors->indices.reserve(polygonof.size());
+			for (auto polygon : polygonof) tricolors->indices.push_back(colors->index(faceof[polygon]));
+			triangles.setFaceColors(tricolors);
+			outps.append(triangles);
 		}
 		if (degeneratePolygons > 0) PRINT("WARNING: PolySet has degenerate polygons");
 	}
 
+	namespace {
+		struct EdgeHash {
+			size_t operator()(uint64_t edge) const { return mix64(edge); }
+		};
+
+		uint64_t edge_key(uint32_t from, uint32_t to) { return (uint64_t(from) << 32) | to; }
+	}
+
+	/*!
+		Check if all faces of a polyset are within 0.1 degree of being convex,
+		and it's a closed, connected manifold. Vertex and edge indices are
+		hashed and the planes are tested in doubles. Only when a vertex is
+		too close to the plane of a neighboring face to tell the side in
+		floating point, the side is decided by CGAL's exact orientation
+		predicate.
+
+		NB! This function can give false positives if the polyset contains
+		non-planar faces. To be on the safe side, consider passing a tessellated polyset.
+		See issue #1061.
+	*/
 	bool is_approximately_convex(const PolySet &ps) {
+		const double angle_threshold = cos_degrees(.1); // .1°
+		const auto &polygons = ps.polygons();
+		if (polygons.empty()) return true;
+
+		// The vertex indices of face i are at positions offsets[i] up to offsets[i+1]
+		FlatHashIndex<Vector3d> vertices;
+		std::vector<uint32_t> indices, faceof;
+		std::vector<size_t> offsets{0};
+		// The position of each directed edge's first vertex
+		FlatHashMap<uint64_t, uint32_t, EdgeHash> edges;
+		std::vector<Vector3d> normals(polygons.size(), Vector3d::Zero());
+		size_t numindices = 0;
+		for (const auto &poly : polygons) numindices += poly.size();
+		indices.reserve(numindices);
+		faceof.reserve(numindices);
+		offsets.reserve(polygons.size() + 1);
+		edges.reserve(numindices);
+		for (size_t i = 0; i < polygons.size(); ++i) {
+			const auto &poly = polygons[i];
+			const size_t n = poly.size();
+			if (n >= 3) {
+				for (size_t j = 0; j < n; ++j) {
+					indices.push_back(uint32_t(vertices.insert(poly[j]).first));
+					faceof.push_back(uint32_t(i));
+					// Newell's method
+					const auto &v1 = poly[j], &v2 = poly[(j + 1) % n];
+					normals[i] += Vector3d((v1[1] - v2[1]) * (v1[2] + v2[2]),
+																 (v1[2] - v2[2]) * (v1[0] + v2[0]),
+																 (v1[0] - v2[0]) * (v1[1] + v2[1]));
+				}
+				const size_t begin = offsets.back();
+				for (size_t j = 0; j < n; ++j) {
+					const auto edge = edge_key(indices[begin + j], indices[begin + (j + 1) % n]);
+					if (!edges.emplace(edge, uint32_t(begin + j)).second) return false; // edge already exists: nonmanifold
+				}
+			}
+			offsets.push_back(indices.size());
+		}
+		const auto &points = vertices.keys();
+		auto next = [&](size_t k) { return k + 1 < offsets[faceof[k] + 1] ? k + 1 : offsets[faceof[k]]; };
+
+		for (size_t k = 0; k < indices.size(); ++k) {
+			const size_t k1 = next(k), k2 = next(k1);
+			const auto e = edges.find(edge_key(indices[k1], indices[k]));
+			if (e == edges.npos) return false; // not a closed manifold
+			const size_t other = edges.value(e), face = faceof[other];
+			const auto &normal = normals[face];
+
+			const Vector3d &p = points[indices[k2]];
+			const Vector3d d = p - points[indices[offsets[face]]];
+			const double side = normal.dot(d);
+			bool above = side > 0;
+			if (std::abs(side) <= 1e-12 * normal.norm() * d.norm()) {
 #ifdef ENABLE_CGAL
-		return CGALUtils::is_approximately_convex(ps);
-#else
-		return false;
+				// The other face has the edge reversed, i.e. k1, k and the vertex after k
+				const auto &a = points[indices[other]], &b = points[indices[next(other)]], &c = points[indices[next(next(other))]];
+				above = CGAL::orientation(vector_convert<Vertex3K>(a), vector_convert<Vertex3K>(b),
+																	vector_convert<Vertex3K>(c), vector_convert<Vertex3K>(p)) == CGAL::POSITIVE;
 #endif
+			}
+			if (above) {
+				// Check angle
+				const double cos_angle = normal.normalized().dot(normals[faceof[k]].normalized());
+				if (cos_angle < angle_threshold) return false;
+			}
+		}
+
+		// Make sure that all faces are connected
+		std::vector<char> explored(polygons.size(), false);
+		std::vector<uint32_t> stack{0};
+		explored[0] = true;
+		size_t numexplored = 1;
+		while (!stack.empty()) {
+			const size_t f = stack.back();
+			stack.pop_back();
+			for (size_t k = offsets[f]; k < offsets[f + 1]; ++k) {
+				const auto e = edges.find(edge_key(indices[next(k)], indices[k]));
+				if (e == edges.npos) return false; // Nonmanifold
+				const auto other = faceof[edges.value(e)];
+				if (!explored[other]) {
+					explored[other] = true;
+					numexplored++;
+					stack.push_back(other);
+				}
+			}
+		}
+		return numexplored == polygons.size();
+	}
+
+	/*!
+		Builds an indexed mesh from the faces of ps, merging vertices with
+		identical coordinates. Faces are kept in order and orientation.
+		Replaces any previous content of mesh.
+	*/
+	void createIndexedMesh(const PolySet &ps, IndexedMesh &mesh)
+	{
+		mesh = IndexedMesh();
+		Reindexer<Vector3d> vertices;
+		size_t numindices = 0;
+		for (const auto &p : ps.polygons()) numindices += p.size();
+		mesh.indices.reserve(numindices);
+		mesh.faceoffsets.reserve(ps.polygons().size() + 1);
+
+		for (const auto &p : ps.polygons()) {
+			for (const auto &v : p) mesh.indices.push_back(vertices.lookup(v));
+			mesh.faceoffsets.push_back(mesh.indices.size());
+		}
+		vertices.copy(std::back_inserter(mesh.vertices));
+	}
+
+	void appendIndexedMesh(const IndexedMesh &mesh, PolySet &ps)
+	{
+		ps.reserve(ps.numPolygons() + mesh.numFaces());
+		for (size_t i = 0; i < mesh.numFaces(); ++i) {
+			Polygon poly;
+			poly.reserve(mesh.faceSize(i));
+			const int *face = mesh.face(i);
+			for (size_t j = 0; j < mesh.faceSize(i); ++j) poly.push_back(mesh.vertices[face[j]]);
+			ps.append_poly(std::move(poly));
+		}
+	}
+
+	/*!
+		Reduces the triangles of ps to about maxtriangles for drawing it
+		coarsely, by repeatedly collapsing the shortest edges into their
+		midpoints. Each pass collapses edges which share no vertex, so every
+		pass removes at most about a third of the triangles.
+
+		The result has no guarantees of being manifold or free of flipped
+		triangles; it's only meant for previews.
+	*/
+	PolySet *decimate(const PolySet &ps, size_t maxtriangles)
+	{
+		PolySet tri(3, ps.convexValue());
+		PolysetUtils::tessellate_faces(ps, tri);
+		IndexedMesh mesh;
+		createIndexedMesh(tri, mesh);
+		auto &verts = mesh.vertices;
+		auto &indices = mesh.indices;
+
+		std::vector<std::pair<double, std::pair<int, int>>> edges;
+		std::vector<int> collapsed(verts.size());
+		std::vector<bool> touched(verts.size());
+		while (indices.size() / 3 > maxtriangles) {
+			edges.clear();
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				for (size_t j = 0; j < 3; ++j) {
+					const int a = indices[i + j], b = indices[i + (j + 1) % 3];
+					if (a < b) edges.emplace_back((verts[a] - verts[b]).squaredNorm(), std::make_pair(a, b));
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+
+			// Each collapse removes the two triangles sharing the edge
+			const size_t excess = indices.size() / 3 - maxtriangles;
+			size_t removed = 0;
+			for (size_t v = 0; v < verts.size(); ++v) collapsed[v] = int(v);
+			std::fill(touched.begin(), touched.end(), false);
+			for (const auto &e : edges) {
+				if (removed >= excess) break;
+				const int a = e.second.first, b = e.second.second;
+				if (touched[a] || touched[b]) continue;
+				touched[a] = touched[b] = true;
+				collapsed[b] = a;
+				verts[a] = (verts[a] + verts[b]) / 2;
+				removed += 2;
+			}
+
+			size_t n = 0;
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				const int a = collapsed[indices[i]], b = collapsed[indices[i + 1]], c = collapsed[indices[i + 2]];
+				if (a == b || b == c || c == a) continue;
+				indices[n++] = a;
+				indices[n++] = b;
+				indices[n++] = c;
+			}
+			if (n == indices.size()) break;
+			indices.resize(n);
+		}
+
+		mesh.faceoffsets.resize(indices.size() / 3 + 1);
+		for (size_t i = 0; i < mesh.faceoffsets.size(); ++i) mesh.faceoffsets[i] = 3 * i;
+		auto result = new PolySet(3, ps.convexValue());
+		result->setConvexity(ps.getConvexity());
+		appendIndexedMesh(mesh, *result);
+		return result;
+	}
+
+	/*!
+		Simplifies ps by collapsing edges in the order of their quadric error
+		(Garland & Heckbert), until at most maxtriangles triangles are left or
+		the next collapse would move the surface further than maxerror from
+		the planes of the original triangles. maxtriangles = 0 sets no limit
+		on the count.
+
+		Unlike decimate(), collapses are skipped where they would change the
+		topology or flip a triangle, so closed manifold meshes stay closed
+		and manifold and can go on into booleans. Open boundaries and
+		non-manifold edges are kept as they are.
+	*/
+	PolySet *simplify(const PolySet &ps, size_t maxtriangles, double maxerror)
+	{
+		PolySet tri(3, ps.convexValue());
+		PolysetUtils::tessellate_faces(ps, tri);
+		IndexedMesh mesh;
+		createIndexedMesh(tri, mesh);
+		auto &verts = mesh.vertices;
+
+		std::vector<std::array<int, 3>> triangles;
+		triangles.reserve(mesh.numFaces());
+		for (size_t i = 0; i < mesh.numFaces(); ++i) {
+			const int *f = mesh.face(i);
+			if (f[0] != f[1] && f[1] != f[2] && f[2] != f[0]) triangles.push_back({{f[0], f[1], f[2]}});
+		}
+
+		// The quadric of a vertex sums the squared distances to the planes of
+		// its triangles, and those of all vertices collapsed into it
+		std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> quadrics(verts.size(), Eigen::Matrix4d::Zero());
+		std::vector<std::vector<int>> vertextriangles(verts.size());
+		std::unordered_map<uint64_t, int> edgecount;
+		for (size_t t = 0; t < triangles.size(); ++t) {
+			const auto &f = triangles[t];
+			Vector3d n = (verts[f[1]] - verts[f[0]]).cross(verts[f[2]] - verts[f[0]]);
+			if (n.norm() > 0) {
+				n.normalize();
+				const Eigen::Vector4d plane(n[0], n[1], n[2], -n.dot(verts[f[0]]));
+				const Eigen::Matrix4d q = plane * plane.transpose();
+				for (const auto v : f) quadrics[v] += q;
+			}
+			for (size_t j = 0; j < 3; ++j) {
+				vertextriangles[f[j]].push_back(int(t));
+				const auto a = std::min(f[j], f[(j + 1) % 3]), b = std::max(f[j], f[(j + 1) % 3]);
+				edgecount[uint64_t(a) << 32 | uint32_t(b)]++;
+			}
+		}
+		std::vector<bool> locked(verts.size(), false);
+		for (const auto &e : edgecount) {
+			if (e.second != 2) locked[e.first >> 32] = locked[e.first & 0xffffffff] = true;
+		}
+
+		struct Collapse {
+			double cost;
+			int a, b;
+			unsigned int versiona, versionb;
+			Vector3d target;
+			bool operator<(const Collapse &other) const { return cost > other.cost; }
+		};
+		std::vector<unsigned int> versions(verts.size(), 0);
+		std::priority_queue<Collapse> queue;
+		auto push = [&](int a, int b) {
+			if (locked[a] || locked[b]) return;
+			const Eigen::Matrix4d q = quadrics[a] + quadrics[b];
+			auto error = [&q](const Vector3d &v) {
+				const Eigen::Vector4d h(v[0], v[1], v[2], 1);
+				return std::max(0.0, h.dot(q * h));
+			};
+			// The point of least error, unless it's ill-defined or far off the edge
+			const Vector3d mid = (verts[a] + verts[b]) / 2;
+			Vector3d target = mid;
+			Eigen::FullPivLU<Eigen::Matrix3d> lu(q.topLeftCorner<3, 3>());
+			if (lu.isInvertible()) {
+				const Vector3d v = lu.solve(-q.topRightCorner<3, 1>());
+				if ((v - mid).norm() <= (verts[a] - verts[b]).norm()) target = v;
+			}
+			for (const auto &v : {verts[a], verts[b]}) {
+				if (error(v) < error(target)) target = v;
+			}
+			queue.push({error(target), a, b, versions[a], versions[b], target});
+		};
+		for (const auto &e : edgecount) {
+			if (e.second == 2) push(int(e.first >> 32), int(e.first & 0xffffffff));
+		}
+
+		std::vector<bool> removed(triangles.size(), false);
+		size_t numtriangles = triangles.size();
+		const double maxcost = maxerror * maxerror;
+		std::vector<int> opposite;
+		while (!queue.empty() && (maxtriangles == 0 || numtriangles > maxtriangles)) {
+			const auto c = queue.top();
+			queue.pop();
+			if (c.cost > maxcost) break;
+			if (c.versiona != versions[c.a] || c.versionb != versions[c.b]) continue;
+			const int a = c.a, b = c.b;
+
+			auto contains = [&triangles](int t, int v) {
+				const auto &f = triangles[t];
+				return f[0] == v || f[1] == v || f[2] == v;
+			};
+			auto neighbors = [&](int v) {
+				std::vector<int> result;
+				for (const auto t : vertextriangles[v]) {
+					for (const auto w : triangles[t]) if (w != v) result.push_back(w);
+				}
+				std::sort(result.begin(), result.end());
+				result.erase(std::unique(result.begin(), result.end()), result.end());
+				return result;
+			};
+
+			// Link condition: a and b may only share the two vertices opposite
+			// to their edge, and those mustn't form a triangle with both
+			const auto na = neighbors(a), nb = neighbors(b);
+			opposite.clear();
+			std::set_intersection(na.begin(), na.end(), nb.begin(), nb.end(), std::back_inserter(opposite));
+			if (opposite.size() != 2) continue;
+			auto hastriangle = [&](int v) {
+				for (const auto t : vertextriangles[v]) {
+					if (contains(t, opposite[0]) && contains(t, opposite[1])) return true;
+				}
+				return false;
+			};
+			if (hastriangle(a) && hastriangle(b)) continue;
+
+			// The remaining triangles of a and b mustn't flip or degenerate
+			bool flips = false;
+			for (const auto v : {a, b}) {
+				for (const auto t : vertextriangles[v]) {
+					if (contains(t, a) && contains(t, b)) continue;
+					const auto &f = triangles[t];
+					Vector3d p[3], q[3];
+					for (size_t j = 0; j < 3; ++j) {
+						p[j] = verts[f[j]];
+						q[j] = f[j] == v ? c.target : p[j];
+					}
+					const Vector3d before = (p[1] - p[0]).cross(p[2] - p[0]);
+					const Vector3d after = (q[1] - q[0]).cross(q[2] - q[0]);
+					if (before.dot(after) <= 0) flips = true;
+				}
+			}
+			if (flips) continue;
+
+			verts[a] = c.target;
+			quadrics[a] += quadrics[b];
+			versions[a]++;
+			versions[b]++;
+			locked[b] = true;
+			std::vector<int> remaining;
+			for (const auto t : vertextriangles[a]) {
+				if (contains(t, b)) {
+					removed[t] = true;
+					numtriangles--;
+					for (const auto w : triangles[t]) {
+						if (w == a || w == b) continue;
+						auto &others = vertextriangles[w];
+						others.erase(std::find(others.begin(), others.end(), int(t)));
+					}
+				}
+				else {
+					remaining.push_back(t);
+				}
+			}
+			for (const auto t : vertextriangles[b]) {
+				if (removed[t]) continue;
+				for (auto &w : triangles[t]) if (w == b) w = a;
+				remaining.push_back(t);
+			}
+			vertextriangles[a] = std::move(remaining);
+			vertextriangles[b].clear();
+			for (const auto n : neighbors(a)) push(a, n);
+		}
+
+		mesh.indices.clear();
+		mesh.faceoffsets.assign(1, 0);
+		for (size_t t = 0; t < triangles.size(); ++t) {
+			if (removed[t]) continue;
+			mesh.indices.insert(mesh.indices.end(), triangles[t].begin(), triangles[t].end());
+			mesh.faceoffsets.push_back(mesh.indices.size());
+		}
+		auto result = new PolySet(3, ps.convexValue());
+		result->setConvexity(ps.getConvexity());
+		appendIndexedMesh(mesh, *result);
+		PRINTDB("Simplify: %d -> %d triangles", triangles.size() % numtriangles);
+		return result;
 	}
 
 }
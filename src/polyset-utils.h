@@ -1,12 +1,23 @@
 #pragma once
 
+#include <cstddef>
+#include <vector>
+
 class Polygon2d;
 class PolySet;
+struct IndexedMesh;
 
 namespace PolysetUtils {
 
 	Polygon2d *project(const PolySet &ps);
+	Polygon2d *project_silhouette(const PolySet &ps);
+	Polygon2d *slice(const PolySet &ps, double z = 0);
+	std::vector<Polygon2d *> slice(const PolySet &ps, const std::vector<double> &heights);
 	void tessellate_faces(const PolySet &inps, PolySet &outps);
 	bool is_approximately_convex(const PolySet &ps);
+	void createIndexedMesh(const PolySet &ps, IndexedMesh &mesh);
+	void appendIndexedMesh(const IndexedMesh &mesh, PolySet &ps);
+	PolySet *decimate(const PolySet &ps, size_t maxtriangles);
+	PolySet *simplify(const PolySet &ps, size_t maxtriangles, double maxerror);
 
 };
@@ -29,7 +29,9 @@
 #include "linalg.h"
 #include "printutils.h"
 #include "grid.h"
+#include "TriangleBVH.h"
 #include <Eigen/LU>
+#include <algorithm>
 
 /*! /class PolySet
 
@@ -45,11 +47,13 @@
 
  */
 
-PolySet::PolySet(unsigned int dim, boost::tribool convex) : dim(dim), convex(convex), dirty(false)
+PolySet::PolySet(unsigned int dim, boost::tribool convex)
+	: Geometry(KIND), faces(make_shared<Polygons>()), dim(dim), convex(convex)
 {
 }
 
-PolySet::PolySet(const Polygon2d &origin) : polygon(origin), dim(2), convex(unknown), dirty(false)
+PolySet::PolySet(const Polygon2d &origin)
+	: Geometry(KIND), faces(make_shared<Polygons>()), polygon(origin), dim(2), convex(unknown)
 {
 }
 
@@ -57,18 +61,31 @@ PolySet::~PolySet()
 {
 }
 
+// Gives this PolySet its own polygons if a copy shares them
+Polygons &PolySet::unshare()
+{
+	if (this->faces.use_count() > 1) this->faces = make_shared<Polygons>(*this->faces);
+	return *this->faces;
+}
+
+Polygons &PolySet::mutablePolygons()
+{
+	changed();
+	return unshare();
+}
+
 std::string PolySet::dump() const
 {
 	std::ostringstream out;
 	out << "PolySet:"
 	  << "\n dimensions:" << this->dim
 	  << "\n convexity:" << this->convexity
-	  << "\n num polygons: " << polygons.size()
+	  << "\n num polygons: " << polygons().size()
 			<< "\n num outlines: " << polygon.outlines().size()
 	  << "\n polygons data:";
-	for (size_t i = 0; i < polygons.size(); i++) {
+	for (size_t i = 0; i < polygons().size(); i++) {
 		out << "\n  polygon begin:";
-		const Polygon *poly = &polygons[i];
+		const Polygon *poly = &polygons()[i];
 		for (size_t j = 0; j < poly->size(); j++) {
 			Vector3d v = poly->at(j);
 			out << "\n   vertex:" << v.transpose();
@@ -82,13 +99,19 @@ std::string PolySet::dump() const
 
 void PolySet::append_poly()
 {
-	polygons.push_back(Polygon());
+	unshare().push_back(Polygon());
 }
 
 void PolySet::append_poly(const Polygon &poly)
 {
-	polygons.push_back(poly);
-	this->dirty = true;
+	unshare().push_back(poly);
+	changed();
+}
+
+void PolySet::append_poly(Polygon &&poly)
+{
+	unshare().push_back(std::move(poly));
+	changed();
 }
 
 void PolySet::append_vertex(double x, double y, double z)
@@ -98,8 +121,8 @@ void PolySet::append_vertex(double x, double y, double z)
 
 void PolySet::append_vertex(const Vector3d &v)
 {
-	polygons.back().push_back(v);
-	this->dirty = true;
+	unshare().back().push_back(v);
+	changed();
 }
 
 void PolySet::append_vertex(const Vector3f &v)
@@ -114,8 +137,9 @@ void PolySet::insert_vertex(double x, double y, double z)
 
 void PolySet::insert_vertex(const Vector3d &v)
 {
-	polygons.back().insert(polygons.back().begin(), v);
-	this->dirty = true;
+	auto &poly = unshare().back();
+	poly.insert(poly.begin(), v);
+	changed();
 }
 
 void PolySet::insert_vertex(const Vector3f &v)
@@ -125,53 +149,197 @@ void PolySet::insert_vertex(const Vector3f &v)
 
 BoundingBox PolySet::getBoundingBox() const
 {
-	if (this->dirty) {
-		this->bbox.setNull();
-		for(const auto &poly : polygons) {
+	// Concurrent first uses may compute it twice, like bvh()
+	auto bbox = std::atomic_load(&this->boundingbox);
+	if (!bbox) {
+		auto result = make_shared<BoundingBox>();
+		for(const auto &poly : polygons()) {
 			for(const auto &p : poly) {
-				this->bbox.extend(p);
+				result->extend(p);
 			}
 		}
-		this->dirty = false;
+		bbox = result;
+		std::atomic_store(&this->boundingbox, bbox);
 	}
-	return this->bbox;
+	return *bbox;
 }
 
 size_t PolySet::memsize() const
 {
 	size_t mem = 0;
-	for(const auto &p : this->polygons) mem += p.size() * sizeof(Vector3d);
+	for(const auto &p : polygons()) mem += p.size() * sizeof(Vector3d);
 	mem += this->polygon.memsize() - sizeof(this->polygon);
+	if (this->colors) mem += this->colors->table.size() * sizeof(Color4f) + this->colors->indices.size() * sizeof(uint16_t);
 	mem += sizeof(PolySet);
 	return mem;
 }
 
 void PolySet::append(const PolySet &ps)
 {
-	this->polygons.insert(this->polygons.end(), ps.polygons.begin(), ps.polygons.end());
-	if (!dirty && !this->bbox.isNull()) {
-		this->bbox.extend(ps.getBoundingBox());
+	auto &polygons = unshare();
+	const size_t first = polygons.size();
+	polygons.insert(polygons.end(), ps.polygons().begin(), ps.polygons().end());
+	appendColors(ps, first);
+	if (auto bbox = this->boundingbox) {
+		auto result = make_shared<BoundingBox>(*bbox);
+		result->extend(ps.getBoundingBox());
+		this->boundingbox = result;
 	}
 }
 
+/*!
+	Appends the polygons of ps transformed by mat, like append() of a
+	transform()ed copy of ps, but without making that copy.
+*/
+void PolySet::append(const PolySet &ps, const Transform3d &mat)
+{
+	const bool mirrored = mat.matrix().determinant() < 0;
+	auto &polygons = unshare();
+	const size_t first = polygons.size();
+	polygons.reserve(polygons.size() + ps.numPolygons());
+	for (const auto &p : ps.polygons()) {
+		Polygon poly;
+		poly.reserve(p.size());
+		for (const auto &v : p) poly.push_back(mat * v);
+		if (mirrored) std::reverse(poly.begin(), poly.end());
+		polygons.push_back(std::move(poly));
+	}
+	appendColors(ps, first);
+	changed();
+}
+
+const uint16_t PolySet::FaceColors::nocolor;
+
+uint16_t PolySet::FaceColors::lookup(const Color4f &color)
+{
+	const auto it = std::find(this->table.begin(), this->table.end(), color);
+	if (it != this->table.end()) return uint16_t(it - this->table.begin());
+	if (this->table.size() >= nocolor) return nocolor;
+	this->table.push_back(color);
+	return uint16_t(this->table.size() - 1);
+}
+
+Color4f PolySet::faceColor(size_t face) const
+{
+	const auto index = this->colors ? this->colors->index(face) : FaceColors::nocolor;
+	return index == FaceColors::nocolor ? Color4f(-1.0f, -1.0f, -1.0f, 1.0f) : this->colors->table[index];
+}
+
+void PolySet::setColor(const Color4f &color)
+{
+	auto colors = make_shared<FaceColors>();
+	colors->table.push_back(color);
+	colors->indices.assign(numPolygons(), 0);
+	this->colors = colors;
+}
+
+/*!
+	Gives the faces from first on, which were appended from ps, the colors
+	of the faces of ps, merging the color tables.
+*/
+void PolySet::appendColors(const PolySet &ps, size_t first)
+{
+	if (!ps.colors) return;
+	auto colors = this->colors ? make_shared<FaceColors>(*this->colors) : make_shared<FaceColors>();
+	std::vector<uint16_t> map(ps.colors->table.size());
+	for (size_t i = 0; i < map.size(); ++i) map[i] = colors->lookup(ps.colors->table[i]);
+	colors->indices.resize(first, FaceColors::nocolor);
+	for (size_t i = 0; i < ps.numPolygons(); ++i) {
+		const auto index = ps.colors->index(i);
+		colors->indices.push_back(index == FaceColors::nocolor ? index : map[index]);
+	}
+	this->colors = colors;
+}
+
 void PolySet::transform(const Transform3d &mat)
 {
 	// If mirroring transform, flip faces to avoid the object to end up being inside-out
 	bool mirrored = mat.matrix().determinant() < 0;
 
-	for(auto &p : this->polygons){
+	for(auto &p : unshare()){
 		for(auto &v : p) {
 			v = mat * v;
 		}
 		if (mirrored) std::reverse(p.begin(), p.end());
 	}
-	this->dirty = true;
+	changed();
+}
+
+shared_ptr<const TriangleBVH> PolySet::bvh() const
+{
+	// Concurrent first uses may build it twice, but all get a complete one
+	auto tree = std::atomic_load(&this->trianglebvh);
+	if (!tree) {
+		tree = make_shared<const TriangleBVH>(*this);
+		std::atomic_store(&this->trianglebvh, tree);
+	}
+	return tree;
+}
+
+shared_ptr<const MeshTopology> PolySet::topology() const
+{
+	auto topology = std::atomic_load(&this->meshtopology);
+	if (!topology) {
+		IndexedMesh mesh;
+		PolysetUtils::createIndexedMesh(*this, mesh);
+		topology = make_shared<const MeshTopology>(GeometryUtils::analyzeTopology(mesh));
+		std::atomic_store(&this->meshtopology, topology);
+	}
+	return topology;
+}
+
+unsigned int PolySet::estimatedConvexity() const
+{
+	if (this->dim != 3 || this->isEmpty() || this->convex) return 1;
+	auto estimate = this->convexityestimate.value.load();
+	if (estimate) return estimate;
+
+	// Rays along the axes and the diagonals, through a grid over the box;
+	// a ray and its reverse cross the same faces
+	const int grid = 8;
+	static const Vector3d directions[] = {
+		{1, 0, 0}, {0, 1, 0}, {0, 0, 1}, {1, 1, 1}, {1, 1, -1}, {1, -1, 1}, {-1, 1, 1}
+	};
+	const auto tree = bvh();
+	const BoundingBox box = tree->getBoundingBox();
+	const Vector3d center = box.center();
+	const double radius = std::max(box.sizes().norm() / 2, 1e-9);
+	std::vector<TriangleBVH::Hit> hits;
+	size_t crossings = 2;
+	for (const auto &axis : directions) {
+		const Vector3d d = axis.normalized();
+		const Vector3d u = d.unitOrthogonal(), v = d.cross(u);
+		for (int i = 0; i < grid; ++i) {
+			for (int j = 0; j < grid; ++j) {
+				// Off the centers of the cells, so rays are unlikely to run along edges
+				const double a = ((i + 0.4142) / grid * 2 - 1) * radius, b = ((j + 0.7321) / grid * 2 - 1) * radius;
+				const Vector3d origin = center + a * u + b * v - radius * d;
+				hits.clear();
+				tree->intersectRayAll(origin, d, hits, 0, 2 * radius);
+				// Rays through an edge or a vertex hit several triangles at once
+				std::sort(hits.begin(), hits.end(), [](const TriangleBVH::Hit &x, const TriangleBVH::Hit &y) { return x.t < y.t; });
+				size_t count = 0;
+				for (size_t k = 0; k < hits.size(); ++k) {
+					if (k == 0 || hits[k].t - hits[k - 1].t > 1e-9 * radius) count++;
+				}
+				crossings = std::max(crossings, count);
+			}
+		}
+	}
+	estimate = (crossings + 1) / 2;
+	this->convexityestimate.value = estimate;
+	return estimate;
 }
 
 bool PolySet::is_convex() const {
 	if (convex || this->isEmpty()) return true;
 	if (!convex) return false;
-	return PolysetUtils::is_approximately_convex(*this);
+	auto check = this->convexcheck.value.load();
+	if (check < 0) {
+		check = PolysetUtils::is_approximately_convex(*this);
+		this->convexcheck.value = check;
+	}
+	return check;
 }
 
 void PolySet::resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize)
@@ -204,32 +372,67 @@ void PolySet::resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &aut
 /*!
 	Quantizes vertices by gridding them as well as merges close vertices belonging to
 	neighboring grids.
-	May reduce the number of polygons if polygons collapse into < 3 vertices.
+	May reduce the number of polygons if polygons collapse into < 3 vertices; the
+	others keep their order.
+
+	If mesh is given, it receives the result as an indexed mesh, with the distinct
+	vertices in order of first use (including those of collapsed polygons).
 */
-void PolySet::quantizeVertices()
+void PolySet::quantizeVertices(IndexedMesh *mesh)
 {
+	auto &polygons = unshare();
+	size_t numvertices = 0;
+	for (const auto &p : polygons) numvertices += p.size();
 	Grid3d<int> grid(GRID_FINE);
+	grid.reserve(numvertices / 2);
+	if (mesh) {
+		*mesh = IndexedMesh();
+		mesh->indices.reserve(numvertices);
+		mesh->faceoffsets.reserve(polygons.size() + 1);
+	}
+
+	// The colors follow the faces which are kept
+	shared_ptr<FaceColors> colors;
+	if (this->colors) colors = make_shared<FaceColors>(*this->colors);
+
 	std::vector<int> indices; // Vertex indices in one polygon
-	for (std::vector<Polygon>::iterator iter = this->polygons.begin(); iter != this->polygons.end();) {
-		Polygon &p = *iter;
+	size_t kept = 0;
+	for (auto &p : polygons) {
 		indices.resize(p.size());
 		// Quantize all vertices. Build index list
-		for (unsigned int i=0;i<p.size();i++) indices[i] = grid.align(p[i]);
+		for (size_t i = 0; i < p.size(); i++) {
+			indices[i] = grid.align(p[i]);
+			if (mesh && size_t(indices[i]) == mesh->vertices.size()) mesh->vertices.push_back(p[i]);
+		}
 		// Remove consecutive duplicate vertices
-		Polygon::iterator currp = p.begin();
-		for (unsigned int i=0;i<indices.size();i++) {
+		size_t n = 0;
+		for (size_t i = 0; i < indices.size(); i++) {
 			if (indices[i] != indices[(i+1)%indices.size()]) {
-				(*currp++) = p[i];
+				p[n] = p[i];
+				indices[n++] = indices[i];
 			}
 		}
-		p.erase(currp, p.end());
-		if (p.size() < 3) {
+		p.resize(n);
+		if (n < 3) {
 			PRINTD("Removing collapsed polygon due to quantizing");
-			this->polygons.erase(iter);
+			continue;
+		}
+		if (mesh) {
+			mesh->indices.insert(mesh->indices.end(), indices.begin(), indices.begin() + n);
+			mesh->faceoffsets.push_back(mesh->indices.size());
 		}
-		else {
-			iter++;
+		const size_t i = &p - polygons.data();
+		if (kept != i) {
+			polygons[kept] = std::move(p);
+			if (colors && kept < colors->indices.size()) colors->indices[kept] = colors->index(i);
 		}
+		kept++;
+	}
+	polygons.resize(kept);
+	if (colors) {
+		if (colors->indices.size() > kept) colors->indices.resize(kept);
+		this->colors = colors;
 	}
+	changed();
 }
 
@@ -6,16 +6,24 @@
 #include "GeometryUtils.h"
 #include "renderer.h"
 #include "Polygon2d.h"
+#include <atomic>
+#include <cstdint>
 #include <vector>
 #include <string>
 
 #include <boost/logic/tribool.hpp>
 BOOST_TRIBOOL_THIRD_STATE(unknown)
 
+/*!
+	Copies of a PolySet share its polygons until one of them changes them,
+	so copying e.g. a cached PolySet to set its convexity doesn't copy the
+	mesh. Changes go through mutablePolygons() or the other non-const
+	members, which unshare the polygons first.
+*/
 class PolySet : public Geometry
 {
 public:
-	Polygons polygons;
+	static const Kind KIND = Kind::POLYSET;
 
 	PolySet(unsigned int dim, boost::tribool convex = unknown);
 	PolySet(const Polygon2d &origin);
@@ -25,13 +33,20 @@ public:
 	BoundingBox getBoundingBox() const override;
 	std::string dump() const override;
 	unsigned int getDimension() const override { return this->dim; }
-	bool isEmpty() const override { return polygons.size() == 0; }
+	bool isEmpty() const override { return polygons().size() == 0; }
 	Geometry *copy() const override { return new PolySet(*this); }
 
-	void quantizeVertices();
-	size_t numPolygons() const { return polygons.size(); }
+	const Polygons &polygons() const { return *this->faces; }
+	// The polygons to change in place
+	Polygons &mutablePolygons();
+
+	void quantizeVertices(IndexedMesh *mesh = nullptr);
+	size_t numPolygons() const { return this->faces->size(); }
+	// Builders which know their face count up front should reserve it
+	void reserve(size_t numpolygons) { unshare().reserve(numpolygons); }
 	void append_poly();
 	void append_poly(const Polygon &poly);
+	void append_poly(Polygon &&poly);
 	void append_vertex(double x, double y, double z = 0.0);
 	void append_vertex(const Vector3d &v);
 	void append_vertex(const Vector3f &v);
@@ -39,20 +54,106 @@ public:
 	void insert_vertex(const Vector3d &v);
 	void insert_vertex(const Vector3f &v);
 	void append(const PolySet &ps);
+	void append(const PolySet &ps, const Transform3d &mat);
 
 	void render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo = nullptr) const;
 	void render_edges(Renderer::csgmode_e csgmode) const;
+	// The vertex data drawn by render_surface() and render_edges(), see VBOCache
+	void surface_vertices(Renderer::csgmode_e csgmode, std::vector<GLfloat> &data) const;
+	void edge_vertices(Renderer::csgmode_e csgmode, std::vector<GLfloat> &data) const;
 
 	void transform(const Transform3d &mat);
 	void resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize);
 
+	// Whether the PolySet is convex, tested when that's not known from its
+	// construction. The test result is kept until the PolySet changes, so
+	// PolySets shared through the GeometryCache are only tested once.
 	bool is_convex() const;
 	boost::tribool convexValue() const { return this->convex; }
 
+	// The BVH of the triangles, built on first use and kept until the PolySet changes
+	shared_ptr<const class TriangleBVH> bvh() const;
+	// The most front faces a line of sight crosses, for previews of PolySets
+	// whose convexity isn't given: the most crossings of sampled rays in
+	// several directions, cast through the BVH. Kept like the BVH.
+	unsigned int estimatedConvexity() const;
+	// How the faces connect, with vertices merged by their coordinates,
+	// found on first use and kept until the PolySet changes
+	shared_ptr<const MeshTopology> topology() const;
+
+	/*!
+		The solid a primitive's mesh approximates, for renderers which draw
+		the solid itself, e.g. by ray marching its distance function. Set by
+		the primitive after building the mesh and cleared when it changes.
+	*/
+	struct Shape {
+		enum class Type { NONE, BOX, PRISM, CONE, SPHERE };
+		Type type = Type::NONE;
+		Vector3d min, max; // BOX
+		// PRISM and CONE: the radii at z1 and z2: PRISM is a regular polygon
+		// of sides with a vertex on the x axis, CONE is round; SPHERE: r1
+		double r1 = 0, r2 = 0, z1 = 0, z2 = 0;
+		unsigned int sides = 0;
+	};
+	const Shape &shape() const { return this->primitive; }
+	void setShape(const Shape &shape) { this->primitive = shape; }
+
+	/*!
+		The colors given by color(), compactly: a table of the distinct
+		colors and the index into it of each face, nocolor for none. Faces
+		past the end of the indices have no color either. Shared with copies
+		like the polygons, and kept through changes which keep the faces.
+	*/
+	struct FaceColors {
+		static const uint16_t nocolor = 0xffff;
+		std::vector<Color4f> table;
+		std::vector<uint16_t> indices;
+
+		uint16_t index(size_t face) const { return face < indices.size() ? indices[face] : nocolor; }
+		// The index of color in the table, added if it's new; nocolor if the table is full
+		uint16_t lookup(const Color4f &color);
+	};
+	bool hasColors() const { return bool(this->colors); }
+	const shared_ptr<const FaceColors> &faceColors() const { return this->colors; }
+	void setFaceColors(const shared_ptr<const FaceColors> &colors) { this->colors = colors; }
+	// The color of the face, with negative components if it has none
+	Color4f faceColor(size_t face) const;
+	// Gives all faces the color, replacing their colors
+	void setColor(const Color4f &color);
+
 private:
+	template <typename TriangleFunc> void surface_triangles(Renderer::csgmode_e csgmode, TriangleFunc triangle) const;
+	Polygons &unshare();
+	void changed() {
+		this->boundingbox.reset();
+		this->trianglebvh.reset();
+		this->meshtopology.reset();
+		this->convexcheck.value = -1;
+		this->convexityestimate.value = 0;
+		this->primitive = Shape();
+	}
+
+	void appendColors(const PolySet &ps, size_t first);
+
+	// Shared with copies, see mutablePolygons()
+	shared_ptr<Polygons> faces;
+	shared_ptr<const FaceColors> colors;
 	Polygon2d polygon;
 	unsigned int dim;
 	mutable boost::tribool convex;
-	mutable BoundingBox bbox;
-	mutable bool dirty;
+	mutable shared_ptr<const BoundingBox> boundingbox;
+	mutable shared_ptr<const TriangleBVH> trianglebvh;
+	mutable shared_ptr<const MeshTopology> meshtopology;
+	Shape primitive;
+	// Results kept with the PolySet, which copies take along
+	template <typename T> struct Cached {
+		Cached(T value) : value(value) {}
+		Cached(const Cached &other) : value(other.value.load()) {}
+		Cached &operator=(const Cached &other) { this->value = other.value.load(); return *this; }
+		std::atomic<T> value;
+	};
+	// The result of the convexity test of is_convex(), -1 until it's known
+	mutable Cached<signed char> convexcheck{-1};
+	// The result of estimatedConvexity(), 0 until it's known
+	mutable Cached<unsigned int> convexityestimate{0};
 };
@@ -0,0 +1,40 @@
+#include "previewworker.h"
+#include "stackcheck.h"
+#include <QThread>
+
+PreviewWorker::PreviewWorker()
+{
+	this->thread = new QThread();
+	// Instantiation recurses as deep as the design, so this thread gets a
+	// stack as large as the one of the GUI thread
+	this->thread->setStackSize(PlatformUtils::stackLimit() + STACK_BUFFER_SIZE);
+	connect(this->thread, SIGNAL(started()), this, SLOT(work()));
+	moveToThread(this->thread);
+}
+
+PreviewWorker::~PreviewWorker()
+{
+	this->thread->wait();
+	delete this->thread;
+}
+
+bool PreviewWorker::isRunning() const
+{
+	return this->thread->isRunning();
+}
+
+void PreviewWorker::start(const std::function<void()> &job)
+{
+	this->job = job;
+	this->thread->start();
+}
+
+void PreviewWorker::work()
+{
+	StackCheck::inst().setLimit(PlatformUtils::stackLimit());
+	this->job();
+	this->job = nullptr;
+
+	emit done();
+	thread->quit();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QObject>
+#include <functional>
+
+/*!
+	Runs the compile of a preview on its own thread, like CGALWorker does
+	for renders, so the GUI stays responsive meanwhile. The job must not
+	touch any widgets. done() is received on the GUI thread.
+*/
+class PreviewWorker : public QObject
+{
+	Q_OBJECT;
+public:
+	PreviewWorker();
+	~PreviewWorker();
+
+	bool isRunning() const;
+
+public slots:
+	void start(const std::function<void()> &job);
+
+protected slots:
+	void work();
+
+signals:
+	void done();
+
+protected:
+
+	class QThread *thread;
+	std::function<void()> job;
+};
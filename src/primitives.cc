@@ -26,6 +26,7 @@
 
 #include "module.h"
 #include "node.h"
+#include "NodeVisitor.h"
 #include "polyset.h"
 #include "evalcontext.h"
 #include "Polygon2d.h"
@@ -35,10 +36,14 @@
 #include "calc.h"
 #include "degree_trig.h"
 #include <sstream>
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
 #include <boost/assign/std/vector.hpp>
 #include "ModuleInstantiation.h"
+#include "InstancedPolySet.h"
+#include "ShardedCache.h"
+#include <functional>
 using namespace boost::assign; // bring 'operator+=()' into scope
 
 #define F_MINIMUM 0.01
@@ -108,6 +113,8 @@ public:
 	const Geometry *createGeometry() const override;
 };
 
+DEFINE_VISITABLE(PrimitiveNode)
+
 /**
  * Return a radius value by looking up both a diameter and radius variable.
  * The diameter has higher priority, so if found an additionally set radius
@@ -343,6 +350,9 @@ struct point2d {
 	double x, y;
 };
 
+// Round meshes with this many fragments pass for the round solid itself
+static const int smooth_fragments = 24;
+
 static void generate_circle(point2d *circle, double r, int fragments)
 {
 	for (int i=0; i<fragments; i++) {
@@ -352,6 +362,157 @@ static void generate_circle(point2d *circle, double r, int fragments)
 	}
 }
 
+static PolySet *generate_sphere(double r1, int fragments)
+{
+	auto p = new PolySet(3,true);
+	struct ring_s {
+		std::vector<point2d> points;
+		double z;
+	};
+
+	int rings = (fragments+1)/2;
+// Uncomment the following three lines to enable experimental sphere tesselation
+//		if (rings % 2 == 0) rings++; // To ensure that the middle ring is at phi == 0 degrees
+
+	auto ring = std::vector<ring_s>(rings);
+
+//		double offset = 0.5 * ((fragments / 2) % 2);
+	for (int i = 0; i < rings; i++) {
+//			double phi = (180.0 * (i + offset)) / (fragments/2);
+		double phi = (180.0 * (i + 0.5)) / rings;
+		double r = r1 * sin_degrees(phi);
+		ring[i].z = r1 * cos_degrees(phi);
+		ring[i].points.resize(fragments);
+		generate_circle(ring[i].points.data(), r, fragments);
+	}
+
+	p->reserve(2 + size_t(rings - 1) * 2 * fragments);
+	Polygon top;
+	top.reserve(fragments);
+	for (int i = 0; i < fragments; i++)
+		top.emplace_back(ring[0].points[i].x, ring[0].points[i].y, ring[0].z);
+	p->append_poly(std::move(top));
+
+	for (int i = 0; i < rings-1; i++) {
+		auto r1 = &ring[i];
+		auto  r2 = &ring[i+1];
+		int r1i = 0, r2i = 0;
+		while (r1i < fragments || r2i < fragments) {
+			if (r1i >= fragments) goto sphere_next_r2;
+			if (r2i >= fragments) goto sphere_next_r1;
+			if ((double)r1i / fragments < (double)r2i / fragments) {
+			sphere_next_r1:
+				int r1j = (r1i+1) % fragments;
+				p->append_poly({{r2->points[r2i % fragments].x, r2->points[r2i % fragments].y, r2->z},
+												{r1->points[r1j].x, r1->points[r1j].y, r1->z},
+												{r1->points[r1i].x, r1->points[r1i].y, r1->z}});
+				r1i++;
+			} else {
+			sphere_next_r2:
+				int r2j = (r2i+1) % fragments;
+				p->append_poly({{r2->points[r2i].x, r2->points[r2i].y, r2->z},
+												{r2->points[r2j].x, r2->points[r2j].y, r2->z},
+												{r1->points[r1i % fragments].x, r1->points[r1i % fragments].y, r1->z}});
+				r2i++;
+			}
+		}
+	}
+
+	Polygon bottom;
+	bottom.reserve(fragments);
+	for (int i = fragments - 1; i >= 0; i--) {
+		bottom.emplace_back(ring[rings-1].points[i].x,
+												ring[rings-1].points[i].y,
+												ring[rings-1].z);
+	}
+	p->append_poly(std::move(bottom));
+
+	if (fragments >= smooth_fragments) {
+		PolySet::Shape shape;
+		shape.type = PolySet::Shape::Type::SPHERE;
+		shape.r1 = r1;
+		p->setShape(shape);
+	}
+	return p;
+}
+
+static PolySet *generate_cylinder(double r1, double r2, double z1, double z2, int fragments)
+{
+	auto p = new PolySet(3,true);
+	auto circle1 = std::vector<point2d>(fragments);
+	auto circle2 = std::vector<point2d>(fragments);
+
+	generate_circle(circle1.data(), r1, fragments);
+	generate_circle(circle2.data(), r2, fragments);
+
+	p->reserve(size_t(fragments) * (r1 == r2 ? 1 : (r1 > 0) + (r2 > 0)) + (r1 > 0) + (r2 > 0));
+	for (int i=0; i<fragments; i++) {
+		int j = (i+1) % fragments;
+		if (r1 == r2) {
+			p->append_poly({{circle1[j].x, circle1[j].y, z1},
+											{circle2[j].x, circle2[j].y, z2},
+											{circle2[i].x, circle2[i].y, z2},
+											{circle1[i].x, circle1[i].y, z1}});
+		} else {
+			if (r1 > 0) {
+				p->append_poly({{circle1[j].x, circle1[j].y, z1},
+												{circle2[i].x, circle2[i].y, z2},
+												{circle1[i].x, circle1[i].y, z1}});
+			}
+			if (r2 > 0) {
+				p->append_poly({{circle1[j].x, circle1[j].y, z1},
+												{circle2[j].x, circle2[j].y, z2},
+												{circle2[i].x, circle2[i].y, z2}});
+			}
+		}
+	}
+
+	if (r1 > 0) {
+		Polygon bottom;
+		bottom.reserve(fragments);
+		for (int i=fragments-1; i>=0; i--)
+			bottom.emplace_back(circle1[i].x, circle1[i].y, z1);
+		p->append_poly(std::move(bottom));
+	}
+
+	if (r2 > 0) {
+		Polygon top;
+		top.reserve(fragments);
+		for (int i=0; i<fragments; i++)
+			top.emplace_back(circle2[i].x, circle2[i].y, z2);
+		p->append_poly(std::move(top));
+	}
+
+	if (r1 == r2 || fragments >= smooth_fragments) {
+		PolySet::Shape shape;
+		shape.type = r1 == r2 ? PolySet::Shape::Type::PRISM : PolySet::Shape::Type::CONE;
+		shape.r1 = r1;
+		shape.r2 = r2;
+		shape.z1 = z1;
+		shape.z2 = z2;
+		shape.sides = fragments;
+		p->setShape(shape);
+	}
+	return p;
+}
+
+/*!
+	Meshes of unit spheres and cylinders, by their kind and fragment count.
+	Primitives only differing in size share one, as an instance scaled to
+	their size, so e.g. a lattice of small spheres generates one mesh.
+*/
+static ShardedCache<std::string, shared_ptr<const PolySet>> unit_meshes(20*1024*1024);
+
+static shared_ptr<const PolySet> unit_mesh(const std::string &key, const std::function<PolySet *()> &generate)
+{
+	shared_ptr<const PolySet> ps;
+	if (!unit_meshes.get(key, ps)) {
+		ps.reset(generate());
+		unit_meshes.insert(key, ps, ps->memsize());
+	}
+	return ps;
+}
+
 /*!
 	Creates geometry for this node.
 	May return an empty Geometry creation failed, but will not return nullptr.
@@ -381,190 +542,99 @@ const Geometry *PrimitiveNode::createGeometry() const
 				z2 = this->z;
 			}
 
-			p->append_poly(); // top
-			p->append_vertex(x1, y1, z2);
-			p->append_vertex(x2, y1, z2);
-			p->append_vertex(x2, y2, z2);
-			p->append_vertex(x1, y2, z2);
-
-			p->append_poly(); // bottom
-			p->append_vertex(x1, y2, z1);
-			p->append_vertex(x2, y2, z1);
-			p->append_vertex(x2, y1, z1);
-			p->append_vertex(x1, y1, z1);
-
-			p->append_poly(); // side1
-			p->append_vertex(x1, y1, z1);
-			p->append_vertex(x2, y1, z1);
-			p->append_vertex(x2, y1, z2);
-			p->append_vertex(x1, y1, z2);
-
-			p->append_poly(); // side2
-			p->append_vertex(x2, y1, z1);
-			p->append_vertex(x2, y2, z1);
-			p->append_vertex(x2, y2, z2);
-			p->append_vertex(x2, y1, z2);
-
-			p->append_poly(); // side3
-			p->append_vertex(x2, y2, z1);
-			p->append_vertex(x1, y2, z1);
-			p->append_vertex(x1, y2, z2);
-			p->append_vertex(x2, y2, z2);
-
-			p->append_poly(); // side4
-			p->append_vertex(x1, y2, z1);
-			p->append_vertex(x1, y1, z1);
-			p->append_vertex(x1, y1, z2);
-			p->append_vertex(x1, y2, z2);
+			p->reserve(6);
+			p->append_poly({{x1, y1, z2}, {x2, y1, z2}, {x2, y2, z2}, {x1, y2, z2}}); // top
+			p->append_poly({{x1, y2, z1}, {x2, y2, z1}, {x2, y1, z1}, {x1, y1, z1}}); // bottom
+			p->append_poly({{x1, y1, z1}, {x2, y1, z1}, {x2, y1, z2}, {x1, y1, z2}}); // side1
+			p->append_poly({{x2, y1, z1}, {x2, y2, z1}, {x2, y2, z2}, {x2, y1, z2}}); // side2
+			p->append_poly({{x2, y2, z1}, {x1, y2, z1}, {x1, y2, z2}, {x2, y2, z2}}); // side3
+			p->append_poly({{x1, y2, z1}, {x1, y1, z1}, {x1, y1, z2}, {x1, y2, z2}}); // side4
+
+			PolySet::Shape shape;
+			shape.type = PolySet::Shape::Type::BOX;
+			shape.min = Vector3d(x1, y1, z1);
+			shape.max = Vector3d(x2, y2, z2);
+			p->setShape(shape);
 		}
 	}
 		break;
 	case primitive_type_e::SPHERE: {
-		auto p = new PolySet(3,true);
-		g = p;
 		if (this->r1 > 0 && !std::isinf(this->r1)) {
-			struct ring_s {
-				std::vector<point2d> points;
-				double z;
-			};
-
-			auto fragments = Calc::get_fragments_from_r(r1, fn, fs, fa);
-			int rings = (fragments+1)/2;
-// Uncomment the following three lines to enable experimental sphere tesselation
-//		if (rings % 2 == 0) rings++; // To ensure that the middle ring is at phi == 0 degrees
-
-			auto ring = std::vector<ring_s>(rings);
-
-//		double offset = 0.5 * ((fragments / 2) % 2);
-			for (int i = 0; i < rings; i++) {
-//			double phi = (180.0 * (i + offset)) / (fragments/2);
-				double phi = (180.0 * (i + 0.5)) / rings;
-				double r = r1 * sin_degrees(phi);
-				ring[i].z = r1 * cos_degrees(phi);
-				ring[i].points.resize(fragments);
-				generate_circle(ring[i].points.data(), r, fragments);
-			}
-
-			p->append_poly();
-			for (int i = 0; i < fragments; i++)
-				p->append_vertex(ring[0].points[i].x, ring[0].points[i].y, ring[0].z);
-
-			for (int i = 0; i < rings-1; i++) {
-				auto r1 = &ring[i];
-				auto  r2 = &ring[i+1];
-				int r1i = 0, r2i = 0;
-				while (r1i < fragments || r2i < fragments) {
-					if (r1i >= fragments) goto sphere_next_r2;
-					if (r2i >= fragments) goto sphere_next_r1;
-					if ((double)r1i / fragments < (double)r2i / fragments) {
-					sphere_next_r1:
-						p->append_poly();
-						int r1j = (r1i+1) % fragments;
-						p->insert_vertex(r1->points[r1i].x, r1->points[r1i].y, r1->z);
-						p->insert_vertex(r1->points[r1j].x, r1->points[r1j].y, r1->z);
-						p->insert_vertex(r2->points[r2i % fragments].x, r2->points[r2i % fragments].y, r2->z);
-						r1i++;
-					} else {
-					sphere_next_r2:
-						p->append_poly();
-						int r2j = (r2i+1) % fragments;
-						p->append_vertex(r2->points[r2i].x, r2->points[r2i].y, r2->z);
-						p->append_vertex(r2->points[r2j].x, r2->points[r2j].y, r2->z);
-						p->append_vertex(r1->points[r1i % fragments].x, r1->points[r1i % fragments].y, r1->z);
-						r2i++;
-					}
-				}
-			}
-
-			p->append_poly();
-			for (int i = 0; i < fragments; i++) {
-				p->insert_vertex(ring[rings-1].points[i].x, 
-												 ring[rings-1].points[i].y, 
-												 ring[rings-1].z);
-			}
+			const auto fragments = Calc::get_fragments_from_r(r1, fn, fs, fa);
+			const auto unit = unit_mesh(STR("sphere " << fragments), [fragments]() {
+				return generate_sphere(1, fragments);
+			});
+			g = new InstancedPolySet(unit, Transform3d(Eigen::Scaling(this->r1)));
+		}
+		else {
+			g = new PolySet(3,true);
 		}
 	}
 		break;
 	case primitive_type_e::CYLINDER: {
-		auto p = new PolySet(3,true);
-		g = p;
 		if (this->h > 0 && !std::isinf(this->h) &&
 				this->r1 >=0 && this->r2 >= 0 && (this->r1 > 0 || this->r2 > 0) &&
 				!std::isinf(this->r1) && !std::isinf(this->r2)) {
-			auto fragments = Calc::get_fragments_from_r(std::fmax(this->r1, this->r2), this->fn, this->fs, this->fa);
-
-			double z1, z2;
-			if (this->center) {
-				z1 = -this->h/2;
-				z2 = +this->h/2;
-			} else {
-				z1 = 0;
-				z2 = this->h;
+			const auto fragments = Calc::get_fragments_from_r(std::fmax(this->r1, this->r2), this->fn, this->fs, this->fa);
+
+			// Cylinders and cones are scaled unit meshes, other frustums are generated
+			if (this->r1 == this->r2 || this->r1 == 0 || this->r2 == 0) {
+				const double u1 = this->r1 > 0 ? 1 : 0, u2 = this->r2 > 0 ? 1 : 0;
+				const bool center = this->center;
+				const auto unit = unit_mesh(STR("cylinder " << fragments << " " << u1 << " " << u2 << " " << center), [=]() {
+					return center ? generate_cylinder(u1, u2, -0.5, 0.5, fragments) : generate_cylinder(u1, u2, 0, 1, fragments);
+				});
+				const double r = std::fmax(this->r1, this->r2);
+				g = new InstancedPolySet(unit, Transform3d(Eigen::Scaling(r, r, this->h)));
 			}
-
-			auto circle1 = std::vector<point2d>(fragments);
-			auto circle2 = std::vector<point2d>(fragments);
-
-			generate_circle(circle1.data(), r1, fragments);
-			generate_circle(circle2.data(), r2, fragments);
-		
-			for (int i=0; i<fragments; i++) {
-				int j = (i+1) % fragments;
-				if (r1 == r2) {
-					p->append_poly();
-					p->insert_vertex(circle1[i].x, circle1[i].y, z1);
-					p->insert_vertex(circle2[i].x, circle2[i].y, z2);
-					p->insert_vertex(circle2[j].x, circle2[j].y, z2);
-					p->insert_vertex(circle1[j].x, circle1[j].y, z1);
-				} else {
-					if (r1 > 0) {
-						p->append_poly();
-						p->insert_vertex(circle1[i].x, circle1[i].y, z1);
-						p->insert_vertex(circle2[i].x, circle2[i].y, z2);
-						p->insert_vertex(circle1[j].x, circle1[j].y, z1);
-					}
-					if (r2 > 0) {
-						p->append_poly();
-						p->insert_vertex(circle2[i].x, circle2[i].y, z2);
-						p->insert_vertex(circle2[j].x, circle2[j].y, z2);
-						p->insert_vertex(circle1[j].x, circle1[j].y, z1);
-					}
-				}
+			else if (this->center) {
+				g = generate_cylinder(this->r1, this->r2, -this->h/2, +this->h/2, fragments);
 			}
-
-			if (this->r1 > 0) {
-				p->append_poly();
-				for (int i=0; i<fragments; i++)
-					p->insert_vertex(circle1[i].x, circle1[i].y, z1);
-			}
-
-			if (this->r2 > 0) {
-				p->append_poly();
-				for (int i=0; i<fragments; i++)
-					p->append_vertex(circle2[i].x, circle2[i].y, z2);
+			else {
+				g = generate_cylinder(this->r1, this->r2, 0, this->h, fragments);
 			}
 		}
+		else {
+			g = new PolySet(3,true);
+		}
 	}
 		break;
 	case primitive_type_e::POLYHEDRON: {
 		auto p = new PolySet(3);
 		g = p;
 		p->setConvexity(this->convexity);
+		p->reserve(this->faces->toVector().size());
+
+		// Unbox every point once, instead of once per face referring to it
+		const auto &points = this->points->toVector();
+		std::vector<Vector3d> vertices(points.size());
+		std::vector<bool> valid(points.size());
+		for (size_t i=0; i<points.size(); i++) {
+			double px, py, pz;
+			valid[i] = points[i]->getVec3(px, py, pz, 0.0) &&
+				std::isfinite(px) && std::isfinite(py) && std::isfinite(pz);
+			if (valid[i]) vertices[i] = Vector3d(px, py, pz);
+		}
+
 		for (size_t i=0; i<this->faces->toVector().size(); i++)	{
-			p->append_poly();
 			const auto &vec = this->faces->toVector()[i]->toVector();
+			// Faces are given counter-clockwise, PolySet faces are clockwise
+			Polygon face;
+			face.reserve(vec.size());
 			for (size_t j=0; j<vec.size(); j++) {
 				size_t pt = (size_t)vec[j]->toDouble();
-				if (pt < this->points->toVector().size()) {
-					double px, py, pz;
-					if (!this->points->toVector()[pt]->getVec3(px, py, pz, 0.0) ||
-					    !std::isfinite(px) || !std::isfinite(py) || !std::isfinite(pz)) {
+				if (pt < points.size()) {
+					if (!valid[pt]) {
 						PRINTB("ERROR: Unable to convert point at index %d to a vec3 of numbers, %s", j % this->modinst->location().toRelativeString(this->document_path));
+						std::reverse(face.begin(), face.end());
+						p->append_poly(std::move(face));
 						return p;
 					}
-					p->insert_vertex(px, py, pz);
+					face.push_back(vertices[pt]);
 				}
 			}
+			std::reverse(face.begin(), face.end());
+			p->append_poly(std::move(face));
 		}
 	}
 		break;
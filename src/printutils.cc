@@ -1,6 +1,7 @@
 #include "printutils.h"
 #include <sstream>
 #include <stdio.h>
+#include <mutex>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/circular_buffer.hpp>
@@ -23,6 +24,66 @@ boost::circular_buffer<std::string> lastmessages(5);
 namespace {
 	bool no_throw;
 	bool deferred;
+	// Serializes output and the message stack when evaluating on multiple threads
+	std::recursive_mutex print_mutex;
+	thread_local PrintCapture *current_capture = nullptr;
+	thread_local size_t printed_messages = 0;
+}
+
+size_t printedMessageCount()
+{
+	return printed_messages;
+}
+
+PrintCapture::Scope::Scope(PrintCapture &capture) : outer(current_capture)
+{
+	current_capture = &capture;
+}
+
+PrintCapture::Scope::~Scope()
+{
+	current_capture = this->outer;
+}
+
+/*!
+	Records msg in the capture active on this thread, if any.
+	Returns false if nothing is captured.
+*/
+bool PrintCapture::record(Kind kind, const std::string &msg)
+{
+	if (!current_capture) return false;
+	current_capture->messages.emplace_back(kind, msg);
+	if (kind != Kind::DEPRECATION && !std::current_exception() && !no_throw &&
+			OpenSCAD::hardwarnings && boost::starts_with(msg, "WARNING")) {
+		throw HardWarningException(msg);
+	}
+	return true;
+}
+
+void PrintCapture::replay() const
+{
+	for (const auto &m : this->messages) {
+		switch (m.first) {
+		case Kind::CACHED: PRINT(m.second); break;
+		case Kind::NOCACHE: PRINT_NOCACHE(m.second); break;
+		case Kind::DEPRECATION: printDeprecation(m.second); break;
+		}
+	}
+}
+
+namespace {
+	void (*localization_handler)() = nullptr;
+	std::once_flag localization_once;
+}
+
+void set_localization_handler(void (*handler)())
+{
+	localization_handler = handler;
+}
+
+void localize()
+{
+	if (localization_handler) std::call_once(localization_once, localization_handler);
 }
 
 void set_output_handler(OutputHandlerFunc *newhandler, void *userdata)
@@ -48,11 +109,13 @@ bool would_have_thrown()
 
 void print_messages_push()
 {
+	std::lock_guard<std::recursive_mutex> lock(print_mutex);
 	print_messages_stack.push_back(std::string());
 }
 
 void print_messages_pop()
 {
+	std::lock_guard<std::recursive_mutex> lock(print_mutex);
 	std::string msg = print_messages_stack.back();
 	print_messages_stack.pop_back();
 	if (print_messages_stack.size() > 0 && !msg.empty()) {
@@ -66,6 +129,9 @@ void print_messages_pop()
 void PRINT(const std::string &msg)
 {
 	if (msg.empty()) return;
+	printed_messages++;
+	if (PrintCapture::record(PrintCapture::Kind::CACHED, msg)) return;
+	std::lock_guard<std::recursive_mutex> lock(print_mutex);
 	if (print_messages_stack.size() > 0) {
 		if (!print_messages_stack.back().empty()) {
 			print_messages_stack.back() += "\n";
@@ -78,6 +144,9 @@ void PRINT(const std::string &msg)
 void PRINT_NOCACHE(const std::string &msg)
 {
 	if (msg.empty()) return;
+	printed_messages++;
+	if (PrintCapture::record(PrintCapture::Kind::NOCACHE, msg)) return;
+	std::lock_guard<std::recursive_mutex> lock(print_mutex);
 
 	if (boost::starts_with(msg, "WARNING") || boost::starts_with(msg, "ERROR") || boost::starts_with(msg, "TRACE")) {
 		size_t i;
@@ -143,6 +212,8 @@ std::set<std::string> printedDeprecations;
 
 void printDeprecation(const std::string &str)
 {
+	printed_messages++;
+	if (PrintCapture::record(PrintCapture::Kind::DEPRECATION, str)) return;
 	if (printedDeprecations.find(str) == printedDeprecations.end()) {
 		printedDeprecations.insert(str);
 		std::string msg = "DEPRECATED: " + str;
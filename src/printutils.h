@@ -2,14 +2,23 @@
 
 #include <string>
 #include <list>
+#include <utility>
+#include <vector>
 #include <iostream>
 #include <boost/format.hpp>
 
 #include <libintl.h>
 #undef snprintf
 #include <locale.h>
-inline char * _( const char * msgid ) { return gettext( msgid ); }
+
+// Sets the function which binds the message catalog, to be run on the first
+// translation rather than at startup, for runs which may translate nothing
+void set_localization_handler(void (*handler)());
+void localize();
+
+inline char * _( const char * msgid ) { localize(); return gettext( msgid ); }
 inline const char * _( const char * msgid, const char *msgctxt) {
+	localize();
 	/* The separator between msgctxt and msgid in a .mo file.  */
 	const char* GETTEXT_CONTEXT_GLUE = "\004";
 
@@ -44,6 +53,43 @@ void print_messages_push();
 void print_messages_pop();
 void printDeprecation(const std::string &str);
 void resetSuppressedMessages();
+// Number of messages the current thread has printed so far
+size_t printedMessageCount();
+
+/*!
+	Collects the messages printed by a thread, instead of outputting them,
+	while a PrintCapture::Scope is alive on that thread. Used to evaluate
+	on several threads and still report messages in serial order: each
+	piece of work prints into its own capture, and the captures are
+	replayed in order afterwards by the thread owning the work.
+
+	Warnings which would throw with hardwarnings still throw while capturing.
+*/
+class PrintCapture
+{
+public:
+	class Scope
+	{
+	public:
+		Scope(PrintCapture &capture);
+		~Scope();
+	private:
+		PrintCapture *outer;
+	};
+
+	bool empty() const { return this->messages.empty(); }
+	void replay() const;
+
+private:
+	friend void PRINT(const std::string &msg);
+	friend void PRINT_NOCACHE(const std::string &msg);
+	friend void printDeprecation(const std::string &str);
+
+	enum class Kind { CACHED, NOCACHE, DEPRECATION };
+	static bool record(Kind kind, const std::string &msg);
+
+	std::vector<std::pair<Kind, std::string>> messages;
+};
 
 #define PRINT_DEPRECATION(_fmt, _arg) do { printDeprecation(str(boost::format(_fmt) % _arg)); } while (0)
 
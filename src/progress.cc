@@ -1,15 +1,25 @@
 #include "progress.h"
 #include "node.h"
+#include "JobLimits.h"
 
-int progress_report_count;
-void (*progress_report_f)(const class AbstractNode*, void*, int);
+#include <algorithm>
+
+std::atomic<int> progress_report_count{0};
+void (*progress_report_f)(const class AbstractNode*, void*, double);
 void *progress_report_userdata;
+static void (*progress_cancel_f)(void *);
+static void *progress_cancel_userdata;
+
+// The mark last reported on this thread. Nodes are numbered in postfix
+// order, so while a node is being evaluated this is the mark of its last child.
+static thread_local int progress_last_mark = 0;
 
-void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata)
+void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, double mark), void *userdata)
 {
 	progress_report_count = 0;
 	progress_report_f = f;
 	progress_report_userdata = userdata;
+	progress_last_mark = 0;
 	root->progress_prepare();
 }
 
@@ -22,7 +32,44 @@ void progress_report_fin()
 
 void progress_update(const AbstractNode *node, int mark)
 {
+	progress_last_mark = mark;
+	JobLimits::check();
 	if (progress_report_f)
 		progress_report_f(node, progress_report_userdata, mark);
 }
 
+/*!
+	Reports progress from within a single long operation, e.g. a CGAL
+	boolean, which has done the given fraction of its work. The mark
+	reported lies between those of the node's last child and the node, and
+	no node is given. Like progress_update(), this may throw
+	ProgressCancelException from the callback.
+*/
+void progress_tick(double fraction)
+{
+	JobLimits::check();
+	if (progress_report_f)
+		progress_report_f(nullptr, progress_report_userdata, progress_last_mark + std::min(std::max(fraction, 0.0), 1.0));
+}
+
+void progress_cancel_prep(void (*f)(void *userdata), void *userdata)
+{
+	progress_cancel_f = f;
+	progress_cancel_userdata = userdata;
+}
+
+void progress_cancel_fin()
+{
+	progress_cancel_f = nullptr;
+	progress_cancel_userdata = nullptr;
+}
+
+/*!
+	Lets work which has no nodes to report progress on yet, like the
+	instantiation of the tree, be cancelled as well. Called on any thread.
+*/
+void progress_check_cancel()
+{
+	JobLimits::checkpoint();
+	if (progress_cancel_f) progress_cancel_f(progress_cancel_userdata);
+}
@@ -1,13 +1,22 @@
 #pragma once
 
-// Reset to 0 in _prep() and increased for each Node instance in progress_prepare()
-extern int progress_report_count;
+#include <atomic>
 
-extern void (*progress_report_f)(const class AbstractNode*, void*, int);
+// Reset to 0 in _prep() and increased for each Node instance in progress_prepare().
+// Read by the report callback, which may run on worker threads.
+extern std::atomic<int> progress_report_count;
+
+extern void (*progress_report_f)(const class AbstractNode*, void*, double);
 extern void *progress_report_userdata;
 
-void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, int mark), void *userdata);
+void progress_report_prep(AbstractNode *root, void (*f)(const class AbstractNode *node, void *userdata, double mark), void *userdata);
 void progress_report_fin();
 void progress_update(const AbstractNode *node, int mark);
+void progress_tick(double fraction);
+
+// While set, progress_check_cancel() calls f, which may throw ProgressCancelException
+void progress_cancel_prep(void (*f)(void *userdata), void *userdata);
+void progress_cancel_fin();
+void progress_check_cancel();
 
 class ProgressCancelException { };
@@ -5,6 +5,11 @@
 #include "Polygon2d.h"
 #include "colormap.h"
 #include "printutils.h"
+#include "LODCache.h"
+#include "csgnode.h"
+#ifndef NULLGL
+#include "VBOCache.h"
+#endif
 
 bool Renderer::getColor(Renderer::ColorMode colormode, Color4f &col) const
 {
@@ -22,7 +27,7 @@ Renderer::csgmode_e Renderer::get_csgmode(const bool highlight_mode, const bool
     return csgmode_e(csgmode);
 }
 
-Renderer::Renderer() : colorscheme(nullptr)
+Renderer::Renderer() : colorscheme(nullptr), refine_budget(0)
 {
 	PRINTD("Renderer() start");
 	// Setup default colors
@@ -109,13 +114,45 @@ void Renderer::setColorScheme(const ColorScheme &cs) {
 
 void Renderer::render_surface(shared_ptr<const Geometry> geom, csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo)
 {
-	auto ps = dynamic_pointer_cast<const PolySet>(geom);
-	if (ps) ps->render_surface(csgmode, m, shaderinfo);
+	auto ps = geometry_cast<const PolySet>(geom);
+	if (!ps) return;
+	ps = LODCache::instance()->lookup(ps);
+#ifndef NULLGL
+	if (VBOCache::instance()->renderSurface(ps, csgmode, m, shaderinfo)) return;
+#endif
+	ps->render_surface(csgmode, m, shaderinfo);
 }
 
 void Renderer::render_edges(shared_ptr<const Geometry> geom, csgmode_e csgmode)
 {
-	auto ps = dynamic_pointer_cast<const PolySet>(geom);
-	if (ps) ps->render_edges(csgmode);
+	auto ps = geometry_cast<const PolySet>(geom);
+	if (!ps) return;
+	ps = LODCache::instance()->lookup(ps);
+#ifndef NULLGL
+	if (VBOCache::instance()->renderEdges(ps, csgmode)) return;
+#endif
+	ps->render_edges(csgmode);
 }
 
+
+void Renderer::draw_ids(const CSGProducts &products, bool highlight_mode, bool background_mode,
+												std::vector<shared_ptr<const CSGLeaf>> &leaves)
+{
+#ifndef NULLGL
+	for (const auto &product : products.products) {
+		for (const auto type : {OpenSCADOperator::INTERSECTION, OpenSCADOperator::DIFFERENCE}) {
+			const auto csgmode = get_csgmode(highlight_mode, background_mode, type);
+			for (const auto &csgobj : type == OpenSCADOperator::DIFFERENCE ? product.subtractions : product.intersections) {
+				const auto id = leaves.size() + 1;
+				if (id > 0xffffff) return;
+				leaves.push_back(csgobj.leaf);
+				glColor3ub(id & 0xff, (id >> 8) & 0xff, (id >> 16) & 0xff);
+				glPushMatrix();
+				glMultMatrixd(csgobj.leaf->matrix.data());
+				render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix);
+				glPopMatrix();
+			}
+		}
+	}
+#endif
+}
@@ -5,6 +5,7 @@
 #include "memory.h"
 #include "colormap.h"
 #include "enums.h"
+#include <vector>
 
 #ifdef _MSC_VER // NULL
 #include <cstdlib>
@@ -17,6 +18,18 @@ public:
 	virtual ~Renderer() {}
 	virtual void draw(bool showfaces, bool showedges) const = 0;
 	virtual BoundingBox getBoundingBox() const = 0;
+	// For picking: draws each object flat, in the color of its id, i.e. its
+	// index in leaves + 1 as 24 bit RGB. Lighting must be off.
+	virtual void drawIds(std::vector<shared_ptr<const class CSGLeaf>> &leaves) const {}
+	/*!
+		Progressive drawing: with a budget, draw() spends only about that
+		many seconds per frame on objects it hasn't drawn in full since the
+		camera last changed, and draws the others coarsely. isRefined() tells
+		whether the last frame was complete; if not, each further frame
+		refines it. A budget of 0 always draws everything in full.
+	*/
+	void setRefineBudget(double seconds) { this->refine_budget = seconds; }
+	virtual bool isRefined() const { return true; }
 	
 #define CSGMODE_DIFFERENCE_FLAG 0x10
 	enum csgmode_e {
@@ -51,8 +64,11 @@ public:
 	static csgmode_e get_csgmode(const bool highlight_mode, const bool background_mode, const OpenSCADOperator type=OpenSCADOperator::UNION);
 	static void render_surface(shared_ptr<const class Geometry> geom, csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo = nullptr);
 	static void render_edges(shared_ptr<const Geometry> geom, csgmode_e csgmode);
+	static void draw_ids(const class CSGProducts &products, bool highlight_mode, bool background_mode,
+											 std::vector<shared_ptr<const CSGLeaf>> &leaves);
 
 protected:
 	std::map<ColorMode,Color4f> colormap;
 	const ColorScheme *colorscheme;
+	double refine_budget;
 };
@@ -238,6 +238,13 @@ void ScintillaEditor::highlightError(int error_pos)
 	qsci->markerAdd(line, markerNumber);
 }
 
+void ScintillaEditor::setCursorPosition(int line, int col)
+{
+	qsci->setCursorPosition(line, col);
+	qsci->ensureLineVisible(line);
+	qsci->setFocus();
+}
+
 void ScintillaEditor::unhighlightLastError()
 {
 	auto totalLength = qsci->text().length();
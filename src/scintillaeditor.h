@@ -82,6 +82,7 @@ public slots:
 	bool isContentModified() override;
 	void highlightError(int) override;
 	void unhighlightLastError() override;
+	void setCursorPosition(int line, int col) override;
 	void setHighlightScheme(const QString&) override;
 	void indentSelection() override;
 	void unindentSelection() override;
@@ -1,22 +1,35 @@
 #pragma once
 
+#include <atomic>
 #include <cstdlib>
 #include "PlatformUtils.h"
 
+// Pool threads are created with the platform's default thread stack size,
+// which can be as small as 512KB
+#define THREAD_STACK_LIMIT (384 * 1024)
+
 class StackCheck
 {
 public:
+	/*!
+		Each thread measures its own stack. The first thread asking is the main
+		thread (see main()), which gets the limit of the process stack; other
+		threads get a conservative limit.
+	*/
 	static StackCheck &inst()
 	{
-		static StackCheck instance;
+		static std::atomic<bool> first(true);
+		thread_local StackCheck instance(first.exchange(false) ? PlatformUtils::stackLimit() : THREAD_STACK_LIMIT);
 		return instance;
 	}
 
 	~StackCheck() {}
 	inline bool check() { return size() >= limit; }
+	// For threads created with a larger stack; must be called near the bottom of their stack
+	void setLimit(unsigned long limit) { this->limit = limit; }
 
 private:
-	StackCheck() : limit(PlatformUtils::stackLimit()) {
+	StackCheck(unsigned long limit) : limit(limit) {
 		unsigned char c;
 		ptr = &c;
 	}
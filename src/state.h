@@ -9,7 +9,7 @@ class State
 {
 public:
   State(const class AbstractNode *parent) 
-    : flags(NONE), parentnode(parent), numchildren(0) {
+    : flags(NONE), parentnode(parent), numchildren(0), start(0) {
 		this->matrix_ = Transform3d::Identity();
 		this->color_.fill(-1.0f);
 	}
@@ -25,6 +25,10 @@ public:
 	void setColor(const Color4f &c) { this->color_ = c; }
 	void setPreferNef(bool on) { FLAG(this->flags, PREFERNEF, on); }
 	bool preferNef() const { return this->flags & PREFERNEF; }
+	// When the prefix visit of the node began, in RenderProfile::now() time,
+	// if the visitor times nodes (see NodeVisitor::timesNodes()), else 0
+	void setStartTime(double t) { this->start = t; }
+	double startTime() const { return this->start; }
 
   bool isPrefix() const { return this->flags & PREFIX; }
   bool isPostfix() const { return this->flags & POSTFIX; }
@@ -48,6 +52,7 @@ private:
 	unsigned int flags;
   const AbstractNode * parentnode;
   unsigned int numchildren;
+	double start;
 
 	// Transformation matrix and color. FIXME: Generalize such state variables?
 	Transform3d matrix_;
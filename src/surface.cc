@@ -27,6 +27,7 @@
 #include "module.h"
 #include "ModuleInstantiation.h"
 #include "node.h"
+#include "NodeVisitor.h"
 #include "polyset.h"
 #include "evalcontext.h"
 #include "builtin.h"
@@ -35,17 +36,14 @@
 #include "handle_dep.h"
 #include "ext/lodepng/lodepng.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <array>
+#include <cstring>
 #include <sstream>
-#include <fstream>
-#include <unordered_map>
-#include <boost/functional/hash.hpp>
-#include <boost/tokenizer.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string.hpp>
-#include <boost/assign/std/vector.hpp>
-using namespace boost::assign; // bring 'operator+=()' into scope
+#include <vector>
+#include <boost/spirit/include/qi.hpp>
+namespace qi = boost::spirit::qi;
 
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
@@ -57,35 +55,50 @@ public:
 	AbstractNode *instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const override;
 };
 
-typedef std::unordered_map<std::pair<int,int>, double, boost::hash<std::pair<int,int>>> img_data_t;
+/*!
+	The heights of a surface, one row after the other. Rows which are
+	shorter than the longest one are padded with zeros.
+*/
+struct img_data_t
+{
+	int lines = 0;
+	int columns = 0;
+	double min_val = 0; // the bottom of the surface, below all heights
+	std::vector<double> z;
+
+	double operator()(int line, int column) const { return z[size_t(line) * columns + column]; }
+};
 
 class SurfaceNode : public LeafNode
 {
 public:
 	VISITABLE();
-	SurfaceNode(const ModuleInstantiation *mi) : LeafNode(mi), center(false), invert(false), convexity(1) { }
+	SurfaceNode(const ModuleInstantiation *mi) : LeafNode(mi), center(false), invert(false), simplify(false), convexity(1) { }
 	std::string toString() const override;
 	std::string name() const override { return "surface"; }
 
 	Filename filename;
 	bool center;
 	bool invert;
+	bool simplify;
 	int convexity;
 	
 	const Geometry *createGeometry() const override;
 private:
 	void convert_image(img_data_t &data, std::vector<uint8_t> &img, unsigned int width, unsigned int height) const;
 	bool is_png(std::vector<uint8_t> &img) const;
-	img_data_t read_dat(std::string filename) const;
+	img_data_t read_dat(const std::vector<uint8_t> &text, const std::string &filename) const;
 	img_data_t read_png_or_dat(std::string filename) const;
 };
 
+DEFINE_VISITABLE(SurfaceNode)
+
 AbstractNode *SurfaceModule::instantiate(const Context *ctx, const ModuleInstantiation *inst, EvalContext *evalctx) const
 {
 	auto node = new SurfaceNode(inst);
 
 	AssignmentList args{Assignment("file"), Assignment("center"), Assignment("convexity")};
-	AssignmentList optargs{Assignment("center"),Assignment("invert")};
+	AssignmentList optargs{Assignment("center"),Assignment("invert"),Assignment("simplify")};
 
 	Context c(ctx);
 	c.setVariables(evalctx, args, optargs);
@@ -110,17 +123,27 @@ AbstractNode *SurfaceModule::instantiate(const Context *ctx, const ModuleInstant
 		node->invert = invert->toBool();
 	}
 
+	auto simplify = c.lookup_variable("simplify", true);
+	if (simplify->type() == Value::ValueType::BOOL) {
+		node->simplify = simplify->toBool();
+	}
+
 	return node;
 }
 
 void SurfaceNode::convert_image(img_data_t &data, std::vector<uint8_t> &img, unsigned int width, unsigned int height) const
 {
+	data.lines = height;
+	data.columns = width;
+	data.z.resize(size_t(width) * height);
 	for (unsigned int y = 0;y < height;y++) {
+		auto row = &data.z[size_t(height - 1 - y) * width];
 		for (unsigned int x = 0;x < width;x++) {
-			long idx = 4 * (y * width + x);
+			size_t idx = 4 * (size_t(y) * width + x);
 			double pixel = 0.2126 * img[idx] + 0.7152 * img[idx + 1] + 0.0722 * img[idx + 2];
 			double z = 100.0/255 * (invert ? 1 - pixel : pixel);
-			data[std::make_pair(height - 1 - y, x)] = z;
+			row[x] = z;
+			data.min_val = std::min(z - 1, data.min_val);
 		}
 	}
 }
@@ -151,8 +174,7 @@ img_data_t SurfaceNode::read_png_or_dat(std::string filename) const
 	}
 	
 	if (!is_png(png)) {
-		png.clear();
-		return read_dat(filename);
+		return read_dat(png, filename);
 	}
 	
 	unsigned int width, height;
@@ -160,150 +182,162 @@ img_data_t SurfaceNode::read_png_or_dat(std::string filename) const
 	auto error = lodepng::decode(img, width, height, png);
 	if (error) {
 		PRINTB("ERROR: Can't read PNG image '%s'", filename);
-		data.clear();
 		return data;
 	}
+	png.clear();
+	png.shrink_to_fit();
 	
 	convert_image(data, img, width, height);
 	
 	return data;
 }
 
-img_data_t SurfaceNode::read_dat(std::string filename) const
+/*!
+	Parses the rows of numbers of a DAT file, skipping empty lines and #
+	comments. Reading stops at the first illegal value.
+*/
+img_data_t SurfaceNode::read_dat(const std::vector<uint8_t> &text, const std::string &filename) const
 {
 	img_data_t data;
-	std::ifstream stream(filename.c_str());
-
-	if (!stream.good()) {
-		PRINTB("WARNING: Can't open DAT file '%s'.", filename);
-		return data;
-	}
-
-	int lines = 0, columns = 0;
-	double min_val = 0;
-
-	typedef boost::tokenizer<boost::char_separator<char>> tokenizer;
-	boost::char_separator<char> sep(" \t");
-
-	while (!stream.eof()) {
-		std::string line;
-		while (!stream.eof() && (line.size() == 0 || line[0] == '#')) {
-			std::getline(stream, line);
-			boost::trim(line);
+	const auto isblank = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; };
+
+	// All values in one array first, the rows are then padded to the same length
+	std::vector<double> values;
+	std::vector<size_t> rowstart;
+	auto p = reinterpret_cast<const char *>(text.data());
+	const auto end = p + text.size();
+	while (p < end) {
+		auto eol = static_cast<const char *>(std::memchr(p, '\n', end - p));
+		if (!eol) eol = end;
+		while (p < eol && isblank(*p)) p++;
+		if (p == eol || *p == '#') {
+			p = eol + 1;
+			continue;
 		}
-		if (line.size() == 0 && stream.eof()) break;
-
-		int col = 0;
-		tokenizer tokens(line, sep);
-		try {
-			for(const auto &token : tokens) {
-				auto v = boost::lexical_cast<double>(token);
-				data[std::make_pair(lines, col++)] = v;
-				if (col > columns) columns = col;
-				min_val = std::min(v-1, min_val);
+
+		rowstart.push_back(values.size());
+		bool illegal = false;
+		while (p < eol) {
+			double v;
+			auto token = p;
+			if (!qi::parse(p, eol, qi::double_, v) || (p < eol && !isblank(*p))) {
+				// Like before, there is no warning for the last line
+				if (eol < end) {
+					while (p < eol && !isblank(*p)) p++;
+					PRINTB("WARNING: Illegal value in '%s': %s", filename % std::string(token, p));
+				}
+				illegal = true;
+				break;
 			}
+			values.push_back(v);
+			data.min_val = std::min(v - 1, data.min_val);
+			while (p < eol && isblank(*p)) p++;
 		}
-		catch (const boost::bad_lexical_cast &blc) {
-			if (!stream.eof()) {
-				PRINTB("WARNING: Illegal value in '%s': %s", filename % blc.what());
-			}
-			break;
-  	}
-		lines++;
+		if (illegal) break;
+		p = eol + 1;
 	}
-	
+
+	data.lines = rowstart.size();
+	rowstart.push_back(values.size());
+	for (int i = 0; i < data.lines; i++) {
+		data.columns = std::max(data.columns, int(rowstart[i + 1] - rowstart[i]));
+	}
+	data.z.resize(size_t(data.lines) * data.columns);
+	for (int i = 0; i < data.lines; i++) {
+		std::copy(values.begin() + rowstart[i], values.begin() + rowstart[i + 1], data.z.begin() + size_t(i) * data.columns);
+	}
+
 	return data;
 }
 
 const Geometry *SurfaceNode::createGeometry() const
 {
-	auto data = read_png_or_dat(filename);
+	const auto data = read_png_or_dat(filename);
 
 	auto p = new PolySet(3);
 	p->setConvexity(convexity);
 	
-	int lines = 0;
-	int columns = 0;
-	double min_val = 0;
-	for (const auto &entry : data) {
-		lines = std::max(lines, entry.first.first + 1);
-		columns = std::max(columns, entry.first.second + 1);
-		min_val = std::min(entry.second - 1, min_val);
-	}
+	const int lines = data.lines;
+	const int columns = data.columns;
+	const double min_val = data.min_val;
 
 	double ox = center ? -(columns-1)/2.0 : 0;
 	double oy = center ? -(lines-1)/2.0 : 0;
 
+	if (lines > 1 && columns > 1) {
+		p->reserve(4 * size_t(lines-1) * (columns-1) + 2 * (lines-1) + 2 * (columns-1) + 1);
+	}
+
 	for (int i = 1; i < lines; i++)
 	for (int j = 1; j < columns; j++)
 	{
-		double v1 = data[std::make_pair(i-1, j-1)];
-		double v2 = data[std::make_pair(i-1, j)];
-		double v3 = data[std::make_pair(i, j-1)];
-		double v4 = data[std::make_pair(i, j)];
+		double v1 = data(i-1, j-1);
+		double v2 = data(i-1, j);
+		double v3 = data(i, j-1);
+		double v4 = data(i, j);
+
+		if (simplify && v1 == v2 && v1 == v3 && v1 == v4) {
+			// A run of flat cells at the same height becomes one face. It keeps
+			// every grid vertex on its outline, so it meets its neighbours' edges.
+			int last = j;
+			while (last + 1 < columns && data(i-1, last+1) == v1 && data(i, last+1) == v1) last++;
+			Polygon flat;
+			flat.reserve(2 * size_t(last - j + 2));
+			for (int k = j-1; k <= last; k++) flat.emplace_back(ox + k, oy + i-1, v1);
+			for (int k = last; k >= j-1; k--) flat.emplace_back(ox + k, oy + i, v1);
+			p->append_poly(std::move(flat));
+			j = last;
+			continue;
+		}
+
 		double vx = (v1 + v2 + v3 + v4) / 4;
 
-		p->append_poly();
-		p->append_vertex(ox + j-1, oy + i-1, v1);
-		p->append_vertex(ox + j, oy + i-1, v2);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
-
-		p->append_poly();
-		p->append_vertex(ox + j, oy + i-1, v2);
-		p->append_vertex(ox + j, oy + i, v4);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
-
-		p->append_poly();
-		p->append_vertex(ox + j, oy + i, v4);
-		p->append_vertex(ox + j-1, oy + i, v3);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
-
-		p->append_poly();
-		p->append_vertex(ox + j-1, oy + i, v3);
-		p->append_vertex(ox + j-1, oy + i-1, v1);
-		p->append_vertex(ox + j-0.5, oy + i-0.5, vx);
+		p->append_poly({{ox + j-1, oy + i-1, v1}, {ox + j, oy + i-1, v2}, {ox + j-0.5, oy + i-0.5, vx}});
+		p->append_poly({{ox + j, oy + i-1, v2}, {ox + j, oy + i, v4}, {ox + j-0.5, oy + i-0.5, vx}});
+		p->append_poly({{ox + j, oy + i, v4}, {ox + j-1, oy + i, v3}, {ox + j-0.5, oy + i-0.5, vx}});
+		p->append_poly({{ox + j-1, oy + i, v3}, {ox + j-1, oy + i-1, v1}, {ox + j-0.5, oy + i-0.5, vx}});
 	}
 
 	for (int i = 1; i < lines; i++)
 	{
-		p->append_poly();
-		p->append_vertex(ox + 0, oy + i-1, min_val);
-		p->append_vertex(ox + 0, oy + i-1, data[std::make_pair(i-1, 0)]);
-		p->append_vertex(ox + 0, oy + i, data[std::make_pair(i, 0)]);
-		p->append_vertex(ox + 0, oy + i, min_val);
-
-		p->append_poly();
-		p->insert_vertex(ox + columns-1, oy + i-1, min_val);
-		p->insert_vertex(ox + columns-1, oy + i-1, data[std::make_pair(i-1, columns-1)]);
-		p->insert_vertex(ox + columns-1, oy + i, data[std::make_pair(i, columns-1)]);
-		p->insert_vertex(ox + columns-1, oy + i, min_val);
+		p->append_poly({{ox + 0, oy + i-1, min_val},
+										{ox + 0, oy + i-1, data(i-1, 0)},
+										{ox + 0, oy + i, data(i, 0)},
+										{ox + 0, oy + i, min_val}});
+
+		p->append_poly({{ox + columns-1, oy + i, min_val},
+										{ox + columns-1, oy + i, data(i, columns-1)},
+										{ox + columns-1, oy + i-1, data(i-1, columns-1)},
+										{ox + columns-1, oy + i-1, min_val}});
 	}
 
 	for (int i = 1; i < columns; i++)
 	{
-		p->append_poly();
-		p->insert_vertex(ox + i-1, oy + 0, min_val);
-		p->insert_vertex(ox + i-1, oy + 0, data[std::make_pair(0, i-1)]);
-		p->insert_vertex(ox + i, oy + 0, data[std::make_pair(0, i)]);
-		p->insert_vertex(ox + i, oy + 0, min_val);
-
-		p->append_poly();
-		p->append_vertex(ox + i-1, oy + lines-1, min_val);
-		p->append_vertex(ox + i-1, oy + lines-1, data[std::make_pair(lines-1, i-1)]);
-		p->append_vertex(ox + i, oy + lines-1, data[std::make_pair(lines-1, i)]);
-		p->append_vertex(ox + i, oy + lines-1, min_val);
+		p->append_poly({{ox + i, oy + 0, min_val},
+										{ox + i, oy + 0, data(0, i)},
+										{ox + i-1, oy + 0, data(0, i-1)},
+										{ox + i-1, oy + 0, min_val}});
+
+		p->append_poly({{ox + i-1, oy + lines-1, min_val},
+										{ox + i-1, oy + lines-1, data(lines-1, i-1)},
+										{ox + i, oy + lines-1, data(lines-1, i)},
+										{ox + i, oy + lines-1, min_val}});
 	}
 
 	if (columns > 1 && lines > 1) {
-		p->append_poly();
+		// Bottom face; the outline is collected counter-clockwise and reversed
+		Polygon bottom;
+		bottom.reserve(2 * (columns-1) + 2 * (lines-1));
 		for (int i = 0; i < columns-1; i++)
-			p->insert_vertex(ox + i, oy + 0, min_val);
+			bottom.emplace_back(ox + i, oy + 0, min_val);
 		for (int i = 0; i < lines-1; i++)
-			p->insert_vertex(ox + columns-1, oy + i, min_val);
+			bottom.emplace_back(ox + columns-1, oy + i, min_val);
 		for (int i = columns-1; i > 0; i--)
-			p->insert_vertex(ox + i, oy + lines-1, min_val);
+			bottom.emplace_back(ox + i, oy + lines-1, min_val);
 		for (int i = lines-1; i > 0; i--)
-			p->insert_vertex(ox + 0, oy + i, min_val);
+			bottom.emplace_back(ox + 0, oy + i, min_val);
+		std::reverse(bottom.begin(), bottom.end());
+		p->append_poly(std::move(bottom));
 	}
 
 	return p;
@@ -316,7 +350,10 @@ std::string SurfaceNode::toString() const
 
 	stream << this->name() << "(file = " << this->filename
 		<< ", center = " << (this->center ? "true" : "false")
-		<< ", invert = " << (this->invert ? "true" : "false")
+		<< ", invert = " << (this->invert ? "true" : "false");
+	// Only written when set, so the output of existing designs stays the same
+	if (this->simplify) stream << ", simplify = true";
+	stream
 				 << ", " "timestamp = " << (fs::exists(path) ? fs::last_write_time(path) : 0)
 				 << ")";
 
@@ -13,6 +13,7 @@
 #else // NULLGL
 #define GLint int
 #define GLuint unsigned int
+#define GLfloat float
 inline void glColor4fv( float *c ) {}
 #endif // NULLGL
 
@@ -5,6 +5,7 @@
 #include <QTextStream>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QTimer>
 #include "editor.h"
 #include "tabmanager.h"
 #include "tabwidget.h"
@@ -68,6 +69,7 @@ void TabManager::tabSwitched(int x)
     assert(tabWidget != nullptr);
     editor = (EditorInterface *)tabWidget->widget(x);
     par->activeEditor = editor;
+    parsePendingDocument();
 
     if(editor == par->customizerEditor)
     {
@@ -83,6 +85,7 @@ void TabManager::tabSwitched(int x)
     par->changedTopLevelConsole(par->consoleDock->isFloating());
     par->parameterTopLevelChanged(par->parameterDock->isFloating());
     par->setWindowTitle(tabWidget->tabText(x).replace("&&", "&"));
+    par->activeTabChanged();
 }
 
 void TabManager::closeTabRequested(int x)
@@ -93,6 +96,7 @@ void TabManager::closeTabRequested(int x)
 
     QWidget *temp = tabWidget->widget(x);
     editorList.remove((EditorInterface *)temp);
+    par->tabClosed((EditorInterface *)temp);
     tabWidget->removeTab(x);
     tabWidget->fireTabCountChanged();
 
@@ -152,6 +156,7 @@ void TabManager::createTab(const QString &filename)
 
     connect(editor, SIGNAL(contentsChanged()), this, SLOT(updateActionUndoState())); 
     connect(editor, SIGNAL(contentsChanged()), par, SLOT(animateUpdateDocChanged())); 
+    connect(editor, SIGNAL(contentsChanged()), par, SLOT(cancelStalePreview()));
     connect(editor, SIGNAL(contentsChanged()), this, SLOT(setContentRenderState()));
     connect(editor, SIGNAL(modificationChanged(bool, EditorInterface *)), this, SLOT(setTabModified(bool, EditorInterface *)));
 
@@ -308,6 +313,22 @@ void TabManager::openTabFile(const QString &filename)
     }
     par->fileChangedOnDisk(); // force cached autoReloadId to update
     refreshDocument();
+    par->loadSnapshot(editor);
+    par->clearCurrentOutput();
+
+    // Files opened together are only parsed once their tab is shown
+    editor->parsePending = true;
+    QTimer::singleShot(0, this, SLOT(parsePendingDocument()));
+}
+
+/*!
+    Initial parse of the current tab's document for the customizer, if it
+    hasn't been parsed since it was opened.
+*/
+void TabManager::parsePendingDocument()
+{
+    if (!editor->parsePending) return;
+    editor->parsePending = false;
 
     par->hideCurrentOutput(); // Initial parse for customizer, hide any errors to avoid duplication
     try {
@@ -317,6 +338,7 @@ void TabManager::openTabFile(const QString &filename)
     }
     par->last_compiled_doc = ""; // undo the damage so F4 works
     par->clearCurrentOutput();
+    if (editor == par->customizerEditor) par->parameterWidget->setEnabled(true);
 }
 
 void TabManager::setTabName(const QString &filename, EditorInterface *edt)
@@ -46,6 +46,7 @@ private:
 private slots:
     void tabSwitched(int);
     void closeTabRequested(int);
+    void parsePendingDocument();
 
 private slots:
     void highlightError(int);
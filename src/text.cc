@@ -34,6 +34,7 @@
 #include "FreetypeRenderer.h"
 #include "Polygon2d.h"
 
+#include <mutex>
 #include <boost/assign/std/vector.hpp>
 using namespace boost::assign; // bring 'operator+=()' into scope
 
@@ -92,6 +93,9 @@ AbstractNode *TextModule::instantiate(const Context *ctx, const ModuleInstantiat
 
 std::vector<const Geometry *> TextNode::createGeometryList() const
 {
+	// FontCache and FreeType aren't thread-safe, see ThreadPool
+	static std::mutex render_mutex;
+	std::lock_guard<std::mutex> lock(render_mutex);
 	FreetypeRenderer renderer;
 	return renderer.render(this->get_params());
 }
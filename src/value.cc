@@ -25,6 +25,7 @@
  */
 
 #include "value.h"
+#include "Arena.h"
 #include "printutils.h"
 #include "double-conversion/double-conversion.h"
 #include "double-conversion/utils.h"
@@ -161,6 +162,94 @@ inline char* DoubleConvert(const double &value, char *buffer,
   return buffer;
 }
 
+namespace {
+	// Concatenations shorter than this are copied right away
+	const size_t rope_min_bytes = 64;
+}
+
+str_utf8_wrapper::Rep::Rep(std::string &&s)
+	: bytes(s.size()), chars(g_utf8_strlen(s.c_str(), s.size())), flat(std::move(s)), flattened(true)
+{
+}
+
+str_utf8_wrapper::Rep::Rep(const shared_ptr<const Rep> &left, const shared_ptr<const Rep> &right)
+	: bytes(left->bytes + right->bytes), chars(left->chars + right->chars), left(left), right(right), flattened(false)
+{
+}
+
+str_utf8_wrapper::Rep::~Rep()
+{
+	// Strings built piece by piece are ropes as deep as they have pieces
+	std::vector<shared_ptr<const Rep>> unlinked;
+	auto unlink = [&unlinked](shared_ptr<const Rep> &rep) {
+		if (rep && rep.use_count() == 1) unlinked.push_back(std::move(rep));
+	};
+	unlink(this->left);
+	unlink(this->right);
+	while (!unlinked.empty()) {
+		auto rep = std::move(unlinked.back());
+		unlinked.pop_back();
+		unlink(rep->left);
+		unlink(rep->right);
+	}
+}
+
+void str_utf8_wrapper::Rep::flatten() const
+{
+	std::call_once(this->flattening, [this]() {
+		std::string text;
+		text.reserve(this->bytes);
+		std::vector<const Rep *> pending{this};
+		while (!pending.empty()) {
+			const Rep *rep = pending.back();
+			pending.pop_back();
+			if (rep->flattened) text += rep->flat;
+			else {
+				pending.push_back(rep->right.get());
+				pending.push_back(rep->left.get());
+			}
+		}
+		this->flat = std::move(text);
+		this->flattened = true;
+	});
+}
+
+str_utf8_wrapper::str_utf8_wrapper(std::string &&s) : rep(make_shared<const Rep>(std::move(s)))
+{
+}
+
+str_utf8_wrapper str_utf8_wrapper::concat(const str_utf8_wrapper &a, const str_utf8_wrapper &b)
+{
+	if (a.empty()) return b;
+	if (b.empty()) return a;
+	if (a.size() + b.size() < rope_min_bytes) return str_utf8_wrapper(a.toString() + b.toString());
+	return str_utf8_wrapper(make_shared<const Rep>(a.rep, b.rep));
+}
+
+const std::string &str_utf8_wrapper::toString() const
+{
+	if (!this->rep->flattened) this->rep->flatten();
+	return this->rep->flat;
+}
+
+size_t str_utf8_wrapper::utf8_offset(size_t i) const
+{
+	assert(i < size_t(get_utf8_strlen()));
+	if (this->rep->chars == this->rep->bytes) return i; // ASCII
+	const char *text = c_str();
+	std::call_once(this->rep->indexing, [this, text]() {
+		auto &offsets = this->rep->offsets;
+		offsets.reserve(this->rep->chars / offset_interval + 1);
+		const char *ptr = text;
+		for (size_t c = 0; c < this->rep->chars; ++c, ptr = g_utf8_next_char(ptr)) {
+			if (c % offset_interval == 0) offsets.push_back(ptr - text);
+		}
+	});
+	const char *ptr = text + this->rep->offsets[i / offset_interval];
+	for (size_t c = 0; c < i % offset_interval; ++c) ptr = g_utf8_next_char(ptr);
+	return ptr - text;
+}
+
 void utf8_split(const std::string& str, std::function<void(ValuePtr)> f)
 {
     const char *ptr = str.c_str();
@@ -249,6 +338,10 @@ Value::Value(const std::string &v) : value(str_utf8_wrapper(v))
   //  std::cout << "creating string\n";
 }
 
+Value::Value(const str_utf8_wrapper &v) : value(v)
+{
+}
+
 Value::Value(const char *v) : value(str_utf8_wrapper(v))
 {
   //  std::cout << "creating string from char *\n";
@@ -264,6 +357,10 @@ Value::Value(const VectorType &v) : value(v)
   //  std::cout << "creating vector\n";
 }
 
+Value::Value(VectorType &&v) : value(std::move(v))
+{
+}
+
 Value::Value(const RangeType &v) : value(v)
 {
   //  std::cout << "creating range\n";
@@ -343,146 +440,152 @@ bool Value::getFiniteDouble(double &v) const
   return valid;
 }
 
-class tostring_visitor : public boost::static_visitor<std::string>
-{
-public:
-  template <typename T> std::string operator()(const T &op1) const {
-    //    std::cout << "[generic tostring_visitor]\n";
-    return boost::lexical_cast<std::string>(op1);	
-  }
-
-  std::string operator()(const double &op1) const {
-    char buffer[DC_BUFFER_SIZE];
-    double_conversion::StringBuilder builder(buffer, DC_BUFFER_SIZE);
-    double_conversion::DoubleToStringConverter dc(DC_FLAGS, DC_INF, DC_NAN, DC_EXP, 
-      DC_DECIMAL_LOW_EXP, DC_DECIMAL_HIGH_EXP, DC_MAX_LEADING_ZEROES, DC_MAX_TRAILING_ZEROES);
-    return DoubleConvert(op1, buffer, builder, dc);
-  }
-
-  std::string operator()(const boost::blank &) const {
-    return "undef";
-  }
-
-  std::string operator()(const bool &v) const {
-    return v ? "true" : "false";
-  }
-
-  std::string operator()(const Value::VectorType &v) const {
-    // Create a single stream and pass reference to it for list elements for optimization.
-    std::ostringstream stream;
-    stream << '[';
-    for (size_t i = 0; i < v.size(); i++) {
-      if (i > 0) stream << ", ";
-      v[i]->toStream(stream);
-    }
-    stream << ']';
-    return stream.str();
-  }
-
-  std::string operator()(const RangeType &v) const {
-    return (boost::format("[%1% : %2% : %3%]") % v.begin_val % v.step_val % v.end_val).str();
-  }
-
-};
-
-// Optimization to avoid multiple stream instantiations and copies to str for long vectors.
-// Functions identically to "class tostring_visitor", except outputting to stream and not returning strings
-class tostream_visitor : public boost::static_visitor<>
+/*!
+	Writes the string form of values into one string, with one number
+	converter for all of them. Strings are quoted (not escaped), as they
+	are in vectors. Vectors which remember their string form are copied
+	from it.
+*/
+class ValueWriter : public boost::static_visitor<>
 {
 public:
-  std::ostringstream &stream;
-  
-
-  mutable char buffer[DC_BUFFER_SIZE];
-  mutable double_conversion::StringBuilder builder;
-  double_conversion::DoubleToStringConverter dc;
-
-  tostream_visitor(std::ostringstream& stream) 
-    : stream(stream), builder(buffer, DC_BUFFER_SIZE), 
-      dc(DC_FLAGS, DC_INF, DC_NAN, DC_EXP, DC_DECIMAL_LOW_EXP, DC_DECIMAL_HIGH_EXP, DC_MAX_LEADING_ZEROES, DC_MAX_TRAILING_ZEROES) 
+  ValueWriter(std::string &out)
+    : out(out), builder(buffer, DC_BUFFER_SIZE),
+      dc(DC_FLAGS, DC_INF, DC_NAN, DC_EXP, DC_DECIMAL_LOW_EXP, DC_DECIMAL_HIGH_EXP, DC_MAX_LEADING_ZEROES, DC_MAX_TRAILING_ZEROES)
     {};
 
-  template <typename T> void operator()(const T &op1) const {
-    //    std::cout << "[generic tostream_visitor]\n";
-    stream << boost::lexical_cast<std::string>(op1);
-  }
-
   void operator()(const double &op1) const {
-    stream << DoubleConvert(op1, buffer, builder, dc);
+    // Integers of up to 6 digits come out of DoubleConvert() unchanged
+    if (std::fabs(op1) < 1e6 && op1 == std::floor(op1)) {
+      char digits[8];
+      char *p = digits + sizeof(digits);
+      long n = std::lround(std::fabs(op1));
+      do {
+        *--p = '0' + n % 10;
+        n /= 10;
+      } while (n > 0);
+      if (op1 < 0) *--p = '-';
+      out.append(p, digits + sizeof(digits) - p);
+    }
+    else {
+      out += DoubleConvert(op1, buffer, builder, dc);
+    }
   }
 
   void operator()(const boost::blank &) const {
-    stream << "undef";
+    out += "undef";
   }
 
   void operator()(const bool &v) const {
-    stream << (v ? "true" : "false");
+    out += v ? "true" : "false";
   }
 
   void operator()(const Value::VectorType &v) const {
-    stream << '[';
+    const auto cached = std::atomic_load(&v.cached_str);
+    if (cached) {
+      out += *cached;
+      return;
+    }
+    out += '[';
     for (size_t i = 0; i < v.size(); i++) {
-      if (i > 0) stream << ", ";
-      v[i]->toStream(this);
+      if (i > 0) out += ", ";
+      boost::apply_visitor(*this, v[i]->value);
     }
-    stream << ']';
+    out += ']';
   }
 
   void operator()(const str_utf8_wrapper &v) const {
-    stream << '"' << v << '"';
+    out += '"';
+    out += v.toString();
+    out += '"';
   }
 
   void operator()(const RangeType &v) const {
-    stream << "[";
+    out += '[';
     this->operator()(v.begin_val);
-    stream << " : ";
+    out += " : ";
     this->operator()(v.step_val);
-    stream << " : ";
+    out += " : ";
     this->operator()(v.end_val);
-    stream << "]";
+    out += ']';
+  }
+
+  // The form of top level ranges, which are formatted like streams do
+  static std::string rangeString(const RangeType &v) {
+    return (boost::format("[%1% : %2% : %3%]") % v.begin_val % v.step_val % v.end_val).str();
   }
 
+private:
+  std::string &out;
+  mutable char buffer[DC_BUFFER_SIZE];
+  mutable double_conversion::StringBuilder builder;
+  double_conversion::DoubleToStringConverter dc;
 };
 
+// Vectors remember string forms at least this long, libraries use str() of
+// large lists e.g. for keys, over and over
+static const size_t cached_string_length = 256;
 
 std::string Value::toString() const
 {
-  return boost::apply_visitor(tostring_visitor(), this->value);
+  std::string out;
+  appendString(out);
+  return out;
 }
 
-// helper called by tostring_visitor methods to avoid extra instantiations
-std::string Value::toString(const tostring_visitor *visitor) const
+void Value::appendString(std::string &out) const
 {
-  return boost::apply_visitor(*visitor, this->value);
+  switch (this->type()) {
+  case ValueType::STRING:
+    out += boost::get<str_utf8_wrapper>(this->value).toString();
+    break;
+  case ValueType::RANGE:
+    out += ValueWriter::rangeString(boost::get<RangeType>(this->value));
+    break;
+  case ValueType::VECTOR: {
+    const auto &v = boost::get<VectorType>(this->value);
+    const auto cached = std::atomic_load(&v.cached_str);
+    if (cached) {
+      out += *cached;
+      break;
+    }
+    const size_t start = out.size();
+    ValueWriter writer(out);
+    writer(v);
+    if (out.size() - start >= cached_string_length) {
+      std::atomic_store(&v.cached_str, make_shared<const std::string>(out, start));
+    }
+    break;
+  }
+  default:
+    boost::apply_visitor(ValueWriter(out), this->value);
+    break;
+  }
 }
 
 void Value::toStream(std::ostringstream &stream) const
 {
-  boost::apply_visitor(tostream_visitor(stream), this->value);
-}
-
-// helper called by tostream_visitor methods to avoid extra instantiations
-void Value::toStream(const tostream_visitor *visitor) const
-{
-  boost::apply_visitor(*visitor, this->value);
+  std::string out;
+  if (this->type() == ValueType::VECTOR) appendString(out);
+  else boost::apply_visitor(ValueWriter(out), this->value);
+  stream.write(out.data(), out.size());
 }
 
 std::string Value::toEchoString() const
 {
-	if (type() == Value::ValueType::STRING) {
-		return std::string("\"") + toString() + '"';
-	} else {
-		return toString();
-	}
+  std::string out;
+  appendEchoString(out);
+  return out;
 }
 
-// helper called by tostring_visitor methods to avoid extra instantiations
-std::string Value::toEchoString(const tostring_visitor *visitor) const
+void Value::appendEchoString(std::string &out) const
 {
 	if (type() == Value::ValueType::STRING) {
-		return std::string("\"") + toString(visitor) + '"';
+		out += '"';
+		appendString(out);
+		out += '"';
 	} else {
-		return toString(visitor);
+		appendString(out);
 	}
 }
 
@@ -598,6 +701,13 @@ bool Value::getVec3(double &x, double &y, double &z, double defaultval) const
   return (v[0]->getDouble(x) && v[1]->getDouble(y) && v[2]->getDouble(z));
 }
 
+const str_utf8_wrapper &Value::toStrUtf8Wrapper() const
+{
+  static const str_utf8_wrapper empty;
+  const str_utf8_wrapper *val = boost::get<str_utf8_wrapper>(&this->value);
+  return val ? *val : empty;
+}
+
 RangeType Value::toRange() const
 {
   const RangeType *val = boost::get<RangeType>(&this->value);
@@ -741,6 +851,55 @@ Value Value::operator-(const Value &v) const
 	return boost::apply_visitor(minus_visitor(), this->value, v.value);
 }
 
+namespace {
+	/*
+		Matrix products unbox numeric operands into flat buffers first, so the
+		inner loops run over plain doubles without a type check per element.
+		The sums are accumulated in the same order as by the generic code,
+		so the results are identical.
+	*/
+	bool unbox_numbers(const Value::VectorType &vec, std::vector<double> &out)
+	{
+		out.resize(vec.size());
+		for (size_t i = 0; i < vec.size(); i++) {
+			if (!vec[i]->getDouble(out[i])) return false;
+		}
+		return true;
+	}
+
+	// Unboxes a matrix of numbers with rows of equal length, row by row
+	bool unbox_matrix(const Value::VectorType &rows, std::vector<double> &out, size_t &cols)
+	{
+		if (rows.empty() || rows[0]->type() != Value::ValueType::VECTOR) return false;
+		cols = rows[0]->toVector().size();
+		out.resize(rows.size() * cols);
+		for (size_t i = 0; i < rows.size(); i++) {
+			if (rows[i]->type() != Value::ValueType::VECTOR) return false;
+			const auto &row = rows[i]->toVector();
+			if (row.size() != cols) return false;
+			for (size_t j = 0; j < cols; j++) {
+				if (!row[j]->getDouble(out[i * cols + j])) return false;
+			}
+		}
+		return true;
+	}
+
+	// out = v * m, for a vector v of m's row count
+	Value::VectorType mult_vec_mat(const double *v, const std::vector<double> &m, size_t rows, size_t cols)
+	{
+		Value::VectorType dstv;
+		dstv.reserve(cols);
+		for (size_t i = 0; i < cols; i++) {
+			double r_e = 0.0;
+			for (size_t j = 0; j < rows; j++) {
+				r_e += v[j] * m[j * cols + i];
+			}
+			dstv.push_back(ValuePtr(r_e));
+		}
+		return dstv;
+	}
+}
+
 Value Value::multvecnum(const Value &vecval, const Value &numval)
 {
 // Vector * Number
@@ -754,6 +913,21 @@ Value Value::multvecnum(const Value &vecval, const Value &numval)
 Value Value::multmatvec(const VectorType &matrixvec, const VectorType &vectorvec)
 {
 // Matrix * Vector
+	std::vector<double> m, v;
+	size_t cols;
+	if (unbox_matrix(matrixvec, m, cols) && cols == vectorvec.size() && unbox_numbers(vectorvec, v)) {
+		VectorType dstv;
+		dstv.reserve(matrixvec.size());
+		for (size_t i = 0; i < matrixvec.size(); i++) {
+			double r_e = 0.0;
+			for (size_t j = 0; j < cols; j++) {
+				r_e += m[i * cols + j] * v[j];
+			}
+			dstv.push_back(ValuePtr(r_e));
+		}
+		return {std::move(dstv)};
+	}
+
 	VectorType dstv;
 	for (size_t i=0;i<matrixvec.size();i++) {
 		if (matrixvec[i]->type() != ValueType::VECTOR || 
@@ -776,6 +950,12 @@ Value Value::multvecmat(const VectorType &vectorvec, const VectorType &matrixvec
 {
 	assert(vectorvec.size() == matrixvec.size());
 // Vector * Matrix
+	std::vector<double> v, m;
+	size_t cols;
+	if (unbox_numbers(vectorvec, v) && unbox_matrix(matrixvec, m, cols)) {
+		return {mult_vec_mat(v.data(), m, matrixvec.size(), cols)};
+	}
+
 	VectorType dstv;
 	for (size_t i=0;i<matrixvec[0]->toVector().size();i++) {
 		double r_e = 0.0;
@@ -828,6 +1008,17 @@ Value Value::operator*(const Value &v) const
 		} else if (vec1[0]->type() == ValueType::VECTOR && vec2[0]->type() == ValueType::VECTOR &&
 							 vec1[0]->toVector().size() == vec2.size()) {
 			// Matrix * Matrix
+			std::vector<double> m1, m2;
+			size_t cols1, cols2;
+			if (unbox_matrix(vec1, m1, cols1) && unbox_matrix(vec2, m2, cols2)) {
+				VectorType dstv;
+				dstv.reserve(vec1.size());
+				for (size_t i = 0; i < vec1.size(); i++) {
+					dstv.push_back(ValuePtr(mult_vec_mat(&m1[i * cols1], m2, vec2.size(), cols2)));
+				}
+				return {std::move(dstv)};
+			}
+
 			VectorType dstv;
 			for (const auto &srcrow : vec1) {
 				const auto &srcrowvec = srcrow->toVector();
@@ -912,16 +1103,11 @@ public:
     Value v;
 
     const auto i = convert_to_uint32(idx);
-    if (i < str.size()) {
-			// Ensure character (not byte) index is inside the character/glyph array
-			if (i < str.get_utf8_strlen())	{
-				gchar utf8_of_cp[6] = ""; //A buffer for a single unicode character to be copied into
-				auto ptr = g_utf8_offset_to_pointer(str.c_str(), i);
-				if (ptr) {
-					g_utf8_strncpy(utf8_of_cp, ptr, 1);
-				}
-				v = std::string(utf8_of_cp);
-			}
+    // Ensure character (not byte) index is inside the character/glyph array
+    if (i < size_t(str.get_utf8_strlen())) {
+      gchar utf8_of_cp[6] = ""; //A buffer for a single unicode character to be copied into
+      g_utf8_strncpy(utf8_of_cp, str.c_str() + str.utf8_offset(i), 1);
+      v = std::string(utf8_of_cp);
     }
     return v;
   }
@@ -1055,54 +1241,110 @@ bool RangeType::iterator::operator!=(const self_type &other) const
 	return !(*this == other);
 }
 
-ValuePtr::ValuePtr()
+/*
+	Values are immutable once they are held by a ValuePtr, so undef, the
+	bools and small integers are shared instead of allocated for each
+	result. Everything else is allocated together with its reference count,
+	from the arena of evaluation temporaries (see Arena).
+*/
+namespace {
+	const int SHARED_INT_MIN = -128;
+	const int SHARED_INT_MAX = 1023;
+
+	template <typename... Args>
+	shared_ptr<const Value> make_temporary(Args &&... args)
+	{
+		return std::allocate_shared<Value>(ArenaAllocator<Value>(Arena::evaluate()), std::forward<Args>(args)...);
+	}
+
+	const shared_ptr<const Value> &shared_undefined()
+	{
+		static const shared_ptr<const Value> undef = make_shared<Value>();
+		return undef;
+	}
+
+	const shared_ptr<const Value> &shared_bool(bool v)
+	{
+		static const shared_ptr<const Value> values[] = { make_shared<Value>(false), make_shared<Value>(true) };
+		return values[v];
+	}
+
+	const std::vector<shared_ptr<const Value>> &shared_ints()
+	{
+		static const std::vector<shared_ptr<const Value>> values = []() {
+			std::vector<shared_ptr<const Value>> v;
+			for (int i = SHARED_INT_MIN; i <= SHARED_INT_MAX; ++i) v.push_back(make_shared<Value>(double(i)));
+			return v;
+		}();
+		return values;
+	}
+
+	shared_ptr<const Value> make_number(double v)
+	{
+		// -0 prints differently, so only +0 is shared
+		if (v >= SHARED_INT_MIN && v <= SHARED_INT_MAX && v == std::floor(v) && !(v == 0 && std::signbit(v))) {
+			return shared_ints()[int(v) - SHARED_INT_MIN];
+		}
+		return make_temporary(v);
+	}
+
+	shared_ptr<const Value> make_value(const Value &v)
+	{
+		switch (v.type()) {
+		case Value::ValueType::UNDEFINED: return shared_undefined();
+		case Value::ValueType::BOOL: return shared_bool(v.toBool());
+		case Value::ValueType::NUMBER: return make_number(v.toDouble());
+		default: return make_temporary(v);
+		}
+	}
+}
+
+ValuePtr::ValuePtr() : shared_ptr<const Value>(shared_undefined())
+{
+}
+
+ValuePtr::ValuePtr(const Value &v) : shared_ptr<const Value>(make_value(v))
+{
+}
+
+ValuePtr::ValuePtr(bool v) : shared_ptr<const Value>(shared_bool(v))
 {
-	this->reset(new Value());
 }
 
-ValuePtr::ValuePtr(const Value &v)
+ValuePtr::ValuePtr(int v) : shared_ptr<const Value>(make_number(v))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(bool v)
+ValuePtr::ValuePtr(double v) : shared_ptr<const Value>(make_number(v))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(int v)
+ValuePtr::ValuePtr(const std::string &v) : shared_ptr<const Value>(make_temporary(v))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(double v)
+ValuePtr::ValuePtr(const str_utf8_wrapper &v) : shared_ptr<const Value>(make_temporary(v))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(const std::string &v)
+ValuePtr::ValuePtr(const char *v) : shared_ptr<const Value>(make_temporary(v))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(const char *v)
+ValuePtr::ValuePtr(const char v) : shared_ptr<const Value>(make_temporary(v))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(const char v)
+ValuePtr::ValuePtr(const std::vector<ValuePtr> &v) : shared_ptr<const Value>(make_temporary(Value::VectorType(v)))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(const Value::VectorType &v)
+ValuePtr::ValuePtr(std::vector<ValuePtr> &&v) : shared_ptr<const Value>(make_temporary(Value::VectorType(std::move(v))))
 {
-	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(const RangeType &v)
+ValuePtr::ValuePtr(const RangeType &v) : shared_ptr<const Value>(make_temporary(v))
 {
-	this->reset(new Value(v));
 }
 
 bool ValuePtr::operator==(const ValuePtr &v) const
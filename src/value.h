@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <algorithm>
@@ -15,8 +17,7 @@
 #include <cstdint>
 #include "memory.h"
 
-class tostring_visitor;
-class tostream_visitor;
+class ValueWriter;
 
 class QuotedString : public std::string
 {
@@ -96,8 +97,7 @@ public:
 	uint32_t numValues() const;
   
 	friend class chr_visitor;
-	friend class tostring_visitor;
-	friend class tostream_visitor;
+	friend class ValueWriter;
 	friend class bracket_visitor;
 };
 
@@ -112,9 +112,11 @@ public:
   ValuePtr(int v);
   ValuePtr(double v);
   ValuePtr(const std::string &v);
+  ValuePtr(const class str_utf8_wrapper &v);
   ValuePtr(const char *v);
   ValuePtr(const char v);
   ValuePtr(const class std::vector<ValuePtr> &v);
+  ValuePtr(std::vector<ValuePtr> &&v);
   ValuePtr(const class RangeType &v);
 
 	operator bool() const;
@@ -140,29 +142,104 @@ private:
 };
 
 
-class str_utf8_wrapper : public std::string
+/*!
+	The string of a string Value. Strings are immutable and shared. str()
+	of strings concatenates them into a rope rather than copying, which is
+	flattened once its contents are needed, so building a long string piece
+	by piece takes linear time rather than quadratic.
+
+	The length in characters is known without flattening. Characters of
+	non-ASCII strings are found through an index of the offsets of every
+	so many characters, built once.
+*/
+class str_utf8_wrapper
 {
 public:
-	str_utf8_wrapper() : std::string(), cached_len(-1) { }
-	str_utf8_wrapper( const std::string& s ) : std::string( s ), cached_len(-1) { }
-	str_utf8_wrapper( size_t n, char c ) : std::string(n, c), cached_len(-1) { }
-	~str_utf8_wrapper() {}
-	
-	glong get_utf8_strlen() const {
-		if (cached_len < 0) {
-			cached_len = g_utf8_strlen(this->c_str(), this->size());
-		}
-		return cached_len;
-	};
+	str_utf8_wrapper() : str_utf8_wrapper(std::string()) {}
+	str_utf8_wrapper(const std::string &s) : str_utf8_wrapper(std::string(s)) {}
+	str_utf8_wrapper(std::string &&s);
+	str_utf8_wrapper(const char *s) : str_utf8_wrapper(std::string(s)) {}
+	str_utf8_wrapper(size_t n, char c) : str_utf8_wrapper(std::string(n, c)) {}
+
+	// The concatenation of a and b
+	static str_utf8_wrapper concat(const str_utf8_wrapper &a, const str_utf8_wrapper &b);
+
+	// Flattens the string, once
+	const std::string &toString() const;
+	const char *c_str() const { return toString().c_str(); }
+	size_t size() const { return this->rep->bytes; }
+	bool empty() const { return this->rep->bytes == 0; }
+	glong get_utf8_strlen() const { return this->rep->chars; }
+	// The offset in bytes of character i, which must be less than get_utf8_strlen()
+	size_t utf8_offset(size_t i) const;
+
+	bool operator==(const str_utf8_wrapper &o) const { return this->rep == o.rep || toString() == o.toString(); }
+	bool operator!=(const str_utf8_wrapper &o) const { return !(*this == o); }
+	bool operator<(const str_utf8_wrapper &o) const { return toString() < o.toString(); }
+	bool operator>(const str_utf8_wrapper &o) const { return toString() > o.toString(); }
+	bool operator<=(const str_utf8_wrapper &o) const { return toString() <= o.toString(); }
+	bool operator>=(const str_utf8_wrapper &o) const { return toString() >= o.toString(); }
+
 private:
-	mutable glong cached_len;
+	// A piece of text, or the concatenation of two until flattened
+	struct Rep {
+		Rep(std::string &&s);
+		Rep(const shared_ptr<const Rep> &left, const shared_ptr<const Rep> &right);
+		~Rep();
+		void flatten() const;
+
+		const size_t bytes;
+		const size_t chars;
+		// Only released by the destructor, which does so without recursing
+		mutable shared_ptr<const Rep> left, right;
+		// Values are shared between threads evaluating concurrently
+		mutable std::string flat;
+		mutable std::atomic<bool> flattened;
+		mutable std::once_flag flattening;
+		mutable std::vector<size_t> offsets; // Of every offset_interval-th character
+		mutable std::once_flag indexing;
+	};
+	static const size_t offset_interval = 64;
+
+	str_utf8_wrapper(const shared_ptr<const Rep> &rep) : rep(rep) {}
+	shared_ptr<const Rep> rep;
 };
 
 
 class Value
 {
 public:
-	typedef std::vector<ValuePtr> VectorType;
+	/*!
+		Remembers its string form once it's part of a Value, see
+		Value::appendString(). Copies don't, they may be changed.
+	*/
+	class VectorType : public std::vector<ValuePtr>
+	{
+	public:
+		using std::vector<ValuePtr>::vector;
+		VectorType() {}
+		VectorType(const std::vector<ValuePtr> &v) : std::vector<ValuePtr>(v) {}
+		VectorType(std::vector<ValuePtr> &&v) : std::vector<ValuePtr>(std::move(v)) {}
+		VectorType(const VectorType &v) : std::vector<ValuePtr>(v) {}
+		VectorType(VectorType &&v) : std::vector<ValuePtr>(std::move(v)) {}
+
+		VectorType &operator=(const VectorType &v) {
+			std::vector<ValuePtr>::operator=(v);
+			this->cached_str.reset();
+			return *this;
+		}
+		VectorType &operator=(VectorType &&v) {
+			std::vector<ValuePtr>::operator=(std::move(v));
+			this->cached_str.reset();
+			return *this;
+		}
+
+	private:
+		friend class Value;
+		friend class ::ValueWriter;
+		// Values are shared between threads, use std::atomic_load/store
+		mutable shared_ptr<const std::string> cached_str;
+	};
 
   enum class ValueType {
     UNDEFINED,
@@ -179,9 +256,11 @@ public:
   Value(int v);
   Value(double v);
   Value(const std::string &v);
+  Value(const str_utf8_wrapper &v);
   Value(const char *v);
   Value(const char v);
   Value(const VectorType &v);
+  Value(VectorType &&v);
   Value(const RangeType &v);
   ~Value() {}
 
@@ -195,12 +274,15 @@ public:
   bool getFiniteDouble(double &v) const;
   bool toBool() const;
   std::string toString() const;
-  std::string toString(const tostring_visitor *visitor) const;
   std::string toEchoString() const;
-  std::string toEchoString(const tostring_visitor *visitor) const;
+  // Like toString() and toEchoString(), appending to out
+  void appendString(std::string &out) const;
+  void appendEchoString(std::string &out) const;
+  // The form of elements of vectors, with quoted strings
   void toStream(std::ostringstream &stream) const;
-  void toStream(const tostream_visitor *visitor) const;
   std::string chrString() const;
+  // The string of a string value, without copying
+  const str_utf8_wrapper &toStrUtf8Wrapper() const;
   const VectorType &toVector() const;
   bool getVec2(double &x, double &y, bool ignoreInfinite = false) const;
   bool getVec3(double &x, double &y, double &z) const;
@@ -233,6 +315,8 @@ public:
   typedef boost::variant< boost::blank, bool, double, str_utf8_wrapper, VectorType, RangeType > Variant;
 
 private:
+  friend class ValueWriter;
+
   static Value multvecnum(const Value &vecval, const Value &numval);
   static Value multmatvec(const VectorType &matrixvec, const VectorType &vectorvec);
   static Value multvecmat(const VectorType &vectorvec, const VectorType &matrixvec);
@@ -0,0 +1,128 @@
+#include "benchmark-common.h"
+#include "printutils.h"
+
+#include <boost/format.hpp>
+#include <boost/program_options.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace {
+	typedef std::chrono::steady_clock Clock;
+
+	std::atomic<size_t> allocation_count(0);
+
+	struct Result {
+		std::string name;
+		size_t iterations;
+		double ms;
+		double allocations;
+	};
+
+	std::vector<Result> results;
+	std::string filter;
+	std::string jsonfile;
+	double min_time = 0.5;
+
+	bool write_json(const std::string &filename)
+	{
+		std::ofstream stream(filename.c_str(), std::ios::out | std::ios::trunc);
+		if (!stream.is_open()) return false;
+		stream << "{\n  \"benchmarks\": [";
+		for (size_t i = 0; i < results.size(); ++i) {
+			const auto &r = results[i];
+			stream << (i ? ",\n" : "\n")
+						 << boost::format("    {\"name\": \"%s\", \"iterations\": %d, \"real_time\": %.6f, \"cpu_time\": %.6f, \"time_unit\": \"ms\", \"allocations\": %.1f}")
+						 % r.name % r.iterations % r.ms % r.ms % r.allocations;
+		}
+		stream << "\n  ]\n}\n";
+		return bool(stream);
+	}
+}
+
+// Every allocation of the program is counted
+void *operator new(size_t size)
+{
+	++allocation_count;
+	if (void *p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+namespace Benchmark {
+	bool init(int argc, char **argv, int &exitcode)
+	{
+		po::options_description desc("Allowed options");
+		desc.add_options()
+			("help,h", "print this help message and exit")
+			("filter", po::value<std::string>(), "=substring -only run the benchmarks whose name contains it")
+			("min-time", po::value<double>(), "=seconds -run each benchmark for at least this long (default 0.5)")
+			("json", po::value<std::string>(), "=file -also write the results to the file as JSON");
+
+		po::variables_map vm;
+		try {
+			po::store(po::parse_command_line(argc, argv, desc), vm);
+		} catch (const po::error &e) {
+			std::cerr << "error parsing options: " << e.what() << "\n";
+			exitcode = 1;
+			return false;
+		}
+		if (vm.count("help")) {
+			std::cout << "Usage: " << argv[0] << " [options]\n" << desc;
+			exitcode = 0;
+			return false;
+		}
+		if (vm.count("filter")) filter = vm["filter"].as<std::string>();
+		if (vm.count("min-time")) min_time = vm["min-time"].as<double>();
+		if (vm.count("json")) jsonfile = vm["json"].as<std::string>();
+
+		std::cout << boost::format("%-52s %15s %10s %12s\n") % "Benchmark" % "Time" % "Iterations" % "Allocs/op";
+		return true;
+	}
+
+	void run(const std::string &name, size_t size, const std::function<void()> &fn)
+	{
+		const auto fullname = STR(name << "/" << size);
+		if (!filter.empty() && fullname.find(filter) == std::string::npos) return;
+
+		size_t iterations = 0;
+		double elapsed;
+		const size_t allocs = allocation_count;
+		const auto start = Clock::now();
+		do {
+			fn();
+			++iterations;
+			elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		} while (elapsed < min_time);
+
+		const double ms = elapsed * 1000 / iterations;
+		const double allocations = double(allocation_count - allocs) / iterations;
+		std::cout << boost::format("%-52s %12.3f ms %10d %12.1f\n") % fullname % ms % iterations % allocations << std::flush;
+		results.push_back({fullname, iterations, ms, allocations});
+	}
+
+	int finish()
+	{
+		if (!jsonfile.empty() && !write_json(jsonfile)) {
+			std::cerr << "Can't write results to " << jsonfile << "\n";
+			return 1;
+		}
+		return 0;
+	}
+}
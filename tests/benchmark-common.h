@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/*!
+	The harness shared by the micro-benchmarks. Each benchmark is run until
+	--min-time (default 0.5s) has passed, at least once, and the mean time
+	and number of heap allocations per run are reported. With --json, the
+	results are also written in the layout of Google Benchmark's, so its
+	compare.py can compare two runs.
+*/
+namespace Benchmark {
+	// Parses the command line. Returns false if the program should exit
+	// with exitcode, e.g. after --help.
+	bool init(int argc, char **argv, int &exitcode);
+
+	// Runs "name/size", unless it's filtered out
+	void run(const std::string &name, size_t size, const std::function<void()> &fn);
+
+	// Writes the JSON output, if any. Returns the exit code.
+	int finish();
+}
@@ -0,0 +1,118 @@
+#!/usr/bin/env python
+#
+# Benchmark driver
+#
+# Usage: benchmark.py --openscad=<executable-path> --output=<results.json>
+#                     [--repeat=n] [--startup] [<openscad args>] model.scad[:format] ...
+#
+# Exports each model with --timing, by default to STL; a different export
+# format can be given after a colon, e.g. model.scad:svg for 2D models or
+# model.scad:echo for models without geometry. Each model is run --repeat
+# times, and the fastest time of each phase is kept, which is the least
+# noisy.
+#
+# The results are written to the output file as JSON:
+#   {"models": {"examples/Basics/logo.scad": {"phases": {"parse": ms, ...},
+#                                             "total": ms, "status": 0}, ...}}
+# Model names are relative to the source tree, so results of different
+# builds can be compared with compare_benchmarks.py.
+#
+# With --startup, the wall time of exporting an empty model to CSG, i.e.
+# of starting up and shutting down, is reported as the model "startup",
+# with the phase "process". --timing only measures from within main().
+#
+# Fonts are taken from testdata/ttf, as by the tests.
+#
+# Returns 0 if all models exported successfully, 1 otherwise.
+#
+
+from __future__ import print_function
+
+import sys, os, json, subprocess, tempfile, shutil, argparse, time
+
+formats = ['stl', 'off', 'amf', '3mf', 'dxf', 'svg', 'csg', 'ast', 'term', 'echo']
+
+def run_model(openscad, model, fmt, args, tmpdir):
+    outfile = os.path.join(tmpdir, 'out.' + fmt)
+    timingfile = os.path.join(tmpdir, 'timing.json')
+    if os.path.exists(timingfile): os.remove(timingfile)
+    cmd = [openscad, '--timing=' + timingfile, '-o', outfile] + args + [model]
+    with open(os.devnull, 'w') as devnull:
+        rc = subprocess.call(cmd, stdout=devnull, stderr=devnull)
+    if not os.path.exists(timingfile):
+        return {'phases': {}, 'total': 0.0, 'status': rc if rc != 0 else 1}
+    with open(timingfile) as f:
+        return json.load(f)
+
+def run_startup(openscad, args, tmpdir):
+    model = os.path.join(tmpdir, 'empty.scad')
+    open(model, 'w').close()
+    cmd = [openscad, '-o', os.path.join(tmpdir, 'out.csg')] + args + [model]
+    start = time.time()
+    with open(os.devnull, 'w') as devnull:
+        rc = subprocess.call(cmd, stdout=devnull, stderr=devnull)
+    ms = (time.time() - start) * 1000
+    return {'phases': {'process': ms}, 'total': ms, 'status': rc}
+
+def fastest(runs):
+    result = {'phases': {}, 'total': min(r['total'] for r in runs), 'status': max(r['status'] for r in runs)}
+    for run in runs:
+        for phase, ms in run['phases'].items():
+            result['phases'][phase] = min(ms, result['phases'].get(phase, ms))
+    return result
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+parser.add_argument('--output', required=True, help='Specify the results file')
+parser.add_argument('--repeat', type=int, default=3, help='Number of runs of each model')
+parser.add_argument('--startup', action='store_true', help='Also measure the startup time')
+parser.add_argument('--root', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), '..'),
+                    help='Directory the model names are relative to')
+args, remaining = parser.parse_known_args()
+
+models = [m for m in remaining if not m.startswith('-')]
+openscad_args = [a for a in remaining if a.startswith('-')]
+if not models and not args.startup:
+    print('benchmark.py: no models given', file=sys.stderr)
+    sys.exit(1)
+
+os.environ['OPENSCAD_FONT_PATH'] = os.path.join(args.root, 'testdata', 'ttf')
+
+results = {'models': {}}
+failed = 0
+tmpdir = tempfile.mkdtemp(prefix='openscad-benchmark-')
+try:
+    if args.startup:
+        # More runs, as a single one is short and noisy
+        result = fastest([run_startup(args.openscad, openscad_args, tmpdir) for i in range(max(args.repeat, 1) * 5)])
+        results['models']['startup'] = result
+        if result['status'] != 0:
+            failed += 1
+            print('%-60s FAILED (%d)' % ('startup', result['status']))
+        else:
+            print('%-60s %10.1f ms' % ('startup', result['total']))
+    for model in models:
+        fmt = 'stl'
+        path = model
+        base, sep, suffix = model.rpartition(':')
+        if sep and suffix in formats:
+            path, fmt = base, suffix
+        path = os.path.abspath(path)
+        name = os.path.relpath(path, args.root).replace(os.sep, '/')
+        runs = [run_model(args.openscad, path, fmt, openscad_args, tmpdir) for i in range(max(args.repeat, 1))]
+        result = fastest(runs)
+        results['models'][name] = result
+        if result['status'] != 0:
+            failed += 1
+            print('%-60s FAILED (%d)' % (name, result['status']))
+        else:
+            print('%-60s %10.1f ms' % (name, result['total']))
+finally:
+    shutil.rmtree(tmpdir, ignore_errors=True)
+
+with open(args.output, 'w') as f:
+    json.dump(results, f, indent=2, sort_keys=True)
+    f.write('\n')
+print('Results written to ' + args.output)
+
+sys.exit(1 if failed else 0)
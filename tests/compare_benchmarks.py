@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+#
+# Compares two results files of benchmark.py
+#
+# Usage: compare_benchmarks.py [--threshold=percent] [--min-time=ms] baseline.json current.json
+#
+# Prints the change of the total and of each phase for every model in both
+# files. A phase or total counts as a regression if it is more than
+# --threshold percent slower (default 10) and also more than --min-time
+# milliseconds slower (default 5), so that fast phases don't flag timer
+# noise. A model which exported successfully in the baseline but fails
+# now is a regression, too.
+#
+# Returns 0 if there are no regressions, 1 if there are, 2 on invalid input.
+#
+
+from __future__ import print_function
+
+import sys, json, argparse
+
+def load(filename):
+    try:
+        with open(filename) as f:
+            return json.load(f)['models']
+    except (IOError, ValueError, KeyError) as e:
+        print('compare_benchmarks.py: can\'t read %s: %s' % (filename, e), file=sys.stderr)
+        sys.exit(2)
+
+parser = argparse.ArgumentParser()
+parser.add_argument('--threshold', type=float, default=10.0, help='Slowdown in percent counting as regression')
+parser.add_argument('--min-time', type=float, default=5.0, help='Slowdown in milliseconds counting as regression')
+parser.add_argument('baseline')
+parser.add_argument('current')
+args = parser.parse_args()
+
+baseline = load(args.baseline)
+current = load(args.current)
+
+def regressed(before, after):
+    return after - before > args.min_time and after > before * (1 + args.threshold / 100.0)
+
+def change(before, after):
+    if before <= 0: return '     n/a'
+    return '%+7.1f%%' % ((after - before) / before * 100.0)
+
+regressions = []
+for name in sorted(set(baseline) & set(current)):
+    b, c = baseline[name], current[name]
+    if c['status'] != 0:
+        if b['status'] == 0: regressions.append(name + ': fails now')
+        print('%-60s FAILED' % name)
+        continue
+    if b['status'] != 0:
+        print('%-60s fixed' % name)
+        continue
+    flag = ' REGRESSION' if regressed(b['total'], c['total']) else ''
+    print('%-60s %10.1f -> %10.1f ms %s%s' % (name, b['total'], c['total'], change(b['total'], c['total']), flag))
+    if flag: regressions.append('%s: total %s' % (name, change(b['total'], c['total']).strip()))
+    for phase in sorted(set(b['phases']) & set(c['phases'])):
+        before, after = b['phases'][phase], c['phases'][phase]
+        flag = ' REGRESSION' if regressed(before, after) else ''
+        print('  %-58s %10.1f -> %10.1f ms %s%s' % (phase, before, after, change(before, after), flag))
+        if flag: regressions.append('%s: %s %s' % (name, phase, change(before, after).strip()))
+
+for name in sorted(set(baseline) - set(current)): print('%-60s only in baseline' % name)
+for name in sorted(set(current) - set(baseline)): print('%-60s only in current' % name)
+
+if regressions:
+    print('\n%d regression(s):' % len(regressions))
+    for r in regressions: print('  ' + r)
+    sys.exit(1)
+print('\nNo regressions.')
+sys.exit(0)
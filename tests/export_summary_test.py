@@ -0,0 +1,272 @@
+#!/usr/bin/env python
+
+# Export summary test
+#
+#
+# Usage: <script> <inputfile> --openscad=<executable-path> [--format=<format>] [--runs=<n>] [--cache-dir]
+#                 [--batch | --serve] [--retval=<n>] [<openscad args>] file.txt
+#
+#
+# step 1. Run OpenSCAD on the input file n times (default 1), exporting to the
+#         given format. With --cache-dir, the runs share a persistent geometry
+#         cache in a fresh directory, so the later runs read what the first wrote.
+#         With --batch, the input file is a manifest for --batch instead, and
+#         with --serve, a file of requests for --serve, one per line. In both,
+#         {dir} stands for the directory of the input file and {out} for the
+#         directory the exports go to.
+# step 2. Fail unless OpenSCAD returned the given value (default 0).
+# step 3. Summarize each exported file: its contents in terms which don't
+#         depend on the platform, e.g. the number of triangles of each color
+#         and the bounding box, rounded. Runs exporting several files, like
+#         those of --slice-heights, --sweep and --batch, get a summary per file.
+# step 4. Fail if the summaries of the runs differ, else write it to file.txt.
+# step 5. (done in CTest) - compare the summary to the expected one.
+#
+# This script should return 0 on success, not-0 on error.
+
+from __future__ import print_function
+
+import sys, os, re, subprocess, argparse, shutil, tempfile, struct, json
+import xml.etree.ElementTree as ET
+from zipfile import ZipFile
+
+def failquit(*args):
+    if len(args)!=0: print(args)
+    print('export_summary_test args:',str(sys.argv))
+    print('exiting export_summary_test.py with failure')
+    sys.exit(1)
+
+def rounded(x):
+    s = '%.4f' % x
+    s = s.rstrip('0').rstrip('.')
+    return '0' if s == '-0' else s
+
+def bbox_line(points):
+    if not points: return 'bounding box: empty'
+    lo = [min(p[i] for p in points) for i in range(len(points[0]))]
+    hi = [max(p[i] for p in points) for i in range(len(points[0]))]
+    return 'bounding box: [' + ', '.join(rounded(x) for x in lo) + '] - [' + ', '.join(rounded(x) for x in hi) + ']'
+
+def distinct(points):
+    return len(set(tuple(rounded(x) for x in p) for p in points))
+
+def localname(element):
+    return element.tag.split('}')[-1]
+
+def children(element, name):
+    return [child for child in element if localname(child) == name]
+
+def descendants(element, name):
+    return [child for child in element.iter() if localname(child) == name]
+
+def summarize_3mf(filename):
+    model = ET.fromstring(ZipFile(filename).read('3D/3dmodel.model'))
+    lines = []
+    for materials in descendants(model, 'basematerials'):
+        for i, base in enumerate(children(materials, 'base')):
+            lines.append('material %d: %s' % (i, base.get('displaycolor')))
+    for obj in descendants(model, 'object'):
+        vertices = [tuple(float(v.get(c)) for c in 'xyz') for v in descendants(obj, 'vertex')]
+        triangles = descendants(obj, 'triangle')
+        material = obj.get('pindex')
+        lines.append('object "%s": %d vertices, %d triangles, material %s' %
+                     (obj.get('name'), len(vertices), len(triangles), material if material is not None else 'none'))
+        counts = {}
+        for t in triangles:
+            key = t.get('p1', 'object')
+            counts[key] = counts.get(key, 0) + 1
+        for key in sorted(counts):
+            lines.append(' %d triangles of material %s' % (counts[key], key))
+        lines.append(' ' + bbox_line(vertices))
+    lines.append('build items: %d' % len(descendants(model, 'item')))
+    return lines
+
+def summarize_amf(filename):
+    amf = ET.parse(filename).getroot()
+    lines = []
+    for material in children(amf, 'material'):
+        color = material.find('color')
+        rgba = ' '.join(color.find(c).text.strip() if color.find(c) is not None else '-' for c in 'rgba')
+        lines.append('material %s: %s' % (material.get('id'), rgba))
+    for obj in children(amf, 'object'):
+        vertices = [tuple(float(v.find('coordinates').find(c).text) for c in 'xyz') for v in descendants(obj, 'vertex')]
+        volumes = descendants(obj, 'volume')
+        lines.append('object %s: %d vertices, %d volumes' % (obj.get('id'), len(vertices), len(volumes)))
+        for volume in volumes:
+            lines.append(' volume of material %s: %d triangles' %
+                         (volume.get('materialid', 'none'), len(children(volume, 'triangle'))))
+        lines.append(' ' + bbox_line(vertices))
+    return lines
+
+# Binary STL is told apart by its size, as its header may start with "solid" too
+def summarize_stl(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+    if len(data) >= 84 and len(data) == 84 + 50 * struct.unpack('<I', data[80:84])[0]:
+        kind = 'binary'
+        count = struct.unpack('<I', data[80:84])[0]
+        vertices = []
+        for i in range(count):
+            values = struct.unpack('<12f', data[84 + 50 * i:84 + 50 * i + 48])
+            vertices += [values[3:6], values[6:9], values[9:12]]
+    else:
+        kind = 'ASCII'
+        vertices = [tuple(float(x) for x in m.groups()) for m in
+                    re.finditer(r'vertex\s+(\S+)\s+(\S+)\s+(\S+)', data.decode('utf-8'))]
+    return ['%s STL: %d triangles, %d vertices' % (kind, len(vertices) // 3, distinct(vertices)),
+            bbox_line(vertices)]
+
+def summarize_off(filename):
+    with open(filename) as f:
+        tokens = f.read().split()
+    if not tokens or tokens[0] != 'OFF': failquit('not an OFF file: ' + filename)
+    numvertices, numfaces = int(tokens[1]), int(tokens[2])
+    values = [float(x) for x in tokens[4:4 + 3 * numvertices]]
+    vertices = [tuple(values[3 * i:3 * i + 3]) for i in range(numvertices)]
+    return ['OFF: %d vertices, %d faces' % (numvertices, numfaces), bbox_line(vertices)]
+
+def summarize_osmesh(filename):
+    with open(filename, 'rb') as f:
+        data = f.read()
+    if data[:6] != b'OSMESH': failquit('not an osmesh file: ' + filename)
+    numobjects = struct.unpack('<I', data[8:12])[0]
+    lines = []
+    pos = 12
+    for i in range(numobjects):
+        hascolor = struct.unpack('<B', data[pos:pos + 1])[0] & 1
+        pos += 1
+        color = 'none'
+        if hascolor:
+            color = ' '.join(rounded(c) for c in struct.unpack('<4f', data[pos:pos + 16]))
+            pos += 16
+        numvertices, numfaces = struct.unpack('<QQ', data[pos:pos + 16])
+        pos += 16
+        values = struct.unpack('<%dd' % (3 * numvertices), data[pos:pos + 24 * numvertices])
+        pos += 24 * numvertices
+        facesizes = struct.unpack('<%dI' % numfaces, data[pos:pos + 4 * numfaces])
+        pos += 4 * numfaces + 4 * sum(facesizes)
+        vertices = [tuple(values[3 * j:3 * j + 3]) for j in range(numvertices)]
+        lines.append('object %d: %d vertices, %d faces, color %s' % (i, numvertices, numfaces, color))
+        lines.append(' ' + bbox_line(vertices))
+    return lines
+
+# The outlines of each layer, with y pointing up again
+def summarize_svg(filename):
+    def label(element):
+        return next((v for k, v in element.attrib.items() if k.endswith('}label')), None)
+    svg = ET.parse(filename).getroot()
+    layers = [g for g in descendants(svg, 'g') if label(g)] or [svg]
+    lines = []
+    for layer in layers:
+        outlines = 0
+        points = []
+        for path in descendants(layer, 'path'):
+            d = path.get('d')
+            outlines += d.count('M')
+            points += [(float(x), -float(y)) for x, y in re.findall(r'([-\d.e+]+),([-\d.e+]+)', d)]
+        lines.append('layer %s: %d outlines, %d points' % (label(layer) or 'none', outlines, len(points)))
+        lines.append(' ' + bbox_line(points))
+    return lines
+
+def summarize(filename):
+    format = os.path.splitext(filename)[1][1:].lower()
+    summarizer = globals().get('summarize_' + format)
+    if not summarizer: failquit('no summary for format ' + format)
+    return summarizer(filename)
+
+def expand(template, inputdir, outputdir, quote):
+    return template.replace('{dir}', quote(inputdir)).replace('{out}', quote(outputdir))
+
+#
+# Parse arguments
+#
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+parser.add_argument('--format', help='Specify the export format, which is also the suffix of the exported file')
+parser.add_argument('--runs', type=int, default=1, help='Export the file this many times, expecting the same result')
+parser.add_argument('--cache-dir', dest='cachedir', action='store_true', help='Share a persistent geometry cache between the runs')
+parser.add_argument('--batch', action='store_true', help='The input file is a manifest of jobs for --batch')
+parser.add_argument('--serve', action='store_true', help='The input file has a request for --serve per line')
+parser.add_argument('--retval', type=int, default=0, help='The expected return value of OpenSCAD')
+args,remaining_args = parser.parse_known_args()
+
+inputfile = remaining_args[0]
+summaryfile = remaining_args[-1]
+remaining_args = remaining_args[1:-1] # Passed on to the OpenSCAD executable
+
+if not os.path.exists(inputfile):
+    failquit('cant find input file named: ' + inputfile)
+if not os.path.exists(args.openscad):
+    failquit('cant find openscad executable named: ' + args.openscad)
+if not args.format and not args.batch and not args.serve:
+    failquit('no --format given')
+
+inputdir = os.path.dirname(os.path.abspath(inputfile))
+inputbasename = os.path.splitext(os.path.split(inputfile)[1])[0]
+cachedir = tempfile.mkdtemp(prefix='openscad-cache-') if args.cachedir else None
+workdir = tempfile.mkdtemp(prefix='openscad-export-')
+
+def run(outputdir):
+    lines = []
+    stdin = None
+    if args.batch:
+        with open(inputfile) as f:
+            manifest = expand(f.read(), inputdir, outputdir, lambda path: path)
+        manifestfile = os.path.join(workdir, inputbasename + '.manifest')
+        with open(manifestfile, 'w') as f:
+            f.write(manifest)
+        export_cmd = [args.openscad, '--batch', manifestfile] + remaining_args
+    elif args.serve:
+        with open(inputfile) as f:
+            stdin = expand(f.read(), inputdir, outputdir, lambda path: json.dumps(path)[1:-1]).encode('utf-8')
+        export_cmd = [args.openscad, '--serve'] + remaining_args
+    else:
+        exportfile = os.path.join(outputdir, '%s.%s' % (inputbasename, args.format))
+        export_cmd = [args.openscad, inputfile, '-o', exportfile] + remaining_args
+    if cachedir: export_cmd.append('--cache-dir=' + cachedir)
+    print(' '.join(export_cmd), file=sys.stderr)
+    proc = subprocess.Popen(export_cmd, stdin=subprocess.PIPE if stdin else None, stdout=subprocess.PIPE if stdin else None)
+    output = proc.communicate(stdin)[0]
+    if proc.returncode != args.retval:
+        failquit('OpenSCAD returned %d instead of %d' % (proc.returncode, args.retval))
+
+    # Responses are a JSON line followed by the exported bytes
+    while args.serve and output:
+        line, _, output = output.partition(b'\n')
+        if not line.strip(): continue
+        response = json.loads(line.decode('utf-8'))
+        size = int(response['size'])
+        data, output = output[:size], output[size:]
+        lines.append('response %s: %s, %s' % (response['id'], response['status'], 'output' if size else 'no output'))
+        if size:
+            suffix = {'binstl': 'stl', 'zipamf': 'amf'}.get(response['format'], response['format'])
+            with open(os.path.join(outputdir, '%s.%s' % (response['id'], suffix)), 'wb') as f:
+                f.write(data)
+
+    files = sorted(os.listdir(outputdir))
+    if not files: failquit('OpenSCAD exported nothing')
+    if args.format and files == ['%s.%s' % (inputbasename, args.format)]:
+        return lines + summarize(os.path.join(outputdir, files[0]))
+    for name in files:
+        lines.append('file %s:' % name)
+        lines += [' ' + line for line in summarize(os.path.join(outputdir, name))]
+    return lines
+
+summaries = []
+try:
+    for i in range(args.runs):
+        print('Running OpenSCAD #%d:' % (i + 1), file=sys.stderr)
+        outputdir = os.path.join(workdir, 'run%d' % i)
+        os.mkdir(outputdir)
+        summaries.append(run(outputdir))
+finally:
+    if cachedir: shutil.rmtree(cachedir, ignore_errors=True)
+    shutil.rmtree(workdir, ignore_errors=True)
+
+for i in range(1, len(summaries)):
+    if summaries[i] != summaries[0]:
+        failquit('The export of run %d differs from the first:\n%s\n%s' %
+                 (i + 1, '\n'.join(summaries[0]), '\n'.join(summaries[i])))
+
+with open(summaryfile, 'w') as f:
+    f.write('\n'.join(summaries[0]) + '\n')
@@ -0,0 +1,169 @@
+/*
+	Micro-benchmarks of the interpreter: the evaluation of typical numeric
+	workloads, written as scripts of several sizes, and the Value operations
+	they spend their time in. The allocations per run show what the
+	ValuePtr and Context changes save besides the time.
+
+	Usage: interpbench [--filter=substring] [--min-time=seconds] [--json=file]
+*/
+
+#include "benchmark-common.h"
+#include "tests-common.h"
+#include "openscad.h"
+#include "parsersettings.h"
+#include "printutils.h"
+#include "builtin.h"
+#include "builtincontext.h"
+#include "modcontext.h"
+#include "FileModule.h"
+#include "ModuleInstantiation.h"
+#include "FunctionCache.h"
+#include "ModuleCallCache.h"
+#include "node.h"
+#include "value.h"
+#include "stackcheck.h"
+#include "PlatformUtils.h"
+
+#include <boost/filesystem.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+std::string commandline_commands;
+std::string currentdir;
+
+namespace {
+	struct Workload {
+		const char *name;
+		std::vector<size_t> sizes;
+		// Is prefixed with N = size;
+		const char *script;
+	};
+
+	const std::vector<Workload> workloads{
+		{"recursion", {15, 20},
+		 "function fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2);\n"
+		 "r = fib(N);\n"},
+		{"tail-recursion", {1000, 100000},
+		 "function sum(n, acc = 0) = n <= 0 ? acc : sum(n - 1, acc + n);\n"
+		 "r = sum(N);\n"},
+		{"list-comprehension", {1000, 100000},
+		 "r = [for (i = [0:N - 1]) if (i % 3 != 0) let (x = i * i) [i, x, sin(i)]];\n"},
+		{"concat", {100, 2000},
+		 "function acc(n, v = []) = n == 0 ? v : acc(n - 1, concat(v, [n]));\n"
+		 "r = acc(N);\n"},
+		{"matrix-multiplication", {4, 32},
+		 "m = [for (i = [0:N - 1]) [for (j = [0:N - 1]) (i + 1) / (j + 1)]];\n"
+		 "r = m * m * m;\n"},
+		{"search", {100, 1000},
+		 "table = [for (i = [0:N - 1]) [str(\"key\", i), i]];\n"
+		 "r = [for (i = [0:N - 1]) search([str(\"key\", (i * 7) % N)], table)];\n"},
+		{"str", {100, 2000},
+		 "function build(n, s = \"\") = n == 0 ? s : build(n - 1, str(s, n % 10, \",\"));\n"
+		 "r = build(N);\n"},
+	};
+
+	/*!
+		Evaluates the top-level assignments of the parsed script once, as
+		the first compile after a change does, so the function and module
+		call caches are cleared first.
+	*/
+	void evaluate(const FileModule &module, const BuiltinContext &top_ctx)
+	{
+		FunctionCache::instance()->clear();
+		ModuleCallCache::instance()->clear();
+		ModuleInstantiation root_inst("group");
+		FileContext filectx(&top_ctx);
+		delete module.instantiateWithFileContext(&filectx, &root_inst, nullptr);
+	}
+
+	void benchScripts(const fs::path &tmpdir)
+	{
+		BuiltinContext top_ctx;
+		for (const auto &workload : workloads) {
+			for (size_t size : workload.sizes) {
+				const auto filename = (tmpdir / (std::string(workload.name) + ".scad")).string();
+				{
+					std::ofstream file(filename.c_str());
+					file << "N = " << size << ";\n" << workload.script;
+				}
+				std::unique_ptr<FileModule> module(parsefile(filename.c_str()));
+				if (!module) {
+					std::cerr << "Can't parse the " << workload.name << " workload\n";
+					continue;
+				}
+				Benchmark::run(std::string("evaluate/") + workload.name, size, [&]() {
+					evaluate(*module, top_ctx);
+				});
+			}
+		}
+	}
+
+	ValuePtr matrix(size_t n)
+	{
+		Value::VectorType rows;
+		for (size_t i = 0; i < n; ++i) {
+			Value::VectorType row;
+			for (size_t j = 0; j < n; ++j) row.emplace_back(double(i + 1) / (j + 1));
+			rows.emplace_back(std::move(row));
+		}
+		return ValuePtr(std::move(rows));
+	}
+
+	void benchValues()
+	{
+		for (size_t n : {4, 32}) {
+			const auto m = matrix(n);
+			Benchmark::run("ValuePtr::operator*/matrix", n, [&]() {
+				const auto r = m * m;
+			});
+			Value::VectorType column;
+			for (size_t i = 0; i < n; ++i) column.emplace_back(double(i));
+			const ValuePtr v(std::move(column));
+			Benchmark::run("ValuePtr::operator*/matrix-vector", n, [&]() {
+				const auto r = m * v;
+			});
+			Benchmark::run("ValuePtr::operator+/matrix", n, [&]() {
+				const auto r = m + m;
+			});
+		}
+		for (size_t n : {10, 1000}) {
+			Value::VectorType elements;
+			for (size_t i = 0; i < n; ++i) elements.emplace_back(double(i));
+			const ValuePtr v(std::move(elements));
+			Benchmark::run("ValuePtr::operator[]", n, [&]() {
+				for (size_t i = 0; i < n; ++i) const auto e = v[ValuePtr(double(i))];
+			});
+			Benchmark::run("Value::toString/vector", n, [&]() {
+				const auto s = v->toString();
+			});
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	StackCheck::inst();
+	int exitcode;
+	if (!Benchmark::init(argc, argv, exitcode)) return exitcode;
+
+	Builtins::instance()->initialize();
+	currentdir = fs::current_path().generic_string();
+	PlatformUtils::registerApplicationPath(fs::absolute(fs::path(argv[0]).parent_path()).generic_string());
+	parser_init();
+
+	const auto tmpdir = fs::temp_directory_path() / fs::unique_path("interpbench-%%%%-%%%%");
+	fs::create_directories(tmpdir);
+
+	benchScripts(tmpdir);
+	benchValues();
+
+	fs::remove_all(tmpdir);
+	Builtins::instance(true);
+	return Benchmark::finish();
+}
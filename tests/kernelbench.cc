@@ -0,0 +1,420 @@
+/*
+	Micro-benchmarks of the geometry kernels, with synthetic inputs of
+	several sizes, so the 2D, 3D, tessellation and file format code can be
+	timed (and different implementations compared) without the evaluator.
+
+	Usage: kernelbench [--filter=substring] [--min-time=seconds] [--json=file]
+*/
+
+#include "benchmark-common.h"
+#include "openscad.h"
+#include "printutils.h"
+#include "Polygon2d.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "GeometryUtils.h"
+#include "Reindexer.h"
+#include "grid.h"
+#include "TriangleBVH.h"
+#include "clipper-utils.h"
+#include "export.h"
+#include "import.h"
+#include "CGAL_Nef_polyhedron.h"
+#include "cgalutils.h"
+#include "degree_trig.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+
+std::string commandline_commands;
+std::string currentdir;
+
+extern PolySet *import_amf(std::string, const Location &loc);
+extern Geometry *import_3mf(const std::string &, const Location &loc);
+
+namespace {
+	// A star with n points, which has n reflex vertices
+	Outline2d star(size_t n, double r, double x = 0, double y = 0)
+	{
+		Outline2d outline;
+		for (size_t i = 0; i < 2 * n; ++i) {
+			const double phi = 180.0 * i / n, ri = i % 2 ? r / 2 : r;
+			outline.vertices.emplace_back(x + ri * cos_degrees(phi), y + ri * sin_degrees(phi));
+		}
+		return outline;
+	}
+
+	Outline2d circle(size_t n, double r, double x = 0, double y = 0)
+	{
+		Outline2d outline;
+		for (size_t i = 0; i < n; ++i) {
+			const double phi = 360.0 * i / n;
+			outline.vertices.emplace_back(x + r * cos_degrees(phi), y + r * sin_degrees(phi));
+		}
+		return outline;
+	}
+
+	shared_ptr<Polygon2d> polygon(const Outline2d &outline)
+	{
+		auto poly = make_shared<Polygon2d>();
+		poly->addOutline(outline);
+		poly->setSanitized(true);
+		return poly;
+	}
+
+	// n overlapping circles along a spiral
+	std::vector<shared_ptr<Polygon2d>> circles(size_t n)
+	{
+		std::vector<shared_ptr<Polygon2d>> polys;
+		for (size_t i = 0; i < n; ++i) {
+			const double phi = 37.0 * i, r = 2.0 * i;
+			polys.push_back(polygon(circle(64, 10, r * cos_degrees(phi), r * sin_degrees(phi))));
+		}
+		return polys;
+	}
+
+	std::vector<const Polygon2d *> pointers(const std::vector<shared_ptr<Polygon2d>> &polys)
+	{
+		std::vector<const Polygon2d *> result;
+		for (const auto &poly : polys) result.push_back(poly.get());
+		return result;
+	}
+
+	// A closed prism over the given outline, with n-gon caps
+	PolySet *prism(const Outline2d &outline, double h)
+	{
+		auto ps = new PolySet(3);
+		const auto &v = outline.vertices;
+		const size_t n = v.size();
+		ps->append_poly();
+		for (size_t i = n; i-- > 0;) ps->append_vertex(v[i][0], v[i][1], 0);
+		ps->append_poly();
+		for (size_t i = 0; i < n; ++i) ps->append_vertex(v[i][0], v[i][1], h);
+		for (size_t i = 0; i < n; ++i) {
+			const size_t j = (i + 1) % n;
+			ps->append_poly();
+			ps->append_vertex(v[i][0], v[i][1], 0);
+			ps->append_vertex(v[j][0], v[j][1], 0);
+			ps->append_vertex(v[j][0], v[j][1], h);
+			ps->append_vertex(v[i][0], v[i][1], h);
+		}
+		return ps;
+	}
+
+	// A UV sphere with the given number of fragments around, of triangles
+	PolySet *sphere(int fragments, double r, const Vector3d &center = Vector3d::Zero())
+	{
+		auto ps = new PolySet(3, true);
+		const int rings = (fragments + 1) / 2;
+		auto point = [&](int ring, int i) {
+			const double phi = 180.0 * ring / rings, theta = 360.0 * i / fragments;
+			return Vector3d(center[0] + r * sin_degrees(phi) * cos_degrees(theta),
+											center[1] + r * sin_degrees(phi) * sin_degrees(theta),
+											center[2] + r * cos_degrees(phi));
+		};
+		for (int ring = 0; ring < rings; ++ring) {
+			for (int i = 0; i < fragments; ++i) {
+				const int j = (i + 1) % fragments;
+				if (ring > 0) ps->append_poly({point(ring, i), point(ring + 1, j), point(ring, j)});
+				if (ring < rings - 1) ps->append_poly({point(ring, i), point(ring + 1, i), point(ring + 1, j)});
+			}
+		}
+		return ps;
+	}
+
+	// n overlapping spheres along a helix
+	Geometry::Geometries spheres(size_t n, int fragments, bool nef)
+	{
+		Geometry::Geometries children;
+		for (size_t i = 0; i < n; ++i) {
+			const double phi = 60.0 * i;
+			shared_ptr<const Geometry> ps(sphere(fragments, 10, Vector3d(8 * cos_degrees(phi), 8 * sin_degrees(phi), 3.0 * i)));
+			if (nef) ps.reset(CGALUtils::createNefPolyhedronFromGeometry(*ps));
+			children.push_back(std::make_pair(nullptr, ps));
+		}
+		return children;
+	}
+
+	void bench2d()
+	{
+		for (size_t n : {2, 8, 32, 128}) {
+			const auto polys = circles(n);
+			const auto operands = pointers(polys);
+			Benchmark::run("ClipperUtils::apply/union", n, [&]() {
+				delete ClipperUtils::apply(operands, ClipperLib::ctUnion);
+			});
+			Benchmark::run("ClipperUtils::apply/difference", n, [&]() {
+				delete ClipperUtils::apply(operands, ClipperLib::ctDifference);
+			});
+			Benchmark::run("ClipperUtils::apply/intersection", n, [&]() {
+				delete ClipperUtils::apply(operands, ClipperLib::ctIntersection);
+			});
+		}
+		// The arc tolerance of offset(r = 1, $fn = 32)
+		const double arc_tolerance = 1 - cos_degrees(180.0 / 32);
+		for (size_t n : {64, 256, 1024}) {
+			const auto poly = polygon(star(n, 100));
+			Benchmark::run("ClipperUtils::applyOffset/round", n, [&]() {
+				delete ClipperUtils::applyOffset(*poly, 1.0, ClipperLib::jtRound, 2.0, arc_tolerance);
+			});
+			Benchmark::run("ClipperUtils::applyOffset/miter", n, [&]() {
+				delete ClipperUtils::applyOffset(*poly, 1.0, ClipperLib::jtMiter, 2.0, arc_tolerance);
+			});
+		}
+		for (size_t n : {8, 32, 128}) {
+			const auto a = polygon(star(n, 100)), b = polygon(circle(32, 5));
+			const std::vector<const Polygon2d *> operands{a.get(), b.get()};
+			Benchmark::run("ClipperUtils::applyMinkowski", n, [&]() {
+				delete ClipperUtils::applyMinkowski(operands);
+			});
+		}
+	}
+
+	void bench3d()
+	{
+		for (int fragments : {16, 32, 64}) {
+			const shared_ptr<const PolySet> ps(sphere(fragments, 10));
+			Benchmark::run("CGALUtils::createNefPolyhedronFromGeometry", fragments, [&]() {
+				delete CGALUtils::createNefPolyhedronFromGeometry(*ps);
+			});
+		}
+		for (int fragments : {16, 64}) {
+			const std::unique_ptr<PolySet> ps(sphere(fragments, 10));
+			const shared_ptr<const Geometry> N(CGALUtils::createNefPolyhedronFromGeometry(*ps));
+			Benchmark::run("export_nef3", fragments, [&]() {
+				std::ostringstream out;
+				export_nef3(N, out);
+			});
+			const auto &p3 = *static_cast<const CGAL_Nef_polyhedron &>(*N).p3;
+			Benchmark::run("CGALUtils::writeNefPolyhedron", fragments, [&]() {
+				std::ostringstream out(std::ios::out | std::ios::binary);
+				CGALUtils::writeNefPolyhedron(out, p3);
+			});
+			std::ostringstream out(std::ios::out | std::ios::binary);
+			CGALUtils::writeNefPolyhedron(out, p3);
+			const std::string data = out.str();
+			Benchmark::run("CGALUtils::readNefPolyhedron", fragments, [&]() {
+				const char *begin = data.data();
+				delete CGALUtils::readNefPolyhedron(begin, data.data() + data.size());
+			});
+		}
+		for (size_t n : {2, 4, 8, 16}) {
+			const auto children = spheres(n, 16, true);
+			Benchmark::run("CGALUtils::applyOperator/union", n, [&]() {
+				delete CGALUtils::applyOperator(children, OpenSCADOperator::UNION);
+			});
+			Benchmark::run("CGALUtils::applyOperator/difference", n, [&]() {
+				delete CGALUtils::applyOperator(children, OpenSCADOperator::DIFFERENCE);
+			});
+			Benchmark::run("CGALUtils::applyOperator/intersection", n, [&]() {
+				delete CGALUtils::applyOperator(children, OpenSCADOperator::INTERSECTION);
+			});
+		}
+		for (size_t n : {2, 16, 128}) {
+			const auto children = spheres(n, 32, false);
+			Benchmark::run("CGALUtils::applyHull", n, [&]() {
+				PolySet result(3, true);
+				CGALUtils::applyHull(children, result);
+			});
+		}
+		for (int fragments : {8, 16, 32}) {
+			Geometry::Geometries convex;
+			convex.push_back(std::make_pair(nullptr, shared_ptr<const Geometry>(prism(circle(fragments, 20), 10))));
+			convex.push_back(std::make_pair(nullptr, shared_ptr<const Geometry>(sphere(fragments, 2))));
+			Benchmark::run("CGALUtils::applyMinkowski/convex", fragments, [&]() {
+				delete CGALUtils::applyMinkowski(convex);
+			});
+			// The star prism is decomposed into a part for each point
+			Geometry::Geometries nonconvex;
+			nonconvex.push_back(std::make_pair(nullptr, shared_ptr<const Geometry>(prism(star(fragments, 20), 10))));
+			nonconvex.push_back(std::make_pair(nullptr, shared_ptr<const Geometry>(sphere(16, 2))));
+			Benchmark::run("CGALUtils::applyMinkowski/nonconvex", fragments, [&]() {
+				delete CGALUtils::applyMinkowski(nonconvex);
+			});
+		}
+		for (int fragments : {32, 256}) {
+			const std::unique_ptr<PolySet> ps(sphere(fragments, 10));
+			Benchmark::run("PolysetUtils::is_approximately_convex", fragments, [&]() {
+				PolysetUtils::is_approximately_convex(*ps);
+			});
+		}
+	}
+
+	void benchTessellation()
+	{
+		for (size_t n : {64, 512, 4096}) {
+			const std::unique_ptr<PolySet> ps(prism(star(n, 100), 10));
+			Benchmark::run("PolysetUtils::tessellate_faces", n, [&]() {
+				PolySet result(3);
+				PolysetUtils::tessellate_faces(*ps, result);
+			});
+
+			// A star with a circular hole
+			std::vector<Vector3f> vertices;
+			std::vector<IndexedFace> faces(2);
+			for (const auto &v : star(n, 100).vertices) {
+				faces[0].push_back(vertices.size());
+				vertices.emplace_back(v[0], v[1], 0);
+			}
+			for (const auto &v : circle(n / 2, 25).vertices) {
+				faces[1].push_back(vertices.size());
+				vertices.emplace_back(v[0], v[1], 0);
+			}
+			std::reverse(faces[1].begin(), faces[1].end());
+			const Vector3f normal(0, 0, 1);
+			Benchmark::run("GeometryUtils::tessellatePolygonWithHoles", n, [&]() {
+				std::vector<IndexedTriangle> triangles;
+				GeometryUtils::tessellatePolygonWithHoles(vertices, faces, triangles, &normal);
+			});
+		}
+
+		// A pattern of pockets, i.e. translated copies of the star with a hole
+		for (size_t copies : {16, 1024}) {
+			std::vector<Vector3f> vertices;
+			std::vector<std::vector<IndexedFace>> polygons;
+			for (size_t c = 0; c < copies; ++c) {
+				const double x = 30.0 * (c % 32), y = 30.0 * (c / 32);
+				std::vector<IndexedFace> faces(2);
+				for (const auto &v : star(64, 10, x, y).vertices) {
+					faces[0].push_back(vertices.size());
+					vertices.emplace_back(v[0], v[1], 0);
+				}
+				for (const auto &v : circle(32, 2, x, y).vertices) {
+					faces[1].push_back(vertices.size());
+					vertices.emplace_back(v[0], v[1], 0);
+				}
+				std::reverse(faces[1].begin(), faces[1].end());
+				polygons.push_back(std::move(faces));
+			}
+			Benchmark::run("GeometryUtils::tessellatePolygonsWithHoles/repeated", copies, [&]() {
+				std::vector<IndexedTriangle> triangles;
+				GeometryUtils::tessellatePolygonsWithHoles(vertices, polygons, triangles);
+			});
+		}
+	}
+
+	// The vertex dedup and snapping of every mesh conversion
+	void benchHashing()
+	{
+		for (int fragments : {32, 256}) {
+			const std::unique_ptr<PolySet> ps(sphere(fragments, 10));
+			std::vector<Vector3f> points;
+			for (const auto &p : ps->polygons()) {
+				for (const auto &v : p) points.push_back(v.cast<float>());
+			}
+			Benchmark::run("Reindexer<Vector3f>::lookup", fragments, [&]() {
+				Reindexer<Vector3f> reindexer;
+				for (const auto &p : points) reindexer.lookup(p);
+			});
+			Benchmark::run("Grid3d::align", fragments, [&]() {
+				Grid3d<int> grid(GRID_FINE);
+				for (const auto &p : ps->polygons()) {
+					for (auto v : p) grid.align(v);
+				}
+			});
+			Benchmark::run("PolySet::quantizeVertices", fragments, [&]() {
+				PolySet copy(*ps);
+				copy.quantizeVertices();
+			});
+		}
+	}
+
+	void benchBVH()
+	{
+		for (int fragments : {32, 256}) {
+			const std::unique_ptr<PolySet> ps(sphere(fragments, 10));
+			Benchmark::run("TriangleBVH::TriangleBVH", fragments, [&]() {
+				TriangleBVH bvh(*ps);
+			});
+			const TriangleBVH bvh(*ps);
+			// Rays from all around through the sphere
+			Benchmark::run("TriangleBVH::intersectRay", fragments, [&]() {
+				TriangleBVH::Hit hit;
+				for (int i = 0; i < 100; ++i) {
+					const Vector3d origin(30 * cos_degrees(3.6 * i), 30 * sin_degrees(3.6 * i), i / 10.0 - 5);
+					bvh.intersectRay(origin, -origin, hit);
+				}
+			});
+			const std::unique_ptr<PolySet> other(sphere(fragments, 10, Vector3d(15, 0, 0)));
+			const TriangleBVH otherbvh(*other);
+			Benchmark::run("TriangleBVH::intersects", fragments, [&]() {
+				bvh.intersects(otherbvh);
+			});
+		}
+	}
+
+	void benchFormats(const fs::path &tmpdir)
+	{
+		typedef void (*Exporter)(const shared_ptr<const Geometry> &, std::ostream &);
+		const std::vector<std::pair<const char *, Exporter>> exporters3d{
+			{"stl", export_stl}, {"binstl", export_binstl}, {"off", export_off}, {"amf", export_amf},
+			{"3mf", export_3mf}, {"osmesh", export_osmesh}};
+		const std::vector<std::pair<const char *, Exporter>> exporters2d{
+			{"dxf", export_dxf}, {"svg", export_svg}};
+
+		for (int fragments : {32, 256}) {
+			const shared_ptr<const Geometry> ps(sphere(fragments, 10));
+			for (const auto &exporter : exporters3d) {
+				Benchmark::run(std::string("export/") + exporter.first, fragments, [&]() {
+					std::ostringstream output;
+					exporter.second(ps, output);
+				});
+				std::ofstream file((tmpdir / (std::string("sphere.") + exporter.first)).string().c_str(), std::ios::binary);
+				exporter.second(ps, file);
+			}
+			const auto stl = (tmpdir / "sphere.stl").string(), binstl = (tmpdir / "sphere.binstl").string();
+			const auto off = (tmpdir / "sphere.off").string(), amf = (tmpdir / "sphere.amf").string();
+			const auto _3mf = (tmpdir / "sphere.3mf").string(), osmesh = (tmpdir / "sphere.osmesh").string();
+			Benchmark::run("import/stl", fragments, [&]() { delete import_stl(stl, Location::NONE); });
+			Benchmark::run("import/binstl", fragments, [&]() { delete import_stl(binstl, Location::NONE); });
+			Benchmark::run("import/off", fragments, [&]() { delete import_off(off, Location::NONE); });
+			Benchmark::run("import/amf", fragments, [&]() { delete import_amf(amf, Location::NONE); });
+			Benchmark::run("import/3mf", fragments, [&]() { delete import_3mf(_3mf, Location::NONE); });
+			Benchmark::run("import/osmesh", fragments, [&]() { delete import_osmesh(osmesh, Location::NONE); });
+		}
+
+		for (size_t n : {64, 4096}) {
+			const shared_ptr<const Geometry> poly(polygon(star(n, 100)));
+			for (const auto &exporter : exporters2d) {
+				Benchmark::run(std::string("export/") + exporter.first, n, [&]() {
+					std::ostringstream output;
+					exporter.second(poly, output);
+				});
+			}
+			const auto svg = (tmpdir / "star.svg").string();
+			{
+				std::ofstream file(svg.c_str());
+				export_svg(poly, file);
+			}
+			Benchmark::run("import/svg", n, [&]() { delete import_svg(svg, 72.0, false, 0, 2, 12, Location::NONE); });
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int exitcode;
+	if (!Benchmark::init(argc, argv, exitcode)) return exitcode;
+
+	currentdir = fs::current_path().generic_string();
+	const auto tmpdir = fs::temp_directory_path() / fs::unique_path("kernelbench-%%%%-%%%%");
+	fs::create_directories(tmpdir);
+
+	bench2d();
+	bench3d();
+	benchTessellation();
+	benchHashing();
+	benchBVH();
+	benchFormats(tmpdir);
+
+	fs::remove_all(tmpdir);
+	return Benchmark::finish();
+}
@@ -15,6 +15,17 @@
 # on the system. (E.g. the C glyph is actually different from Debian/Jessie
 # installation and what we ship as Liberation-2.00.1).
 #
+# A test run with openscad may be given performance budgets with
+#
+#   --budget=total=20000,caches.geometry.misses=200,peak_memory=500M
+#
+# usually from the test_budgets() list in CMakeLists.txt.
+# Keys are dotted paths into the --summary-json output of the run (total and
+# the phases are in milliseconds), values are the maxima, with an optional
+# K, M or G suffix. A run exceeding a budget fails the test. The time budgets
+# are multiplied by the OPENSCAD_BUDGET_SCALE environment variable, if set,
+# for slower machines.
+#
 # Returns 0 on passed test
 #         1 on error
 #         2 on invalid cmd-line options
@@ -223,6 +234,42 @@ def post_process_3mf(filename):
     with open(filename, 'wb') as xml_file:
         xml_file.write(xml_content.encode('utf-8'))
 
+def parse_budgets(spec):
+    budgets = []
+    for item in re.split(r'[,\s]+', spec.strip()):
+        if not item: continue
+        key, _, value = item.partition("=")
+        scale = {'K': 1024, 'M': 1024**2, 'G': 1024**3}.get(value[-1:].upper(), 1)
+        if scale != 1: value = value[:-1]
+        budgets.append((key, float(value) * scale))
+    return budgets
+
+def check_budgets(summaryfilename, budgets):
+    import json
+    try:
+        with open(summaryfilename) as f:
+            summary = json.load(f)
+    except (IOError, ValueError) as err:
+        print("Error: can't read the summary %s: %s" % (summaryfilename, err), file=sys.stderr)
+        return False
+    timescale = float(os.getenv("OPENSCAD_BUDGET_SCALE", "1"))
+    result = True
+    for key, limit in budgets:
+        value = summary
+        for part in key.split("."):
+            value = value.get(part) if isinstance(value, dict) else None
+        if not isinstance(value, (int, float)):
+            print("Error: the summary has no figure '%s' for the budget" % key, file=sys.stderr)
+            result = False
+            continue
+        if key == "total" or key.startswith("phases."): limit *= timescale
+        if value > limit:
+            print("Error: %s is %g, over its budget of %g" % (key, value, limit), file=sys.stderr)
+            result = False
+        else:
+            print("%s is %g, within its budget of %g" % (key, value, limit), file=sys.stderr)
+    return result
+
 def run_test(testname, cmd, args):
     cmdname = os.path.split(options.cmd)[1]
 
@@ -244,8 +291,14 @@ def run_test(testname, cmd, args):
 
     outfile = open(outputname, "wb")
 
+    budgets = []
+    if not options.generate and cmdname.lower().startswith("openscad"):
+        budgets = parse_budgets(options.budget)
+    summaryfilename = os.path.join(actualdir, options.filename + "-summary.json")
+    summaryoption = ["--summary-json=" + summaryfilename] if budgets else []
+
     try:
-        cmdline = [cmd] + args + [outputname]
+        cmdline = [cmd] + summaryoption + args + [outputname]
         sys.stderr.flush()
         print('run_test() cmdline:', ' '.join(cmdline))
         fontdir = os.path.abspath(os.path.join(os.path.dirname(__file__), "..", "testdata/ttf"))
@@ -264,6 +317,8 @@ def run_test(testname, cmd, args):
         if proc.returncode != 0:
             print("Error: %s failed with return code %d" % (cmdname, proc.returncode), file=sys.stderr)
             return None
+        if budgets and not check_budgets(summaryfilename, budgets):
+            return None
 
         return outputname
     except (OSError) as err:
@@ -287,12 +342,13 @@ def usage():
     print("  -t, --test=<name>        Specify test name instead of deducting it from the argument (defaults to basename <exe>)", file=sys.stderr)
     print("  -f, --file=<name>        Specify test file instead of deducting it from the argument (default to basename <first arg>)", file=sys.stderr)
     print("  -c, --convexec=<name>    Path to ImageMagick 'convert' executable", file=sys.stderr)
+    print("  --budget=<key=max,...>   Fail if the run's --summary-json figures exceed the given budgets", file=sys.stderr)
 
 if __name__ == '__main__':
     # Handle command-line arguments
     try:
         debug('args:'+str(sys.argv))
-        opts, args = getopt.getopt(sys.argv[1:], "gs:e:c:t:f:m", ["generate", "convexec=", "suffix=", "expected_dir=", "test=", "file=", "comparator="])
+        opts, args = getopt.getopt(sys.argv[1:], "gs:e:c:t:f:m", ["generate", "convexec=", "suffix=", "expected_dir=", "test=", "file=", "comparator=", "budget="])
         debug('getopt args:'+str(sys.argv))
     except (getopt.GetoptError) as err:
         usage()
@@ -304,6 +360,7 @@ if __name__ == '__main__':
     options.generate = False
     options.suffix = "txt"
     options.comparator = ""
+    options.budget = ""
 
     for o, a in opts:
         if o in ("-g", "--generate"): options.generate = True
@@ -320,6 +377,8 @@ if __name__ == '__main__':
             options.comparison_exec = os.path.normpath( a )
         elif o in ("-m", "--comparator"):
             options.comparator = a
+        elif o == "--budget":
+            options.budget = a
 
     # <cmdline-tool> and <argument>
     if len(args) < 2: